@@ -401,6 +401,14 @@ void bind_alert()
         .def_readonly("info_hash", &dht_get_peers_alert::info_hash)
     ;
 
+    class_<dht_scrape_alert, bases<alert>, noncopyable>(
+        "dht_scrape_alert", no_init
+    )
+        .def_readonly("info_hash", &dht_scrape_alert::info_hash)
+        .def_readonly("num_seeds", &dht_scrape_alert::num_seeds)
+        .def_readonly("num_peers", &dht_scrape_alert::num_peers)
+    ;
+
     class_<peer_unsnubbed_alert, bases<peer_alert>, noncopyable>(
         "peer_unsnubbed_alert", no_init
     );
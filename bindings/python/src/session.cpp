@@ -537,7 +537,7 @@ void bind_session()
                 arg("fingerprint")=fingerprint("LT",0,1,0,0)
                 , arg("flags")=session::start_default_features | session::add_default_plugins))
         )
-        .def("post_torrent_updates", allow_threads(&session::post_torrent_updates))
+        .def("post_torrent_updates", allow_threads(&session::post_torrent_updates), arg("flags") = 0xffffffff)
         .def(
             "listen_on", &listen_on
           , (arg("min"), "max", arg("interface") = (char const*)0, arg("flags") = 0)
@@ -554,6 +554,7 @@ void bind_session()
         .def("set_dht_settings", allow_threads(&session::set_dht_settings))
         .def("start_dht", allow_threads(start_dht0))
         .def("stop_dht", allow_threads(&session::stop_dht))
+        .def("dht_scrape", allow_threads(&session::dht_scrape))
 #ifndef TORRENT_NO_DEPRECATE
         .def("start_dht", allow_threads(start_dht1))
         .def("dht_state", allow_threads(&session::dht_state))
@@ -335,6 +335,8 @@ void bind_torrent_handle()
         .def("remove_url_seed", _(&torrent_handle::remove_url_seed))
         .def("url_seeds", url_seeds)
         .def("get_torrent_info", _(&torrent_handle::get_torrent_info), return_internal_reference<>())
+        .def("pin_metadata", _(&torrent_handle::pin_metadata))
+        .def("unpin_metadata", _(&torrent_handle::unpin_metadata))
         .def("is_valid", _(&torrent_handle::is_valid))
         .def("pause", _(&torrent_handle::pause), arg("flags") = 0)
         .def("resume", _(&torrent_handle::resume))
@@ -1908,10 +1908,12 @@ int main(int argc, char* argv[]) {
         int c = 0;
 
 
-        std::deque<alert*> alerts;
+        // the alerts are owned by the session, and freed by the
+        // next call to pop_alerts()
+        std::vector<alert*> alerts;
         ses.pop_alerts(&alerts);
         std::string now = time_now_string();
-        for (std::deque<alert*>::iterator i = alerts.begin()
+        for (std::vector<alert*>::iterator i = alerts.begin()
                  , end(alerts.end()); i != end; ++i)
         {
             bool need_resort = false;
@@ -1933,10 +1935,7 @@ int main(int argc, char* argv[]) {
                 std::sort(filtered_handles.begin(), filtered_handles.end()
 					, &compare_torrent);
 			}
-
-			delete *i;
 		}
-		alerts.clear();
 
 		session_status sess_stat = ses.status();
 
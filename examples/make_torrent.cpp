@@ -39,6 +39,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/create_torrent.hpp"
 #include "libtorrent/file.hpp"
 #include "libtorrent/file_pool.hpp"
+#include "libtorrent/time.hpp"
 
 #include <boost/bind.hpp>
 
@@ -53,9 +54,10 @@ bool file_filter(std::string const& f)
 	return true;
 }
 
-void print_progress(int i, int num)
+bool print_progress(int i, int num)
 {
 	fprintf(stderr, "\r%d/%d", i+1, num);
+	return true;
 }
 
 void print_usage()
@@ -91,6 +93,9 @@ void print_usage()
 		"            where the filename defaults to a.torrent\n"
 		"-r file     add root certificate to the torrent, to verify\n"
 		"            the HTTPS tracker\n"
+		"-j threads  hash the pieces on the specified number of\n"
+		"            threads, while reading ahead. The time it took\n"
+		"            and the hashing rate are printed when done\n"
 		, stderr);
 }
 
@@ -116,6 +121,7 @@ int main(int argc, char* argv[])
 		int pad_file_limit = -1;
 		int piece_size = 0;
 		int flags = 0;
+		int num_threads = 0;
 		std::string root_cert;
 
 		std::string outfile;
@@ -180,6 +186,10 @@ int main(int argc, char* argv[])
 					++i;
 					root_cert = argv[i];
 					break;
+				case 'j':
+					++i;
+					num_threads = atoi(argv[i]);
+					break;
 				default:
 					print_usage();
 					return 1;
@@ -208,8 +218,17 @@ int main(int argc, char* argv[])
 			t.add_url_seed(*i);
 
 		error_code ec;
-		set_piece_hashes(t, parent_path(full_path)
-			, boost::bind(&print_progress, _1, t.num_pieces()), ec);
+		ptime start = time_now_hires();
+		if (num_threads > 0)
+		{
+			set_piece_hashes(t, parent_path(full_path)
+				, boost::bind(&print_progress, _1, t.num_pieces()), num_threads, ec);
+		}
+		else
+		{
+			set_piece_hashes(t, parent_path(full_path)
+				, boost::bind(&print_progress, _1, t.num_pieces()), ec);
+		}
 		if (ec)
 		{
 			fprintf(stderr, "%s\n", ec.message().c_str());
@@ -217,6 +236,14 @@ int main(int argc, char* argv[])
 		}
 
 		fprintf(stderr, "\n");
+		if (num_threads > 0)
+		{
+			double seconds = total_microseconds(time_now_hires() - start) / 1000000.;
+			fprintf(stderr, "hashed %.1f MB in %.2f s (%.1f MB/s) on %d threads\n"
+				, fs.total_size() / 1000000., seconds
+				, seconds > 0. ? fs.total_size() / 1000000. / seconds : 0.
+				, num_threads);
+		}
 		t.set_creator(creator_str.c_str());
 		if (!comment_str.empty())
 			t.set_comment(comment_str.c_str());
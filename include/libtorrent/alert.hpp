@@ -35,13 +35,16 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <memory>
 #include <deque>
+#include <vector>
 #include <string>
+#include <new> // for placement new
 
 #ifdef _MSC_VER
 #pragma warning(push, 1)
 #endif
 
 #include <boost/function/function1.hpp>
+#include <boost/type_traits/alignment_of.hpp>
 
 #include <boost/preprocessor/repetition/enum_params_with_a_default.hpp>
 #include <boost/preprocessor/repetition/enum.hpp>
@@ -134,21 +137,46 @@ namespace libtorrent {
 
 		void post_alert(const alert& alert_);
 		void post_alert_ptr(alert* alert_);
+
+		// posts a copy of a, constructed in place in the alert
+		// queue. This is picked over post_alert(alert const&)
+		// whenever the concrete type of the alert is known, and
+		// doesn't allocate memory once the queue has grown
+		template <class T>
+		void post_alert(T const& a)
+		{
+			notify_extensions(&a);
+
+			mutex::scoped_lock lock(m_mutex);
+			void* buf = allocate_alert(a, sizeof(T), boost::alignment_of<T>::value);
+			if (buf == 0) return;
+			commit_alert(new (buf) T(a));
+		}
+
 		bool pending() const;
 		std::auto_ptr<alert> get();
 		void get_all(std::deque<alert*>* alerts);
 
+		// hands over all queued alerts at once. The alerts are
+		// owned by the alert_manager and stay valid until the next
+		// call to get_batch()
+		void get_batch(std::vector<alert*>& alerts);
+
+		// this is called for every alert that may be posted. The queue
+		// size is updated by the client's thread, so the mutex is held
+		// while reading it
 		template <class T>
 		bool should_post() const
 		{
 			mutex::scoped_lock lock(m_mutex);
-			if (m_alerts.size() >= m_queue_size_limit) return false;
-			return (m_alert_mask & T::static_category) != 0;
+			if ((m_alert_mask & T::static_category) == 0) return false;
+			return m_queue_size < m_queue_size_limit;
 		}
 
 		bool should_post(alert const* a) const
 		{
-			return m_alert_mask & a->category();
+			mutex::scoped_lock lock(m_mutex);
+			return (m_alert_mask & a->category()) != 0;
 		}
 
 		alert const* wait_for_alert(time_duration max_wait);
@@ -159,9 +187,17 @@ namespace libtorrent {
 			m_alert_mask = m;
 		}
 
-		int alert_mask() const { return m_alert_mask; }
+		int alert_mask() const
+		{
+			mutex::scoped_lock lock(m_mutex);
+			return m_alert_mask;
+		}
 
-		size_t alert_queue_size_limit() const { return m_queue_size_limit; }
+		size_t alert_queue_size_limit() const
+		{
+			mutex::scoped_lock lock(m_mutex);
+			return m_queue_size_limit;
+		}
 		size_t set_alert_queue_size_limit(size_t queue_size_limit_);
 
 		void set_dispatch_function(boost::function<void(std::auto_ptr<alert>)> const&);
@@ -172,8 +208,82 @@ namespace libtorrent {
 
 	private:
 		void post_impl(std::auto_ptr<alert>& alert_);
+		void notify_extensions(alert const* a);
+
+		// returns memory for an alert of the given size in the
+		// current arena, or 0 if the alert should not be queued
+		// there. In that case it has already been dispatched or
+		// dropped. Must be called with m_mutex held
+		void* allocate_alert(alert const& a, int size, int alignment);
+
+		// queues an alert constructed in memory returned from
+		// allocate_alert(). Must be called with m_mutex held
+		void commit_alert(alert* a);
+
+		// moves the queued alerts out of the arena, into heap
+		// allocated alerts owned by the caller, and clears the
+		// arena. Must be called with m_mutex held
+		void take_pending(std::deque<alert*>& alerts);
+
+		// alerts constructed in place in a list of memory blocks.
+		// The blocks are kept when the alerts are cleared, so once
+		// the arena has grown to hold a typical batch of alerts,
+		// posting an alert doesn't allocate memory. Alerts posted as
+		// heap allocated pointers are queued here too, and owned
+		// by the arena until they're handed over
+		struct alert_arena
+		{
+			alert_arena(): m_block(0), m_used(0) {}
+			~alert_arena();
+
+			// returns 0 if the size doesn't fit in a block
+			void* allocate(int size, int alignment);
+
+			void push_back(alert* a, bool on_heap);
+
+			// if the alert at index i is heap allocated, the
+			// ownership is passed on to the caller. Otherwise
+			// 0 is returned
+			alert* release(int i);
+
+			// destructs all alerts, but keeps the memory blocks
+			void clear();
+
+			std::vector<alert*> const& alerts() const { return m_alerts; }
+			int size() const { return int(m_alerts.size()); }
+
+			enum { block_size = 64 * 1024 };
+
+		private:
+			std::vector<alert*> m_alerts;
+
+			// for every alert in m_alerts, true if it was allocated
+			// on the heap, rather than in one of the blocks
+			std::vector<bool> m_on_heap;
+
+			std::vector<char*> m_blocks;
+
+			// the block currently being filled, and the number of
+			// bytes used in it
+			int m_block;
+			int m_used;
+		};
+
+		// alerts are posted to m_arena[m_generation]. The other
+		// arena holds the last batch handed out by get_batch(),
+		// which is cleared by the next call to get_batch()
+		alert_arena m_arena[2];
+		int m_generation;
+
+		// the number of alerts in the current arena that have been
+		// taken by get(). Those are destructed when the arena is
+		// cleared
+		int m_read_pos;
+
+		// the number of alerts in the queue. Protected by m_mutex,
+		// like the mask and the queue size limit
+		size_t m_queue_size;
 
-		std::deque<alert*> m_alerts;
 		mutable mutex m_mutex;
 //		event m_condition;
 		boost::uint32_t m_alert_mask;
@@ -42,6 +42,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/address.hpp"
 #include "libtorrent/stat.hpp"
 #include "libtorrent/rss.hpp" // for feed_handle
+#include "libtorrent/performance_counters.hpp"
 
 // lines reserved for future includes
 // the type-ids of the alert types
@@ -1132,6 +1133,25 @@ namespace libtorrent
 		sha1_hash info_hash;
 	};
 
+	struct TORRENT_EXPORT dht_scrape_alert: alert
+	{
+		dht_scrape_alert(sha1_hash const& info_hash_
+			, int num_seeds_, int num_peers_)
+			: info_hash(info_hash_)
+			, num_seeds(num_seeds_)
+			, num_peers(num_peers_)
+		{}
+
+		TORRENT_DEFINE_ALERT(dht_scrape_alert);
+
+		const static int static_category = alert::dht_notification;
+		virtual std::string message() const;
+
+		sha1_hash info_hash;
+		int num_seeds;
+		int num_peers;
+	};
+
 	struct TORRENT_EXPORT stats_alert: torrent_alert
 	{
 		stats_alert(torrent_handle const& h, int interval
@@ -1333,6 +1353,34 @@ namespace libtorrent
 		std::vector<torrent_status> status;
 	};
 
+	struct TORRENT_EXPORT state_delta_alert : alert
+	{
+		TORRENT_DEFINE_ALERT(state_delta_alert);
+
+		const static int static_category = alert::status_notification;
+		virtual std::string message() const;
+		virtual bool discardable() const { return false; }
+
+		// one entry per torrent with at least one changed field
+		std::vector<torrent_delta> deltas;
+	};
+
+	struct TORRENT_EXPORT session_stats_alert : alert
+	{
+		session_stats_alert(counters const& cnt);
+
+		TORRENT_DEFINE_ALERT(session_stats_alert);
+
+		const static int static_category = alert::stats_notification;
+		virtual std::string message() const;
+		virtual bool discardable() const { return false; }
+
+		// the values of all counters and gauges, indexed by
+		// counters::stats_counter_t and counters::stats_gauge_t.
+		// Use session_stats_metrics() to map names to indices
+		boost::uint64_t values[counters::num_counters];
+	};
+
 #undef TORRENT_DEFINE_ALERT
 
 }
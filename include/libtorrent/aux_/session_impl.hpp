@@ -71,6 +71,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/add_torrent_params.hpp"
 #include "libtorrent/stat.hpp"
 #include "libtorrent/file_pool.hpp"
+#include "libtorrent/torrent_loader.hpp"
 #include "libtorrent/bandwidth_manager.hpp"
 #include "libtorrent/socket_type.hpp"
 #include "libtorrent/connection_queue.hpp"
@@ -85,8 +86,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/address.hpp"
 #include "libtorrent/utp_socket_manager.hpp"
 #include "libtorrent/bloom_filter.hpp"
+#include "libtorrent/timer_wheel.hpp"
 #include "libtorrent/rss.hpp"
 #include "libtorrent/alert_dispatcher.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/resolver.hpp"
 #include "libtorrent/kademlia/dht_observer.hpp"
 
 #if TORRENT_COMPLETE_TYPES_REQUIRED
@@ -97,13 +101,6 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/asio/ssl/context.hpp>
 #endif
 
-#if defined TORRENT_STATS && defined __MACH__
-#include <mach/vm_statistics.h>
-#include <mach/mach_init.h>
-#include <mach/host_info.h>
-#include <mach/mach_host.h>
-#endif
-
 namespace libtorrent
 {
 
@@ -150,25 +147,6 @@ namespace libtorrent
 	{
 		struct session_impl;
 
-#if defined TORRENT_STATS && !defined __MACH__
-		struct vm_statistics_data_t
-		{
-			boost::uint64_t active_count;
-			boost::uint64_t inactive_count;
-			boost::uint64_t wire_count;
-			boost::uint64_t free_count;
-			boost::uint64_t pageins;
-			boost::uint64_t pageouts;
-			boost::uint64_t faults;
-		};
-#endif
-
-		struct thread_cpu_usage
-		{
-			ptime user_time;
-			ptime system_time;
-		};
-
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
 		struct tracker_logger;
 #endif
@@ -299,6 +277,9 @@ namespace libtorrent
 			void start_dht();
 			void stop_dht();
 			void start_dht(entry const& startup_state);
+			void dht_scrape(sha1_hash const& info_hash);
+			void on_dht_scrape(sha1_hash const& info_hash
+				, int num_seeds, int num_peers);
 
 			// this is called for torrents when they are started
 			// it will prioritize them for announcing to
@@ -348,8 +329,13 @@ namespace libtorrent
 			bool is_listening() const;
 
 			torrent_handle add_torrent(add_torrent_params const&, error_code& ec);
-			torrent_handle add_torrent_impl(add_torrent_params const&, error_code& ec);
+			// resume is the resume data, if it's already been decoded.
+			// The torrent takes it over
+			torrent_handle add_torrent_impl(add_torrent_params const&, error_code& ec
+				, bdecode_node* resume = 0);
 			void async_add_torrent(add_torrent_params* params);
+			void async_add_torrents(std::vector<boost::shared_ptr<loaded_torrent> > const& torrents);
+			void on_torrent_loaded(boost::shared_ptr<loaded_torrent> const& t);
 
 			void remove_torrent(torrent_handle const& h, int options);
 			void remove_torrent_impl(boost::shared_ptr<torrent> tptr, int options);
@@ -359,17 +345,49 @@ namespace libtorrent
 				, boost::uint32_t flags) const;
 			void refresh_torrent_status(std::vector<torrent_status>* ret
 				, boost::uint32_t flags) const;
-			void post_torrent_updates();
+			void post_torrent_updates(boost::uint32_t flags);
+			void post_torrent_deltas(boost::uint64_t fields);
+			void post_session_stats();
+
+			// refreshes all gauges and the counters that are sampled
+			// from other objects (the disk thread, the stat object)
+			void update_stats_gauges();
+
+			void inc_stats_counter(int c, int value = 1)
+			{ m_stats_counters.inc_stats_counter(c, value); }
 
 			std::vector<torrent_handle> get_torrents() const;
 			
 			void queue_check_torrent(boost::shared_ptr<torrent> const& t);
 			void dequeue_check_torrent(boost::shared_ptr<torrent> const& t);
 
+			// adds or removes a torrent from the list of torrents
+			// whose second_tick() is called every second
+			void start_ticking(torrent* t);
+			void stop_ticking(torrent* t);
+
+			// moves t to the auto-manage queue it belongs in, at the
+			// position it belongs at. This is called whenever anything
+			// that affects the queue or the position changes, such as
+			// the torrent's state, queue position or seed rank. It also
+			// keeps the list of engaged torrents up to date
+			void update_auto_manage_state(torrent* t);
+
+			// schedules a dormant torrent's wake-up timer to fire
+			// in the given number of seconds
+			void schedule_torrent_wakeup(timer_entry* e, int delay);
+			void cancel_torrent_wakeup(timer_entry* e);
+
+			// schedules the eviction of a dormant torrent's metadata
+			// in the given number of seconds
+			void schedule_torrent_unload(timer_entry* e, int delay);
+			void cancel_torrent_unload(timer_entry* e);
+
 			void set_alert_mask(boost::uint32_t m);
 			size_t set_alert_queue_size_limit(size_t queue_size_limit_);
 			std::auto_ptr<alert> pop_alert();
 			void pop_alerts(std::deque<alert*>* alerts);
+			void pop_alerts(std::vector<alert*>* alerts);
 			void set_alert_dispatch(boost::function<void(std::auto_ptr<alert>)> const&);
 			void post_alert(const alert& alert_);
 
@@ -460,6 +478,13 @@ namespace libtorrent
 			void load_asnum_db(std::string file);
 			bool has_asnum_db() const { return m_asnum_db; }
 
+			// incremented every time the rank of an AS (its peak
+			// download rate) or the AS database changes. The
+			// policies rebuild their connect candidate heaps when
+			// it does, since the heaps are ordered by AS rank
+			int as_rank_generation() const { return m_as_rank_generation; }
+			void as_rank_changed() { ++m_as_rank_generation; }
+
 			void load_country_db(std::string file);
 			bool has_country_db() const { return m_country_db; }
 			char const* country_for_ip(address const& a);
@@ -546,19 +571,26 @@ namespace libtorrent
 				--m_num_active_finished;
 			}
 
+			// the torrents whose state changed are queued separately for
+			// post_torrent_updates() and post_torrent_deltas(), so that
+			// calling one doesn't empty the queue of the other
+			enum { state_update_queue, state_delta_queue, num_state_queues };
+
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
-			bool in_state_updates(boost::shared_ptr<torrent> t)
+			bool in_state_updates(boost::shared_ptr<torrent> t, int queue)
 			{
-				return std::find_if(m_state_updates.begin(), m_state_updates.end()
-					, boost::bind(&boost::weak_ptr<torrent>::lock, _1) == t) != m_state_updates.end();
+				std::vector<boost::weak_ptr<torrent> > const& q = m_state_updates[queue];
+				return std::find_if(q.begin(), q.end()
+					, boost::bind(&boost::weak_ptr<torrent>::lock, _1) == t) != q.end();
 			}
 #endif
 
-			void add_to_update_queue(boost::weak_ptr<torrent> t)
+			void add_to_update_queue(boost::weak_ptr<torrent> t, int queue)
 			{
-				TORRENT_ASSERT(std::find_if(m_state_updates.begin(), m_state_updates.end()
-					, boost::bind(&boost::weak_ptr<torrent>::lock, _1) == t.lock()) == m_state_updates.end());
-				m_state_updates.push_back(t);
+				std::vector<boost::weak_ptr<torrent> >& q = m_state_updates[queue];
+				TORRENT_ASSERT(std::find_if(q.begin(), q.end()
+					, boost::bind(&boost::weak_ptr<torrent>::lock, _1) == t.lock()) == q.end());
+				q.push_back(t);
 			}
 
 //		private:
@@ -579,52 +611,6 @@ namespace libtorrent
 			// the settings for the client
 			session_settings m_settings;
 
-			// this is a shared pool where policy_peer objects
-			// are allocated. It's a pool since we're likely
-			// to have tens of thousands of peers, and a pool
-			// saves significant overhead
-#ifdef TORRENT_STATS
-			struct logging_allocator
-			{
-				typedef std::size_t size_type;
-				typedef std::ptrdiff_t difference_type;
-
-				static char* malloc(const size_type bytes)
-				{
-					allocated_bytes += bytes;
-					++allocations;
-					return (char*)::malloc(bytes);
-				}
-
-				static void free(char* const block)
-				{
-					--allocations;
-					return ::free(block);
-				}
-			
-				static int allocations;
-				static int allocated_bytes;
-			};
-			boost::object_pool<
-				policy::ipv4_peer, logging_allocator> m_ipv4_peer_pool;
-#if TORRENT_USE_IPV6
-			boost::object_pool<
-				policy::ipv6_peer, logging_allocator> m_ipv6_peer_pool;
-#endif
-#if TORRENT_USE_I2P
-			boost::object_pool<
-				policy::i2p_peer, logging_allocator> m_i2p_peer_pool;
-#endif
-#else
-			boost::object_pool<policy::ipv4_peer> m_ipv4_peer_pool;
-#if TORRENT_USE_IPV6
-			boost::object_pool<policy::ipv6_peer> m_ipv6_peer_pool;
-#endif
-#if TORRENT_USE_I2P
-			boost::object_pool<policy::i2p_peer> m_i2p_peer_pool;
-#endif
-#endif
-
 			// this vector is used to store the block_info
 			// objects pointed to by partial_piece_info returned
 			// by torrent::get_download_queue.
@@ -668,6 +654,12 @@ namespace libtorrent
 			// constructed after it.
 			disk_io_thread m_disk_thread;
 
+			// parses the resume data and stats the files of torrents
+			// added with async_add_torrents(). This is created on first
+			// use. It relies on m_files and posts to m_io_service, so it
+			// must be destructed before them
+			boost::scoped_ptr<torrent_loader> m_torrent_loader;
+
 			// this is a list of half-open tcp connections
 			// (only outgoing connections)
 			// this has to be one of the last
@@ -712,6 +704,45 @@ namespace libtorrent
 
 			tracker_manager m_tracker_manager;
 			torrent_map m_torrents;
+
+			// the torrents that are ticked every second. Torrents that
+			// have nothing to do every second go dormant and remove
+			// themselves from this list. Each torrent knows its own
+			// index in it, which makes removal O(1)
+			std::vector<torrent*> m_ticking_torrents;
+
+			// wake-up timers for dormant torrents. One tick is one second,
+			// counted from m_timer_epoch
+			timer_wheel m_torrent_timers;
+
+			// timers for evicting the metadata of dormant torrents. These
+			// use the same ticks as m_torrent_timers
+			timer_wheel m_unload_timers;
+
+			// orders torrents in an auto-manage queue by the sort key
+			// they were inserted with (see torrent::auto_manage_key())
+			struct auto_manage_order
+			{
+				bool operator()(torrent const* lhs, torrent const* rhs) const;
+			};
+			typedef std::set<torrent*, auto_manage_order> auto_manage_queue_t;
+
+			// the auto-managed torrents, one queue for torrents that
+			// are checking, downloading and seeding respectively. Torrents
+			// with errors are not in any of them. Downloading and checking
+			// torrents are ordered by queue position and seeding torrents
+			// by seed rank, highest first
+			enum { checking_queue, download_queue, seed_queue, num_auto_manage_queues };
+			auto_manage_queue_t m_auto_manage_queues[num_auto_manage_queues];
+
+			// the torrents that are allowed to have peers or to
+			// announce (see torrent::is_engaged()). This is all
+			// the auto-manager needs to look at past the last
+			// active slot
+			std::vector<torrent*> m_engaged_torrents;
+
+			// the total number of torrents visited by the auto-manager
+			size_type m_auto_manage_evaluations;
 			std::map<std::string, boost::shared_ptr<torrent> > m_uuids;
 
 			// counters of how many of the active (non-paused) torrents
@@ -860,9 +891,27 @@ namespace libtorrent
 			void on_tick(error_code const& e);
 
 			void try_connect_more_peers(int num_downloads, int num_downloads_peers);
-			void auto_manage_torrents(std::vector<torrent*>& list
+
+			// what the auto-manager decided to do with a torrent.
+			// The decisions are applied once all queues have been
+			// walked, since applying them may reorder the queues
+			struct auto_manage_decision
+			{
+				torrent* t;
+				bool announce_to_dht;
+				bool announce_to_trackers;
+				bool announce_to_lsd;
+				// 1 = start, 0 = pause, -1 = leave it running
+				int start;
+			};
+			void auto_manage_torrent(torrent* t
 				, int& dht_limit, int& tracker_limit, int& lsd_limit
-				, int& hard_limit, int type_limit);
+				, int& hard_limit, int& type_limit
+				, std::vector<auto_manage_decision>& decisions);
+			void auto_manage_torrents(int queue
+				, int& dht_limit, int& tracker_limit, int& lsd_limit
+				, int& hard_limit, int type_limit
+				, std::vector<auto_manage_decision>& decisions);
 			void recalculate_auto_managed_torrents();
 			void recalculate_unchoke_slots(int congested_torrents
 				, int uncongested_torrents);
@@ -871,6 +920,18 @@ namespace libtorrent
 			ptime m_created;
 			int session_time() const { return total_seconds(time_now() - m_created); }
 
+			// m_created is moved forward every now and then to keep
+			// session_time() small. This is the fixed origin of the
+			// ticks of m_torrent_timers
+			ptime m_timer_epoch;
+			boost::uint32_t timer_tick(ptime now) const
+			{ return total_seconds(now - m_timer_epoch); }
+
+			// histograms of how long the one-second tick took, the whole
+			// of it and the part ticking torrents. See session_status
+			int m_tick_histogram[session_status::num_tick_histogram_buckets];
+			int m_torrent_tick_histogram[session_status::num_tick_histogram_buckets];
+
 			ptime m_last_tick;
 			ptime m_last_second_tick;
 			// used to limit how often disk warnings are generated
@@ -983,6 +1044,10 @@ namespace libtorrent
 
 			tcp::resolver m_host_resolver;
 
+			// the hostname lookups of trackers and web seeds go through
+			// this cache
+			resolver m_resolver;
+
 			// the index of the torrent that will be offered to
 			// connect to a peer next time on_tick is called.
 			// This implements a round robin.
@@ -1018,10 +1083,14 @@ namespace libtorrent
 			FILE* m_request_log;
 #endif
 
+			// the session wide performance counters and gauges. These
+			// are always maintained and are posted to the client in
+			// session_stats_alert
+			counters m_stats_counters;
+
 #ifdef TORRENT_STATS
 			void rotate_stats_log();
-			void print_log_line(int tick_interval_ms, ptime now);
-			void reset_stat_counters();
+			void print_log_line(ptime now);
 			void enable_stats_logging(bool s);
 
 			bool m_stats_logging_enabled;
@@ -1035,84 +1104,10 @@ namespace libtorrent
 			// rotated every hour and the sequence number is
 			// incremented by one
 			int m_log_seq;
-			// the number of peers that were disconnected this
-			// tick due to protocol error
-			int m_error_peers;
-			int m_disconnected_peers;
-			int m_eof_peers;
-			int m_connreset_peers;
-			int m_connrefused_peers;
-			int m_connaborted_peers;
-			int m_perm_peers;
-			int m_buffer_peers;
-			int m_unreachable_peers;
-			int m_broken_pipe_peers;
-			int m_addrinuse_peers;
-			int m_no_access_peers;
-			int m_invalid_arg_peers;
-			int m_aborted_peers;
-
-			int m_piece_requests;
-			int m_max_piece_requests;
-			int m_invalid_piece_requests;
-			int m_choked_piece_requests;
-			int m_cancelled_piece_requests;
-			int m_piece_rejects;
-
-			int m_error_incoming_peers;
-			int m_error_outgoing_peers;
-			int m_error_rc4_peers;
-			int m_error_encrypted_peers;
-			int m_error_tcp_peers;
-			int m_error_utp_peers;
-			// the number of times the piece picker fell through
-			// to the end-game mode
-			int m_end_game_piece_picker_blocks;
-			int m_piece_picker_blocks;
-			int m_piece_picks;
-			int m_reject_piece_picks;
-			int m_unchoke_piece_picks;
-			int m_incoming_redundant_piece_picks;
-			int m_incoming_piece_picks;
-			int m_end_game_piece_picks;
-			int m_snubbed_piece_picks;
-			int m_connect_timeouts;
-			int m_uninteresting_peers;
-			int m_timeout_peers;
-			int m_no_memory_peers;
-			int m_too_many_peers;
-			int m_transport_timeout_peers;
-			cache_status m_last_cache_status;
-			size_type m_last_failed;
-			size_type m_last_redundant;
-			size_type m_last_uploaded;
-			size_type m_last_downloaded;
-			int m_connection_attempts;
-			int m_num_banned_peers;
-			int m_banned_for_hash_failure;
-			vm_statistics_data_t m_last_vm_stat;
-			thread_cpu_usage m_network_thread_cpu_usage;
-			sliding_average<20> m_read_ops;
-			sliding_average<20> m_write_ops;;
-			enum
-			{
-				on_read_counter,
-				on_write_counter,
-				on_tick_counter,
-				on_lsd_counter,
-				on_lsd_peer_counter,
-				on_udp_counter,
-				on_accept_counter,
-				on_disk_queue_counter,
-				on_disk_read_counter,
-				on_disk_write_counter,
-				max_messages
-			};
-			int m_num_messages[max_messages];
-			// 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192,
-			// 16384, 32768, 65536, 131072, 262144, 524288, 1048576
-			int m_send_buffer_sizes[18];
-			int m_recv_buffer_sizes[18];
+
+			// the counters as of the last log line. Counters are
+			// logged as the difference since the previous line
+			counters m_last_stats_counters;
 #endif
 
 			// each second tick the timer takes a little
@@ -1200,6 +1195,7 @@ namespace libtorrent
 			// from this map. Pointers to its elements
 			// are kept in the policy::peer structures.
 			std::map<int, int> m_as_peak;
+			int m_as_rank_generation;
 #endif
 
 			// total redundant and failed bytes
@@ -1227,7 +1223,9 @@ namespace libtorrent
 
 			// this is the set of (subscribed) torrents that have changed
 			// their states since the last time the user requested updates.
-			std::vector<boost::weak_ptr<torrent> > m_state_updates;
+			// One for post_torrent_updates() and one for
+			// post_torrent_deltas()
+			std::vector<boost::weak_ptr<torrent> > m_state_updates[num_state_queues];
 
 			// the main working thread
 			boost::scoped_ptr<thread> m_thread;
@@ -0,0 +1,241 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#ifndef TORRENT_BDECODE_HPP_INCLUDED
+#define TORRENT_BDECODE_HPP_INCLUDED
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <boost/cstdint.hpp>
+#include "libtorrent/config.hpp"
+#include "libtorrent/assert.hpp"
+#include "libtorrent/error_code.hpp"
+
+namespace libtorrent
+{
+	struct bdecode_node;
+
+	namespace detail
+	{
+		// bdecode() turns the buffer into a flat array of these, in the
+		// order the items appear in the buffer. Every dictionary, list,
+		// string and integer is one token. Dictionaries and lists are
+		// terminated by an end token. A dictionary's keys and values are
+		// stored as alternating tokens. The last token in the array is
+		// an end token marking the end of the decoded buffer
+		struct bdecode_token
+		{
+			enum type_t { none, dict, list, string, integer, end };
+
+			enum limits_t
+			{
+				max_offset = (1 << 29) - 1,
+				max_next_item = (1 << 29) - 1,
+				// the length prefix of a string, including the colon,
+				// is header + 2 bytes. This limits strings to 8 digits
+				max_header = (1 << 3) - 1
+			};
+
+			bdecode_token(boost::uint32_t off, type_t t
+				, boost::uint32_t next = 1, int header_size = 0)
+				: offset(off)
+				, type(t)
+				, next_item(next)
+				, header(header_size)
+			{
+				TORRENT_ASSERT(off <= max_offset);
+				TORRENT_ASSERT(next <= max_next_item);
+				TORRENT_ASSERT(header_size >= 0 && header_size <= max_header);
+			}
+
+			// the offset of this item in the buffer. That's the 'd', 'l'
+			// or 'i', or the first digit of the length of a string
+			boost::uint32_t offset:29;
+			boost::uint32_t type:3;
+			// the number of tokens to skip to get to the item following
+			// this one. For dictionaries and lists, that includes all
+			// their children and their end token
+			boost::uint32_t next_item:29;
+			// the size of the length prefix of a string, minus 2
+			boost::uint32_t header:3;
+		};
+	}
+
+	// return 0 = success
+	//
+	// decodes the buffer into ret. Unlike lazy_bdecode(), this doesn't
+	// allocate a node per item. All items are stored in a single array
+	// of tokens owned by ret, which is reused (and not shrunk) when
+	// decoding into ret again. So, a bdecode_node that's kept around
+	// decodes without allocating any memory once it's warmed up.
+	// The buffer is not copied and must outlive ret.
+	//
+	// depth_limit is the maximum nesting of dictionaries and lists,
+	// token_limit the maximum number of items in the buffer. The
+	// offset of a decoding error is stored in error_pos
+	TORRENT_EXPORT int bdecode(char const* start, char const* end
+		, bdecode_node& ret, error_code& ec, int* error_pos = 0
+		, int depth_limit = 100, int token_limit = 1000000);
+
+	// a reference to an item in a decoded buffer. The node returned by
+	// bdecode() is the root. It owns the token array, all other nodes
+	// refer into it and are only valid as long as the root is alive and
+	// hasn't been used to decode anything else. Non-root nodes are cheap
+	// to copy. Copying the root copies the token array.
+	//
+	// The accessors mirror the ones of lazy_entry, except that
+	// items are returned by value. A node that doesn't refer to
+	// anything has type none_t and evaluates to false
+	struct TORRENT_EXPORT bdecode_node
+	{
+		friend TORRENT_EXPORT int bdecode(char const* start, char const* end
+			, bdecode_node& ret, error_code& ec, int* error_pos
+			, int depth_limit, int token_limit);
+
+		bdecode_node();
+		bdecode_node(bdecode_node const& n);
+		bdecode_node& operator=(bdecode_node const& n);
+
+		enum type_t
+		{
+			none_t, dict_t, list_t, string_t, int_t
+		};
+
+		type_t type() const;
+
+		typedef void (bdecode_node::*bool_type)() const;
+		operator bool_type() const
+		{ return m_token_idx == -1 ? 0 : &bdecode_node::non_zero; }
+
+		// returns the buffer and the size of the bencoded data of
+		// this item
+		std::pair<char const*, int> data_section() const;
+
+		// list functions
+		// ==============
+
+		// accessing the items in order is constant time per item
+		bdecode_node list_at(int i) const;
+		std::string list_string_value_at(int i
+			, char const* default_val = "") const;
+		boost::int64_t list_int_value_at(int i
+			, boost::int64_t default_val = 0) const;
+		int list_size() const;
+
+		// dictionary functions
+		// ====================
+
+		std::pair<std::string, bdecode_node> dict_at(int i) const;
+		// the returned node is of type none_t if the key isn't found.
+		// The typed lookups also return none_t if the item has
+		// another type
+		bdecode_node dict_find(char const* key) const;
+		bdecode_node dict_find_dict(char const* key) const;
+		bdecode_node dict_find_list(char const* key) const;
+		bdecode_node dict_find_string(char const* key) const;
+		bdecode_node dict_find_int(char const* key) const;
+		std::string dict_find_string_value(char const* key
+			, char const* default_value = "") const;
+		boost::int64_t dict_find_int_value(char const* key
+			, boost::int64_t default_val = 0) const;
+		int dict_size() const;
+
+		// integer functions
+		// =================
+
+		boost::int64_t int_value() const;
+
+		// string functions
+		// ================
+
+		// the string is not null-terminated!
+		char const* string_ptr() const;
+		int string_length() const;
+		std::string string_value() const;
+
+		// resets this node to none_t. The root keeps the memory of its
+		// token array, to be reused
+		void clear();
+
+		void swap(bdecode_node& n);
+
+		// preallocates room for the given number of tokens
+		void reserve(int tokens);
+
+		// if the decoded buffer is moved, this updates the root and
+		// the nodes copied from it after the move to the new buffer
+		void switch_underlying_buffer(char const* buf);
+
+	private:
+
+		bdecode_node(detail::bdecode_token const* tokens, char const* buf
+			, int len, int idx);
+
+		void non_zero() const {}
+
+		// returns the token index of the item following the one at idx
+		int next_token(int idx) const
+		{ return idx + m_root_tokens[idx].next_item; }
+
+		// the offset in m_buffer of the data following the item at idx
+		int end_offset(int idx) const
+		{ return m_root_tokens[next_token(idx)].offset; }
+
+		// only the root owns tokens. m_root_tokens points into the token
+		// array of the root
+		std::vector<detail::bdecode_token> m_tokens;
+		detail::bdecode_token const* m_root_tokens;
+
+		// the bencoded buffer
+		char const* m_buffer;
+		int m_buffer_size;
+
+		// the index of the token of this item, or -1
+		int m_token_idx;
+
+		// the last list item or dictionary entry accessed, and its
+		// token. This makes iterating over a list or a dictionary
+		// linear, even though the tokens can only be walked forward
+		mutable int m_last_index;
+		mutable int m_last_token;
+
+		// the number of items in the list or dictionary. -1
+		// until it has been counted
+		mutable int m_size;
+	};
+
+	TORRENT_EXPORT std::string print_entry(bdecode_node const& e
+		, bool single_line = false, int indent = 0);
+}
+
+#endif // TORRENT_BDECODE_HPP_INCLUDED
+
@@ -0,0 +1,305 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_BENCODE_WRITER_HPP_INCLUDED
+#define TORRENT_BENCODE_WRITER_HPP_INCLUDED
+
+#include <vector>
+#include <string>
+#include <cstring> // for strlen, strcmp
+#include <boost/noncopyable.hpp>
+#include "libtorrent/config.hpp"
+#include "libtorrent/assert.hpp"
+#include "libtorrent/entry.hpp" // for integer_type
+#include "libtorrent/bencode.hpp" // for integer_to_str
+
+namespace libtorrent
+{
+	// a sink for bencode_dict and bencode_list that appends to a
+	// vector. The vector is not cleared, so a buffer that's cleared and
+	// reused for every message stops allocating memory once it has
+	// grown to the size of the largest one
+	struct vector_sink
+	{
+		vector_sink(std::vector<char>& buf): m_buf(buf) {}
+		void put(char c) { m_buf.push_back(c); }
+		void write(char const* buf, int len)
+		{ m_buf.insert(m_buf.end(), buf, buf + len); }
+	private:
+		std::vector<char>& m_buf;
+	};
+
+	template <class Sink> struct bencode_list;
+
+	namespace detail
+	{
+		// the state shared by bencode_dict and bencode_list. Sink is
+		// any type with put(char) and write(char const*, int)
+		template <class Sink>
+		struct bencode_container : boost::noncopyable
+		{
+			bencode_container(Sink& s, char type
+#ifdef TORRENT_DEBUG
+				, bencode_container* parent
+#endif
+				)
+				: m_sink(s)
+#ifdef TORRENT_DEBUG
+				, m_parent(parent)
+				, m_open_child(false)
+#endif
+			{
+#ifdef TORRENT_DEBUG
+				if (m_parent)
+				{
+					TORRENT_ASSERT(!m_parent->m_open_child);
+					m_parent->m_open_child = true;
+				}
+#endif
+				m_sink.put(type);
+			}
+
+			~bencode_container()
+			{
+#ifdef TORRENT_DEBUG
+				TORRENT_ASSERT(!m_open_child);
+				if (m_parent) m_parent->m_open_child = false;
+#endif
+				m_sink.put('e');
+			}
+
+			Sink& sink() { return m_sink; }
+
+		protected:
+
+			void write_string(char const* str, int len)
+			{
+				write_string_prefix(len);
+				if (len > 0) m_sink.write(str, len);
+			}
+
+			void write_string_prefix(int len)
+			{
+				TORRENT_ASSERT(len >= 0);
+				write_number(len);
+				m_sink.put(':');
+			}
+
+			void write_integer(entry::integer_type val)
+			{
+				m_sink.put('i');
+				write_number(val);
+				m_sink.put('e');
+			}
+
+			void write_number(entry::integer_type val)
+			{
+				char buf[21];
+				char const* str = integer_to_str(buf, sizeof(buf), val);
+				m_sink.write(str, static_cast<char const*>(buf) + sizeof(buf) - 1 - str);
+			}
+
+			// nothing may be written to a container while one of its
+			// children is still open
+			void check_writable() const
+			{
+#ifdef TORRENT_DEBUG
+				TORRENT_ASSERT(!m_open_child);
+#endif
+			}
+
+			Sink& m_sink;
+#ifdef TORRENT_DEBUG
+			bencode_container* m_parent;
+			bool m_open_child;
+#endif
+		};
+	}
+
+	// bencode_dict and bencode_list stream a bencoded structure into a
+	// sink as it's being built. The 'd' or 'l' is written when the object
+	// is constructed and the terminating 'e' when it's destructed, so
+	// nesting follows the scopes of the C++ objects. Every value written
+	// to a dictionary is passed together with its key, and list items
+	// take no key, so a key without a value (or the other way around)
+	// doesn't compile. Keys must be written in sorted order, which is
+	// asserted in debug builds.
+	//
+	//	std::vector<char> buf;
+	//	vector_sink s(buf);
+	//	{
+	//		bencode_dict<vector_sink> d(s);
+	//		d.integer("a", 1);
+	//		bencode_list<vector_sink> l(d, "b");
+	//		l.string("foo");
+	//	}
+	//	// buf is now "d1:ai1e1:bl3:fooee"
+	template <class Sink>
+	struct bencode_dict : detail::bencode_container<Sink>
+	{
+		typedef detail::bencode_container<Sink> base;
+
+		// a top level dictionary
+		explicit bencode_dict(Sink& s)
+			: base(s, 'd'
+#ifdef TORRENT_DEBUG
+				, 0
+#endif
+				)
+		{}
+
+		// a dictionary that's the value of key in parent
+		bencode_dict(bencode_dict& parent, char const* key)
+			: base((parent.write_key(key), parent.sink()), 'd'
+#ifdef TORRENT_DEBUG
+				, &parent
+#endif
+				)
+		{}
+
+		// a dictionary that's an item in parent
+		explicit bencode_dict(bencode_list<Sink>& parent)
+			: base((parent.check_item(), parent.sink()), 'd'
+#ifdef TORRENT_DEBUG
+				, &parent
+#endif
+				)
+		{}
+
+		void integer(char const* key, entry::integer_type val)
+		{ write_key(key); this->write_integer(val); }
+
+		void string(char const* key, char const* str, int len)
+		{ write_key(key); this->write_string(str, len); }
+
+		void string(char const* key, char const* str)
+		{ string(key, str, int(std::strlen(str))); }
+
+		void string(char const* key, std::string const& str)
+		{ string(key, str.c_str(), int(str.size())); }
+
+		// writes a value that's already bencoded
+		void raw(char const* key, char const* buf, int len)
+		{ write_key(key); this->m_sink.write(buf, len); }
+
+		// writes the key and the length prefix of a string of len bytes.
+		// The caller is expected to write exactly len bytes to the
+		// returned sink before writing anything else to this dictionary
+		Sink& string_prefix(char const* key, int len)
+		{ write_key(key); this->write_string_prefix(len); return this->m_sink; }
+
+	private:
+
+		template <class S> friend struct bencode_dict;
+		template <class S> friend struct bencode_list;
+
+		void write_key(char const* key)
+		{
+			this->check_writable();
+#ifdef TORRENT_DEBUG
+			// keys must be unique and sorted by their raw bytes
+			TORRENT_ASSERT(m_last_key.empty() || std::strcmp(m_last_key.c_str(), key) < 0);
+			m_last_key = key;
+#endif
+			this->write_string(key, int(std::strlen(key)));
+		}
+
+#ifdef TORRENT_DEBUG
+		std::string m_last_key;
+#endif
+	};
+
+	template <class Sink>
+	struct bencode_list : detail::bencode_container<Sink>
+	{
+		typedef detail::bencode_container<Sink> base;
+
+		// a top level list
+		explicit bencode_list(Sink& s)
+			: base(s, 'l'
+#ifdef TORRENT_DEBUG
+				, 0
+#endif
+				)
+		{}
+
+		// a list that's the value of key in parent
+		bencode_list(bencode_dict<Sink>& parent, char const* key)
+			: base((parent.write_key(key), parent.sink()), 'l'
+#ifdef TORRENT_DEBUG
+				, &parent
+#endif
+				)
+		{}
+
+		// a list that's an item in parent
+		explicit bencode_list(bencode_list& parent)
+			: base((parent.check_item(), parent.sink()), 'l'
+#ifdef TORRENT_DEBUG
+				, &parent
+#endif
+				)
+		{}
+
+		void integer(entry::integer_type val)
+		{ check_item(); this->write_integer(val); }
+
+		void string(char const* str, int len)
+		{ check_item(); this->write_string(str, len); }
+
+		void string(char const* str)
+		{ string(str, int(std::strlen(str))); }
+
+		void string(std::string const& str)
+		{ string(str.c_str(), int(str.size())); }
+
+		// writes an item that's already bencoded
+		void raw(char const* buf, int len)
+		{ check_item(); this->m_sink.write(buf, len); }
+
+		// writes the length prefix of a string item of len bytes. The
+		// caller is expected to write exactly len bytes to the returned
+		// sink before writing anything else to this list
+		Sink& string_prefix(int len)
+		{ check_item(); this->write_string_prefix(len); return this->m_sink; }
+
+	private:
+
+		template <class S> friend struct bencode_dict;
+		template <class S> friend struct bencode_list;
+
+		void check_item() { this->check_writable(); }
+	};
+}
+
+#endif // TORRENT_BENCODE_WRITER_HPP_INCLUDED
+
@@ -57,11 +57,20 @@ namespace libtorrent
 		std::string to_string() const
 		{ return std::string((char const*)&bits[0], N); }
 
+		char const* data() const { return (char const*)&bits[0]; }
+
 		void from_string(char const* str)
 		{ memcpy(bits, str, N); }
 
 		void clear() { memset(bits, 0, N); }
 
+		// adds all the keys in f to this filter
+		bloom_filter& operator|=(bloom_filter const& f)
+		{
+			for (int i = 0; i < N; ++i) bits[i] |= f.bits[i];
+			return *this;
+		}
+
 		float size() const
 		{
 			const int c = (std::min)(count_zero_bits(bits, N), (N * 8) - 1);
@@ -228,6 +228,51 @@ namespace libtorrent
 		void write_share_mode();
 		void write_holepunch_msg(int type, tcp::endpoint const& ep, int error);
 #endif
+
+#ifndef TORRENT_DISABLE_EXTENSIONS
+		// builds an extension message in place, at the end of the send
+		// buffer. It's a sink for bencode_dict and bencode_list, which lets
+		// extensions bencode their messages straight into the send buffer
+		// instead of building an entry and copying it via a temporary
+		// buffer. The header is written with a zero length, which is
+		// patched once the message is complete. That happens in finish()
+		// or in the destructor, which is also when the message is
+		// queued for sending. If the connection is RC4 encrypted, the
+		// message is encrypted in place along with the rest of the send
+		// buffer, right before it's sent.
+		struct extended_message : boost::noncopyable
+		{
+			extended_message(bt_peer_connection& pc, int ext_msg_id);
+			~extended_message() { finish(); }
+
+			void put(char c) { write(&c, 1); }
+			void write(char const* buf, int len);
+
+			// adds len bytes from buf to the end of the message without
+			// copying them (unless the connection is encrypted). buf must
+			// stay valid until it has been sent. Nothing may be written
+			// to the message after this
+			void append_const_buffer(char const* buf, int len);
+
+			// patches in the message length and starts sending it.
+			// Nothing may be written to the message after this
+			void finish();
+
+			// the number of bytes written after the header so far
+			int size() const { return m_size; }
+
+		private:
+			bt_peer_connection& m_pc;
+			// the header of the message in the send buffer. This is 0
+			// once the message is finished, or if we failed to allocate
+			// it
+			char* m_header;
+			int m_size;
+#ifdef TORRENT_DEBUG
+			bool m_closed;
+#endif
+		};
+#endif
 		void write_metadata(std::pair<int, int> req);
 		void write_metadata_request(std::pair<int, int> req);
 		void write_keepalive();
@@ -284,9 +329,11 @@ namespace libtorrent
 
 public:
 
-		// these functions encrypt the send buffer if m_rc4_encrypted
-		// is true, otherwise it passes the call to the
-		// peer_connection functions of the same names
+		// these functions pass the call on to the peer_connection
+		// functions of the same names. The send buffer isn't encrypted
+		// as it's appended to. Everything queued since the last send is
+		// encrypted in place in prepare_send_buffer(), right before it's
+		// handed to the socket
 		virtual void append_const_send_buffer(char const* buffer, int size);
 		virtual void send_buffer(char const* begin, int size, int flags = 0
 			, void (*fun)(char*, int, void*) = 0, void* userdata = 0);
@@ -294,14 +341,22 @@ public:
 		void append_send_buffer(char* buffer, int size, Destructor const& destructor)
 		{
 #ifndef TORRENT_DISABLE_ENCRYPTION
-			if (m_rc4_encrypted)
-				m_enc_handler->encrypt(buffer, size);
+			prepare_append();
 #endif
 			peer_connection::append_send_buffer(buffer, size, destructor, true);
 		}
 
 private:
 
+		// encrypts the bytes queued since the last call, in place, if
+		// they were queued with RC4 enabled
+		void prepare_send_buffer();
+
+		// called before anything is appended to the send buffer. If
+		// the encryption state changed since the last append, the bytes
+		// queued under the old state are dealt with first
+		void prepare_append();
+
 		// Returns offset at which bytestream (src, src + src_size)
 		// matches bytestream(target, target + target_size).
 		// If no sync found, return -1
@@ -405,6 +460,11 @@ private:
 		// true if rc4, false if plaintext
 		bool m_rc4_encrypted;
 
+		// true if the bytes at the end of the send buffer, that haven't
+		// been through prepare_send_buffer() yet, were queued with RC4
+		// enabled and need to be encrypted before they're sent
+		bool m_rc4_pending;
+
 		// used to disconnect peer if sync points are not found within
 		// the maximum number of bytes
 		int m_sync_bytes_read;
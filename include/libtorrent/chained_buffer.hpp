@@ -43,6 +43,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/asio/buffer.hpp>
 #endif
 #include <list>
+#include <vector>
 #include <string.h> // for memcpy
 
 namespace libtorrent
@@ -52,7 +53,7 @@ namespace libtorrent
 #endif
 	struct TORRENT_EXTRA_EXPORT chained_buffer
 	{
-		chained_buffer(): m_bytes(0), m_capacity(0)
+		chained_buffer(): m_bytes(0), m_capacity(0), m_processed(0)
 		{
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 			m_destructed = false;
@@ -94,6 +95,20 @@ namespace libtorrent
 
 		std::list<asio::const_buffer> const& build_iovec(int to_send);
 
+		// returns the bytes appended since the last call to
+		// mutable_tail() or skip_tail(), in order. They are considered
+		// processed once this returns. This is used to encrypt the send
+		// buffer in place, in one pass, right before it's sent
+		std::vector<asio::mutable_buffer> const& mutable_tail();
+
+		// marks all bytes currently in the buffer as processed,
+		// without touching them
+		void skip_tail() { m_processed = m_bytes; }
+
+		// the number of bytes appended since the last call to
+		// mutable_tail() or skip_tail()
+		int tail_size() const { return m_bytes - m_processed; }
+
 		~chained_buffer();
 
 	private:
@@ -115,6 +130,13 @@ namespace libtorrent
 		// invoking the async write call
 		std::list<asio::const_buffer> m_tmp_vec;
 
+		// the number of bytes, from the front, that have been
+		// returned by mutable_tail() or skipped by skip_tail()
+		int m_processed;
+
+		// the buffers returned by mutable_tail()
+		std::vector<asio::mutable_buffer> m_tail_vec;
+
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		bool m_destructed;
 #endif
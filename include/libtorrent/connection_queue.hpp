@@ -33,7 +33,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef TORRENT_CONNECTION_QUEUE
 #define TORRENT_CONNECTION_QUEUE
 
-#include <list>
+#include <vector>
+#include <deque>
+#include <boost/cstdint.hpp>
 #include <boost/function/function1.hpp>
 #include <boost/function/function0.hpp>
 #include <boost/noncopyable.hpp>
@@ -66,15 +68,15 @@ public:
 	void limit(int limit);
 	int limit() const;
 	void close();
-	int size() const { return m_queue.size(); }
+	int size() const { return m_waiting.size() + m_num_connecting; }
 	int num_connecting() const { return m_num_connecting; }
 #if defined TORRENT_ASIO_DEBUGGING
 	float next_timeout() const { return total_milliseconds(m_timer.expires_at() - time_now_hires()) / 1000.f; }
 	float max_timeout() const
 	{
 		ptime max_timeout = min_time();
-		for (std::list<entry>::const_iterator i = m_queue.begin()
-			, end(m_queue.end()); i != end; ++i)
+		for (std::vector<entry>::const_iterator i = m_entries.begin()
+			, end(m_entries.end()); i != end; ++i)
 		{
 			if (!i->connecting) continue;
 			if (i->expires > max_timeout) max_timeout = i->expires;
@@ -96,9 +98,12 @@ private:
 	void on_timeout(error_code const& e);
 	void on_try_connect();
 
+	void post_try_connect();
+
 	struct entry
 	{
-		entry(): connecting(false), ticket(0), expires(max_time()), priority(0) {}
+		entry(): expires(max_time()), generation(0), priority(0)
+			, connecting(false), in_use(false) {}
 		// called when the connection is initiated
 		// this is when the timeout countdown starts
 		boost::function<void(int)> on_connect;
@@ -109,17 +114,69 @@ private:
 		// 2. on_connect, on_timeout
 		// 3. on_timeout
 		boost::function<void()> on_timeout;
-		bool connecting;
-		int ticket;
 		ptime expires;
 		time_duration timeout;
-		int priority;
+		// incremented every time this slot is released. It's
+		// part of the ticket, to tell stale tickets apart from
+		// the entry currently occupying the slot
+		boost::uint16_t generation;
+		boost::uint8_t priority;
+		bool connecting:1;
+		bool in_use:1;
+	};
+
+	// a ticket is the slot index of the entry in the low bits
+	// and the slot's generation in the high bits
+	enum
+	{
+		slot_bits = 20,
+		max_slots = 1 << slot_bits,
+		generation_mask = 0x7ff
+	};
+
+	int ticket_for(int slot) const
+	{ return ((m_entries[slot].generation & generation_mask) << slot_bits) | slot; }
+
+	// returns the slot the ticket refers to, or -1 if the
+	// ticket is stale (or invalid)
+	int slot_for(int ticket) const;
+
+	// returns a free slot, or -1 if we have too many entries
+	int allocate_slot();
+	void release_slot(int slot);
+
+	// the timeouts of connecting entries. This is a min-heap
+	// ordered by expiration time. When an entry completes (or
+	// the queue is closed) its heap node is left behind and
+	// skipped once it reaches the top, since its ticket no
+	// longer refers to a connecting entry
+	struct timeout_entry
+	{
+		timeout_entry(ptime e, int t): expires(e), ticket(t) {}
+		ptime expires;
+		int ticket;
+		// std::push_heap() builds a max-heap, so compare backwards
+		bool operator<(timeout_entry const& rhs) const
+		{ return expires > rhs.expires; }
 	};
 
-	std::list<entry> m_queue;
+	bool is_stale(timeout_entry const& t) const;
+
+	// drops the stale nodes from m_timeouts once they outnumber
+	// the connecting entries
+	void prune_timeouts();
+
+	// all entries, indexed by their slot. Slots that are not
+	// in use are listed in m_free_slots
+	std::vector<entry> m_entries;
+	std::vector<int> m_free_slots;
+
+	// the slots of the entries waiting to connect, in the order
+	// they will be connected in
+	std::deque<int> m_waiting;
+
+	std::vector<timeout_entry> m_timeouts;
 
-	// the next ticket id a connection will be given
-	int m_next_ticket;
 	int m_num_connecting;
 	int m_half_open_limit;
 	bool m_abort;
@@ -127,6 +184,11 @@ private:
 	// the number of outstanding timers
 	int m_num_timers;
 
+	// set when an on_try_connect() call has been posted but not
+	// run yet. This lets a burst of enqueue() and done() calls
+	// share a single call to try_connect()
+	bool m_try_connect_pending;
+
 	deadline_timer m_timer;
 
 	mutable mutex_t m_mutex;
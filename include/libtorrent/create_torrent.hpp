@@ -210,6 +210,16 @@ namespace libtorrent
 	TORRENT_EXPORT void set_piece_hashes(create_torrent& t, std::string const& p
 		, boost::function<void(int)> f, error_code& ec);
 
+	// hashes the pieces on num_threads threads (at most 64). The calling thread reads
+	// the files sequentially, up to 2 * num_threads pieces ahead of the
+	// piece it's waiting for, while the other threads hash the pieces
+	// that have been read. f is called on the calling thread, in piece
+	// order, as each piece hash is set. If it returns false, hashing is
+	// cancelled and ec is set to operation_aborted. File hashes, if
+	// enabled, are calculated on the calling thread
+	TORRENT_EXPORT void set_piece_hashes(create_torrent& t, std::string const& p
+		, boost::function<bool(int)> const& f, int num_threads, error_code& ec);
+
 #ifndef BOOST_NO_EXCEPTIONS
 	template <class Fun>
 	void set_piece_hashes(create_torrent& t, std::string const& p, Fun f)
@@ -102,6 +102,7 @@ namespace libtorrent
 			, read_and_hash
 			, cache_piece
 			, finalize_file
+			, hash_blocks
 		};
 
 		action_t action;
@@ -109,7 +110,8 @@ namespace libtorrent
 		char* buffer;
 		int buffer_size;
 		boost::intrusive_ptr<piece_manager> storage;
-		// arguments used for read and write
+		// arguments used for read and write. For hash_blocks,
+		// offset is the salt that's hashed in after every block
 		int piece, offset;
 		// used for move_storage and rename_file. On errors, this is set
 		// to the error message
@@ -130,6 +132,10 @@ namespace libtorrent
 
 		boost::shared_ptr<entry> resume_data;
 
+		// the result of hash_blocks. The salted SHA-1 of every
+		// block in the piece, in order
+		boost::shared_ptr<std::vector<sha1_hash> > block_hashes;
+
 		// the error code from the file operation
 		error_code error;
 
@@ -103,7 +103,8 @@ namespace libtorrent
 		virtual void on_piece_pass(int index) {}
 		virtual void on_piece_failed(int index) {}
 
-		// called aproximately once every second
+		// called aproximately once every second, except while
+		// the torrent is dormant
 		virtual void tick() {}
 
 		// if true is returned, it means the handler handled the event,
@@ -116,6 +117,11 @@ namespace libtorrent
 		// files is completed.
 		virtual void on_files_checked() {}
 
+		// called right before the metadata of a dormant torrent is
+		// evicted from memory. Plugins should release anything they
+		// hold that refers to the torrent_info
+		virtual void on_unload() {}
+
 		// called when the torrent changes state
 		// the state is one of torrent_status::state_t
 		// enum members
@@ -233,7 +239,8 @@ namespace libtorrent
 		virtual void on_piece_pass(int index) {}
 		virtual void on_piece_failed(int index) {}
 
-		// called aproximately once every second
+		// called aproximately once every second, except while
+		// the torrent is dormant
 		virtual void tick() {}
 
 		// called each time a request message is to be sent. If true
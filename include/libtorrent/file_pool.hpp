@@ -44,6 +44,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #include <map>
+#include <deque>
 #include "libtorrent/file.hpp"
 #include "libtorrent/ptime.hpp"
 #include "libtorrent/thread.hpp"
@@ -64,10 +65,34 @@ namespace libtorrent
 		int size_limit() const { return m_size; }
 		void set_low_prio_io(bool b) { m_low_prio_io = b; }
 
+		// the stat cache holds the results of stat() calls made ahead
+		// of time, by the torrent_loader threads, so that the resume
+		// data check on the disk thread doesn't have to make them.
+		// Entries are removed when they are looked up. Torrents that
+		// never get to the resume data check (because they fail to be
+		// added, or their resume data is rejected) leave their entries
+		// behind, so entries also expire once they're older than the
+		// stat cache age (5 seconds by default). The oldest entries are
+		// evicted once there are more than max_stat_cache
+		void cache_file_status(std::string const& p, file_status const& s
+			, error_code const& ec);
+
+		// returns false if ``p`` is not in the stat cache, or if its
+		// entry has expired
+		bool take_file_status(std::string const& p, file_status* s
+			, error_code& ec);
+
+		int stat_cache_size() const;
+		void set_stat_cache_age(time_duration d);
+
 	private:
 
 		void remove_oldest();
 
+		// removes expired entries, and the oldest entries beyond
+		// max_stat_cache. m_stat_mutex must be held
+		void prune_stat_cache(ptime now);
+
 		int m_size;
 		bool m_low_prio_io;
 
@@ -87,6 +112,28 @@ namespace libtorrent
 		file_set m_files;
 		mutex m_mutex;
 
+		enum { max_stat_cache = 10000 };
+
+		struct stat_cache_entry
+		{
+			file_status status;
+			error_code error;
+			ptime added;
+		};
+
+		typedef std::map<std::string, stat_cache_entry> stat_cache_t;
+		stat_cache_t m_stat_cache;
+
+		// the paths in m_stat_cache in insertion order, along with the
+		// time they were added. Paths that have been looked up, or
+		// cached again, are left in here until they reach the front,
+		// which bounds the size of both containers
+		std::deque<std::pair<ptime, std::string> > m_stat_cache_order;
+
+		time_duration m_stat_cache_age;
+
+		mutable mutex m_stat_mutex;
+
 #if TORRENT_CLOSE_MAY_BLOCK
 		void closer_thread_fun();
 		mutex m_closer_mutex;
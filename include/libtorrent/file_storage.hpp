@@ -37,6 +37,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <ctime>
 
+#include <boost/cstdint.hpp>
+
 #include "libtorrent/size_type.hpp"
 #include "libtorrent/assert.hpp"
 #include "libtorrent/peer_request.hpp"
@@ -145,10 +147,11 @@ namespace libtorrent
 		bool hidden_attribute:1;
 		bool executable_attribute:1;
 		bool symlink_attribute:1;
-		// the index into file_storage::m_paths. To get
-		// the full path to this file, concatenate the path
-		// from that array with the 'name' field in
-		// this struct
+		// the index of the directory this file is in, in
+		// file_storage::m_path_components, or -1 if the
+		// name is the full path. To get the full path to
+		// this file, combine the path of that directory with
+		// the 'name' field in this struct
 		int path_index;
 	};
 
@@ -217,9 +220,12 @@ namespace libtorrent
 		}
 
 		size_type total_size() const { return m_total_size; }
-		void set_num_pieces(int n) { m_num_pieces = n; }
+		// the piece length has to be set before the number of pieces.
+		// Setting the number of pieces builds the piece-to-file index
+		void set_num_pieces(int n) { m_num_pieces = n; update_piece_index(); }
 		int num_pieces() const { TORRENT_ASSERT(m_piece_length > 0); return m_num_pieces; }
-		void set_piece_length(int l)  { m_piece_length = l; }
+		void set_piece_length(int l)
+		{ m_piece_length = l; std::vector<int>().swap(m_piece_index); }
 		int piece_length() const { TORRENT_ASSERT(m_piece_length > 0); return m_piece_length; }
 		int piece_size(int index) const;
 
@@ -234,13 +240,25 @@ namespace libtorrent
 			swap(ti.m_symlinks, m_symlinks);
 			swap(ti.m_mtime, m_mtime);
 			swap(ti.m_file_base, m_file_base);
-			swap(ti.m_paths, m_paths);
+			swap(ti.m_path_components, m_path_components);
+			swap(ti.m_path_names, m_path_names);
+			swap(ti.m_path_index, m_path_index);
+			swap(ti.m_piece_index, m_piece_index);
 			swap(ti.m_name, m_name);
 			swap(ti.m_total_size, m_total_size);
 			swap(ti.m_num_pieces, m_num_pieces);
 			swap(ti.m_piece_length, m_piece_length);
 		}
 
+		// frees the file list, but keeps the name, total size and
+		// piece layout, so the torrent's size and number of pieces
+		// can still be queried. This is used when the metadata of
+		// an idle torrent is evicted from memory
+		void unload();
+
+		// the number of bytes of heap memory used by the file list
+		size_type memory_usage() const;
+
 		// if pad_file_limit >= 0, files larger than
 		// that limit will be padded, default is to
 		// not add any padding
@@ -275,9 +293,23 @@ namespace libtorrent
 	private:
 #endif
 
-		void update_path_index(internal_file_entry& e);
+		// sets the name and path index of e from the full path
+		void update_path_index(internal_file_entry& e, std::string const& path);
 		void reorder_file(int index, int dst);
 
+		// returns the index of the directory p in m_path_components,
+		// adding it (and any missing parent directories) if it's not
+		// there already. Returns -1 if p is empty
+		int intern_path(std::string const& p);
+		int intern_path_component(int parent, char const* name, int len);
+		void rehash_path_index(int num_slots);
+		std::string directory_path(int index) const;
+
+		// rebuilds m_piece_index from the file offsets. This is
+		// a no-op until both the piece length and the number of
+		// pieces are known
+		void update_piece_index();
+
 		// the list of files that this torrent consists of
 		std::vector<internal_file_entry> m_files;
 
@@ -305,9 +337,37 @@ namespace libtorrent
 		// offsets)
 		std::vector<size_type> m_file_base;
 
-		// all unique paths files have. The internal_file_entry::path_index
-		// points into this array
-		std::vector<std::string> m_paths;
+		// the directories files live in, stored as a tree. Every
+		// directory name is stored once, along with the index of
+		// its parent directory (-1 for top level directories), so
+		// that torrents with many files in deep directory structures
+		// don't store a copy of the full path for each unique
+		// directory. internal_file_entry::path_index points into
+		// this array
+		struct path_component
+		{
+			// offset and length of the name in m_path_names
+			boost::uint32_t name_offset;
+			boost::uint32_t name_len;
+			int parent;
+		};
+		std::vector<path_component> m_path_components;
+
+		// the names of all path components, back to back
+		std::string m_path_names;
+
+		// maps (parent, name) to the position in m_path_components.
+		// This is an open addressing hash table whose size is always
+		// a power of 2 (or 0). Empty slots are set to -1
+		std::vector<int> m_path_index;
+
+		// m_piece_index[p] is the index of the file the first byte
+		// of piece p is in. The last entry (at num_pieces) is the
+		// last file. This bounds the binary search for the file
+		// at an offset to the files overlapping a single piece.
+		// It's empty until the piece layout is known, and whenever
+		// the file offsets change
+		std::vector<int> m_piece_index;
 
 		// name of torrent. For multi-file torrents
 		// this is always the root directory
@@ -62,6 +62,7 @@ namespace libtorrent
 {
 
 struct http_connection;
+struct resolver;
 class connection_queue;
 
 const int default_max_bottled_buffer_size = 2*1024*1024;
@@ -96,6 +97,23 @@ struct TORRENT_EXTRA_EXPORT http_connection
 	int rate_limit() const
 	{ return m_rate_limit; }
 
+	// when set, hostnames are looked up through this resolver (and its
+	// cache) instead of a resolver owned by this connection
+	void set_resolver(resolver* r) { m_cached_resolver = r; }
+
+	// ask the server to keep the connection open. Once a bottled
+	// response has been received on a connection the server agreed to
+	// keep open, it's left idle (see is_idle()) and another request to
+	// the same host can be made on it by calling get() again
+	void keep_alive(bool k) { m_keep_alive = k; }
+	bool is_idle() const { return m_idle && !m_abort && m_sock.is_open(); }
+
+	// replaces the handlers, for when the connection is reused by
+	// a new owner
+	void set_handler(http_handler const& handler
+		, http_connect_handler const& ch = http_connect_handler()
+		, http_filter_handler const& fh = http_filter_handler());
+
 	std::string sendbuffer;
 
 	void get(std::string const& url, time_duration timeout = seconds(30)
@@ -129,6 +147,10 @@ private:
 #endif
 	void on_resolve(error_code const& e
 		, tcp::resolver::iterator i);
+	void on_resolve_cached(error_code const& e
+		, std::vector<address> const& addresses);
+	void on_endpoints();
+	void reconnect();
 	void queue_connect();
 	void connect(int ticket, tcp::endpoint target_address);
 	void on_connect_timeout();
@@ -148,6 +170,7 @@ private:
 #endif
 	int m_read_pos;
 	tcp::resolver m_resolver;
+	resolver* m_cached_resolver;
 	http_parser m_parser;
 	http_handler m_handler;
 	http_connect_handler m_connect_handler;
@@ -218,6 +241,18 @@ private:
 	int m_priority;
 
 	bool m_abort;
+
+	// true if we ask the server to keep the connection open
+	bool m_keep_alive;
+
+	// set when a response has been received and the server will
+	// keep the connection open for another request
+	bool m_idle;
+
+	// true if the current request was sent on a connection that was
+	// left idle by the previous one. If the server closed it while it
+	// was idle, the request is sent again on a new connection
+	bool m_reused;
 };
 
 }
@@ -73,7 +73,7 @@ namespace libtorrent
 			, tracker_manager& man
 			, tracker_request const& req
 			, boost::weak_ptr<request_callback> c
-			, aux::session_impl const& ses
+			, aux::session_impl& ses
 			, proxy_settings const& ps
 			, std::string const& password = ""
 #if TORRENT_USE_I2P
@@ -96,12 +96,16 @@ namespace libtorrent
 
 		virtual void on_timeout(error_code const& ec) {}
 
+		// true if this request may be sent on a kept-alive connection
+		// from the tracker_manager's pool
+		bool keep_alive() const;
+
 		void parse(int status_code, lazy_entry const& e);
 		bool extract_peer_info(lazy_entry const& e, peer_entry& ret);
 
 		tracker_manager& m_man;
 		boost::shared_ptr<http_connection> m_tracker_connection;
-		aux::session_impl const& m_ses;
+		aux::session_impl& m_ses;
 		address m_tracker_ip;
 		proxy_settings const& m_ps;
 		connection_queue& m_cc;
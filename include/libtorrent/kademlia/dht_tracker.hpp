@@ -52,6 +52,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/socket.hpp"
 #include "libtorrent/thread.hpp"
 #include "libtorrent/deadline_timer.hpp"
+#include "libtorrent/bdecode.hpp"
 
 namespace libtorrent
 {
@@ -93,6 +94,8 @@ namespace libtorrent { namespace dht
 		void announce(sha1_hash const& ih, int listen_port, bool seed
 			, boost::function<void(std::vector<tcp::endpoint> const&)> f);
 
+		void scrape(sha1_hash const& ih, boost::function<void(int, int)> f);
+
 		void dht_status(session_status& s);
 		void network_stats(int& sent, int& received);
 
@@ -116,12 +119,18 @@ namespace libtorrent { namespace dht
 
 		// implements udp_socket_interface
 		virtual bool send_packet(libtorrent::entry& e, udp::endpoint const& addr, int send_flags);
+		virtual bool send_packet(char const* buf, int size
+			, udp::endpoint const& addr, int send_flags);
 
 		node_impl m_dht;
 		rate_limited_udp_socket& m_sock;
 
 		std::vector<char> m_send_buf;
 
+		// the decoded incoming message. It's reused for every
+		// packet to avoid allocating a new token array each time
+		bdecode_node m_msg;
+
 		ptime m_last_new_key;
 		deadline_timer m_timer;
 		deadline_timer m_connection_timer;
@@ -42,6 +42,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/kademlia/rpc_manager.hpp>
 #include <libtorrent/kademlia/observer.hpp>
 #include <libtorrent/kademlia/msg.hpp>
+#include <libtorrent/bloom_filter.hpp>
 
 #include <boost/optional.hpp>
 #include <boost/function/function1.hpp>
@@ -74,6 +75,7 @@ public:
 		, bool noseeds);
 
 	virtual char const* name() const { return "get_peers"; }
+	virtual void start();
 
 	node_id const target() const { return m_target; }
 
@@ -83,8 +85,6 @@ protected:
 	observer_ptr new_observer(void* ptr, udp::endpoint const& ep, node_id const& id);
 	virtual bool invoke(observer_ptr o);
 
-private:
-
 	data_callback m_data_callback;
 	nodes_callback m_nodes_callback;
 	std::map<node_id, std::string> m_write_tokens;
@@ -105,6 +105,46 @@ public:
 	void reply(msg const&);
 };
 
+// a get_peers traversal with the BEP 33 scrape flag set. Instead
+// of peers, the nodes respond with bloom filters of the seeds and
+// downloaders they know of. The filters of all responses are merged
+// and the estimated swarm size is reported when the traversal is done
+class scrape_data : public find_data
+{
+public:
+	typedef boost::function<void(int, int)> scrape_callback;
+
+	scrape_data(node_impl& node, node_id target
+		, scrape_callback const& callback);
+
+	virtual char const* name() const { return "scrape"; }
+
+	void got_filters(char const* seeds, char const* downloaders);
+
+protected:
+
+	void done();
+	observer_ptr new_observer(void* ptr, udp::endpoint const& ep, node_id const& id);
+	virtual bool invoke(observer_ptr o);
+
+private:
+
+	scrape_callback m_callback;
+	bloom_filter<256> m_seeds;
+	bloom_filter<256> m_downloaders;
+};
+
+class scrape_observer : public find_data_observer
+{
+public:
+	scrape_observer(
+		boost::intrusive_ptr<traversal_algorithm> const& algorithm
+		, udp::endpoint const& ep, node_id const& id)
+		: find_data_observer(algorithm, ep, id)
+	{}
+	void reply(msg const&);
+};
+
 } } // namespace libtorrent::dht
 
 #endif // FIND_DATA_050323_HPP
@@ -43,6 +43,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/kademlia/node_id.hpp>
 #include <libtorrent/kademlia/msg.hpp>
 #include <libtorrent/kademlia/find_data.hpp>
+#include <libtorrent/kademlia/peer_storage.hpp>
 
 #include <libtorrent/io.hpp>
 #include <libtorrent/session_settings.hpp>
@@ -94,25 +95,8 @@ struct key_desc_t
 	}; 
 };
 
-bool TORRENT_EXTRA_EXPORT verify_message(lazy_entry const* msg, key_desc_t const desc[]
-	, lazy_entry const* ret[], int size , char* error, int error_size);
-
-// this is the entry for every peer
-// the timestamp is there to make it possible
-// to remove stale peers
-struct peer_entry
-{
-	tcp::endpoint addr;
-	ptime added;
-	bool seed;
-};
-
-// this is a group. It contains a set of group members
-struct torrent_entry
-{
-	std::string name;
-	std::set<peer_entry> peers;
-};
+bool TORRENT_EXTRA_EXPORT verify_message(bdecode_node const& msg, key_desc_t const desc[]
+	, bdecode_node ret[], int size , char* error, int error_size);
 
 struct dht_immutable_item
 {
@@ -145,13 +129,6 @@ inline bool operator<(rsa_key const& lhs, rsa_key const& rhs)
 	return memcmp(lhs.bytes, rhs.bytes, sizeof(lhs.bytes)) < 0;
 }
 
-inline bool operator<(peer_entry const& lhs, peer_entry const& rhs)
-{
-	return lhs.addr.address() == rhs.addr.address()
-		? lhs.addr.port() < rhs.addr.port()
-		: lhs.addr.address() < rhs.addr.address();
-}
-
 struct null_type {};
 
 class announce_observer : public observer
@@ -165,25 +142,19 @@ public:
 	void reply(msg const&) { flags |= flag_done; }
 };
 
-struct count_peers
-{
-	int& count;
-	count_peers(int& c): count(c) {}
-	void operator()(std::pair<libtorrent::dht::node_id
-		, libtorrent::dht::torrent_entry> const& t)
-	{
-		count += t.second.peers.size();
-	}
-};
-
 struct udp_socket_interface
 {
 	virtual bool send_packet(entry& e, udp::endpoint const& addr, int flags) = 0;
+	// sends a message that's already bencoded, including the "v" key
+	virtual bool send_packet(char const* buf, int size
+		, udp::endpoint const& addr, int flags) = 0;
 };
 
+// the client version we put in the "v" key of every message we send
+extern TORRENT_EXTRA_EXPORT char const dht_client_version[4];
+
 class TORRENT_EXTRA_EXPORT node_impl : boost::noncopyable
 {
-typedef std::map<node_id, torrent_entry> table_t;
 typedef std::map<node_id, dht_immutable_item> dht_immutable_table_t;
 typedef std::map<node_id, dht_mutable_item> dht_mutable_table_t;
 
@@ -203,13 +174,8 @@ public:
 	void unreachable(udp::endpoint const& ep);
 	void incoming(msg const& m);
 
-	int num_torrents() const { return m_map.size(); }
-	int num_peers() const
-	{
-		int ret = 0;
-		std::for_each(m_map.begin(), m_map.end(), count_peers(ret));
-		return ret;
-	}
+	int num_torrents() const { return m_storage.num_torrents(); }
+	int num_peers() const { return m_storage.num_peers(); }
 
 	int bucket_size(int bucket);
 
@@ -219,7 +185,7 @@ public:
 	size_type num_global_nodes() const
 	{ return m_table.num_global_nodes(); }
 
-	int data_size() const { return int(m_map.size()); }
+	int data_size() const { return m_storage.num_torrents(); }
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 	void print_state(std::ostream& os) const
@@ -229,6 +195,13 @@ public:
 	void announce(sha1_hash const& info_hash, int listen_port, bool seed
 		, boost::function<void(std::vector<tcp::endpoint> const&)> f);
 
+	// estimates the number of seeds and downloaders of the torrent
+	// by merging the BEP 33 bloom filters of the nodes closest to
+	// it. f is called with the seed and downloader counts once the
+	// traversal completes
+	void scrape(sha1_hash const& info_hash
+		, boost::function<void(int, int)> f);
+
 	bool verify_token(std::string const& token, char const* info_hash
 		, udp::endpoint const& addr);
 
@@ -269,8 +242,6 @@ public:
 
 protected:
 
-	void lookup_peers(sha1_hash const& info_hash, int prefix, entry& reply
-		, bool noseed, bool scrape) const;
 	bool lookup_torrents(sha1_hash const& target, entry& reply
 		, char* tags) const;
 
@@ -284,7 +255,16 @@ private:
 	// since it might have references to it
 	std::set<traversal_algorithm*> m_running_requests;
 
-	void incoming_request(msg const& h, entry& e);
+	// returns true if the response has already been sent. Otherwise
+	// the response is in e
+	bool incoming_request(msg const& h, entry& e);
+
+	// writes the response to the most common queries straight into
+	// m_response_buf and sends it. Returns false if the query isn't
+	// one of them
+	bool write_response(msg const& m, char const* query
+		, bdecode_node const& arg_ent, node_id const& id);
+	void write_error(msg const& m, node_id const& id, char const* error);
 
 	node_id m_id;
 
@@ -293,7 +273,7 @@ public:
 	rpc_manager m_rpc;
 
 private:
-	table_t m_map;
+	peer_storage m_storage;
 	dht_immutable_table_t m_immutable_table;
 	dht_mutable_table_t m_mutable_table;
 	
@@ -304,6 +284,12 @@ private:
 
 	alert_dispatcher* m_post_alert;
 	udp_socket_interface* m_sock;
+
+	// scratch space for building responses. These are reused for
+	// every request to avoid allocating memory for each of them
+	std::vector<char> m_response_buf;
+	nodes_t m_response_nodes;
+	std::vector<peer_entry const*> m_response_peers;
 };
 
 
@@ -0,0 +1,230 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_DHT_PEER_STORAGE_HPP_INCLUDED
+#define TORRENT_DHT_PEER_STORAGE_HPP_INCLUDED
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/peer_id.hpp" // for sha1_hash
+#include "libtorrent/address.hpp"
+#include "libtorrent/socket.hpp"
+#include "libtorrent/time.hpp"
+#include "libtorrent/size_type.hpp"
+#include "libtorrent/session_settings.hpp"
+#include "libtorrent/bloom_filter.hpp"
+
+namespace libtorrent { namespace dht
+{
+
+// this is the entry for every peer
+// the timestamp is there to make it possible
+// to remove stale peers
+struct peer_entry
+{
+	enum { v6_flag = 1, seed_flag = 2 };
+
+	// the IP address in network byte order. IPv4
+	// addresses only use the first 4 bytes
+	boost::uint8_t addr[16];
+	boost::uint16_t port;
+	boost::uint8_t flags;
+	// the time of the last announce, in seconds since
+	// the peer_storage was created
+	boost::uint32_t added;
+
+	bool seed() const { return (flags & seed_flag) != 0; }
+	bool is_v6() const { return (flags & v6_flag) != 0; }
+	int addr_size() const { return is_v6() ? 16 : 4; }
+	address get_address() const;
+	tcp::endpoint endpoint() const
+	{ return tcp::endpoint(get_address(), port); }
+};
+
+// the BEP 33 bloom filters of the IPs of the seeds and the
+// downloaders of a torrent, used to answer scrape requests
+struct scrape_filters
+{
+	bloom_filter<256> seeds;
+	bloom_filter<256> downloaders;
+};
+
+// this is a group. It contains the peers that have announced
+// the info-hash. The peers are kept in a flat array of at most
+// dht_settings::max_peers entries. Once it's full, new peers
+// replace the one that announced the longest ago
+struct torrent_entry
+{
+	sha1_hash info_hash;
+	// malloced array of capacity peers, the first
+	// num_peers are in use. This is 0 for empty
+	// slots in the hash table
+	peer_entry* peers;
+	// the torrent name, as announced by the first peer
+	// that had one. malloced and null terminated, or 0
+	char* name;
+	// the scrape bloom filters of the peers. They're only
+	// allocated once someone scrapes the torrent, and kept
+	// up to date as peers announce. Since peers can't be
+	// removed from a bloom filter, they're freed whenever a
+	// peer leaves and rebuilt on the next scrape. malloced, or 0
+	scrape_filters* scrape;
+	// this counts announces, and is halved every time
+	// peer_storage::tick() is called. When we run out of
+	// space, the least popular torrents are evicted first
+	boost::uint32_t popularity;
+	boost::uint16_t num_peers;
+	boost::uint16_t capacity;
+};
+
+// the storage for all peers announced to this DHT node. The torrents
+// are kept in an open addressing hash table, keyed by info-hash. All
+// torrents and peers are stored in flat arrays, and the total memory
+// used is bounded by dht_settings::max_peer_storage_size
+class TORRENT_EXTRA_EXPORT peer_storage : boost::noncopyable
+{
+public:
+	peer_storage(dht_settings const& settings);
+	~peer_storage();
+
+	// adds the peer to the torrent, or refreshes it if it's already
+	// there. If name is not 0, it's the torrent name announced by the
+	// peer
+	void announce(sha1_hash const& info_hash, tcp::endpoint const& ep
+		, bool seed, char const* name, int name_len);
+
+	// returns the torrent with the given info-hash. If prefix is less
+	// than 20, returns any torrent whose info-hash share the first
+	// prefix bytes with info_hash. Returns 0 if there is no such torrent.
+	// prefix may not be less than 4. Prefix lookups are a binary search
+	// in m_sorted, full lookups go straight to the hash table
+	torrent_entry const* find(sha1_hash const& info_hash, int prefix = 20) const;
+
+	// picks up to num peers at random from t and stores pointers to them
+	// in out. The cost is proportional to the number of peers picked,
+	// not the number of peers in the torrent. Returns the number of
+	// peers picked
+	int random_peers(torrent_entry const& t, int num, bool noseed
+		, peer_entry const** out) const;
+
+	// returns the scrape bloom filters of t, building and caching
+	// them if necessary. If there isn't enough memory left to cache
+	// them, the returned filters are only valid until the next call
+	scrape_filters const& scrape(torrent_entry const& t);
+
+	// removes peers that haven't announced in a while, and
+	// decays the popularity of torrents. This is expected to
+	// be called every few minutes
+	void tick();
+
+	int num_torrents() const { return m_num_torrents; }
+	int num_peers() const { return m_num_peers; }
+
+	// the number of bytes allocated by the storage
+	size_type memory_usage() const { return m_memory_usage; }
+
+#ifdef TORRENT_DEBUG
+	void check_invariant() const;
+#endif
+
+private:
+
+	// returns the slot index the info-hash hashes to. All 20 bytes
+	// are hashed, mixed with m_hash_seed
+	int home_slot(sha1_hash const& info_hash) const;
+
+	// returns the slot holding info_hash, or the empty slot
+	// it should be inserted into
+	int find_slot(sha1_hash const& info_hash) const;
+
+	// grows or shrinks the table to num_slots, a power of 2
+	void rehash(int num_slots);
+
+	// removes the torrent in slot. Entries further down its probe
+	// sequence are moved back, so there's no need for tombstones
+	void erase_slot(int slot);
+
+	// evicts one of the least popular torrents, but never the one
+	// with info-hash keep. Returns false if there was nothing to evict
+	bool evict(sha1_hash const& keep);
+
+	// makes room for at least one more peer in t. Returns false if
+	// it couldn't grow, in which case the oldest peer should be
+	// replaced
+	bool grow_peers(torrent_entry& t);
+
+	// frees the scrape filters of t, if it has any
+	void clear_scrape(torrent_entry& t);
+
+	// the peer array size limit for a single torrent
+	int max_peers() const;
+
+	boost::uint32_t seconds_since_epoch() const;
+
+	dht_settings const& m_settings;
+
+	// the hash table of torrents. The number of slots is always a
+	// power of 2, and at most half of them are in use
+	std::vector<torrent_entry> m_table;
+
+	// the number of bits of the hash used to index m_table
+	int m_hash_bits;
+
+	// random value mixed into the hash, to make it harder
+	// to target a specific part of the table
+	boost::uint32_t m_hash_seed;
+
+	// the info-hashes of all torrents in the table, sorted. This is
+	// what prefix lookups search. Its capacity is kept at half the
+	// number of slots, which is the most torrents the table can hold,
+	// so inserting never allocates
+	std::vector<sha1_hash> m_sorted;
+
+	int m_num_torrents;
+	int m_num_peers;
+	size_type m_memory_usage;
+
+	// timestamps in peer_entry are relative to this
+	ptime m_epoch;
+
+	// the filters returned by scrape() for torrents that
+	// don't have room for their own
+	scrape_filters m_scrape_scratch;
+};
+
+} } // namespace libtorrent::dht
+
+#endif // TORRENT_DHT_PEER_STORAGE_HPP_INCLUDED
+
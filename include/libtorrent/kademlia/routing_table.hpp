@@ -40,7 +40,6 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/tuple/tuple.hpp>
 #include <boost/array.hpp>
 #include <set>
-#include <list>
 
 #include <libtorrent/kademlia/logging.hpp>
 
@@ -68,9 +67,12 @@ typedef std::vector<node_entry> bucket_t;
 
 struct routing_table_node
 {
+	routing_table_node(): num_live(0) {}
 	bucket_t replacements;
-	bucket_t live_nodes;
 	ptime last_active;
+	// the number of live nodes in this bucket. The live nodes
+	// themselves are stored in the routing_table's node arrays
+	int num_live;
 };
 
 // differences in the implementation from the description in
@@ -134,9 +136,7 @@ public:
 		int num_buckets = m_buckets.size();
 		if (num_buckets == 0) return 0;
 		if (bucket < num_buckets) bucket = num_buckets - 1;
-		table_t::const_iterator i = m_buckets.begin();
-		std::advance(i, bucket);
-		return (int)i->live_nodes.size();
+		return m_buckets[bucket].num_live;
 	}
 
 	void for_each_node(void (*)(void*, node_entry const&)
@@ -166,14 +166,40 @@ public:
 
 private:
 
-	typedef std::list<routing_table_node> table_t;
+	typedef std::vector<routing_table_node> table_t;
 
-	table_t::iterator find_bucket(node_id const& id);
+	// returns the index of the bucket id belongs in
+	int find_bucket(node_id const& id);
 
-	// return a pointer the node_entry with the given endpoint
-	// or 0 if we don't have such a node. Both the address and the
-	// port has to match
-	node_entry* find_node(udp::endpoint const& ep, routing_table::table_t::iterator* bucket);
+	// looks for a node with the given endpoint, among the live nodes
+	// and in the replacement caches. Both the address and the port has
+	// to match. Returns false if there is no such node. Otherwise
+	// bucket is set to the bucket it's in and either slot is set to its
+	// live node slot or replacement to its index in the replacement
+	// cache. The other one is set to -1
+	bool find_node(udp::endpoint const& ep, int& bucket, int& slot
+		, int& replacement) const;
+
+	// the first slot in the node arrays belonging to bucket. Every
+	// bucket has room for as many nodes as it could hold with
+	// extended_routing_table turned on
+	int bucket_offset(int bucket) const;
+
+	// returns the slot of the live node with the given ID
+	// in bucket, or -1 if there is none
+	int find_live_node(int bucket, node_id const& id) const;
+
+	node_entry live_node(int slot) const;
+	void set_live_node(int slot, node_entry const& e);
+	void add_live_node(int bucket, node_entry const& e);
+	void erase_live_node(int bucket, int slot);
+
+	// appends a bucket to the end of the table
+	void add_bucket();
+
+	bool has_ip(address const& a) const;
+	void add_ip(address const& a);
+	void remove_ip(address const& a);
 
 	// constant called k in paper
 	int m_bucket_size;
@@ -188,6 +214,24 @@ private:
 	// added to the end and it's split up between them
 	table_t m_buckets;
 
+	// the live nodes of all buckets, as parallel arrays. The
+	// nodes of bucket n are in the m_buckets[n].num_live slots
+	// starting at bucket_offset(n). Keeping the IDs contiguous
+	// makes find_node() a linear scan over them
+	std::vector<node_id> m_ids;
+	std::vector<udp::endpoint> m_endpoints;
+	std::vector<boost::uint16_t> m_timeout_counts;
+	std::vector<boost::uint16_t> m_rtts;
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+	std::vector<ptime> m_first_seen;
+#endif
+
+	// the closest nodes found so far by find_node(). The first
+	// element is the 64 most significant bits of the distance to
+	// the target and the second one is the slot. It's a member to
+	// avoid allocating a new one for every lookup
+	std::vector<std::pair<boost::uint64_t, int> > m_closest;
+
 	node_id m_id; // our own node id
 
 	// the last time need_bootstrap() returned true
@@ -211,8 +255,8 @@ private:
 	// these are all the IPs that are in the routing
 	// table. It's used to only allow a single entry
 	// per IP in the whole table. Currently only for
-	// IPv4
-	std::set<address_v4::bytes_type> m_ips;
+	// IPv4. This is kept sorted
+	std::vector<boost::uint32_t> m_ips;
 };
 
 } } // namespace libtorrent::dht
@@ -46,6 +46,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/kademlia/observer.hpp>
 
 #include "libtorrent/ptime.hpp"
+#include "libtorrent/size_type.hpp"
+#include "libtorrent/slab_allocator.hpp"
+#include "libtorrent/timer_wheel.hpp"
+#include "libtorrent/session_status.hpp"
 
 namespace libtorrent { namespace aux { struct session_impl; } }
 
@@ -102,15 +106,52 @@ public:
 
 	int num_allocated_observers() const { return m_allocated_observers; }
 
+	// the number of requests we're waiting for a response to
+	int num_transactions() const { return m_num_transactions; }
+
+	// fills in the round-trip time histogram and timeout counters
+	void status(session_status& s) const;
+
 private:
 
-	boost::uint32_t calc_connection_id(udp::endpoint addr);
+	// an outstanding request. It's linked into the hash bucket of its
+	// transaction ID and target address, and its timer is scheduled
+	// in m_timeouts for the short timeout first, and then the full one
+	struct transaction
+	{
+		observer_ptr o;
+		// the next transaction in the same hash bucket
+		transaction* next;
+		timer_entry timer;
+		// true once the short timeout has fired
+		bool short_timeout;
+	};
+
+	int bucket_for(int tid, address const& addr) const;
+	void unlink(transaction* t);
+	void rehash(int num_buckets);
+
+	// converts a time to ticks of the timeout wheel, rounding up
+	boost::uint32_t wheel_tick(ptime t) const;
 
 	mutable boost::pool<> m_pool_allocator;
 
-	typedef std::list<observer_ptr> transactions_t;
-	transactions_t m_transactions;
-	
+	// outstanding transactions, hashed by transaction ID and target
+	// address. The number of buckets is always a power of 2
+	std::vector<transaction*> m_transactions;
+	int m_num_transactions;
+	slab_allocator<transaction> m_transaction_pool;
+
+	// the short and full timeouts of every outstanding transaction.
+	// Tick 0 of the wheel is m_start
+	timer_wheel m_timeouts;
+	ptime m_start;
+
+	// the number of replies whose round-trip time fell in each bucket.
+	// Bucket 0 is less than 1 ms, bucket n is [2^(n-1), 2^n) ms
+	int m_rtt_histogram[session_status::num_dht_rtt_buckets];
+	size_type m_num_timeouts;
+
 	udp_socket_interface* m_sock;
 	node_id m_our_id;
 	routing_table& m_table;
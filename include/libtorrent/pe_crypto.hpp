@@ -54,11 +54,23 @@ void TORRENT_EXTRA_EXPORT rc4_init(const unsigned char* in, unsigned long len, r
 unsigned long TORRENT_EXTRA_EXPORT rc4_encrypt(unsigned char *out, unsigned long outlen, rc4 *state);
 #endif
 
+#include <vector>
+#include <boost/version.hpp>
+#if BOOST_VERSION < 103500
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif
+
 #include "libtorrent/peer_id.hpp" // For sha1_hash
 #include "libtorrent/assert.hpp"
 
 namespace libtorrent
 {
+#if BOOST_VERSION >= 103500
+	namespace asio = boost::asio;
+#endif
+
 	class TORRENT_EXTRA_EXPORT dh_key_exchange
 	{
 	public:
@@ -93,6 +105,18 @@ namespace libtorrent
 		virtual void set_outgoing_key(unsigned char const* key, int len) = 0;
 		virtual void encrypt(char* pos, int len) = 0;
 		virtual void decrypt(char* pos, int len) = 0;
+
+		// encrypts all the buffers in place, in order, as if they
+		// were one contiguous buffer
+		virtual void encrypt_buffers(std::vector<asio::mutable_buffer> const& iovec)
+		{
+			for (std::vector<asio::mutable_buffer>::const_iterator i = iovec.begin()
+				, end(iovec.end()); i != end; ++i)
+			{
+				encrypt(asio::buffer_cast<char*>(*i), asio::buffer_size(*i));
+			}
+		}
+
 		virtual ~encryption_handler() {}
 	};
 
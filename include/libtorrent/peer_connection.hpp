@@ -241,6 +241,16 @@ namespace libtorrent
 		void request_large_blocks(bool b)
 		{ m_request_large_blocks = b; }
 
+		// the max number of bytes merged into a single request
+		// when requesting large blocks. 0 means unlimited
+		void max_large_request(int bytes)
+		{ m_max_large_request = bytes; }
+
+		// the lower bound of the desired request queue size,
+		// in blocks, regardless of the download rate
+		void min_desired_queue_size(int num)
+		{ m_min_desired_queue_size = num; }
+
 		void set_endgame(bool b) { m_endgame_mode = b; }
 		bool endgame() const { return m_endgame_mode; }
 
@@ -561,6 +571,20 @@ namespace libtorrent
 			, void (*fun)(char*, int, void*) = 0, void* userdata = 0);
 		virtual void setup_send();
 
+		// copies size bytes to the end of the send buffer and calls fun
+		// on each chunk once it has been copied. Unlike send_buffer(), this
+		// doesn't initiate a send. Returns false if we ran out of memory,
+		// in which case the connection has been disconnected
+		bool copy_send_buffer(char const* buf, int size
+			, void (*fun)(char*, int, void*) = 0, void* userdata = 0);
+
+		// returns size contiguous bytes at the end of the send buffer,
+		// without initiating a send. size may not be greater than
+		// one send buffer chunk (session_impl::send_buffer_size). Returns
+		// 0 if we ran out of memory, in which case the connection has
+		// been disconnected
+		char* allocate_send_buffer(int size);
+
 		void cork_socket() { TORRENT_ASSERT(!m_corked); m_corked = true; }
 		void uncork_socket();
 
@@ -667,6 +691,18 @@ namespace libtorrent
 		virtual void on_sent(error_code const& error
 			, std::size_t bytes_transferred) = 0;
 
+		// called right before the send buffer is handed to the socket.
+		// This lets bt_peer_connection encrypt everything queued since
+		// the last send in place, in one go
+		virtual void prepare_send_buffer() {}
+
+		// returns the bytes appended to the send buffer since the last
+		// call to send_buffer_tail() or skip_send_buffer_tail(). See
+		// chained_buffer::mutable_tail()
+		std::vector<asio::mutable_buffer> const& send_buffer_tail()
+		{ return m_send_buffer.mutable_tail(); }
+		void skip_send_buffer_tail() { m_send_buffer.skip_tail(); }
+
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		buffer::interval wr_recv_buffer()
 		{
@@ -745,6 +781,15 @@ namespace libtorrent
 		// web seeds also has a limit on the queue size.
 		int m_max_out_request_queue;
 
+		// the max number of bytes merged into one request when
+		// m_request_large_blocks is set. 0 means no limit
+		int m_max_large_request;
+
+		// the desired queue size is never set lower than this.
+		// Web seeds raise it to keep a few large range requests
+		// in flight from the start
+		int m_min_desired_queue_size;
+
 		// the average rate of receiving complete piece messages
 		sliding_average<20> m_piece_rate;
 		sliding_average<20> m_send_rate;
@@ -1061,8 +1106,9 @@ namespace libtorrent
 		boost::uint8_t m_prefer_whole_pieces;
 
 		// the number of request we should queue up
-		// at the remote end.
-		boost::uint8_t m_desired_queue_size;
+		// at the remote end. Web seeds queue up several
+		// large range requests, which may be more than 255 blocks
+		boost::uint16_t m_desired_queue_size;
 
 		// the number of piece requests we have rejected
 		// in a row because the peer is choked. This is
@@ -0,0 +1,330 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_PERFORMANCE_COUNTERS_HPP_INCLUDED
+#define TORRENT_PERFORMANCE_COUNTERS_HPP_INCLUDED
+
+#include <boost/cstdint.hpp>
+#include "libtorrent/config.hpp"
+#include "libtorrent/assert.hpp"
+
+namespace libtorrent
+{
+	// the registry of session wide performance counters. Counters are
+	// monotonically increasing event counts, gauges are sampled values
+	// that may go up and down. All of them are updated from the network
+	// thread only, so plain integers are enough. The disk thread's
+	// counters are sampled from its cache_status whenever the gauges
+	// are refreshed. The names of these values, as presented to clients,
+	// are defined in session_stats.cpp
+	struct TORRENT_EXTRA_EXPORT counters
+	{
+		enum stats_counter_t
+		{
+			// the number of peers that were disconnected and
+			// the reasons for disconnecting them
+			disconnected_peers,
+			error_peers,
+			eof_peers,
+			connreset_peers,
+			connrefused_peers,
+			connaborted_peers,
+			perm_peers,
+			buffer_peers,
+			unreachable_peers,
+			broken_pipe_peers,
+			addrinuse_peers,
+			no_access_peers,
+			invalid_arg_peers,
+			aborted_peers,
+			uninteresting_peers,
+			transport_timeout_peers,
+			timeout_peers,
+			no_memory_peers,
+			too_many_peers,
+			connect_timeouts,
+			error_incoming_peers,
+			error_outgoing_peers,
+			error_tcp_peers,
+			error_utp_peers,
+			error_encrypted_peers,
+			error_rc4_peers,
+
+			connection_attempts,
+			banned_peers,
+			banned_for_hash_failure,
+
+			// the smart ban plugin. Pieces whose blocks were hashed
+			// after failing or passing the hash check, block hashes
+			// recorded against the peers that sent them and peers
+			// banned for sending a bad block
+			smart_ban_failed_pieces,
+			smart_ban_passed_pieces,
+			smart_ban_blocks_recorded,
+			smart_ban_peers_banned,
+
+			// incoming piece requests and how they were handled
+			piece_requests,
+			max_piece_requests,
+			invalid_piece_requests,
+			choked_piece_requests,
+			cancelled_piece_requests,
+			piece_rejects,
+
+			// the number of blocks the piece picker looked at and
+			// the events that triggered picking pieces
+			piece_picker_blocks,
+			end_game_piece_picker_blocks,
+			reject_piece_picks,
+			unchoke_piece_picks,
+			incoming_redundant_piece_picks,
+			incoming_piece_picks,
+			end_game_piece_picks,
+			snubbed_piece_picks,
+
+			// the number of times the choker ran
+			num_unchoke_rounds,
+			num_optimistic_unchoke_rounds,
+
+			// the number of boost.asio handlers invoked, by type
+			on_read_counter,
+			on_write_counter,
+			on_tick_counter,
+			on_lsd_counter,
+			on_lsd_peer_counter,
+			on_udp_counter,
+			on_accept_counter,
+			on_disk_queue_counter,
+			on_disk_read_counter,
+			on_disk_write_counter,
+
+			// session wide transfer totals. These are sampled
+			// from the session's stat object
+			sent_bytes,
+			sent_payload_bytes,
+			recv_bytes,
+			recv_payload_bytes,
+			recv_failed_bytes,
+			recv_redundant_bytes,
+
+			// redundant bytes, by waste reason. These line up with
+			// torrent::wasted_reason_t
+			waste_piece_timed_out,
+			waste_piece_cancelled,
+			waste_piece_unknown,
+			waste_piece_seed,
+			waste_piece_end_game,
+			waste_piece_closing,
+
+			auto_manage_evaluations,
+
+			// torrents added by async_add_torrents(), once they have
+			// been loaded by the torrent_loader
+			startup_torrents_added,
+			startup_torrents_failed,
+
+			// HTTP tracker requests sent on a kept-alive connection
+			// from the pool, and the ones that needed a new connection
+			tracker_pool_hits,
+			tracker_pool_misses,
+
+			// hostname lookups answered by the session's DNS cache, and
+			// the ones that were sent to the system resolver (sampled
+			// from the resolver)
+			dns_cache_hits,
+			dns_cache_misses,
+
+			// disk thread totals, sampled from cache_status
+			num_blocks_read,
+			num_blocks_written,
+			num_blocks_cache_hits,
+			num_read_ops,
+			num_write_ops,
+			num_read_back,
+			disk_read_time,
+			disk_write_time,
+			disk_hash_time,
+			disk_sort_time,
+			disk_job_time,
+
+			// DHT traffic, sampled from the session's stat object
+			dht_bytes_in,
+			dht_bytes_out,
+
+			// histograms of the size of socket reads and writes.
+			// bucket N counts operations of up to 2^N bytes (plus the
+			// 13 bytes of a piece message header)
+			socket_send_size3,
+			socket_send_size20 = socket_send_size3 + 17,
+			socket_recv_size3,
+			socket_recv_size20 = socket_recv_size3 + 17,
+
+			num_stats_counters
+		};
+
+		enum stats_gauge_t
+		{
+			// the number of torrents in each state
+			num_checking_torrents = num_stats_counters,
+			num_stopped_torrents,
+			num_upload_only_torrents,
+			num_downloading_torrents,
+			num_seeding_torrents,
+			num_queued_seeding_torrents,
+			num_queued_download_torrents,
+			num_error_torrents,
+			num_torrents_want_peers,
+			num_ticking_torrents,
+			num_dormant_torrents,
+
+			// startup progress. The number of torrents passed to
+			// async_add_torrents() that are waiting to be loaded, and
+			// the number of torrents waiting for their resume data to
+			// be checked
+			num_startup_queued_torrents,
+			num_checking_resume_torrents,
+
+			// the number of peer connections in each state
+			num_peer_connections,
+			num_peers_connected,
+			num_peers_half_open,
+			num_tcp_peers,
+			num_utp_peers,
+			num_peers_up_interested,
+			num_peers_down_interesting,
+			num_peers_up_unchoked,
+			num_peers_down_unchoked,
+			num_peers_up_requests,
+			num_peers_down_requests,
+			num_peers_up_send_buffer,
+			num_peers_end_game,
+			num_unchoke_slots,
+
+			// the peer lists of all torrents
+			num_connect_candidates,
+			num_list_peers,
+			num_peer_allocations,
+			peer_list_bytes,
+
+			// outstanding block requests
+			num_outstanding_requests,
+			num_outstanding_end_game_requests,
+			num_outstanding_write_blocks,
+			num_pending_incoming_requests,
+			num_pending_reading_bytes,
+
+			// transfer rates, in bytes per second
+			upload_rate,
+			download_rate,
+			tcp_upload_rate,
+			tcp_download_rate,
+			utp_upload_rate,
+			utp_download_rate,
+
+			// the number of peers waiting on a rate limiter or
+			// on the disk
+			limiter_up_queue,
+			limiter_down_queue,
+			limiter_disk_up_queue,
+			limiter_disk_down_queue,
+
+			// the disk cache and job queue
+			disk_blocks_in_use,
+			disk_read_cache_blocks,
+			disk_cache_blocks,
+			disk_queued_write_bytes,
+			disk_job_queue_length,
+			disk_read_queue_size,
+			disk_average_read_time,
+			disk_average_write_time,
+			disk_average_hash_time,
+			disk_average_job_time,
+			disk_average_sort_time,
+			disk_average_queue_time,
+
+			// the number of uTP sockets in each state
+			num_utp_idle,
+			num_utp_syn_sent,
+			num_utp_connected,
+			num_utp_fin_sent,
+			num_utp_close_wait,
+
+			// the DHT routing table and storage
+			dht_nodes,
+			dht_node_cache,
+			dht_torrents,
+			dht_allocations,
+
+			num_counters,
+			num_gauges_counters = num_counters - num_stats_counters
+		};
+
+		counters()
+		{
+			for (int i = 0; i < num_counters; ++i)
+				m_stats_counter[i] = 0;
+		}
+
+		boost::int64_t operator[](int i) const
+		{
+			TORRENT_ASSERT(i >= 0);
+			TORRENT_ASSERT(i < num_counters);
+			return m_stats_counter[i];
+		}
+
+		// returns the new value
+		boost::int64_t inc_stats_counter(int c, boost::int64_t value = 1)
+		{
+			TORRENT_ASSERT(c >= 0);
+			TORRENT_ASSERT(c < num_stats_counters);
+			TORRENT_ASSERT(value >= 0);
+			return m_stats_counter[c] += value;
+		}
+
+		// counters that are sampled from other statistics objects
+		// (rather than incremented in place) and all gauges are
+		// set with this function
+		void set_value(int c, boost::int64_t value)
+		{
+			TORRENT_ASSERT(c >= 0);
+			TORRENT_ASSERT(c < num_counters);
+			m_stats_counter[c] = value;
+		}
+
+	private:
+
+		boost::int64_t m_stats_counter[num_counters];
+	};
+}
+
+#endif // TORRENT_PERFORMANCE_COUNTERS_HPP_INCLUDED
+
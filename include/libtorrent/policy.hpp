@@ -34,7 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_POLICY_HPP_INCLUDED
 
 #include <algorithm>
-#include <deque>
+#include <vector>
 #include "libtorrent/string_util.hpp" // for allocate_string_copy
 
 #include "libtorrent/peer.hpp"
@@ -44,6 +44,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/size_type.hpp"
 #include "libtorrent/invariant_check.hpp"
 #include "libtorrent/config.hpp"
+#include "libtorrent/slab_allocator.hpp"
 
 namespace libtorrent
 {
@@ -64,7 +65,7 @@ namespace libtorrent
 		ufloat16():m_val(0) {}
 		ufloat16(int v)
 		{ *this = v; }
-		operator int()
+		operator int() const
 		{
 			return (m_val >> 3) << ((m_val & 7) + 4);
 		}
@@ -83,7 +84,7 @@ namespace libtorrent
 					++exp;
 				}
 				TORRENT_ASSERT(exp <= 7);
-				m_val = (v << 3) || (exp & 7);
+				m_val = (v << 3) | (exp & 7);
 			}
 			return *this;
 		}
@@ -108,6 +109,7 @@ namespace libtorrent
 	public:
 
 		policy(torrent* t);
+		~policy();
 
 		struct peer;
 
@@ -134,6 +136,11 @@ namespace libtorrent
 		void set_connection(policy::peer* p, peer_connection* c);
 		void set_failcount(policy::peer* p, int f);
 
+		// last_connected is part of the rank of connect candidates,
+		// it must be updated through these to keep them ordered
+		void set_last_connected(policy::peer* p, int session_time);
+		void clear_last_connected();
+
 		// the peer has got at least one interesting piece
 		void peer_is_interesting(peer_connection& c);
 
@@ -148,24 +155,25 @@ namespace libtorrent
 		void check_invariant() const;
 #endif
 
-// intended struct layout (on 32 bit architectures)
+// intended struct layout (on 32 bit architectures, without GeoIP)
 // offset size  alignment field
 // 0      8     4         prev_amount_upload, prev_amount_download
 // 8      4     4         connection
-// 12     2     2         last_optimistically_unchoked
-// 14     2     2         last_connected
-// 16     16    1         addr
-// 32     2     2         port
-// 34     2     2         upload_rate_limit
-// 36     2     2         download_rate_limit
-// 38     1     1         hashfails
-// 39     1     1         failcount, connectable, optimistically_unchoked, seed
-// 40     1     1         fast_reconnects, trust_points
-// 41     1     1         source, pe_support, is_v6_addr
-// 42     1     1         on_parole, banned, added_to_dht, supports_utp,
+// 12     4     4         index
+// 16     2     2         last_optimistically_unchoked
+// 18     2     2         last_connected
+// 20     2     2         port
+// 22     1     1         hashfails
+// 23     1     1         failcount, connectable, optimistically_unchoked, seed
+// 24     1     1         fast_reconnects, trust_points
+// 25     1     1         source, pe_support, is_v6_addr
+// 26     1     1         on_parole, banned, added_to_dht, supports_utp,
 //                        supports_holepunch, web_seed
-// 43     1     1         <padding>
-// 44
+// 27     1     1         <padding>
+// 28                     addr (in ipv4_peer, ipv6_peer and i2p_peer)
+//
+// fields that are only touched when a peer connects or disconnects
+// (the rate limits) are not stored here, but in policy::m_rate_limits
 		struct TORRENT_EXTRA_EXPORT peer
 		{
 			peer(boost::uint16_t port, bool connectable, int src);
@@ -198,6 +206,12 @@ namespace libtorrent
 			// will refer to a valid peer_connection
 			peer_connection* connection;
 
+			// the position of this peer in policy::m_peers. It's
+			// used to erase the peer and to find its cold fields
+			// in constant time. Web seeds are not in the peer list
+			// and have this set to not_in_list
+			boost::uint32_t index;
+
 #ifndef TORRENT_DISABLE_GEO_IP
 #ifdef TORRENT_DEBUG
 			// only used in debug mode to assert that
@@ -224,10 +238,6 @@ namespace libtorrent
 			// the port this peer is or was connected on
 			boost::uint16_t port;
 
-			// the upload and download rate limits set for this peer
-			ufloat16 upload_rate_limit;
-			ufloat16 download_rate_limit;
-
 			// the number of times this peer has been
 			// part of a piece that failed the hash check
 			boost::uint8_t hashfails;
@@ -351,46 +361,11 @@ namespace libtorrent
 
 		int num_peers() const { return m_peers.size(); }
 
-		struct peer_address_compare
-		{
-			bool operator()(
-				peer const* lhs, libtorrent::address const& rhs) const
-			{
-				return lhs->address() < rhs;
-			}
+		// this is the value of peer::index for peers
+		// that are not in m_peers (i.e. web seeds)
+		enum { not_in_list = 0xffffffff };
 
-			bool operator()(
-				libtorrent::address const& lhs, peer const* rhs) const
-			{
-				return lhs < rhs->address();
-			}
-
-#if TORRENT_USE_I2P
-			bool operator()(
-				peer const* lhs, char const* rhs) const
-			{
-				return strcmp(lhs->dest(), rhs) < 0;
-			}
-
-			bool operator()(
-				char const* lhs, peer const* rhs) const
-			{
-				return strcmp(lhs, rhs->dest()) < 0;
-			}
-#endif
-
-			bool operator()(
-				peer const* lhs, peer const* rhs) const
-			{
-#if TORRENT_USE_I2P
-				if (rhs->is_i2p_addr == lhs->is_i2p_addr)
-					return strcmp(lhs->dest(), rhs->dest()) < 0;
-#endif
-				return lhs->address() < rhs->address();
-			}
-		};
-
-		typedef std::deque<peer*> peers_t;
+		typedef std::vector<peer*> peers_t;
 
 		typedef peers_t::iterator iterator;
 		typedef peers_t::const_iterator const_iterator;
@@ -399,40 +374,107 @@ namespace libtorrent
 		const_iterator begin_peer() const { return m_peers.begin(); }
 		const_iterator end_peer() const { return m_peers.end(); }
 
-		std::pair<iterator, iterator> find_peers(address const& a)
-		{
-			return std::equal_range(
-				m_peers.begin(), m_peers.end(), a, peer_address_compare());
-		}
+		// returns a peer with the given address, or 0 if there
+		// is none. If multiple connections per IP are allowed,
+		// any one of the peers with this address is returned
+		peer* find_peer(address const& a) const;
 
-		std::pair<const_iterator, const_iterator> find_peers(address const& a) const
-		{
-			return std::equal_range(
-				m_peers.begin(), m_peers.end(), a, peer_address_compare());
-		}
+		// returns the peer with the given IP and port, or 0
+		peer* find_peer(tcp::endpoint const& ep) const;
+
+#if TORRENT_USE_I2P
+		peer* find_i2p_peer(char const* destination) const;
+#endif
 
 		bool connect_one_peer(int session_time);
 
+		// returns the best peer to connect to, without connecting
+		// to it, or 0 if there is none
+		peer* find_connect_candidate(int session_time);
+
+		// rebuilds the heap of connect candidates. This is needed
+		// when the rank of many peers changes at once, for instance
+		// when their last_connected times are rewound
+		void rebuild_candidates();
+
 		bool has_peer(policy::peer const* p) const;
 
 		int num_seeds() const { return m_num_seeds; }
-		int num_connect_candidates() const { return m_num_connect_candidates; }
+		int num_connect_candidates() const { return m_candidates.size(); }
 		void recalculate_connect_candidates();
 
 		void erase_peer(policy::peer* p);
 		void erase_peer(iterator i);
 
+		// removes every peer from the list and returns all memory
+		// used by the peer list to the system. There must not be
+		// any connected peers
+		void clear_peer_list();
+
+		// the number of bytes used by the peer list. This includes
+		// the peer objects, the free slots in the allocators and the
+		// endpoint index
+		size_type memory_usage() const;
+
+		// the number of chunks of memory the peer objects are
+		// allocated from
+		int num_allocations() const;
+
 	private:
 
 		void update_peer(policy::peer* p, int src, int flags
 		, tcp::endpoint const& remote, char const* destination);
-		bool insert_peer(policy::peer* p, iterator iter, int flags);
+		bool insert_peer(policy::peer* p, int flags);
+
+		// allocates and constructs a new peer entry. It is not
+		// added to the peer list. Returns 0 if we're out of memory
+		peer* allocate_peer(tcp::endpoint const& remote, bool connectable, int src);
+		void free_peer(peer* p);
+
+		// appends p to m_peers and adds it to the endpoint index
+		void add_to_list(peer* p);
+
+		// the endpoint index is an open addressing hash table
+		// of positions in m_peers, keyed by the peer's address
+		// (or i2p destination). Collisions are resolved by
+		// linear probing.
+		int index_slot(int pos) const;
+		void index_insert(int pos);
+		void index_erase(int pos);
+		void index_rehash(int num_slots);
 
 		bool compare_peer_erase(policy::peer const& lhs, policy::peer const& rhs) const;
 		bool compare_peer(policy::peer const& lhs, policy::peer const& rhs
 			, address const& external_ip) const;
 
-		iterator find_connect_candidate(int session_time);
+		// the connect candidates are kept in a binary heap,
+		// ordered by compare_peer(). These maintain the heap
+		// and the position of every peer in it
+		void update_connect_candidate(peer* p);
+		void candidate_push(peer* p);
+		void candidate_erase(int pos);
+		void candidate_sift_up(int pos);
+		void candidate_sift_down(int pos);
+		void candidate_set(int pos, peer* p)
+		{
+			m_candidates[pos] = p;
+			m_candidate_pos[p->index] = pos;
+		}
+
+		// updates m_candidate_ip from our external address. Returns
+		// true if it changed, which means the heap must be rebuilt
+		bool update_candidate_ip();
+
+		// orders peers by their rank as connect candidates,
+		// with the best candidate at the top of a heap
+		struct candidate_compare
+		{
+			candidate_compare(policy const& p): m_policy(p) {}
+			bool operator()(peer const* lhs, peer const* rhs) const
+			{ return m_policy.compare_peer(*rhs, *lhs, m_policy.m_candidate_ip); }
+			policy const& m_policy;
+		};
+		friend struct candidate_compare;
 
 		bool is_connect_candidate(peer const& p, bool finished) const;
 		bool is_erase_candidate(peer const& p, bool finished) const;
@@ -442,8 +484,62 @@ namespace libtorrent
 		enum flags_t { force_erase = 1 };
 		void erase_peers(int flags = 0);
 
+		// all the peers we know about, in no particular order.
+		// every peer's index field is its position in this vector
 		peers_t m_peers;
 
+		// the rate limits of a peer are only used when it connects
+		// and disconnects. They are kept in this array, parallel
+		// to m_peers, to keep the peer objects small
+		struct rate_limits
+		{
+			ufloat16 upload;
+			ufloat16 download;
+		};
+		std::vector<rate_limits> m_rate_limits;
+
+		// the endpoint index. The size is always a power of 2
+		// (or 0). Empty slots are set to empty_slot
+		enum { empty_slot = 0xffffffff };
+		std::vector<boost::uint32_t> m_index;
+
+		// all connect candidates, i.e. peers that are not
+		// connected, not banned, connectable and haven't
+		// reached the max failcount. It's a binary heap with
+		// the best candidate (according to compare_peer())
+		// at the front
+		std::vector<peer*> m_candidates;
+
+		// the position of every peer in m_candidates, parallel
+		// to m_peers. Peers that aren't connect candidates have
+		// this set to not_in_list
+		std::vector<boost::uint32_t> m_candidate_pos;
+
+		// the address the cidr distance to connect candidates
+		// is measured from. When seeding, or if we don't know
+		// our external address, this is a random address to
+		// not bias any particular peers
+		address m_candidate_ip;
+
+#ifndef TORRENT_DISABLE_GEO_IP
+		// the session's AS rank generation when the heap was last
+		// rebuilt. The AS ranks are shared by every torrent and
+		// change as we download from peers, so the heap is rebuilt
+		// when this is behind the session's generation
+		int m_as_rank_generation;
+#endif
+
+		// the peer objects are allocated from these. Each
+		// torrent has its own allocators, which means the
+		// memory is returned when the torrent is removed
+		slab_allocator<ipv4_peer> m_ipv4_peers;
+#if TORRENT_USE_IPV6
+		slab_allocator<ipv6_peer> m_ipv6_peers;
+#endif
+#if TORRENT_USE_I2P
+		slab_allocator<i2p_peer> m_i2p_peers;
+#endif
+
 		torrent* m_torrent;
 
 		// this shouldbe NULL for the most part. It's set
@@ -454,18 +550,11 @@ namespace libtorrent
 		// if so, don't delete it.
 		peer* m_locked_peer;
 
-		// since the peer list can grow too large
-		// to scan all of it, start at this iterator
+		// the next peer to send a DHT ping to. Since the peer
+		// list can grow too large to scan all of it, we keep
+		// going from here
 		int m_round_robin;
 
-		// The number of peers in our peer list
-		// that are connect candidates. i.e. they're
-		// not already connected and they have not
-		// yet reached their max try count and they
-		// have the connectable state (we have a listen
-		// port for them).
-		int m_num_connect_candidates;
-
 		// the number of seeds in the peer list
 		int m_num_seeds;
 
@@ -478,6 +567,9 @@ namespace libtorrent
 		// is different from this state, we need to
 		// recalculate the connect candidates.
 		bool m_finished:1;
+
+		// true if m_candidate_ip is a random address
+		bool m_random_candidate_ip:1;
 	};
 
 	inline policy::ipv4_peer::ipv4_peer(
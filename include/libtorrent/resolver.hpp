@@ -0,0 +1,113 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_RESOLVER_HPP_INCLUDED
+#define TORRENT_RESOLVER_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/function/function2.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/socket.hpp"
+#include "libtorrent/address.hpp"
+#include "libtorrent/io_service_fwd.hpp"
+#include "libtorrent/error_code.hpp"
+#include "libtorrent/size_type.hpp"
+#include "libtorrent/time.hpp"
+
+namespace libtorrent
+{
+	// a hostname resolver with a cache in front of it. Lookups that
+	// were made less than cache_timeout seconds ago are answered from
+	// the cache, and concurrent lookups of the same hostname share a
+	// single query. This is used by the tracker connections and web
+	// seeds, which tend to look up the same few hostnames over and over.
+	// It may only be used from the thread running the io_service
+	struct TORRENT_EXTRA_EXPORT resolver : boost::noncopyable
+	{
+		typedef boost::function<void(error_code const&
+			, std::vector<address> const&)> callback_t;
+
+		resolver(io_service& ios);
+
+		// the handler is always posted, never called from within
+		// this function
+		void async_resolve(std::string const& host, callback_t const& h);
+
+		// cancels all outstanding lookups. Their handlers are called
+		// with operation_aborted
+		void cancel();
+
+		// 0 disables the cache, only concurrent lookups are merged
+		void set_cache_timeout(int seconds) { m_timeout = seconds; }
+
+		int size() const { return m_cache.size(); }
+		size_type num_hits() const { return m_hits; }
+		size_type num_misses() const { return m_misses; }
+
+	private:
+
+		void on_lookup(error_code const& ec, tcp::resolver::iterator i
+			, std::string hostname);
+
+		struct dns_cache_entry
+		{
+			ptime last_seen;
+			std::vector<address> addresses;
+		};
+
+		typedef std::map<std::string, dns_cache_entry> cache_t;
+		cache_t m_cache;
+
+		// the handlers waiting for a lookup that's in progress
+		typedef std::map<std::string, std::vector<callback_t> > pending_t;
+		pending_t m_pending;
+
+		io_service& m_ios;
+		tcp::resolver m_resolver;
+
+		// the number of seconds a cached result is valid for
+		int m_timeout;
+
+		// the max number of hostnames to keep in the cache
+		int m_max_size;
+
+		size_type m_hits;
+		size_type m_misses;
+	};
+}
+
+#endif // TORRENT_RESOLVER_HPP_INCLUDED
+
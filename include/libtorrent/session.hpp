@@ -189,7 +189,21 @@ namespace libtorrent
 			, boost::uint32_t flags = 0) const;
 		void refresh_torrent_status(std::vector<torrent_status>* ret
 			, boost::uint32_t flags = 0) const;
-		void post_torrent_updates();
+
+		// posts a state_update_alert with the status of all torrents
+		// whose state changed since the last call. ``flags`` has the same
+		// meaning as for torrent_handle::status()
+		void post_torrent_updates(boost::uint32_t flags = 0xffffffff);
+
+		// posts a state_delta_alert with the fields in ``fields`` (a mask
+		// of torrent_delta::field_bit()) that changed for every torrent
+		// whose state changed since the last call. The torrents are queued
+		// separately from post_torrent_updates()
+		void post_torrent_deltas(boost::uint64_t fields = ~boost::uint64_t(0));
+
+		// posts a session_stats_alert with the current value of all
+		// session counters and gauges. See session_stats_metrics()
+		void post_session_stats();
 
 		// returns a list of all torrents in this session
 		std::vector<torrent_handle> get_torrents() const;
@@ -205,6 +219,13 @@ namespace libtorrent
 #endif
 		torrent_handle add_torrent(add_torrent_params const& params, error_code& ec);
 		void async_add_torrent(add_torrent_params const& params);
+
+		// adds all torrents in ``params`` asynchronously. The resume data
+		// is parsed and the files are stat()ed on a pool of
+		// session_settings::startup_threads threads, and each torrent is
+		// added as soon as it's done. An add_torrent_alert is posted for
+		// each torrent, like for async_add_torrent().
+		void async_add_torrents(std::vector<add_torrent_params> const& params);
 		
 #ifndef BOOST_NO_EXCEPTIONS
 #ifndef TORRENT_NO_DEPRECATE
@@ -275,6 +296,7 @@ namespace libtorrent
 		void add_dht_node(std::pair<std::string, int> const& node);
 		void add_dht_router(std::pair<std::string, int> const& node);
 		bool is_dht_running() const;
+		void dht_scrape(sha1_hash const& info_hash);
 #endif
 
 #ifndef TORRENT_DISABLE_ENCRYPTION
@@ -465,6 +487,12 @@ namespace libtorrent
 		// delete them all.
 		void pop_alerts(std::deque<alert*>* alerts);
 
+		// pop all alerts in the alert queue and return pointers to
+		// them in 'alerts'. The alerts are still owned by the session
+		// and stay valid until the next call to this function, which
+		// frees them. The alerts are handed over without copying them
+		void pop_alerts(std::vector<alert*>* alerts);
+
 #ifndef TORRENT_NO_DEPRECATE
 		TORRENT_DEPRECATED_PREFIX
 		void set_severity_level(alert::severity_t s) TORRENT_DEPRECATED;
@@ -939,6 +939,42 @@ namespace libtorrent
 		// http_connection maximum receive buffer size
 		// limits torrent file size for URL torrents
 		int max_http_recv_buffer_size;
+
+		// the number of seconds a torrent has to be dormant (i.e.
+		// have no connections and no activity) before its metadata
+		// and peer list are evicted to the metadata cache. They are
+		// loaded back as soon as the torrent needs them. 0 disables
+		// eviction
+		int metadata_unload_timeout;
+
+		// the directory evicted metadata is saved in. Eviction is
+		// disabled if this is empty
+		std::string metadata_cache_path;
+
+		// the number of threads used to load torrents added with
+		// session::async_add_torrents(). The threads are started the
+		// first time it's called
+		int startup_threads;
+
+		// the max number of requests started per second to any single
+		// tracker (protocol, hostname and port). Requests above the limit
+		// are queued. 0 means unlimited
+		int tracker_host_requests_per_second;
+
+		// the number of seconds a kept-alive connection to an HTTP
+		// tracker is kept open while it's not used. 0 disables
+		// keep-alive and opens a new connection for every request
+		int tracker_keep_alive_timeout;
+
+		// the max number of bytes requested from a url-seed in a single
+		// HTTP request. Adjacent blocks (even across pieces) are coalesced
+		// into one range request up to this size
+		int urlseed_max_request_bytes;
+
+		// the max number of connections to open to a single web seed.
+		// Additional connections are opened one at a time, as long as
+		// the torrent is below its connection limit
+		int max_web_seed_connections;
 	};
 
 #ifndef TORRENT_DISABLE_DHT
@@ -952,6 +988,8 @@ namespace libtorrent
 #endif
 			, max_fail_count(20)
 			, max_torrents(2000)
+			, max_peers(500)
+			, max_peer_storage_size(16 * 1024 * 1024)
 			, max_dht_items(700)
 			, max_torrent_search_reply(20)
 			, restrict_routing_ips(true)
@@ -980,6 +1018,15 @@ namespace libtorrent
 		// this is the max number of torrents the DHT will track
 		int max_torrents;
 
+		// the max number of peers to store per torrent. Once a
+		// torrent is full, new peers replace the oldest ones
+		int max_peers;
+
+		// the max number of bytes to use for storing announced
+		// peers. When it's used up, the least popular torrents
+		// are evicted
+		int max_peer_storage_size;
+
 		// max number of items the DHT will store
 		int max_dht_items;
 
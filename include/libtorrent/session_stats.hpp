@@ -0,0 +1,64 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_SESSION_STATS_HPP_INCLUDED
+#define TORRENT_SESSION_STATS_HPP_INCLUDED
+
+#include "libtorrent/config.hpp"
+#include <vector>
+
+namespace libtorrent
+{
+	// describes one value in the values array of session_stats_alert.
+	// The names are stable across versions, the indices are not. Clients
+	// are expected to look up the index of the metrics they're interested
+	// in once, by name, with find_metric_idx()
+	struct TORRENT_EXPORT stats_metric
+	{
+		// the name is made up of a category and a name, separated
+		// by a dot. e.g. "peer.disconnected_peers"
+		char const* name;
+		int value_index;
+		enum { type_counter, type_gauge };
+		int type;
+	};
+
+	// returns the table of all metrics posted in session_stats_alert
+	TORRENT_EXPORT std::vector<stats_metric> session_stats_metrics();
+
+	// returns the index into session_stats_alert::values of the metric
+	// with the specified name, or -1 if there is no such metric
+	TORRENT_EXPORT int find_metric_idx(char const* name);
+}
+
+#endif // TORRENT_SESSION_STATS_HPP_INCLUDED
+
@@ -36,6 +36,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/config.hpp"
 #include "libtorrent/size_type.hpp"
 #include <vector>
+#include <string>
 
 namespace libtorrent
 {
@@ -72,6 +73,31 @@ namespace libtorrent
 
 #endif
 
+	struct tracker_host_status
+	{
+		// the protocol, hostname and port of the tracker, for
+		// instance "udp://tracker.example.com:6969"
+		std::string host;
+
+		// requests that have completed, failed and timed out (timeouts
+		// are included in the failures)
+		int num_requests;
+		int num_failures;
+		int num_timeouts;
+
+		// the average round-trip time of successful requests, in
+		// milliseconds
+		int rtt;
+
+		// the number of requests currently outstanding
+		int in_flight;
+
+		// the number of requests held back by the rate limit, and the
+		// number of UDP scrapes waiting to be sent together
+		int queued;
+		int queued_scrapes;
+	};
+
 	struct utp_status
 	{
 		int num_idle;
@@ -137,11 +163,31 @@ namespace libtorrent
 		std::vector<dht_lookup> active_requests;
 		std::vector<dht_routing_bucket> dht_routing_table;
 		int dht_total_allocations;
+
+		enum { num_dht_rtt_buckets = 15 };
+		int dht_rtt_histogram[num_dht_rtt_buckets];
+		int dht_outstanding_transactions;
+		size_type dht_transaction_timeouts;
 #endif
 
 		utp_status utp_stats;
 
 		int peerlist_size;
+		size_type peerlist_memory;
+		int peerlist_bytes_per_peer;
+
+		int num_ticking_torrents;
+		int num_dormant_torrents;
+
+		enum { num_tick_histogram_buckets = 12 };
+		int tick_histogram[num_tick_histogram_buckets];
+		int torrent_tick_histogram[num_tick_histogram_buckets];
+
+		size_type auto_manage_evaluations;
+
+		// one entry per tracker host that has been announced or
+		// scraped to
+		std::vector<tracker_host_status> tracker_hosts;
 	};
 
 }
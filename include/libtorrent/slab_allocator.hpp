@@ -0,0 +1,199 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_SLAB_ALLOCATOR_HPP_INCLUDED
+#define TORRENT_SLAB_ALLOCATOR_HPP_INCLUDED
+
+#include <vector>
+#include <utility> // for pair
+#include <algorithm> // for min, max
+#include <cstdlib> // for malloc/free
+#include <cstring> // for memcpy
+#include <boost/noncopyable.hpp>
+#include "libtorrent/assert.hpp"
+
+namespace libtorrent
+{
+	// a simple allocator for fixed size objects. Memory is allocated in
+	// chunks (slabs) that grow geometrically up to max_chunk_size objects.
+	// Freed slots are kept in an intrusive free list. Unlike
+	// boost::object_pool, releasing an object is O(1) and all memory is
+	// returned to the system when the allocator is destructed. The memory
+	// of a slot is never returned to the system while the allocator is
+	// alive, so it is safe to read (but not trust) a dangling pointer
+	// into it.
+	template <class T, int max_chunk_size = 4096>
+	struct slab_allocator : boost::noncopyable
+	{
+		slab_allocator()
+			: m_free_list(0)
+			, m_next_chunk_size(32)
+			, m_size(0)
+			, m_capacity(0)
+		{}
+
+		~slab_allocator()
+		{
+			TORRENT_ASSERT(m_size == 0);
+			for (std::vector<chunk_t>::iterator i = m_chunks.begin()
+				, end(m_chunks.end()); i != end; ++i)
+				std::free(i->first);
+		}
+
+		// returns uninitialized memory for one T. The caller is expected to
+		// construct the object with placement new. Returns 0 if we're out
+		// of memory
+		T* malloc()
+		{
+			if (m_free_list == 0 && !grow()) return 0;
+			char* ret = m_free_list;
+			std::memcpy(&m_free_list, ret, sizeof(char*));
+			++m_size;
+			return reinterpret_cast<T*>(ret);
+		}
+
+		// returns the slot p to the free list. This does not call the
+		// destructor of p
+		void free(T* p)
+		{
+			TORRENT_ASSERT(is_from(p));
+			TORRENT_ASSERT(m_size > 0);
+			char* slot = reinterpret_cast<char*>(p);
+			std::memcpy(slot, &m_free_list, sizeof(char*));
+			m_free_list = slot;
+			--m_size;
+		}
+
+		void destroy(T* p)
+		{
+			p->~T();
+			free(p);
+		}
+
+		// this is a linear scan over the chunks. Once they have reached
+		// max_chunk_size, the number of chunks grows linearly with the
+		// number of objects, so this is only meant for asserts
+		bool is_from(T const* p) const
+		{
+			char const* ptr = reinterpret_cast<char const*>(p);
+			for (std::vector<chunk_t>::const_iterator i = m_chunks.begin()
+				, end(m_chunks.end()); i != end; ++i)
+			{
+				if (ptr < i->first || ptr >= i->first + i->second * slot_size)
+					continue;
+				return (ptr - i->first) % slot_size == 0;
+			}
+			return false;
+		}
+
+		// returns all chunks to the system. This may only be called
+		// when there are no live objects
+		void release_memory()
+		{
+			TORRENT_ASSERT(m_size == 0);
+			for (std::vector<chunk_t>::iterator i = m_chunks.begin()
+				, end(m_chunks.end()); i != end; ++i)
+				std::free(i->first);
+			std::vector<chunk_t>().swap(m_chunks);
+			m_free_list = 0;
+			m_next_chunk_size = 32;
+			m_capacity = 0;
+		}
+
+		// the number of live objects
+		int size() const { return m_size; }
+
+		// the number of slots (allocated or not)
+		int capacity() const { return m_capacity; }
+
+		// the number of chunks allocated from the system
+		int num_chunks() const { return m_chunks.size(); }
+
+		// the number of bytes this allocator has allocated from
+		// the system, including the free slots
+		size_t allocated_bytes() const
+		{
+			return size_t(m_capacity) * slot_size
+				+ m_chunks.capacity() * sizeof(chunk_t);
+		}
+
+	private:
+
+		// every slot needs to be able to hold the free-list pointer.
+		// Rounding up to a multiple of the pointer size preserves the
+		// alignment of T, since sizeof(T) is a multiple of its alignment
+		enum { slot_size = (sizeof(T) + sizeof(char*) - 1)
+			/ sizeof(char*) * sizeof(char*) };
+
+		bool grow()
+		{
+			// make room for the chunk before allocating it, so that the
+			// push_back below can't throw and leak it
+			if (m_chunks.size() == m_chunks.capacity())
+				m_chunks.reserve((std::max)(m_chunks.size() * 2, size_t(8)));
+
+			int num_slots = m_next_chunk_size;
+			char* mem = static_cast<char*>(std::malloc(num_slots * slot_size));
+			if (mem == 0) return false;
+			m_chunks.push_back(chunk_t(mem, num_slots));
+			m_capacity += num_slots;
+			if (m_next_chunk_size < max_chunk_size)
+				m_next_chunk_size = (std::min)(m_next_chunk_size * 2, int(max_chunk_size));
+
+			// thread the new slots onto the free list, in address order
+			for (int i = num_slots - 1; i >= 0; --i)
+			{
+				char* slot = mem + i * slot_size;
+				std::memcpy(slot, &m_free_list, sizeof(char*));
+				m_free_list = slot;
+			}
+			return true;
+		}
+
+		// the start of each chunk and the number of slots in it
+		typedef std::pair<char*, int> chunk_t;
+		std::vector<chunk_t> m_chunks;
+
+		// the first free slot. Every free slot holds a pointer
+		// to the next free slot in its first bytes
+		char* m_free_list;
+
+		// the number of slots to allocate in the next chunk
+		int m_next_chunk_size;
+
+		int m_size;
+		int m_capacity;
+	};
+}
+
+#endif // TORRENT_SLAB_ALLOCATOR_HPP_INCLUDED
+
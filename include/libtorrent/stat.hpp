@@ -97,6 +97,11 @@ namespace libtorrent
 
 		int counter() const { return m_counter; }
 
+		// true if nothing has been transferred in this
+		// second and both averages have faded out to 0
+		bool is_idle() const
+		{ return m_counter == 0 && m_5_sec_average == 0 && m_30_sec_average == 0; }
+
 		void clear()
 		{
 			m_counter = 0;
@@ -235,6 +240,13 @@ namespace libtorrent
 				m_stat[i].second_tick(tick_interval_ms);
 		}
 
+		bool is_idle() const
+		{
+			for (int i = 0; i < num_channels; ++i)
+				if (!m_stat[i].is_idle()) return false;
+			return true;
+		}
+
 		int low_pass_upload_rate() const
 		{
 			return m_stat[upload_payload].low_pass_rate()
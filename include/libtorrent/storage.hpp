@@ -62,6 +62,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/thread.hpp"
 #include "libtorrent/storage_defs.hpp"
 #include "libtorrent/allocator.hpp"
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/lazy_entry.hpp"
 
 namespace libtorrent
 {
@@ -75,12 +77,15 @@ namespace libtorrent
 		file_storage const& t
 		, std::string const& p);
 
+	// if ``pool`` is set, its stat cache is used for files that
+	// were stat'ed ahead of time
 	TORRENT_EXTRA_EXPORT bool match_filesizes(
 		file_storage const& t
-		, std::string const& p
+		, std::string p
 		, std::vector<std::pair<size_type, std::time_t> > const& sizes
-		, bool compact_mode
-		, std::string* error = 0);
+		, int flags
+		, error_code& error
+		, file_pool* pool = 0);
 /*
 	struct TORRENT_EXTRA_EXPORT file_allocation_failed: std::exception
 	{
@@ -132,7 +137,19 @@ namespace libtorrent
 		virtual bool move_storage(std::string const& save_path) = 0;
 
 		// verify storage dependent fast resume entries
-		virtual bool verify_resume_data(lazy_entry const& rd, error_code& error) = 0;
+#ifndef TORRENT_NO_DEPRECATE
+		// The default implementation parses the resume data into a
+		// lazy_entry and calls the deprecated overload, for storages
+		// that only implement that one
+		virtual bool verify_resume_data(bdecode_node const& rd, error_code& error);
+
+		// deprecated in 1.0, override the bdecode_node overload instead.
+		// It's not marked TORRENT_DEPRECATED since the library still
+		// calls it
+		virtual bool verify_resume_data(lazy_entry const& rd, error_code& error);
+#else
+		virtual bool verify_resume_data(bdecode_node const& rd, error_code& error) = 0;
+#endif
 
 		// write storage dependent fast resume entries
 		virtual bool write_resume_data(entry& rd) const = 0;
@@ -204,7 +221,8 @@ namespace libtorrent
 		bool move_slot(int src_slot, int dst_slot);
 		bool swap_slots(int slot1, int slot2);
 		bool swap_slots3(int slot1, int slot2, int slot3);
-		bool verify_resume_data(lazy_entry const& rd, error_code& error);
+		using storage_interface::verify_resume_data;
+		bool verify_resume_data(bdecode_node const& rd, error_code& error);
 		bool write_resume_data(entry& rd) const;
 
 		// this identifies a read or write operation
@@ -276,7 +294,8 @@ namespace libtorrent
 		bool move_slot(int, int) { return false; }
 		bool swap_slots(int, int) { return false; }
 		bool swap_slots3(int, int, int) { return false; }
-		bool verify_resume_data(lazy_entry const&, error_code&) { return false; }
+		using storage_interface::verify_resume_data;
+		bool verify_resume_data(bdecode_node const&, error_code&) { return false; }
 		bool write_resume_data(entry&) const { return false; }
 
 		int m_piece_size;
@@ -309,7 +328,7 @@ namespace libtorrent
 
 		void async_finalize_file(int file);
 
-		void async_check_fastresume(lazy_entry const* resume_data
+		void async_check_fastresume(bdecode_node const* resume_data
 			, boost::function<void(int, disk_io_job const&)> const& handler);
 		
 		void async_check_files(boost::function<void(int, disk_io_job const&)> const& handler);
@@ -340,6 +359,12 @@ namespace libtorrent
 
 		void async_hash(int piece, boost::function<void(int, disk_io_job const&)> const& f);
 
+		// reads back the piece from disk and hashes each block, with
+		// salt appended to it. The hashes are passed back in the job's
+		// block_hashes
+		void async_hash_blocks(int piece, int salt
+			, boost::function<void(int, disk_io_job const&)> const& f);
+
 		void async_release_files(
 			boost::function<void(int, disk_io_job const&)> const& handler
 			= boost::function<void(int, disk_io_job const&)>());
@@ -375,7 +400,7 @@ namespace libtorrent
 
 		std::string save_path() const;
 
-		bool verify_resume_data(lazy_entry const& rd, error_code& e)
+		bool verify_resume_data(bdecode_node const& rd, error_code& e)
 		{ return m_storage->verify_resume_data(rd, e); }
 
 		bool is_allocating() const
@@ -399,7 +424,7 @@ namespace libtorrent
 		// the error message indicates that the fast resume data was rejected
 		// if 'fatal_disk_error' is returned, the error message indicates what
 		// when wrong in the disk access
-		int check_fastresume(lazy_entry const& rd, error_code& error);
+		int check_fastresume(bdecode_node const& rd, error_code& error);
 
 		// this function returns true if the checking is complete
 		int check_files(int& current_slot, int& have_piece, error_code& error);
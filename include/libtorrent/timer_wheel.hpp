@@ -0,0 +1,124 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_TIMER_WHEEL_HPP_INCLUDED
+#define TORRENT_TIMER_WHEEL_HPP_INCLUDED
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include "libtorrent/config.hpp"
+#include "libtorrent/assert.hpp"
+
+namespace libtorrent
+{
+	// an entry in a timer_wheel. It's meant to be embedded in the object
+	// that wants to be woken up. The userdata pointer is not used by the
+	// wheel, it's there for the owner to find its way back from an expired
+	// entry. An entry may only be scheduled in one wheel at a time
+	struct timer_entry
+	{
+		timer_entry(): next(0), prev(0), expires(0), userdata(0) {}
+		bool scheduled() const { return next != 0; }
+
+		timer_entry* next;
+		timer_entry* prev;
+		// the tick this entry is due
+		boost::uint32_t expires;
+		void* userdata;
+	};
+
+	// a hierarchical timer wheel. Scheduling and cancelling a timer is O(1).
+	// Advancing the wheel is O(1) per tick plus the cost of the expired
+	// timers, with an occasional cascade of a higher level slot into
+	// the levels below it. The unit of a tick is up to the user (the session
+	// uses seconds). Timers that are further into the future than the wheel
+	// can represent (about 2^24 ticks) are clamped to its horizon
+	struct TORRENT_EXTRA_EXPORT timer_wheel : boost::noncopyable
+	{
+		// now is the tick the wheel starts at
+		timer_wheel(boost::uint32_t now = 0);
+		~timer_wheel();
+
+		// schedules e to expire at the given tick. If e is already
+		// scheduled, it's moved. Timers that are due now or in the past
+		// will expire on the next call to advance() with a later tick
+		void schedule(timer_entry* e, boost::uint32_t expires);
+
+		// removes e from the wheel. It's fine to cancel an entry that
+		// isn't scheduled
+		void cancel(timer_entry* e);
+
+		// moves the wheel forward to now, and appends every timer that
+		// expired to the expired vector, in expiry order. The entries are
+		// unlinked from the wheel before they are returned, so they
+		// may be rescheduled right away
+		void advance(boost::uint32_t now, std::vector<timer_entry*>& expired);
+
+		// the number of scheduled timers
+		int size() const { return m_size; }
+
+		// the next tick to be processed by advance()
+		boost::uint32_t current_tick() const { return m_now; }
+
+		// returns the tick the earliest scheduled timer is due, or the
+		// current tick if it's overdue. This only looks at the first
+		// occupied slot of every level, so it doesn't walk all the
+		// timers. May only be called if size() > 0
+		boost::uint32_t next_expiry() const;
+
+	private:
+
+		enum
+		{
+			slot_bits = 6,
+			num_slots = 1 << slot_bits,
+			slot_mask = num_slots - 1,
+			num_levels = 4
+		};
+
+		void link(timer_entry* e);
+		void cascade(int level);
+
+		// every slot is a circular list with a sentinel head
+		timer_entry m_slots[num_levels][num_slots];
+
+		// the next tick that will be processed by advance().
+		// every scheduled timer expires at this tick or later
+		boost::uint32_t m_now;
+
+		int m_size;
+	};
+}
+
+#endif // TORRENT_TIMER_WHEEL_HPP_INCLUDED
+
@@ -46,6 +46,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/tuple/tuple.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/intrusive_ptr.hpp>
 #include <boost/version.hpp>
 
@@ -55,6 +56,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/torrent_handle.hpp"
 #include "libtorrent/entry.hpp"
+#include "libtorrent/bdecode.hpp"
 #include "libtorrent/torrent_info.hpp"
 #include "libtorrent/socket.hpp"
 #include "libtorrent/address.hpp"
@@ -74,6 +76,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/aux_/session_impl.hpp"
 #include "libtorrent/deadline_timer.hpp"
 #include "libtorrent/union_endpoint.hpp"
+#include "libtorrent/timer_wheel.hpp"
 
 #if TORRENT_COMPLETE_TYPES_REQUIRED
 #include "libtorrent/peer_connection.hpp"
@@ -125,7 +128,10 @@ namespace libtorrent
 		{ return m_torrent_file->info_hash(); }
 
 		// starts the announce timer
-		void start();
+		// resume is the resume data, if it's already been decoded.
+		// It must refer into the resume data buffer passed to the
+		// constructor. It's taken over by the torrent
+		void start(bdecode_node* resume = 0);
 
 		void start_download_url();
 
@@ -225,6 +231,73 @@ namespace libtorrent
 
 		void second_tick(stat& accumulator, int tick_interval_ms);
 
+		// a torrent that doesn't need to be ticked every second (no
+		// peers, no transfer rates to fade out and no web seeds to
+		// connect to) goes dormant and is taken out of the session's
+		// tick loop. wake_up() puts it back. It's called whenever
+		// something happens that second_tick() needs to attend to
+		void wake_up();
+		bool is_dormant() const { return m_dormant; }
+
+		// takes this torrent out of the session's tick loop and
+		// timer wheel. Called when the torrent is aborted
+		void stop_ticking();
+
+		// a torrent that has been dormant for metadata_unload_timeout
+		// seconds saves its info section and peer list to the metadata
+		// cache and frees them. need_loaded() brings them back, and
+		// has to be called before anything that needs the file list,
+		// the piece hashes or the peer list. It returns false if the
+		// metadata couldn't be restored, in which case the torrent is
+		// set to an error state
+		bool unload_metadata();
+		bool need_loaded();
+		bool is_loaded() const { return m_torrent_file->is_loaded(); }
+
+		// loads the metadata and keeps it from being unloaded until
+		// unpin_torrent_file() has been called as many times as
+		// pin_torrent_file(). Unloading frees the file list and info
+		// section of the torrent_info in place, so this is how a client
+		// holding a reference to it keeps it valid
+		bool pin_torrent_file();
+		void unpin_torrent_file();
+
+		// loads the metadata and restarts the unload timer, without
+		// pinning the torrent. Used by the deprecated
+		// torrent_handle::get_torrent_info()
+		bool load_torrent_file();
+
+		// the index of this torrent in the session's list of
+		// ticking torrents, or -1 if it's not in it
+		int ticking_index() const { return m_ticking_index; }
+		void set_ticking_index(int i) { m_ticking_index = i; }
+
+		// true while the session ticks this torrent, or wakes
+		// it up when it's dormant
+		bool in_tick_schedule() const { return m_ticking_index >= 0 || m_dormant; }
+
+		// true if this torrent is allowed to have peers or
+		// to announce. Torrents that aren't are left alone by
+		// the auto-manager once it's out of active slots
+		bool is_engaged() const
+		{
+			return m_allow_peers || m_announce_to_dht
+				|| m_announce_to_trackers || m_announce_to_lsd;
+		}
+
+		// the session's auto-manage queue this torrent is in (or -1)
+		// and its sort key in that queue. These are maintained by
+		// session_impl::update_auto_manage_state()
+		int auto_manage_queue() const { return m_auto_manage_queue; }
+		int auto_manage_key() const { return m_auto_manage_key; }
+		void set_auto_manage_position(int queue, int key)
+		{ m_auto_manage_queue = queue; m_auto_manage_key = key; }
+
+		// the index of this torrent in the session's list of
+		// engaged torrents, or -1
+		int engaged_index() const { return m_engaged_index; }
+		void set_engaged_index(int i) { m_engaged_index = i; }
+
 		std::string name() const;
 
 		stat statistics() const { return m_stat; }
@@ -296,6 +369,7 @@ namespace libtorrent
 		void filter_files(std::vector<bool> const& files);
 #if !TORRENT_NO_FPU
 		void file_progress(std::vector<float>& fp) const;
+		void load_file_progress(std::vector<float>& fp);
 #endif
 		// ============ end deprecation =============
 
@@ -319,11 +393,20 @@ namespace libtorrent
 
 		void status(torrent_status* st, boost::uint32_t flags);
 
+		// fills in the fields in ``fields`` (a mask of torrent_delta
+		// field bits) that changed since the last call. Returns false
+		// if none of them changed
+		bool status_delta(torrent_delta* d, boost::uint64_t fields);
+
 		// this torrent changed state, if the user is subscribing to
 		// it, add it to the m_state_updates list in session_impl
 		void state_updated();
 
+		// file_progress() needs the file list, and reports no files
+		// while the metadata is unloaded. load_file_progress() loads
+		// the metadata first
 		void file_progress(std::vector<size_type>& fp, int flags = 0) const;
+		void load_file_progress(std::vector<size_type>& fp, int flags);
 
 		void use_interface(std::string net_interface);
 		tcp::endpoint get_interface() const;
@@ -477,7 +560,8 @@ namespace libtorrent
 		void announce_with_tracker(tracker_request::event_t e
 			= tracker_request::none
 			, address const& bind_interface = address_v4::any());
-		int seconds_since_last_scrape() const { return m_last_scrape; }
+		int seconds_since_last_scrape() const
+		{ return boost::uint16_t(m_last_scrape + dormant_seconds()); }
 
 #ifndef TORRENT_DISABLE_DHT
 		void dht_announce();
@@ -628,22 +712,30 @@ namespace libtorrent
 		void on_peer_name_lookup(error_code const& e, tcp::resolver::iterator i
 			, peer_id pid);
 
-		// this is the asio callback that is called when a name
+		// this is the callback that is called when a name
 		// lookup for a WEB SEED is completed.
-		void on_name_lookup(error_code const& e, tcp::resolver::iterator i
-			, std::list<web_seed_entry>::iterator url, tcp::endpoint proxy);
+		void on_name_lookup(error_code const& e, std::vector<address> const& host
+			, int port, std::list<web_seed_entry>::iterator url, tcp::endpoint proxy);
 
 		void connect_web_seed(std::list<web_seed_entry>::iterator web, tcp::endpoint a);
 
-		// this is the asio callback that is called when a name
+		// this is the callback that is called when a name
 		// lookup for a proxy for a web seed is completed.
-		void on_proxy_name_lookup(error_code const& e, tcp::resolver::iterator i
-			, std::list<web_seed_entry>::iterator url);
+		void on_proxy_name_lookup(error_code const& e, std::vector<address> const& host
+			, int proxy_port, std::list<web_seed_entry>::iterator url);
 
 		// remove a web seed, or schedule it for removal in case there
 		// are outstanding operations on it
 		void remove_web_seed(std::list<web_seed_entry>::iterator web);
 
+		// detaches the connection (if any) from one of the peer
+		// slots of a web seed and removes the slot from the picker
+		void clear_web_seed_peer(policy::peer& p);
+
+		// the max number of connections to open to a single web seed
+		int web_seed_connection_limit() const
+		{ return (std::max)(settings().max_web_seed_connections, 1); }
+
 		// this is called when the torrent has finished. i.e.
 		// all the pieces we have not filtered have been downloaded.
 		// If no pieces are filtered, this is called first and then
@@ -735,8 +827,13 @@ namespace libtorrent
 
 		torrent_handle get_handle();
 
+		// write_resume_data() requires the metadata to be loaded, since
+		// the resume data includes the peer list.
+		// load_write_resume_data() loads it first, and leaves rd
+		// untouched if that fails
 		void write_resume_data(entry& rd) const;
-		void read_resume_data(lazy_entry const& rd);
+		bool load_write_resume_data(entry& rd);
+		void read_resume_data(bdecode_node const& rd);
 
 		void seen_complete() { m_last_seen_complete = time(0); }
 		int time_since_complete() const { return int(time(0) - m_last_seen_complete); }
@@ -853,8 +950,8 @@ namespace libtorrent
 		void queue_torrent_check();
 		void dequeue_torrent_check();
 
-		void clear_in_state_update()
-		{ m_in_state_updates = false; }
+		void clear_in_state_update(int queue)
+		{ m_in_state_updates &= ~(1 << queue); }
 
 		void inc_num_connecting()
 		{ ++m_num_connecting; }
@@ -874,6 +971,27 @@ namespace libtorrent
 
 	private:
 
+		// goes dormant if there's nothing for second_tick() to do
+		void maybe_go_dormant();
+
+		// true if unload_metadata() is allowed to evict the metadata
+		// right now
+		bool can_unload_metadata() const;
+		std::string metadata_cache_file() const;
+
+		// adds the peers in the "peers", "peers6", "banned_peers" and
+		// "banned_peers6" strings of e to the peer list. This is the
+		// compact format used by the resume data and the metadata cache
+		void add_compact_peers(bdecode_node const& e);
+
+		// the number of seconds we've been dormant that haven't been
+		// credited to the time counters yet. The time counters are only
+		// incremented for torrents that are not paused
+		int dormant_seconds() const;
+
+		// credits the dormant time to the time counters
+		void flush_dormant_time();
+
 		void on_files_deleted(int ret, disk_io_job const& j);
 		void on_files_released(int ret, disk_io_job const& j);
 		void on_torrent_paused(int ret, disk_io_job const& j);
@@ -1076,7 +1194,7 @@ namespace libtorrent
 
 		// used if there is any resume data
 		std::vector<char> m_resume_data;
-		lazy_entry m_resume_entry;
+		bdecode_node m_resume_entry;
 
 		// if the torrent is started without metadata, it may
 		// still be given a name until the metadata is received
@@ -1084,6 +1202,13 @@ namespace libtorrent
 		// longer be used and will be reset
 		boost::scoped_ptr<std::string> m_name;
 
+		// the values of the torrent_delta fields as of the last
+		// call to status_delta(), indexed by torrent_delta::field_t.
+		// Only the fields in m_delta_fields are valid. This is only
+		// allocated once deltas are requested for this torrent
+		boost::scoped_array<boost::int64_t> m_last_delta;
+		boost::uint64_t m_delta_fields;
+
 		storage_constructor_type m_storage_constructor;
 
 		// the posix time this torrent was added and when
@@ -1327,6 +1452,35 @@ namespace libtorrent
 		// from this torrent
 		boost::uint16_t m_last_upload;
 
+		// the index of this torrent in the session's list of
+		// torrents that are ticked every second, or -1 if it's
+		// dormant (or not added to the session yet)
+		int m_ticking_index;
+
+		// while dormant, this wakes us up in time for the next
+		// web seed retry or the next attempt to leave upload mode
+		timer_entry m_wake_timer;
+
+		// while dormant, this evicts the metadata when it fires. See
+		// unload_metadata()
+		timer_entry m_unload_timer;
+
+		// the time we went dormant, or the last time the dormant
+		// time was credited to the time counters
+		ptime m_dormant_since;
+
+		// the sort key of this torrent in the session's auto-manage
+		// queue. This is a copy of the queue position or the negative
+		// seed rank, from the last time the session looked at it
+		int m_auto_manage_key;
+
+		// the index of this torrent in the session's list of engaged
+		// torrents, or -1 if it's not engaged
+		int m_engaged_index;
+
+		// the session's auto-manage queue this torrent is in, or -1
+		boost::int8_t m_auto_manage_queue;
+
 		// the scrape data from the tracker response, this
 		// is optional and may be 0xffffff
 		unsigned int m_downloaders:24;
@@ -1369,10 +1523,25 @@ namespace libtorrent
 		// whenever this torrent's state changes (any state).
 		bool m_state_subscription:1;
 
-		// in state_updates list. When adding a torrent to the
-		// session_impl's m_state_update list, this bit is set
-		// to never add the same torrent twice
-		bool m_in_state_updates:1;
+		// in state_updates lists. When adding a torrent to one of the
+		// session_impl's m_state_updates lists, the bit for that
+		// list is set to never add the same torrent twice
+		boost::uint8_t m_in_state_updates:2;
+
+		// set when this torrent is not ticked by the session
+		bool m_dormant:1;
+
+		// the state of the torrent when it went dormant. These
+		// determine which time counters the dormant time is
+		// credited to
+		bool m_dormant_paused:1;
+		bool m_dormant_seed:1;
+		bool m_dormant_finished:1;
+		bool m_dormant_upload_mode:1;
+
+		// the number of outstanding torrent_handle::pin_metadata()
+		// calls. The metadata is not unloaded while this is non-zero
+		boost::uint16_t m_torrent_file_pins;
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 	public:
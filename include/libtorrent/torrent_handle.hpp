@@ -176,7 +176,8 @@ namespace libtorrent
 			query_accurate_download_counters = 2,
 			query_last_seen_complete = 4,
 			query_pieces = 8,
-			query_verified_pieces = 16
+			query_verified_pieces = 16,
+			query_memory_usage = 32
 		};
 
 		// the flags specify which fields are calculated. By default everything
@@ -266,6 +267,12 @@ namespace libtorrent
 
 		boost::intrusive_ptr<torrent_info> torrent_file() const;
 
+		// keeps the metadata of the torrent loaded, see metadata_unload_timeout.
+		// Every call to pin_metadata() must be matched by a call to
+		// unpin_metadata()
+		void pin_metadata() const;
+		void unpin_metadata() const;
+
 #ifndef TORRENT_NO_DEPRECATE
 
 		// ================ start deprecation ============
@@ -665,6 +672,100 @@ namespace libtorrent
 		// if this torrent has its own listen socket, this is
 		// the port it's listening on. Otherwise it's 0
 		int listen_port;
+
+		// false if the metadata and the peer list of this torrent
+		// have been evicted to the metadata cache. See
+		// session_settings::metadata_unload_timeout
+		bool is_loaded;
+
+		// the number of bytes of memory used by the metadata (the
+		// file list and the info section) and by the peer list
+		int metadata_memory;
+		int peer_list_memory;
+	};
+
+	// a compact representation of the changes to the numeric fields of
+	// a torrent_status, posted in state_delta_alert. Only the fields that
+	// were requested and that changed since the last delta for the same
+	// torrent are included. Strings and bitfields are never part of a
+	// delta, use torrent_handle::status() to query those.
+	struct TORRENT_EXPORT torrent_delta
+	{
+		// the fields that can be included in a delta. Each field has
+		// the same meaning as the corresponding member of torrent_status.
+		// Boolean fields are 0 or 1. The distributed copies fields are
+		// -1 if the torrent has no piece picker.
+		enum field_t
+		{
+			state,
+			paused,
+			auto_managed,
+			is_seeding,
+			is_finished,
+			has_metadata,
+			need_save_resume,
+			queue_position,
+			progress_ppm,
+			download_rate,
+			upload_rate,
+			download_payload_rate,
+			upload_payload_rate,
+			total_download,
+			total_upload,
+			total_payload_download,
+			total_payload_upload,
+			total_done,
+			total_wanted_done,
+			total_wanted,
+			all_time_download,
+			all_time_upload,
+			total_failed_bytes,
+			total_redundant_bytes,
+			num_peers,
+			num_seeds,
+			num_complete,
+			num_incomplete,
+			list_peers,
+			list_seeds,
+			connect_candidates,
+			num_uploads,
+			num_connections,
+			num_pieces,
+			distributed_full_copies,
+			distributed_fraction,
+			seed_rank,
+			active_time,
+			finished_time,
+			seeding_time,
+			time_since_upload,
+			time_since_download,
+			last_scrape,
+			last_seen_complete,
+
+			num_fields
+		};
+
+		// returns the bit representing ``field`` in a field mask
+		static boost::uint64_t field_bit(int field)
+		{ return boost::uint64_t(1) << field; }
+
+		// true if this delta contains a new value for ``field``
+		bool has(int field) const { return (changed & field_bit(field)) != 0; }
+
+		// the new value of ``field``. It's only valid to call this for
+		// fields where has() returns true
+		boost::int64_t value(int field) const;
+
+		// the torrent this delta belongs to
+		torrent_handle handle;
+
+		// a bitmask of the fields included in this delta. Bit ``n``
+		// represents the field with value ``n`` in field_t
+		boost::uint64_t changed;
+
+		// the new values of the fields in ``changed``, in the order
+		// of field_t
+		std::vector<boost::int64_t> values;
 	};
 
 }
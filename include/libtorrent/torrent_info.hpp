@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <string>
 #include <vector>
+#include <list>
 
 #ifdef _MSC_VER
 #pragma warning(push, 1)
@@ -210,6 +211,27 @@ namespace libtorrent
 		// it's also used to hold the peer_connection
 		// pointer, when the web seed is connected
 		policy::peer peer_info;
+
+		// when more than one connection is allowed to a web seed
+		// (session_settings::max_web_seed_connections), each
+		// additional connection uses one of these. They're never
+		// removed, a slot is reused once its connection closes
+		std::list<policy::peer> extra_peers;
+
+		// the number of connections to this web seed
+		int num_connections() const;
+
+		// returns true if any connection to this web seed has
+		// been banned
+		bool banned() const;
+
+		// returns true if c is one of the connections to this web seed
+		bool has_connection(peer_connection const* c) const;
+
+		// returns a peer slot without a connection, allocating a new
+		// one if all are in use and there are fewer than limit. Returns
+		// 0 if we already have limit connections
+		policy::peer* free_slot(int limit);
 	};
 
 #ifndef BOOST_NO_EXCEPTIONS
@@ -391,6 +413,25 @@ namespace libtorrent
 
 		void swap(torrent_info& ti);
 
+		// frees the file list and the info section, keeping only what's
+		// needed to identify the torrent and to know its size and number
+		// of pieces. The info section can be restored with load(). Torrents
+		// with renamed files and merkle torrents can't be unloaded, since
+		// their state isn't fully described by the info section
+		void unload();
+
+		// restores the metadata of an unloaded torrent from its info
+		// section. Fails if the buffer isn't the info section of this
+		// torrent, i.e. if it doesn't match the info-hash
+		bool load(char const* buffer, int size, error_code& ec);
+
+		// returns false if the metadata has been unloaded
+		bool is_loaded() const { return m_info_section || !is_valid(); }
+
+		// the number of bytes of heap memory used by the file list
+		// and the info section
+		size_type memory_usage() const;
+
 		boost::shared_array<char> metadata() const
 		{ return m_info_section; }
 
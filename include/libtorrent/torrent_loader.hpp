@@ -0,0 +1,120 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef TORRENT_TORRENT_LOADER_HPP_INCLUDED
+#define TORRENT_TORRENT_LOADER_HPP_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <boost/function/function1.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/thread.hpp"
+#include "libtorrent/error_code.hpp"
+#include "libtorrent/io_service_fwd.hpp"
+#include "libtorrent/add_torrent_params.hpp"
+#include "libtorrent/bdecode.hpp"
+
+namespace libtorrent
+{
+	struct file_pool;
+
+	// a torrent queued on the torrent_loader. It owns a copy of the
+	// resume data buffer, which is freed along with it
+	struct TORRENT_EXTRA_EXPORT loaded_torrent : boost::noncopyable
+	{
+		loaded_torrent(add_torrent_params const& p);
+		~loaded_torrent();
+
+		add_torrent_params params;
+
+		// the resume data, decoded by the loader thread. It refers into
+		// *params.resume_data, and is handed over to the torrent along
+		// with it. It's none_t if there's no resume data or it failed
+		// to decode
+		bdecode_node resume;
+
+		// set if the torrent failed to load
+		error_code error;
+	};
+
+	// the torrent loader does the work of adding a torrent that doesn't
+	// need the network thread, on a pool of threads. That's decoding the
+	// resume data, parsing the metadata stored in it and stat()ing the
+	// files, to warm up the stat cache in the file_pool for the resume
+	// data check.
+	// Each torrent is handed back to the network thread, via the
+	// io_service, as soon as it's done. Torrents are picked up in the
+	// order they were queued, but since there are several threads, they
+	// may complete out of order
+	struct TORRENT_EXTRA_EXPORT torrent_loader : boost::noncopyable
+	{
+		typedef boost::function<void(boost::shared_ptr<loaded_torrent> const&)> handler_t;
+
+		torrent_loader(io_service& ios, file_pool& fp, handler_t const& h);
+		~torrent_loader();
+
+		// the torrents are passed on to the handler once loaded. If there
+		// are fewer than num_threads threads running, more are started
+		void queue(std::vector<boost::shared_ptr<loaded_torrent> > const& torrents
+			, int num_threads);
+
+		// stops all threads and drops the torrents that haven't been
+		// loaded yet. Blocks until the threads have exited
+		void abort();
+
+		// the number of torrents that haven't been picked up by
+		// a thread yet
+		int num_queued() const;
+
+	private:
+
+		void thread_fun();
+		void load(loaded_torrent& t);
+
+		io_service& m_ios;
+		file_pool& m_pool;
+		handler_t m_handler;
+
+		mutable mutex m_mutex;
+		condition m_cond;
+		std::deque<boost::shared_ptr<loaded_torrent> > m_queue;
+		std::vector<boost::shared_ptr<thread> > m_threads;
+		bool m_abort;
+	};
+}
+
+#endif // TORRENT_TORRENT_LOADER_HPP_INCLUDED
+
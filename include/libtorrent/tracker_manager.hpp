@@ -37,6 +37,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <utility>
 #include <ctime>
+#include <map>
+#include <list>
+#include <deque>
 
 #ifdef _MSC_VER
 #pragma warning(push, 1)
@@ -64,6 +67,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/size_type.hpp"
 #include "libtorrent/union_endpoint.hpp"
 #include "libtorrent/udp_socket.hpp" // for udp_socket_observer
+#include "libtorrent/sliding_average.hpp"
+#include "libtorrent/session_status.hpp" // for tracker_host_status
 #ifdef TORRENT_USE_OPENSSL
 #include <boost/asio/ssl/context.hpp>
 #endif
@@ -74,6 +79,7 @@ namespace libtorrent
 	class tracker_manager;
 	struct timeout_handler;
 	struct tracker_connection;
+	struct http_connection;
 	namespace aux { struct session_impl; }
 
 	// returns -1 if gzip header is invalid or the header size in bytes
@@ -185,6 +191,7 @@ namespace libtorrent
 		void restart_read_timeout();
 		void cancel();
 		bool cancelled() const { return m_abort; }
+		ptime start_time() const { return m_start_time; }
 
 		virtual void on_timeout(error_code const& ec) = 0;
 		virtual ~timeout_handler() {}
@@ -231,8 +238,10 @@ namespace libtorrent
 		tracker_request const& tracker_req() const { return m_req; }
 
 		void fail_disp(error_code ec) { fail(ec); }
-		void fail(error_code const& ec, int code = -1, char const* msg = ""
+		virtual void fail(error_code const& ec, int code = -1, char const* msg = ""
 			, int interval = 0, int min_interval = 0);
+		bool failed() const { return m_failed; }
+		error_code const& error() const { return m_error; }
 		virtual void start() = 0;
 		virtual void close();
 		address const& bind_interface() const { return m_req.bind_ip; }
@@ -262,16 +271,17 @@ namespace libtorrent
 #endif
 
 		const tracker_request m_req;
+
+		// set by fail(). Used for the per tracker statistics
+		bool m_failed;
+		error_code m_error;
 	};
 
 	class TORRENT_EXTRA_EXPORT tracker_manager: public udp_socket_observer, boost::noncopyable
 	{
 	public:
 
-		tracker_manager(aux::session_impl& ses, proxy_settings const& ps)
-			: m_ses(ses)
-			, m_proxy(ps)
-			, m_abort(false) {}
+		tracker_manager(aux::session_impl& ses, proxy_settings const& ps);
 		~tracker_manager();
 
 		void queue_request(
@@ -287,6 +297,16 @@ namespace libtorrent
 		bool empty() const;
 		int num_requests() const;
 
+		// fills in the request statistics and queue sizes of every
+		// tracker host requests have been made to
+		void get_host_status(std::vector<tracker_host_status>* ret) const;
+
+		// hands a kept-alive connection to an HTTP tracker back to the
+		// pool, once its response has been received. It's picked up by
+		// the next request to the same tracker
+		void return_idle_connection(std::string const& url
+			, boost::shared_ptr<http_connection> const& c);
+
 		void sent_bytes(int bytes);
 		void received_bytes(int bytes);
 
@@ -300,6 +320,87 @@ namespace libtorrent
 		
 	private:
 
+		struct queued_request
+		{
+			io_service* ios;
+			connection_queue* cc;
+			tracker_request req;
+			std::string auth;
+			boost::weak_ptr<request_callback> cb;
+		};
+
+		// the requests to one tracker, identified by protocol,
+		// hostname and port
+		struct tracker_host
+		{
+			tracker_host()
+				: requests_left(0)
+				, window_start(min_time())
+				, in_flight(0)
+				, num_requests(0)
+				, num_failures(0)
+				, num_timeouts(0)
+			{}
+
+			// requests held back by the rate limit, in the order
+			// they were queued
+			std::deque<queued_request> queue;
+
+			// UDP scrapes waiting to be sent together, in a single
+			// packet
+			std::vector<queued_request> scrapes;
+
+			// the number of requests that may still be started in
+			// the current one second window, and when it started
+			int requests_left;
+			ptime window_start;
+
+			int in_flight;
+			int num_requests;
+			int num_failures;
+			int num_timeouts;
+
+			// round-trip time of successful requests, in milliseconds
+			sliding_average<16> rtt;
+
+			// kept-alive HTTP connections to this tracker that aren't
+			// in use, and the time they were returned to the pool.
+			// The most recently used connection is last
+			std::vector<std::pair<boost::shared_ptr<http_connection>, ptime> > idle;
+		};
+
+		typedef std::map<std::string, tracker_host> host_map_t;
+
+		// the max number of idle connections kept per tracker
+		enum { max_idle_connections = 8 };
+
+		// returns true if another request may be started to this
+		// tracker host, and counts it against the rate limit
+		bool may_start(tracker_host& h);
+
+		// removes the requests from cb that are waiting in h's queues
+		void drop_queued_requests(tracker_host& h
+			, boost::shared_ptr<request_callback> const& cb);
+
+		// creates the connection for r and adds it to m_connections.
+		// Returns 0 if the protocol isn't supported. The caller is
+		// expected to start the connection
+		boost::intrusive_ptr<tracker_connection> add_connection(
+			queued_request const& r, tracker_host& h);
+
+		// returns the most recently used idle connection to this
+		// tracker, or an empty pointer if there isn't one
+		boost::shared_ptr<http_connection> take_idle_connection(tracker_host& h);
+
+		// closes idle connections that have been unused for longer
+		// than the tracker_keep_alive_timeout. Returns true if there
+		// are idle connections left
+		bool expire_idle_connections(tracker_host& h);
+
+		void send_scrapes(tracker_host& h);
+		void arm_queue_timer();
+		void on_queue_timer(error_code const& e);
+
 		typedef mutex mutex_t;
 		mutable mutex_t m_mutex;
 
@@ -308,6 +409,15 @@ namespace libtorrent
 		tracker_connections_t m_connections;
 		aux::session_impl& m_ses;
 		proxy_settings const& m_proxy;
+
+		host_map_t m_hosts;
+
+		// drains the request queues, sends the coalesced scrapes and
+		// expires idle connections. It's only running while there are
+		// requests waiting or connections idle
+		deadline_timer m_queue_timer;
+		bool m_queue_timer_active;
+
 		bool m_abort;
 	};
 }
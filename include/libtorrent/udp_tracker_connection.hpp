@@ -78,6 +78,16 @@ namespace libtorrent
 		void start();
 		void close();
 
+		// the number of info-hashes that fit in a single scrape
+		// packet, as specified by BEP 15
+		enum { max_scrapes_per_packet = 74 };
+
+		// adds another torrent to scrape in the same request. The
+		// response for it is posted to c. This must be called before
+		// start(), and only on scrape requests
+		void add_scrape(tracker_request const& req
+			, boost::weak_ptr<request_callback> c);
+
 #if !defined TORRENT_VERBOSE_LOGGING \
 	&& !defined TORRENT_LOGGING \
 	&& !defined TORRENT_ERROR_LOGGING
@@ -143,6 +153,15 @@ namespace libtorrent
 		action_t m_state;
 
 		proxy_settings m_proxy;
+
+		// the scrapes sent in the same packet as the one in
+		// tracker_req(), in the order their info-hashes are sent
+		struct scrape_entry
+		{
+			tracker_request req;
+			boost::weak_ptr<request_callback> cb;
+		};
+		std::vector<scrape_entry> m_scrapes;
 	};
 
 }
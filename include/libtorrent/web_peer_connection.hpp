@@ -109,6 +109,12 @@ namespace libtorrent
 
 		bool maybe_harvest_block();
 
+		// appends size bytes from buf to the block being assembled
+		// in m_piece, allocating the disk buffer if needed. If buf
+		// is 0, zeroes are appended. Returns false if we ran out of
+		// disk buffers, in which case the connection is closed
+		bool append_piece(char const* buf, int size);
+
 		// returns the block currently being
 		// downloaded. And the progress of that
 		// block. If the peer isn't downloading
@@ -123,11 +129,14 @@ namespace libtorrent
 		std::string m_url;
 			
 		// this is used for intermediate storage of pieces
-		// that are received in more than one HTTP response
-		// TODO: if we make this be a disk_buffer_holder instead
-		// we would save a copy sometimes
-		// use allocate_disk_receive_buffer and release_disk_receive_buffer
-		std::vector<char> m_piece;
+		// that are received in more than one HTTP response.
+		// It's a disk buffer, so once the block is complete
+		// it's handed to the disk thread without another copy
+		disk_buffer_holder m_piece;
+
+		// the number of bytes of the current block that
+		// have been written to m_piece
+		int m_piece_size;
 		
 		// the number of bytes received in the current HTTP
 		// response. used to know where in the buffer the
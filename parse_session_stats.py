@@ -188,69 +188,54 @@ def gen_html(reports, generations):
 	file.close()
 
 reports = [
-	('torrents', 'num', '', 'number of torrents in different torrent states', ['downloading torrents', 'seeding torrents', \
-		'checking torrents', 'stopped torrents', 'upload-only torrents', 'error torrents', 'queued seed torrents', \
-		'queued download torrents'], stacked),
-	('torrents_want_peers', 'num', '', 'number of torrents that want more peers', ['torrents want more peers']),
-	('peers', 'num', '', 'num connected peers', ['peers', 'connecting peers', 'connection attempts', 'banned peers', 'total peers']),
-	('peers_max', 'num', '', 'num connected peers', ['peers', 'connecting peers', 'connection attempts', 'banned peers', 'max connections', 'total peers']),
-	('peer_churn', 'num', '', 'connecting and disconnecting peers', ['connecting peers', 'connection attempts']),
-	('peer_limits', 'num', '', 'number of connections per limit', ['average peers per limit']),
-	('connect_candidates', 'num', '', 'number of peers we know of that we can connect to', ['connect candidates']),
-	('peers_list_size', 'num', '', 'number of known peers (not necessarily connected)', ['num list peers']),
-	('overall_rates', 'rate', 'B/s', 'download and upload rates', ['uploaded bytes', 'downloaded bytes', 'upload rate', 'download rate', 'smooth upload rate', 'smooth download rate']),
-	('disk_write_queue', 'Bytes', 'B', 'bytes queued up by peers, to be written to disk', ['disk write queued bytes', 'disk queue limit', 'disk queue low watermark']),
-	('peers_requests', 'num', '', 'incoming piece request rate', ['piece requests', 'piece rejects', 'max piece requests', 'invalid piece requests', 'choked piece requests', 'cancelled piece requests']),
-	('peers_upload', 'num', '', 'number of peers by state wrt. uploading', ['peers up interested', 'peers up unchoked', 'peers up requests', 'peers disk-up', 'peers up send buffer', 'peers bw-up', 'max unchoked']),
-	('peers_download', 'num', '', 'number of peers by state wrt. downloading', ['peers down interesting', 'peers down unchoked', 'peers down requests', 'peers disk-down', 'peers bw-down','num end-game peers']),
-	('peer_errors', 'num', '', 'number of peers by error that disconnected them', ['error peers', 'peer disconnects', 'peers eof', 'peers connection reset', 'connect timeouts', 'uninteresting peers disconnect', 'banned for hash failure', 'no memory peer errors', 'too many peers', 'transport timeout peers', 'connection refused peers', 'connection aborted peers', 'permission denied peers', 'no buffer peers', 'host unreachable peers', 'broken pipe peers', 'address in use peers', 'access denied peers', 'invalid argument peers', 'operation aborted peers']),
-	('peer_errors_incoming', 'num', '', 'number of peers by incoming or outgoing connection', ['error incoming peers', 'error outgoing peers']),
-	('peer_errors_transport', 'num', '', 'number of peers by transport protocol', ['error tcp peers', 'error utp peers']),
-	('peer_errors_encryption', 'num', '', 'number of peers by encryption level', ['error encrypted peers', 'error rc4 peers', 'peer disconnects']),
-	('incoming requests', 'num', '', 'incoming 16kiB block requests', ['pending incoming block requests', 'average pending incoming block requests']),
-	('waste', '% of all downloaded bytes', '%%', 'proportion of all downloaded bytes that were wasted', ['% failed payload bytes', '% wasted payload bytes', '% protocol bytes'], stacked),
-	('waste by source', '% of all wasted bytes', '%%', 'what\' causing the waste', [ 'redundant timed-out', 'redundant cancelled', 'redundant unknown', 'redundant seed', 'redundant end-game', 'redundant closing'], stacked),
-	('average_disk_time_absolute', 'job time', 's', 'running averages of timings of disk operations', ['disk read time', 'disk write time', 'disk hash time', 'disk job time', 'disk sort time']),
-	('average_disk_queue_time', 'job queued time', 's', 'running averages of disk queue time', ['disk queue time', 'disk job time']),
-	('disk_time', '% of total disk job time', '%%', 'proportion of time spent by the disk thread', ['% read time', '% write time', '% hash time', '% sort time'], stacked),
-	('disk_cache_hits', 'blocks (16kiB)', '', '', ['disk block read', 'read cache hits', 'disk block written', 'disk read back']),
-	('disk_cache', 'blocks (16kiB)', '', 'disk cache size and usage', ['disk buffer allocations', 'read disk cache size', 'disk cache size', 'cache size']),
-	('disk_readback', '% of written blocks', '%%', 'portion of written blocks that had to be read back for hash verification', ['% read back']),
-	('disk_queue', 'number of queued disk jobs', '', 'queued disk jobs', ['disk queue size', 'disk read queue size', 'read job queue size limit']),
-	('disk_iops', 'operations/s', '', 'number of disk operations per second', ['read ops/s', 'write ops/s', 'smooth read ops/s', 'smooth write ops/s']),
-	('disk pending reads', 'Bytes', '', 'number of bytes peers are waiting for to be read from the disk', ['pending reading bytes']),
-	('mixed mode', 'rate', 'B/s', 'rates by transport protocol', ['TCP up rate','TCP down rate','uTP up rate','uTP down rate','TCP up limit','TCP down limit']),
-	('connection_type', 'num', '', 'peers by transport protocol', ['utp peers','tcp peers']),
-	('uTP delay', 'buffering delay', 's', 'network delays measured by uTP', ['uTP peak send delay','uTP peak recv delay', 'uTP avg send delay', 'uTP avg recv delay']),
-	('uTP send delay histogram', 'buffering delay', 's', 'send delays measured by uTP', ['uTP avg send delay'], histogram),
-	('uTP recv delay histogram', 'buffering delay', 's', 'receive delays measured by uTP', ['uTP avg recv delay'], histogram),
-	('uTP stats', 'num', '', 'number of uTP sockets by state', ['uTP idle', 'uTP syn-sent', 'uTP connected', 'uTP fin-sent', 'uTP close-wait'], stacked),
-	('system memory', '', '', 'virtual memory page count', ['active resident pages', 'inactive resident pages', 'pinned resident pages', 'free pages'], stacked),
-	('memory paging', '', '', 'vm disk activity', ['pageins', 'pageouts']),
-	('page faults', '', '', '', ['page faults']),
-	('CPU usage', '%', '', '', ['network thread system time', 'network thread user+system time']),
+	('torrents', 'num', '', 'number of torrents in different torrent states', ['ses.num_downloading_torrents', 'ses.num_seeding_torrents', \
+		'ses.num_checking_torrents', 'ses.num_stopped_torrents', 'ses.num_upload_only_torrents', 'ses.num_error_torrents', 'ses.num_queued_seeding_torrents', \
+		'ses.num_queued_download_torrents'], stacked),
+	('torrents_want_peers', 'num', '', 'number of torrents that want more peers', ['ses.num_torrents_want_peers']),
+	('ticking_torrents', 'num', '', 'number of torrents ticked every second and dormant torrents', ['ses.num_ticking_torrents', 'ses.num_dormant_torrents'], stacked),
+	('auto_manage', 'num', '', 'number of torrents visited by the auto-manager', ['ses.auto_manage_evaluations']),
+	('peers', 'num', '', 'num connected peers', ['peer.num_peers_connected', 'peer.num_peers_half_open', 'peer.connection_attempts', 'peer.banned_peers', 'peer.num_peer_connections']),
+	('peer_churn', 'num', '', 'connecting and disconnecting peers', ['peer.num_peers_half_open', 'peer.connection_attempts', 'peer.disconnected_peers']),
+	('connect_candidates', 'num', '', 'number of peers we know of that we can connect to', ['peer.num_connect_candidates']),
+	('peers_list_size', 'num', '', 'number of known peers (not necessarily connected)', ['peer.num_list_peers']),
+	('overall_rates', 'rate', 'B/s', 'download and upload rates', ['net.sent_bytes', 'net.recv_bytes', 'net.upload_rate', 'net.download_rate']),
+	('disk_write_queue', 'Bytes', 'B', 'bytes queued up by peers, to be written to disk', ['disk.disk_queued_write_bytes']),
+	('peers_requests', 'num', '', 'incoming piece request rate', ['peer.piece_requests', 'peer.piece_rejects', 'peer.max_piece_requests', 'peer.invalid_piece_requests', 'peer.choked_piece_requests', 'peer.cancelled_piece_requests']),
+	('peers_upload', 'num', '', 'number of peers by state wrt. uploading', ['peer.num_peers_up_interested', 'peer.num_peers_up_unchoked', 'peer.num_peers_up_requests', 'net.limiter_disk_up_queue', 'peer.num_peers_up_send_buffer', 'net.limiter_up_queue', 'choker.num_unchoke_slots']),
+	('peers_download', 'num', '', 'number of peers by state wrt. downloading', ['peer.num_peers_down_interesting', 'peer.num_peers_down_unchoked', 'peer.num_peers_down_requests', 'net.limiter_disk_down_queue', 'net.limiter_down_queue', 'peer.num_peers_end_game']),
+	('peer_errors', 'num', '', 'number of peers by error that disconnected them', ['peer.error_peers', 'peer.disconnected_peers', 'peer.eof_peers', 'peer.connreset_peers', 'peer.connect_timeouts', 'peer.uninteresting_peers', 'peer.banned_for_hash_failure', 'peer.no_memory_peers', 'peer.too_many_peers', 'peer.transport_timeout_peers', 'peer.connrefused_peers', 'peer.connaborted_peers', 'peer.perm_peers', 'peer.buffer_peers', 'peer.unreachable_peers', 'peer.broken_pipe_peers', 'peer.addrinuse_peers', 'peer.no_access_peers', 'peer.invalid_arg_peers', 'peer.aborted_peers']),
+	('peer_errors_incoming', 'num', '', 'number of peers by incoming or outgoing connection', ['peer.error_incoming_peers', 'peer.error_outgoing_peers']),
+	('peer_errors_transport', 'num', '', 'number of peers by transport protocol', ['peer.error_tcp_peers', 'peer.error_utp_peers']),
+	('peer_errors_encryption', 'num', '', 'number of peers by encryption level', ['peer.error_encrypted_peers', 'peer.error_rc4_peers', 'peer.disconnected_peers']),
+	('incoming requests', 'num', '', 'incoming 16kiB block requests', ['peer.num_pending_incoming_requests']),
+	('waste', 'downloaded bytes', 'B', 'downloaded bytes that were wasted', ['net.recv_failed_bytes', 'net.recv_redundant_bytes'], stacked),
+	('waste by source', 'wasted bytes', 'B', 'what\' causing the waste', [ 'net.waste_piece_timed_out', 'net.waste_piece_cancelled', 'net.waste_piece_unknown', 'net.waste_piece_seed', 'net.waste_piece_end_game', 'net.waste_piece_closing'], stacked),
+	('average_disk_time_absolute', 'job time', 'us', 'running averages of timings of disk operations', ['disk.disk_average_read_time', 'disk.disk_average_write_time', 'disk.disk_average_hash_time', 'disk.disk_average_job_time', 'disk.disk_average_sort_time']),
+	('average_disk_queue_time', 'job queued time', 'us', 'running averages of disk queue time', ['disk.disk_average_queue_time', 'disk.disk_average_job_time']),
+	('disk_time', 'disk job time', 'us', 'time spent by the disk thread', ['disk.disk_read_time', 'disk.disk_write_time', 'disk.disk_hash_time', 'disk.disk_sort_time'], stacked),
+	('disk_cache_hits', 'blocks (16kiB)', '', '', ['disk.num_blocks_read', 'disk.num_blocks_cache_hits', 'disk.num_blocks_written', 'disk.num_read_back']),
+	('disk_cache', 'blocks (16kiB)', '', 'disk cache size and usage', ['disk.disk_blocks_in_use', 'disk.disk_read_cache_blocks', 'disk.disk_cache_blocks']),
+	('disk_queue', 'number of queued disk jobs', '', 'queued disk jobs', ['disk.disk_job_queue_length', 'disk.disk_read_queue_size']),
+	('disk_iops', 'operations/s', '', 'number of disk operations per second', ['disk.num_read_ops', 'disk.num_write_ops']),
+	('disk pending reads', 'Bytes', '', 'number of bytes peers are waiting for to be read from the disk', ['peer.num_pending_reading_bytes']),
+	('mixed mode', 'rate', 'B/s', 'rates by transport protocol', ['net.tcp_upload_rate','net.tcp_download_rate','net.utp_upload_rate','net.utp_download_rate']),
+	('connection_type', 'num', '', 'peers by transport protocol', ['peer.num_utp_peers','peer.num_tcp_peers']),
+	('uTP stats', 'num', '', 'number of uTP sockets by state', ['utp.num_utp_idle', 'utp.num_utp_syn_sent', 'utp.num_utp_connected', 'utp.num_utp_fin_sent', 'utp.num_utp_close_wait'], stacked),
+	('dht', 'num', '', 'DHT routing table and storage', ['dht.dht_nodes', 'dht.dht_node_cache', 'dht.dht_torrents']),
+	('dht traffic', 'Bytes', 'B', 'DHT bytes sent and received', ['dht.dht_bytes_in', 'dht.dht_bytes_out']),
+	('choker', 'num', '', 'number of times the choker ran', ['choker.num_unchoke_rounds', 'choker.num_optimistic_unchoke_rounds']),
 	('boost.asio messages', 'events/s', '', 'number of messages posted per second', [ \
-		'read_counter', 'write_counter', 'tick_counter', 'lsd_counter', \
-		'lsd_peer_counter', 'udp_counter', 'accept_counter', 'disk_queue_counter', \
-		'disk_read_counter', 'disk_write_counter'], stacked),
-	('send_buffer_sizes', 'num', '', '', ['up 8', 'up 16', 'up 32', 'up 64', 'up 128', 'up 256', \
-		'up 512', 'up 1024', 'up 2048', 'up 4096', 'up 8192', 'up 16384', 'up 32768', 'up 65536', \
-		'up 131072', 'up 262144'], stacked),
-	('recv_buffer_sizes', 'num', '', '', ['down 8', 'down 16', 'down 32', 'down 64', 'down 128', \
-		'down 256', 'down 512', 'down 1024', 'down 2048', 'down 4096', 'down 8192', 'down 16384', \
-		'down 32768', 'down 65536', 'down 131072', 'down 262144'], stacked),
-#	('absolute_waste', 'num', '', ['failed bytes', 'redundant bytes', 'download rate']),
+		'net.on_read_counter', 'net.on_write_counter', 'net.on_tick_counter', 'net.on_lsd_counter', \
+		'net.on_lsd_peer_counter', 'net.on_udp_counter', 'net.on_accept_counter', 'net.on_disk_queue_counter', \
+		'net.on_disk_read_counter', 'net.on_disk_write_counter'], stacked),
+	('send_buffer_sizes', 'num', '', '', ['sock_bufs.socket_send_size%d' % i for i in range(3, 19)], stacked),
+	('recv_buffer_sizes', 'num', '', '', ['sock_bufs.socket_recv_size%d' % i for i in range(3, 19)], stacked),
 
 #somewhat uninteresting stats
-	('tick_rate', 'time between ticks', 's', '', ['tick interval', 'tick residual']),
-	('peer_dl_rates', 'num', '', 'peers split into download rate buckets', ['peers down 0', 'peers down 0-2', 'peers down 2-5', 'peers down 5-10', 'peers down 50-100', 'peers down 100-'], stacked),
-	('peer_dl_rates2', 'num', '', 'peers split into download rate buckets (only downloading peers)', ['peers down 0-2', 'peers down 2-5', 'peers down 5-10', 'peers down 50-100', 'peers down 100-'], stacked),
-	('peer_ul_rates', 'num', '', 'peers split into upload rate buckets', ['peers up 0', 'peers up 0-2', 'peers up 2-5', 'peers up 5-10', 'peers up 50-100', 'peers up 100-'], stacked),
-	('peer_ul_rates2', 'num', '', 'peers split into upload rate buckets (only uploading peers)', ['peers up 0-2', 'peers up 2-5', 'peers up 5-10', 'peers up 50-100', 'peers up 100-'], stacked),
-	('piece_picker_end_game', 'blocks', '', '', ['end game piece picker blocks', 'piece picker blocks', \
-		'piece picks', 'reject piece picks', 'unchoke piece picks', 'incoming redundant piece picks', \
-		'incoming piece picks', 'end game piece picks', 'snubbed piece picks'], stacked),
-	('piece_picker', 'blocks', '', '', ['piece picks', 'reject piece picks', 'unchoke piece picks', 'incoming redundant piece picks', 'incoming piece picks', 'end game piece picks', 'snubbed piece picks'], stacked),
+	('piece_picker_end_game', 'blocks', '', '', ['picker.end_game_piece_picker_blocks', 'picker.piece_picker_blocks', \
+		'picker.reject_piece_picks', 'picker.unchoke_piece_picks', 'picker.incoming_redundant_piece_picks', \
+		'picker.incoming_piece_picks', 'picker.end_game_piece_picks', 'picker.snubbed_piece_picks'], stacked),
+	('piece_picker', 'blocks', '', '', ['picker.reject_piece_picks', 'picker.unchoke_piece_picks', 'picker.incoming_redundant_piece_picks', 'picker.incoming_piece_picks', 'picker.end_game_piece_picks', 'picker.snubbed_piece_picks'], stacked),
 ]
 
 print 'generating graphs'
@@ -33,6 +33,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/pch.hpp"
 
 #include <string>
+#include <cstdlib> // for malloc/free
 
 #include "libtorrent/config.hpp"
 #include "libtorrent/alert.hpp"
@@ -331,32 +332,109 @@ namespace libtorrent {
 		return msg;
 	}
 
+	std::string dht_scrape_alert::message() const
+	{
+		char ih_hex[41];
+		to_hex((const char*)&info_hash[0], 20, ih_hex);
+		char msg[200];
+		snprintf(msg, sizeof(msg), "dht scrape: %s seeds: %d peers: %d"
+			, ih_hex, num_seeds, num_peers);
+		return msg;
+	}
+
 
 
 	alert_manager::alert_manager(io_service& ios, int queue_limit, boost::uint32_t alert_mask)
-		: m_alert_mask(alert_mask)
+		: m_generation(0)
+		, m_read_pos(0)
+		, m_queue_size(0)
+		, m_alert_mask(alert_mask)
 		, m_queue_size_limit(queue_limit)
 		, m_ios(ios)
 	{}
 
 	alert_manager::~alert_manager()
 	{
-		while (!m_alerts.empty())
+		std::vector<alert*> const& alerts = m_arena[m_generation].alerts();
+		for (int i = m_read_pos; i < int(alerts.size()); ++i)
 		{
-			TORRENT_ASSERT(alert_cast<save_resume_data_alert>(m_alerts.front()) == 0
+			TORRENT_ASSERT(alert_cast<save_resume_data_alert>(alerts[i]) == 0
 				&& "shutting down session with remaining resume data alerts in the alert queue. "
 				"You proabably wany to make sure you always wait for all resume data "
 				"alerts before shutting down");
-			delete m_alerts.front();
-			m_alerts.pop_front();
 		}
 	}
 
+	alert_manager::alert_arena::~alert_arena()
+	{
+		clear();
+		for (std::vector<char*>::iterator i = m_blocks.begin()
+			, end(m_blocks.end()); i != end; ++i)
+			std::free(*i);
+	}
+
+	void* alert_manager::alert_arena::allocate(int size, int alignment)
+	{
+		if (size > block_size) return 0;
+
+		TORRENT_ASSERT((alignment & (alignment - 1)) == 0);
+		int offset = (m_used + alignment - 1) & ~(alignment - 1);
+		if (m_blocks.empty() || offset + size > block_size)
+		{
+			// move on to the next block, and allocate it
+			// if we haven't used that many blocks before. m_block
+			// is only updated once the block exists, so that a failed
+			// allocation leaves the arena as it was
+			int const block = m_blocks.empty() ? 0 : m_block + 1;
+			if (block == int(m_blocks.size()))
+			{
+				char* b = static_cast<char*>(std::malloc(block_size));
+				if (b == 0) return 0;
+				m_blocks.push_back(b);
+			}
+			m_block = block;
+			offset = 0;
+		}
+		m_used = offset + size;
+		return m_blocks[m_block] + offset;
+	}
+
+	void alert_manager::alert_arena::push_back(alert* a, bool on_heap)
+	{
+		m_alerts.push_back(a);
+		m_on_heap.push_back(on_heap);
+	}
+
+	alert* alert_manager::alert_arena::release(int i)
+	{
+		TORRENT_ASSERT(i >= 0 && i < int(m_alerts.size()));
+		if (!m_on_heap[i]) return 0;
+		alert* ret = m_alerts[i];
+		m_alerts[i] = 0;
+		m_on_heap[i] = false;
+		return ret;
+	}
+
+	void alert_manager::alert_arena::clear()
+	{
+		for (int i = 0; i < int(m_alerts.size()); ++i)
+		{
+			alert* a = m_alerts[i];
+			if (a == 0) continue;
+			if (m_on_heap[i]) delete a;
+			else a->~alert();
+		}
+		m_alerts.clear();
+		m_on_heap.clear();
+		m_block = 0;
+		m_used = 0;
+	}
+
 	alert const* alert_manager::wait_for_alert(time_duration max_wait)
 	{
 		mutex::scoped_lock lock(m_mutex);
 
-		if (!m_alerts.empty()) return m_alerts.front();
+		if (m_queue_size > 0) return m_arena[m_generation].alerts()[m_read_pos];
 		
 //		system_time end = get_system_time()
 //			+ boost::posix_time::microseconds(total_microseconds(max_wait));
@@ -369,14 +447,14 @@ namespace libtorrent {
 		ptime start = time_now_hires();
 
 		// TODO: change this to use an asio timer instead
-		while (m_alerts.empty())
+		while (m_queue_size == 0)
 		{
 			lock.unlock();
 			sleep(50);
 			lock.lock();
 			if (time_now_hires() - start >= max_wait) return 0;
 		}
-		return m_alerts.front();
+		return m_arena[m_generation].alerts()[m_read_pos];
 	}
 
 	void alert_manager::set_dispatch_function(boost::function<void(std::auto_ptr<alert>)> const& fun)
@@ -386,7 +464,7 @@ namespace libtorrent {
 		m_dispatch = fun;
 
 		std::deque<alert*> alerts;
-		m_alerts.swap(alerts);
+		take_pending(alerts);
 		lock.unlock();
 
 		while (!alerts.empty())
@@ -405,19 +483,23 @@ namespace libtorrent {
 		dispatcher(*alert_);
 	}
 
-	void alert_manager::post_alert_ptr(alert* alert_)
+	void alert_manager::notify_extensions(alert const* a)
 	{
-		std::auto_ptr<alert> a(alert_);
-
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		for (ses_extension_list_t::iterator i = m_ses_extensions.begin()
 			, end(m_ses_extensions.end()); i != end; ++i)
 		{
 			TORRENT_TRY {
-				(*i)->on_alert(alert_);
+				(*i)->on_alert(a);
 			} TORRENT_CATCH(std::exception&) {}
 		}
 #endif
+	}
+
+	void alert_manager::post_alert_ptr(alert* alert_)
+	{
+		std::auto_ptr<alert> a(alert_);
+		notify_extensions(alert_);
 
 		mutex::scoped_lock lock(m_mutex);
 		post_impl(a);
@@ -426,16 +508,7 @@ namespace libtorrent {
 	void alert_manager::post_alert(const alert& alert_)
 	{
 		std::auto_ptr<alert> a(alert_.clone());
-
-#ifndef TORRENT_DISABLE_EXTENSIONS
-		for (ses_extension_list_t::iterator i = m_ses_extensions.begin()
-			, end(m_ses_extensions.end()); i != end; ++i)
-		{
-			TORRENT_TRY {
-				(*i)->on_alert(&alert_);
-			} TORRENT_CATCH(std::exception&) {}
-		}
-#endif
+		notify_extensions(&alert_);
 
 		mutex::scoped_lock lock(m_mutex);
 		post_impl(a);
@@ -445,15 +518,58 @@ namespace libtorrent {
 	{
 		if (m_dispatch)
 		{
-			TORRENT_ASSERT(m_alerts.empty());
+			TORRENT_ASSERT(m_queue_size == 0);
 			TORRENT_TRY {
 				m_dispatch(alert_);
 			} TORRENT_CATCH(std::exception&) {}
 		}
-		else if (m_alerts.size() < m_queue_size_limit || !alert_->discardable())
+		else if (m_queue_size < m_queue_size_limit || !alert_->discardable())
+		{
+			m_arena[m_generation].push_back(alert_.release(), true);
+			++m_queue_size;
+		}
+	}
+
+	void* alert_manager::allocate_alert(alert const& a, int size, int alignment)
+	{
+		if (m_dispatch)
+		{
+			// the dispatch function takes ownership of the alert,
+			// so it has to be allocated on the heap
+			std::auto_ptr<alert> copy(a.clone());
+			post_impl(copy);
+			return 0;
+		}
+
+		if (m_queue_size >= m_queue_size_limit && a.discardable()) return 0;
+
+		void* ret = m_arena[m_generation].allocate(size, alignment);
+		if (ret == 0)
+		{
+			std::auto_ptr<alert> copy(a.clone());
+			post_impl(copy);
+		}
+		return ret;
+	}
+
+	void alert_manager::commit_alert(alert* a)
+	{
+		m_arena[m_generation].push_back(a, false);
+		++m_queue_size;
+	}
+
+	void alert_manager::take_pending(std::deque<alert*>& alerts)
+	{
+		alert_arena& arena = m_arena[m_generation];
+		for (int i = m_read_pos; i < arena.size(); ++i)
 		{
-			m_alerts.push_back(alert_.release());
+			alert* a = arena.release(i);
+			if (a == 0) a = arena.alerts()[i]->clone().release();
+			alerts.push_back(a);
 		}
+		arena.clear();
+		m_read_pos = 0;
+		m_queue_size = 0;
 	}
 
 #ifndef TORRENT_DISABLE_EXTENSIONS
@@ -467,26 +583,54 @@ namespace libtorrent {
 	{
 		mutex::scoped_lock lock(m_mutex);
 		
-		if (m_alerts.empty())
+		if (m_queue_size == 0)
 			return std::auto_ptr<alert>(0);
 
-		alert* result = m_alerts.front();
-		m_alerts.pop_front();
+		alert_arena& arena = m_arena[m_generation];
+		alert* result = arena.release(m_read_pos);
+		if (result == 0) result = arena.alerts()[m_read_pos]->clone().release();
+		++m_read_pos;
+		--m_queue_size;
+
+		// once every alert has been read, the arena can be reused
+		if (m_queue_size == 0)
+		{
+			arena.clear();
+			m_read_pos = 0;
+		}
 		return std::auto_ptr<alert>(result);
 	}
 
 	void alert_manager::get_all(std::deque<alert*>* alerts)
 	{
 		mutex::scoped_lock lock(m_mutex);
-		if (m_alerts.empty()) return;
-		m_alerts.swap(*alerts);
+		if (m_queue_size == 0) return;
+		take_pending(*alerts);
+	}
+
+	void alert_manager::get_batch(std::vector<alert*>& alerts)
+	{
+		alerts.clear();
+
+		mutex::scoped_lock lock(m_mutex);
+
+		// the alerts handed out by the last call are no longer
+		// referenced by the caller
+		m_arena[m_generation ^ 1].clear();
+		if (m_queue_size == 0) return;
+
+		std::vector<alert*> const& queued = m_arena[m_generation].alerts();
+		alerts.assign(queued.begin() + m_read_pos, queued.end());
+		m_generation ^= 1;
+		m_read_pos = 0;
+		m_queue_size = 0;
 	}
 
 	bool alert_manager::pending() const
 	{
 		mutex::scoped_lock lock(m_mutex);
 		
-		return !m_alerts.empty();
+		return m_queue_size > 0;
 	}
 
 	size_t alert_manager::set_alert_queue_size_limit(size_t queue_size_limit_)
@@ -635,5 +779,25 @@ namespace libtorrent {
 		return msg;
 	}
 
+	std::string state_delta_alert::message() const
+	{
+		char msg[600];
+		snprintf(msg, sizeof(msg), "state deltas for %d torrents", int(deltas.size()));
+		return msg;
+	}
+
+	session_stats_alert::session_stats_alert(counters const& cnt)
+	{
+		for (int i = 0; i < counters::num_counters; ++i)
+			values[i] = cnt[i];
+	}
+
+	std::string session_stats_alert::message() const
+	{
+		char msg[100];
+		snprintf(msg, sizeof(msg), "session stats (%d values)", int(counters::num_counters));
+		return msg;
+	}
+
 } // namespace libtorrent
 
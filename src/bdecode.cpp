@@ -0,0 +1,669 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include "libtorrent/pch.hpp"
+
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/alloca.hpp"
+#include "libtorrent/string_util.hpp" // for is_print
+#include <cstring>
+#include <vector>
+#include <cstdio> // for snprintf
+
+namespace libtorrent
+{
+	using detail::bdecode_token;
+
+	namespace
+	{
+		bool numeric(char c) { return c >= '0' && c <= '9'; }
+
+		struct stack_frame
+		{
+			// the index of the dictionary or list token
+			int token;
+			// for dictionaries, 1 if the next item is a value, 0 if
+			// it's a key
+			int state;
+		};
+
+		// the largest parse stack (in frames) that's allocated with alloca.
+		// Deeper stacks are allocated on the heap
+		enum { max_alloca_frames = 256 };
+	}
+
+	bdecode_node::bdecode_node()
+		: m_root_tokens(0)
+		, m_buffer(0)
+		, m_buffer_size(0)
+		, m_token_idx(-1)
+		, m_last_index(-1)
+		, m_last_token(-1)
+		, m_size(-1)
+	{}
+
+	bdecode_node::bdecode_node(bdecode_node const& n)
+		: m_tokens(n.m_tokens)
+		, m_root_tokens(n.m_root_tokens)
+		, m_buffer(n.m_buffer)
+		, m_buffer_size(n.m_buffer_size)
+		, m_token_idx(n.m_token_idx)
+		, m_last_index(n.m_last_index)
+		, m_last_token(n.m_last_token)
+		, m_size(n.m_size)
+	{
+		// a copy of the root refers to its own tokens
+		if (!m_tokens.empty()) m_root_tokens = &m_tokens[0];
+	}
+
+	bdecode_node& bdecode_node::operator=(bdecode_node const& n)
+	{
+		if (&n == this) return *this;
+		m_tokens = n.m_tokens;
+		m_root_tokens = n.m_root_tokens;
+		m_buffer = n.m_buffer;
+		m_buffer_size = n.m_buffer_size;
+		m_token_idx = n.m_token_idx;
+		m_last_index = n.m_last_index;
+		m_last_token = n.m_last_token;
+		m_size = n.m_size;
+		// a copy of the root refers to its own tokens
+		if (!m_tokens.empty()) m_root_tokens = &m_tokens[0];
+		return *this;
+	}
+
+	bdecode_node::bdecode_node(bdecode_token const* tokens, char const* buf
+		, int len, int idx)
+		: m_root_tokens(tokens)
+		, m_buffer(buf)
+		, m_buffer_size(len)
+		, m_token_idx(idx)
+		, m_last_index(-1)
+		, m_last_token(-1)
+		, m_size(-1)
+	{
+		TORRENT_ASSERT(idx >= 0);
+		TORRENT_ASSERT(tokens[idx].type != bdecode_token::end);
+	}
+
+	bdecode_node::type_t bdecode_node::type() const
+	{
+		if (m_token_idx == -1) return none_t;
+		switch (m_root_tokens[m_token_idx].type)
+		{
+			case bdecode_token::dict: return dict_t;
+			case bdecode_token::list: return list_t;
+			case bdecode_token::string: return string_t;
+			case bdecode_token::integer: return int_t;
+			default: return none_t;
+		}
+	}
+
+	std::pair<char const*, int> bdecode_node::data_section() const
+	{
+		if (m_token_idx == -1) return std::make_pair(m_buffer, 0);
+		int const start = m_root_tokens[m_token_idx].offset;
+		return std::make_pair(m_buffer + start, end_offset(m_token_idx) - start);
+	}
+
+	bdecode_node bdecode_node::list_at(int i) const
+	{
+		TORRENT_ASSERT(type() == list_t);
+		TORRENT_ASSERT(i >= 0);
+
+		int token = m_token_idx + 1;
+		int item = 0;
+		if (m_last_index != -1 && m_last_index <= i)
+		{
+			token = m_last_token;
+			item = m_last_index;
+		}
+
+		for (; item < i; ++item)
+		{
+			TORRENT_ASSERT(m_root_tokens[token].type != bdecode_token::end);
+			if (m_root_tokens[token].type == bdecode_token::end)
+				return bdecode_node();
+			token = next_token(token);
+		}
+		TORRENT_ASSERT(m_root_tokens[token].type != bdecode_token::end);
+		if (m_root_tokens[token].type == bdecode_token::end)
+			return bdecode_node();
+
+		m_last_token = token;
+		m_last_index = i;
+		return bdecode_node(m_root_tokens, m_buffer, m_buffer_size, token);
+	}
+
+	std::string bdecode_node::list_string_value_at(int i
+		, char const* default_val) const
+	{
+		bdecode_node n = list_at(i);
+		if (n.type() != string_t) return default_val;
+		return n.string_value();
+	}
+
+	boost::int64_t bdecode_node::list_int_value_at(int i
+		, boost::int64_t default_val) const
+	{
+		bdecode_node n = list_at(i);
+		if (n.type() != int_t) return default_val;
+		return n.int_value();
+	}
+
+	int bdecode_node::list_size() const
+	{
+		TORRENT_ASSERT(type() == list_t);
+		if (m_size != -1) return m_size;
+
+		int token = m_token_idx + 1;
+		int ret = 0;
+		if (m_last_index != -1)
+		{
+			token = m_last_token;
+			ret = m_last_index;
+		}
+		while (m_root_tokens[token].type != bdecode_token::end)
+		{
+			token = next_token(token);
+			++ret;
+		}
+		m_size = ret;
+		return ret;
+	}
+
+	std::pair<std::string, bdecode_node> bdecode_node::dict_at(int i) const
+	{
+		TORRENT_ASSERT(type() == dict_t);
+		TORRENT_ASSERT(i >= 0);
+
+		int token = m_token_idx + 1;
+		int item = 0;
+		if (m_last_index != -1 && m_last_index <= i)
+		{
+			token = m_last_token;
+			item = m_last_index;
+		}
+
+		for (; item < i; ++item)
+		{
+			TORRENT_ASSERT(m_root_tokens[token].type == bdecode_token::string);
+			if (m_root_tokens[token].type == bdecode_token::end)
+				return std::make_pair(std::string(), bdecode_node());
+			// skip the key and the value
+			token = next_token(next_token(token));
+		}
+		TORRENT_ASSERT(m_root_tokens[token].type == bdecode_token::string);
+		if (m_root_tokens[token].type == bdecode_token::end)
+			return std::make_pair(std::string(), bdecode_node());
+
+		m_last_token = token;
+		m_last_index = i;
+
+		bdecode_token const& t = m_root_tokens[token];
+		int const start = t.offset + t.header + 2;
+		return std::make_pair(std::string(m_buffer + start
+			, m_root_tokens[token + 1].offset - start)
+			, bdecode_node(m_root_tokens, m_buffer, m_buffer_size, token + 1));
+	}
+
+	int bdecode_node::dict_size() const
+	{
+		TORRENT_ASSERT(type() == dict_t);
+		if (m_size != -1) return m_size;
+
+		int token = m_token_idx + 1;
+		int ret = 0;
+		if (m_last_index != -1)
+		{
+			token = m_last_token;
+			ret = m_last_index;
+		}
+		while (m_root_tokens[token].type != bdecode_token::end)
+		{
+			token = next_token(next_token(token));
+			++ret;
+		}
+		m_size = ret;
+		return ret;
+	}
+
+	bdecode_node bdecode_node::dict_find(char const* key) const
+	{
+		TORRENT_ASSERT(type() == dict_t);
+		int const key_len = std::strlen(key);
+
+		int token = m_token_idx + 1;
+		while (m_root_tokens[token].type != bdecode_token::end)
+		{
+			bdecode_token const& t = m_root_tokens[token];
+			TORRENT_ASSERT(t.type == bdecode_token::string);
+			int const start = t.offset + t.header + 2;
+			if (m_root_tokens[token + 1].offset - start == key_len
+				&& std::memcmp(m_buffer + start, key, key_len) == 0)
+				return bdecode_node(m_root_tokens, m_buffer, m_buffer_size, token + 1);
+			token = next_token(token + 1);
+		}
+		return bdecode_node();
+	}
+
+	bdecode_node bdecode_node::dict_find_dict(char const* key) const
+	{
+		bdecode_node ret = dict_find(key);
+		if (ret.type() != dict_t) return bdecode_node();
+		return ret;
+	}
+
+	bdecode_node bdecode_node::dict_find_list(char const* key) const
+	{
+		bdecode_node ret = dict_find(key);
+		if (ret.type() != list_t) return bdecode_node();
+		return ret;
+	}
+
+	bdecode_node bdecode_node::dict_find_string(char const* key) const
+	{
+		bdecode_node ret = dict_find(key);
+		if (ret.type() != string_t) return bdecode_node();
+		return ret;
+	}
+
+	bdecode_node bdecode_node::dict_find_int(char const* key) const
+	{
+		bdecode_node ret = dict_find(key);
+		if (ret.type() != int_t) return bdecode_node();
+		return ret;
+	}
+
+	std::string bdecode_node::dict_find_string_value(char const* key
+		, char const* default_value) const
+	{
+		bdecode_node n = dict_find(key);
+		if (n.type() != string_t) return default_value;
+		return n.string_value();
+	}
+
+	boost::int64_t bdecode_node::dict_find_int_value(char const* key
+		, boost::int64_t default_val) const
+	{
+		bdecode_node n = dict_find(key);
+		if (n.type() != int_t) return default_val;
+		return n.int_value();
+	}
+
+	boost::int64_t bdecode_node::int_value() const
+	{
+		TORRENT_ASSERT(type() == int_t);
+		// skip the 'i', the terminating 'e' was verified by bdecode()
+		char const* ptr = m_buffer + m_root_tokens[m_token_idx].offset + 1;
+		char const* const end = m_buffer + end_offset(m_token_idx) - 1;
+		bool const negative = *ptr == '-';
+		if (negative) ++ptr;
+		boost::int64_t val = 0;
+		for (; ptr < end; ++ptr) val = val * 10 + (*ptr - '0');
+		return negative ? -val : val;
+	}
+
+	char const* bdecode_node::string_ptr() const
+	{
+		TORRENT_ASSERT(type() == string_t);
+		bdecode_token const& t = m_root_tokens[m_token_idx];
+		return m_buffer + t.offset + t.header + 2;
+	}
+
+	int bdecode_node::string_length() const
+	{
+		TORRENT_ASSERT(type() == string_t);
+		bdecode_token const& t = m_root_tokens[m_token_idx];
+		return end_offset(m_token_idx) - t.offset - t.header - 2;
+	}
+
+	std::string bdecode_node::string_value() const
+	{
+		return std::string(string_ptr(), string_length());
+	}
+
+	void bdecode_node::clear()
+	{
+		m_tokens.clear();
+		m_root_tokens = 0;
+		m_buffer = 0;
+		m_buffer_size = 0;
+		m_token_idx = -1;
+		m_last_index = -1;
+		m_last_token = -1;
+		m_size = -1;
+	}
+
+	void bdecode_node::swap(bdecode_node& n)
+	{
+		using std::swap;
+		// swapping the vectors doesn't move the tokens, so the
+		// token pointers stay valid
+		m_tokens.swap(n.m_tokens);
+		swap(m_root_tokens, n.m_root_tokens);
+		swap(m_buffer, n.m_buffer);
+		swap(m_buffer_size, n.m_buffer_size);
+		swap(m_token_idx, n.m_token_idx);
+		swap(m_last_index, n.m_last_index);
+		swap(m_last_token, n.m_last_token);
+		swap(m_size, n.m_size);
+	}
+
+	void bdecode_node::reserve(int tokens)
+	{ m_tokens.reserve(tokens); }
+
+	void bdecode_node::switch_underlying_buffer(char const* buf)
+	{
+		TORRENT_ASSERT(m_buffer != 0);
+		m_buffer = buf;
+	}
+
+#define TORRENT_FAIL_BDECODE(code) \
+	{ \
+		ec = code; \
+		if (error_pos) *error_pos = start - orig_start; \
+		ret.clear(); \
+		return -1; \
+	}
+
+	int bdecode(char const* start, char const* end, bdecode_node& ret
+		, error_code& ec, int* error_pos, int depth_limit, int token_limit)
+	{
+		char const* const orig_start = start;
+		ec.clear();
+		ret.clear();
+		if (start == end) return 0;
+
+		if (end - start > bdecode_token::max_offset)
+			TORRENT_FAIL_BDECODE(errors::limit_exceeded);
+
+		// every level of nesting takes at least one byte, so there's
+		// no point in a stack deeper than the buffer
+		if (depth_limit > end - start) depth_limit = int(end - start);
+		if (depth_limit < 1) depth_limit = 1;
+
+		// the depth limit is controlled by the caller. Only put the parse
+		// stack on the machine stack when it's small, otherwise a large
+		// limit could overflow it
+		std::vector<stack_frame> heap_stack;
+		stack_frame* stack;
+		if (depth_limit <= max_alloca_frames)
+		{
+			stack = TORRENT_ALLOCA(stack_frame, depth_limit);
+		}
+		else
+		{
+			heap_stack.resize(depth_limit);
+			stack = &heap_stack[0];
+		}
+		int sp = 0;
+		std::vector<bdecode_token>& tokens = ret.m_tokens;
+
+		do
+		{
+			if (start >= end) TORRENT_FAIL_BDECODE(errors::unexpected_eof);
+			if (--token_limit < 0) TORRENT_FAIL_BDECODE(errors::limit_exceeded);
+
+			char const t = *start;
+			int const parent = sp - 1;
+
+			// dictionary keys must be strings
+			if (parent >= 0 && stack[parent].state == 0 && t != 'e' && !numeric(t)
+				&& tokens[stack[parent].token].type == bdecode_token::dict)
+				TORRENT_FAIL_BDECODE(errors::expected_string);
+
+			switch (t)
+			{
+				case 'd':
+				case 'l':
+				{
+					if (sp == depth_limit) TORRENT_FAIL_BDECODE(errors::depth_exceeded);
+					stack[sp].token = tokens.size();
+					stack[sp].state = 0;
+					++sp;
+					// next_item is filled in once we reach the end
+					tokens.push_back(bdecode_token(start - orig_start
+						, t == 'd' ? bdecode_token::dict : bdecode_token::list));
+					++start;
+					break;
+				}
+				case 'i':
+				{
+					char const* int_start = start;
+					++start;
+					if (start < end && *start == '-') ++start;
+					char const* digits = start;
+					while (start < end && numeric(*start)) ++start;
+					if (start >= end) TORRENT_FAIL_BDECODE(errors::unexpected_eof);
+					if (*start != 'e' || start == digits)
+						TORRENT_FAIL_BDECODE(errors::expected_value);
+					tokens.push_back(bdecode_token(int_start - orig_start
+						, bdecode_token::integer));
+					++start;
+					break;
+				}
+				case 'e':
+				{
+					if (sp == 0) TORRENT_FAIL_BDECODE(errors::expected_value);
+					// a key without a value
+					if (stack[parent].state == 1
+						&& tokens[stack[parent].token].type == bdecode_token::dict)
+						TORRENT_FAIL_BDECODE(errors::expected_value);
+					tokens.push_back(bdecode_token(start - orig_start
+						, bdecode_token::end));
+					int const top = stack[parent].token;
+					tokens[top].next_item = tokens.size() - top;
+					--sp;
+					++start;
+					break;
+				}
+				default:
+				{
+					if (!numeric(t)) TORRENT_FAIL_BDECODE(errors::expected_value);
+					char const* str_start = start;
+					boost::int64_t len = 0;
+					while (start < end && numeric(*start))
+					{
+						len = len * 10 + (*start - '0');
+						++start;
+						if (len > bdecode_token::max_offset) TORRENT_FAIL_BDECODE(errors::limit_exceeded);
+					}
+					if (start >= end || *start != ':')
+						TORRENT_FAIL_BDECODE(errors::expected_colon);
+					int const header = start - str_start - 1;
+					if (header > bdecode_token::max_header)
+						TORRENT_FAIL_BDECODE(errors::limit_exceeded);
+					++start;
+					if (len > end - start) TORRENT_FAIL_BDECODE(errors::unexpected_eof);
+					tokens.push_back(bdecode_token(str_start - orig_start
+						, bdecode_token::string, 1, header));
+					start += len;
+					break;
+				}
+			}
+
+			// keep track of whether the next item in the dictionary
+			// is a key or a value
+			if (parent >= 0 && t != 'e')
+				stack[parent].state = !stack[parent].state;
+		} while (sp > 0);
+
+		// this marks the end of the last item. It lets us find the
+		// size of any item by looking at the offset of the next token
+		tokens.push_back(bdecode_token(start - orig_start, bdecode_token::end));
+
+		ret.m_root_tokens = &tokens[0];
+		ret.m_buffer = orig_start;
+		ret.m_buffer_size = start - orig_start;
+		ret.m_token_idx = 0;
+		return 0;
+	}
+
+	namespace
+	{
+		int line_longer_than(bdecode_node const& e, int limit)
+		{
+			int line_len = 0;
+			switch (e.type())
+			{
+			case bdecode_node::list_t:
+				line_len += 4;
+				if (line_len > limit) return -1;
+				for (int i = 0; i < e.list_size(); ++i)
+				{
+					int ret = line_longer_than(e.list_at(i), limit - line_len);
+					if (ret == -1) return -1;
+					line_len += ret + 2;
+				}
+				break;
+			case bdecode_node::dict_t:
+				line_len += 4;
+				if (line_len > limit) return -1;
+				for (int i = 0; i < e.dict_size(); ++i)
+				{
+					std::pair<std::string, bdecode_node> ent = e.dict_at(i);
+					line_len += 4 + ent.first.size();
+					if (line_len > limit) return -1;
+					int ret = line_longer_than(ent.second, limit - line_len);
+					if (ret == -1) return -1;
+					line_len += ret + 1;
+				}
+				break;
+			case bdecode_node::string_t:
+				line_len += 3 + e.string_length();
+				break;
+			case bdecode_node::int_t:
+			{
+				boost::int64_t val = e.int_value();
+				while (val > 0)
+				{
+					++line_len;
+					val /= 10;
+				}
+				line_len += 2;
+			}
+			break;
+			case bdecode_node::none_t:
+				line_len += 4;
+				break;
+			}
+
+			if (line_len > limit) return -1;
+			return line_len;
+		}
+	}
+
+	std::string print_entry(bdecode_node const& e, bool single_line, int indent)
+	{
+		char indent_str[200];
+		memset(indent_str, ' ', 200);
+		indent_str[0] = ',';
+		indent_str[1] = '\n';
+		indent_str[199] = 0;
+		if (indent < 197 && indent >= 0) indent_str[indent+2] = 0;
+		std::string ret;
+		switch (e.type())
+		{
+			case bdecode_node::none_t: return "none";
+			case bdecode_node::int_t:
+			{
+				char str[100];
+				snprintf(str, sizeof(str), "%"PRId64, e.int_value());
+				return str;
+			}
+			case bdecode_node::string_t:
+			{
+				bool printable = true;
+				char const* str = e.string_ptr();
+				for (int i = 0; i < e.string_length(); ++i)
+				{
+					if (is_print((unsigned char)str[i])) continue;
+					printable = false;
+					break;
+				}
+				ret += "'";
+				if (printable)
+				{
+					ret += e.string_value();
+					ret += "'";
+					return ret;
+				}
+				for (int i = 0; i < e.string_length(); ++i)
+				{
+					char tmp[5];
+					snprintf(tmp, sizeof(tmp), "%02x", (unsigned char)str[i]);
+					ret += tmp;
+				}
+				ret += "'";
+				return ret;
+			}
+			case bdecode_node::list_t:
+			{
+				ret += '[';
+				bool one_liner = line_longer_than(e, 200) != -1 || single_line;
+
+				if (!one_liner) ret += indent_str + 1;
+				for (int i = 0; i < e.list_size(); ++i)
+				{
+					if (i == 0 && one_liner) ret += " ";
+					ret += print_entry(e.list_at(i), single_line, indent + 2);
+					if (i < e.list_size() - 1) ret += (one_liner?", ":indent_str);
+					else ret += (one_liner?" ":indent_str+1);
+				}
+				ret += "]";
+				return ret;
+			}
+			case bdecode_node::dict_t:
+			{
+				ret += "{";
+				bool one_liner = line_longer_than(e, 200) != -1 || single_line;
+
+				if (!one_liner) ret += indent_str+1;
+				for (int i = 0; i < e.dict_size(); ++i)
+				{
+					if (i == 0 && one_liner) ret += " ";
+					std::pair<std::string, bdecode_node> ent = e.dict_at(i);
+					ret += "'";
+					ret += ent.first;
+					ret += "': ";
+					ret += print_entry(ent.second, single_line, indent + 2);
+					if (i < e.dict_size() - 1) ret += (one_liner?", ":indent_str);
+					else ret += (one_liner?" ":indent_str+1);
+				}
+				ret += "}";
+				return ret;
+			}
+		}
+		return ret;
+	}
+}
+
@@ -46,6 +46,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/identify_client.hpp"
 #include "libtorrent/entry.hpp"
 #include "libtorrent/bencode.hpp"
+#include "libtorrent/bdecode.hpp"
 #include "libtorrent/alert_types.hpp"
 #include "libtorrent/invariant_check.hpp"
 #include "libtorrent/io.hpp"
@@ -116,6 +117,7 @@ namespace libtorrent
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		, m_encrypted(false)
 		, m_rc4_encrypted(false)
+		, m_rc4_pending(false)
 		, m_sync_bytes_read(0)
 #endif
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
@@ -281,9 +283,7 @@ namespace libtorrent
 	{
 		INVARIANT_CHECK;
 
-#ifdef TORRENT_STATS
-		++m_ses.m_piece_rejects;
-#endif
+		m_ses.inc_stats_counter(counters::piece_rejects);
 
 		if (!m_supports_fast) return;
 
@@ -602,13 +602,37 @@ namespace libtorrent
 #endif
 	}
 
+	void bt_peer_connection::prepare_append()
+	{
+		bool rc4 = m_encrypted && m_rc4_encrypted;
+		if (rc4 == m_rc4_pending) return;
+		// the bytes queued so far were queued under the
+		// old encryption state, deal with them first
+		prepare_send_buffer();
+		m_rc4_pending = rc4;
+	}
+
+	void bt_peer_connection::prepare_send_buffer()
+	{
+		if (!m_rc4_pending)
+		{
+			skip_send_buffer_tail();
+			return;
+		}
+
+		std::vector<asio::mutable_buffer> const& iovec = send_buffer_tail();
+		if (iovec.empty()) return;
+		TORRENT_ASSERT(m_enc_handler.get());
+		m_enc_handler->encrypt_buffers(iovec);
+	}
+
 	void bt_peer_connection::append_const_send_buffer(char const* buffer, int size)
 	{
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		if (m_encrypted && m_rc4_encrypted)
 		{
 			// if we're encrypting this buffer, we need to make a copy
-			// since we'll mutate it
+			// since it will be mutated in place
 			char* buf = (char*)malloc(size);
 			memcpy(buf, buffer, size);
 			bt_peer_connection::append_send_buffer(buf, size, boost::bind(&::free, _1));
@@ -620,12 +644,6 @@ namespace libtorrent
 		}
 	}
 
-	void encrypt(char* buf, int len, void* userdata)
-	{
-		rc4_handler* rc4 = (rc4_handler*)userdata;
-		rc4->encrypt(buf, len);
-	}
-
 	void bt_peer_connection::send_buffer(char const* buf, int size, int flags
 			, void (*f)(char*, int, void*), void* ud)
 	{
@@ -633,20 +651,87 @@ namespace libtorrent
 		TORRENT_ASSERT(ud == 0);
 		TORRENT_ASSERT(buf);
 		TORRENT_ASSERT(size > 0);
-		
-		void* userdata = 0;
-		void (*fun)(char*, int, void*) = 0;
+
 #ifndef TORRENT_DISABLE_ENCRYPTION
-		if (m_encrypted && m_rc4_encrypted)
+		prepare_append();
+#endif
+		peer_connection::send_buffer(buf, size, flags);
+	}
+
+#ifndef TORRENT_DISABLE_EXTENSIONS
+	bt_peer_connection::extended_message::extended_message(bt_peer_connection& pc
+		, int ext_msg_id)
+		: m_pc(pc)
+		, m_header(0)
+		, m_size(0)
+#ifdef TORRENT_DEBUG
+		, m_closed(false)
+#endif
+	{
+		TORRENT_ASSERT(ext_msg_id >= 0 && ext_msg_id < 256);
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		pc.prepare_append();
+#endif
+
+		// the length prefix has to be contiguous to be patched
+		// in place once we know the size of the message
+		m_header = pc.allocate_send_buffer(6);
+		if (m_header == 0) return;
+		char* ptr = m_header;
+		detail::write_uint32(0, ptr);
+		detail::write_uint8(msg_extended, ptr);
+		detail::write_uint8(ext_msg_id, ptr);
+	}
+
+	void bt_peer_connection::extended_message::write(char const* buf, int len)
+	{
+		TORRENT_ASSERT(!m_closed);
+		if (m_header == 0) return;
+		if (!m_pc.copy_send_buffer(buf, len))
 		{
-			fun = encrypt;
-			userdata = m_enc_handler.get();
+			// we ran out of memory and the connection was
+			// disconnected. Don't send a truncated message
+			m_header = 0;
+			return;
 		}
+		m_size += len;
+	}
+
+	void bt_peer_connection::extended_message::append_const_buffer(char const* buf, int len)
+	{
+		TORRENT_ASSERT(!m_closed);
+#ifdef TORRENT_DEBUG
+		m_closed = true;
 #endif
-		
-		peer_connection::send_buffer(buf, size, flags, fun, userdata);
+		if (m_header == 0) return;
+		m_pc.append_const_send_buffer(buf, len);
+		m_size += len;
 	}
 
+	void bt_peer_connection::extended_message::finish()
+	{
+#ifdef TORRENT_DEBUG
+		m_closed = true;
+#endif
+		if (m_header == 0) return;
+
+		// the length was written as 0. Normally the message is still
+		// plain text at this point, and is encrypted when it's sent, but
+		// the send buffer may have been encrypted already. RC4 is a
+		// stream cipher, XOR-ing the key stream with the plain text, so
+		// XOR-ing the length into the encrypted zeroes yields the same
+		// bytes as encrypting the length would have
+		boost::uint32_t len = 2 + m_size;
+		m_header[0] ^= char(len >> 24);
+		m_header[1] ^= char(len >> 16);
+		m_header[2] ^= char(len >> 8);
+		m_header[3] ^= char(len);
+		m_header = 0;
+
+		m_pc.setup_send();
+	}
+#endif
+
 	int bt_peer_connection::get_syncoffset(char const* src, int src_size,
 		char const* target, int target_size) const
 	{
@@ -1172,9 +1257,9 @@ namespace libtorrent
 #ifdef TORRENT_VERBOSE_LOGGING
 			peer_log("<== HASHPIECE [ piece: %d list: %d ]", p.piece, list_size);
 #endif
-			lazy_entry hash_list;
+			bdecode_node hash_list;
 			error_code ec;
-			if (lazy_bdecode(recv_buffer.begin + 13, recv_buffer.begin+ 13 + list_size
+			if (bdecode(recv_buffer.begin + 13, recv_buffer.begin+ 13 + list_size
 				, hash_list, ec) != 0)
 			{
 				disconnect(errors::invalid_hash_piece, 2);
@@ -1183,7 +1268,7 @@ namespace libtorrent
 
 			// the list has this format:
 			// [ [node-index, hash], [node-index, hash], ... ]
-			if (hash_list.type() != lazy_entry::list_t)
+			if (hash_list.type() != bdecode_node::list_t)
 			{
 				disconnect(errors::invalid_hash_list, 2);
 				return;
@@ -1192,15 +1277,15 @@ namespace libtorrent
 			std::map<int, sha1_hash> nodes;
 			for (int i = 0; i < hash_list.list_size(); ++i)
 			{
-				lazy_entry const* e = hash_list.list_at(i);
-				if (e->type() != lazy_entry::list_t
-					|| e->list_size() != 2
-					|| e->list_at(0)->type() != lazy_entry::int_t
-					|| e->list_at(1)->type() != lazy_entry::string_t
-					|| e->list_at(1)->string_length() != 20) continue;
+				bdecode_node e = hash_list.list_at(i);
+				if (e.type() != bdecode_node::list_t
+					|| e.list_size() != 2
+					|| e.list_at(0).type() != bdecode_node::int_t
+					|| e.list_at(1).type() != bdecode_node::string_t
+					|| e.list_at(1).string_length() != 20) continue;
 
-				nodes.insert(std::make_pair(int(e->list_int_value_at(0))
-					, sha1_hash(e->list_at(1)->string_ptr())));
+				nodes.insert(std::make_pair(int(e.list_int_value_at(0))
+					, sha1_hash(e.list_at(1).string_ptr())));
 			}
 			if (!nodes.empty() && !t->add_merkle_nodes(nodes, p.piece))
 			{
@@ -2814,6 +2899,10 @@ namespace libtorrent
 
 			if (!m_rc4_encrypted)
 			{
+				// anything still queued with RC4 enabled has
+				// to be encrypted before the keys go away
+				prepare_send_buffer();
+				m_rc4_pending = false;
 				m_enc_handler.reset();
 #ifdef TORRENT_VERBOSE_LOGGING
 				peer_log("*** destroyed rc4 keys");
@@ -2845,6 +2934,10 @@ namespace libtorrent
 			}
 			else // !m_rc4_encrypted
 			{
+				// the handshake may still be queued, waiting to
+				// be encrypted
+				prepare_send_buffer();
+				m_rc4_pending = false;
 				m_enc_handler.reset();
 #ifdef TORRENT_VERBOSE_LOGGING
 				peer_log("*** destroyed encryption handler");
@@ -3332,6 +3425,7 @@ namespace libtorrent
 				|| !is_outgoing());
 
 		TORRENT_ASSERT(!m_rc4_encrypted || m_enc_handler.get());
+		TORRENT_ASSERT(!m_rc4_pending || m_enc_handler.get());
 #endif
 		if (!in_handshake())
 		{
@@ -32,12 +32,14 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/chained_buffer.hpp"
 #include "libtorrent/assert.hpp"
+#include <algorithm> // for reverse, min
 
 namespace libtorrent
 {
 	void chained_buffer::pop_front(int bytes_to_pop)
 	{
 		TORRENT_ASSERT(bytes_to_pop <= m_bytes);
+		m_processed -= (std::min)(bytes_to_pop, m_processed);
 		while (bytes_to_pop > 0 && !m_vec.empty())
 		{
 			buffer_t& b = m_vec.front();
@@ -135,6 +137,26 @@ namespace libtorrent
 		return m_tmp_vec;
 	}
 
+	std::vector<asio::mutable_buffer> const& chained_buffer::mutable_tail()
+	{
+		m_tail_vec.clear();
+
+		// the tail is at the end of the chain, walk it backwards
+		int left = m_bytes - m_processed;
+		for (std::list<buffer_t>::reverse_iterator i = m_vec.rbegin()
+			, end(m_vec.rend()); left > 0 && i != end; ++i)
+		{
+			int s = (std::min)(left, i->used_size);
+			if (s == 0) continue;
+			m_tail_vec.push_back(asio::mutable_buffer(i->start + i->used_size - s, s));
+			left -= s;
+		}
+		TORRENT_ASSERT(left == 0);
+		std::reverse(m_tail_vec.begin(), m_tail_vec.end());
+		m_processed = m_bytes;
+		return m_tail_vec;
+	}
+
 	chained_buffer::~chained_buffer()
 	{
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
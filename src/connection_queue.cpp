@@ -30,6 +30,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#include <algorithm>
 #include <boost/bind.hpp>
 #include "libtorrent/config.hpp"
 #include "libtorrent/invariant_check.hpp"
@@ -45,11 +46,12 @@ POSSIBILITY OF SUCH DAMAGE.
 namespace libtorrent
 {
 
-	connection_queue::connection_queue(io_service& ios): m_next_ticket(0)
-		, m_num_connecting(0)
+	connection_queue::connection_queue(io_service& ios)
+		: m_num_connecting(0)
 		, m_half_open_limit(0)
 		, m_abort(false)
 		, m_num_timers(0)
+		, m_try_connect_pending(false)
 		, m_timer(ios)
 #ifdef TORRENT_DEBUG
 		, m_in_timeout_function(false)
@@ -64,7 +66,78 @@ namespace libtorrent
 	{
 		mutex_t::scoped_lock l(m_mutex);
 		return m_half_open_limit == 0 ? (std::numeric_limits<int>::max)()
-			: m_half_open_limit - m_queue.size();
+			: m_half_open_limit - size();
+	}
+
+	int connection_queue::slot_for(int ticket) const
+	{
+		if (ticket < 0) return -1;
+		int slot = ticket & (max_slots - 1);
+		if (slot >= int(m_entries.size())) return -1;
+		entry const& e = m_entries[slot];
+		if (!e.in_use || ticket_for(slot) != ticket) return -1;
+		return slot;
+	}
+
+	int connection_queue::allocate_slot()
+	{
+		int slot;
+		if (!m_free_slots.empty())
+		{
+			slot = m_free_slots.back();
+			m_free_slots.pop_back();
+		}
+		else
+		{
+			if (int(m_entries.size()) >= max_slots) return -1;
+			slot = m_entries.size();
+			m_entries.push_back(entry());
+		}
+		TORRENT_ASSERT(!m_entries[slot].in_use);
+		m_entries[slot].in_use = true;
+		return slot;
+	}
+
+	void connection_queue::release_slot(int slot)
+	{
+		entry& e = m_entries[slot];
+		TORRENT_ASSERT(e.in_use);
+		e.on_connect.clear();
+		e.on_timeout.clear();
+		e.connecting = false;
+		e.in_use = false;
+		e.expires = max_time();
+		++e.generation;
+		m_free_slots.push_back(slot);
+	}
+
+	bool connection_queue::is_stale(timeout_entry const& t) const
+	{
+		int slot = slot_for(t.ticket);
+		if (slot == -1) return true;
+		entry const& e = m_entries[slot];
+		// if the generation counter has wrapped, the ticket may match
+		// a newer entry. It will have its own node in the heap though
+		return !e.connecting || e.expires != t.expires;
+	}
+
+	void connection_queue::prune_timeouts()
+	{
+		if (int(m_timeouts.size()) <= m_num_connecting * 2 + 64) return;
+
+		m_timeouts.erase(std::remove_if(m_timeouts.begin(), m_timeouts.end()
+			, boost::bind(&connection_queue::is_stale, this, _1)), m_timeouts.end());
+		std::make_heap(m_timeouts.begin(), m_timeouts.end());
+	}
+
+	void connection_queue::post_try_connect()
+	{
+		if (m_try_connect_pending) return;
+		if (m_num_connecting >= m_half_open_limit
+			&& m_half_open_limit > 0) return;
+		m_try_connect_pending = true;
+		m_timer.get_io_service().post(boost::bind(
+			&connection_queue::on_try_connect, this));
 	}
 
 	void connection_queue::enqueue(boost::function<void(int)> const& on_connect
@@ -77,34 +150,27 @@ namespace libtorrent
 
 		TORRENT_ASSERT(priority >= 0);
 		TORRENT_ASSERT(priority < 3);
+		if (priority < 0 || priority > 2) return;
 
-		entry* e = 0;
-
-		switch (priority)
+		int slot = allocate_slot();
+		if (slot == -1)
 		{
-			case 0:
-				m_queue.push_back(entry());
-				e = &m_queue.back();
-				break;
-			case 1:
-			case 2:
-				m_queue.push_front(entry());
-				e = &m_queue.front();
-				break;
-			default: return;
+			// there's no room for another ticket. Fail the
+			// connection attempt, but not while we're locked
+			m_timer.get_io_service().post(boost::bind(on_connect, -1));
+			return;
 		}
 
-		e->priority = priority;
-		e->on_connect = on_connect;
-		e->on_timeout = on_timeout;
-		e->ticket = m_next_ticket;
-		e->timeout = timeout;
-		++m_next_ticket;
-
-		if (m_num_connecting < m_half_open_limit
-			|| m_half_open_limit == 0)
-			m_timer.get_io_service().post(boost::bind(
-				&connection_queue::on_try_connect, this));
+		entry& e = m_entries[slot];
+		e.priority = priority;
+		e.on_connect = on_connect;
+		e.on_timeout = on_timeout;
+		e.timeout = timeout;
+
+		if (priority == 0) m_waiting.push_back(slot);
+		else m_waiting.push_front(slot);
+
+		post_try_connect();
 	}
 
 	void connection_queue::done(int ticket)
@@ -113,20 +179,23 @@ namespace libtorrent
 
 		INVARIANT_CHECK;
 
-		std::list<entry>::iterator i = std::find_if(m_queue.begin()
-			, m_queue.end(), boost::bind(&entry::ticket, _1) == ticket);
-		if (i == m_queue.end())
+		int slot = slot_for(ticket);
+		if (slot == -1)
 		{
 			// this might not be here in case on_timeout calls remove
 			return;
 		}
-		if (i->connecting) --m_num_connecting;
-		m_queue.erase(i);
 
-		if (m_num_connecting < m_half_open_limit
-			|| m_half_open_limit == 0)
-			m_timer.get_io_service().post(boost::bind(
-				&connection_queue::on_try_connect, this));
+		// tickets are only handed out to entries as they start
+		// connecting, so waiting entries can't be done
+		TORRENT_ASSERT(m_entries[slot].connecting);
+		if (!m_entries[slot].connecting) return;
+
+		--m_num_connecting;
+		release_slot(slot);
+		prune_timeouts();
+
+		post_try_connect();
 	}
 
 	void connection_queue::close()
@@ -136,30 +205,58 @@ namespace libtorrent
 		if (m_num_connecting == 0) m_timer.cancel(ec);
 		m_abort = true;
 
-		std::list<entry> tmp;
-		tmp.swap(m_queue);
-		m_num_connecting = 0;
+		// entries with priority 2 are allowed to outlive the queue
+		// being closed, all other entries are aborted. Entries that
+		// are still connecting are timed out, the ones still waiting
+		// are told they failed to connect
+		std::vector<boost::function<void()> > timed_out;
+		std::vector<boost::function<void(int)> > aborted;
+
+		for (int i = 0; i < int(m_entries.size()); ++i)
+		{
+			entry& e = m_entries[i];
+			if (!e.in_use || e.priority > 1) continue;
+			if (e.connecting)
+			{
+				timed_out.push_back(boost::function<void()>());
+				timed_out.back().swap(e.on_timeout);
+				--m_num_connecting;
+			}
+			else
+			{
+				aborted.push_back(boost::function<void(int)>());
+				aborted.back().swap(e.on_connect);
+			}
+			release_slot(i);
+		}
+
+		std::deque<int> waiting;
+		for (std::deque<int>::iterator i = m_waiting.begin()
+			, end(m_waiting.end()); i != end; ++i)
+		{
+			if (m_entries[*i].in_use) waiting.push_back(*i);
+		}
+		m_waiting.swap(waiting);
+		prune_timeouts();
 
 		// we don't want to call the timeout callback while we're locked
 		// since that is a recipie for dead-locks
 		l.unlock();
 
-		while (!tmp.empty())
+		for (std::vector<boost::function<void()> >::iterator i = timed_out.begin()
+			, end(timed_out.end()); i != end; ++i)
 		{
-			entry& e = tmp.front();
-			if (e.priority > 1)
-			{
-				mutex_t::scoped_lock ll(m_mutex);
-				if (e.connecting) ++m_num_connecting;
-				m_queue.push_back(e);
-				tmp.pop_front();
-				continue;
-			}
 			TORRENT_TRY {
-				if (e.connecting) e.on_timeout();
-				else e.on_connect(-1);
+				(*i)();
+			} TORRENT_CATCH(std::exception&) {}
+		}
+
+		for (std::vector<boost::function<void(int)> >::iterator i = aborted.begin()
+			, end(aborted.end()); i != end; ++i)
+		{
+			TORRENT_TRY {
+				(*i)(-1);
 			} TORRENT_CATCH(std::exception&) {}
-			tmp.pop_front();
 		}
 	}
 
@@ -177,13 +274,30 @@ namespace libtorrent
 	void connection_queue::check_invariant() const
 	{
 		int num_connecting = 0;
-		for (std::list<entry>::const_iterator i = m_queue.begin();
-			i != m_queue.end(); ++i)
+		int num_in_use = 0;
+		for (std::vector<entry>::const_iterator i = m_entries.begin();
+			i != m_entries.end(); ++i)
 		{
+			if (!i->in_use)
+			{
+				TORRENT_ASSERT(!i->connecting);
+				continue;
+			}
+			++num_in_use;
 			if (i->connecting) ++num_connecting;
 			else TORRENT_ASSERT(i->expires == max_time());
 		}
 		TORRENT_ASSERT(num_connecting == m_num_connecting);
+		TORRENT_ASSERT(num_in_use + int(m_free_slots.size()) == int(m_entries.size()));
+		TORRENT_ASSERT(num_in_use == size());
+
+		for (std::deque<int>::const_iterator i = m_waiting.begin();
+			i != m_waiting.end(); ++i)
+		{
+			TORRENT_ASSERT(m_entries[*i].in_use);
+			TORRENT_ASSERT(!m_entries[*i].connecting);
+		}
+		TORRENT_ASSERT(int(m_timeouts.size()) >= m_num_connecting);
 	}
 
 #endif
@@ -201,26 +315,29 @@ namespace libtorrent
 		if (m_num_connecting >= m_half_open_limit
 			&& m_half_open_limit > 0) return;
 	
-		if (m_queue.empty())
+		if (size() == 0)
 		{
 			error_code ec;
 			m_timer.cancel(ec);
 			return;
 		}
 
-		// all entries are connecting, no need to look for new ones
-		if (m_queue.size() == m_num_connecting)
-			return;
-
-		std::list<entry>::iterator i = std::find_if(m_queue.begin()
-			, m_queue.end(), boost::bind(&entry::connecting, _1) == false);
-
-		std::list<entry> to_connect;
+		// connect as many of the waiting entries as the limit allows
+		// in one go. The callbacks are moved out of the entries, since
+		// on_connect is never called more than once per entry
+		std::vector<std::pair<boost::function<void(int)>, int> > to_connect;
+		int num_to_connect = m_half_open_limit == 0 ? int(m_waiting.size())
+			: (std::min)(int(m_waiting.size()), m_half_open_limit - m_num_connecting);
+		to_connect.reserve(num_to_connect);
 
-		while (i != m_queue.end())
+		ptime now = time_now_hires();
+		for (int i = 0; i < num_to_connect; ++i)
 		{
-			TORRENT_ASSERT(i->connecting == false);
-			ptime expire = time_now_hires() + i->timeout;
+			int slot = m_waiting.front();
+			m_waiting.pop_front();
+			entry& e = m_entries[slot];
+			TORRENT_ASSERT(e.connecting == false);
+			ptime expire = now + e.timeout;
 			if (m_num_connecting == 0)
 			{
 #if defined TORRENT_ASIO_DEBUGGING
@@ -231,35 +348,31 @@ namespace libtorrent
 				m_timer.async_wait(boost::bind(&connection_queue::on_timeout, this, _1));
 				++m_num_timers;
 			}
-			i->connecting = true;
+			e.connecting = true;
 			++m_num_connecting;
-			i->expires = expire;
+			e.expires = expire;
 
-			INVARIANT_CHECK;
+			int ticket = ticket_for(slot);
+			m_timeouts.push_back(timeout_entry(expire, ticket));
+			std::push_heap(m_timeouts.begin(), m_timeouts.end());
 
-			to_connect.push_back(*i);
+			to_connect.push_back(std::make_pair(boost::function<void(int)>(), ticket));
+			to_connect.back().first.swap(e.on_connect);
 
 #ifdef TORRENT_CONNECTION_LOGGING
 			m_log << log_time() << " " << free_slots() << std::endl;
 #endif
-
-			if (m_num_connecting >= m_half_open_limit
-				&& m_half_open_limit > 0) break;
-			if (m_num_connecting == m_queue.size()) break;
-			i = std::find_if(i, m_queue.end(), boost::bind(&entry::connecting, _1) == false);
 		}
 
 		l.unlock();
 
-		while (!to_connect.empty())
+		for (std::vector<std::pair<boost::function<void(int)>, int> >::iterator i
+			= to_connect.begin(), end(to_connect.end()); i != end; ++i)
 		{
-			entry& ent = to_connect.front();
 			TORRENT_TRY {
-				ent.on_connect(ent.ticket);
+				i->first(i->second);
 			} TORRENT_CATCH(std::exception&) {}
-			to_connect.pop_front();
 		}
-
 	}
 
 #ifdef TORRENT_DEBUG
@@ -295,34 +408,36 @@ namespace libtorrent
 
 		ptime next_expire = max_time();
 		ptime now = time_now_hires() + milliseconds(100);
-		std::list<entry> timed_out;
-		for (std::list<entry>::iterator i = m_queue.begin();
-			!m_queue.empty() && i != m_queue.end();)
+		std::vector<boost::function<void()> > timed_out;
+		while (!m_timeouts.empty())
 		{
-			if (i->connecting && i->expires < now)
+			timeout_entry const& top = m_timeouts.front();
+			if (!is_stale(top))
 			{
-				std::list<entry>::iterator j = i;
-				++i;
-				timed_out.splice(timed_out.end(), m_queue, j, i);
+				if (top.expires >= now)
+				{
+					next_expire = top.expires;
+					break;
+				}
+				int slot = slot_for(top.ticket);
+				timed_out.push_back(boost::function<void()>());
+				timed_out.back().swap(m_entries[slot].on_timeout);
 				--m_num_connecting;
-				continue;
+				release_slot(slot);
 			}
-			if (i->connecting && i->expires < next_expire)
-				next_expire = i->expires;
-			++i;
+			std::pop_heap(m_timeouts.begin(), m_timeouts.end());
+			m_timeouts.pop_back();
 		}
 
 		// we don't want to call the timeout callback while we're locked
 		// since that is a recepie for dead-locks
 		l.unlock();
 
-		for (std::list<entry>::iterator i = timed_out.begin()
+		for (std::vector<boost::function<void()> >::iterator i = timed_out.begin()
 			, end(timed_out.end()); i != end; ++i)
 		{
-			TORRENT_ASSERT(i->connecting);
-			TORRENT_ASSERT(i->ticket != -1);
 			TORRENT_TRY {
-				i->on_timeout();
+				(*i)();
 			} TORRENT_CATCH(std::exception&) {}
 		}
 		
@@ -344,6 +459,7 @@ namespace libtorrent
 	void connection_queue::on_try_connect()
 	{
 		mutex_t::scoped_lock l(m_mutex);
+		m_try_connect_pending = false;
 		try_connect(l);
 	}
 }
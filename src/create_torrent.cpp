@@ -34,9 +34,13 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/file_pool.hpp"
 #include "libtorrent/storage.hpp"
 #include "libtorrent/escape_string.hpp"
+#include "libtorrent/thread.hpp"
 
 #include <boost/bind.hpp>
 #include <boost/next_prior.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <deque>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -160,6 +164,149 @@ namespace libtorrent
 		char* m_piece;
 	};
 
+	// calculates the SHA-1 of every file, as the pieces
+	// are fed to it in order
+	struct file_hash_state
+	{
+		file_hash_state(create_torrent& t)
+			: m_torrent(t)
+			, m_file_idx(0)
+			, m_left_in_file(t.files().at(0).size)
+		{}
+
+		void update(char const* buf, int size)
+		{
+			int left_in_piece = size;
+			while (left_in_piece > 0)
+			{
+				int to_hash_for_file = int((std::min)(size_type(left_in_piece), m_left_in_file));
+				if (to_hash_for_file > 0)
+				{
+					int offset = size - left_in_piece;
+					m_hasher.update(buf + offset, to_hash_for_file);
+				}
+				m_left_in_file -= to_hash_for_file;
+				left_in_piece -= to_hash_for_file;
+				if (m_left_in_file == 0)
+				{
+					if (!m_torrent.files().at(m_file_idx).pad_file)
+						m_torrent.set_file_hash(m_file_idx, m_hasher.final());
+					m_hasher.reset();
+					m_file_idx++;
+					if (m_file_idx >= m_torrent.files().num_files()) break;
+					m_left_in_file = m_torrent.files().at(m_file_idx).size;
+				}
+			}
+		}
+
+	private:
+		create_torrent& m_torrent;
+		hasher m_hasher;
+		int m_file_idx;
+		size_type m_left_in_file;
+	};
+
+	namespace
+	{
+		// set_piece_hashes() doesn't start more hashing threads than this
+		enum { max_hash_threads = 64 };
+
+		// a piece read by set_piece_hashes(), waiting to be hashed
+		struct hash_job
+		{
+			char* buf;
+			int size;
+			sha1_hash hash;
+			bool done;
+		};
+
+		// the threads hashing the pieces read by set_piece_hashes().
+		// The destructor stops the threads and waits for them to exit
+		struct hash_threads : boost::noncopyable
+		{
+			hash_threads(int num_threads): m_abort(false)
+			{
+				TORRENT_TRY
+				{
+					for (int i = 0; i < num_threads; ++i)
+					{
+						m_threads.push_back(boost::shared_ptr<thread>(
+							new thread(boost::bind(&hash_threads::thread_fun, this))));
+					}
+				}
+				TORRENT_CATCH(...)
+				{
+					// the destructor won't run, so the threads that
+					// were started have to be joined here
+					stop();
+#ifndef BOOST_NO_EXCEPTIONS
+					throw;
+#endif
+				}
+			}
+
+			~hash_threads() { stop(); }
+
+			void push(hash_job* j)
+			{
+				mutex::scoped_lock l(m_mutex);
+				j->done = false;
+				m_queue.push_back(j);
+				m_cond.signal_all(l);
+			}
+
+			// blocks until j has been hashed
+			void wait(hash_job* j)
+			{
+				mutex::scoped_lock l(m_mutex);
+				while (!j->done) m_done_cond.wait(l);
+			}
+
+		private:
+
+			void stop()
+			{
+				mutex::scoped_lock l(m_mutex);
+				m_abort = true;
+				m_cond.signal_all(l);
+				l.unlock();
+
+				for (std::vector<boost::shared_ptr<thread> >::iterator i = m_threads.begin()
+					, end(m_threads.end()); i != end; ++i)
+					(*i)->join();
+			}
+
+			void thread_fun()
+			{
+				mutex::scoped_lock l(m_mutex);
+				for (;;)
+				{
+					while (m_queue.empty() && !m_abort) m_cond.wait(l);
+					if (m_abort) return;
+					hash_job* j = m_queue.front();
+					m_queue.pop_front();
+					l.unlock();
+
+					sha1_hash h = hasher(j->buf, j->size).final();
+
+					l.lock();
+					j->hash = h;
+					j->done = true;
+					m_done_cond.signal_all(l);
+				}
+			}
+
+			mutex m_mutex;
+			// signalled when there are jobs in the queue
+			condition m_cond;
+			// signalled when a job is done
+			condition m_done_cond;
+			std::deque<hash_job*> m_queue;
+			std::vector<boost::shared_ptr<thread> > m_threads;
+			bool m_abort;
+		};
+	}
+
 #if TORRENT_USE_WSTRING
 	void set_piece_hashes(create_torrent& t, std::wstring const& p
 		, boost::function<void(int)> const& f, error_code& ec)
@@ -207,10 +354,8 @@ namespace libtorrent
 			default_storage_constructor(const_cast<file_storage&>(t.files()), 0, path, fp
 			, std::vector<boost::uint8_t>()));
 
-		// if we're calculating file hashes as well, use this hasher
-		hasher filehash;
-		int file_idx = 0;
-		size_type left_in_file = t.files().at(0).size;
+		// if we're calculating file hashes as well, use this
+		file_hash_state file_hashes(t);
 
 		// calculate the hash for all pieces
 		int num = t.num_pieces();
@@ -227,35 +372,77 @@ namespace libtorrent
 			}
 			
 			if (t.should_add_file_hashes())
+				file_hashes.update(buf.bytes(), t.piece_size(i));
+
+			hasher h(buf.bytes(), t.piece_size(i));
+			t.set_hash(i, h.final());
+			f(i);
+		}
+	}
+
+	void set_piece_hashes(create_torrent& t, std::string const& p
+		, boost::function<bool(int)> const& f, int num_threads, error_code& ec)
+	{
+		if (num_threads < 1) num_threads = 1;
+		if (num_threads > max_hash_threads) num_threads = max_hash_threads;
+
+		file_pool fp;
+#if TORRENT_USE_UNC_PATHS
+		std::string path = canonicalize_path(p);
+#else
+		std::string const& path = p;
+#endif
+		boost::scoped_ptr<storage_interface> st(
+			default_storage_constructor(const_cast<file_storage&>(t.files()), 0, path, fp
+			, std::vector<boost::uint8_t>()));
+
+		file_hash_state file_hashes(t);
+
+		// the pieces are read into a ring of buffers, ahead of the
+		// piece we're waiting for. The threads are destructed before
+		// the buffers, since they may still be hashing some of them
+		int num = t.num_pieces();
+		// don't hold more than 512 MiB of pieces in memory
+		int queue_depth = (std::min)(num_threads * 2
+			, 512 * 1024 * 1024 / t.piece_length());
+		queue_depth = (std::max)(1, (std::min)(queue_depth, num));
+		piece_holder buf(queue_depth * t.piece_length());
+		std::vector<hash_job> jobs(queue_depth);
+		for (int i = 0; i < queue_depth; ++i)
+			jobs[i].buf = buf.bytes() + i * t.piece_length();
+
+		hash_threads threads(num_threads);
+
+		int next_read = 0;
+		for (int i = 0; i < num; ++i)
+		{
+			while (next_read < num && next_read < i + queue_depth)
 			{
-				int left_in_piece = t.piece_size(i);
-				int this_piece_size = left_in_piece;
-				// the number of bytes from this file we just read
-				while (left_in_piece > 0)
+				hash_job& j = jobs[next_read % queue_depth];
+				j.size = t.piece_size(next_read);
+				// read hits the disk and will block
+				st->read(j.buf, next_read, 0, j.size);
+				if (st->error())
 				{
-					int to_hash_for_file = int((std::min)(size_type(left_in_piece), left_in_file));
-					if (to_hash_for_file > 0)
-					{
-						int offset = this_piece_size - left_in_piece;
-						filehash.update(buf.bytes() + offset, to_hash_for_file);
-					}
-					left_in_file -= to_hash_for_file;
-					left_in_piece -= to_hash_for_file;
-					if (left_in_file == 0)
-					{
-						if (!t.files().at(file_idx).pad_file)
-							t.set_file_hash(file_idx, filehash.final());
-						filehash.reset();
-						file_idx++;
-						if (file_idx >= t.files().num_files()) break;
-						left_in_file = t.files().at(file_idx).size;
-					}
+					ec = st->error();
+					return;
 				}
+				threads.push(&j);
+				++next_read;
 			}
 
-			hasher h(buf.bytes(), t.piece_size(i));
-			t.set_hash(i, h.final());
-			f(i);
+			hash_job& j = jobs[i % queue_depth];
+			threads.wait(&j);
+
+			if (t.should_add_file_hashes())
+				file_hashes.update(j.buf, j.size);
+
+			t.set_hash(i, j.hash);
+			if (!f(i))
+			{
+				ec = asio::error::operation_aborted;
+				return;
+			}
 		}
 	}
 
@@ -1421,6 +1421,7 @@ namespace libtorrent
 		, read_operation + cancel_on_abort // read_and_hash
 		, read_operation + cancel_on_abort // cache_piece
 		, 0 // finalize_file
+		, cancel_on_abort // hash_blocks
 	};
 
 	bool should_cancel_on_abort(disk_io_job const& j)
@@ -2236,6 +2237,95 @@ namespace libtorrent
 					m_cache_stats.cumulative_hash_time += total_milliseconds(done - hash_start);
 					break;
 				}
+				case disk_io_job::hash_blocks:
+				{
+					if (test_error(j))
+					{
+						ret = -1;
+						break;
+					}
+#ifdef TORRENT_DISK_STATS
+					m_log << log_time() << " hash_blocks " << j.piece << std::endl;
+#endif
+					mutex::scoped_lock l(m_piece_mutex);
+					INVARIANT_CHECK;
+
+					// blocks of this piece that are still in the write
+					// cache need to be flushed before we read them back
+					cache_piece_index_t& idx = m_pieces.get<0>();
+					cache_piece_index_t::iterator i = find_cached_piece(m_pieces, j, l);
+					if (i != idx.end())
+					{
+						TORRENT_ASSERT(i->storage);
+						flush_range(const_cast<cached_piece_entry&>(*i), 0, INT_MAX, l);
+						idx.erase(i);
+						if (test_error(j))
+						{
+							ret = -1;
+							break;
+						}
+					}
+					l.unlock();
+
+					char* buf = allocate_buffer("hash buffer");
+					if (buf == 0)
+					{
+						ret = -1;
+#if BOOST_VERSION == 103500
+						j.error = error_code(boost::system::posix_error::not_enough_memory
+							, get_posix_category());
+#elif BOOST_VERSION > 103500
+						j.error = error_code(boost::system::errc::not_enough_memory
+							, get_posix_category());
+#else
+						j.error = error::no_memory;
+#endif
+						j.str.clear();
+						break;
+					}
+					disk_buffer_holder holder(*this, buf);
+
+					// read the piece back one block at a time and hash
+					// each block, with the salt appended
+					int piece_size = j.storage->info()->piece_size(j.piece);
+					int num_blocks = (piece_size + m_block_size - 1) / m_block_size;
+					boost::shared_ptr<std::vector<sha1_hash> > hashes(
+						new std::vector<sha1_hash>(num_blocks));
+					ret = 0;
+					for (int b = 0; b < num_blocks; ++b)
+					{
+						int block_size = (std::min)(m_block_size, piece_size - b * m_block_size);
+						file::iovec_t iov;
+						iov.iov_base = buf;
+						iov.iov_len = block_size;
+						int r = j.storage->read_impl(&iov, j.piece, b * m_block_size, 1);
+						if (r < 0)
+						{
+							test_error(j);
+							ret = -1;
+							break;
+						}
+						if (r != block_size)
+						{
+							j.error = errors::file_too_short;
+							j.error_file.clear();
+							j.str.clear();
+							ret = -1;
+							break;
+						}
+						hasher h(buf, block_size);
+						h.update((char const*)&j.offset, sizeof(j.offset));
+						(*hashes)[b] = h.final();
+					}
+					if (ret < 0) break;
+
+					// the time isn't added to m_hash_time or cumulative_hash_time.
+					// Those measure piece hash checks, and a smart ban read-back
+					// of a whole piece would skew them
+					m_cache_stats.total_read_back += num_blocks;
+					j.block_hashes = hashes;
+					break;
+				}
 				case disk_io_job::move_storage:
 				{
 #ifdef TORRENT_DISK_STATS
@@ -2356,7 +2446,7 @@ namespace libtorrent
 #ifdef TORRENT_DISK_STATS
 					m_log << log_time() << " check_fastresume" << std::endl;
 #endif
-					lazy_entry const* rd = (lazy_entry const*)j.buffer;
+					bdecode_node const* rd = (bdecode_node const*)j.buffer;
 					TORRENT_ASSERT(rd != 0);
 					ret = j.storage->check_fastresume(*rd, j.error);
 					test_error(j);
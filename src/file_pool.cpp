@@ -37,6 +37,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/file_pool.hpp"
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/file_storage.hpp" // for file_entry
+#include "libtorrent/time.hpp"
 
 namespace libtorrent
 {
@@ -44,12 +45,67 @@ namespace libtorrent
 	file_pool::file_pool(int size)
 		: m_size(size)
 		, m_low_prio_io(true)
+		, m_stat_cache_age(seconds(5))
 #if TORRENT_CLOSE_MAY_BLOCK
 		, m_stop_thread(false)
 		, m_closer_thread(boost::bind(&file_pool::closer_thread_fun, this))
 #endif
 	{}
 
+	void file_pool::cache_file_status(std::string const& p, file_status const& s
+		, error_code const& ec)
+	{
+		mutex::scoped_lock l(m_stat_mutex);
+		ptime now = time_now_hires();
+		stat_cache_entry& e = m_stat_cache[p];
+		e.status = s;
+		e.error = ec;
+		e.added = now;
+		m_stat_cache_order.push_back(std::make_pair(now, p));
+		prune_stat_cache(now);
+	}
+
+	void file_pool::prune_stat_cache(ptime now)
+	{
+		while (!m_stat_cache_order.empty()
+			&& (int(m_stat_cache_order.size()) > max_stat_cache
+				|| now - m_stat_cache_order.front().first > m_stat_cache_age))
+		{
+			// the path may have been looked up, or cached again,
+			// since this entry was added
+			std::pair<ptime, std::string> const& front = m_stat_cache_order.front();
+			stat_cache_t::iterator i = m_stat_cache.find(front.second);
+			if (i != m_stat_cache.end() && i->second.added == front.first)
+				m_stat_cache.erase(i);
+			m_stat_cache_order.pop_front();
+		}
+	}
+
+	bool file_pool::take_file_status(std::string const& p, file_status* s
+		, error_code& ec)
+	{
+		mutex::scoped_lock l(m_stat_mutex);
+		prune_stat_cache(time_now_hires());
+		stat_cache_t::iterator i = m_stat_cache.find(p);
+		if (i == m_stat_cache.end()) return false;
+		*s = i->second.status;
+		ec = i->second.error;
+		m_stat_cache.erase(i);
+		return true;
+	}
+
+	int file_pool::stat_cache_size() const
+	{
+		mutex::scoped_lock l(m_stat_mutex);
+		return m_stat_cache.size();
+	}
+
+	void file_pool::set_stat_cache_age(time_duration d)
+	{
+		mutex::scoped_lock l(m_stat_mutex);
+		m_stat_cache_age = d;
+	}
+
 	file_pool::~file_pool()
 	{
 #if TORRENT_CLOSE_MAY_BLOCK
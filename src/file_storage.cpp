@@ -38,6 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/utf8.hpp"
 #include <boost/bind.hpp>
 #include <cstdio>
+#include <cstring> // for strlen
 #include <algorithm>
 
 namespace libtorrent
@@ -53,6 +54,45 @@ namespace libtorrent
 		m_files.reserve(num_files);
 	}
 
+	void file_storage::unload()
+	{
+		// swap with empty vectors to actually free the memory
+		std::vector<internal_file_entry>().swap(m_files);
+		std::vector<char const*>().swap(m_file_hashes);
+		std::vector<std::string>().swap(m_symlinks);
+		std::vector<time_t>().swap(m_mtime);
+		std::vector<size_type>().swap(m_file_base);
+		std::vector<path_component>().swap(m_path_components);
+		std::string().swap(m_path_names);
+		std::vector<int>().swap(m_path_index);
+		std::vector<int>().swap(m_piece_index);
+	}
+
+	size_type file_storage::memory_usage() const
+	{
+		size_type ret = size_type(m_files.capacity()) * sizeof(internal_file_entry)
+			+ m_file_hashes.capacity() * sizeof(char const*)
+			+ m_symlinks.capacity() * sizeof(std::string)
+			+ m_mtime.capacity() * sizeof(time_t)
+			+ m_file_base.capacity() * sizeof(size_type)
+			+ m_path_components.capacity() * sizeof(path_component)
+			+ m_path_names.capacity()
+			+ m_path_index.capacity() * sizeof(int)
+			+ m_piece_index.capacity() * sizeof(int)
+			+ m_name.capacity();
+
+		// names with a length are borrowed from the info section
+		for (std::vector<internal_file_entry>::const_iterator i = m_files.begin()
+			, end(m_files.end()); i != end; ++i)
+		{
+			if (i->name_len == 0 && i->name) ret += strlen(i->name) + 1;
+		}
+		for (std::vector<std::string>::const_iterator i = m_symlinks.begin()
+			, end(m_symlinks.end()); i != end; ++i)
+			ret += i->capacity();
+		return ret;
+	}
+
 	int file_storage::piece_size(int index) const
 	{
 		TORRENT_ASSERT(index >= 0 && index < num_pieces());
@@ -69,34 +109,144 @@ namespace libtorrent
 			return piece_length();
 	}
 
-	void file_storage::update_path_index(internal_file_entry& e)
+	void file_storage::update_path_index(internal_file_entry& e
+		, std::string const& path)
 	{
-		std::string parent = parent_path(e.filename());
+		std::string parent = parent_path(path);
 		if (parent.empty())
 		{
 			e.path_index = -1;
+			e.set_name(path.c_str());
 		}
 		else
 		{
-			// do we already have this path in the path list?
-			std::vector<std::string>::reverse_iterator p
-				= std::find(m_paths.rbegin(), m_paths.rend(), parent);
+			e.path_index = intern_path(parent);
+			e.set_name(filename(path).c_str());
+		}
+	}
+
+	namespace
+	{
+		// FNV-1a of the name, seeded by the parent index
+		boost::uint32_t path_hash(int parent, char const* name, int len)
+		{
+			boost::uint32_t ret = (2166136261u ^ boost::uint32_t(parent)) * 16777619u;
+			for (int i = 0; i < len; ++i)
+				ret = (ret ^ boost::uint8_t(name[i])) * 16777619u;
+			return ret;
+		}
 
-			if (p == m_paths.rend())
-			{
-				// no, we don't. add it
-				e.path_index = m_paths.size();
-				m_paths.push_back(parent);
-			}
-			else
+		bool is_separator(char c)
+		{
+#if defined(TORRENT_WINDOWS) || defined(TORRENT_OS2)
+			return c == '/' || c == '\\';
+#else
+			return c == '/';
+#endif
+		}
+	}
+
+	int file_storage::intern_path(std::string const& p)
+	{
+		int ret = -1;
+		char const* c = p.c_str();
+		char const* end = c + p.size();
+
+		// an absolute path keeps its root as the first component
+		if (c != end && is_separator(*c))
+		{
+			ret = intern_path_component(ret, c, 1);
+			++c;
+		}
+
+		while (c != end)
+		{
+			char const* sep = c;
+			while (sep != end && !is_separator(*sep)) ++sep;
+			if (sep != c) ret = intern_path_component(ret, c, sep - c);
+			c = sep;
+			if (c != end) ++c;
+		}
+		return ret;
+	}
+
+	int file_storage::intern_path_component(int parent, char const* name, int len)
+	{
+		if (!m_path_index.empty())
+		{
+			const int mask = int(m_path_index.size()) - 1;
+			for (int i = path_hash(parent, name, len) & mask;
+				m_path_index[i] != -1; i = (i + 1) & mask)
 			{
-				// yes we do. use it
-				e.path_index = p.base() - m_paths.begin() - 1;
+				path_component const& c = m_path_components[m_path_index[i]];
+				if (c.parent == parent && int(c.name_len) == len
+					&& std::memcmp(m_path_names.data() + c.name_offset, name, len) == 0)
+					return m_path_index[i];
 			}
-			e.set_name(filename(e.filename()).c_str());
+		}
+
+		// keep the load factor below 3/4
+		if ((m_path_components.size() + 1) * 4 > m_path_index.size() * 3)
+			rehash_path_index((std::max)(int(m_path_index.size()) * 2, 32));
+
+		int ret = int(m_path_components.size());
+		path_component c;
+		c.name_offset = m_path_names.size();
+		c.name_len = len;
+		c.parent = parent;
+		m_path_components.push_back(c);
+		m_path_names.append(name, len);
+
+		const int mask = int(m_path_index.size()) - 1;
+		int i = path_hash(parent, name, len) & mask;
+		while (m_path_index[i] != -1) i = (i + 1) & mask;
+		m_path_index[i] = ret;
+		return ret;
+	}
+
+	void file_storage::rehash_path_index(int num_slots)
+	{
+		TORRENT_ASSERT((num_slots & (num_slots - 1)) == 0);
+		m_path_index.assign(num_slots, -1);
+		const int mask = num_slots - 1;
+		for (int k = 0; k < int(m_path_components.size()); ++k)
+		{
+			path_component const& c = m_path_components[k];
+			int i = path_hash(c.parent, m_path_names.data() + c.name_offset
+				, c.name_len) & mask;
+			while (m_path_index[i] != -1) i = (i + 1) & mask;
+			m_path_index[i] = k;
 		}
 	}
 
+	std::string file_storage::directory_path(int index) const
+	{
+		TORRENT_ASSERT(index >= 0 && index < int(m_path_components.size()));
+		path_component const& c = m_path_components[index];
+		std::string name(m_path_names, c.name_offset, c.name_len);
+		if (c.parent == -1) return name;
+		return combine_path(directory_path(c.parent), name);
+	}
+
+	void file_storage::update_piece_index()
+	{
+		std::vector<int>().swap(m_piece_index);
+		if (m_piece_length <= 0 || m_num_pieces <= 0 || m_files.empty()) return;
+
+		// the files are sorted by offset, so this is a single
+		// sweep over the files and pieces
+		m_piece_index.resize(m_num_pieces + 1);
+		const int last = int(m_files.size()) - 1;
+		int file = 0;
+		for (int p = 0; p < m_num_pieces; ++p)
+		{
+			size_type off = size_type(p) * m_piece_length;
+			while (file < last && m_files[file + 1].offset <= off) ++file;
+			m_piece_index[p] = file;
+		}
+		m_piece_index[m_num_pieces] = last;
+	}
+
 	file_entry::file_entry(): offset(0), size(0), file_base(0)
 		, mtime(0), pad_file(false), hidden_attribute(false)
 		, executable_attribute(false)
@@ -172,8 +322,7 @@ namespace libtorrent
 		TORRENT_ASSERT(index >= 0 && index < int(m_files.size()));
 		std::string utf8;
 		wchar_utf8(new_filename, utf8);
-		m_files[index].set_name(utf8.c_str());
-		update_path_index(m_files[index]);
+		update_path_index(m_files[index], utf8);
 	}
 
 	void file_storage::add_file(std::wstring const& file, size_type size, int flags
@@ -188,8 +337,7 @@ namespace libtorrent
 	void file_storage::rename_file(int index, std::string const& new_filename)
 	{
 		TORRENT_ASSERT(index >= 0 && index < int(m_files.size()));
-		m_files[index].set_name(new_filename.c_str());
-		update_path_index(m_files[index]);
+		update_path_index(m_files[index], new_filename);
 	}
 
 	namespace
@@ -207,10 +355,23 @@ namespace libtorrent
 		target.offset = offset;
 		TORRENT_ASSERT(!compare_file_offset(target, m_files.front()));
 
-		std::vector<internal_file_entry>::const_iterator file_iter = std::upper_bound(
-			begin(), end(), target, compare_file_offset);
+		iterator first = begin();
+		iterator last = end();
+		if (!m_piece_index.empty())
+		{
+			// only the files overlapping the piece the offset is
+			// in can contain it
+			size_type piece = offset / m_piece_length;
+			if (piece < m_num_pieces)
+			{
+				first = begin() + m_piece_index[int(piece)];
+				last = begin() + m_piece_index[int(piece) + 1] + 1;
+			}
+		}
+
+		iterator file_iter = std::upper_bound(first, last, target, compare_file_offset);
 
-		TORRENT_ASSERT(file_iter != begin());
+		TORRENT_ASSERT(file_iter != first);
 		--file_iter;
 		return file_iter;
 	}
@@ -229,11 +390,7 @@ namespace libtorrent
 		TORRENT_ASSERT(target.offset + size <= m_total_size);
 		TORRENT_ASSERT(!compare_file_offset(target, m_files.front()));
 
-		std::vector<internal_file_entry>::const_iterator file_iter = std::upper_bound(
-			begin(), end(), target, compare_file_offset);
-
-		TORRENT_ASSERT(file_iter != begin());
-		--file_iter;
+		iterator file_iter = file_at_offset(target.offset);
 
 		size_type file_offset = target.offset - file_iter->offset;
 		for (; size > 0; file_offset -= file_iter->size, ++file_iter)
@@ -283,7 +440,7 @@ namespace libtorrent
 	{
 		TORRENT_ASSERT(file_index < num_files());
 		TORRENT_ASSERT(file_index >= 0);
-		size_type offset = file_offset + at(file_index).offset;
+		size_type offset = file_offset + m_files[file_index].offset;
 
 		peer_request ret;
 		ret.piece = int(offset / piece_length());
@@ -312,9 +469,9 @@ namespace libtorrent
 				m_name = split_path(file).c_str();
 		}
 		TORRENT_ASSERT(m_name == split_path(file).c_str());
+		std::vector<int>().swap(m_piece_index);
 		m_files.push_back(internal_file_entry());
 		internal_file_entry& e = m_files.back();
-		e.set_name(file.c_str());
 		e.size = size;
 		e.offset = m_total_size;
 		e.pad_file = (flags & pad_file) != 0;
@@ -332,7 +489,7 @@ namespace libtorrent
 			m_mtime[m_files.size() - 1] = mtime;
 		}
 		
-		update_path_index(e);
+		update_path_index(e, file);
 		m_total_size += size;
 	}
 
@@ -353,9 +510,16 @@ namespace libtorrent
 			if (m_files.empty())
 				m_name = split_path(ent.path).c_str();
 		}
-		internal_file_entry ife(ent);
-		m_files.push_back(ife);
+		std::vector<int>().swap(m_piece_index);
+		// construct the entry in place, rather than copying it
+		// from internal_file_entry(ent), to only allocate the name once
+		m_files.push_back(internal_file_entry());
 		internal_file_entry& e = m_files.back();
+		e.size = ent.size;
+		e.pad_file = ent.pad_file;
+		e.hidden_attribute = ent.hidden_attribute;
+		e.executable_attribute = ent.executable_attribute;
+		e.symlink_attribute = ent.symlink_attribute;
 		if (e.size < 0) e.size = 0;
 		e.offset = m_total_size;
 		m_total_size += e.size;
@@ -375,7 +539,7 @@ namespace libtorrent
 			m_mtime[m_files.size() - 1] = ent.mtime;
 		}
 		if (ent.file_base) set_file_base(e, ent.file_base);
-		update_path_index(e);
+		update_path_index(e, ent.path);
 	}
 
 	sha1_hash file_storage::hash(int index) const
@@ -415,9 +579,9 @@ namespace libtorrent
 	{
 		TORRENT_ASSERT(index >= 0 && index < int(m_files.size()));
 		internal_file_entry const& fe = m_files[index];
-		TORRENT_ASSERT(fe.path_index >= -1 && fe.path_index < int(m_paths.size()));
+		TORRENT_ASSERT(fe.path_index >= -1 && fe.path_index < int(m_path_components.size()));
 		if (fe.path_index == -1) return fe.filename();
-		return combine_path(m_paths[fe.path_index], fe.filename());
+		return combine_path(directory_path(fe.path_index), fe.filename());
 	}
 
 	std::string file_storage::file_name(int index) const
@@ -489,9 +653,9 @@ namespace libtorrent
 
 	std::string file_storage::file_path(internal_file_entry const& fe) const
 	{
-		TORRENT_ASSERT(fe.path_index >= -1 && fe.path_index < int(m_paths.size()));
+		TORRENT_ASSERT(fe.path_index >= -1 && fe.path_index < int(m_path_components.size()));
 		if (fe.path_index == -1) return fe.filename();
-		return combine_path(m_paths[fe.path_index], fe.filename());
+		return combine_path(directory_path(fe.path_index), fe.filename());
 	}
 
 	std::string file_storage::file_name(internal_file_entry const& fe) const
@@ -557,6 +721,9 @@ namespace libtorrent
 		if (pad_file_limit >= 0 && pad_file_limit < alignment)
 			pad_file_limit = alignment;
 
+		// the file offsets are about to change
+		std::vector<int>().swap(m_piece_index);
+
 		size_type off = 0;
 		int padding_file = 0;
 		for (std::vector<internal_file_entry>::iterator i = m_files.begin();
@@ -38,6 +38,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/socket.hpp"
 #include "libtorrent/connection_queue.hpp"
 #include "libtorrent/socket_type.hpp" // for async_shutdown
+#include "libtorrent/resolver.hpp"
+#include "libtorrent/string_util.hpp" // for string_equal_no_case
 
 #if defined TORRENT_ASIO_DEBUGGING
 #include "libtorrent/debug.hpp"
@@ -65,6 +67,7 @@ http_connection::http_connection(io_service& ios, connection_queue& cc
 #endif
 	, m_read_pos(0)
 	, m_resolver(ios)
+	, m_cached_resolver(0)
 	, m_handler(handler)
 	, m_connect_handler(ch)
 	, m_filter_handler(fh)
@@ -88,6 +91,9 @@ http_connection::http_connection(io_service& ios, connection_queue& cc
 	, m_ssl(false)
 	, m_priority(0)
 	, m_abort(false)
+	, m_keep_alive(false)
+	, m_idle(false)
+	, m_reused(false)
 {
 	TORRENT_ASSERT(!m_handler.empty());
 }
@@ -192,7 +198,10 @@ void http_connection::get(std::string const& url, time_duration timeout, int pri
 	if (m_bottled)
 		APPEND_FMT("Accept-Encoding: gzip\r\n");
 
-	APPEND_FMT("Connection: close\r\n\r\n");
+	if (m_keep_alive)
+		APPEND_FMT("Connection: keep-alive\r\n\r\n");
+	else
+		APPEND_FMT("Connection: close\r\n\r\n");
 
 	sendbuffer.assign(request);
 	m_url = url;
@@ -231,6 +240,8 @@ void http_connection::start(std::string const& hostname, std::string const& port
 	m_timer.async_wait(boost::bind(&http_connection::on_timeout
 		, boost::weak_ptr<http_connection>(me), _1));
 	m_called = false;
+	m_idle = false;
+	m_reused = false;
 	m_parser.reset();
 	m_recvbuffer.clear();
 	m_read_pos = 0;
@@ -246,6 +257,9 @@ void http_connection::start(std::string const& hostname, std::string const& port
 	if (m_sock.is_open() && m_hostname == hostname && m_port == port
 		&& m_ssl == ssl && m_bind_addr == bind_addr)
 	{
+		m_reused = true;
+		m_last_receive = time_now_hires();
+		m_start_time = m_last_receive;
 #if defined TORRENT_ASIO_DEBUGGING
 		add_outstanding_async("http_connection::on_write");
 #endif
@@ -363,6 +377,15 @@ void http_connection::start(std::string const& hostname, std::string const& port
 			m_endpoints.push_back(tcp::endpoint(address(), atoi(port.c_str())));
 			queue_connect();
 		}
+		else if (m_cached_resolver)
+		{
+#if defined TORRENT_ASIO_DEBUGGING
+			add_outstanding_async("http_connection::on_resolve");
+#endif
+			m_endpoints.clear();
+			m_cached_resolver->async_resolve(hostname
+				, boost::bind(&http_connection::on_resolve_cached, me, _1, _2));
+		}
 		else
 		{
 #if defined TORRENT_ASIO_DEBUGGING
@@ -507,6 +530,38 @@ void http_connection::on_resolve(error_code const& e
 	std::transform(i, tcp::resolver::iterator(), std::back_inserter(m_endpoints)
 		, boost::bind(&tcp::resolver::iterator::value_type::endpoint, _1));
 
+	on_endpoints();
+}
+
+void http_connection::on_resolve_cached(error_code const& e
+	, std::vector<address> const& addresses)
+{
+#if defined TORRENT_ASIO_DEBUGGING
+	complete_async("http_connection::on_resolve");
+#endif
+	// the shared resolver isn't cancelled when we're closed
+	if (m_abort) return;
+
+	if (e)
+	{
+		boost::shared_ptr<http_connection> me(shared_from_this());
+
+		callback(e);
+		close();
+		return;
+	}
+	TORRENT_ASSERT(!addresses.empty());
+
+	int port = atoi(m_port.c_str());
+	for (std::vector<address>::const_iterator i = addresses.begin()
+		, end(addresses.end()); i != end; ++i)
+		m_endpoints.push_back(tcp::endpoint(*i, port));
+
+	on_endpoints();
+}
+
+void http_connection::on_endpoints()
+{
 	if (m_filter_handler) m_filter_handler(*this, m_endpoints);
 	if (m_endpoints.empty())
 	{
@@ -530,6 +585,30 @@ void http_connection::on_resolve(error_code const& e
 	queue_connect();
 }
 
+void http_connection::reconnect()
+{
+	// the server closed the connection while it was idle. Send the
+	// request again on a new connection
+	std::string hostname = m_hostname;
+	std::string port = m_port;
+	error_code ec;
+	m_sock.close(ec);
+	start(hostname, port, m_completion_timeout, m_priority, &m_proxy
+		, m_ssl, m_redirects, m_bind_addr
+#if TORRENT_USE_I2P
+		, m_i2p_conn
+#endif
+		);
+}
+
+void http_connection::set_handler(http_handler const& handler
+	, http_connect_handler const& ch, http_filter_handler const& fh)
+{
+	m_handler = handler;
+	m_connect_handler = ch;
+	m_filter_handler = fh;
+}
+
 void http_connection::queue_connect()
 {
 	TORRENT_ASSERT(!m_endpoints.empty());
@@ -658,12 +737,19 @@ void http_connection::on_write(error_code const& e)
 	if (e)
 	{
 		boost::shared_ptr<http_connection> me(shared_from_this());
+		if (m_reused && !m_abort)
+		{
+			reconnect();
+			return;
+		}
 		callback(e);
 		close();
 		return;
 	}
 
-	std::string().swap(sendbuffer);
+	// the request is kept around on reused connections, in case
+	// it needs to be sent again
+	if (!m_reused) std::string().swap(sendbuffer);
 	m_recvbuffer.resize(4096);
 
 	int amount_to_read = m_recvbuffer.size() - m_read_pos;
@@ -711,6 +797,14 @@ void http_connection::on_read(error_code const& e
 
 	// when using the asio SSL wrapper, it seems like
 	// we get the shut_down error instead of EOF
+	// a reused connection that's closed before we receive anything
+	// was most likely closed by the server while it was idle
+	if (e && m_reused && m_read_pos == 0 && !m_abort)
+	{
+		reconnect();
+		return;
+	}
+
 	if (e == asio::error::eof || e == asio::error::shut_down)
 	{
 		error_code ec = asio::error::eof;
@@ -826,7 +920,14 @@ void http_connection::on_read(error_code const& e
 		{
 			error_code ec;
 			m_timer.cancel(ec);
+
+			// if the server agreed to keep the connection open, stop
+			// reading and leave it idle. The handler may pick it up
+			// for the next request
+			m_idle = m_keep_alive && m_parser.protocol() == "HTTP/1.1"
+				&& !string_equal_no_case(m_parser.header("connection").c_str(), "close");
 			callback(e, m_parser.get_body().begin, m_parser.get_body().left());
+			if (m_idle) return;
 		}
 	}
 	else
@@ -33,6 +33,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/pch.hpp"
 
 #include <cctype>
+#include <cstring> // for memchr
 #include <algorithm>
 #include <stdlib.h>
 
@@ -46,6 +47,43 @@ using namespace libtorrent;
 namespace libtorrent
 {
 
+	namespace
+	{
+		// returns a pointer to the first c in [begin, end), or end if
+		// there is none. memchr() is vectorized by the C library, which
+		// makes it several times faster than std::find() on long lines
+		// and on the large chunks of web seed responses
+		char const* find_char(char const* begin, char const* end, char c)
+		{
+			TORRENT_ASSERT(begin <= end);
+			void const* ret = std::memchr(begin, c, end - begin);
+			return ret ? static_cast<char const*>(ret) : end;
+		}
+
+		// splits the header line [line, line_end) into a lower case name
+		// and a value with leading whitespace stripped, without copying the
+		// line itself first. Returns false if there's no colon in the line,
+		// i.e. it's the empty line terminating the headers
+		bool parse_header_line(char const* line, char const* line_end
+			, std::string& name, std::string& value)
+		{
+			char const* separator = find_char(line, line_end, ':');
+			if (separator == line_end) return false;
+
+			name.resize(separator - line);
+			for (int i = 0; line != separator; ++line, ++i)
+				name[i] = to_lower(*line);
+
+			++separator;
+			// skip whitespace
+			while (separator < line_end
+				&& (*separator == ' ' || *separator == '\t'))
+				++separator;
+			value.assign(separator, line_end);
+			return true;
+		}
+	}
+
 	bool is_ok_status(int http_status)
 	{
 		return http_status == 206 // partial content
@@ -103,7 +141,7 @@ restart_response:
 		if (m_state == read_status)
 		{
 			TORRENT_ASSERT(!m_finished);
-			char const* newline = std::find(pos, recv_buffer.end, '\n');
+			char const* newline = find_char(pos, recv_buffer.end, '\n');
 			// if we don't have a full line yet, wait.
 			if (newline == recv_buffer.end)
 			{
@@ -129,7 +167,7 @@ restart_response:
 			pos = newline;
 
 			m_protocol = read_until(line, ' ', line_end);
-			if (m_protocol.substr(0, 5) == "HTTP/")
+			if (m_protocol.compare(0, 5, "HTTP/") == 0)
 			{
 				m_status_code = atoi(read_until(line, ' ', line_end).c_str());
 				m_server_message = read_until(line, '\r', line_end);
@@ -152,22 +190,22 @@ restart_response:
 		if (m_state == read_header)
 		{
 			TORRENT_ASSERT(!m_finished);
-			char const* newline = std::find(pos, recv_buffer.end, '\n');
-			std::string line;
+			char const* newline = find_char(pos, recv_buffer.end, '\n');
+			std::string name;
+			std::string value;
 
 			while (newline != recv_buffer.end && m_state == read_header)
 			{
 				// if the LF character is preceeded by a CR
-				// charachter, don't copy it into the line string.
+				// charachter, it's not part of the line
+				char const* line = pos;
 				char const* line_end = newline;
 				if (pos != line_end && *(line_end - 1) == '\r') --line_end;
-				line.assign(pos, line_end);
 				++newline;
 				m_recv_pos += newline - pos;
 				pos = newline;
 
-				std::string::size_type separator = line.find(':');
-				if (separator == std::string::npos)
+				if (!parse_header_line(line, line_end, name, value))
 				{
 					if (m_status_code == 100)
 					{
@@ -189,14 +227,6 @@ restart_response:
 					break;
 				}
 
-				std::string name = line.substr(0, separator);
-				std::transform(name.begin(), name.end(), name.begin(), &to_lower);
-				++separator;
-				// skip whitespace
-				while (separator < line.size()
-					&& (line[separator] == ' ' || line[separator] == '\t'))
-					++separator;
-				std::string value = line.substr(separator, std::string::npos);
 				m_header.insert(std::make_pair(name, value));
 
 				if (name == "content-length")
@@ -239,7 +269,7 @@ restart_response:
 				}
 
 				TORRENT_ASSERT(m_recv_pos <= recv_buffer.left());
-				newline = std::find(pos, recv_buffer.end, '\n');
+				newline = find_char(pos, recv_buffer.end, '\n');
 			}
 			boost::get<1>(ret) += newline - (m_recv_buffer.begin + start_pos);
 		}
@@ -350,7 +380,7 @@ restart_response:
 		if (pos < buf.end && pos[0] == '\n') ++pos;
 		if (pos == buf.end) return false;
 
-		char const* newline = std::find(pos, buf.end, '\n');
+		char const* newline = find_char(pos, buf.end, '\n');
 		if (newline == buf.end) return false;
 		++newline;
 
@@ -373,21 +403,21 @@ restart_response:
 		// this is the terminator of the stream. Also read headers
 		std::map<std::string, std::string> tail_headers;
 		pos = newline;
-		newline = std::find(pos, buf.end, '\n');
+		newline = find_char(pos, buf.end, '\n');
 
-		std::string line;
+		std::string name;
+		std::string value;
 		while (newline != buf.end)
 		{
 			// if the LF character is preceeded by a CR
-			// charachter, don't copy it into the line string.
+			// charachter, it's not part of the line
+			char const* line = pos;
 			char const* line_end = newline;
 			if (pos != line_end && *(line_end - 1) == '\r') --line_end;
-			line.assign(pos, line_end);
 			++newline;
 			pos = newline;
 
-			std::string::size_type separator = line.find(':');
-			if (separator == std::string::npos)
+			if (!parse_header_line(line, line_end, name, value))
 			{
 				// this means we got a blank line,
 				// the header is finished and the body
@@ -406,18 +436,10 @@ restart_response:
 				return true;
 			}
 
-			std::string name = line.substr(0, separator);
-			std::transform(name.begin(), name.end(), name.begin(), &to_lower);
-			++separator;
-			// skip whitespace
-			while (separator < line.size()
-				&& (line[separator] == ' ' || line[separator] == '\t'))
-				++separator;
-			std::string value = line.substr(separator, std::string::npos);
 			tail_headers.insert(std::make_pair(name, value));
 //			fprintf(stderr, "tail_header: %s: %s\n", name.c_str(), value.c_str());
 
-			newline = std::find(pos, buf.end, '\n');
+			newline = find_char(pos, buf.end, '\n');
 		}
 		return false;
 	}
@@ -76,7 +76,7 @@ namespace libtorrent
 		, tracker_manager& man
 		, tracker_request const& req
 		, boost::weak_ptr<request_callback> c
-		, aux::session_impl const& ses
+		, aux::session_impl& ses
 		, proxy_settings const& ps
 		, std::string const& auth
 #if TORRENT_USE_I2P
@@ -212,15 +212,45 @@ namespace libtorrent
 			}
 		}
 
-		m_tracker_connection.reset(new http_connection(m_ios, m_cc
-			, boost::bind(&http_tracker_connection::on_response, self(), _1, _2, _3, _4)
-			, true, settings.max_http_recv_buffer_size
-			, boost::bind(&http_tracker_connection::on_connect, self(), _1)
-			, boost::bind(&http_tracker_connection::on_filter, self(), _1, _2)
+		if (m_tracker_connection)
+		{
+			// this is a kept-alive connection from the tracker_manager's
+			// pool. It's already connected, so on_connect() won't be
+			// called and the IP filter is checked here instead
+			error_code ec;
+			tcp::endpoint ep = m_tracker_connection->socket().remote_endpoint(ec);
+			if (ec || (tracker_req().apply_ip_filter
+				&& m_ses.m_ip_filter.access(ep.address()) == ip_filter::blocked))
+			{
+				m_tracker_connection->close();
+				m_tracker_connection.reset();
+			}
+			else
+			{
+				m_tracker_connection->set_handler(
+					boost::bind(&http_tracker_connection::on_response, self(), _1, _2, _3, _4)
+					, boost::bind(&http_tracker_connection::on_connect, self(), _1)
+					, boost::bind(&http_tracker_connection::on_filter, self(), _1, _2));
+				m_tracker_ip = ep.address();
+				boost::shared_ptr<request_callback> cb = requester();
+				if (cb) cb->m_tracker_address = ep;
+			}
+		}
+
+		if (!m_tracker_connection)
+		{
+			m_tracker_connection.reset(new http_connection(m_ios, m_cc
+				, boost::bind(&http_tracker_connection::on_response, self(), _1, _2, _3, _4)
+				, true, settings.max_http_recv_buffer_size
+				, boost::bind(&http_tracker_connection::on_connect, self(), _1)
+				, boost::bind(&http_tracker_connection::on_filter, self(), _1, _2)
 #ifdef TORRENT_USE_OPENSSL
-			, tracker_req().ssl_ctx
+				, tracker_req().ssl_ctx
 #endif
-			));
+				));
+			m_tracker_connection->set_resolver(&m_ses.m_resolver);
+			m_tracker_connection->keep_alive(keep_alive());
+		}
 
 		int timeout = tracker_req().event==tracker_request::stopped
 			?settings.stop_tracker_timeout
@@ -248,11 +278,32 @@ namespace libtorrent
 #endif
 	}
 
+	bool http_tracker_connection::keep_alive() const
+	{
+		if (m_ses.settings().tracker_keep_alive_timeout <= 0) return false;
+
+		// connections through proxies aren't kept alive
+		if (m_ps.type != proxy_settings::none) return false;
+#if TORRENT_USE_I2P
+		if (is_i2p_url(tracker_req().url)) return false;
+#endif
+#ifdef TORRENT_USE_OPENSSL
+		// torrents with their own SSL context don't share connections
+		if (tracker_req().ssl_ctx) return false;
+#endif
+		return true;
+	}
+
 	void http_tracker_connection::close()
 	{
 		if (m_tracker_connection)
 		{
-			m_tracker_connection->close();
+			// if the tracker agreed to keep the connection open, hand
+			// it back to the pool for the next request to this tracker
+			if (m_tracker_connection->is_idle())
+				m_man.return_idle_connection(tracker_req().url, m_tracker_connection);
+			else
+				m_tracker_connection->close();
 			m_tracker_connection.reset();
 		}
 		tracker_connection::close();
@@ -51,6 +51,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/socket.hpp"
 #include "libtorrent/socket_io.hpp"
 #include "libtorrent/bencode.hpp"
+#include "libtorrent/bdecode.hpp"
 #include "libtorrent/io.hpp"
 #include "libtorrent/version.hpp"
 #include "libtorrent/escape_string.hpp"
@@ -129,11 +130,11 @@ namespace libtorrent { namespace dht
 	}
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-	std::string parse_dht_client(lazy_entry const& e)
+	std::string parse_dht_client(bdecode_node const& e)
 	{
-		lazy_entry const* ver = e.dict_find_string("v");
+		bdecode_node ver = e.dict_find_string("v");
 		if (!ver) return "generic";
-		std::string const& client = ver->string_value();
+		std::string const& client = ver.string_value();
 		if (client.size() < 2)
 		{
 			++g_unknown_message_input;
@@ -422,6 +423,11 @@ namespace libtorrent { namespace dht
 		m_dht.announce(ih, listen_port, seed, f);
 	}
 
+	void dht_tracker::scrape(sha1_hash const& ih, boost::function<void(int, int)> f)
+	{
+		m_dht.scrape(ih, f);
+	}
+
 
 	// translate bittorrent kademlia message into the generice kademlia message
 	// used by the library
@@ -508,10 +514,12 @@ namespace libtorrent { namespace dht
 			
 		TORRENT_ASSERT(size > 0);
 
-		lazy_entry e;
+		// m_msg keeps its token array between packets, so decoding
+		// a message doesn't allocate
+		bdecode_node& e = m_msg;
 		int pos;
 		error_code err;
-		int ret = lazy_bdecode(buf, buf + size, e, err, &pos, 10, 500);
+		int ret = bdecode(buf, buf + size, e, err, &pos, 10, 500);
 		if (ret != 0)
 		{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
@@ -523,7 +531,7 @@ namespace libtorrent { namespace dht
 
 		libtorrent::dht::msg m(e, ep);
 
-		if (e.type() != lazy_entry::dict_t)
+		if (e.type() != bdecode_node::dict_t)
 		{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 			TORRENT_LOG(dht_tracker) << "<== " << ep << " ERROR: not a dictionary: "
@@ -610,41 +618,47 @@ namespace libtorrent { namespace dht
 		using libtorrent::bencode;
 		using libtorrent::entry;
 
-		static char const version_str[] = {'L', 'T'
-			, LIBTORRENT_VERSION_MAJOR, LIBTORRENT_VERSION_MINOR};
-		e["v"] = std::string(version_str, version_str + 4);
+		e["v"] = std::string(dht_client_version, dht_client_version
+			+ sizeof(dht_client_version));
 
 		m_send_buf.clear();
 		bencode(std::back_inserter(m_send_buf), e);
+		return send_packet(&m_send_buf[0], int(m_send_buf.size()), addr, send_flags);
+	}
+
+	bool dht_tracker::send_packet(char const* buf, int size
+		, udp::endpoint const& addr, int send_flags)
+	{
 		error_code ec;
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		std::stringstream log_line;
-		lazy_entry print;
-		int ret = lazy_bdecode(&m_send_buf[0], &m_send_buf[0] + m_send_buf.size(), print, ec);
+		bdecode_node print;
+		int ret = bdecode(buf, buf + size, print, ec);
 		TORRENT_ASSERT(ret == 0);
 		log_line << print_entry(print, true);
 #endif
 
-		if (m_sock.send(addr, &m_send_buf[0], (int)m_send_buf.size(), ec, send_flags))
+		if (m_sock.send(addr, buf, size, ec, send_flags))
 		{
 			if (ec) return false;
 
 			// account for IP and UDP overhead
-			m_sent_bytes += m_send_buf.size() + (addr.address().is_v6() ? 48 : 28);
+			m_sent_bytes += size + (addr.address().is_v6() ? 48 : 28);
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-			m_total_out_bytes += m_send_buf.size();
+			m_total_out_bytes += size;
 		
-			if (e["y"].string() == "r")
+			std::string y = print.dict_find_string_value("y");
+			if (y == "r")
 			{
 				// TODO: fix this stats logging
 //				++m_replies_sent[e["r"]];
-//				m_replies_bytes_sent[e["r"]] += int(m_send_buf.size());
+//				m_replies_bytes_sent[e["r"]] += size;
 			}
-			else if (e["y"].string() == "q")
+			else if (y == "q")
 			{
-				m_queries_out_bytes += m_send_buf.size();
+				m_queries_out_bytes += size;
 			}
 			TORRENT_LOG(dht_tracker) << "==> " << addr << " " << log_line.str();
 #endif
@@ -61,7 +61,7 @@ void find_data_observer::reply(msg const& m)
 	log_line << "[" << m_algorithm.get() << "] incoming get_peer response [ ";
 #endif
 
-	lazy_entry const* r = m.message.dict_find_dict("r");
+	bdecode_node r = m.message.dict_find_dict("r");
 	if (!r)
 	{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
@@ -70,8 +70,8 @@ void find_data_observer::reply(msg const& m)
 		return;
 	}
 
-	lazy_entry const* id = r->dict_find_string("id");
-	if (!id || id->string_length() != 20)
+	bdecode_node id = r.dict_find_string("id");
+	if (!id || id.string_length() != 20)
 	{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		TORRENT_LOG(traversal) << "[" << m_algorithm.get() << "] invalid id in response";
@@ -79,27 +79,27 @@ void find_data_observer::reply(msg const& m)
 		return;
 	}
 
-	lazy_entry const* token = r->dict_find_string("token");
+	bdecode_node token = r.dict_find_string("token");
 	if (token)
 	{
 		static_cast<find_data*>(m_algorithm.get())->got_write_token(
-			node_id(id->string_ptr()), token->string_value());
+			node_id(id.string_ptr()), token.string_value());
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-		log_line << " token: " << to_hex(token->string_value());
+		log_line << " token: " << to_hex(token.string_value());
 #endif
 	}
 
 	// look for peers
-	lazy_entry const* n = r->dict_find_list("values");
+	bdecode_node n = r.dict_find_list("values");
 	if (n)
 	{
 		std::vector<tcp::endpoint> peer_list;
-		if (n->list_size() == 1 && n->list_at(0)->type() == lazy_entry::string_t)
+		if (n.list_size() == 1 && n.list_at(0).type() == bdecode_node::string_t)
 		{
 			// assume it's mainline format
-			char const* peers = n->list_at(0)->string_ptr();
-			char const* end = peers + n->list_at(0)->string_length();
+			char const* peers = n.list_at(0).string_ptr();
+			char const* end = peers + n.list_at(0).string_length();
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 			log_line << " p: " << ((end - peers) / 6);
@@ -112,19 +112,19 @@ void find_data_observer::reply(msg const& m)
 			// assume it's uTorrent/libtorrent format
 			read_endpoint_list<tcp::endpoint>(n, peer_list);
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-			log_line << " p: " << n->list_size();
+			log_line << " p: " << n.list_size();
 #endif
 		}
 		static_cast<find_data*>(m_algorithm.get())->got_peers(peer_list);
 	}
 
 	// look for nodes
-	n = r->dict_find_string("nodes");
+	n = r.dict_find_string("nodes");
 	if (n)
 	{
 		std::vector<node_entry> node_list;
-		char const* nodes = n->string_ptr();
-		char const* end = nodes + n->string_length();
+		char const* nodes = n.string_ptr();
+		char const* end = nodes + n.string_length();
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		log_line << " nodes: " << ((end - nodes) / 26);
@@ -138,26 +138,26 @@ void find_data_observer::reply(msg const& m)
 		}
 	}
 
-	n = r->dict_find_list("nodes2");
+	n = r.dict_find_list("nodes2");
 	if (n)
 	{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-		log_line << " nodes2: " << n->list_size();
+		log_line << " nodes2: " << n.list_size();
 #endif
-		for (int i = 0; i < n->list_size(); ++i)
+		for (int i = 0; i < n.list_size(); ++i)
 		{
-			lazy_entry const* p = n->list_at(0);
-			if (p->type() != lazy_entry::string_t) continue;
-			if (p->string_length() < 6 + 20) continue;
-			char const* in = p->string_ptr();
+			bdecode_node p = n.list_at(0);
+			if (p.type() != bdecode_node::string_t) continue;
+			if (p.string_length() < 6 + 20) continue;
+			char const* in = p.string_ptr();
 
 			node_id id;
 			std::copy(in, in + 20, id.begin());
 			in += 20;
-			if (p->string_length() == 6 + 20)
+			if (p.string_length() == 6 + 20)
 				m_algorithm->traverse(id, read_v4_endpoint<udp::endpoint>(in));
 #if TORRENT_USE_IPV6
-			else if (p->string_length() == 18 + 20)
+			else if (p.string_length() == 18 + 20)
 				m_algorithm->traverse(id, read_v6_endpoint<udp::endpoint>(in));
 #endif
 		}
@@ -189,7 +189,15 @@ find_data::find_data(
 	, m_got_peers(false)
 	, m_noseeds(noseeds)
 {
-	node.m_table.for_each_node(&add_entry_fun, 0, (traversal_algorithm*)this);
+}
+
+void find_data::start()
+{
+	// this can't be done in the constructor, since new_observer()
+	// is virtual and the observers of sub classes would not be
+	// created
+	m_node.m_table.for_each_node(&add_entry_fun, 0, (traversal_algorithm*)this);
+	traversal_algorithm::start();
 }
 
 observer_ptr find_data::new_observer(void* ptr
@@ -253,5 +261,100 @@ void find_data::done()
 	traversal_algorithm::done();
 }
 
+void scrape_observer::reply(msg const& m)
+{
+	bdecode_node r = m.message.dict_find_dict("r");
+	if (r)
+	{
+		bdecode_node seeds = r.dict_find_string("BFsd");
+		// older versions of libtorrent used the wrong key
+		if (!seeds) seeds = r.dict_find_string("BFse");
+		bdecode_node downloaders = r.dict_find_string("BFpe");
+		if (seeds && downloaders
+			&& seeds.string_length() == 256
+			&& downloaders.string_length() == 256)
+		{
+			static_cast<scrape_data*>(m_algorithm.get())->got_filters(
+				seeds.string_ptr(), downloaders.string_ptr());
+		}
+	}
+
+	// this also picks up the nodes, to keep
+	// the traversal going
+	find_data_observer::reply(m);
+}
+
+namespace
+{
+	void nop_peers(std::vector<tcp::endpoint> const&) {}
+	void nop_nodes(std::vector<std::pair<node_entry, std::string> > const&, bool) {}
+}
+
+scrape_data::scrape_data(
+	node_impl& node
+	, node_id target
+	, scrape_callback const& callback)
+	: find_data(node, target, &nop_peers, &nop_nodes, false)
+	, m_callback(callback)
+{
+}
+
+observer_ptr scrape_data::new_observer(void* ptr
+	, udp::endpoint const& ep, node_id const& id)
+{
+	observer_ptr o(new (ptr) scrape_observer(this, ep, id));
+#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
+	o->m_in_constructor = false;
+#endif
+	return o;
+}
+
+bool scrape_data::invoke(observer_ptr o)
+{
+	if (m_done)
+	{
+		m_invoke_count = -1;
+		return false;
+	}
+
+	entry e;
+	e["y"] = "q";
+	e["q"] = "get_peers";
+	entry& a = e["a"];
+	a["info_hash"] = m_target.to_string();
+	a["scrape"] = 1;
+	return m_node.m_rpc.invoke(e, o->target_ep(), o);
+}
+
+void scrape_data::got_filters(char const* seeds, char const* downloaders)
+{
+	// the same peer is likely to be stored by several of the nodes,
+	// so the filters are merged rather than their sizes added up
+	bloom_filter<256> f;
+	f.from_string(seeds);
+	m_seeds |= f;
+	f.from_string(downloaders);
+	m_downloaders |= f;
+}
+
+void scrape_data::done()
+{
+	if (m_invoke_count != 0) return;
+
+	if (m_callback)
+	{
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+		TORRENT_LOG(traversal) << time_now_string() << "[" << this << "] scrape DONE"
+			<< " seeds: " << m_seeds.size() << " downloaders: " << m_downloaders.size();
+#endif
+		// size() estimates half a peer for an empty filter, so
+		// truncate rather than round
+		m_callback(int(m_seeds.size()), int(m_downloaders.size()));
+		m_callback.clear();
+	}
+
+	find_data::done();
+}
+
 } } // namespace libtorrent::dht
 
@@ -38,6 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/io.hpp"
 #include "libtorrent/bencode.hpp"
+#include "libtorrent/bencode_writer.hpp"
 #include "libtorrent/hasher.hpp"
 #include "libtorrent/alert_types.hpp"
 #include "libtorrent/alert.hpp"
@@ -52,6 +53,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/kademlia/refresh.hpp"
 #include "libtorrent/kademlia/find_data.hpp"
 #include "libtorrent/rsa.hpp"
+#include "libtorrent/version.hpp"
 
 namespace libtorrent { namespace dht
 {
@@ -59,33 +61,16 @@ namespace libtorrent { namespace dht
 void incoming_error(entry& e, char const* msg);
 
 using detail::write_endpoint;
+using detail::write_address;
+using detail::write_uint16;
 
-// TODO: configurable?
-enum { announce_interval = 30 };
+char const dht_client_version[4] = {'L', 'T'
+	, LIBTORRENT_VERSION_MAJOR, LIBTORRENT_VERSION_MINOR};
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 TORRENT_DEFINE_LOG(node)
 #endif
 
-// remove peers that have timed out
-void purge_peers(std::set<peer_entry>& peers)
-{
-	for (std::set<peer_entry>::iterator i = peers.begin()
-		  , end(peers.end()); i != end;)
-	{
-		// the peer has timed out
-		if (i->added + minutes(int(announce_interval * 1.5f)) < time_now())
-		{
-#ifdef TORRENT_DHT_VERBOSE_LOGGING
-			TORRENT_LOG(node) << "peer timed out at: " << i->addr;
-#endif
-			peers.erase(i++);
-		}
-		else
-			++i;
-	}
-}
-
 void nop() {}
 
 node_impl::node_impl(alert_dispatcher* alert_disp
@@ -96,6 +81,7 @@ node_impl::node_impl(alert_dispatcher* alert_disp
 	, m_id(nid == (node_id::min)() || !verify_id(nid, external_address) ? generate_id(external_address) : nid)
 	, m_table(m_id, 8, settings)
 	, m_rpc(m_id, m_table, sock, observer)
+	, m_storage(settings)
 	, m_last_tracker_tick(time_now())
 	, m_post_alert(alert_disp)
 	, m_sock(sock)
@@ -204,8 +190,8 @@ void node_impl::unreachable(udp::endpoint const& ep)
 void node_impl::incoming(msg const& m)
 {
 	// is this a reply?
-	lazy_entry const* y_ent = m.message.dict_find_string("y");
-	if (!y_ent || y_ent->string_length() == 0)
+	bdecode_node y_ent = m.message.dict_find_string("y");
+	if (!y_ent || y_ent.string_length() == 0)
 	{
 		entry e;
 		incoming_error(e, "missing 'y' entry");
@@ -213,7 +199,7 @@ void node_impl::incoming(msg const& m)
 		return;
 	}
 
-	char y = *(y_ent->string_ptr());
+	char y = *(y_ent.string_ptr());
 
 	switch (y)
 	{
@@ -228,17 +214,17 @@ void node_impl::incoming(msg const& m)
 		{
 			TORRENT_ASSERT(m.message.dict_find_string_value("y") == "q");
 			entry e;
-			incoming_request(m, e);
-			m_sock->send_packet(e, m.addr, 0);
+			if (!incoming_request(m, e))
+				m_sock->send_packet(e, m.addr, 0);
 			break;
 		}
 		case 'e':
 		{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-			lazy_entry const* err = m.message.dict_find_list("e");
-			if (err && err->list_size() >= 2)
+			bdecode_node err = m.message.dict_find_list("e");
+			if (err && err.list_size() >= 2)
 			{
-				TORRENT_LOG(node) << "INCOMING ERROR: " << err->list_string_value_at(1);
+				TORRENT_LOG(node) << "INCOMING ERROR: " << err.list_string_value_at(1);
 			}
 #endif
 			break;
@@ -332,6 +318,16 @@ void node_impl::announce(sha1_hash const& info_hash, int listen_port, bool seed
 	ta->start();
 }
 
+void node_impl::scrape(sha1_hash const& info_hash
+	, boost::function<void(int, int)> f)
+{
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+	TORRENT_LOG(node) << "scraping [ ih: " << info_hash << " ]" ;
+#endif
+	boost::intrusive_ptr<scrape_data> ta(new scrape_data(*this, info_hash, f));
+	ta->start();
+}
+
 void node_impl::tick()
 {
 	node_id target;
@@ -359,20 +355,7 @@ time_duration node_impl::connection_timeout()
 	}
 
 	// look through all peers and see if any have timed out
-	for (table_t::iterator i = m_map.begin(), end(m_map.end()); i != end;)
-	{
-		torrent_entry& t = i->second;
-		node_id const& key = i->first;
-		++i;
-		purge_peers(t.peers);
-
-		// if there are no more peers, remove the entry altogether
-		if (t.peers.empty())
-		{
-			table_t::iterator i = m_map.find(key);
-			if (i != m_map.end()) m_map.erase(i);
-		}
-	}
+	m_storage.tick();
 
 	return d;
 }
@@ -382,9 +365,10 @@ void node_impl::status(session_status& s)
 	mutex_t::scoped_lock l(m_mutex);
 
 	m_table.status(s);
-	s.dht_torrents = int(m_map.size());
+	s.dht_torrents = m_storage.num_torrents();
 	s.active_requests.clear();
 	s.dht_total_allocations = m_rpc.num_allocated_observers();
+	m_rpc.status(s);
 	for (std::set<traversal_algorithm*>::iterator i = m_running_requests.begin()
 		, end(m_running_requests.end()); i != end; ++i)
 	{
@@ -394,69 +378,6 @@ void node_impl::status(session_status& s)
 	}
 }
 
-void node_impl::lookup_peers(sha1_hash const& info_hash, int prefix, entry& reply
-	, bool noseed, bool scrape) const
-{
-	if (m_post_alert)
-	{
-		alert* a = new dht_get_peers_alert(info_hash);
-		if (!m_post_alert->post_alert(a)) delete a;
-	}
-
-	table_t::const_iterator i = m_map.lower_bound(info_hash);
-	if (i == m_map.end()) return;
-	if (i->first != info_hash && prefix == 20) return;
-	if (prefix != 20)
-	{
-		sha1_hash mask = sha1_hash::max();
-		mask <<= (20 - prefix) * 8;
-		if ((i->first & mask) != (info_hash & mask)) return;
-	}
-
-	torrent_entry const& v = i->second;
-
-	if (!v.name.empty()) reply["n"] = v.name;
-
-	if (scrape)
-	{
-		bloom_filter<256> downloaders;
-		bloom_filter<256> seeds;
-
-		for (std::set<peer_entry>::const_iterator i = v.peers.begin()
-			, end(v.peers.end()); i != end; ++i)
-		{
-			sha1_hash iphash;
-			hash_address(i->addr.address(), iphash);
-			if (i->seed) seeds.set(iphash);
-			else downloaders.set(iphash);
-		}
-
-		reply["BFpe"] = downloaders.to_string();
-		reply["BFse"] = seeds.to_string();
-	}
-	else
-	{
-		int num = (std::min)((int)v.peers.size(), m_settings.max_peers_reply);
-		std::set<peer_entry>::const_iterator iter = v.peers.begin();
-		entry::list_type& pe = reply["values"].list();
-		std::string endpoint;
-
-		for (int t = 0, m = 0; m < num && iter != v.peers.end(); ++iter, ++t)
-		{
-			if ((random() / float(UINT_MAX + 1.f)) * (num - t) >= num - m) continue;
-			if (noseed && iter->seed) continue;
-			endpoint.resize(18);
-			std::string::iterator out = endpoint.begin();
-			write_endpoint(iter->addr, out);
-			endpoint.resize(out - endpoint.begin());
-			pe.push_back(entry(endpoint));
-
-			++m;
-		}
-	}
-	return;
-}
-
 namespace
 {
 	void write_nodes_entry(entry& r, nodes_t const& nodes)
@@ -494,26 +415,64 @@ namespace
 			}
 		}
 	}
+
+	// the same as write_nodes_entry(), but for a response that's
+	// written directly into a buffer
+	void write_nodes(bencode_dict<vector_sink>& d, nodes_t const& nodes)
+	{
+		int num_v4 = 0;
+		for (nodes_t::const_iterator i = nodes.begin()
+			, end(nodes.end()); i != end; ++i)
+		{
+			if (i->addr.is_v4()) ++num_v4;
+		}
+
+		vector_sink& s = d.string_prefix("nodes", num_v4 * (20 + 6));
+		for (nodes_t::const_iterator i = nodes.begin()
+			, end(nodes.end()); i != end; ++i)
+		{
+			if (!i->addr.is_v4()) continue;
+			char node[20 + 6];
+			char* out = std::copy(i->id.begin(), i->id.end(), node);
+			write_endpoint(udp::endpoint(i->addr, i->port), out);
+			s.write(node, sizeof(node));
+		}
+
+		if (num_v4 == int(nodes.size())) return;
+
+		bencode_list<vector_sink> l(d, "nodes2");
+		for (nodes_t::const_iterator i = nodes.begin()
+			, end(nodes.end()); i != end; ++i)
+		{
+			if (!i->addr.is_v6()) continue;
+			char node[20 + 18];
+			char* out = std::copy(i->id.begin(), i->id.end(), node);
+			write_endpoint(udp::endpoint(i->addr, i->port), out);
+			l.string(node, sizeof(node));
+		}
+	}
 }
 
 // verifies that a message has all the required
 // entries and returns them in ret
-bool verify_message(lazy_entry const* msg, key_desc_t const desc[], lazy_entry const* ret[]
-	, int size , char* error, int error_size)
+bool verify_message(bdecode_node const& message, key_desc_t const desc[]
+	, bdecode_node ret[], int size , char* error, int error_size)
 {
 	// clear the return buffer
-	memset(ret, 0, sizeof(ret[0]) * size);
+	for (int i = 0; i < size; ++i)
+		ret[i].clear();
 
 	// when parsing child nodes, this is the stack
-	// of lazy_entry pointers to return to
-	lazy_entry const* stack[5];
+	// of bdecode_nodes to return to
+	bdecode_node const* stack[5];
 	int stack_ptr = -1;
 
-	if (msg->type() != lazy_entry::dict_t)
+	if (message.type() != bdecode_node::dict_t)
 	{
 		snprintf(error, error_size, "not a dictionary");
 		return false;
 	}
+	bdecode_node const* msg = &message;
 	++stack_ptr;
 	stack[stack_ptr] = msg;
 	for (int i = 0; i < size; ++i)
@@ -524,8 +483,9 @@ bool verify_message(lazy_entry const* msg, key_desc_t const desc[], lazy_entry c
 
 		ret[i] = msg->dict_find(k.name);
 		// none_t means any type
-		if (ret[i] && ret[i]->type() != k.type && k.type != lazy_entry::none_t) ret[i] = 0;
-		if (ret[i] == 0 && (k.flags & key_desc_t::optional) == 0)
+		if (ret[i] && ret[i].type() != k.type && k.type != bdecode_node::none_t)
+			ret[i].clear();
+		if (!ret[i] && (k.flags & key_desc_t::optional) == 0)
 		{
 			// the key was not found, and it's not an optional key
 			snprintf(error, error_size, "missing '%s' key", k.name);
@@ -534,18 +494,18 @@ bool verify_message(lazy_entry const* msg, key_desc_t const desc[], lazy_entry c
 
 		if (k.size > 0
 			&& ret[i]
-			&& k.type == lazy_entry::string_t)
+			&& k.type == bdecode_node::string_t)
 		{
 			bool invalid = false;
 			if (k.flags & key_desc_t::size_divisible)
-				invalid = (ret[i]->string_length() % k.size) != 0;
+				invalid = (ret[i].string_length() % k.size) != 0;
 			else
-				invalid = ret[i]->string_length() != k.size;
+				invalid = ret[i].string_length() != k.size;
 
 			if (invalid)
 			{
 				// the string was not of the required size
-				ret[i] = 0;
+				ret[i].clear();
 				if ((k.flags & key_desc_t::optional) == 0)
 				{
 					snprintf(error, error_size, "invalid value for '%s'", k.name);
@@ -555,13 +515,13 @@ bool verify_message(lazy_entry const* msg, key_desc_t const desc[], lazy_entry c
 		}
 		if (k.flags & key_desc_t::parse_children)
 		{
-			TORRENT_ASSERT(k.type == lazy_entry::dict_t);
+			TORRENT_ASSERT(k.type == bdecode_node::dict_t);
 
 			if (ret[i])
 			{
 				++stack_ptr;
 				TORRENT_ASSERT(stack_ptr < int(sizeof(stack)/sizeof(stack[0])));
-				msg = ret[i];
+				msg = &ret[i];
 				stack[stack_ptr] = msg;
 			}
 			else
@@ -590,42 +550,58 @@ void incoming_error(entry& e, char const* msg)
 	l.push_back(entry(msg));
 }
 
-// build response
-void node_impl::incoming_request(msg const& m, entry& e)
+namespace
 {
-	e = entry(entry::dictionary_t);
-	e["y"] = "r";
-	e["t"] = m.message.dict_find_string_value("t");
-
-	key_desc_t top_desc[] = {
-		{"q", lazy_entry::string_t, 0, 0},
-		{"a", lazy_entry::dict_t, 0, key_desc_t::parse_children},
-			{"id", lazy_entry::string_t, 20, key_desc_t::last_child},
-	};
-
-	lazy_entry const* top_level[3];
-	char error_string[200];
-	if (!verify_message(&m.message, top_desc, top_level, 3, error_string, sizeof(error_string)))
+	// writes our node ID, and the IP of the node we respond to
+	// if its node ID doesn't match it
+	void write_id(bencode_dict<vector_sink>& d, node_id const& our_id
+		, node_id const& id, address const& addr)
 	{
-		incoming_error(e, error_string);
-		return;
-	}
+		d.string("id", reinterpret_cast<char const*>(&our_id[0]), node_id::size);
 
-	char const* query = top_level[0]->string_cstr();
-
-	lazy_entry const* arg_ent = top_level[1];
-
-	node_id id(top_level[2]->string_ptr());
+		if (verify_id(id, addr)) return;
+		char ip[16];
+		char* out = ip;
+		write_address(addr, out);
+		d.string("ip", ip, out - ip);
+	}
+}
 
-	m_table.heard_about(id, m.addr);
+void node_impl::write_error(msg const& m, node_id const& id, char const* error)
+{
+	bdecode_node t = m.message.dict_find_string("t");
 
-	entry& reply = e["r"];
-	m_rpc.add_our_id(reply);
+	m_response_buf.clear();
+	vector_sink s(m_response_buf);
+	{
+		bencode_dict<vector_sink> d(s);
+		{
+			bencode_list<vector_sink> e(d, "e");
+			e.integer(203);
+			e.string(error);
+		}
+		{
+			bencode_dict<vector_sink> r(d, "r");
+			write_id(r, m_id, id, m.addr.address());
+		}
+		if (t) d.string("t", t.string_ptr(), t.string_length());
+		else d.string("t", "", 0);
+		d.string("v", dht_client_version, sizeof(dht_client_version));
+		d.string("y", "e", 1);
+	}
+	m_sock->send_packet(&m_response_buf[0], m_response_buf.size(), m.addr, 0);
+}
 
-	// if this nodes ID doesn't match its IP, tell it what
-	// its IP is
-	if (!verify_id(id, m.addr.address()))
-		reply["ip"] = address_to_bytes(m.addr.address());
+bool node_impl::write_response(msg const& m, char const* query
+	, bdecode_node const& arg_ent, node_id const& id)
+{
+	char error_string[200];
+	sha1_hash target;
+	bool find_nodes = false;
+	bool token = false;
+	torrent_entry const* torrent = 0;
+	bool noseed = false;
+	bool scrape = false;
 
 	if (strcmp(query, "ping") == 0)
 	{
@@ -635,59 +611,54 @@ void node_impl::incoming_request(msg const& m, entry& e)
 	else if (strcmp(query, "get_peers") == 0)
 	{
 		key_desc_t msg_desc[] = {
-			{"info_hash", lazy_entry::string_t, 20, 0},
-			{"ifhpfxl", lazy_entry::int_t, 0, key_desc_t::optional},
-			{"noseed", lazy_entry::int_t, 0, key_desc_t::optional},
-			{"scrape", lazy_entry::int_t, 0, key_desc_t::optional},
+			{"info_hash", bdecode_node::string_t, 20, 0},
+			{"ifhpfxl", bdecode_node::int_t, 0, key_desc_t::optional},
+			{"noseed", bdecode_node::int_t, 0, key_desc_t::optional},
+			{"scrape", bdecode_node::int_t, 0, key_desc_t::optional},
 		};
 
-		lazy_entry const* msg_keys[4];
+		bdecode_node msg_keys[4];
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 4, error_string, sizeof(error_string)))
 		{
-			incoming_error(e, error_string);
-			return;
+			write_error(m, id, error_string);
+			return true;
 		}
 
-		reply["token"] = generate_token(m.addr, msg_keys[0]->string_ptr());
-		
-		sha1_hash info_hash(msg_keys[0]->string_ptr());
-		nodes_t n;
+		target = sha1_hash(msg_keys[0].string_ptr());
 		// always return nodes as well as peers
-		m_table.find_node(info_hash, n, 0);
-		write_nodes_entry(reply, n);
+		find_nodes = true;
+		token = true;
 
-		int prefix = msg_keys[1] ? int(msg_keys[1]->int_value()) : 20;
+		int prefix = msg_keys[1] ? int(msg_keys[1].int_value()) : 20;
 		if (prefix > 20) prefix = 20;
 		else if (prefix < 4) prefix = 4;
 
-		bool noseed = false;
-		bool scrape = false;
-		if (msg_keys[2] && msg_keys[2]->int_value() != 0) noseed = true;
-		if (msg_keys[3] && msg_keys[3]->int_value() != 0) scrape = true;
-		lookup_peers(info_hash, prefix, reply, noseed, scrape);
-#ifdef TORRENT_DHT_VERBOSE_LOGGING
-		if (reply.find_key("values")) TORRENT_LOG(node) << " values: " << reply["values"].list().size();
-#endif
+		if (msg_keys[2] && msg_keys[2].int_value() != 0) noseed = true;
+		if (msg_keys[3] && msg_keys[3].int_value() != 0) scrape = true;
+
+		if (m_post_alert)
+		{
+			alert* a = new dht_get_peers_alert(target);
+			if (!m_post_alert->post_alert(a)) delete a;
+		}
+
+		torrent = m_storage.find(target, prefix);
 	}
 	else if (strcmp(query, "find_node") == 0)
 	{
 		key_desc_t msg_desc[] = {
-			{"target", lazy_entry::string_t, 20, 0},
+			{"target", bdecode_node::string_t, 20, 0},
 		};
 
-		lazy_entry const* msg_keys[1];
+		bdecode_node msg_keys[1];
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 1, error_string, sizeof(error_string)))
 		{
-			incoming_error(e, error_string);
-			return;
+			write_error(m, id, error_string);
+			return true;
 		}
 
-		sha1_hash target(msg_keys[0]->string_ptr());
-
-		// TODO: find_node should write directly to the response entry
-		nodes_t n;
-		m_table.find_node(target, n, 0);
-		write_nodes_entry(reply, n);
+		target = sha1_hash(msg_keys[0].string_ptr());
+		find_nodes = true;
 	}
 	else if (strcmp(query, "announce_peer") == 0)
 	{
@@ -695,34 +666,34 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		extern int g_failed_announces;
 #endif
 		key_desc_t msg_desc[] = {
-			{"info_hash", lazy_entry::string_t, 20, 0},
-			{"port", lazy_entry::int_t, 0, 0},
-			{"token", lazy_entry::string_t, 0, 0},
-			{"n", lazy_entry::string_t, 0, key_desc_t::optional},
-			{"seed", lazy_entry::int_t, 0, key_desc_t::optional},
+			{"info_hash", bdecode_node::string_t, 20, 0},
+			{"port", bdecode_node::int_t, 0, 0},
+			{"token", bdecode_node::string_t, 0, 0},
+			{"n", bdecode_node::string_t, 0, key_desc_t::optional},
+			{"seed", bdecode_node::int_t, 0, key_desc_t::optional},
 		};
 
-		lazy_entry const* msg_keys[5];
+		bdecode_node msg_keys[5];
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 5, error_string, sizeof(error_string)))
 		{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 			++g_failed_announces;
 #endif
-			incoming_error(e, error_string);
-			return;
+			write_error(m, id, error_string);
+			return true;
 		}
 
-		int port = int(msg_keys[1]->int_value());
+		int port = int(msg_keys[1].int_value());
 		if (port < 0 || port >= 65536)
 		{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 			++g_failed_announces;
 #endif
-			incoming_error(e, "invalid port");
-			return;
+			write_error(m, id, "invalid port");
+			return true;
 		}
 
-		sha1_hash info_hash(msg_keys[0]->string_ptr());
+		sha1_hash info_hash(msg_keys[0].string_ptr());
 
 		if (m_post_alert)
 		{
@@ -730,13 +701,13 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			if (!m_post_alert->post_alert(a)) delete a;
 		}
 
-		if (!verify_token(msg_keys[2]->string_value(), msg_keys[0]->string_ptr(), m.addr))
+		if (!verify_token(msg_keys[2].string_value(), msg_keys[0].string_ptr(), m.addr))
 		{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 			++g_failed_announces;
 #endif
-			incoming_error(e, "invalid token");
-			return;
+			write_error(m, id, "invalid token");
+			return true;
 		}
 
 		// the token was correct. That means this
@@ -744,82 +715,175 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		// the table get a chance to add it.
 		m_table.node_seen(id, m.addr, 0xffff);
 
-		if (!m_map.empty() && int(m_map.size()) >= m_settings.max_torrents)
+		// the peer announces a torrent name. It's stored
+		// unless we already have a name for this torrent
+		char const* name = 0;
+		int name_len = 0;
+		if (msg_keys[3])
 		{
-			// we need to remove some. Remove the ones with the
-			// fewest peers
-			int num_peers = m_map.begin()->second.peers.size();
-			table_t::iterator candidate = m_map.begin();
-			for (table_t::iterator i = m_map.begin()
-				, end(m_map.end()); i != end; ++i)
-			{
-				if (int(i->second.peers.size()) > num_peers) continue;
-				if (i->first == info_hash) continue;
-				num_peers = i->second.peers.size();
-				candidate = i;
-			}
-			m_map.erase(candidate);
+			name = msg_keys[3].string_ptr();
+			name_len = msg_keys[3].string_length();
 		}
-		torrent_entry& v = m_map[info_hash];
 
-		// the peer announces a torrent name, and we don't have a name
-		// for this torrent. Store it.
-		if (msg_keys[3] && v.name.empty())
-		{
-			std::string name = msg_keys[3]->string_value();
-			if (name.size() > 50) name.resize(50);
-			v.name = name;
-		}
-
-		peer_entry peer;
-		peer.addr = tcp::endpoint(m.addr.address(), port);
-		peer.added = time_now();
-		peer.seed = msg_keys[4] && msg_keys[4]->int_value();
-		std::set<peer_entry>::iterator i = v.peers.find(peer);
-		if (i != v.peers.end()) v.peers.erase(i++);
-		v.peers.insert(i, peer);
+		m_storage.announce(info_hash, tcp::endpoint(m.addr.address(), port)
+			, msg_keys[4] && msg_keys[4].int_value(), name, name_len);
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		extern int g_announces;
 		++g_announces;
 #endif
 	}
-	else if (strcmp(query, "put") == 0)
+	else
+	{
+		return false;
+	}
+
+	if (find_nodes) m_table.find_node(target, m_response_nodes, 0);
+
+	// the keys of a dictionary must be written in sorted order.
+	// Upper case letters sort before lower case ones
+	m_response_buf.clear();
+	vector_sink s(m_response_buf);
+	{
+		bencode_dict<vector_sink> d(s);
+		{
+			bencode_dict<vector_sink> r(d, "r");
+
+			if (torrent && scrape)
+			{
+				scrape_filters const& f = m_storage.scrape(*torrent);
+				r.string("BFpe", f.downloaders.data(), 256);
+				r.string("BFsd", f.seeds.data(), 256);
+			}
+
+			// if this nodes ID doesn't match its IP, tell it what
+			// its IP is
+			write_id(r, m_id, id, m.addr.address());
+
+			if (torrent && torrent->name)
+				r.string("n", torrent->name);
+
+			if (find_nodes) write_nodes(r, m_response_nodes);
+
+			if (token)
+			{
+				r.string("token", generate_token(m.addr
+					, reinterpret_cast<char const*>(&target[0])));
+			}
+
+			if (torrent && !scrape)
+			{
+				int num = (std::min)(int(torrent->num_peers), m_settings.max_peers_reply);
+				if (int(m_response_peers.size()) < num) m_response_peers.resize(num);
+				num = m_storage.random_peers(*torrent, num, noseed
+					, num == 0 ? 0 : &m_response_peers[0]);
+
+				bencode_list<vector_sink> values(r, "values");
+				for (int i = 0; i < num; ++i)
+				{
+					peer_entry const& p = *m_response_peers[i];
+					// the compact endpoint is the address followed
+					// by the port, both in network byte order
+					char endpoint[16 + 2];
+					char* out = std::copy(p.addr, p.addr + p.addr_size(), endpoint);
+					write_uint16(p.port, out);
+					values.string(endpoint, out - endpoint);
+				}
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+				TORRENT_LOG(node) << " values: " << num;
+#endif
+			}
+		}
+
+		bdecode_node t = m.message.dict_find_string("t");
+		if (t) d.string("t", t.string_ptr(), t.string_length());
+		else d.string("t", "", 0);
+		d.string("v", dht_client_version, sizeof(dht_client_version));
+		d.string("y", "r", 1);
+	}
+
+	m_sock->send_packet(&m_response_buf[0], m_response_buf.size(), m.addr, 0);
+	return true;
+}
+
+// build response
+bool node_impl::incoming_request(msg const& m, entry& e)
+{
+	e = entry(entry::dictionary_t);
+
+	key_desc_t top_desc[] = {
+		{"q", bdecode_node::string_t, 0, 0},
+		{"a", bdecode_node::dict_t, 0, key_desc_t::parse_children},
+			{"id", bdecode_node::string_t, 20, key_desc_t::last_child},
+	};
+
+	bdecode_node top_level[3];
+	char error_string[200];
+	if (!verify_message(m.message, top_desc, top_level, 3, error_string, sizeof(error_string)))
+	{
+		e["t"] = m.message.dict_find_string_value("t");
+		incoming_error(e, error_string);
+		return false;
+	}
+
+	std::string query = top_level[0].string_value();
+
+	bdecode_node const& arg_ent = top_level[1];
+
+	node_id id(top_level[2].string_ptr());
+
+	m_table.heard_about(id, m.addr);
+
+	// the most common queries don't build an entry. Their
+	// response is written straight into the send buffer
+	if (write_response(m, query.c_str(), arg_ent, id)) return true;
+
+	e["y"] = "r";
+	e["t"] = m.message.dict_find_string_value("t");
+	entry& reply = e["r"];
+	m_rpc.add_our_id(reply);
+
+	// if this nodes ID doesn't match its IP, tell it what
+	// its IP is
+	if (!verify_id(id, m.addr.address()))
+		reply["ip"] = address_to_bytes(m.addr.address());
+
+	if (query == "put")
 	{
 		// the first 2 entries are for both mutable and
 		// immutable puts
 		const static key_desc_t msg_desc[] = {
-			{"token", lazy_entry::string_t, 0, 0},
-			{"v", lazy_entry::none_t, 0, 0},
-			{"seq", lazy_entry::int_t, 0, key_desc_t::optional},
+			{"token", bdecode_node::string_t, 0, 0},
+			{"v", bdecode_node::none_t, 0, 0},
+			{"seq", bdecode_node::int_t, 0, key_desc_t::optional},
 			// public key
-			{"k", lazy_entry::string_t, 268, key_desc_t::optional},
-			{"sig", lazy_entry::string_t, 256, key_desc_t::optional},
+			{"k", bdecode_node::string_t, 268, key_desc_t::optional},
+			{"sig", bdecode_node::string_t, 256, key_desc_t::optional},
 		};
 
 		// attempt to parse the message
-		lazy_entry const* msg_keys[5];
+		bdecode_node msg_keys[5];
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 5, error_string, sizeof(error_string)))
 		{
 			incoming_error(e, error_string);
-			return;
+			return false;
 		}
 
 		// is this a mutable put?
 		bool mutable_put = (msg_keys[2] && msg_keys[3] && msg_keys[4]);
 
 		// pointer and length to the whole entry
-		std::pair<char const*, int> buf = msg_keys[1]->data_section();
+		std::pair<char const*, int> buf = msg_keys[1].data_section();
 		if (buf.second > 767 || buf.second <= 0)
 		{
 			incoming_error(e, "message too big");
-			return;
+			return false;
 		}
 
 		sha1_hash target;
 		if (!mutable_put)
 			target = hasher(buf.first, buf.second).final();
 		else
-			target = sha1_hash(msg_keys[3]->string_ptr());
+			target = sha1_hash(msg_keys[3].string_ptr());
 
 //		fprintf(stderr, "%s PUT target: %s\n"
 //			, mutable_put ? "mutable":"immutable"
@@ -827,10 +891,10 @@ void node_impl::incoming_request(msg const& m, entry& e)
 
 		// verify the write-token. tokens are only valid to write to
 		// specific target hashes. it must match the one we got a "get" for
-		if (!verify_token(msg_keys[0]->string_value(), (char const*)&target[0], m.addr))
+		if (!verify_token(msg_keys[0].string_value(), (char const*)&target[0], m.addr))
 		{
 			incoming_error(e, "invalid token");
-			return;
+			return false;
 		}
 
 		dht_immutable_item* f = 0;
@@ -874,24 +938,24 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			// generate the message digest by merging the sequence number and the
 			hasher digest;
 			char seq[20];
-			int len = snprintf(seq, sizeof(seq), "3:seqi%"PRId64"e1:v", msg_keys[2]->int_value());
+			int len = snprintf(seq, sizeof(seq), "3:seqi%"PRId64"e1:v", msg_keys[2].int_value());
 			digest.update(seq, len);
-			std::pair<char const*, int> buf = msg_keys[1]->data_section();
+			std::pair<char const*, int> buf = msg_keys[1].data_section();
 			digest.update(buf.first, buf.second);
 
 #ifdef TORRENT_USE_OPENSSL
-			if (!verify_rsa(digest.final(), msg_keys[3]->string_ptr(), msg_keys[3]->string_length()
-				, msg_keys[4]->string_ptr(), msg_keys[4]->string_length()))
+			if (!verify_rsa(digest.final(), msg_keys[3].string_ptr(), msg_keys[3].string_length()
+				, msg_keys[4].string_ptr(), msg_keys[4].string_length()))
 			{
 				incoming_error(e, "invalid signature");
-				return;
+				return false;
 			}
 #else
 			incoming_error(e, "unsupported");
-			return;
+			return false;
 #endif
 
-			sha1_hash target = hasher(msg_keys[3]->string_ptr(), msg_keys[3]->string_length()).final();
+			sha1_hash target = hasher(msg_keys[3].string_ptr(), msg_keys[3].string_length()).final();
 			dht_mutable_table_t::iterator i = m_mutable_table.find(target);
 			if (i == m_mutable_table.end())
 			{
@@ -911,11 +975,11 @@ void node_impl::incoming_request(msg const& m, entry& e)
 				dht_mutable_item to_add;
 				to_add.value = (char*)malloc(buf.second);
 				to_add.size = buf.second;
-				to_add.seq = msg_keys[2]->int_value();
-				memcpy(to_add.sig, msg_keys[4]->string_ptr(), sizeof(to_add.sig));
-				TORRENT_ASSERT(sizeof(to_add.sig) == msg_keys[4]->string_length());
+				to_add.seq = msg_keys[2].int_value();
+				memcpy(to_add.sig, msg_keys[4].string_ptr(), sizeof(to_add.sig));
+				TORRENT_ASSERT(sizeof(to_add.sig) == msg_keys[4].string_length());
 				memcpy(to_add.value, buf.first, buf.second);
-				memcpy(&to_add.key, msg_keys[3]->string_ptr(), sizeof(to_add.key));
+				memcpy(&to_add.key, msg_keys[3].string_ptr(), sizeof(to_add.key));
 		
 				boost::tie(i, boost::tuples::ignore) = m_mutable_table.insert(
 					std::make_pair(target, to_add));
@@ -926,13 +990,13 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			{
 				dht_mutable_item* item = &i->second;
 
-				if (item->seq > msg_keys[2]->int_value())
+				if (item->seq > msg_keys[2].int_value())
 				{
 					incoming_error(e, "old sequence number");
-					return;
+					return false;
 				}
 
-				if (item->seq < msg_keys[2]->int_value())
+				if (item->seq < msg_keys[2].int_value())
 				{
 					if (item->size != buf.second)
 					{
@@ -940,9 +1004,9 @@ void node_impl::incoming_request(msg const& m, entry& e)
 						item->value = (char*)malloc(buf.second);
 						item->size = buf.second;
 					}
-					item->seq = msg_keys[2]->int_value();
-					memcpy(item->sig, msg_keys[4]->string_ptr(), sizeof(item->sig));
-					TORRENT_ASSERT(sizeof(item->sig) == msg_keys[4]->string_length());
+					item->seq = msg_keys[2].int_value();
+					memcpy(item->sig, msg_keys[4].string_ptr(), sizeof(item->sig));
+					TORRENT_ASSERT(sizeof(item->sig) == msg_keys[4].string_length());
 					memcpy(item->value, buf.first, buf.second);
 				}
 			}
@@ -963,29 +1027,29 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			++f->num_announcers;
 		}
 	}
-	else if (strcmp(query, "get") == 0)
+	else if (query == "get")
 	{
 		key_desc_t msg_desc[] = {
-			{"target", lazy_entry::string_t, 20, 0},
+			{"target", bdecode_node::string_t, 20, 0},
 		};
 
 		// k is not used for now
 
 		// attempt to parse the message
-		lazy_entry const* msg_keys[1];
+		bdecode_node msg_keys[1];
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 1, error_string, sizeof(error_string)))
 		{
 			incoming_error(e, error_string);
-			return;
+			return false;
 		}
 
-		sha1_hash target(msg_keys[0]->string_ptr());
+		sha1_hash target(msg_keys[0].string_ptr());
 
 //		fprintf(stderr, "%s GET target: %s\n"
 //			, msg_keys[1] ? "mutable":"immutable"
 //			, to_hex(target.to_string()).c_str());
 
-		reply["token"] = generate_token(m.addr, msg_keys[0]->string_ptr());
+		reply["token"] = generate_token(m.addr, msg_keys[0].string_ptr());
 		
 		nodes_t n;
 		// always return nodes as well as peers
@@ -1016,24 +1080,25 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		// if we don't recognize the message but there's a
 		// 'target' or 'info_hash' in the arguments, treat it
 		// as find_node to be future compatible
-		lazy_entry const* target_ent = arg_ent->dict_find_string("target");
-		if (target_ent == 0 || target_ent->string_length() != 20)
+		bdecode_node target_ent = arg_ent.dict_find_string("target");
+		if (!target_ent || target_ent.string_length() != 20)
 		{
-			target_ent = arg_ent->dict_find_string("info_hash");
-			if (target_ent == 0 || target_ent->string_length() != 20)
+			target_ent = arg_ent.dict_find_string("info_hash");
+			if (!target_ent || target_ent.string_length() != 20)
 			{
 				incoming_error(e, "unknown message");
-				return;
+				return false;
 			}
 		}
 
-		sha1_hash target(target_ent->string_ptr());
+		sha1_hash target(target_ent.string_ptr());
 		nodes_t n;
 		// always return nodes as well as peers
 		m_table.find_node(target, n, 0);
 		write_nodes_entry(reply, n);
-		return;
+		return false;
 	}
+	return false;
 }
 
 
@@ -0,0 +1,613 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/pch.hpp"
+
+#include <cstdlib> // for malloc/realloc/free
+#include <cstring> // for memcpy/memcmp
+#include <algorithm>
+#include <new> // for placement new
+
+#include "libtorrent/kademlia/peer_storage.hpp"
+#include "libtorrent/invariant_check.hpp"
+#include "libtorrent/random.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/assert.hpp"
+
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+#include "libtorrent/kademlia/node.hpp" // for the node log
+#endif
+
+namespace libtorrent { namespace dht
+{
+
+namespace
+{
+	// peers are expected to re-announce every 30 minutes. If we
+	// haven't heard from one in 45 minutes, it's removed
+	enum { peer_timeout = 45 * 60 };
+
+	// the smallest hash table we'll use
+	enum { min_hash_bits = 4 };
+
+	// the number of peers we make room for when a torrent is added
+	enum { initial_peers = 4 };
+
+	// the number of random torrents we look at when picking
+	// one to evict
+	enum { eviction_samples = 8 };
+
+	int gcd(int a, int b)
+	{
+		while (b != 0)
+		{
+			int t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+
+	// the filters are keyed by the SHA-1 of the IP, just like
+	// hash_address() does it
+	void add_to_filter(scrape_filters& f, peer_entry const& p)
+	{
+		sha1_hash iphash = hasher(reinterpret_cast<char const*>(p.addr)
+			, p.addr_size()).final();
+		if (p.seed()) f.seeds.set(iphash);
+		else f.downloaders.set(iphash);
+	}
+}
+
+address peer_entry::get_address() const
+{
+#if TORRENT_USE_IPV6
+	if (is_v6())
+	{
+		address_v6::bytes_type b;
+		std::memcpy(&b[0], addr, b.size());
+		return address_v6(b);
+	}
+#endif
+	address_v4::bytes_type b;
+	std::memcpy(&b[0], addr, b.size());
+	return address_v4(b);
+}
+
+peer_storage::peer_storage(dht_settings const& settings)
+	: m_settings(settings)
+	, m_hash_bits(0)
+	, m_hash_seed(random())
+	, m_num_torrents(0)
+	, m_num_peers(0)
+	, m_memory_usage(0)
+	, m_epoch(time_now())
+{
+	rehash(1 << min_hash_bits);
+}
+
+peer_storage::~peer_storage()
+{
+	for (std::vector<torrent_entry>::iterator i = m_table.begin()
+		, end(m_table.end()); i != end; ++i)
+	{
+		std::free(i->peers);
+		std::free(i->name);
+		std::free(i->scrape);
+	}
+}
+
+boost::uint32_t peer_storage::seconds_since_epoch() const
+{
+	return total_seconds(time_now() - m_epoch);
+}
+
+int peer_storage::max_peers() const
+{
+	return (std::max)(1, (std::min)(m_settings.max_peers, 0xffff));
+}
+
+int peer_storage::home_slot(sha1_hash const& info_hash) const
+{
+	// info-hashes are chosen by whoever announces them, so we can't
+	// rely on them being uniformly distributed. Every byte is mixed
+	// in (this is murmur3), seeded with a random value, to make it
+	// hard to pick info-hashes that all collide
+	boost::uint32_t h = m_hash_seed;
+	for (int i = 0; i < sha1_hash::size; i += 4)
+	{
+		boost::uint32_t k;
+		std::memcpy(&k, &info_hash[i], sizeof(k));
+		k *= 0xcc9e2d51;
+		k = (k << 15) | (k >> 17);
+		k *= 0x1b873593;
+		h ^= k;
+		h = (h << 13) | (h >> 19);
+		h = h * 5 + 0xe6546b64;
+	}
+	h ^= sha1_hash::size;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h >> (32 - m_hash_bits);
+}
+
+int peer_storage::find_slot(sha1_hash const& info_hash) const
+{
+	int const mask = m_table.size() - 1;
+	int i = home_slot(info_hash);
+	while (m_table[i].peers != 0 && m_table[i].info_hash != info_hash)
+		i = (i + 1) & mask;
+	return i;
+}
+
+torrent_entry const* peer_storage::find(sha1_hash const& info_hash, int prefix) const
+{
+	TORRENT_ASSERT(prefix >= 4 && prefix <= 20);
+	if (prefix >= 20)
+	{
+		torrent_entry const& t = m_table[find_slot(info_hash)];
+		return t.peers ? &t : 0;
+	}
+
+	// the first info-hash that's not less than the prefix padded
+	// with zeros is the only one that may share the prefix
+	sha1_hash first = info_hash;
+	std::memset(&first[prefix], 0, sha1_hash::size - prefix);
+	std::vector<sha1_hash>::const_iterator i = std::lower_bound(
+		m_sorted.begin(), m_sorted.end(), first);
+	if (i == m_sorted.end()
+		|| std::memcmp(&(*i)[0], &info_hash[0], prefix) != 0)
+		return 0;
+	return &m_table[find_slot(*i)];
+}
+
+void peer_storage::rehash(int num_slots)
+{
+	TORRENT_ASSERT((num_slots & (num_slots - 1)) == 0);
+	TORRENT_ASSERT(num_slots >= m_num_torrents * 2);
+
+	torrent_entry empty;
+	std::memset(&empty, 0, sizeof(empty));
+
+	std::vector<torrent_entry> old(num_slots, empty);
+	old.swap(m_table);
+	// the table may shrink, so the difference has to be signed
+	m_memory_usage += (size_type(m_table.capacity()) - size_type(old.capacity()))
+		* size_type(sizeof(torrent_entry));
+
+	std::vector<sha1_hash> sorted;
+	sorted.reserve(num_slots / 2);
+	sorted.insert(sorted.end(), m_sorted.begin(), m_sorted.end());
+	m_memory_usage += (size_type(sorted.capacity()) - size_type(m_sorted.capacity()))
+		* size_type(sizeof(sha1_hash));
+	sorted.swap(m_sorted);
+
+	m_hash_bits = 0;
+	while ((1 << m_hash_bits) < num_slots) ++m_hash_bits;
+
+	for (std::vector<torrent_entry>::iterator i = old.begin()
+		, end(old.end()); i != end; ++i)
+	{
+		if (i->peers == 0) continue;
+		m_table[find_slot(i->info_hash)] = *i;
+	}
+}
+
+void peer_storage::erase_slot(int slot)
+{
+	torrent_entry& t = m_table[slot];
+	TORRENT_ASSERT(t.peers != 0);
+
+	m_num_peers -= t.num_peers;
+	--m_num_torrents;
+	m_memory_usage -= size_type(t.capacity) * sizeof(peer_entry);
+	if (t.name) m_memory_usage -= std::strlen(t.name) + 1;
+	clear_scrape(t);
+	std::free(t.peers);
+	std::free(t.name);
+
+	std::vector<sha1_hash>::iterator i = std::lower_bound(
+		m_sorted.begin(), m_sorted.end(), t.info_hash);
+	TORRENT_ASSERT(i != m_sorted.end() && *i == t.info_hash);
+	m_sorted.erase(i);
+
+	// move entries after the hole back into it, as long as that
+	// doesn't move them in front of their home slot
+	int const mask = m_table.size() - 1;
+	int hole = slot;
+	for (int i = (slot + 1) & mask; m_table[i].peers != 0; i = (i + 1) & mask)
+	{
+		int home = home_slot(m_table[i].info_hash);
+		if (((i - home) & mask) < ((i - hole) & mask)) continue;
+		m_table[hole] = m_table[i];
+		hole = i;
+	}
+	std::memset(&m_table[hole], 0, sizeof(torrent_entry));
+}
+
+bool peer_storage::evict(sha1_hash const& keep)
+{
+	if (m_num_torrents == 0) return false;
+
+	// looking at every torrent would make every announce linear when
+	// we're full. Instead, the least popular of a few random torrents
+	// is evicted
+	int const mask = m_table.size() - 1;
+	int candidate = -1;
+	for (int k = 0; k < eviction_samples; ++k)
+	{
+		int i = random() & mask;
+		while (m_table[i].peers == 0) i = (i + 1) & mask;
+		torrent_entry const& t = m_table[i];
+		if (t.info_hash == keep) continue;
+		if (candidate == -1
+			|| t.popularity < m_table[candidate].popularity
+			|| (t.popularity == m_table[candidate].popularity
+				&& t.num_peers < m_table[candidate].num_peers))
+			candidate = i;
+	}
+
+	if (candidate == -1)
+	{
+		// we only found the torrent we're supposed to keep. There
+		// may not be any other
+		for (int i = 0; i < int(m_table.size()); ++i)
+		{
+			if (m_table[i].peers == 0 || m_table[i].info_hash == keep) continue;
+			candidate = i;
+			break;
+		}
+		if (candidate == -1) return false;
+	}
+
+	erase_slot(candidate);
+	return true;
+}
+
+void peer_storage::announce(sha1_hash const& info_hash, tcp::endpoint const& ep
+	, bool seed, char const* name, int name_len)
+{
+	INVARIANT_CHECK;
+
+	if (m_settings.max_torrents <= 0) return;
+
+	int slot = find_slot(info_hash);
+	if (m_table[slot].peers == 0)
+	{
+		int const initial_size = (std::min)(int(initial_peers), max_peers());
+		size_type needed;
+		for (;;)
+		{
+			// the table may need to grow too
+			needed = initial_size * size_type(sizeof(peer_entry));
+			if ((m_num_torrents + 1) * 2 > int(m_table.size()))
+				needed += m_table.size() * size_type(sizeof(torrent_entry))
+					+ m_table.size() / 2 * size_type(sizeof(sha1_hash));
+			if (m_num_torrents < m_settings.max_torrents
+				&& m_memory_usage + needed <= m_settings.max_peer_storage_size)
+				break;
+			if (!evict(info_hash)) break;
+		}
+
+		// if nothing could be evicted to make room, the
+		// announce is dropped
+		if (m_num_torrents >= m_settings.max_torrents
+			|| m_memory_usage + needed > m_settings.max_peer_storage_size)
+			return;
+
+		if ((m_num_torrents + 1) * 2 > int(m_table.size()))
+			rehash(m_table.size() * 2);
+
+		peer_entry* peers = static_cast<peer_entry*>(
+			std::malloc(initial_size * sizeof(peer_entry)));
+		if (peers == 0) return;
+
+		slot = find_slot(info_hash);
+		torrent_entry& t = m_table[slot];
+		t.info_hash = info_hash;
+		t.peers = peers;
+		t.capacity = initial_size;
+		++m_num_torrents;
+		m_sorted.insert(std::lower_bound(m_sorted.begin(), m_sorted.end()
+			, info_hash), info_hash);
+		m_memory_usage += initial_size * sizeof(peer_entry);
+	}
+
+	torrent_entry* t = &m_table[slot];
+	if (t->popularity < 0xffffffff) ++t->popularity;
+
+	if (name != 0 && t->name == 0)
+	{
+		if (name_len > 50) name_len = 50;
+		t->name = static_cast<char*>(std::malloc(name_len + 1));
+		if (t->name)
+		{
+			std::memcpy(t->name, name, name_len);
+			t->name[name_len] = 0;
+			m_memory_usage += name_len + 1;
+		}
+	}
+
+	peer_entry peer;
+	std::memset(&peer, 0, sizeof(peer));
+	peer.port = ep.port();
+	peer.added = seconds_since_epoch();
+	peer.flags = seed ? peer_entry::seed_flag : 0;
+#if TORRENT_USE_IPV6
+	if (ep.address().is_v6())
+	{
+		address_v6::bytes_type b = ep.address().to_v6().to_bytes();
+		std::memcpy(peer.addr, &b[0], b.size());
+		peer.flags |= peer_entry::v6_flag;
+	}
+	else
+#endif
+	{
+		address_v4::bytes_type b = ep.address().to_v4().to_bytes();
+		std::memcpy(peer.addr, &b[0], b.size());
+	}
+
+	// look for the peer, and for the one that announced the longest
+	// ago, in case we need to replace it
+	int oldest = 0;
+	for (int i = 0; i < t->num_peers; ++i)
+	{
+		peer_entry& p = t->peers[i];
+		if (p.port == peer.port
+			&& (p.flags & peer_entry::v6_flag) == (peer.flags & peer_entry::v6_flag)
+			&& std::memcmp(p.addr, peer.addr, sizeof(peer.addr)) == 0)
+		{
+			// a downloader that became a seed is still in
+			// the downloader filter
+			if (p.seed() != peer.seed()) clear_scrape(*t);
+			p = peer;
+			return;
+		}
+		if (p.added < t->peers[oldest].added) oldest = i;
+	}
+
+	if (t->num_peers == t->capacity && t->capacity < max_peers())
+	{
+		int new_capacity = (std::min)(t->capacity * 2, max_peers());
+		size_type const needed = (new_capacity - t->capacity) * sizeof(peer_entry);
+
+		// evicting torrents moves them around in the table
+		while (m_memory_usage + needed > m_settings.max_peer_storage_size
+			&& evict(info_hash));
+		t = &m_table[find_slot(info_hash)];
+
+		if (m_memory_usage + needed <= m_settings.max_peer_storage_size)
+		{
+			peer_entry* peers = static_cast<peer_entry*>(std::realloc(t->peers
+				, new_capacity * sizeof(peer_entry)));
+			if (peers)
+			{
+				t->peers = peers;
+				t->capacity = new_capacity;
+				m_memory_usage += needed;
+			}
+		}
+	}
+
+	if (t->num_peers < t->capacity)
+	{
+		t->peers[t->num_peers] = peer;
+		++t->num_peers;
+		++m_num_peers;
+		if (t->scrape) add_to_filter(*t->scrape, peer);
+	}
+	else
+	{
+		clear_scrape(*t);
+		t->peers[oldest] = peer;
+	}
+}
+
+void peer_storage::clear_scrape(torrent_entry& t)
+{
+	if (t.scrape == 0) return;
+	std::free(t.scrape);
+	t.scrape = 0;
+	m_memory_usage -= sizeof(scrape_filters);
+}
+
+scrape_filters const& peer_storage::scrape(torrent_entry const& te)
+{
+	INVARIANT_CHECK;
+
+	TORRENT_ASSERT(&te >= &m_table[0] && &te < &m_table[0] + m_table.size());
+	torrent_entry& t = m_table[&te - &m_table[0]];
+	TORRENT_ASSERT(t.peers != 0);
+	if (t.scrape) return *t.scrape;
+
+	scrape_filters* f = &m_scrape_scratch;
+	if (m_memory_usage + size_type(sizeof(scrape_filters)) <= m_settings.max_peer_storage_size)
+	{
+		void* mem = std::malloc(sizeof(scrape_filters));
+		if (mem)
+		{
+			f = t.scrape = new (mem) scrape_filters;
+			m_memory_usage += sizeof(scrape_filters);
+		}
+	}
+	if (f == &m_scrape_scratch)
+	{
+		f->seeds.clear();
+		f->downloaders.clear();
+	}
+
+	for (peer_entry const* i = t.peers, *end(t.peers + t.num_peers);
+		i != end; ++i)
+		add_to_filter(*f, *i);
+	return *f;
+}
+
+int peer_storage::random_peers(torrent_entry const& t, int num, bool noseed
+	, peer_entry const** out) const
+{
+	int const n = t.num_peers;
+	if (n == 0 || num <= 0) return 0;
+
+	// walk the peers from a random start, with a random stride that's
+	// co-prime with the number of peers. That visits every peer once
+	// if we go all the way around, but we stop as soon as we have
+	// enough
+	int start = random() % n;
+	int step = 1;
+	if (n > 2)
+	{
+		for (int k = 0; k < 4; ++k)
+		{
+			int s = 1 + random() % (n - 1);
+			if (gcd(s, n) != 1) continue;
+			step = s;
+			break;
+		}
+	}
+
+	int ret = 0;
+	int i = start;
+	for (int visited = 0; visited < n && ret < num; ++visited)
+	{
+		peer_entry const& p = t.peers[i];
+		if (!noseed || !p.seed()) out[ret++] = &p;
+		i += step;
+		if (i >= n) i -= n;
+	}
+	return ret;
+}
+
+void peer_storage::tick()
+{
+	INVARIANT_CHECK;
+
+	boost::uint32_t const now = seconds_since_epoch();
+	std::vector<sha1_hash> empty;
+
+	for (std::vector<torrent_entry>::iterator i = m_table.begin()
+		, end(m_table.end()); i != end; ++i)
+	{
+		torrent_entry& t = *i;
+		if (t.peers == 0) continue;
+
+		t.popularity >>= 1;
+		int const num_peers = t.num_peers;
+
+		for (int k = 0; k < t.num_peers;)
+		{
+			if (t.peers[k].added + peer_timeout >= now)
+			{
+				++k;
+				continue;
+			}
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+			TORRENT_LOG(node) << "peer timed out at: " << t.peers[k].endpoint();
+#endif
+			t.peers[k] = t.peers[t.num_peers - 1];
+			--t.num_peers;
+			--m_num_peers;
+		}
+		if (t.num_peers != num_peers) clear_scrape(t);
+
+		// if there are no more peers, remove the entry altogether
+		if (t.num_peers == 0)
+		{
+			empty.push_back(t.info_hash);
+			continue;
+		}
+
+		// give back memory of torrents that have lost most of their peers
+		if (t.num_peers * 4 <= t.capacity && t.capacity > initial_peers)
+		{
+			int new_capacity = (std::max)(t.num_peers * 2, int(initial_peers));
+			peer_entry* peers = static_cast<peer_entry*>(std::realloc(t.peers
+				, new_capacity * sizeof(peer_entry)));
+			if (peers)
+			{
+				m_memory_usage -= size_type(t.capacity - new_capacity)
+					* size_type(sizeof(peer_entry));
+				t.peers = peers;
+				t.capacity = new_capacity;
+			}
+		}
+	}
+
+	for (std::vector<sha1_hash>::iterator i = empty.begin()
+		, end(empty.end()); i != end; ++i)
+		erase_slot(find_slot(*i));
+
+	int num_slots = m_table.size();
+	while (num_slots > (1 << min_hash_bits) && m_num_torrents * 8 < num_slots)
+		num_slots /= 2;
+	if (num_slots != int(m_table.size())) rehash(num_slots);
+}
+
+#ifdef TORRENT_DEBUG
+void peer_storage::check_invariant() const
+{
+	int num_torrents = 0;
+	int num_peers = 0;
+	size_type memory = m_table.capacity() * sizeof(torrent_entry)
+		+ m_sorted.capacity() * sizeof(sha1_hash);
+	for (int i = 0; i < int(m_table.size()); ++i)
+	{
+		torrent_entry const& t = m_table[i];
+		if (t.peers == 0)
+		{
+			TORRENT_ASSERT(t.name == 0);
+			TORRENT_ASSERT(t.scrape == 0);
+			TORRENT_ASSERT(t.num_peers == 0);
+			continue;
+		}
+		++num_torrents;
+		num_peers += t.num_peers;
+		memory += size_type(t.capacity) * sizeof(peer_entry);
+		if (t.name) memory += std::strlen(t.name) + 1;
+		if (t.scrape) memory += sizeof(scrape_filters);
+		TORRENT_ASSERT(t.num_peers <= t.capacity);
+		TORRENT_ASSERT(find_slot(t.info_hash) == i);
+		TORRENT_ASSERT(std::binary_search(m_sorted.begin(), m_sorted.end()
+			, t.info_hash));
+	}
+	TORRENT_ASSERT(int(m_sorted.size()) == m_num_torrents);
+	TORRENT_ASSERT(num_torrents == m_num_torrents);
+	TORRENT_ASSERT(num_peers == m_num_peers);
+	TORRENT_ASSERT(memory == m_memory_usage);
+	TORRENT_ASSERT(m_num_torrents * 2 <= int(m_table.size()));
+}
+#endif
+
+} } // namespace libtorrent::dht
+
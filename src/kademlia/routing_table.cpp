@@ -65,6 +65,9 @@ routing_table::routing_table(node_id const& id, int bucket_size
 	, m_last_refresh(min_time())
 	, m_last_self_refresh(min_time())
 {
+	// buckets are only ever added, never removed, so once the table
+	// has reserved room for all of them, references to buckets stay valid
+	m_buckets.reserve(160);
 }
 
 int routing_table::bucket_limit(int bucket) const
@@ -77,6 +80,108 @@ int routing_table::bucket_limit(int bucket) const
 	return m_bucket_size;
 }
 
+int routing_table::bucket_offset(int bucket) const
+{
+	// the sum of the first n extended bucket sizes (16, 8, 4, 2)
+	int const extended_offsets[] = {0, 16, 24, 28, 30};
+	if (bucket < 5) return extended_offsets[bucket] * m_bucket_size;
+	return (30 + bucket - 4) * m_bucket_size;
+}
+
+void routing_table::add_bucket()
+{
+	m_buckets.push_back(routing_table_node());
+	int num_slots = bucket_offset(m_buckets.size());
+	m_ids.resize(num_slots);
+	m_endpoints.resize(num_slots);
+	m_timeout_counts.resize(num_slots);
+	m_rtts.resize(num_slots);
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+	m_first_seen.resize(num_slots);
+#endif
+}
+
+node_entry routing_table::live_node(int slot) const
+{
+	node_entry e(m_ids[slot], m_endpoints[slot], m_rtts[slot]);
+	e.timeout_count = m_timeout_counts[slot];
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+	e.first_seen = m_first_seen[slot];
+#endif
+	return e;
+}
+
+void routing_table::set_live_node(int slot, node_entry const& e)
+{
+	m_ids[slot] = e.id;
+	m_endpoints[slot] = e.ep();
+	m_timeout_counts[slot] = e.timeout_count;
+	m_rtts[slot] = e.rtt;
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+	m_first_seen[slot] = e.first_seen;
+#endif
+}
+
+void routing_table::add_live_node(int bucket, node_entry const& e)
+{
+	routing_table_node& b = m_buckets[bucket];
+	TORRENT_ASSERT(b.num_live < bucket_offset(bucket + 1) - bucket_offset(bucket));
+	set_live_node(bucket_offset(bucket) + b.num_live, e);
+	++b.num_live;
+}
+
+void routing_table::erase_live_node(int bucket, int slot)
+{
+	// the nodes after slot are moved down one step, to keep
+	// them in the order they were added in
+	int end = bucket_offset(bucket) + m_buckets[bucket].num_live;
+	TORRENT_ASSERT(slot >= bucket_offset(bucket) && slot < end);
+	std::copy(m_ids.begin() + slot + 1, m_ids.begin() + end, m_ids.begin() + slot);
+	std::copy(m_endpoints.begin() + slot + 1, m_endpoints.begin() + end
+		, m_endpoints.begin() + slot);
+	std::copy(m_timeout_counts.begin() + slot + 1, m_timeout_counts.begin() + end
+		, m_timeout_counts.begin() + slot);
+	std::copy(m_rtts.begin() + slot + 1, m_rtts.begin() + end, m_rtts.begin() + slot);
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+	std::copy(m_first_seen.begin() + slot + 1, m_first_seen.begin() + end
+		, m_first_seen.begin() + slot);
+#endif
+	--m_buckets[bucket].num_live;
+}
+
+int routing_table::find_live_node(int bucket, node_id const& id) const
+{
+	for (int i = bucket_offset(bucket), end(i + m_buckets[bucket].num_live);
+		i != end; ++i)
+	{
+		if (m_ids[i] == id) return i;
+	}
+	return -1;
+}
+
+bool routing_table::has_ip(address const& a) const
+{
+	return std::binary_search(m_ips.begin(), m_ips.end()
+		, boost::uint32_t(a.to_v4().to_ulong()));
+}
+
+void routing_table::add_ip(address const& a)
+{
+	boost::uint32_t ip = a.to_v4().to_ulong();
+	std::vector<boost::uint32_t>::iterator i = std::lower_bound(
+		m_ips.begin(), m_ips.end(), ip);
+	if (i != m_ips.end() && *i == ip) return;
+	m_ips.insert(i, ip);
+}
+
+void routing_table::remove_ip(address const& a)
+{
+	boost::uint32_t ip = a.to_v4().to_ulong();
+	std::vector<boost::uint32_t>::iterator i = std::lower_bound(
+		m_ips.begin(), m_ips.end(), ip);
+	if (i != m_ips.end() && *i == ip) m_ips.erase(i);
+}
+
 void routing_table::status(session_status& s) const
 {
 	boost::tie(s.dht_nodes, s.dht_node_cache) = size();
@@ -88,7 +193,7 @@ void routing_table::status(session_status& s) const
 		, end(m_buckets.end()); i != end; ++i)
 	{
 		dht_routing_bucket b;
-		b.num_nodes = i->live_nodes.size();
+		b.num_nodes = i->num_live;
 		b.num_replacements = i->replacements.size();
 		b.last_active = total_seconds(now - i->last_active);
 		s.dht_routing_table.push_back(b);
@@ -102,7 +207,7 @@ boost::tuple<int, int> routing_table::size() const
 	for (table_t::const_iterator i = m_buckets.begin()
 		, end(m_buckets.end()); i != end; ++i)
 	{
-		nodes += i->live_nodes.size();
+		nodes += i->num_live;
 		replacements += i->replacements.size();
 	}
 	return boost::make_tuple(nodes, replacements);
@@ -115,7 +220,7 @@ size_type routing_table::num_global_nodes() const
 	for (table_t::const_iterator i = m_buckets.begin()
 		, end(m_buckets.end()); i != end; ++i)
 	{
-		deepest_size = i->live_nodes.size(); // + i->replacements.size();
+		deepest_size = i->num_live; // + i->replacements.size();
 		if (deepest_size < m_bucket_size) break;
 		// this bucket is full
 		++deepest_bucket;
@@ -147,7 +252,7 @@ void routing_table::print_state(std::ostream& os) const
 		for (table_t::const_iterator i = m_buckets.begin(), end(m_buckets.end());
 			i != end; ++i)
 		{
-			os << (int(i->live_nodes.size()) > (max_size - 1 - k) ? "|" : " ");
+			os << (i->num_live > (max_size - 1 - k) ? "|" : " ");
 		}
 		os << "\n";
 	}
@@ -169,23 +274,23 @@ void routing_table::print_state(std::ostream& os) const
 	os << "\n\n";
 
 	os << "nodes:\n";
-	int bucket_index = 0;
-	for (table_t::const_iterator i = m_buckets.begin(), end(m_buckets.end());
-		i != end; ++i, ++bucket_index)
+	for (int bucket_index = 0; bucket_index < int(m_buckets.size()); ++bucket_index)
 	{
-//		if (i->live_nodes.empty()) continue;
+		routing_table_node const& b = m_buckets[bucket_index];
+//		if (b.num_live == 0) continue;
 		os << "=== BUCKET == " << bucket_index
-			<< " == " << total_seconds(time_now() - i->last_active)
+			<< " == " << total_seconds(time_now() - b.last_active)
 			<< " seconds ago ===== \n";
-		for (bucket_t::const_iterator j = i->live_nodes.begin()
-			, end(i->live_nodes.end()); j != end; ++j)
+		for (int j = bucket_offset(bucket_index), end(j + b.num_live);
+			j != end; ++j)
 		{
-			os << " id: " << j->id
-				<< " rtt: " << j->rtt
-				<< " ip: " << j->ep()
-				<< " fails: " << j->fail_count()
-				<< " pinged: " << j->pinged()
-				<< " dist: " << distance_exp(m_id, j->id)
+			node_entry n = live_node(j);
+			os << " id: " << n.id
+				<< " rtt: " << n.rtt
+				<< " ip: " << n.ep()
+				<< " fails: " << n.fail_count()
+				<< " pinged: " << n.pinged()
+				<< " dist: " << distance_exp(m_id, n.id)
 				<< "\n";
 		}
 	}
@@ -195,16 +300,15 @@ void routing_table::print_state(std::ostream& os) const
 
 void routing_table::touch_bucket(node_id const& target)
 {
-	table_t::iterator i = find_bucket(target);
-	i->last_active = time_now();
+	m_buckets[find_bucket(target)].last_active = time_now();
 }
 
 // returns true if lhs is in more need of a refresh than rhs
 bool compare_bucket_refresh(routing_table_node const& lhs, routing_table_node const& rhs)
 {
 	// add the number of nodes to prioritize buckets with few nodes in them
-	return lhs.last_active + seconds(lhs.live_nodes.size() * 5)
-		< rhs.last_active + seconds(rhs.live_nodes.size() * 5);
+	return lhs.last_active + seconds(lhs.num_live * 5)
+		< rhs.last_active + seconds(rhs.num_live * 5);
 }
 
 bool routing_table::need_refresh(node_id& target) const
@@ -268,14 +372,14 @@ void routing_table::replacement_cache(bucket_t& nodes) const
 	}
 }
 
-routing_table::table_t::iterator routing_table::find_bucket(node_id const& id)
+int routing_table::find_bucket(node_id const& id)
 {
 //	TORRENT_ASSERT(id != m_id);
 
 	int num_buckets = m_buckets.size();
 	if (num_buckets == 0)
 	{
-		m_buckets.push_back(routing_table_node());
+		add_bucket();
 		// add 160 seconds to prioritize higher buckets (i.e. buckets closer to us)
 		m_buckets.back().last_active = min_time() + seconds(160);
 		++num_buckets;
@@ -285,47 +389,47 @@ routing_table::table_t::iterator routing_table::find_bucket(node_id const& id)
 	TORRENT_ASSERT(bucket_index < int(m_buckets.size()));
 	TORRENT_ASSERT(bucket_index >= 0);
 
-	table_t::iterator i = m_buckets.begin();
-	std::advance(i, bucket_index);
-	return i;
+	return bucket_index;
 }
 
-bool compare_ip_cidr(node_entry const& lhs, node_entry const& rhs)
+bool compare_ip_cidr(address const& lhs, address const& rhs)
 {
-	TORRENT_ASSERT(lhs.addr.is_v4() == rhs.addr.is_v4());
+	TORRENT_ASSERT(lhs.is_v4() == rhs.is_v4());
 	// the number of bits in the IPs that may match. If
 	// more bits that this matches, something suspicious is
 	// going on and we shouldn't add the second one to our
 	// routing table
-	int cutoff = rhs.addr.is_v4() ? 8 : 64;
-	int dist = cidr_distance(lhs.addr, rhs.addr);
+	int cutoff = rhs.is_v4() ? 8 : 64;
+	int dist = cidr_distance(lhs, rhs);
 	return dist <= cutoff;
 }
 
-node_entry* routing_table::find_node(udp::endpoint const& ep, routing_table::table_t::iterator* bucket)
+bool routing_table::find_node(udp::endpoint const& ep, int& bucket
+	, int& slot, int& replacement) const
 {
-	for (table_t::iterator i = m_buckets.begin()
-		, end(m_buckets.end()); i != end; ++i)
+	for (int i = 0; i < int(m_buckets.size()); ++i)
 	{
-		for (bucket_t::iterator j = i->replacements.begin();
-			j != i->replacements.end(); ++j)
+		bucket_t const& rb = m_buckets[i].replacements;
+		for (bucket_t::const_iterator j = rb.begin(); j != rb.end(); ++j)
 		{
 			if (j->addr != ep.address()) continue;
 			if (j->port != ep.port()) continue;
-			*bucket = i;
-			return &*j;
+			bucket = i;
+			slot = -1;
+			replacement = j - rb.begin();
+			return true;
 		}
-		for (bucket_t::iterator j = i->live_nodes.begin();
-			j != i->live_nodes.end(); ++j)
+		for (int j = bucket_offset(i), end(j + m_buckets[i].num_live);
+			j != end; ++j)
 		{
-			if (j->addr != ep.address()) continue;
-			if (j->port != ep.port()) continue;
-			*bucket = i;
-			return &*j;
+			if (m_endpoints[j] != ep) continue;
+			bucket = i;
+			slot = j;
+			replacement = -1;
+			return true;
 		}
 	}
-	*bucket = m_buckets.end();
-	return 0;
+	return false;
 }
 
 bool routing_table::add_node(node_entry e)
@@ -338,7 +442,7 @@ bool routing_table::add_node(node_entry e)
 	if (e.id == m_id) return ret;
 
 	// do we already have this IP in the table?
-	if (m_ips.find(e.addr.to_v4().to_bytes()) != m_ips.end())
+	if (has_ip(e.addr))
 	{
 		// this exact IP already exists in the table. It might be the case
 		// that the node changed IP. If pinged is true, and the port also
@@ -348,9 +452,12 @@ bool routing_table::add_node(node_entry e)
 		// a response with a correct transaction ID, i.e. it is verified to not
 		// be the result of a poioned routing table
 
-		node_entry* existing = 0;
-		table_t::iterator existing_bucket;
-		if (!e.pinged() || (existing = find_node(e.ep(), &existing_bucket)) == 0)
+		bool existing = false;
+		int existing_bucket = -1;
+		int existing_slot = -1;
+		int existing_replacement = -1;
+		if (!e.pinged() || !(existing = find_node(e.ep(), existing_bucket
+			, existing_slot, existing_replacement)))
 		{
 			// the new node is not pinged, or it's not an existing node
 			// we should ignore it, unless we allow duplicate IPs in our
@@ -366,77 +473,62 @@ bool routing_table::add_node(node_entry e)
 		}
 		if (e.pinged() && existing)
 		{
+			bucket_t& rb = m_buckets[existing_bucket].replacements;
+
 			// if the node ID is the same, just update the failcount
 			// and be done with it
-			if (existing->id == e.id)
+			if (existing_slot >= 0 && m_ids[existing_slot] == e.id)
 			{
-				existing->timeout_count = 0;
-				existing->update_rtt(e.rtt);
+				node_entry n = live_node(existing_slot);
+				n.timeout_count = 0;
+				n.update_rtt(e.rtt);
+				set_live_node(existing_slot, n);
 				return ret;
 			}
-
-			// delete the current entry before we instert the new one
-			bucket_t& b = existing_bucket->live_nodes;
-			bucket_t& rb = existing_bucket->replacements;
-			bool done = false;
-			for (bucket_t::iterator i = b.begin(), end(b.end());
-				i != end; ++i)
-			{
-				if (i->addr != e.addr || i->port != e.port) continue;
-   #ifdef TORRENT_DHT_VERBOSE_LOGGING
-				TORRENT_LOG(table) << "node ID changed, deleting old entry: "
-					<< i->id << " " << i->addr;
-	#endif
-				b.erase(i);
-				done = true;
-				break;
-			}
-			if (!done)
+			if (existing_replacement >= 0 && rb[existing_replacement].id == e.id)
 			{
-				for (bucket_t::iterator i = rb.begin(), end(rb.end());
-					i != end; ++i)
-				{
-					if (i->addr != e.addr || i->port != e.port) continue;
-	#ifdef TORRENT_DHT_VERBOSE_LOGGING
-					TORRENT_LOG(table) << "node ID changed, deleting old entry: "
-						<< i->id << " " << i->addr;
-	#endif
-					rb.erase(i);
-					done = true;
-					break;
-				}
+				rb[existing_replacement].timeout_count = 0;
+				rb[existing_replacement].update_rtt(e.rtt);
+				return ret;
 			}
-			TORRENT_ASSERT(done);
-			m_ips.erase(e.addr.to_v4().to_bytes());
+
+			// delete the current entry before we instert the new one
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+			TORRENT_LOG(table) << "node ID changed, deleting old entry: "
+				<< (existing_slot >= 0 ? m_ids[existing_slot]
+					: rb[existing_replacement].id) << " " << e.addr;
+#endif
+			if (existing_slot >= 0) erase_live_node(existing_bucket, existing_slot);
+			else rb.erase(rb.begin() + existing_replacement);
+			remove_ip(e.addr);
 		}
 	}
 	
-	table_t::iterator i = find_bucket(e.id);
-	bucket_t& b = i->live_nodes;
-	bucket_t& rb = i->replacements;
-	int bucket_index = std::distance(m_buckets.begin(), i);
+	int bucket_index = find_bucket(e.id);
+	bucket_t& rb = m_buckets[bucket_index].replacements;
 	int bucket_size_limit = bucket_limit(bucket_index);
-
-	bucket_t::iterator j;
+	int const first_slot = bucket_offset(bucket_index);
 
 	// if the node already exists, we don't need it
-	j = std::find_if(b.begin(), b.end()
-		, boost::bind(&node_entry::id, _1) == e.id);
+	int slot = find_live_node(bucket_index, e.id);
 
-	if (j != b.end())
+	if (slot >= 0)
 	{
 		// a new IP address just claimed this node-ID
 		// ignore it
-		if (j->addr != e.addr || j->port != e.port) return ret;
+		if (m_endpoints[slot] != e.ep()) return ret;
 
 		// we already have the node in our bucket
-		TORRENT_ASSERT(j->id == e.id && j->ep() == e.ep());
-		j->timeout_count = 0;
-		j->update_rtt(e.rtt);
+		node_entry n = live_node(slot);
+		n.timeout_count = 0;
+		n.update_rtt(e.rtt);
+		set_live_node(slot, n);
 //		TORRENT_LOG(table) << "updating node: " << i->id << " " << i->addr;
 		return ret;
 	}
 
+	bucket_t::iterator j;
+
 	// if this node exists in the replacement bucket. update it and
 	// pull it out from there. We may add it back to the replacement
 	// bucket, but we may also replace a node in the main bucket, now
@@ -451,28 +543,31 @@ bool routing_table::add_node(node_entry e)
 		j->timeout_count = 0;
 		j->update_rtt(e.rtt);
 		e = *j;
-		m_ips.erase(j->addr.to_v4().to_bytes());
+		remove_ip(j->addr);
 		rb.erase(j);
 	}
 
 	if (m_settings.restrict_routing_ips)
 	{
 		// don't allow multiple entries from IPs very close to each other
-		j = std::find_if(b.begin(), b.end(), boost::bind(&compare_ip_cidr, _1, e));
-		if (j != b.end())
+		for (int k = first_slot, end(k + m_buckets[bucket_index].num_live);
+			k != end; ++k)
 		{
+			if (!compare_ip_cidr(m_endpoints[k].address(), e.addr)) continue;
+
 			// we already have a node in this bucket with an IP very
 			// close to this one. We know that it's not the same, because
 			// it claims a different node-ID. Ignore this to avoid attacks
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 			TORRENT_LOG(table) << "ignoring node: " << e.id << " " << e.addr
 				<< " existing node: "
-				<< j->id << " " << j->addr;
+				<< m_ids[k] << " " << m_endpoints[k].address();
 #endif
 			return ret;
 		}
 
-		j = std::find_if(rb.begin(), rb.end(), boost::bind(&compare_ip_cidr, _1, e));
+		j = std::find_if(rb.begin(), rb.end(), boost::bind(&compare_ip_cidr
+			, boost::bind(&node_entry::addr, _1), e.addr));
 		if (j != rb.end())
 		{
 			// same thing but for the replacement bucket
@@ -485,12 +580,13 @@ bool routing_table::add_node(node_entry e)
 		}
 	}
 
+	int num_live = m_buckets[bucket_index].num_live;
+
 	// if there's room in the main bucket, just insert it
-	if (int(b.size()) < bucket_size_limit)
+	if (num_live < bucket_size_limit)
 	{
-		if (b.empty()) b.reserve(bucket_size_limit);
-		b.push_back(e);
-		m_ips.insert(e.addr.to_v4().to_bytes());
+		add_live_node(bucket_index, e);
+		add_ip(e.addr);
 //		TORRENT_LOG(table) << "inserting node: " << e.id << " " << e.addr;
 		return ret;
 	}
@@ -510,59 +606,63 @@ bool routing_table::add_node(node_entry e)
 		// only nodes that are pinged and haven't failed
 		// can split the bucket, and we can only split
 		// the last bucket
-		can_split = (boost::next(i) == m_buckets.end() && m_buckets.size() < 159);
+		can_split = (bucket_index == int(m_buckets.size()) - 1
+			&& m_buckets.size() < 159);
 
 		// if the node we're trying to insert is considered pinged,
-		// we may replace other nodes that aren't pinged
-
-		j = std::find_if(b.begin(), b.end(), boost::bind(&node_entry::pinged, _1) == false);
+		// we may replace other nodes that aren't pinged.
+		// A node is considered stale if it has failed at least one
+		// time. We choose the node that has failed most times.
+		// in order to keep lookup times small, prefer nodes with low RTTs
+		int unpinged = -1;
+		int most_failed = -1;
+		int slowest = -1;
+		for (int k = first_slot, end(k + num_live); k != end; ++k)
+		{
+			node_entry n = live_node(k);
+			if (!n.pinged())
+			{
+				unpinged = k;
+				break;
+			}
+			if (most_failed == -1 || n.fail_count() > m_timeout_counts[most_failed])
+				most_failed = k;
+			if (slowest == -1 || n.rtt > m_rtts[slowest])
+				slowest = k;
+		}
 
-		if (j != b.end() && !j->pinged())
+		int replace = -1;
+		if (unpinged != -1)
 		{
-			// j points to a node that has not been pinged.
+			// this node has not been pinged.
 			// Replace it with this new one
-			m_ips.erase(j->addr.to_v4().to_bytes());
-			*j = e;
-			m_ips.insert(e.addr.to_v4().to_bytes());
+			replace = unpinged;
 //			TORRENT_LOG(table) << "replacing unpinged node: " << e.id << " " << e.addr;
-			return ret;
 		}
-
-		// A node is considered stale if it has failed at least one
-		// time. Here we choose the node that has failed most times.
-		// If we don't find one, place this node in the replacement-
-		// cache and replace any nodes that will fail in the future
-		// with nodes from that cache.
-
-		j = std::max_element(b.begin(), b.end()
-				, boost::bind(&node_entry::fail_count, _1)
-				< boost::bind(&node_entry::fail_count, _2));
-
-		if (j != b.end() && j->fail_count() > 0)
+		else if (most_failed != -1 && m_timeout_counts[most_failed] > 0)
 		{
-			// i points to a node that has been marked
-			// as stale. Replace it with this new one
-			m_ips.erase(j->addr.to_v4().to_bytes());
-			*j = e;
-			m_ips.insert(e.addr.to_v4().to_bytes());
+			// this node has been marked as stale.
+			// Replace it with this new one
+			replace = most_failed;
 //			TORRENT_LOG(table) << "replacing stale node: " << e.id << " " << e.addr;
-			return ret;
 		}
-
-		// in order to keep lookup times small, prefer nodes with low RTTs
-
-		j = std::max_element(b.begin(), b.end()
-				, boost::bind(&node_entry::rtt, _1)
-				< boost::bind(&node_entry::rtt, _2));
-
-		if (j != b.end() && j->rtt > e.rtt)
+		else if (slowest != -1 && m_rtts[slowest] > e.rtt)
 		{
-			m_ips.erase(j->addr.to_v4().to_bytes());
-			*j = e;
-			m_ips.insert(e.addr.to_v4().to_bytes());
+			replace = slowest;
 //			TORRENT_LOG(table) << "replacing node with higher RTT: " << e.id << " " << e.addr;
+		}
+
+		if (replace != -1)
+		{
+			remove_ip(m_endpoints[replace].address());
+			set_live_node(replace, e);
+			add_ip(e.addr);
 			return ret;
 		}
+
+		// If we don't find one, place this node in the replacement-
+		// cache and replace any nodes that will fail in the future
+		// with nodes from that cache.
 	}
 
 	// if we can't split, try to insert into the replacement bucket
@@ -594,65 +694,69 @@ bool routing_table::add_node(node_entry e)
 			// less reliable than this one, that has been pinged
 			j = std::find_if(rb.begin(), rb.end(), boost::bind(&node_entry::pinged, _1) == false);
 			if (j == rb.end()) j = rb.begin();
-			m_ips.erase(j->addr.to_v4().to_bytes());
+			remove_ip(j->addr);
 			rb.erase(j);
 		}
 
 		if (rb.empty()) rb.reserve(m_bucket_size);
 		rb.push_back(e);
-		m_ips.insert(e.addr.to_v4().to_bytes());
+		add_ip(e.addr);
 //		TORRENT_LOG(table) << "inserting node in replacement cache: " << e.id << " " << e.addr;
 		return ret;
 	}
 
 	// this is the last bucket, and it's full already. Split
 	// it by adding another bucket
-	m_buckets.push_back(routing_table_node());
+	add_bucket();
+	int const new_index = bucket_index + 1;
 	// the extra seconds added to the end is to prioritize
 	// buckets closer to us when refreshing
 	m_buckets.back().last_active = min_time() + seconds(160 - m_buckets.size());
-	bucket_t& new_bucket = m_buckets.back().live_nodes;
 	bucket_t& new_replacement_bucket = m_buckets.back().replacements;
 
 	// move any node whose (160 - distane_exp(m_id, id)) >= (i - m_buckets.begin())
 	// to the new bucket
-	int new_bucket_size = bucket_limit(bucket_index + 1);
-	for (bucket_t::iterator j = b.begin(); j != b.end();)
+	int new_bucket_size = bucket_limit(new_index);
+	for (int k = first_slot; k < first_slot + m_buckets[bucket_index].num_live;)
 	{
-		if (distance_exp(m_id, j->id) >= 159 - bucket_index)
+		if (distance_exp(m_id, m_ids[k]) >= 159 - bucket_index)
 		{
-			++j;
+			++k;
 			continue;
 		}
 		// this entry belongs in the new bucket
-		if (int(new_bucket.size()) < bucket_size_limit)
-			new_bucket.push_back(*j);
+		if (m_buckets[new_index].num_live < new_bucket_size)
+			add_live_node(new_index, live_node(k));
 		else if (int(new_replacement_bucket.size()) < m_bucket_size)
-			new_replacement_bucket.push_back(*j);
-		j = b.erase(j);
+			new_replacement_bucket.push_back(live_node(k));
+		else
+			remove_ip(m_endpoints[k].address());
+		erase_live_node(bucket_index, k);
 	}
 
 	// split the replacement bucket as well. If the live bucket
 	// is not full anymore, also move the replacement entries
 	// into the main bucket
-	for (bucket_t::iterator j = rb.begin(); j != rb.end();)
+	for (j = rb.begin(); j != rb.end();)
 	{
 		if (distance_exp(m_id, j->id) >= 159 - bucket_index)
 		{
-			if (int(b.size()) >= bucket_size_limit)
+			if (m_buckets[bucket_index].num_live >= bucket_size_limit)
 			{
 				++j;
 				continue;
 			}
-			b.push_back(*j);
+			add_live_node(bucket_index, *j);
 		}
 		else
 		{
 			// this entry belongs in the new bucket
-			if (int(new_bucket.size()) < new_bucket_size)
-				new_bucket.push_back(*j);
+			if (m_buckets[new_index].num_live < new_bucket_size)
+				add_live_node(new_index, *j);
 			else if (int(new_replacement_bucket.size()) < m_bucket_size)
 				new_replacement_bucket.push_back(*j);
+			else
+				remove_ip(j->addr);
 		}
 		j = rb.erase(j);
 	}
@@ -661,9 +765,9 @@ bool routing_table::add_node(node_entry e)
 	// now insert the new node in the appropriate bucket
 	if (distance_exp(m_id, e.id) >= 159 - bucket_index)
 	{
-		if (int(b.size()) < bucket_size_limit)
+		if (m_buckets[bucket_index].num_live < bucket_size_limit)
 		{
-			b.push_back(e);
+			add_live_node(bucket_index, e);
 			added = true;
 		}
 		else if (int(rb.size()) < m_bucket_size)
@@ -674,9 +778,9 @@ bool routing_table::add_node(node_entry e)
 	}
 	else
 	{
-		if (int(new_bucket.size()) < new_bucket_size)
+		if (m_buckets[new_index].num_live < new_bucket_size)
 		{
-			new_bucket.push_back(e);
+			add_live_node(new_index, e);
 			added = true;
 		}
 		else if (int(new_replacement_bucket.size()) < m_bucket_size)
@@ -685,7 +789,7 @@ bool routing_table::add_node(node_entry e)
 			added = true;
 		}
 	}
-	if (added) m_ips.insert(e.addr.to_v4().to_bytes());
+	if (added) add_ip(e.addr);
 	return ret;
 }
 
@@ -694,19 +798,19 @@ void routing_table::for_each_node(
 	, void (*fun2)(void*, node_entry const&)
 	, void* userdata) const
 {
-	for (table_t::const_iterator i = m_buckets.begin()
-		, end(m_buckets.end()); i != end; ++i)
+	for (int i = 0; i < int(m_buckets.size()); ++i)
 	{
 		if (fun1)
 		{
-			for (bucket_t::const_iterator j = i->live_nodes.begin()
-				, end(i->live_nodes.end()); j != end; ++j)
-				fun1(userdata, *j);
+			for (int j = bucket_offset(i), end(j + m_buckets[i].num_live);
+				j != end; ++j)
+				fun1(userdata, live_node(j));
 		}
 		if (fun2)
 		{
-			for (bucket_t::const_iterator j = i->replacements.begin()
-				, end(i->replacements.end()); j != end; ++j)
+			bucket_t const& rb = m_buckets[i].replacements;
+			for (bucket_t::const_iterator j = rb.begin()
+				, end(rb.end()); j != end; ++j)
 				fun2(userdata, *j);
 		}
 	}
@@ -717,54 +821,54 @@ void routing_table::node_failed(node_id const& id, udp::endpoint const& ep)
 	// if messages to ourself fails, ignore it
 	if (id == m_id) return;
 
-	table_t::iterator i = find_bucket(id);
-	bucket_t& b = i->live_nodes;
-	bucket_t& rb = i->replacements;
+	int bucket_index = find_bucket(id);
+	bucket_t& rb = m_buckets[bucket_index].replacements;
 
-	bucket_t::iterator j = std::find_if(b.begin(), b.end()
-		, boost::bind(&node_entry::id, _1) == id);
+	int slot = find_live_node(bucket_index, id);
 
-	if (j == b.end()) return;
+	if (slot == -1) return;
 
 	// if the endpoint doesn't match, it's a different node
 	// claiming the same ID. The node we have in our routing
 	// table is not necessarily stale
-	if (j->ep() != ep) return;
+	if (m_endpoints[slot] != ep) return;
 	
 	if (rb.empty())
 	{
-		j->timed_out();
+		node_entry n = live_node(slot);
+		n.timed_out();
+		m_timeout_counts[slot] = n.timeout_count;
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		TORRENT_LOG(table) << " NODE FAILED"
 			" id: " << id <<
-			" ip: " << j->ep() <<
-			" fails: " << j->fail_count() <<
-			" pinged: " << j->pinged() <<
-			" up-time: " << total_seconds(time_now() - j->first_seen);
+			" ip: " << n.ep() <<
+			" fails: " << n.fail_count() <<
+			" pinged: " << n.pinged() <<
+			" up-time: " << total_seconds(time_now() - n.first_seen);
 #endif
 
 		// if this node has failed too many times, or if this node
 		// has never responded at all, remove it
-		if (j->fail_count() >= m_settings.max_fail_count || !j->pinged())
+		if (n.fail_count() >= m_settings.max_fail_count || !n.pinged())
 		{
-			m_ips.erase(j->addr.to_v4().to_bytes());
-			b.erase(j);
+			remove_ip(n.addr);
+			erase_live_node(bucket_index, slot);
 		}
 		return;
 	}
 
-	m_ips.erase(j->addr.to_v4().to_bytes());
-	b.erase(j);
+	remove_ip(ep.address());
+	erase_live_node(bucket_index, slot);
 
 	// sort by RTT first, to find the node with the lowest
 	// RTT that is pinged
 	std::sort(rb.begin(), rb.end()
 		, boost::bind(&node_entry::rtt, _1) < boost::bind(&node_entry::rtt, _2));
 
-	j = std::find_if(rb.begin(), rb.end(), boost::bind(&node_entry::pinged, _1));
+	bucket_t::iterator j = std::find_if(rb.begin(), rb.end(), boost::bind(&node_entry::pinged, _1));
 	if (j == rb.end()) j = rb.begin();
-	b.push_back(*j);
+	add_live_node(bucket_index, *j);
 	rb.erase(j);
 }
 
@@ -797,19 +901,38 @@ bool routing_table::need_bootstrap() const
 	ptime now = time_now();
 	if (now - m_last_bootstrap < seconds(30)) return false;
 
-	for (table_t::const_iterator i = m_buckets.begin()
-		, end(m_buckets.end()); i != end; ++i)
+	for (int i = 0; i < int(m_buckets.size()); ++i)
 	{
-		for (bucket_t::const_iterator j = i->live_nodes.begin()
-			, end(i->live_nodes.end()); j != end; ++j)
+		for (int j = bucket_offset(i), end(j + m_buckets[i].num_live);
+			j != end; ++j)
 		{
-			if (j->confirmed()) return false;
+			// confirmed
+			if (m_timeout_counts[j] == 0) return false;
 		}
 	}
 	m_last_bootstrap = now;
 	return true;
 }
 
+namespace
+{
+	// the 64 most significant bits of the ID, as a number. The XOR of
+	// two of these is the 64 most significant bits of the distance
+	// between the IDs
+	inline boost::uint64_t id_prefix(node_id const& id)
+	{
+		unsigned char const* p = id.begin();
+		return (boost::uint64_t(p[0]) << 56)
+			| (boost::uint64_t(p[1]) << 48)
+			| (boost::uint64_t(p[2]) << 40)
+			| (boost::uint64_t(p[3]) << 32)
+			| (boost::uint64_t(p[4]) << 24)
+			| (boost::uint64_t(p[5]) << 16)
+			| (boost::uint64_t(p[6]) << 8)
+			| boost::uint64_t(p[7]);
+	}
+}
+
 // fills the vector with the k nodes from our buckets that
 // are nearest to the given id.
 void routing_table::find_node(node_id const& target
@@ -818,91 +941,43 @@ void routing_table::find_node(node_id const& target
 	l.clear();
 	if (count == 0) count = m_bucket_size;
 
-	table_t::iterator i = find_bucket(target);
-	int bucket_index = std::distance(m_buckets.begin(), i);
-	int bucket_size_limit = bucket_limit(bucket_index);
-
-	l.reserve(bucket_size_limit);
-
-	table_t::iterator j = i;
-
-	for (; j != m_buckets.end() && int(l.size()) < count; ++j)
-	{
-		bucket_t& b = j->live_nodes;
-		if (options & include_failed)
-		{
-			copy(b.begin(), b.end()
-				, std::back_inserter(l));
-		}
-		else
-		{
-			std::remove_copy_if(b.begin(), b.end()
-				, std::back_inserter(l)
-				, !boost::bind(&node_entry::confirmed, _1));
-		}
-
-		if (int(l.size()) >= count)
-		{
-			// sort the nodes by how close they are to the target
-			std::sort(l.begin(), l.end(), boost::bind(&compare_ref
-				, boost::bind(&node_entry::id, _1)
-				, boost::bind(&node_entry::id, _2), target));
-
-			l.resize(count);
-			return;
-		}
-	}
-
-	// if we still don't have enough nodes, copy nodes
-	// further away from us
+	// keep the count closest nodes in m_closest, sorted by distance.
+	// Comparing the 64 most significant bits of the distance is
+	// enough to reject almost every node. Only when those are equal
+	// do we need to compare the full IDs
+	boost::uint64_t const target_prefix = id_prefix(target);
+	m_closest.clear();
 
-	if (i == m_buckets.begin())
+	for (int i = 0; i < int(m_buckets.size()); ++i)
 	{
-		// sort the nodes by how close they are to the target
-		std::sort(l.begin(), l.end(), boost::bind(&compare_ref
-			, boost::bind(&node_entry::id, _1)
-			, boost::bind(&node_entry::id, _2), target));
-		return;
-	}
-
-	j = i;
-
-	do
-	{
-		--j;
-		bucket_t& b = j->live_nodes;
-	
-		if (options & include_failed)
+		for (int j = bucket_offset(i), end(j + m_buckets[i].num_live);
+			j != end; ++j)
 		{
-			std::copy(b.begin(), b.end(), std::back_inserter(l));
-		}
-		else
-		{
-			std::remove_copy_if(b.begin(), b.end(), std::back_inserter(l)
-				, !boost::bind(&node_entry::confirmed, _1));
-		}
+			if ((options & include_failed) == 0 && m_timeout_counts[j] != 0)
+				continue;
 
-		if (int(l.size()) >= count)
-		{
-			// sort the nodes by how close they are to the target
-			std::sort(l.begin(), l.end(), boost::bind(&compare_ref
-				, boost::bind(&node_entry::id, _1)
-				, boost::bind(&node_entry::id, _2), target));
+			boost::uint64_t d = id_prefix(m_ids[j]) ^ target_prefix;
+			if (int(m_closest.size()) == count && d > m_closest.back().first)
+				continue;
 
-			l.resize(count);
-			return;
+			// find where this node goes. The list is short, and most
+			// nodes that get this far are close, so search from the end
+			int pos = m_closest.size();
+			while (pos > 0 && (m_closest[pos - 1].first > d
+				|| (m_closest[pos - 1].first == d
+					&& compare_ref(m_ids[j], m_ids[m_closest[pos - 1].second], target))))
+				--pos;
+			if (pos == count) continue;
+
+			if (int(m_closest.size()) == count) m_closest.pop_back();
+			m_closest.insert(m_closest.begin() + pos, std::make_pair(d, j));
 		}
 	}
-	while (j != m_buckets.begin() && int(l.size()) < count);
 
-	// sort the nodes by how close they are to the target
-	std::sort(l.begin(), l.end(), boost::bind(&compare_ref
-		, boost::bind(&node_entry::id, _1)
-		, boost::bind(&node_entry::id, _2), target));
-
-	if (int(l.size()) >= count)
-		l.resize(count);
+	l.reserve(m_closest.size());
+	for (std::vector<std::pair<boost::uint64_t, int> >::const_iterator i
+		= m_closest.begin(), end(m_closest.end()); i != end; ++i)
+		l.push_back(live_node(i->second));
 }
 
 } } // namespace libtorrent::dht
-
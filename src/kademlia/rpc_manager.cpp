@@ -153,6 +153,28 @@ void observer::timeout()
 	m_algorithm->failed(observer_ptr(this));
 }
 
+namespace
+{
+	// the number of seconds we wait for a reply before giving the
+	// traversal a chance to issue another request, and before giving
+	// up on the request altogether
+	enum { short_timeout = 2, full_timeout = 10 };
+
+	// the resolution of the timeout wheel, in milliseconds
+	enum { timeout_tick = 250 };
+
+	int rtt_histogram_bucket(int ms)
+	{
+		int bucket = 0;
+		while (ms > 0 && bucket < session_status::num_dht_rtt_buckets - 1)
+		{
+			ms >>= 1;
+			++bucket;
+		}
+		return bucket;
+	}
+}
+
 enum { observer_size = max3<
 	sizeof(find_data_observer)
 	, sizeof(announce_observer)
@@ -164,6 +186,9 @@ rpc_manager::rpc_manager(node_id const& our_id
 	, routing_table& table, udp_socket_interface* sock
 	, dht_observer* observer)
 	: m_pool_allocator(observer_size, 10)
+	, m_num_transactions(0)
+	, m_start(time_now())
+	, m_num_timeouts(0)
 	, m_sock(sock)
 	, m_our_id(our_id)
 	, m_table(table)
@@ -175,6 +200,10 @@ rpc_manager::rpc_manager(node_id const& our_id
 {
 	std::srand(time(0));
 
+	m_transactions.resize(64, static_cast<transaction*>(0));
+	std::fill(m_rtt_histogram, m_rtt_histogram
+		+ session_status::num_dht_rtt_buckets, 0);
+
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 	TORRENT_LOG(rpc) << "Constructing";
 
@@ -207,11 +236,91 @@ rpc_manager::~rpc_manager()
 	TORRENT_LOG(rpc) << "Destructing";
 #endif
 	
-	for (transactions_t::iterator i = m_transactions.begin()
+	std::vector<observer_ptr> aborted;
+	aborted.reserve(m_num_transactions);
+	for (std::vector<transaction*>::iterator i = m_transactions.begin()
 		, end(m_transactions.end()); i != end; ++i)
 	{
-		(*i)->abort();
+		for (transaction* t = *i; t != 0;)
+		{
+			transaction* next = t->next;
+			m_timeouts.cancel(&t->timer);
+			aborted.push_back(t->o);
+			m_transaction_pool.destroy(t);
+			t = next;
+		}
+		*i = 0;
+	}
+	m_num_transactions = 0;
+
+	std::for_each(aborted.begin(), aborted.end(), boost::bind(&observer::abort, _1));
+}
+
+int rpc_manager::bucket_for(int tid, address const& addr) const
+{
+	boost::uint32_t h = boost::uint32_t(tid) * 0x9e3779b1;
+#if TORRENT_USE_IPV6
+	if (addr.is_v6())
+	{
+		address_v6::bytes_type b = addr.to_v6().to_bytes();
+		unsigned char const* ptr = &b[0];
+		for (int i = 0; i < 4; ++i)
+			h = (h ^ io::read_uint32(ptr)) * 0x85ebca6b;
+	}
+	else
+#endif
+		h = (h ^ boost::uint32_t(addr.to_v4().to_ulong())) * 0x85ebca6b;
+	h ^= h >> 16;
+	return h & (m_transactions.size() - 1);
+}
+
+void rpc_manager::unlink(transaction* t)
+{
+	transaction** p = &m_transactions[bucket_for(t->o->transaction_id()
+		, t->o->target_addr())];
+	while (*p != t)
+	{
+		TORRENT_ASSERT(*p != 0);
+		p = &(*p)->next;
 	}
+	*p = t->next;
+	t->next = 0;
+	m_timeouts.cancel(&t->timer);
+	--m_num_transactions;
+}
+
+void rpc_manager::rehash(int num_buckets)
+{
+	TORRENT_ASSERT((num_buckets & (num_buckets - 1)) == 0);
+	std::vector<transaction*> old(num_buckets, static_cast<transaction*>(0));
+	old.swap(m_transactions);
+	for (std::vector<transaction*>::iterator i = old.begin()
+		, end(old.end()); i != end; ++i)
+	{
+		for (transaction* t = *i; t != 0;)
+		{
+			transaction* next = t->next;
+			transaction*& b = m_transactions[bucket_for(t->o->transaction_id()
+				, t->o->target_addr())];
+			t->next = b;
+			b = t;
+			t = next;
+		}
+	}
+}
+
+boost::uint32_t rpc_manager::wheel_tick(ptime t) const
+{
+	boost::int64_t const ms = total_microseconds(t - m_start) / 1000;
+	return boost::uint32_t((ms + timeout_tick - 1) / timeout_tick);
+}
+
+void rpc_manager::status(session_status& s) const
+{
+	std::copy(m_rtt_histogram, m_rtt_histogram
+		+ session_status::num_dht_rtt_buckets, s.dht_rtt_histogram);
+	s.dht_outstanding_transactions = m_num_transactions;
+	s.dht_transaction_timeouts = m_num_timeouts;
 }
 
 void* rpc_manager::allocate_observer()
@@ -238,11 +347,21 @@ size_t rpc_manager::allocation_size() const
 #ifdef TORRENT_DEBUG
 void rpc_manager::check_invariant() const
 {
-	for (transactions_t::const_iterator i = m_transactions.begin()
-		, end(m_transactions.end()); i != end; ++i)
+	int num_transactions = 0;
+	for (int i = 0; i < int(m_transactions.size()); ++i)
 	{
-		TORRENT_ASSERT(*i);
+		for (transaction const* t = m_transactions[i]; t != 0; t = t->next)
+		{
+			TORRENT_ASSERT(t->o);
+			TORRENT_ASSERT(bucket_for(t->o->transaction_id(), t->o->target_addr()) == i);
+			TORRENT_ASSERT(t->timer.scheduled());
+			TORRENT_ASSERT(t->timer.userdata == t);
+			++num_transactions;
+		}
 	}
+	TORRENT_ASSERT(num_transactions == m_num_transactions);
+	TORRENT_ASSERT(m_timeouts.size() == m_num_transactions);
+	TORRENT_ASSERT(m_transaction_pool.size() == m_num_transactions);
 }
 #endif
 
@@ -252,19 +371,24 @@ void rpc_manager::unreachable(udp::endpoint const& ep)
 	TORRENT_LOG(rpc) << time_now_string() << " PORT_UNREACHABLE [ ip: " << ep << " ]";
 #endif
 
-	for (transactions_t::iterator i = m_transactions.begin();
-		i != m_transactions.end();)
+	// ICMP messages don't tell us the transaction ID, so this has to
+	// look at every transaction. Unreachable messages are rare compared
+	// to replies
+	for (std::vector<transaction*>::iterator i = m_transactions.begin()
+		, end(m_transactions.end()); i != end; ++i)
 	{
-		TORRENT_ASSERT(*i);
-		observer_ptr const& o = *i;
-		if (o->target_ep() != ep) { ++i; continue; }
-		observer_ptr ptr = *i;
-		m_transactions.erase(i++);
+		for (transaction* t = *i; t != 0; t = t->next)
+		{
+			if (t->o->target_ep() != ep) continue;
+			observer_ptr ptr = t->o;
+			unlink(t);
+			m_transaction_pool.destroy(t);
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-		TORRENT_LOG(rpc) << "  found transaction [ tid: " << ptr->transaction_id() << " ]";
+			TORRENT_LOG(rpc) << "  found transaction [ tid: " << ptr->transaction_id() << " ]";
 #endif
-		ptr->timeout();
-		break;
+			ptr->timeout();
+			return;
+		}
 	}
 }
 
@@ -290,15 +414,18 @@ bool rpc_manager::incoming(msg const& m, node_id* id)
 
 	observer_ptr o;
 
-	for (transactions_t::iterator i = m_transactions.begin()
-		, end(m_transactions.end()); i != end; ++i)
+	if (tid != -1)
 	{
-		TORRENT_ASSERT(*i);
-		if ((*i)->transaction_id() != tid) continue;
-		if (m.addr.address() != (*i)->target_addr()) continue;
-		o = *i;
-		m_transactions.erase(i);
-		break;
+		for (transaction* t = m_transactions[bucket_for(tid, m.addr.address())];
+			t != 0; t = t->next)
+		{
+			if (t->o->transaction_id() != tid) continue;
+			if (m.addr.address() != t->o->target_addr()) continue;
+			o = t->o;
+			unlink(t);
+			m_transaction_pool.destroy(t);
+			break;
+		}
 	}
 
 	if (!o)
@@ -321,8 +448,8 @@ bool rpc_manager::incoming(msg const& m, node_id* id)
 		<< std::endl;
 #endif
 
-	lazy_entry const* ret_ent = m.message.dict_find_dict("r");
-	if (ret_ent == 0)
+	bdecode_node ret_ent = m.message.dict_find_dict("r");
+	if (!ret_ent)
 	{
 		entry e;
 		incoming_error(e, "missing 'r' key");
@@ -330,8 +457,8 @@ bool rpc_manager::incoming(msg const& m, node_id* id)
 		return false;
 	}
 
-	lazy_entry const* node_id_ent = ret_ent->dict_find_string("id");
-	if (node_id_ent == 0 || node_id_ent->string_length() != 20)
+	bdecode_node node_id_ent = ret_ent.dict_find_string("id");
+	if (!node_id_ent || node_id_ent.string_length() != 20)
 	{
 		entry e;
 		incoming_error(e, "missing 'id' key");
@@ -339,22 +466,22 @@ bool rpc_manager::incoming(msg const& m, node_id* id)
 		return false;
 	}
 
-	lazy_entry const* ext_ip = ret_ent->dict_find_string("ip");
-	if (ext_ip && ext_ip->string_length() == 4)
+	bdecode_node ext_ip = ret_ent.dict_find_string("ip");
+	if (ext_ip && ext_ip.string_length() == 4)
 	{
 		// this node claims we use the wrong node-ID!
 		address_v4::bytes_type b;
-		memcpy(&b[0], ext_ip->string_ptr(), 4);
+		memcpy(&b[0], ext_ip.string_ptr(), 4);
 		if (m_observer)
 			m_observer->set_external_address(address_v4(b)
 				, aux::session_impl::source_dht, m.addr.address());
 	}
 #if TORRENT_USE_IPV6
-	else if (ext_ip && ext_ip->string_length() == 16)
+	else if (ext_ip && ext_ip.string_length() == 16)
 	{
 		// this node claims we use the wrong node-ID!
 		address_v6::bytes_type b;
-		memcpy(&b[0], ext_ip->string_ptr(), 16);
+		memcpy(&b[0], ext_ip.string_ptr(), 16);
 		if (m_observer)
 			m_observer->set_external_address(address_v6(b)
 				, aux::session_impl::source_dht, m.addr.address());
@@ -366,9 +493,10 @@ bool rpc_manager::incoming(msg const& m, node_id* id)
 		<< tid << " from " << m.addr;
 #endif
 	o->reply(m);
-	*id = node_id(node_id_ent->string_ptr());
+	*id = node_id(node_id_ent.string_ptr());
 
 	int rtt = total_milliseconds(now - o->sent());
+	++m_rtt_histogram[rtt_histogram_bucket(rtt)];
 
 	// we found an observer for this reply, hence the node is not spoofing
 	// add it to the routing table
@@ -379,68 +507,57 @@ time_duration rpc_manager::tick()
 {
 	INVARIANT_CHECK;
 
-	const static int short_timeout = 2;
-	const static int timeout = 10;
-
 	//	look for observers that have timed out
 
-	if (m_transactions.empty()) return seconds(short_timeout);
+	if (m_num_transactions == 0) return seconds(short_timeout);
 
-	std::list<observer_ptr> timeouts;
+	std::vector<timer_entry*> expired;
+	m_timeouts.advance(wheel_tick(time_now()), expired);
 
-	time_duration ret = seconds(short_timeout);
-	ptime now = time_now();
+	std::vector<observer_ptr> timeouts;
+	std::vector<observer_ptr> short_timeouts;
 
-	for (transactions_t::iterator i = m_transactions.begin();
-		i != m_transactions.end();)
+	for (std::vector<timer_entry*>::iterator i = expired.begin()
+		, end(expired.end()); i != end; ++i)
 	{
-		observer_ptr o = *i;
-
-		// if we reach an observer that hasn't timed out
-		// break, because every observer after this one will
-		// also not have timed out yet
-		time_duration diff = now - o->sent();
-		if (diff < seconds(timeout))
+		transaction* t = static_cast<transaction*>((*i)->userdata);
+		if (!t->short_timeout)
 		{
-			ret = seconds(timeout) - diff;
-			break;
+			// the short timeout fired. Keep waiting for the reply
+			// until the full timeout
+			t->short_timeout = true;
+			m_timeouts.schedule(&t->timer, wheel_tick(t->o->sent()
+				+ seconds(full_timeout)));
+			if (!t->o->has_short_timeout()) short_timeouts.push_back(t->o);
+			continue;
 		}
-		
+
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-		TORRENT_LOG(rpc) << "[" << o->m_algorithm.get() << "] Timing out transaction id: " 
-			<< (*i)->transaction_id() << " from " << o->target_ep();
+		TORRENT_LOG(rpc) << "[" << t->o->m_algorithm.get() << "] Timing out transaction id: " 
+			<< t->o->transaction_id() << " from " << t->o->target_ep();
 #endif
-		m_transactions.erase(i++);
-		timeouts.push_back(o);
+		timeouts.push_back(t->o);
+		unlink(t);
+		m_transaction_pool.destroy(t);
 	}
-	
-	std::for_each(timeouts.begin(), timeouts.end(), boost::bind(&observer::timeout, _1));
-	timeouts.clear();
+	m_num_timeouts += timeouts.size();
 
-	for (transactions_t::iterator i = m_transactions.begin();
-		i != m_transactions.end(); ++i)
-	{
-		observer_ptr o = *i;
+	// shrink the hash table after a burst of requests
+	if (m_transactions.size() > 64 && m_num_transactions < int(m_transactions.size()) / 8)
+		rehash(m_transactions.size() / 2);
 
-		// if we reach an observer that hasn't timed out
-		// break, because every observer after this one will
-		// also not have timed out yet
-		time_duration diff = now - o->sent();
-		if (diff < seconds(short_timeout))
-		{
-			ret = seconds(short_timeout) - diff;
-			break;
-		}
-		
-		if (o->has_short_timeout()) continue;
+	// the callbacks may issue new requests, so they can't be
+	// called while we're iterating over the transactions
+	std::for_each(timeouts.begin(), timeouts.end(), boost::bind(&observer::timeout, _1));
+	std::for_each(short_timeouts.begin(), short_timeouts.end()
+		, boost::bind(&observer::short_timeout, _1));
 
-		// TODO: don't call short_timeout() again if we've
-		// already called it once
-		timeouts.push_back(o);
-	}
+	if (m_num_transactions == 0) return seconds(short_timeout);
 
-	std::for_each(timeouts.begin(), timeouts.end(), boost::bind(&observer::short_timeout, _1));
-	
+	// come back when the next transaction is due to time out
+	time_duration ret = m_start + milliseconds(boost::int64_t(m_timeouts.next_expiry())
+		* timeout_tick) - time_now();
+	if (ret < milliseconds(0)) ret = milliseconds(0);
 	return ret;
 }
 
@@ -475,13 +592,33 @@ bool rpc_manager::invoke(entry& e, udp::endpoint target_addr
 		<< e["q"].string() << " -> " << target_addr;
 #endif
 
-	if (m_sock->send_packet(e, target_addr, 1))
+	// allocate the transaction before sending, so that a request that
+	// went out always has one to match the reply against
+	transaction* t = m_transaction_pool.malloc();
+	if (t == 0) return false;
+
+	if (!m_sock->send_packet(e, target_addr, 1))
 	{
-		m_transactions.push_back(o);
+		m_transaction_pool.free(t);
+		return true;
+	}
+
+	new (t) transaction;
+	t->o = o;
+	t->short_timeout = false;
+	t->timer.userdata = t;
+	m_timeouts.schedule(&t->timer, wheel_tick(o->sent() + seconds(short_timeout)));
+
+	if (m_num_transactions >= int(m_transactions.size()))
+		rehash(m_transactions.size() * 2);
+	transaction*& b = m_transactions[bucket_for(o->transaction_id()
+		, target_addr.address())];
+	t->next = b;
+	b = t;
+	++m_num_transactions;
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
-		o->m_was_sent = true;
+	o->m_was_sent = true;
 #endif
-	}
 	return true;
 }
 
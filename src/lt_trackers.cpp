@@ -53,6 +53,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/bt_peer_connection.hpp"
 #include "libtorrent/hasher.hpp"
 #include "libtorrent/bencode.hpp"
+#include "libtorrent/bencode_writer.hpp"
+#include "libtorrent/bdecode.hpp"
 #include "libtorrent/torrent.hpp"
 #include "libtorrent/extensions.hpp"
 #include "libtorrent/extensions/ut_metadata.hpp"
@@ -92,23 +94,25 @@ namespace libtorrent { namespace
 			m_2_minutes = 0;
 
 			// build tracker diff
-			entry tex;
-			entry::list_type& added = tex["added"].list();
-			std::vector<announce_entry> const& trackers = m_torrent.trackers();
-			for (std::vector<announce_entry>::const_iterator i = trackers.begin()
-				, end(trackers.end()); i != end; ++i)
+			m_lt_trackers_msg.clear();
+			vector_sink out(m_lt_trackers_msg);
 			{
-				std::vector<announce_entry>::const_iterator k = std::find_if(
-					m_old_trackers.begin(), m_old_trackers.end()
-					, boost::bind(&announce_entry::url, _1) == i->url);
-				if (k != m_old_trackers.end()) continue;
-				if (!send_tracker(*i)) continue;
-				m_old_trackers.push_back(*i);
-				++m_updates;
-				added.push_back(i->url);
+				bencode_dict<vector_sink> tex(out);
+				bencode_list<vector_sink> added(tex, "added");
+				std::vector<announce_entry> const& trackers = m_torrent.trackers();
+				for (std::vector<announce_entry>::const_iterator i = trackers.begin()
+					, end(trackers.end()); i != end; ++i)
+				{
+					std::vector<announce_entry>::const_iterator k = std::find_if(
+						m_old_trackers.begin(), m_old_trackers.end()
+						, boost::bind(&announce_entry::url, _1) == i->url);
+					if (k != m_old_trackers.end()) continue;
+					if (!send_tracker(*i)) continue;
+					m_old_trackers.push_back(*i);
+					++m_updates;
+					added.string(i->url);
+				}
 			}
-			m_lt_trackers_msg.clear();
-			bencode(std::back_inserter(m_lt_trackers_msg), tex);
 			if (m_updates > 0) update_list_hash();
 		}
 
@@ -192,16 +196,16 @@ namespace libtorrent { namespace
 			if (m_message_index == 0) return false;
 			if (!m_pc.packet_finished()) return true;
 
-			lazy_entry msg;
+			bdecode_node msg;
 			error_code ec;
-			int ret = lazy_bdecode(body.begin, body.end, msg, ec);
-			if (ret != 0 || msg.type() != lazy_entry::dict_t)
+			int ret = bdecode(body.begin, body.end, msg, ec);
+			if (ret != 0 || msg.type() != bdecode_node::dict_t)
 			{
 				m_pc.disconnect(errors::invalid_lt_tracker_message, 2);
 				return true;
 			}
 
-			lazy_entry const* added = msg.dict_find_list("added");
+			bdecode_node added = msg.dict_find_list("added");
 
 #ifdef TORRENT_VERBOSE_LOGGING
 			std::stringstream log_line;
@@ -210,7 +214,7 @@ namespace libtorrent { namespace
 #endif
 
 			// invalid tex message
-			if (added == 0)
+			if (!added)
 			{
 #ifdef TORRENT_VERBOSE_LOGGING
 				(*m_pc.m_logger) << time_now_string() << " <== LT_TEX [ NOT A DICTIONARY ]\n";
@@ -218,9 +222,9 @@ namespace libtorrent { namespace
 				return true;
 			}
 
-			for (int i = 0; i < added->list_size(); ++i)
+			for (int i = 0; i < added.list_size(); ++i)
 			{
-				announce_entry e(added->list_string_value_at(i));
+				announce_entry e(added.list_string_value_at(i));
 				if (e.url.empty()) continue;
 				e.fail_limit = 3;
 				e.send_stats = false;
@@ -263,15 +267,8 @@ namespace libtorrent { namespace
 
 			std::vector<char> const& tex_msg = m_tp.get_lt_tex_msg();
 
-			char msg[6];
-			char* ptr = msg;
-
-			detail::write_uint32(1 + 1 + tex_msg.size(), ptr);
-			detail::write_uint8(bt_peer_connection::msg_extended, ptr);
-			detail::write_uint8(m_message_index, ptr);
-			m_pc.send_buffer(msg, sizeof(msg));
-			m_pc.send_buffer(&tex_msg[0], tex_msg.size());
-			m_pc.setup_send();
+			bt_peer_connection::extended_message msg(m_pc, m_message_index);
+			msg.write(&tex_msg[0], tex_msg.size());
 		}
 
 		void send_full_tex_list() const
@@ -283,34 +280,25 @@ namespace libtorrent { namespace
 			log_line << time_now_string() << " ==> LT_TEX [ "
 				"added: ";
 #endif
-			entry tex;
-			entry::list_type& added = tex["added"].list();
-			for (std::vector<announce_entry>::const_iterator i = m_tp.trackers().begin()
-				, end(m_tp.trackers().end()); i != end; ++i)
+			bt_peer_connection::extended_message msg(m_pc, m_message_index);
 			{
-				if (!send_tracker(*i)) continue;
-				added.push_back(i->url);
+				bencode_dict<bt_peer_connection::extended_message> tex(msg);
+				bencode_list<bt_peer_connection::extended_message> added(tex, "added");
+				for (std::vector<announce_entry>::const_iterator i = m_tp.trackers().begin()
+					, end(m_tp.trackers().end()); i != end; ++i)
+				{
+					if (!send_tracker(*i)) continue;
+					added.string(i->url);
 #ifdef TORRENT_VERBOSE_LOGGING
-				log_line << i->url << " ";
+					log_line << i->url << " ";
 #endif
+				}
 			}
-			std::vector<char> tex_msg;
-			bencode(std::back_inserter(tex_msg), tex);
 
 #ifdef TORRENT_VERBOSE_LOGGING
 			log_line << "]\n";
 			(*m_pc.m_logger) << log_line.str();
 #endif
-
-			char msg[6];
-			char* ptr = msg;
-
-			detail::write_uint32(1 + 1 + tex_msg.size(), ptr);
-			detail::write_uint8(bt_peer_connection::msg_extended, ptr);
-			detail::write_uint8(m_message_index, ptr);
-			m_pc.send_buffer(msg, sizeof(msg));
-			m_pc.send_buffer(&tex_msg[0], tex_msg.size());
-			m_pc.setup_send();
 		}
 
 		// this is the message index the remote peer uses
@@ -118,6 +118,8 @@ namespace libtorrent
 #endif
         m_ses(ses)
         , m_max_out_request_queue(m_ses.settings().max_out_request_queue)
+        , m_max_large_request(0)
+        , m_min_desired_queue_size(min_request_queue)
         , m_work(ses.m_io_service)
         , m_last_piece(time_now())
         , m_last_request(time_now())
@@ -1392,9 +1394,7 @@ namespace libtorrent
 
 		if (m_request_queue.empty() && m_download_queue.size() < 2)
 		{
-#ifdef TORRENT_STATS
-			++m_ses.m_reject_piece_picks;
-#endif
+			m_ses.inc_stats_counter(counters::reject_piece_picks);
 			request_a_block(*t, *this);
 			send_block_requests();
 		}
@@ -1486,9 +1486,7 @@ namespace libtorrent
 
 		if (is_interesting())
 		{
-#ifdef TORRENT_STATS
-			++m_ses.m_unchoke_piece_picks;
-#endif
+			m_ses.inc_stats_counter(counters::unchoke_piece_picks);
 			request_a_block(*t, *this);
 			send_block_requests();
 		}
@@ -1986,9 +1984,7 @@ namespace libtorrent
 		boost::shared_ptr<torrent> t = m_torrent.lock();
 		TORRENT_ASSERT(t);
 
-#ifdef TORRENT_STATS
-		++m_ses.m_piece_requests;
-#endif
+		m_ses.inc_stats_counter(counters::piece_requests);
 
 #if defined TORRENT_VERBOSE_LOGGING
 		peer_log("<== REQUEST [ piece: %d s: %d l: %d ]"
@@ -1998,9 +1994,7 @@ namespace libtorrent
 		if (t->super_seeding()
 			&& !super_seeded_piece(r.piece))
 		{
-#ifdef TORRENT_STATS
-			++m_ses.m_invalid_piece_requests;
-#endif
+			m_ses.inc_stats_counter(counters::invalid_piece_requests);
 			++m_num_invalid_requests;
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_ERROR_LOGGING
 			peer_log("*** INVALID_REQUEST [ piece not superseeded "
@@ -2039,9 +2033,7 @@ namespace libtorrent
 
 		if (!t->valid_metadata())
 		{
-#ifdef TORRENT_STATS
-			++m_ses.m_invalid_piece_requests;
-#endif
+			m_ses.inc_stats_counter(counters::invalid_piece_requests);
 			// if we don't have valid metadata yet,
 			// we shouldn't get a request
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_ERROR_LOGGING
@@ -2055,9 +2047,7 @@ namespace libtorrent
 
 		if (int(m_requests.size()) > m_ses.settings().max_allowed_in_request_queue)
 		{
-#ifdef TORRENT_STATS
-			++m_ses.m_max_piece_requests;
-#endif
+			m_ses.inc_stats_counter(counters::max_piece_requests);
 			// don't allow clients to abuse our
 			// memory consumption.
 			// ignore requests if the client
@@ -2095,9 +2085,7 @@ namespace libtorrent
 				peer_log(" ==> REJECT_PIECE [ piece: %d | s: %d | l: %d ]"
 					, r.piece, r.start, r.length);
 #endif
-#ifdef TORRENT_STATS
-				++m_ses.m_choked_piece_requests;
-#endif
+				m_ses.inc_stats_counter(counters::choked_piece_requests);
 				write_reject_request(r);
 				++m_choke_rejects;
 
@@ -2132,9 +2120,7 @@ namespace libtorrent
 		}
 		else
 		{
-#ifdef TORRENT_STATS
-			++m_ses.m_invalid_piece_requests;
-#endif
+			m_ses.inc_stats_counter(counters::invalid_piece_requests);
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_ERROR_LOGGING
 			peer_log("*** INVALID_REQUEST [ "
 				"i: %d t: %d n: %d h: %d block_limit: %d ]"
@@ -2489,9 +2475,7 @@ namespace libtorrent
 			if (!m_download_queue.empty())
 				m_requested = now;
 
-#ifdef TORRENT_STATS
-			++m_ses.m_incoming_redundant_piece_picks;
-#endif
+			m_ses.inc_stats_counter(counters::incoming_redundant_piece_picks);
 			request_a_block(*t, *this);
 			send_block_requests();
 			return;
@@ -2584,9 +2568,7 @@ namespace libtorrent
 
 		if (is_disconnecting()) return;
 
-#ifdef TORRENT_STATS
-		++m_ses.m_incoming_piece_picks;
-#endif
+		m_ses.inc_stats_counter(counters::incoming_piece_picks);
 		request_a_block(*t, *this);
 		send_block_requests();
 	}
@@ -2594,9 +2576,7 @@ namespace libtorrent
 	void peer_connection::on_disk_write_complete(int ret, disk_io_job const& j
 		, peer_request p, boost::shared_ptr<torrent> t)
 	{
-#ifdef TORRENT_STATS
-		++m_ses.m_num_messages[aux::session_impl::on_disk_write_counter];
-#endif
+		m_ses.inc_stats_counter(counters::on_disk_write_counter);
 		TORRENT_ASSERT(m_ses.is_network_thread());
 
 		// flush send buffer at the end of this scope
@@ -2676,9 +2656,7 @@ namespace libtorrent
 
 		if (i != m_requests.end())
 		{
-#ifdef TORRENT_STATS
-			++m_ses.m_cancelled_piece_requests;
-#endif
+			m_ses.inc_stats_counter(counters::cancelled_piece_requests);
 			m_requests.erase(i);
 #ifdef TORRENT_VERBOSE_LOGGING
 			peer_log("==> REJECT_PIECE [ piece: %d s: %d l: %d ]"
@@ -3165,9 +3143,7 @@ namespace libtorrent
 				continue;
 			}
 			peer_request const& r = *i;
-#ifdef TORRENT_STATS
-			++m_ses.m_choked_piece_requests;
-#endif
+			m_ses.inc_stats_counter(counters::choked_piece_requests);
 #ifdef TORRENT_VERBOSE_LOGGING
 			peer_log("==> REJECT_PIECE [ piece: %d s: %d l: %d ]"
 				, r.piece , r.start , r.length);
@@ -3373,6 +3349,11 @@ namespace libtorrent
 					if (front.block.piece_index * blocks_per_piece + front.block.block_index
 						!= block.block.piece_index * blocks_per_piece + block.block.block_index + 1)
 						break;
+					// don't let the request grow beyond the limit. The remaining
+					// blocks are sent as separate, pipelined, requests
+					if (m_max_large_request > 0
+						&& r.length + t->block_size() > m_max_large_request)
+						break;
 					block = m_request_queue.front();
 					m_request_queue.erase(m_request_queue.begin());
 					TORRENT_ASSERT(verify_piece(t->to_req(block.block)));
@@ -3452,9 +3433,7 @@ namespace libtorrent
 		(*m_ses.m_logger) << time_now_string() << " CONNECTION FAILED: " << print_endpoint(m_remote) << "\n";
 #endif
 
-#ifdef TORRENT_STATS
-		++m_ses.m_connect_timeouts;
-#endif
+		m_ses.inc_stats_counter(counters::connect_timeouts);
 
 		boost::shared_ptr<torrent> t = m_torrent.lock();
 		TORRENT_ASSERT(!m_connecting || t);
@@ -3542,62 +3521,60 @@ namespace libtorrent
 		// for outgoing connections however, why would we get this?
 		TORRENT_ASSERT(ec != error::invalid_argument || !m_outgoing);
 
-#ifdef TORRENT_STATS
-		++m_ses.m_disconnected_peers;
-		if (error == 2) ++m_ses.m_error_peers;
-		if (ec == error::connection_reset) ++m_ses.m_connreset_peers;
-		else if (ec == error::eof) ++m_ses.m_eof_peers;
-		else if (ec == error::connection_refused) ++m_ses.m_connrefused_peers;
-		else if (ec == error::connection_aborted) ++m_ses.m_connaborted_peers;
-		else if (ec == error::no_permission) ++m_ses.m_perm_peers;
-		else if (ec == error::no_buffer_space) ++m_ses.m_buffer_peers;
-		else if (ec == error::host_unreachable) ++m_ses.m_unreachable_peers;
-		else if (ec == error::broken_pipe) ++m_ses.m_broken_pipe_peers;
-		else if (ec == error::address_in_use) ++m_ses.m_addrinuse_peers;
-		else if (ec == error::access_denied) ++m_ses.m_no_access_peers;
-		else if (ec == error::invalid_argument) ++m_ses.m_invalid_arg_peers;
-		else if (ec == error::operation_aborted) ++m_ses.m_aborted_peers;
+		m_ses.inc_stats_counter(counters::disconnected_peers);
+		if (error == 2) m_ses.inc_stats_counter(counters::error_peers);
+		if (ec == error::connection_reset) m_ses.inc_stats_counter(counters::connreset_peers);
+		else if (ec == error::eof) m_ses.inc_stats_counter(counters::eof_peers);
+		else if (ec == error::connection_refused) m_ses.inc_stats_counter(counters::connrefused_peers);
+		else if (ec == error::connection_aborted) m_ses.inc_stats_counter(counters::connaborted_peers);
+		else if (ec == error::no_permission) m_ses.inc_stats_counter(counters::perm_peers);
+		else if (ec == error::no_buffer_space) m_ses.inc_stats_counter(counters::buffer_peers);
+		else if (ec == error::host_unreachable) m_ses.inc_stats_counter(counters::unreachable_peers);
+		else if (ec == error::broken_pipe) m_ses.inc_stats_counter(counters::broken_pipe_peers);
+		else if (ec == error::address_in_use) m_ses.inc_stats_counter(counters::addrinuse_peers);
+		else if (ec == error::access_denied) m_ses.inc_stats_counter(counters::no_access_peers);
+		else if (ec == error::invalid_argument) m_ses.inc_stats_counter(counters::invalid_arg_peers);
+		else if (ec == error::operation_aborted) m_ses.inc_stats_counter(counters::aborted_peers);
 		else if (ec == error_code(errors::upload_upload_connection)
 			|| ec == error_code(errors::uninteresting_upload_peer)
 			|| ec == error_code(errors::torrent_aborted)
 			|| ec == error_code(errors::self_connection)
 			|| ec == error_code(errors::torrent_paused))
-			++m_ses.m_uninteresting_peers;
+			m_ses.inc_stats_counter(counters::uninteresting_peers);
 
 		if (ec == error_code(errors::timed_out)
 			|| ec == error::timed_out)
-			++m_ses.m_transport_timeout_peers;
+			m_ses.inc_stats_counter(counters::transport_timeout_peers);
 
 		if (ec == error_code(errors::timed_out_inactivity)
 			|| ec == error_code(errors::timed_out_no_request)
 			|| ec == error_code(errors::timed_out_no_interest))
-			++m_ses.m_timeout_peers;
+			m_ses.inc_stats_counter(counters::timeout_peers);
 
 		if (ec == error_code(errors::no_memory))
-			++m_ses.m_no_memory_peers;
+			m_ses.inc_stats_counter(counters::no_memory_peers);
 
 		if (ec == error_code(errors::too_many_connections))
-			++m_ses.m_too_many_peers;
+			m_ses.inc_stats_counter(counters::too_many_peers);
 
 		if (ec == error_code(errors::timed_out_no_handshake))
-			++m_ses.m_connect_timeouts;
+			m_ses.inc_stats_counter(counters::connect_timeouts);
 
-		if (is_utp(*m_socket)) ++m_ses.m_error_utp_peers;
-		else ++m_ses.m_error_tcp_peers;
+		if (is_utp(*m_socket)) m_ses.inc_stats_counter(counters::error_utp_peers);
+		else m_ses.inc_stats_counter(counters::error_tcp_peers);
 
-		if (m_outgoing) ++m_ses.m_error_outgoing_peers;
-		else ++m_ses.m_error_incoming_peers;
+		if (m_outgoing) m_ses.inc_stats_counter(counters::error_outgoing_peers);
+		else m_ses.inc_stats_counter(counters::error_incoming_peers);
 
 
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		if (type() == bittorrent_connection)
 		{
 			bt_peer_connection* bt = static_cast<bt_peer_connection*>(this);
-			if (bt->supports_encryption()) ++m_ses.m_error_encrypted_peers;
-			if (bt->rc4_encrypted() && bt->supports_encryption()) ++m_ses.m_error_rc4_peers;
+			if (bt->supports_encryption()) m_ses.inc_stats_counter(counters::error_encrypted_peers);
+			if (bt->rc4_encrypted() && bt->supports_encryption()) m_ses.inc_stats_counter(counters::error_rc4_peers);
 		}
 #endif // TORRENT_DISABLE_ENCRYPTION
-#endif
 
 		// we cannot do this in a constructor
 		TORRENT_ASSERT(m_in_constructor == false);
@@ -4074,12 +4051,15 @@ namespace libtorrent
 
 		TORRENT_ASSERT(block_size > 0);
 
-		m_desired_queue_size = queue_time * download_rate / block_size;
+		int queue_size = queue_time * download_rate / block_size;
 
-		if (m_desired_queue_size > m_max_out_request_queue)
-			m_desired_queue_size = m_max_out_request_queue;
-		if (m_desired_queue_size < min_request_queue)
-			m_desired_queue_size = min_request_queue;
+		if (queue_size > m_max_out_request_queue)
+			queue_size = m_max_out_request_queue;
+		if (queue_size < m_min_desired_queue_size)
+			queue_size = m_min_desired_queue_size;
+		// m_desired_queue_size is 16 bits
+		if (queue_size > 0xffff) queue_size = 0xffff;
+		m_desired_queue_size = queue_size;
 	}
 
 	void peer_connection::second_tick(int tick_interval_ms)
@@ -4172,9 +4152,7 @@ namespace libtorrent
 			// might not be any unrequested blocks anymore, so
 			// we should try to pick another block to see
 			// if we can pick a busy one
-#ifdef TORRENT_STATS
-			++m_ses.m_end_game_piece_picks;
-#endif
+			m_ses.inc_stats_counter(counters::end_game_piece_picks);
 			m_last_request = now;
 			request_a_block(*t, *this);
 			if (m_disconnecting) return;
@@ -4301,7 +4279,10 @@ namespace libtorrent
 			{
 				std::pair<const int, int>* as_stats = peer_info_struct()->inet_as;
 				if (as_stats && as_stats->second < m_download_rate_peak)
+				{
 					as_stats->second = m_download_rate_peak;
+					m_ses.as_rank_changed();
+				}
 			}
 #endif
 		}
@@ -4453,9 +4434,7 @@ namespace libtorrent
 		// picking the same block again, stalling the
 		// same piece indefinitely.
 		m_desired_queue_size = 2;
-#ifdef TORRENT_STATS
-		++m_ses.m_snubbed_piece_picks;
-#endif
+		m_ses.inc_stats_counter(counters::snubbed_piece_picks);
 		request_a_block(*t, *this);
 
 		// the block we just picked (potentially)
@@ -4607,9 +4586,7 @@ namespace libtorrent
 		// all completed disk operations
 		cork _c(*this);
 
-#ifdef TORRENT_STATS
-		++m_ses.m_num_messages[aux::session_impl::on_disk_read_counter];
-#endif
+		m_ses.inc_stats_counter(counters::on_disk_read_counter);
 		TORRENT_ASSERT(m_ses.is_network_thread());
 
 		m_reading_bytes -= r.length;
@@ -4913,6 +4890,7 @@ namespace libtorrent
 #ifdef TORRENT_VERBOSE_LOGGING
 		peer_log(">>> ASYNC_WRITE [ bytes: %d ]", amount_to_send);
 #endif
+		prepare_send_buffer();
 		std::list<asio::const_buffer> const& vec = m_send_buffer.build_iovec(amount_to_send);
 #if defined TORRENT_ASIO_DEBUGGING
 		add_outstanding_async("peer_connection::on_send_data");
@@ -5179,6 +5157,19 @@ namespace libtorrent
 		if (flags == message_type_request)
 			m_requests_in_buffer.push_back(m_send_buffer.size() + size);
 
+		// this is unchanged from before copy_send_buffer() was split out:
+		// a message that fits in the last chunk doesn't initiate a send.
+		// That chunk was queued by an earlier call, which already did, and
+		// on_send_data() calls setup_send() again while there's data left
+		int const free_space = m_send_buffer.space_in_last_buffer();
+		if (!copy_send_buffer(buf, size, fun, userdata)) return;
+		if (size <= free_space) return;
+		setup_send();
+	}
+
+	bool peer_connection::copy_send_buffer(char const* buf, int size
+		, void (*fun)(char*, int, void*), void* userdata)
+	{
 		int free_space = m_send_buffer.space_in_last_buffer();
 		if (free_space > size) free_space = size;
 		if (free_space > 0)
@@ -5194,20 +5185,19 @@ namespace libtorrent
 			m_ses.log_buffer_usage();
 #endif
 		}
-		if (size <= 0) return;
+		if (size <= 0) return true;
 
 #if defined TORRENT_STATS && defined TORRENT_DISK_STATS
 		m_ses.m_buffer_usage_logger << log_time() << " send_buffer_alloc: " << size << std::endl;
 		m_ses.log_buffer_usage();
 #endif
-		int i = 0;
 		while (size > 0)
 		{
 			char* chain_buf = m_ses.allocate_buffer();
 			if (chain_buf == 0)
 			{
 				disconnect(errors::no_memory);
-				return;
+				return false;
 			}
 
 			int buf_size = (std::min)(int(aux::session_impl::send_buffer_size), size);
@@ -5217,9 +5207,26 @@ namespace libtorrent
 			size -= buf_size;
 			m_send_buffer.append_buffer(chain_buf, aux::session_impl::send_buffer_size, buf_size
 				, boost::bind(&session_impl::free_buffer, boost::ref(m_ses), _1));
-			++i;
 		}
-		setup_send();
+		return true;
+	}
+
+	char* peer_connection::allocate_send_buffer(int size)
+	{
+		TORRENT_ASSERT(size > 0);
+		TORRENT_ASSERT(size <= aux::session_impl::send_buffer_size);
+		char* ret = m_send_buffer.allocate_appendix(size);
+		if (ret) return ret;
+
+		ret = m_ses.allocate_buffer();
+		if (ret == 0)
+		{
+			disconnect(errors::no_memory);
+			return 0;
+		}
+		m_send_buffer.append_buffer(ret, aux::session_impl::send_buffer_size, size
+			, boost::bind(&session_impl::free_buffer, boost::ref(m_ses), _1));
+		return ret;
 	}
 
 	template<class T>
@@ -5240,15 +5247,13 @@ namespace libtorrent
 	void peer_connection::on_receive_data(const error_code& error
 		, std::size_t bytes_transferred)
 	{
-#ifdef TORRENT_STATS
-		++m_ses.m_num_messages[aux::session_impl::on_read_counter];
+		m_ses.inc_stats_counter(counters::on_read_counter);
 		int size = 8;
 		int index = 0;
 		while (bytes_transferred > size + 13) { size <<= 1; ++index; }
-		int num_max = sizeof(m_ses.m_recv_buffer_sizes)/sizeof(m_ses.m_recv_buffer_sizes[0]);
-		if (index >= num_max) index = num_max - 1;
-		++m_ses.m_recv_buffer_sizes[index];
-#endif
+		int num_max = counters::socket_recv_size20 - counters::socket_recv_size3;
+		if (index > num_max) index = num_max;
+		m_ses.inc_stats_counter(counters::socket_recv_size3 + index);
 		TORRENT_ASSERT(m_ses.is_network_thread());
 
 		// keep ourselves alive in until this function exits in
@@ -5624,15 +5629,13 @@ namespace libtorrent
 	void peer_connection::on_send_data(error_code const& error
 		, std::size_t bytes_transferred)
 	{
-#ifdef TORRENT_STATS
-		++m_ses.m_num_messages[aux::session_impl::on_write_counter];
+		m_ses.inc_stats_counter(counters::on_write_counter);
 		int size = 8;
 		int index = 0;
 		while (bytes_transferred > size + 13) { size <<= 1; ++index; }
-		int num_max = sizeof(m_ses.m_send_buffer_sizes)/sizeof(m_ses.m_send_buffer_sizes[0]);
-		if (index >= num_max) index = num_max - 1;
-		++m_ses.m_send_buffer_sizes[index];
-#endif
+		int num_max = counters::socket_send_size20 - counters::socket_send_size3;
+		if (index > num_max) index = num_max;
+		m_ses.inc_stats_counter(counters::socket_send_size3 + index);
 		TORRENT_ASSERT(m_ses.is_network_thread());
 
 #if defined TORRENT_VERBOSE_LOGGING
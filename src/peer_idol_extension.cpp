@@ -18,6 +18,7 @@
 #include "libtorrent/peer_connection.hpp"
 #include "libtorrent/bt_peer_connection.hpp"
 #include "libtorrent/bencode.hpp"
+#include "libtorrent/bencode_writer.hpp"
 #include "libtorrent/torrent.hpp"
 #include "libtorrent/extensions.hpp"
 #include "libtorrent/broadcast_socket.hpp"
@@ -28,7 +29,7 @@
 #include "libtorrent/extensions/peer_idol.hpp"
 
 #ifdef TORRENT_VERBOSE_LOGGING
-#include "libtorrent/lazy_entry.hpp"
+#include "libtorrent/bdecode.hpp"
 #endif
 
 namespace libtorrent {
@@ -85,54 +86,48 @@ namespace libtorrent {
             virtual void add_handshake(entry& h) {}
 
             void send_best_peers() {
-                // copy peers from the torrrent in a peer_connection
-                // vector in order to sort it in the next step
-                std::vector<peer_connection*> peers;
+                // pick the (up to) three non-seeds with the best payload
+                // download rate. They're kept sorted according to
+                // payload_download_compare, on the stack
+                enum { max_votes = 3 };
+                peer_connection* peers[max_votes];
+                int vote_size = 0;
                 for (torrent::peer_iterator i = m_torrent.begin(),
                          end(m_torrent.end()); i != end; ++i) {
                     peer_connection* peer = *i;
-                    if (!peer->is_seed()) {
-                        peers.push_back(peer);
-                    }
-                    else {
+                    if (peer->is_seed()) {
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
                         (*m_torrent.session().m_logger) << time_now_string() << " [peer_idol]" << " ignoring " << peer->remote() << " because it is a seeder\n";
 #endif
+                        continue;
                     }
-                }
 
-                // sort all peers according to their upload rate
-                std::sort(peers.begin(), peers.end()
-                          , boost::bind(&peer_connection::payload_download_compare, _1, _2));
-
-                entry pid;
-                std::string& pla = pid["added"].string();
-                std::back_insert_iterator<std::string> pla_out(pla);
-
-
-                int vote_size = 0;
+                    int j = vote_size;
+                    while (j > 0 && peer->payload_download_compare(peers[j - 1])) --j;
+                    if (j == max_votes) continue;
+                    if (vote_size < max_votes) ++vote_size;
+                    for (int k = vote_size - 1; k > j; --k) peers[k] = peers[k - 1];
+                    peers[j] = peer;
+                }
 
-                if (peers.size() == 0) {
+                if (vote_size == 0) {
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
-                    (*m_torrent.session().m_logger) << time_now_string() << " [peer_idol] to less peers to send a peer idol message: " << peers.size() << "\n";
+                    (*m_torrent.session().m_logger) << time_now_string() << " [peer_idol] to less peers to send a peer idol message: " << vote_size << "\n";
 #endif
                     return;
                 }
-                else if (peers.size() > 3) {
-                    vote_size = 3;
-                }
-                else if (peers.size() < 3 and peers.size() > 0) {
-                    vote_size = peers.size();
-                }
+
+                char pla[max_votes * 6];
+                char* pla_out = pla;
 
                 for (int i = 0; i < vote_size; ++i) {
-                    tcp::endpoint  remote = peers.at(i)->remote();
+                    tcp::endpoint  remote = peers[i]->remote();
 
                     // if the peer has told us which port its listening on,
                     // use that port. But only if we didn't connect to the peer.
                     // if we connected to it, use the port we know works
                     policy::peer *pi = 0;
-                    if ((pi = peers.at(i)->peer_info_struct()) && pi->port > 0)
+                    if ((pi = peers[i]->peer_info_struct()) && pi->port > 0)
                         remote.port(pi->port);
 
                     if (remote.address().is_v4()) {
@@ -143,18 +138,12 @@ namespace libtorrent {
                     }
                 }
 
-                std::vector<char> pid_msg;
-                bencode(std::back_inserter(pid_msg), pid);
-
-                char msg[6];
-                char* ptr = msg;
-
-                detail::write_uint32(1 + 1 + pid_msg.size(), ptr);
-                detail::write_uint8(bt_peer_connection::msg_extended, ptr);
-                detail::write_uint8(m_peer_idol_extension_id, ptr);
-
-                m_pc.send_buffer(msg, sizeof(msg));
-                m_pc.send_buffer(&pid_msg[0], pid_msg.size());
+                // bencode the votes straight into the send buffer
+                {
+                    bt_peer_connection::extended_message msg(m_pc, m_peer_idol_extension_id);
+                    bencode_dict<bt_peer_connection::extended_message> pid(msg);
+                    pid.string("added", pla, pla_out - pla);
+                }
 
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
                 (*m_torrent.session().m_logger) << time_now_string() << " [peer_idol]" << " send peer vote\n";
@@ -175,11 +164,11 @@ namespace libtorrent {
                                                 << "\n";
 #endif
 
-                lazy_entry pid_msg;
+                bdecode_node pid_msg;
                 error_code ec;
-                int ret = lazy_bdecode(body.begin, body.end, pid_msg, ec);
+                int ret = bdecode(body.begin, body.end, pid_msg, ec);
 
-                if (ret != 0 || pid_msg.type() != lazy_entry::dict_t) {
+                if (ret != 0 || pid_msg.type() != bdecode_node::dict_t) {
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
                     (*m_torrent.session().m_logger) << time_now_string() << " [peer_idol] error parsing bencoded peer vote,"
                                                     << ", length: " << length
@@ -194,14 +183,15 @@ namespace libtorrent {
                 rank_points[1] = 2;
                 rank_points[2] = 1;
 
-                lazy_entry const* p = pid_msg.dict_find_string("added");
-                char const* in = p->string_ptr();
+                bdecode_node p = pid_msg.dict_find_string("added");
+                if (!p) return true;
+                char const* in = p.string_ptr();
 
                 tcp::endpoint votes[3];
                 peer_connection* votes_valid[3]   = {NULL};
                 peer_connection* votes_invalid[3] = {NULL};
 
-                int num_peers = p->string_length() / 6;
+                int num_peers = p.string_length() / 6;
 
                 for (int i = 0; i < num_peers; ++i) {
                     votes[i] = detail::read_v4_endpoint<tcp::endpoint>(in);
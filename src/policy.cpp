@@ -66,20 +66,60 @@ namespace
 {
 	using namespace libtorrent;
 
-	struct match_peer_endpoint
+	// the finalizer from murmur hash 3. It's used to spread
+	// the bits of the keys in the endpoint index, since it's
+	// indexed by the low bits of the hash
+	boost::uint32_t mix_hash(boost::uint32_t h)
 	{
-		match_peer_endpoint(tcp::endpoint const& ep)
-			: m_ep(ep)
-		{}
+		h ^= h >> 16;
+		h *= 0x85ebca6b;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35;
+		h ^= h >> 16;
+		return h;
+	}
 
-		bool operator()(policy::peer const* p) const
+	boost::uint32_t address_hash(address const& a)
+	{
+#if TORRENT_USE_IPV6
+		if (a.is_v6())
 		{
-			TORRENT_ASSERT(p->in_use);
-			return p->address() == m_ep.address() && p->port == m_ep.port();
+			address_v6::bytes_type b = a.to_v6().to_bytes();
+			boost::uint32_t ret = 0;
+			for (int i = 0; i < int(b.size()); i += 4)
+			{
+				ret = mix_hash(ret ^ ((boost::uint32_t(b[i]) << 24)
+					| (boost::uint32_t(b[i+1]) << 16)
+					| (boost::uint32_t(b[i+2]) << 8)
+					| boost::uint32_t(b[i+3])));
+			}
+			return ret;
 		}
+#endif
+		return mix_hash(a.to_v4().to_ulong());
+	}
 
-		tcp::endpoint const& m_ep;
-	};
+#if TORRENT_USE_I2P
+	boost::uint32_t destination_hash(char const* dest)
+	{
+		// FNV-1a
+		boost::uint32_t ret = 2166136261u;
+		for (; *dest; ++dest)
+		{
+			ret ^= boost::uint8_t(*dest);
+			ret *= 16777619;
+		}
+		return mix_hash(ret);
+	}
+#endif
+
+	boost::uint32_t peer_hash(policy::peer const* p)
+	{
+#if TORRENT_USE_I2P
+		if (p->is_i2p_addr) return destination_hash(p->dest());
+#endif
+		return address_hash(p->address());
+	}
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 	struct match_peer_connection
@@ -247,9 +287,7 @@ namespace libtorrent
 		for (std::vector<piece_block>::iterator i = interesting_pieces.begin();
 			i != interesting_pieces.end(); ++i)
 		{
-#ifdef TORRENT_STATS
-			++ses.m_piece_picker_blocks;
-#endif
+			ses.inc_stats_counter(counters::piece_picker_blocks);
 
 			if (prefer_whole_pieces == 0 && num_requests <= 0) break;
 
@@ -325,9 +363,7 @@ namespace libtorrent
 			return;
 		}
 
-#ifdef TORRENT_STATS
-		++ses.m_end_game_piece_picker_blocks;
-#endif
+		ses.inc_stats_counter(counters::end_game_piece_picker_blocks);
 
 #ifdef TORRENT_DEBUG
 		piece_picker::downloading_piece st;
@@ -347,10 +383,22 @@ namespace libtorrent
 		: m_torrent(t)
 		, m_locked_peer(NULL)
 		, m_round_robin(0)
-		, m_num_connect_candidates(0)
 		, m_num_seeds(0)
 		, m_finished(false)
-	{ TORRENT_ASSERT(t); }
+		, m_random_candidate_ip(false)
+	{
+		TORRENT_ASSERT(t);
+#ifndef TORRENT_DISABLE_GEO_IP
+		m_as_rank_generation = t->session().as_rank_generation();
+#endif
+	}
+
+	policy::~policy()
+	{
+		TORRENT_ASSERT(m_locked_peer == NULL);
+		for (iterator i = m_peers.begin(), end(m_peers.end()); i != end; ++i)
+			free_peer(*i);
+	}
 
 	// disconnects and removes all peers that are now filtered
 	void policy::ip_filter_updated()
@@ -360,117 +408,326 @@ namespace libtorrent
 		aux::session_impl& ses = m_torrent->session();
 		if (!m_torrent->apply_ip_filter()) return;
 
-		for (iterator i = m_peers.begin(); i != m_peers.end();)
+		for (int i = 0; i < int(m_peers.size());)
 		{
-			if ((ses.m_ip_filter.access((*i)->address()) & ip_filter::blocked) == 0)
+			peer* p = m_peers[i];
+			if ((ses.m_ip_filter.access(p->address()) & ip_filter::blocked) == 0)
 			{
 				++i;
 				continue;
 			}
 
-			if (*i == m_locked_peer)
+			if (p == m_locked_peer)
 			{
 				++i;
 				continue;
 			}
 		
 			if (ses.m_alerts.should_post<peer_blocked_alert>())
-				ses.m_alerts.post_alert(peer_blocked_alert(m_torrent->get_handle(), (*i)->address()));
-
-			int current = i - m_peers.begin();
-			TORRENT_ASSERT(current >= 0);
-			TORRENT_ASSERT(m_peers.size() > 0);
-			TORRENT_ASSERT(i != m_peers.end());
+				ses.m_alerts.post_alert(peer_blocked_alert(m_torrent->get_handle(), p->address()));
 
-			if ((*i)->connection)
+			if (p->connection)
 			{
 				// disconnecting the peer here may also delete the
-				// peer_info_struct. If that is the case, just continue
+				// peer_info_struct. If that is the case, the last peer
+				// in the list has been moved into position i. Just
+				// continue with that one
 				int count = m_peers.size();
-				peer_connection* p = (*i)->connection;
-				
-				p->disconnect(errors::banned_by_ip_filter);
-				// what *i refers to has changed, i.e. cur was deleted
-				if (m_peers.size() < count)
-				{
-					i = m_peers.begin() + current;
-					continue;
-				}
-				TORRENT_ASSERT((*i)->connection == 0
-					|| (*i)->connection->peer_info_struct() == 0);
+				p->connection->disconnect(errors::banned_by_ip_filter);
+				if (int(m_peers.size()) < count) continue;
+
+				TORRENT_ASSERT(p->connection == 0
+					|| p->connection->peer_info_struct() == 0);
 			}
 
-			erase_peer(i);
-			i = m_peers.begin() + current;
+			// this moves the last peer into position i, so
+			// don't step the cursor
+			erase_peer(p);
 		}
 	}
 
-	void policy::erase_peer(policy::peer* p)
+	void policy::erase_peer(iterator i)
 	{
-		INVARIANT_CHECK;
-
-		TORRENT_ASSERT(p->in_use);
-
-		std::pair<iterator, iterator> range = find_peers(p->address());
-		iterator iter = std::find_if(range.first, range.second, match_peer_endpoint(p->ip()));
-		if (iter == range.second) return;
-		erase_peer(iter);
+		TORRENT_ASSERT(i != m_peers.end());
+		erase_peer(*i);
 	}
 
 	// any peer that is erased from m_peers will be
 	// erased through this function. This way we can make
 	// sure that any references to the peer are removed
 	// as well, such as in the piece picker.
-	void policy::erase_peer(iterator i)
+	void policy::erase_peer(policy::peer* p)
 	{
 		INVARIANT_CHECK;
-		TORRENT_ASSERT(i != m_peers.end());
-		TORRENT_ASSERT(m_locked_peer != *i);
+
+		TORRENT_ASSERT(p->in_use);
+		TORRENT_ASSERT(m_locked_peer != p);
+
+		// web seeds are not in the peer list
+		if (p->index >= m_peers.size() || m_peers[p->index] != p) return;
+		const int pos = p->index;
 
 		if (m_torrent->has_picker())
-			m_torrent->picker().clear_peer(*i);
-		if ((*i)->seed) --m_num_seeds;
-		if (is_connect_candidate(**i, m_finished))
+			m_torrent->picker().clear_peer(p);
+		if (p->seed) --m_num_seeds;
+		if (m_candidate_pos[pos] != not_in_list)
+			candidate_erase(m_candidate_pos[pos]);
+
+		// to make this constant time, the hole left by p is
+		// filled with the last peer in the list
+		index_erase(pos);
+		const int last = int(m_peers.size()) - 1;
+		if (pos != last)
 		{
-			TORRENT_ASSERT(m_num_connect_candidates > 0);
-			--m_num_connect_candidates;
+			int slot = index_slot(last);
+			TORRENT_ASSERT(slot >= 0);
+			m_index[slot] = pos;
+			m_peers[pos] = m_peers[last];
+			m_peers[pos]->index = pos;
+			m_rate_limits[pos] = m_rate_limits[last];
+			m_candidate_pos[pos] = m_candidate_pos[last];
 		}
-		TORRENT_ASSERT(m_num_connect_candidates < int(m_peers.size()));
-		if (m_round_robin > i - m_peers.begin()) --m_round_robin;
+		m_peers.pop_back();
+		m_rate_limits.pop_back();
+		m_candidate_pos.pop_back();
 		if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
 
-#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
-		TORRENT_ASSERT((*i)->in_use);
-		(*i)->in_use = false;
+		// don't let the index stay large after the peer list shrunk
+		if (m_index.size() > 32 && m_peers.size() * 8 < m_index.size())
+			index_rehash(m_index.size() / 2);
+
+		free_peer(p);
+	}
+
+	void policy::clear_peer_list()
+	{
+		INVARIANT_CHECK;
+
+		TORRENT_ASSERT(m_locked_peer == NULL);
+
+		for (iterator i = m_peers.begin(), end(m_peers.end()); i != end; ++i)
+		{
+			TORRENT_ASSERT((*i)->connection == 0);
+			if (m_torrent->has_picker())
+				m_torrent->picker().clear_peer(*i);
+			free_peer(*i);
+		}
+
+		// swap with empty vectors to actually free the memory
+		peers_t().swap(m_peers);
+		std::vector<rate_limits>().swap(m_rate_limits);
+		std::vector<boost::uint32_t>().swap(m_index);
+		std::vector<peer*>().swap(m_candidates);
+		std::vector<boost::uint32_t>().swap(m_candidate_pos);
+		m_num_seeds = 0;
+		m_round_robin = 0;
+
+		m_ipv4_peers.release_memory();
+#if TORRENT_USE_IPV6
+		m_ipv6_peers.release_memory();
+#endif
+#if TORRENT_USE_I2P
+		m_i2p_peers.release_memory();
 #endif
+	}
 
+	policy::peer* policy::allocate_peer(tcp::endpoint const& remote
+		, bool connectable, int src)
+	{
+		peer* p = 0;
 #if TORRENT_USE_IPV6
-		if ((*i)->is_v6_addr)
+		if (remote.address().is_v6())
 		{
-			TORRENT_ASSERT(m_torrent->session().m_ipv6_peer_pool.is_from(
-				static_cast<ipv6_peer*>(*i)));
-			m_torrent->session().m_ipv6_peer_pool.destroy(
-				static_cast<ipv6_peer*>(*i));
+			void* mem = m_ipv6_peers.malloc();
+			if (mem == 0) return 0;
+			p = new (mem) ipv6_peer(remote, connectable, src);
 		}
 		else
+#endif
+		{
+			void* mem = m_ipv4_peers.malloc();
+			if (mem == 0) return 0;
+			p = new (mem) ipv4_peer(remote, connectable, src);
+		}
+
+#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
+		p->in_use = true;
+#endif
+		return p;
+	}
+
+	void policy::free_peer(peer* p)
+	{
+		TORRENT_ASSERT(p->in_use);
+#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
+		p->in_use = false;
+#endif
+
+#if TORRENT_USE_IPV6
+		if (p->is_v6_addr)
+		{
+			m_ipv6_peers.destroy(static_cast<ipv6_peer*>(p));
+			return;
+		}
 #endif
 #if TORRENT_USE_I2P
-		if ((*i)->is_i2p_addr)
+		if (p->is_i2p_addr)
 		{
-			TORRENT_ASSERT(m_torrent->session().m_i2p_peer_pool.is_from(
-				static_cast<i2p_peer*>(*i)));
-			m_torrent->session().m_i2p_peer_pool.destroy(
-				static_cast<i2p_peer*>(*i));
+			m_i2p_peers.destroy(static_cast<i2p_peer*>(p));
+			return;
 		}
-		else
 #endif
+		m_ipv4_peers.destroy(static_cast<ipv4_peer*>(p));
+	}
+
+	void policy::add_to_list(peer* p)
+	{
+		p->index = m_peers.size();
+		m_peers.push_back(p);
+		m_rate_limits.push_back(rate_limits());
+		m_candidate_pos.push_back(not_in_list);
+		index_insert(p->index);
+	}
+
+	// returns the slot in m_index that refers to position
+	// pos in m_peers, or -1 if there is none
+	int policy::index_slot(int pos) const
+	{
+		if (m_index.empty()) return -1;
+		const int mask = int(m_index.size()) - 1;
+		for (int i = peer_hash(m_peers[pos]) & mask;
+			m_index[i] != empty_slot; i = (i + 1) & mask)
+		{
+			if (m_index[i] == boost::uint32_t(pos)) return i;
+		}
+		return -1;
+	}
+
+	void policy::index_insert(int pos)
+	{
+		// keep the load factor below 3/4. Rehashing inserts
+		// every peer in m_peers, including this one
+		if (m_peers.size() * 4 > m_index.size() * 3)
 		{
-			TORRENT_ASSERT(m_torrent->session().m_ipv4_peer_pool.is_from(
-				static_cast<ipv4_peer*>(*i)));
-			m_torrent->session().m_ipv4_peer_pool.destroy(
-				static_cast<ipv4_peer*>(*i));
+			index_rehash((std::max)(int(m_index.size()) * 2, 32));
+			return;
 		}
-		m_peers.erase(i);
+
+		const int mask = int(m_index.size()) - 1;
+		int i = peer_hash(m_peers[pos]) & mask;
+		while (m_index[i] != empty_slot) i = (i + 1) & mask;
+		m_index[i] = pos;
+	}
+
+	void policy::index_erase(int pos)
+	{
+		int i = index_slot(pos);
+		TORRENT_ASSERT(i >= 0);
+		if (i < 0) return;
+
+		// to not break the probe sequence of any entry following
+		// this one, shift those entries back into the hole
+		const int mask = int(m_index.size()) - 1;
+		for (int j = (i + 1) & mask; m_index[j] != empty_slot; j = (j + 1) & mask)
+		{
+			int home = peer_hash(m_peers[m_index[j]]) & mask;
+			// if the home slot of the entry at j is cyclically
+			// in (i, j], it can stay where it is
+			if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+				continue;
+			m_index[i] = m_index[j];
+			i = j;
+		}
+		m_index[i] = empty_slot;
+	}
+
+	void policy::index_rehash(int num_slots)
+	{
+		TORRENT_ASSERT((num_slots & (num_slots - 1)) == 0);
+		TORRENT_ASSERT(int(m_peers.size()) < num_slots);
+		m_index.assign(num_slots, boost::uint32_t(empty_slot));
+		const int mask = num_slots - 1;
+		for (int k = 0; k < int(m_peers.size()); ++k)
+		{
+			int i = peer_hash(m_peers[k]) & mask;
+			while (m_index[i] != empty_slot) i = (i + 1) & mask;
+			m_index[i] = k;
+		}
+	}
+
+	policy::peer* policy::find_peer(address const& a) const
+	{
+		if (m_index.empty()) return 0;
+		const int mask = int(m_index.size()) - 1;
+		for (int i = address_hash(a) & mask;
+			m_index[i] != empty_slot; i = (i + 1) & mask)
+		{
+			peer* p = m_peers[m_index[i]];
+#if TORRENT_USE_I2P
+			if (p->is_i2p_addr) continue;
+#endif
+			if (p->address() == a) return p;
+		}
+		return 0;
+	}
+
+	policy::peer* policy::find_peer(tcp::endpoint const& ep) const
+	{
+		if (m_index.empty()) return 0;
+		const int mask = int(m_index.size()) - 1;
+		for (int i = address_hash(ep.address()) & mask;
+			m_index[i] != empty_slot; i = (i + 1) & mask)
+		{
+			peer* p = m_peers[m_index[i]];
+#if TORRENT_USE_I2P
+			if (p->is_i2p_addr) continue;
+#endif
+			if (p->port == ep.port() && p->address() == ep.address()) return p;
+		}
+		return 0;
+	}
+
+#if TORRENT_USE_I2P
+	policy::peer* policy::find_i2p_peer(char const* destination) const
+	{
+		if (m_index.empty()) return 0;
+		const int mask = int(m_index.size()) - 1;
+		for (int i = destination_hash(destination) & mask;
+			m_index[i] != empty_slot; i = (i + 1) & mask)
+		{
+			peer* p = m_peers[m_index[i]];
+			if (!p->is_i2p_addr) continue;
+			if (strcmp(p->dest(), destination) == 0) return p;
+		}
+		return 0;
+	}
+#endif
+
+	size_type policy::memory_usage() const
+	{
+		size_type ret = m_ipv4_peers.allocated_bytes();
+#if TORRENT_USE_IPV6
+		ret += m_ipv6_peers.allocated_bytes();
+#endif
+#if TORRENT_USE_I2P
+		ret += m_i2p_peers.allocated_bytes();
+#endif
+		ret += m_peers.capacity() * sizeof(peer*);
+		ret += m_rate_limits.capacity() * sizeof(rate_limits);
+		ret += m_index.capacity() * sizeof(boost::uint32_t);
+		return ret;
+	}
+
+	int policy::num_allocations() const
+	{
+		int ret = m_ipv4_peers.num_chunks();
+#if TORRENT_USE_IPV6
+		ret += m_ipv6_peers.num_chunks();
+#endif
+#if TORRENT_USE_I2P
+		ret += m_i2p_peers.num_chunks();
+#endif
+		return ret;
 	}
 
 	bool policy::should_erase_immediately(peer const& p) const
@@ -508,8 +765,8 @@ namespace libtorrent
 
 		if (max_peerlist_size == 0 || m_peers.empty()) return;
 
-		int erase_candidate = -1;
-		int force_erase_candidate = -1;
+		peer* erase_candidate = 0;
+		peer* force_erase_candidate = 0;
 
 		TORRENT_ASSERT(m_finished == m_torrent->is_finished());
 
@@ -524,48 +781,46 @@ namespace libtorrent
 			if (int(m_peers.size()) < low_watermark)
 				break;
 
-			if (round_robin == int(m_peers.size())) round_robin = 0;
+			if (round_robin >= int(m_peers.size())) round_robin = 0;
 
 			peer& pe = *m_peers[round_robin];
 			TORRENT_ASSERT(pe.in_use);
-			int current = round_robin;
 
 			if (is_erase_candidate(pe, m_finished)
-				&& (erase_candidate == -1
-					|| !compare_peer_erase(*m_peers[erase_candidate], pe)))
+				&& (erase_candidate == 0
+					|| !compare_peer_erase(*erase_candidate, pe)))
 			{
 				if (should_erase_immediately(pe))
 				{
-					if (erase_candidate > current) --erase_candidate;
-					if (force_erase_candidate > current) --force_erase_candidate;
-					TORRENT_ASSERT(current >= 0 && current < int(m_peers.size()));
-					erase_peer(m_peers.begin() + current);
+					if (erase_candidate == &pe) erase_candidate = 0;
+					if (force_erase_candidate == &pe) force_erase_candidate = 0;
+					// this moves the last peer into this position,
+					// look at that one next
+					erase_peer(&pe);
 					continue;
 				}
 				else
 				{
-					erase_candidate = current;
+					erase_candidate = &pe;
 				}
 			}
 			if (is_force_erase_candidate(pe)
-				&& (force_erase_candidate == -1
-					|| !compare_peer_erase(*m_peers[force_erase_candidate], pe)))
+				&& (force_erase_candidate == 0
+					|| !compare_peer_erase(*force_erase_candidate, pe)))
 			{
-				force_erase_candidate = current;
+				force_erase_candidate = &pe;
 			}
 
 			++round_robin;
 		}
 		
-		if (erase_candidate > -1)
+		if (erase_candidate)
 		{
-			TORRENT_ASSERT(erase_candidate >= 0 && erase_candidate < int(m_peers.size()));
-			erase_peer(m_peers.begin() + erase_candidate);
+			erase_peer(erase_candidate);
 		}
-		else if ((flags & force_erase) && force_erase_candidate > -1)
+		else if ((flags & force_erase) && force_erase_candidate)
 		{
-			TORRENT_ASSERT(force_erase_candidate >= 0 && force_erase_candidate < int(m_peers.size()));
-			erase_peer(m_peers.begin() + force_erase_candidate);
+			erase_peer(force_erase_candidate);
 		}
 	}
 
@@ -578,15 +833,11 @@ namespace libtorrent
 		if (!m_torrent->settings().ban_web_seeds && p->web_seed)
 			return;
 
-		if (is_connect_candidate(*p, m_finished))
-			--m_num_connect_candidates;
-
-#ifdef TORRENT_STATS
 		aux::session_impl& ses = m_torrent->session();
-		++ses.m_num_banned_peers;
-#endif
+		ses.inc_stats_counter(counters::banned_peers);
 
 		p->banned = true;
+		update_connect_candidate(p);
 		TORRENT_ASSERT(!is_connect_candidate(*p, m_finished));
 	}
 
@@ -597,9 +848,8 @@ namespace libtorrent
 		TORRENT_ASSERT(p->in_use);
 		TORRENT_ASSERT(c);
 
-		const bool was_conn_cand = is_connect_candidate(*p, m_finished);
 		p->connection = c;
-		if (was_conn_cand) --m_num_connect_candidates;
+		update_connect_candidate(p);
 	}
 
 	void policy::set_failcount(policy::peer* p, int f)
@@ -607,13 +857,24 @@ namespace libtorrent
 		INVARIANT_CHECK;
 
 		TORRENT_ASSERT(p->in_use);
-		const bool was_conn_cand = is_connect_candidate(*p, m_finished);
 		p->failcount = f;
-		if (was_conn_cand != is_connect_candidate(*p, m_finished))
-		{
-			if (was_conn_cand) --m_num_connect_candidates;
-			else ++m_num_connect_candidates;
-		}
+		update_connect_candidate(p);
+	}
+
+	void policy::set_last_connected(policy::peer* p, int session_time)
+	{
+		TORRENT_ASSERT(p->in_use);
+		p->last_connected = session_time;
+		update_connect_candidate(p);
+	}
+
+	void policy::clear_last_connected()
+	{
+		INVARIANT_CHECK;
+
+		for (iterator i = m_peers.begin(), end(m_peers.end()); i != end; ++i)
+			(*i)->last_connected = 0;
+		rebuild_candidates();
 	}
 
 	bool policy::is_connect_candidate(peer const& p, bool finished) const
@@ -641,20 +902,115 @@ namespace libtorrent
 		return true;
 	}
 
-	policy::iterator policy::find_connect_candidate(int session_time)
+	void policy::update_connect_candidate(peer* p)
 	{
-		INVARIANT_CHECK;
+		// web seeds are not in the peer list, and are never
+		// connect candidates
+		if (!has_peer(p)) return;
 
-		int candidate = -1;
-		int erase_candidate = -1;
+		const boost::uint32_t pos = m_candidate_pos[p->index];
+		if (!is_connect_candidate(*p, m_finished))
+		{
+			if (pos != not_in_list) candidate_erase(pos);
+			return;
+		}
 
-		TORRENT_ASSERT(m_finished == m_torrent->is_finished());
+		if (pos == not_in_list)
+		{
+			candidate_push(p);
+			return;
+		}
 
-		int min_reconnect_time = m_torrent->settings().min_reconnect_time;
+		// the rank of the peer may have changed
+		candidate_sift_up(pos);
+		candidate_sift_down(m_candidate_pos[p->index]);
+	}
+
+	void policy::candidate_push(peer* p)
+	{
+		TORRENT_ASSERT(m_candidate_pos[p->index] == not_in_list);
+		m_candidates.push_back(p);
+		candidate_sift_up(m_candidates.size() - 1);
+	}
+
+	void policy::candidate_erase(int pos)
+	{
+		TORRENT_ASSERT(pos >= 0 && pos < int(m_candidates.size()));
+		m_candidate_pos[m_candidates[pos]->index] = not_in_list;
+		const int last = int(m_candidates.size()) - 1;
+		if (pos == last)
+		{
+			m_candidates.pop_back();
+			return;
+		}
+		peer* moved = m_candidates[last];
+		m_candidates.pop_back();
+		candidate_set(pos, moved);
+		candidate_sift_up(pos);
+		candidate_sift_down(m_candidate_pos[moved->index]);
+	}
+
+	void policy::candidate_sift_up(int pos)
+	{
+		candidate_compare cmp(*this);
+		peer* p = m_candidates[pos];
+		while (pos > 0)
+		{
+			int parent = (pos - 1) / 2;
+			if (!cmp(m_candidates[parent], p)) break;
+			candidate_set(pos, m_candidates[parent]);
+			pos = parent;
+		}
+		candidate_set(pos, p);
+	}
+
+	void policy::candidate_sift_down(int pos)
+	{
+		candidate_compare cmp(*this);
+		peer* p = m_candidates[pos];
+		const int size = m_candidates.size();
+		for (;;)
+		{
+			int child = pos * 2 + 1;
+			if (child >= size) break;
+			if (child + 1 < size && cmp(m_candidates[child], m_candidates[child + 1]))
+				++child;
+			if (!cmp(p, m_candidates[child])) break;
+			candidate_set(pos, m_candidates[child]);
+			pos = child;
+		}
+		candidate_set(pos, p);
+	}
+
+	void policy::rebuild_candidates()
+	{
+#ifndef TORRENT_DISABLE_GEO_IP
+		m_as_rank_generation = m_torrent->session().as_rank_generation();
+#endif
+		m_candidates.clear();
+		for (int i = 0; i < int(m_peers.size()); ++i)
+		{
+			m_candidate_pos[i] = not_in_list;
+			if (is_connect_candidate(*m_peers[i], m_finished))
+				m_candidates.push_back(m_peers[i]);
+		}
+		std::make_heap(m_candidates.begin(), m_candidates.end()
+			, candidate_compare(*this));
+		for (int i = 0; i < int(m_candidates.size()); ++i)
+			m_candidate_pos[m_candidates[i]->index] = i;
+	}
+
+	bool policy::update_candidate_ip()
+	{
 		address external_ip = m_torrent->session().external_address();
 
 		// don't bias any particular peers when seeding
-		if (m_finished || external_ip == address())
+		const bool randomize = m_finished || external_ip == address();
+		if (randomize && m_random_candidate_ip) return false;
+		if (!randomize && !m_random_candidate_ip && external_ip == m_candidate_ip)
+			return false;
+
+		if (randomize)
 		{
 			// set external_ip to a random value, to
 			// radomize which peers we prefer
@@ -662,103 +1018,112 @@ namespace libtorrent
 			std::generate(bytes.begin(), bytes.end(), &random);
 			external_ip = address_v4(bytes);
 		}
+		m_candidate_ip = external_ip;
+		m_random_candidate_ip = randomize;
+		return true;
+	}
 
-		if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
+	policy::peer* policy::find_connect_candidate(int session_time)
+	{
+		INVARIANT_CHECK;
 
-#ifndef TORRENT_DISABLE_DHT
-		bool pinged = false;
-#endif
+		TORRENT_ASSERT(m_finished == m_torrent->is_finished());
 
 		int max_peerlist_size = m_torrent->is_paused()
 			?m_torrent->settings().max_paused_peerlist_size
 			:m_torrent->settings().max_peerlist_size;
 
-		for (int iterations = (std::min)(int(m_peers.size()), 300);
-			iterations > 0; --iterations)
-		{
-			if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
-
-			peer& pe = *m_peers[m_round_robin];
-			TORRENT_ASSERT(pe.in_use);
-			int current = m_round_robin;
+		// if the number of peers is growing large
+		// we need to start weeding.
+		if (int(m_peers.size()) >= max_peerlist_size * 0.95
+			&& max_peerlist_size > 0)
+			erase_peers();
 
 #ifndef TORRENT_DISABLE_DHT
-			// try to send a DHT ping to this peer
-			// as well, to figure out if it supports
-			// DHT (uTorrent and BitComet doesn't
-			// advertise support)
-			if (!pinged && !pe.added_to_dht)
+		// try to send a DHT ping to one peer
+		// as well, to figure out if it supports
+		// DHT (uTorrent and BitComet doesn't
+		// advertise support)
+		if (!m_peers.empty())
+		{
+			if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
+			peer& pe = *m_peers[m_round_robin++];
+			if (!pe.added_to_dht)
 			{
 				udp::endpoint node(pe.address(), pe.port);
 				m_torrent->session().add_dht_node(node);
 				pe.added_to_dht = true;
-				pinged = true;
 			}
+		}
 #endif
-			// if the number of peers is growing large
-			// we need to start weeding.
 
-			if (int(m_peers.size()) >= max_peerlist_size * 0.95
-				&& max_peerlist_size > 0)
-			{
-				if (is_erase_candidate(pe, m_finished)
-					&& (erase_candidate == -1
-						|| !compare_peer_erase(*m_peers[erase_candidate], pe)))
-				{
-					if (should_erase_immediately(pe))
-					{
-						if (erase_candidate > current) --erase_candidate;
-						if (candidate > current) --candidate;
-						erase_peer(m_peers.begin() + current);
-						continue;
-					}
-					else
-					{
-						erase_candidate = current;
-					}
-				}
-			}
-
-			++m_round_robin;
+		bool rebuild = update_candidate_ip();
+#ifndef TORRENT_DISABLE_GEO_IP
+		// the AS ranks are only part of the order when we're
+		// downloading and have an AS database
+		if (!m_finished && m_torrent->session().has_asnum_db()
+			&& m_as_rank_generation != m_torrent->session().as_rank_generation())
+			rebuild = true;
+#endif
+		if (rebuild) rebuild_candidates();
 
-			if (!is_connect_candidate(pe, m_finished)) continue;
+		// peers may stop being connect candidates without us
+		// being told, for instance when the port filter changes.
+		// Drop them as we find them
+		while (!m_candidates.empty()
+			&& !is_connect_candidate(*m_candidates[0], m_finished))
+			candidate_erase(0);
 
-			// compare peer returns true if lhs is better than rhs. In this
-			// case, it returns true if the current candidate is better than
-			// pe, which is the peer m_round_robin points to. If it is, just
-			// keep looking.
-			if (candidate != -1
-				&& compare_peer(*m_peers[candidate], pe, external_ip)) continue;
+		if (m_candidates.empty()) return 0;
 
-			if (pe.last_connected
-				&& session_time - pe.last_connected <
-				(int(pe.failcount) + 1) * min_reconnect_time)
-				continue;
+		int min_reconnect_time = m_torrent->settings().min_reconnect_time;
 
-			candidate = current;
-		}
-		
-		if (erase_candidate > -1)
+		// the heap is ordered by rank, but peers we've tried
+		// recently may not be reconnected to yet. Visit the heap
+		// best-first until we find one we're allowed to connect
+		// to. Since peers with the same failcount are ordered by
+		// last_connected, this usually ends after a few steps
+		peer* candidate = 0;
+		candidate_compare cmp(*this);
+		std::vector<peer*> frontier(1, m_candidates[0]);
+		for (int iterations = 300; !frontier.empty() && iterations > 0; --iterations)
 		{
-			if (candidate > erase_candidate) --candidate;
-			erase_peer(m_peers.begin() + erase_candidate);
+			std::pop_heap(frontier.begin(), frontier.end(), cmp);
+			peer* pe = frontier.back();
+			frontier.pop_back();
+			TORRENT_ASSERT(pe->in_use);
+
+			if (pe->last_connected == 0
+				|| session_time - pe->last_connected >=
+				(int(pe->failcount) + 1) * min_reconnect_time)
+			{
+				candidate = pe;
+				break;
+			}
+
+			int child = m_candidate_pos[pe->index] * 2 + 1;
+			for (int end = (std::min)(child + 2, int(m_candidates.size()));
+				child < end; ++child)
+			{
+				frontier.push_back(m_candidates[child]);
+				std::push_heap(frontier.begin(), frontier.end(), cmp);
+			}
 		}
 
 #if defined TORRENT_LOGGING || defined TORRENT_VERBOSE_LOGGING
-		if (candidate != -1)
+		if (candidate)
 		{
 			(*m_torrent->session().m_logger) << time_now_string()
 				<< " *** FOUND CONNECTION CANDIDATE ["
-				" ip: " << m_peers[candidate]->ip() <<
-				" d: " << cidr_distance(external_ip, m_peers[candidate]->address()) <<
-				" external: " << external_ip <<
-				" t: " << (session_time - m_peers[candidate]->last_connected) <<
+				" ip: " << candidate->ip() <<
+				" d: " << cidr_distance(m_candidate_ip, candidate->address()) <<
+				" external: " << m_candidate_ip <<
+				" t: " << (session_time - candidate->last_connected) <<
 				" ]\n";
 		}
 #endif
 
-		if (candidate == -1) return m_peers.end();
-		return m_peers.begin() + candidate;
+		return candidate;
 	}
 
 	bool policy::new_connection(peer_connection& c, int session_time)
@@ -806,46 +1171,15 @@ namespace libtorrent
 		}
 #endif
 
-		iterator iter;
 		peer* i = 0;
 
-		bool found = false;
 		if (m_torrent->settings().allow_multiple_connections_per_ip)
-		{
-			tcp::endpoint remote = c.remote();
-			std::pair<iterator, iterator> range = find_peers(remote.address());
-			iter = std::find_if(range.first, range.second, match_peer_endpoint(remote));
-	
-			if (iter != range.second)
-			{
-				TORRENT_ASSERT((*iter)->in_use);
-				found = true;
-			}
-		}
+			i = find_peer(c.remote());
 		else
-		{
-			iter = std::lower_bound(
-				m_peers.begin(), m_peers.end()
-				, c.remote().address(), peer_address_compare()
-			);
-
-			if (iter != m_peers.end() && (*iter)->address() == c.remote().address())
-			{
-				TORRENT_ASSERT((*iter)->in_use);
-				found = true;
-			}
-		}
-
-		// make sure the iterator we got is properly sorted relative
-		// to the connection's address
-//		TORRENT_ASSERT(m_peers.empty()
-//			|| (iter == m_peers.end() && (*(iter-1))->address() < c.remote().address())
-//			|| (iter != m_peers.end() && c.remote().address() < (*iter)->address())
-//			|| (iter != m_peers.end() && iter != m_peers.begin() && (*(iter-1))->address() < c.remote().address()));
+			i = find_peer(c.remote().address());
 
-		if (found)
+		if (i)
 		{
-			i = *iter;
 			TORRENT_ASSERT(i->in_use);
 			TORRENT_ASSERT(i->connection != &c);
 
@@ -961,13 +1295,6 @@ namespace libtorrent
 					}
 				}
 			}
-
-			if (is_connect_candidate(*i, m_finished))
-			{
-				m_num_connect_candidates--;
-				TORRENT_ASSERT(m_num_connect_candidates >= 0);
-				if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-			}
 		}
 		else
 		{
@@ -978,7 +1305,6 @@ namespace libtorrent
 
 			if (int(m_peers.size()) >= m_torrent->settings().max_peerlist_size)
 			{
-				// this may invalidate our iterator!
 				erase_peers(force_erase);
 				if (int(m_peers.size()) >= m_torrent->settings().max_peerlist_size)
 				{
@@ -997,46 +1323,12 @@ namespace libtorrent
 					c.disconnect(errors::too_many_connections);
 					return false;
 				}
-				// restore it
-				iter = std::lower_bound(
-					m_peers.begin(), m_peers.end()
-					, c.remote().address(), peer_address_compare()
-				);
 			}
 
-#if TORRENT_USE_IPV6
-			bool is_v6 = c.remote().address().is_v6();
-#endif
-			peer* p =
-#if TORRENT_USE_IPV6
-				is_v6 ? (peer*)m_torrent->session().m_ipv6_peer_pool.malloc() :
-#endif
-				(peer*)m_torrent->session().m_ipv4_peer_pool.malloc();
-			if (p == 0) return false;
+			i = allocate_peer(c.remote(), false, 0);
+			if (i == 0) return false;
 
-#if TORRENT_USE_IPV6
-			if (is_v6)
-				m_torrent->session().m_ipv6_peer_pool.set_next_size(500);
-			else
-#endif
-				m_torrent->session().m_ipv4_peer_pool.set_next_size(500);
-
-#if TORRENT_USE_IPV6
-			if (is_v6)
-				new (p) ipv6_peer(c.remote(), false, 0);
-			else
-#endif
-				new (p) ipv4_peer(c.remote(), false, 0);
-
-#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
-			p->in_use = true;
-#endif
-
-			iter = m_peers.insert(iter, p);
-
-			if (m_round_robin >= iter - m_peers.begin()) ++m_round_robin;
-
-			i = *iter;
+			add_to_list(i);
 #ifndef TORRENT_DISABLE_GEO_IP
 			int as = ses.as_for_ip(c.remote().address());
 #ifdef TORRENT_DEBUG
@@ -1053,10 +1345,11 @@ namespace libtorrent
 		c.add_stat(size_type(i->prev_amount_download) << 10, size_type(i->prev_amount_upload) << 10);
 
 		// restore transfer rate limits
+		rate_limits const& limits = m_rate_limits[i->index];
 		int rate_limit;
-		rate_limit = i->upload_rate_limit;
+		rate_limit = limits.upload;
 		if (rate_limit) c.set_upload_limit(rate_limit);
-		rate_limit = i->download_rate_limit;
+		rate_limit = limits.download;
 		if (rate_limit) c.set_download_limit(rate_limit);
 
 		i->prev_amount_download = 0;
@@ -1065,6 +1358,7 @@ namespace libtorrent
 		TORRENT_ASSERT(i->connection);
 		if (!c.fast_reconnect())
 			i->last_connected = session_time;
+		update_connect_candidate(i);
 
 		// this cannot be a connect candidate anymore, since i->connection is set
 		TORRENT_ASSERT(!is_connect_candidate(*i, m_finished));
@@ -1086,22 +1380,18 @@ namespace libtorrent
 		if (m_torrent->settings().allow_multiple_connections_per_ip)
 		{
 			tcp::endpoint remote(p->address(), port);
-			std::pair<iterator, iterator> range = find_peers(remote.address());
-			iterator i = std::find_if(range.first, range.second
-				, match_peer_endpoint(remote));
-			if (i != range.second)
+			peer* i = find_peer(remote);
+			if (i)
 			{
-				policy::peer& pp = **i;
+				policy::peer& pp = *i;
 				TORRENT_ASSERT(pp.in_use);
 				if (pp.connection)
 				{
-					bool was_conn_cand = is_connect_candidate(pp, m_finished);
 					// if we already have an entry with this
 					// new endpoint, disconnect this one
 					pp.connectable = true;
 					pp.source |= src;
-					if (!was_conn_cand && is_connect_candidate(pp, m_finished))
-						++m_num_connect_candidates;
+					update_connect_candidate(&pp);
 					// calling disconnect() on a peer, may actually end
 					// up "garbage collecting" its policy::peer entry
 					// as well, if it's considered useless (which this specific)
@@ -1123,38 +1413,24 @@ namespace libtorrent
 #ifdef TORRENT_DEBUG
 		else
 		{
-			std::pair<iterator, iterator> range = find_peers(p->address());
-			TORRENT_ASSERT(range.second - range.first == 1);
+			TORRENT_ASSERT(find_peer(p->address()) == p);
 		}
 #endif
 
-		bool was_conn_cand = is_connect_candidate(*p, m_finished);
 		p->port = port;
 		p->source |= src;
 		p->connectable = true;
-
-		if (was_conn_cand != is_connect_candidate(*p, m_finished))
-		{
-			m_num_connect_candidates += was_conn_cand ? -1 : 1;
-			TORRENT_ASSERT(m_num_connect_candidates >= 0);
-			if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-		}
+		update_connect_candidate(p);
 		return true;
 	}
 
-	// it's important that we don't dereference
-	// p here, since it is allowed to be a dangling
-	// pointer. see smart_ban.cpp
+	// it's important that we don't trust p here, since
+	// it is allowed to be a dangling pointer. see smart_ban.cpp
+	// Reading its index is fine though, since the slab allocators
+	// don't release any memory until the policy is destructed
 	bool policy::has_peer(policy::peer const* p) const
 	{
-		TORRENT_ASSERT(p->in_use);
-		// find p in m_peers
-		for (const_iterator i = m_peers.begin()
-			, end(m_peers.end()); i != end; ++i)
-		{
-			if (*i == p) return true;
-		}
-		return false;
+		return p->index < m_peers.size() && m_peers[p->index] == p;
 	}
 
 	void policy::set_seed(policy::peer* p, bool s)
@@ -1162,14 +1438,8 @@ namespace libtorrent
 		if (p == 0) return;
 		TORRENT_ASSERT(p->in_use);
 		if (p->seed == s) return;
-		bool was_conn_cand = is_connect_candidate(*p, m_finished);
 		p->seed = s;
-		if (was_conn_cand && !is_connect_candidate(*p, m_finished))
-		{
-			--m_num_connect_candidates;
-			TORRENT_ASSERT(m_num_connect_candidates >= 0);
-			if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-		}
+		update_connect_candidate(p);
 
 		if (p->web_seed) return;
 		if (s) ++m_num_seeds;
@@ -1178,7 +1448,7 @@ namespace libtorrent
 		TORRENT_ASSERT(m_num_seeds <= int(m_peers.size()));
 	}
 
-	bool policy::insert_peer(policy::peer* p, iterator iter, int flags)
+	bool policy::insert_peer(policy::peer* p, int flags)
 	{
 		TORRENT_ASSERT(p);
 		TORRENT_ASSERT(p->in_use);
@@ -1195,26 +1465,9 @@ namespace libtorrent
 			erase_peers();
 			if (int(m_peers.size()) >= max_peerlist_size)
 				return 0;
-
-			// since some peers were removed, we need to
-			// update the iterator to make it valid again
-#if TORRENT_USE_I2P
-			if (p->is_i2p_addr)
-			{
-				iter = std::lower_bound(
-					m_peers.begin(), m_peers.end()
-					, p->dest(), peer_address_compare());
-			}
-			else
-#endif
-			iter = std::lower_bound(
-				m_peers.begin(), m_peers.end()
-				, p->address(), peer_address_compare());
 		}
 
-		iter = m_peers.insert(iter, p);
-
-		if (m_round_robin >= iter - m_peers.begin()) ++m_round_robin;
+		add_to_list(p);
 
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		if (flags & 0x01) p->pe_support = true;
@@ -1236,8 +1489,7 @@ namespace libtorrent
 #endif
 		p->inet_as = m_torrent->session().lookup_as(as);
 #endif
-		if (is_connect_candidate(*p, m_finished))
-			++m_num_connect_candidates;
+		update_connect_candidate(p);
 
 		m_torrent->state_updated();
 
@@ -1247,8 +1499,6 @@ namespace libtorrent
 	void policy::update_peer(policy::peer* p, int src, int flags
 		, tcp::endpoint const& remote, char const* destination)
 	{
-		bool was_conn_cand = is_connect_candidate(*p, m_finished);
-
 		TORRENT_ASSERT(p->in_use);
 		p->connectable = true;
 
@@ -1295,11 +1545,9 @@ namespace libtorrent
 		}
 #endif
 
-		if (was_conn_cand != is_connect_candidate(*p, m_finished))
-		{
-			m_num_connect_candidates += was_conn_cand ? -1 : 1;
-			if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-		}
+		// the source or failcount may have changed, which
+		// affects the peer's rank as a connect candidate
+		update_connect_candidate(p);
 	}
 
 #if TORRENT_USE_I2P
@@ -1307,43 +1555,28 @@ namespace libtorrent
 	{
 		INVARIANT_CHECK;
 	
-		bool found = false;
-		iterator iter = std::lower_bound(
-			m_peers.begin(), m_peers.end()
-			, destination, peer_address_compare()
-		);
+		peer* p = find_i2p_peer(destination);
 
-		if (iter != m_peers.end() && strcmp((*iter)->dest(), destination) == 0)
-			found = true;
-
-		peer* p = 0;
-
-		if (!found)
+		if (p == 0)
 		{
 			// we don't have any info about this peer.
 			// add a new entry
-			p = (peer*)m_torrent->session().m_i2p_peer_pool.malloc();
-			if (p == 0) return 0;
-			m_torrent->session().m_i2p_peer_pool.set_next_size(500);
-			new (p) i2p_peer(destination, true, src);
+			void* mem = m_i2p_peers.malloc();
+			if (mem == 0) return 0;
+			p = new (mem) i2p_peer(destination, true, src);
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 			p->in_use = true;
 #endif
 
-			if (!insert_peer(p, iter, flags))
+			if (!insert_peer(p, flags))
 			{
-#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
-				p->in_use = false;
-#endif
-
-				m_torrent->session().m_i2p_peer_pool.destroy((i2p_peer*)p);
+				free_peer(p);
 				return 0;
 			}
 		}
 		else
 		{
-			p = *iter;
 			update_peer(p, src, flags, tcp::endpoint(), destination);
 		}
 		m_torrent->state_updated();
@@ -1404,68 +1637,23 @@ namespace libtorrent
 			return 0;
 		}
 
-		iterator iter;
 		peer* p = 0;
 
-		bool found = false;
 		if (m_torrent->settings().allow_multiple_connections_per_ip)
-		{
-			std::pair<iterator, iterator> range = find_peers(remote.address());
-			iter = std::find_if(range.first, range.second, match_peer_endpoint(remote));
-			if (iter != range.second) found = true;
-		}
+			p = find_peer(remote);
 		else
-		{
-			iter = std::lower_bound(
-				m_peers.begin(), m_peers.end()
-				, remote.address(), peer_address_compare()
-			);
+			p = find_peer(remote.address());
 
-			if (iter != m_peers.end() && (*iter)->address() == remote.address()) found = true;
-		}
-
-		if (!found)
+		if (p == 0)
 		{
 			// we don't have any info about this peer.
 			// add a new entry
-
-#if TORRENT_USE_IPV6
-			bool is_v6 = remote.address().is_v6();
-#endif
-			p =
-#if TORRENT_USE_IPV6
-				is_v6 ? (peer*)m_torrent->session().m_ipv6_peer_pool.malloc() :
-#endif
-				(peer*)m_torrent->session().m_ipv4_peer_pool.malloc();
+			p = allocate_peer(remote, true, src);
 			if (p == 0) return 0;
-#if TORRENT_USE_IPV6
-			if (is_v6)
-				m_torrent->session().m_ipv6_peer_pool.set_next_size(500);
-			else
-#endif
-				m_torrent->session().m_ipv4_peer_pool.set_next_size(500);
-
-#if TORRENT_USE_IPV6
-			if (is_v6)
-				new (p) ipv6_peer(remote, true, src);
-			else
-#endif
-				new (p) ipv4_peer(remote, true, src);
-
-#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
-			p->in_use = true;
-#endif
 
-			if (!insert_peer(p, iter, flags))
+			if (!insert_peer(p, flags))
 			{
-#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
-				p->in_use = false;
-#endif
-#if TORRENT_USE_IPV6
-				if (is_v6) m_torrent->session().m_ipv6_peer_pool.destroy((ipv6_peer*)p);
-				else
-#endif
-				m_torrent->session().m_ipv4_peer_pool.destroy((ipv4_peer*)p);
+				free_peer(p);
 				return 0;
 			}
 #ifndef TORRENT_DISABLE_EXTENSIONS
@@ -1474,7 +1662,6 @@ namespace libtorrent
 		}
 		else
 		{
-			p = *iter;
 			TORRENT_ASSERT(p->in_use);
 			update_peer(p, src, flags, remote, 0);
 #ifndef TORRENT_DISABLE_EXTENSIONS
@@ -1491,9 +1678,9 @@ namespace libtorrent
 
 		TORRENT_ASSERT(m_torrent->want_more_peers());
 		
-		iterator i = find_connect_candidate(session_time);
-		if (i == m_peers.end()) return false;
-		peer& p = **i;
+		peer* i = find_connect_candidate(session_time);
+		if (i == 0) return false;
+		peer& p = *i;
 		TORRENT_ASSERT(p.in_use);
 
 		TORRENT_ASSERT(!p.banned);
@@ -1505,10 +1692,8 @@ namespace libtorrent
 		if (!m_torrent->connect_to_peer(&p))
 		{
 			// failcount is a 5 bit value
-			const bool was_conn_cand = is_connect_candidate(p, m_finished);
 			if (p.failcount < 31) ++p.failcount;
-			if (was_conn_cand && !is_connect_candidate(p, m_finished))
-				--m_num_connect_candidates;
+			update_connect_candidate(&p);
 			return false;
 		}
 		TORRENT_ASSERT(p.connection);
@@ -1540,9 +1725,13 @@ namespace libtorrent
 		TORRENT_ASSERT(p->connection == &c);
 		TORRENT_ASSERT(!is_connect_candidate(*p, m_finished));
 
-		// save transfer rate limits
-		p->upload_rate_limit = c.upload_limit();
-		p->download_rate_limit = c.download_limit();
+		// save transfer rate limits. Web seeds are not in the list
+		// and don't have any slot to save them in
+		if (has_peer(p))
+		{
+			m_rate_limits[p->index].upload = c.upload_limit();
+			m_rate_limits[p->index].download = c.download_limit();
+		}
 
 		p->connection = 0;
 		p->optimistically_unchoked = false;
@@ -1559,8 +1748,7 @@ namespace libtorrent
 			if (p->failcount < 31) ++p->failcount;
 		}
 
-		if (is_connect_candidate(*p, m_finished))
-			++m_num_connect_candidates;
+		update_connect_candidate(p);
 
 		// if we're already a seed, it's not as important
 		// to keep all the possibly stale peers
@@ -1611,13 +1799,10 @@ namespace libtorrent
 		const bool is_finished = m_torrent->is_finished();
 		if (is_finished == m_finished) return;
 
-		m_num_connect_candidates = 0;
 		m_finished = is_finished;
-		for (const_iterator i = m_peers.begin();
-			i != m_peers.end(); ++i)
-		{
-			m_num_connect_candidates += is_connect_candidate(**i, m_finished);
-		}
+		// the ranking depends on m_finished too
+		update_candidate_ip();
+		rebuild_candidates();
 	}
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
@@ -1645,8 +1830,10 @@ namespace libtorrent
 #ifdef TORRENT_DEBUG
 	void policy::check_invariant() const
 	{
-		TORRENT_ASSERT(m_num_connect_candidates >= 0);
-		TORRENT_ASSERT(m_num_connect_candidates <= int(m_peers.size()));
+		TORRENT_ASSERT(m_candidates.size() <= m_peers.size());
+		TORRENT_ASSERT(m_candidate_pos.size() == m_peers.size());
+		TORRENT_ASSERT(m_rate_limits.size() == m_peers.size());
+		TORRENT_ASSERT(m_peers.size() <= m_index.size());
 		if (m_torrent->is_aborted()) return;
 
 #ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
@@ -1656,30 +1843,36 @@ namespace libtorrent
 		int nonempty_connections = 0;
 		int connect_candidates = 0;
 
+		int index_entries = 0;
+		for (std::vector<boost::uint32_t>::const_iterator i = m_index.begin()
+			, end(m_index.end()); i != end; ++i)
+		{
+			if (*i == empty_slot) continue;
+			TORRENT_ASSERT(*i < m_peers.size());
+			++index_entries;
+		}
+		TORRENT_ASSERT(index_entries == int(m_peers.size()));
+
 		std::set<tcp::endpoint> unique_test;
-		const_iterator prev = m_peers.end();
 		for (const_iterator i = m_peers.begin();
 			i != m_peers.end(); ++i)
 		{
-			if (prev != m_peers.end()) ++prev;
-			if (i == m_peers.begin() + 1) prev = m_peers.begin();
-			if (prev != m_peers.end())
-			{
-				if (m_torrent->settings().allow_multiple_connections_per_ip)
-					TORRENT_ASSERT(!((*i)->address() < (*prev)->address()));
-				else
-					TORRENT_ASSERT((*prev)->address() < (*i)->address());
-			}
 			peer const& p = **i;
 			TORRENT_ASSERT(p.in_use);
+			TORRENT_ASSERT(p.index == boost::uint32_t(i - m_peers.begin()));
+			TORRENT_ASSERT(index_slot(p.index) >= 0);
 			if (is_connect_candidate(p, m_finished)) ++connect_candidates;
+			TORRENT_ASSERT(is_connect_candidate(p, m_finished)
+				== (m_candidate_pos[p.index] != not_in_list));
 #ifndef TORRENT_DISABLE_GEO_IP
 			TORRENT_ASSERT(p.inet_as == 0 || p.inet_as->first == p.inet_as_num);
 #endif
 			if (!m_torrent->settings().allow_multiple_connections_per_ip)
 			{
-				std::pair<const_iterator, const_iterator> range = find_peers(p.address());
-				TORRENT_ASSERT(range.second - range.first == 1);
+#if TORRENT_USE_I2P
+				if (!p.is_i2p_addr)
+#endif
+				TORRENT_ASSERT(find_peer(p.address()) == &p);
 			}
 			else
 			{
@@ -1704,7 +1897,9 @@ namespace libtorrent
 				++connected_peers;
 		}
 
-		TORRENT_ASSERT(m_num_connect_candidates == connect_candidates);
+		TORRENT_ASSERT(int(m_candidates.size()) == connect_candidates);
+		for (int i = 0; i < int(m_candidates.size()); ++i)
+			TORRENT_ASSERT(m_candidate_pos[m_candidates[i]->index] == boost::uint32_t(i));
 
 		int num_torrent_peers = 0;
 		for (torrent::const_peer_iterator i = m_torrent->begin();
@@ -1770,14 +1965,13 @@ namespace libtorrent
 		: prev_amount_upload(0)
 		, prev_amount_download(0)
 		, connection(0)
+		, index(not_in_list)
 #ifndef TORRENT_DISABLE_GEO_IP
 		, inet_as(0)
 #endif
 		, last_optimistically_unchoked(0)
 		, last_connected(0)
 		, port(port)
-		, upload_rate_limit(0)
-		, download_rate_limit(0)
 		, hashfails(0)
 		, failcount(0)
 		, connectable(conn)
@@ -1881,7 +2075,9 @@ namespace libtorrent
 		if (lhs_rank != rhs_rank) return lhs_rank > rhs_rank;
 
 #ifndef TORRENT_DISABLE_GEO_IP
-		// don't bias fast peers when seeding
+		// don't bias fast peers when seeding. The AS ranks change
+		// as we download, find_connect_candidate() rebuilds the
+		// heap when they have
 		if (!m_finished && m_torrent->session().has_asnum_db())
 		{
 			int lhs_as = lhs.inet_as ? lhs.inet_as->second : 0;
@@ -0,0 +1,128 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/pch.hpp"
+
+#include <boost/bind.hpp>
+
+#include "libtorrent/resolver.hpp"
+#include "libtorrent/io_service.hpp"
+
+namespace libtorrent
+{
+	resolver::resolver(io_service& ios)
+		: m_ios(ios)
+		, m_resolver(ios)
+		, m_timeout(1200)
+		, m_max_size(700)
+		, m_hits(0)
+		, m_misses(0)
+	{}
+
+	void resolver::async_resolve(std::string const& host, callback_t const& h)
+	{
+		cache_t::iterator i = m_cache.find(host);
+		if (i != m_cache.end())
+		{
+			if (time_now() - i->second.last_seen < seconds(m_timeout))
+			{
+				++m_hits;
+				m_ios.post(boost::bind(h, error_code(), i->second.addresses));
+				return;
+			}
+			m_cache.erase(i);
+		}
+
+		++m_misses;
+
+		// if this hostname is already being looked up, just wait
+		// for that lookup to complete
+		std::vector<callback_t>& handlers = m_pending[host];
+		handlers.push_back(h);
+		if (handlers.size() > 1) return;
+
+		// the port is filled in by the caller
+		tcp::resolver::query q(host, "0");
+		m_resolver.async_resolve(q, boost::bind(&resolver::on_lookup, this
+			, _1, _2, host));
+	}
+
+	void resolver::on_lookup(error_code const& ec, tcp::resolver::iterator i
+		, std::string hostname)
+	{
+		pending_t::iterator p = m_pending.find(hostname);
+		if (p == m_pending.end()) return;
+
+		std::vector<callback_t> handlers;
+		handlers.swap(p->second);
+		m_pending.erase(p);
+
+		std::vector<address> addresses;
+		if (!ec)
+		{
+			for (; i != tcp::resolver::iterator(); ++i)
+				addresses.push_back(i->endpoint().address());
+		}
+
+		if (!ec && !addresses.empty() && m_timeout > 0)
+		{
+			// evict the least recently looked up hostname
+			if (int(m_cache.size()) >= m_max_size)
+			{
+				cache_t::iterator oldest = m_cache.begin();
+				for (cache_t::iterator j = m_cache.begin(), end(m_cache.end());
+					j != end; ++j)
+				{
+					if (j->second.last_seen < oldest->second.last_seen) oldest = j;
+				}
+				m_cache.erase(oldest);
+			}
+
+			dns_cache_entry& e = m_cache[hostname];
+			e.last_seen = time_now();
+			e.addresses = addresses;
+		}
+
+		for (std::vector<callback_t>::iterator j = handlers.begin()
+			, end(handlers.end()); j != end; ++j)
+			(*j)(ec, addresses);
+	}
+
+	void resolver::cancel()
+	{
+		m_resolver.cancel();
+
+		// the handlers of the lookups in progress are called from
+		// on_lookup, with operation_aborted
+	}
+}
+
@@ -586,9 +586,19 @@ namespace libtorrent
 		TORRENT_SYNC_CALL2(refresh_torrent_status, ret, flags);
 	}
 
-	void session::post_torrent_updates()
+	void session::post_torrent_updates(boost::uint32_t flags)
 	{
-		TORRENT_ASYNC_CALL(post_torrent_updates);
+		TORRENT_ASYNC_CALL1(post_torrent_updates, flags);
+	}
+
+	void session::post_torrent_deltas(boost::uint64_t fields)
+	{
+		TORRENT_ASYNC_CALL1(post_torrent_deltas, fields);
+	}
+
+	void session::post_session_stats()
+	{
+		TORRENT_ASYNC_CALL(post_session_stats);
 	}
 
 	std::vector<torrent_handle> session::get_torrents() const
@@ -627,6 +637,16 @@ namespace libtorrent
 		TORRENT_ASYNC_CALL1(async_add_torrent, p);
 	}
 
+	void session::async_add_torrents(std::vector<add_torrent_params> const& params)
+	{
+		std::vector<boost::shared_ptr<loaded_torrent> > torrents;
+		torrents.reserve(params.size());
+		for (std::vector<add_torrent_params>::const_iterator i = params.begin()
+			, end(params.end()); i != end; ++i)
+			torrents.push_back(boost::shared_ptr<loaded_torrent>(new loaded_torrent(*i)));
+		TORRENT_ASYNC_CALL1(async_add_torrents, torrents);
+	}
+
 #ifndef BOOST_NO_EXCEPTIONS
 #ifndef TORRENT_NO_DEPRECATE
 	// if the torrent already exists, this will throw duplicate_torrent
@@ -815,6 +835,11 @@ namespace libtorrent
 		return r;
 	}
 
+	void session::dht_scrape(sha1_hash const& info_hash)
+	{
+		TORRENT_ASYNC_CALL1(dht_scrape, info_hash);
+	}
+
 #endif
 
 #ifndef TORRENT_DISABLE_ENCRYPTION
@@ -1037,6 +1062,11 @@ namespace libtorrent
 		m_impl->pop_alerts(alerts);
 	}
 
+	void session::pop_alerts(std::vector<alert*>* alerts)
+	{
+		m_impl->pop_alerts(alerts);
+	}
+
 	alert const* session::wait_for_alert(time_duration max_wait)
 	{
 		return m_impl->wait_for_alert(max_wait);
@@ -1292,6 +1322,12 @@ namespace libtorrent
 		, tracker_backoff(250)
 		, ban_web_seeds(true)
 		, max_http_recv_buffer_size(2*1024*1024)
+		, metadata_unload_timeout(0)
+		, startup_threads(4)
+		, tracker_host_requests_per_second(0)
+		, tracker_keep_alive_timeout(30)
+		, urlseed_max_request_bytes(2 * 1024 * 1024)
+		, max_web_seed_connections(1)
 	{}
 
 	session_settings::~session_settings() {}
@@ -82,10 +82,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/extensions.hpp"
 #include "libtorrent/random.hpp"
 #include "libtorrent/magnet_uri.hpp"
-
-#if defined TORRENT_STATS && defined __MACH__
-#include <mach/task.h>
-#endif
+#include "libtorrent/session_stats.hpp"
 
 #ifndef TORRENT_WINDOWS
 #include <sys/resource.h>
@@ -196,78 +193,23 @@ namespace detail
 
 namespace aux {
 
-#ifdef TORRENT_STATS
-	void get_vm_stats(vm_statistics_data_t* vm_stat)
-	{
-		memset(vm_stat, 0, sizeof(*vm_stat));
-#if defined __MACH__
-		mach_port_t host_port = mach_host_self();
-		mach_msg_type_number_t host_count = HOST_VM_INFO_COUNT;
-		kern_return_t error = host_statistics(host_port, HOST_VM_INFO,
-			(host_info_t)vm_stat, &host_count);
-#elif defined TORRENT_LINUX
-		char buffer[4096];
-		char string[1024];
-		boost::uint32_t value;
-		FILE* f = fopen("/proc/vmstat", "r");
-		int ret = 0;
-		while ((ret = fscanf(f, "%s %u\n", string, &value)) != EOF)
-		{
-			if (ret != 2) continue;
-			if (strcmp(string, "nr_active_anon") == 0) vm_stat->active_count += value;
-			else if (strcmp(string, "nr_active_file") == 0) vm_stat->active_count += value;
-			else if (strcmp(string, "nr_inactive_anon") == 0) vm_stat->inactive_count += value;
-			else if (strcmp(string, "nr_inactive_file") == 0) vm_stat->inactive_count += value;
-			else if (strcmp(string, "nr_free_pages") == 0) vm_stat->free_count = value;
-			else if (strcmp(string, "nr_unevictable") == 0) vm_stat->wire_count = value;
-			else if (strcmp(string, "pswpin") == 0) vm_stat->pageins = value;
-			else if (strcmp(string, "pswpout") == 0) vm_stat->pageouts = value;
-			else if (strcmp(string, "pgfault") == 0) vm_stat->faults = value;
-		}
-		fclose(f);
-#endif
-// TOOD: windows?
-	}
-
-	void get_thread_cpu_usage(thread_cpu_usage* tu)
-	{
-#if defined __MACH__
-		task_thread_times_info t_info;
-		mach_msg_type_number_t t_info_count = TASK_THREAD_TIMES_INFO_COUNT;
-		task_info(mach_task_self(), TASK_THREAD_TIMES_INFO, (task_info_t)&t_info, &t_info_count);
-
-		tu->user_time = min_time()
-			+ seconds(t_info.user_time.seconds)
-			+ microsec(t_info.user_time.microseconds);
-		tu->system_time = min_time()
-			+ seconds(t_info.system_time.seconds)
-			+ microsec(t_info.system_time.microseconds);
-#elif defined TORRENT_LINUX
-		struct rusage ru;
-		getrusage(RUSAGE_THREAD, &ru);
-		tu->user_time = min_time()
-			+ seconds(ru.ru_utime.tv_sec)
-			+ microsec(ru.ru_utime.tv_usec);
-		tu->system_time = min_time()
-			+ seconds(ru.ru_stime.tv_sec)
-			+ microsec(ru.ru_stime.tv_usec);
-#elif defined TORRENT_WINDOWS
-		FILETIME system_time;
-		FILETIME user_time;
-		FILETIME creation_time;
-		FILETIME exit_time;
-		GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &user_time, &system_time);
-
-		boost::uint64_t utime = (boost::uint64_t(user_time.dwHighDateTime) << 32)
-			+ user_time.dwLowDateTime;
-		boost::uint64_t stime = (boost::uint64_t(system_time.dwHighDateTime) << 32)
-			+ system_time.dwLowDateTime;
-
-		tu->user_time = min_time() + microsec(utime / 10);
-		tu->system_time = min_time() + microsec(stime / 10);
-#endif
-	}
-#endif //TORRENT_STATS
+namespace
+{
+	// maps the duration of a tick to its bucket in the tick histograms.
+	// Bucket 0 is less than 1 ms, bucket n is [2^(n-1), 2^n) ms and the
+	// last bucket is everything above that
+	int tick_histogram_bucket(time_duration d)
+	{
+		int ms = total_milliseconds(d);
+		int bucket = 0;
+		while (ms > 0 && bucket < session_status::num_tick_histogram_buckets - 1)
+		{
+			ms >>= 1;
+			++bucket;
+		}
+		return bucket;
+	}
+}
 
 	struct seed_random_generator
 	{
@@ -447,6 +389,13 @@ namespace aux {
 		TORRENT_SETTING(integer, tracker_backoff)
 		TORRENT_SETTING(boolean, ban_web_seeds)
 		TORRENT_SETTING(integer, max_http_recv_buffer_size)
+		TORRENT_SETTING(integer, metadata_unload_timeout)
+		TORRENT_SETTING(std_string, metadata_cache_path)
+		TORRENT_SETTING(integer, startup_threads)
+		TORRENT_SETTING(integer, tracker_host_requests_per_second)
+		TORRENT_SETTING(integer, tracker_keep_alive_timeout)
+		TORRENT_SETTING(integer, urlseed_max_request_bytes)
+		TORRENT_SETTING(integer, max_web_seed_connections)
 	};
 
 #undef TORRENT_SETTING
@@ -475,6 +424,8 @@ namespace aux {
 #endif
 		TORRENT_SETTING(integer, max_fail_count)
 		TORRENT_SETTING(integer, max_torrents)
+		TORRENT_SETTING(integer, max_peers)
+		TORRENT_SETTING(integer, max_peer_storage_size)
 		TORRENT_SETTING(integer, max_dht_items)
 		TORRENT_SETTING(integer, max_torrent_search_reply)
 		TORRENT_SETTING(boolean, restrict_routing_ips)
@@ -545,11 +496,6 @@ namespace aux {
 	}
 #undef lenof
 
-#ifdef TORRENT_STATS
-	int session_impl::logging_allocator::allocations = 0;
-	int session_impl::logging_allocator::allocated_bytes = 0;
-#endif
-
 #if defined TORRENT_USE_OPENSSL && BOOST_VERSION >= 104700 && OPENSSL_VERSION_NUMBER >= 0x90812f
 	// when running bittorrent over SSL, the SNI (server name indication)
 	// extension is used to know which torrent the incoming connection is
@@ -597,14 +543,11 @@ namespace aux {
 		, std::string const& logpath
 #endif
 		)
-		: m_ipv4_peer_pool(500)
-#if TORRENT_USE_IPV6
-		, m_ipv6_peer_pool(500)
-#endif
+		:
 #ifndef TORRENT_DISABLE_POOL_ALLOCATOR
-		, m_send_buffers(send_buffer_size)
+		m_send_buffers(send_buffer_size),
 #endif
-		, m_files(40)
+		m_files(40)
 		, m_io_service()
 #ifdef TORRENT_USE_OPENSSL
 		, m_ssl_ctx(m_io_service, asio::ssl::context::sslv23)
@@ -619,6 +562,7 @@ namespace aux {
 		, m_upload_rate(peer_connection::upload_channel)
 #endif
 		, m_tracker_manager(*this, m_proxy)
+		, m_auto_manage_evaluations(0)
 		, m_num_active_downloading(0)
 		, m_num_active_finished(0)
 		, m_listen_port_retries(listen_port_range.second - listen_port_range.first)
@@ -640,6 +584,7 @@ namespace aux {
 		, m_peak_down_rate(0)
 		, m_incoming_connection(false)
 		, m_created(time_now_hires())
+		, m_timer_epoch(m_created)
 		, m_last_tick(m_created)
 		, m_last_second_tick(m_created - milliseconds(900))
 		, m_last_disk_performance_warning(min_time())
@@ -658,6 +603,7 @@ namespace aux {
 		, m_timer(m_io_service)
 		, m_lsd_announce_timer(m_io_service)
 		, m_host_resolver(m_io_service)
+		, m_resolver(m_io_service)
 		, m_current_connect_attempts(0)
 		, m_tick_residual(0)
 		, m_non_filtered_torrents(0)
@@ -667,6 +613,7 @@ namespace aux {
 #ifndef TORRENT_DISABLE_GEO_IP
 		, m_asnum_db(0)
 		, m_country_db(0)
+		, m_as_rank_generation(0)
 #endif
 		, m_total_failed_bytes(0)
 		, m_total_redundant_bytes(0)
@@ -681,6 +628,8 @@ namespace aux {
 #endif
 
 		memset(m_redundant_bytes, 0, sizeof(m_redundant_bytes));
+		memset(m_tick_histogram, 0, sizeof(m_tick_histogram));
+		memset(m_torrent_tick_histogram, 0, sizeof(m_torrent_tick_histogram));
 		m_udp_socket.set_rate_limit(m_settings.dht_upload_rate_limit);
 
 		m_udp_socket.subscribe(&m_tracker_manager);
@@ -883,7 +832,10 @@ namespace aux {
 		PRINT_OFFSETOF(file_storage, m_symlinks)
 		PRINT_OFFSETOF(file_storage, m_mtime)
 		PRINT_OFFSETOF(file_storage, m_file_base)
-		PRINT_OFFSETOF(file_storage, m_paths)
+		PRINT_OFFSETOF(file_storage, m_path_components)
+		PRINT_OFFSETOF(file_storage, m_path_names)
+		PRINT_OFFSETOF(file_storage, m_path_index)
+		PRINT_OFFSETOF(file_storage, m_piece_index)
 		PRINT_OFFSETOF(file_storage, m_name)
 		PRINT_OFFSETOF(file_storage, m_total_size)
 		PRINT_OFFSETOF(file_storage, m_num_pieces)
@@ -915,6 +867,7 @@ namespace aux {
 		PRINT_OFFSETOF(policy::peer, prev_amount_upload)
 		PRINT_OFFSETOF(policy::peer, prev_amount_download)
 		PRINT_OFFSETOF(policy::peer, connection)
+		PRINT_OFFSETOF(policy::peer, index)
 #ifndef TORRENT_DISABLE_GEO_IP
 #ifdef TORRENT_DEBUG
 		PRINT_OFFSETOF(policy::peer, inet_as_num)
@@ -924,8 +877,6 @@ namespace aux {
 		PRINT_OFFSETOF(policy::peer, last_optimistically_unchoked)
 		PRINT_OFFSETOF(policy::peer, last_connected)
 		PRINT_OFFSETOF(policy::peer, port)
-		PRINT_OFFSETOF(policy::peer, upload_rate_limit)
-		PRINT_OFFSETOF(policy::peer, download_rate_limit)
 		PRINT_OFFSETOF(policy::peer, hashfails)
 		PRINT_OFFSETOF_END(policy::peer)
 
@@ -1010,21 +961,10 @@ namespace aux {
 #endif
 
 #ifdef TORRENT_STATS
-
 		m_stats_logger = 0;
 		m_log_seq = 0;
 		m_stats_logging_enabled = true;
 
-		memset(&m_last_cache_status, 0, sizeof(m_last_cache_status));
-		get_vm_stats(&m_last_vm_stat);
-
-		m_last_failed = 0;
-		m_last_redundant = 0;
-		m_last_uploaded = 0;
-		m_last_downloaded = 0;
-		get_thread_cpu_usage(&m_network_thread_cpu_usage);
-
-		reset_stat_counters();
 		rotate_stats_log();
 #endif
 #ifdef TORRENT_DISK_STATS
@@ -1092,36 +1032,6 @@ namespace aux {
 			fclose(m_stats_logger);
 		}
 
-		// make these cumulative for easier reading of graphs
-		// reset them every time the log is rotated though,
-		// to make them cumulative per one-hour graph
-		m_error_peers = 0;
-		m_disconnected_peers = 0;
-		m_eof_peers = 0;
-		m_connreset_peers = 0;
-		m_connrefused_peers = 0;
-		m_connaborted_peers = 0;
-		m_perm_peers = 0;
-		m_buffer_peers = 0;
-		m_unreachable_peers = 0;
-		m_broken_pipe_peers = 0;
-		m_addrinuse_peers = 0;
-		m_no_access_peers = 0;
-		m_invalid_arg_peers = 0;
-		m_aborted_peers = 0;
-		m_error_incoming_peers = 0;
-		m_error_outgoing_peers = 0;
-		m_error_rc4_peers = 0;
-		m_error_encrypted_peers = 0;
-		m_error_tcp_peers = 0;
-		m_error_utp_peers = 0;
-		m_connect_timeouts = 0;
-		m_uninteresting_peers = 0;
-		m_transport_timeout_peers = 0;
-		m_timeout_peers = 0;
-		m_no_memory_peers = 0;
-		m_too_many_peers = 0;
-
 		error_code ec;
 		char filename[100];
 		create_directory("session_stats", ec);
@@ -1135,169 +1045,14 @@ namespace aux {
 		}
 		m_last_log_rotation = time_now();
 
-		fputs("second:uploaded bytes:downloaded bytes:downloading torrents:seeding torrents"
-			":peers:connecting peers:disk block buffers:num list peers"
-			":peer allocations:peer storage bytes"
-			":checking torrents"
-			":stopped torrents"
-			":upload-only torrents"
-			":queued seed torrents"
-			":queued download torrents"
-			":peers bw-up:peers bw-down:peers disk-up:peers disk-down"
-			":upload rate:download rate:disk write queued bytes"
-			":peers down 0:peers down 0-2:peers down 2-5:peers down 5-10:peers down 10-50"
-			":peers down 50-100:peers down 100-"
-			":peers up 0:peers up 0-2:peers up 2-5:peers up 5-10:peers up 10-50:peers up 50-100"
-			":peers up 100-:error peers"
-			":peers down interesting:peers down unchoked:peers down requests"
-			":peers up interested:peers up unchoked:peers up requests"
-			":peer disconnects:peers eof:peers connection reset"
-			":outstanding requests:outstanding end-game requests"
-			":outstanding writing blocks"
-			":end game piece picker blocks"
-			":piece picker blocks"
-			":piece picks"
-			":reject piece picks"
-			":unchoke piece picks"
-			":incoming redundant piece picks"
-			":incoming piece picks"
-			":end game piece picks"
-			":snubbed piece picks"
-			":connect timeouts"
-			":uninteresting peers disconnect"
-			":timeout peers"
-			":% failed payload bytes"
-			":% wasted payload bytes"
-			":% protocol bytes"
-			":disk read time"
-			":disk write time"
-			":disk queue time"
-			":disk queue size"
-			":disk queued bytes"
-			":read cache hits"
-			":disk block read"
-			":disk block written"
-			":failed bytes"
-			":redundant bytes"
-			":error torrents"
-			":read disk cache size"
-			":disk cache size"
-			":disk buffer allocations"
-			":disk hash time"
-			":disk job time"
-			":disk sort time"
-			":connection attempts"
-			":banned peers"
-			":banned for hash failure"
-			":cache size"
-			":max connections"
-			":connect candidates"
-			":disk queue limit"
-			":disk queue low watermark"
-			":% read time"
-			":% write time"
-			":% hash time"
-			":% sort time"
-			":disk read back"
-			":% read back"
-			":disk read queue size"
-			":tick interval"
-			":tick residual"
-			":max unchoked"
-			":read job queue size limit"
-			":smooth upload rate"
-			":smooth download rate"
-			":num end-game peers"
-			":TCP up rate"
-			":TCP down rate"
-			":TCP up limit"
-			":TCP down limit"
-			":uTP up rate"
-			":uTP down rate"
-			":uTP peak send delay"
-			":uTP avg send delay"
-			":uTP peak recv delay"
-			":uTP avg recv delay"
-			":read ops/s"
-			":write ops/s"
-			":active resident pages"
-			":inactive resident pages"
-			":pinned resident pages"
-			":free pages"
-			":pageins"
-			":pageouts"
-			":page faults"
-			":smooth read ops/s"
-			":smooth write ops/s"
-			":pending reading bytes"
-			":read_counter"
-			":write_counter"
-			":tick_counter"
-			":lsd_counter"
-			":lsd_peer_counter"
-			":udp_counter"
-			":accept_counter"
-			":disk_queue_counter"
-			":disk_read_counter"
-			":disk_write_counter"
-			":up 8:up 16:up 32:up 64:up 128:up 256:up 512:up 1024:up 2048:up 4096:up 8192:up 16384:up 32768:up 65536:up 131072:up 262144:up 524288:up 1048576"
-			":down 8:down 16:down 32:down 64:down 128:down 256:down 512:down 1024:down 2048:down 4096:down 8192:down 16384:down 32768:down 65536:down 131072:down 262144:down 524288:down 1048576"
-			":network thread system time"
-			":network thread user+system time"
-
-			":redundant timed-out"
-			":redundant cancelled"
-			":redundant unknown"
-			":redundant seed"
-			":redundant end-game"
-			":redundant closing"
-			":no memory peer errors"
-			":too many peers"
-			":transport timeout peers"
-			":uTP idle"
-			":uTP syn-sent"
-			":uTP connected"
-			":uTP fin-sent"
-			":uTP close-wait"
-
-			":tcp peers"
-			":utp peers"
-
-			":connection refused peers"
-			":connection aborted peers"
-			":permission denied peers"
-			":no buffer peers"
-			":host unreachable peers"
-			":broken pipe peers"
-			":address in use peers"
-			":access denied peers"
-			":invalid argument peers"
-			":operation aborted peers"
-
-			":error incoming peers"
-			":error outgoing peers"
-			":error rc4 peers"
-			":error encrypted peers"
-			":error tcp peers"
-			":error utp peers"
-
-			":total peers"
-			":pending incoming block requests"
-			":average pending incoming block requests"
-
-			":torrents want more peers"
-			":average peers per limit"
-
-			":piece requests"
-			":max piece requests"
-			":invalid piece requests"
-			":choked piece requests"
-			":cancelled piece requests"
-			":piece rejects"
-
-			":peers up send buffer"
-
-			"\n\n", m_stats_logger);
+		// the columns are the session stats metrics, in the order
+		// of the metrics table
+		std::vector<stats_metric> stats = session_stats_metrics();
+		fputs("second", m_stats_logger);
+		for (std::vector<stats_metric>::iterator i = stats.begin()
+			, end(stats.end()); i != end; ++i)
+			fprintf(m_stats_logger, ":%s", i->name);
+		fputs("\n\n", m_stats_logger);
 	}
 #endif
 
@@ -1519,6 +1274,7 @@ namespace aux {
 				int& peak = m_as_peak[as_num];
 				if (peak < item.second->int_value()) peak = item.second->int_value();
 			}
+			as_rank_changed();
 		}
 #endif
 
@@ -1616,6 +1372,7 @@ namespace aux {
 
 		if (m_asnum_db) GeoIP_delete(m_asnum_db);
 		m_asnum_db = GeoIP_open(file.c_str(), GEOIP_STANDARD);
+		as_rank_changed();
 //		return m_asnum_db;
 	}
 
@@ -1628,6 +1385,7 @@ namespace aux {
 		std::string utf8;
 		wchar_utf8(file, utf8);
 		m_asnum_db = GeoIP_open(utf8.c_str(), GEOIP_STANDARD);
+		as_rank_changed();
 //		return m_asnum_db;
 	}
 
@@ -1776,6 +1534,7 @@ namespace aux {
 		m_i2p_conn.close(ec);
 #endif
 		m_queued_for_checking.clear();
+		if (m_torrent_loader) m_torrent_loader->abort();
 		stop_lsd();
 		stop_upnp();
 		stop_natpmp();
@@ -1951,6 +1710,11 @@ namespace aux {
 		bool connections_limit_changed = m_settings.connections_limit != s.connections_limit;
 		bool unchoke_limit_changed = m_settings.unchoke_slots_limit != s.unchoke_slots_limit;
 
+		// these settings are part of the seed rank
+		bool seed_rank_changed = m_settings.seed_time_limit != s.seed_time_limit
+			|| m_settings.seed_time_ratio_limit != s.seed_time_ratio_limit
+			|| m_settings.share_ratio_limit != s.share_ratio_limit;
+
 #ifndef TORRENT_NO_DEPRECATE
 		// support deprecated choker settings
 		if (s.choking_algorithm == session_settings::rate_based_choker)
@@ -2057,6 +1821,15 @@ namespace aux {
 		update_rate_settings();
 
 		if (connections_limit_changed) update_connections_limit();
+
+		if (seed_rank_changed)
+		{
+			std::vector<torrent*> seeds(m_auto_manage_queues[seed_queue].begin()
+				, m_auto_manage_queues[seed_queue].end());
+			for (std::vector<torrent*>::iterator i = seeds.begin()
+				, end(seeds.end()); i != end; ++i)
+				update_auto_manage_state(*i);
+		}
 		if (unchoke_limit_changed) update_unchoke_limit();
 
 		// enable anonymous mode. We don't want to accept any incoming
@@ -2502,9 +2275,7 @@ retry:
 	bool session_impl::incoming_packet(error_code const& ec
 		, udp::endpoint const& ep, char const* buf, int size)
 	{
-#ifdef TORRENT_STATS
-		++m_num_messages[on_udp_counter];
-#endif
+		inc_stats_counter(counters::on_udp_counter);
 
 		if (ec)
 		{
@@ -2558,9 +2329,7 @@ retry:
 #if defined TORRENT_ASIO_DEBUGGING
 		complete_async("session_impl::on_accept_connection");
 #endif
-#ifdef TORRENT_STATS
-		++m_num_messages[on_accept_counter];
-#endif
+		inc_stats_counter(counters::on_accept_counter);
 		TORRENT_ASSERT(is_network_thread());
 		boost::shared_ptr<socket_acceptor> listener = listen_socket.lock();
 		if (!listener) return;
@@ -2968,9 +2737,7 @@ retry:
 	// wake them up
 	void session_impl::on_disk_queue()
 	{
-#ifdef TORRENT_STATS
-		++m_num_messages[on_disk_queue_counter];
-#endif
+		inc_stats_counter(counters::on_disk_queue_counter);
 		TORRENT_ASSERT(is_network_thread());
 
 		// just to play it safe
@@ -3012,9 +2779,7 @@ retry:
 #if defined TORRENT_ASIO_DEBUGGING
 		complete_async("session_impl::on_tick");
 #endif
-#ifdef TORRENT_STATS
-		++m_num_messages[on_tick_counter];
-#endif
+		inc_stats_counter(counters::on_tick_counter);
 
 		TORRENT_ASSERT(is_network_thread());
 
@@ -3102,6 +2867,9 @@ retry:
 					else
 						pe->last_connected -= four_hours;
 				}
+				// clamping last_connected to 0 may have made peers
+				// tie that didn't before, which changes their order
+				p.rebuild_candidates();
 			}
 		}
 
@@ -3252,11 +3020,47 @@ retry:
 				++num_downloads;
 				num_downloads_peers += t.num_peers();
 			}
-
-			t.second_tick(m_stat, tick_interval_ms);
 			++i;
 		}
 
+		// wake up the dormant torrents whose timers expired. They
+		// are ticked along with the others right below
+		std::vector<timer_entry*> expired;
+		m_torrent_timers.advance(timer_tick(now), expired);
+		for (std::vector<timer_entry*>::iterator i = expired.begin()
+			, end(expired.end()); i != end; ++i)
+		{
+			static_cast<torrent*>((*i)->userdata)->wake_up();
+		}
+
+		// evict the metadata of torrents that have been dormant for long
+		// enough. The metadata cache is written synchronously, so the
+		// number of evictions per tick is limited. The remaining ones
+		// are pushed to the next tick
+		expired.clear();
+		m_unload_timers.advance(timer_tick(now), expired);
+		const int max_unloads_per_tick = 50;
+		for (int k = 0; k < int(expired.size()); ++k)
+		{
+			if (k < max_unloads_per_tick)
+				static_cast<torrent*>(expired[k]->userdata)->unload_metadata();
+			else
+				schedule_torrent_unload(expired[k], 1);
+		}
+
+		// torrents may go dormant from within second_tick(), in which
+		// case the last torrent in the list is moved into its slot
+		ptime torrent_tick_start = time_now_hires();
+		for (int i = 0; i < int(m_ticking_torrents.size());)
+		{
+			torrent* t = m_ticking_torrents[i];
+			TORRENT_ASSERT(!t->is_aborted());
+			t->second_tick(m_stat, tick_interval_ms);
+			if (i < int(m_ticking_torrents.size()) && m_ticking_torrents[i] == t) ++i;
+		}
+		++m_torrent_tick_histogram[tick_histogram_bucket(
+			time_now_hires() - torrent_tick_start)];
+
 		// some people claim that there sometimes can be cases where
 		// there is no torrent being checked, but there are torrents
 		// waiting to be checked. I have never seen this, and I can't
@@ -3332,7 +3136,7 @@ retry:
 
 		if (m_stats_logging_enabled)
 		{
-			print_log_line(tick_interval_ms, now);
+			print_log_line(now);
 		}
 #endif
 
@@ -3472,6 +3276,8 @@ retry:
 
 		while (m_tick_residual >= 1000) m_tick_residual -= 1000;
 //		m_peer_pool.release_memory();
+
+		++m_tick_histogram[tick_histogram_bucket(time_now_hires() - now)];
 	}
 
 #ifdef TORRENT_STATS
@@ -3482,7 +3288,6 @@ retry:
 
 		m_stats_logging_enabled = s;
 
-		reset_stat_counters();
 		if (!s)
 		{
 			if (m_stats_logger) fclose(m_stats_logger);
@@ -3490,491 +3295,37 @@ retry:
 		}
 		else
 		{
+			update_stats_gauges();
+			m_last_stats_counters = m_stats_counters;
 			rotate_stats_log();
-			get_thread_cpu_usage(&m_network_thread_cpu_usage);
 		}
 	}
 
-	void session_impl::reset_stat_counters()
-	{
-		m_end_game_piece_picker_blocks = 0;
-		m_piece_picker_blocks = 0;
-		m_piece_picks = 0;
-		m_reject_piece_picks = 0;
-		m_unchoke_piece_picks = 0;
-		m_incoming_redundant_piece_picks = 0;
-		m_incoming_piece_picks = 0;
-		m_end_game_piece_picks = 0;
-		m_snubbed_piece_picks = 0;
-		m_connection_attempts = 0;
-		m_num_banned_peers = 0;
-		m_banned_for_hash_failure = 0;
-
-		m_piece_requests = 0;
-		m_max_piece_requests = 0;
-		m_invalid_piece_requests = 0;
-		m_choked_piece_requests = 0;
-		m_cancelled_piece_requests = 0;
-		m_piece_rejects = 0;
-
-		memset(m_num_messages, 0, sizeof(m_num_messages));
-		memset(m_send_buffer_sizes, 0, sizeof(m_send_buffer_sizes));
-		memset(m_recv_buffer_sizes, 0, sizeof(m_recv_buffer_sizes));
-	}
-
-	void session_impl::print_log_line(int tick_interval_ms, ptime now)
+	void session_impl::print_log_line(ptime now)
 	{
-		int connect_candidates = 0;
-
-		int checking_torrents = 0;
-		int stopped_torrents = 0;
-		int upload_only_torrents = 0;
-		int downloading_torrents = 0;
-		int seeding_torrents = 0;
-		int queued_seed_torrents = 0;
-		int queued_download_torrents = 0;
-		int error_torrents = 0;
-
-		int num_peers = 0;
-		int peer_dl_rate_buckets[7];
-		int peer_ul_rate_buckets[7];
-		memset(peer_dl_rate_buckets, 0, sizeof(peer_dl_rate_buckets));
-		memset(peer_ul_rate_buckets, 0, sizeof(peer_ul_rate_buckets));
-		int outstanding_requests = 0;
-		int outstanding_end_game_requests = 0;
-		int outstanding_write_blocks = 0;
-
-		int peers_up_interested = 0;
-		int peers_down_interesting = 0;
-		int peers_up_requests = 0;
-		int peers_down_requests = 0;
-		int peers_up_send_buffer = 0;
-
-		// number of torrents that want more peers
-		int num_want_more_peers = 0;
-
-		// number of peers among torrents with a peer limit
-		int num_limited_peers = 0;
-		// sum of limits of all torrents with a peer limit
-		int total_peers_limit = 0;
-
-		std::vector<partial_piece_info> dq;
-		for (torrent_map::iterator i = m_torrents.begin()
-			, end(m_torrents.end()); i != end; ++i)
-		{
-			torrent* t = i->second.get();
-			int connection_slots = (std::max)(t->max_connections() - t->num_peers(), 0);
-			int candidates = t->get_policy().num_connect_candidates();
-			connect_candidates += (std::min)(candidates, connection_slots);
-			num_peers += t->get_policy().num_peers();
+		if (now - m_last_log_rotation > hours(1))
+			rotate_stats_log();
 
-			if (t->want_more_peers()) ++num_want_more_peers;
-			if (t->max_connections() > 0)
-			{
-				num_limited_peers += t->num_peers();
-				num_limited_peers += t->max_connections();
-			}
+		if (m_stats_logger == 0) return;
 
-			if (t->has_error())
-				++error_torrents;
-			else
-			{
-				if (t->is_paused())
-				{
-					if (!t->is_auto_managed())
-						++stopped_torrents;
-					else
-					{
-						if (t->is_seed())
-							++queued_seed_torrents;
-						else
-							++queued_download_torrents;
-					}
-				}
-				else
-				{
-					if (i->second->state() == torrent_status::checking_files
-						|| i->second->state() == torrent_status::queued_for_checking)
-						++checking_torrents;
-					else if (i->second->is_seed())
-						++seeding_torrents;
-					else if (i->second->is_upload_only())
-						++upload_only_torrents;
-					else
-						++downloading_torrents;
-				}
-			}
+		update_stats_gauges();
 
-			dq.clear();
-			i->second->get_download_queue(&dq);
-			for (std::vector<partial_piece_info>::iterator j = dq.begin()
-				, end(dq.end()); j != end; ++j)
-			{
-				for (int k = 0; k < j->blocks_in_piece; ++k)
-				{
-					block_info& bi = j->blocks[k];
-					if (bi.state == block_info::requested)
-					{
-						++outstanding_requests;
-						if (bi.num_peers > 1) ++outstanding_end_game_requests;
-					}
-					else if (bi.state == block_info::writing)
-						++outstanding_write_blocks;
-				}
-			}
-		}
-		int tcp_up_rate = 0;
-		int tcp_down_rate = 0;
-		int utp_up_rate = 0;
-		int utp_down_rate = 0;
-		int utp_peak_send_delay = 0;
-		int utp_peak_recv_delay = 0;
-		boost::uint64_t utp_send_delay_sum = 0;
-		boost::uint64_t utp_recv_delay_sum = 0;
-		int num_utp_peers = 0;
-		int num_tcp_peers = 0;
-		int utp_num_delay_sockets = 0;
-		int utp_num_recv_delay_sockets = 0;
-		int num_complete_connections = 0;
-		int num_half_open = 0;
-		int peers_down_unchoked = 0;
-		int peers_up_unchoked = 0;
-		int num_end_game_peers = 0;
-		int reading_bytes = 0;
-		int pending_incoming_reqs = 0;
+		fprintf(m_stats_logger, "%f", total_milliseconds(now - m_last_log_rotation) / 1000.f);
 
-		for (connection_map::iterator i = m_connections.begin()
-			, end(m_connections.end()); i != end; ++i)
+		// counters are logged as the change since the last line,
+		// gauges are logged as they are
+		std::vector<stats_metric> stats = session_stats_metrics();
+		for (std::vector<stats_metric>::iterator i = stats.begin()
+			, end(stats.end()); i != end; ++i)
 		{
-			peer_connection* p = i->get();
-			if (p->is_connecting())
-			{
-				++num_half_open;
-				continue;
-			}
-
-			++num_complete_connections;
-			if (!p->is_choked()) ++peers_up_unchoked;
-			if (!p->has_peer_choked()) ++peers_down_unchoked;
-			if (!p->download_queue().empty()) ++peers_down_requests;
-			if (p->is_peer_interested()) ++peers_up_interested;
-			if (p->is_interesting()) ++peers_down_interesting;
-			if (p->send_buffer_size() > 100 || !p->upload_queue().empty() || p->num_reading_bytes() > 0)
-				++peers_up_requests;
-			if (p->endgame()) ++num_end_game_peers;
-			reading_bytes += p->num_reading_bytes();
-
-			pending_incoming_reqs += int(p->upload_queue().size());
-
-			int dl_bucket = 0;
-			int dl_rate = p->statistics().download_payload_rate();
-			if (dl_rate == 0) dl_bucket = 0;
-			else if (dl_rate < 2000) dl_bucket = 1;
-			else if (dl_rate < 5000) dl_bucket = 2;
-			else if (dl_rate < 10000) dl_bucket = 3;
-			else if (dl_rate < 50000) dl_bucket = 4;
-			else if (dl_rate < 100000) dl_bucket = 5;
-			else dl_bucket = 6;
-
-			int ul_rate = p->statistics().upload_payload_rate();
-			int ul_bucket = 0;
-			if (ul_rate == 0) ul_bucket = 0;
-			else if (ul_rate < 2000) ul_bucket = 1;
-			else if (ul_rate < 5000) ul_bucket = 2;
-			else if (ul_rate < 10000) ul_bucket = 3;
-			else if (ul_rate < 50000) ul_bucket = 4;
-			else if (ul_rate < 100000) ul_bucket = 5;
-			else ul_bucket = 6;
-
-			++peer_dl_rate_buckets[dl_bucket];
-			++peer_ul_rate_buckets[ul_bucket];
-
-			boost::uint64_t upload_rate = int(p->statistics().upload_rate());
-			int buffer_size_watermark = upload_rate
-				* m_settings.send_buffer_watermark_factor / 100;
-			if (buffer_size_watermark < m_settings.send_buffer_low_watermark)
-				buffer_size_watermark = m_settings.send_buffer_low_watermark;
-			else if (buffer_size_watermark > m_settings.send_buffer_watermark)
-				buffer_size_watermark = m_settings.send_buffer_watermark;
-			if (p->send_buffer_size() + p->num_reading_bytes() >= buffer_size_watermark)
-				++peers_up_send_buffer;
-
-			utp_stream* utp_socket = p->get_socket()->get<utp_stream>();
-#ifdef TORRENT_USE_OPENSSL
-			if (!utp_socket)
-			{
-				ssl_stream<utp_stream>* ssl_str = p->get_socket()->get<ssl_stream<utp_stream> >();
-				if (ssl_str) utp_socket = &ssl_str->next_layer();
-			}
-#endif
-			if (utp_socket)
-			{
-				utp_up_rate += ul_rate;
-				utp_down_rate += dl_rate;
-				int send_delay = utp_socket->send_delay();
-				int recv_delay = utp_socket->recv_delay();
-				utp_peak_send_delay = (std::max)(utp_peak_send_delay, send_delay);
-				utp_peak_recv_delay = (std::max)(utp_peak_recv_delay, recv_delay);
-				if (send_delay > 0)
-				{
-					utp_send_delay_sum += send_delay;
-					++utp_num_delay_sockets;
-				}
-				if (recv_delay > 0)
-				{
-					utp_recv_delay_sum += recv_delay;
-					++utp_num_recv_delay_sockets;
-				}
-				++num_utp_peers;
-			}
-			else
-			{
-				tcp_up_rate += ul_rate;
-				tcp_down_rate += dl_rate;
-				++num_tcp_peers;
-			}
-
+			boost::int64_t value = m_stats_counters[i->value_index];
+			if (i->type == stats_metric::type_counter)
+				value -= m_last_stats_counters[i->value_index];
+			fprintf(m_stats_logger, "\t%"PRId64, value);
 		}
+		fputs("\n", m_stats_logger);
 
-		int low_watermark = m_settings.max_queued_disk_bytes_low_watermark == 0
-			|| m_settings.max_queued_disk_bytes_low_watermark >= m_settings.max_queued_disk_bytes
-			? size_type(m_settings.max_queued_disk_bytes) * 7 / 8
-			: m_settings.max_queued_disk_bytes_low_watermark;
-
-		if (now - m_last_log_rotation > hours(1))
-			rotate_stats_log();
-
-		// system memory stats
-		vm_statistics_data_t vm_stat;
-		get_vm_stats(&vm_stat);
-		thread_cpu_usage cur_cpu_usage;
-		get_thread_cpu_usage(&cur_cpu_usage);
-
-		if (m_stats_logger)
-		{
-			cache_status cs = m_disk_thread.status();
-			session_status sst = status();
-
-			m_read_ops.add_sample((cs.reads - m_last_cache_status.reads) * 1000.0 / float(tick_interval_ms));
-			m_write_ops.add_sample((cs.writes - m_last_cache_status.writes) * 1000.0 / float(tick_interval_ms));
-
-			int total_job_time = cs.cumulative_job_time == 0 ? 1 : cs.cumulative_job_time;
-
-#define STAT_LOG(type, val) fprintf(m_stats_logger, "%" #type "\t", val)
-
-			STAT_LOG(f, total_milliseconds(now - m_last_log_rotation) / 1000.f);
-			size_type uploaded = m_stat.total_upload() - m_last_uploaded;
-			STAT_LOG(d, int(uploaded));
-			size_type downloaded = m_stat.total_download() - m_last_downloaded;
-			STAT_LOG(d, int(downloaded));
-			STAT_LOG(d, downloading_torrents);
-			STAT_LOG(d, seeding_torrents);
-			STAT_LOG(d, num_complete_connections);
-			STAT_LOG(d, num_half_open);
-			STAT_LOG(d, m_disk_thread.disk_allocations());
-			STAT_LOG(d, num_peers);
-			STAT_LOG(d, logging_allocator::allocations);
-			STAT_LOG(d, logging_allocator::allocated_bytes);
-			STAT_LOG(d, checking_torrents);
-			STAT_LOG(d, stopped_torrents);
-			STAT_LOG(d, upload_only_torrents);
-			STAT_LOG(d, queued_seed_torrents);
-			STAT_LOG(d, queued_download_torrents);
-			STAT_LOG(d, m_upload_rate.queue_size());
-			STAT_LOG(d, m_download_rate.queue_size());
-			STAT_LOG(d, m_disk_queues[peer_connection::upload_channel]);
-			STAT_LOG(d, m_disk_queues[peer_connection::download_channel]);
-			STAT_LOG(d, m_stat.upload_rate());
-			STAT_LOG(d, m_stat.download_rate());
-			STAT_LOG(d, int(m_disk_thread.queue_buffer_size()));
-			STAT_LOG(d, peer_dl_rate_buckets[0]);
-			STAT_LOG(d, peer_dl_rate_buckets[1]);
-			STAT_LOG(d, peer_dl_rate_buckets[2]);
-			STAT_LOG(d, peer_dl_rate_buckets[3]);
-			STAT_LOG(d, peer_dl_rate_buckets[4]);
-			STAT_LOG(d, peer_dl_rate_buckets[5]);
-			STAT_LOG(d, peer_dl_rate_buckets[6]);
-			STAT_LOG(d, peer_ul_rate_buckets[0]);
-			STAT_LOG(d, peer_ul_rate_buckets[1]);
-			STAT_LOG(d, peer_ul_rate_buckets[2]);
-			STAT_LOG(d, peer_ul_rate_buckets[3]);
-			STAT_LOG(d, peer_ul_rate_buckets[4]);
-			STAT_LOG(d, peer_ul_rate_buckets[5]);
-			STAT_LOG(d, peer_ul_rate_buckets[6]);
-			STAT_LOG(d, m_error_peers);
-			STAT_LOG(d, peers_down_interesting);
-			STAT_LOG(d, peers_down_unchoked);
-			STAT_LOG(d, peers_down_requests);
-			STAT_LOG(d, peers_up_interested);
-			STAT_LOG(d, peers_up_unchoked);
-			STAT_LOG(d, peers_up_requests);
-			STAT_LOG(d, m_disconnected_peers);
-			STAT_LOG(d, m_eof_peers);
-			STAT_LOG(d, m_connreset_peers);
-			STAT_LOG(d, outstanding_requests);
-			STAT_LOG(d, outstanding_end_game_requests);
-			STAT_LOG(d, outstanding_write_blocks);
-			STAT_LOG(d, m_end_game_piece_picker_blocks);
-			STAT_LOG(d, m_piece_picker_blocks);
-			STAT_LOG(d, m_piece_picks);
-			STAT_LOG(d, m_reject_piece_picks);
-			STAT_LOG(d, m_unchoke_piece_picks);
-			STAT_LOG(d, m_incoming_redundant_piece_picks);
-			STAT_LOG(d, m_incoming_piece_picks);
-			STAT_LOG(d, m_end_game_piece_picks);
-			STAT_LOG(d, m_snubbed_piece_picks);
-			STAT_LOG(d, m_connect_timeouts);
-			STAT_LOG(d, m_uninteresting_peers);
-			STAT_LOG(d, m_timeout_peers);
-			STAT_LOG(f, (float(m_total_failed_bytes) * 100.f / (m_stat.total_payload_download() == 0 ? 1 : m_stat.total_payload_download())));
-			STAT_LOG(f, (float(m_total_redundant_bytes) * 100.f / (m_stat.total_payload_download() == 0 ? 1 : m_stat.total_payload_download())));
-			STAT_LOG(f, (float(m_stat.total_protocol_download()) * 100.f / (m_stat.total_download() == 0 ? 1 : m_stat.total_download())));
-			STAT_LOG(f, float(cs.average_read_time) / 1000000.f);
-			STAT_LOG(f, float(cs.average_write_time) / 1000000.f);
-			STAT_LOG(f, float(cs.average_queue_time) / 1000000.f);
-			STAT_LOG(d, int(cs.job_queue_length));
-			STAT_LOG(d, int(cs.queued_bytes));
-			STAT_LOG(d, int(cs.blocks_read_hit - m_last_cache_status.blocks_read_hit));
-			STAT_LOG(d, int(cs.blocks_read - m_last_cache_status.blocks_read));
-			STAT_LOG(d, int(cs.blocks_written - m_last_cache_status.blocks_written));
-			STAT_LOG(d, int(m_total_failed_bytes - m_last_failed));
-			STAT_LOG(d, int(m_total_redundant_bytes - m_last_redundant));
-			STAT_LOG(d, error_torrents);
-			STAT_LOG(d, cs.read_cache_size);
-			STAT_LOG(d, cs.cache_size);
-			STAT_LOG(d, cs.total_used_buffers);
-			STAT_LOG(f, float(cs.average_hash_time) / 1000000.f);
-			STAT_LOG(f, float(cs.average_job_time) / 1000000.f);
-			STAT_LOG(f, float(cs.average_sort_time) / 1000000.f);
-			STAT_LOG(d, m_connection_attempts);
-			STAT_LOG(d, m_num_banned_peers);
-			STAT_LOG(d, m_banned_for_hash_failure);
-			STAT_LOG(d, m_settings.cache_size);
-			STAT_LOG(d, m_settings.connections_limit);
-			STAT_LOG(d, connect_candidates);
-			STAT_LOG(d, int(m_settings.max_queued_disk_bytes));
-			STAT_LOG(d, low_watermark);
-			STAT_LOG(f, float(cs.cumulative_read_time * 100.f / total_job_time));
-			STAT_LOG(f, float(cs.cumulative_write_time * 100.f / total_job_time));
-			STAT_LOG(f, float(cs.cumulative_hash_time * 100.f / total_job_time));
-			STAT_LOG(f, float(cs.cumulative_sort_time * 100.f / total_job_time));
-			STAT_LOG(d, int(cs.total_read_back - m_last_cache_status.total_read_back));
-			STAT_LOG(f, float(cs.total_read_back * 100.f / (cs.blocks_written == 0 ? 1: cs.blocks_written)));
-			STAT_LOG(d, cs.read_queue_size);
-			STAT_LOG(f, float(tick_interval_ms) / 1000.f);
-			STAT_LOG(f, float(m_tick_residual) / 1000.f);
-			STAT_LOG(d, m_allowed_upload_slots);
-			STAT_LOG(d, m_settings.unchoke_slots_limit * 2);
-			STAT_LOG(d, m_stat.low_pass_upload_rate());
-			STAT_LOG(d, m_stat.low_pass_download_rate());
-			STAT_LOG(d, num_end_game_peers);
-			STAT_LOG(d, tcp_up_rate);
-			STAT_LOG(d, tcp_down_rate);
-			STAT_LOG(d, int(m_tcp_upload_channel.throttle()));
-			STAT_LOG(d, int(m_tcp_download_channel.throttle()));
-			STAT_LOG(d, utp_up_rate);
-			STAT_LOG(d, utp_down_rate);
-			STAT_LOG(f, float(utp_peak_send_delay) / 1000000.f);
-			STAT_LOG(f, float(utp_num_delay_sockets ? float(utp_send_delay_sum) / float(utp_num_delay_sockets) : 0) / 1000000.f);
-			STAT_LOG(f, float(utp_peak_recv_delay) / 1000000.f);
-			STAT_LOG(f, float(utp_num_recv_delay_sockets ? float(utp_recv_delay_sum) / float(utp_num_recv_delay_sockets) : 0) / 1000000.f);
-			STAT_LOG(f, float(cs.reads - m_last_cache_status.reads) * 1000.0 / float(tick_interval_ms));
-			STAT_LOG(f, float(cs.writes - m_last_cache_status.writes) * 1000.0 / float(tick_interval_ms));
-
-			STAT_LOG(d, int(vm_stat.active_count));
-			STAT_LOG(d, int(vm_stat.inactive_count));
-			STAT_LOG(d, int(vm_stat.wire_count));
-			STAT_LOG(d, int(vm_stat.free_count));
-			STAT_LOG(d, int(vm_stat.pageins - m_last_vm_stat.pageins));
-			STAT_LOG(d, int(vm_stat.pageouts - m_last_vm_stat.pageouts));
-			STAT_LOG(d, int(vm_stat.faults - m_last_vm_stat.faults));
-
-			STAT_LOG(d, m_read_ops.mean());
-			STAT_LOG(d, m_write_ops.mean());
-
-			STAT_LOG(d, reading_bytes);
-
-			for (int i = 0; i < max_messages; ++i)
-				STAT_LOG(d, m_num_messages[i]);
-			int num_max = sizeof(m_send_buffer_sizes)/sizeof(m_send_buffer_sizes[0]);
-			for (int i = 0; i < num_max; ++i)
-				STAT_LOG(d, m_send_buffer_sizes[i]);
-			num_max = sizeof(m_recv_buffer_sizes)/sizeof(m_recv_buffer_sizes[0]);
-			for (int i = 0; i < num_max; ++i)
-				STAT_LOG(d, m_recv_buffer_sizes[i]);
-
-			STAT_LOG(f, total_microseconds(cur_cpu_usage.user_time
-				- m_network_thread_cpu_usage.user_time) / double(tick_interval_ms * 10));
-			STAT_LOG(f, (total_microseconds(cur_cpu_usage.system_time
-					- m_network_thread_cpu_usage.system_time)
-				+ total_microseconds(cur_cpu_usage.user_time
-					- m_network_thread_cpu_usage.user_time))
-				/ double(tick_interval_ms * 10));
-
-			for (int i = 0; i < torrent::waste_reason_max; ++i)
-				STAT_LOG(f, (m_redundant_bytes[i] * 100.) / double(m_total_redundant_bytes == 0 ? 1 : m_total_redundant_bytes));
-
-			STAT_LOG(d, m_no_memory_peers);
-			STAT_LOG(d, m_too_many_peers);
-			STAT_LOG(d, m_transport_timeout_peers);
-
-			STAT_LOG(d, sst.utp_stats.num_idle);
-			STAT_LOG(d, sst.utp_stats.num_syn_sent);
-			STAT_LOG(d, sst.utp_stats.num_connected);
-			STAT_LOG(d, sst.utp_stats.num_fin_sent);
-			STAT_LOG(d, sst.utp_stats.num_close_wait);
-
-			STAT_LOG(d, num_tcp_peers);
-			STAT_LOG(d, num_utp_peers);
-
-			STAT_LOG(d, m_connrefused_peers);
-			STAT_LOG(d, m_connaborted_peers);
-			STAT_LOG(d, m_perm_peers);
-			STAT_LOG(d, m_buffer_peers);
-			STAT_LOG(d, m_unreachable_peers);
-			STAT_LOG(d, m_broken_pipe_peers);
-			STAT_LOG(d, m_addrinuse_peers);
-			STAT_LOG(d, m_no_access_peers);
-			STAT_LOG(d, m_invalid_arg_peers);
-			STAT_LOG(d, m_aborted_peers);
-
-			STAT_LOG(d, m_error_incoming_peers);
-			STAT_LOG(d, m_error_outgoing_peers);
-			STAT_LOG(d, m_error_rc4_peers);
-			STAT_LOG(d, m_error_encrypted_peers);
-			STAT_LOG(d, m_error_tcp_peers);
-			STAT_LOG(d, m_error_utp_peers);
-
-			STAT_LOG(d, int(m_connections.size()));
-			STAT_LOG(d, pending_incoming_reqs);
-			STAT_LOG(f, num_complete_connections == 0 ? 0.f : (float(pending_incoming_reqs) / num_complete_connections));
-
-			STAT_LOG(d, num_want_more_peers);
-			STAT_LOG(f, total_peers_limit == 0 ? 0 : float(num_limited_peers) / total_peers_limit);
-
-			STAT_LOG(d, m_piece_requests);
-			STAT_LOG(d, m_max_piece_requests);
-			STAT_LOG(d, m_invalid_piece_requests);
-			STAT_LOG(d, m_choked_piece_requests);
-			STAT_LOG(d, m_cancelled_piece_requests);
-			STAT_LOG(d, m_piece_rejects);
-
-			STAT_LOG(d, peers_up_send_buffer);
-
-			fprintf(m_stats_logger, "\n");
-
-#undef STAT_LOG
-
-			m_last_cache_status = cs;
-			m_last_vm_stat = vm_stat;
-			m_network_thread_cpu_usage = cur_cpu_usage;
-			m_last_failed = m_total_failed_bytes;
-			m_last_redundant = m_total_redundant_bytes;
-			m_last_uploaded = m_stat.total_upload();
-			m_last_downloaded = m_stat.total_download();
-		}
-
-		reset_stat_counters();
+		m_last_stats_counters = m_stats_counters;
 	}
 #endif // TORRENT_STATS
 
@@ -4090,9 +3441,7 @@ retry:
 #if defined TORRENT_ASIO_DEBUGGING
 		complete_async("session_impl::on_lsd_announce");
 #endif
-#ifdef TORRENT_STATS
-		++m_num_messages[on_lsd_counter];
-#endif
+		inc_stats_counter(counters::on_lsd_counter);
 		TORRENT_ASSERT(is_network_thread());
 		if (e) return;
 
@@ -4137,50 +3486,82 @@ retry:
 		}
 	}
 
-	void session_impl::auto_manage_torrents(std::vector<torrent*>& list
+	void session_impl::auto_manage_torrent(torrent* t
 		, int& dht_limit, int& tracker_limit, int& lsd_limit
-		, int& hard_limit, int type_limit)
+		, int& hard_limit, int& type_limit
+		, std::vector<auto_manage_decision>& decisions)
 	{
-		for (std::vector<torrent*>::iterator i = list.begin()
-			, end(list.end()); i != end; ++i)
+		TORRENT_ASSERT(t->state() != torrent_status::checking_files
+			&& t->state() != torrent_status::queued_for_checking);
+
+		--dht_limit;
+		--lsd_limit;
+		--tracker_limit;
+		auto_manage_decision d;
+		d.t = t;
+		d.announce_to_dht = dht_limit >= 0;
+		d.announce_to_trackers = tracker_limit >= 0;
+		d.announce_to_lsd = lsd_limit >= 0;
+
+		if (!t->is_paused() && !is_active(t, settings())
+			&& hard_limit > 0)
 		{
-			torrent* t = *i;
+			--hard_limit;
+			d.start = -1;
+		}
+		else if (type_limit > 0 && hard_limit > 0)
+		{
+			--hard_limit;
+			--type_limit;
+			d.start = 1;
+		}
+		else
+		{
+			d.start = 0;
+		}
+		decisions.push_back(d);
+	}
 
-			if ((t->state() == torrent_status::checking_files
-				|| t->state() == torrent_status::queued_for_checking))
-				continue;
+	void session_impl::auto_manage_torrents(int queue
+		, int& dht_limit, int& tracker_limit, int& lsd_limit
+		, int& hard_limit, int type_limit
+		, std::vector<auto_manage_decision>& decisions)
+	{
+		auto_manage_queue_t const& q = m_auto_manage_queues[queue];
+		auto_manage_queue_t::const_iterator i = q.begin();
+		for (; i != q.end(); ++i)
+		{
+			// once all the limits are used up, every torrent further
+			// down the queue will be paused and not announce
+			if (dht_limit <= 0 && tracker_limit <= 0 && lsd_limit <= 0
+				&& (type_limit <= 0 || hard_limit <= 0))
+				break;
 
-			--dht_limit;
-			--lsd_limit;
-			--tracker_limit;
-			t->set_announce_to_dht(dht_limit >= 0);
-			t->set_announce_to_trackers(tracker_limit >= 0);
-			t->set_announce_to_lsd(lsd_limit >= 0);
+			auto_manage_torrent(*i, dht_limit, tracker_limit, lsd_limit
+				, hard_limit, type_limit, decisions);
+		}
+		if (i == q.end()) return;
 
-			if (!t->is_paused() && !is_active(t, settings())
-				&& hard_limit > 0)
-			{
-				--hard_limit;
-				continue;
-			}
+		// the torrents we didn't visit only need to be looked at if
+		// they're running or announcing. They're still visited in queue
+		// order, since inactive torrents that are already running may
+		// be left running as long as there are slots under the hard limit
+		std::vector<torrent*> rest;
+		for (std::vector<torrent*>::const_iterator j = m_engaged_torrents.begin()
+			, end(m_engaged_torrents.end()); j != end; ++j)
+		{
+			torrent* t = *j;
+			if (t->auto_manage_queue() != queue) continue;
+			if (q.key_comp()(t, *i)) continue;
+			rest.push_back(t);
+		}
+		std::sort(rest.begin(), rest.end(), q.key_comp());
 
-			if (type_limit > 0 && hard_limit > 0)
-			{
-				--hard_limit;
-				--type_limit;
-#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
-				t->log_to_all_peers("AUTO MANAGER STARTING TORRENT");
-#endif
-				t->set_allow_peers(true);
-			}
-			else
-			{
-#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
-				t->log_to_all_peers("AUTO MANAGER PAUSING TORRENT");
-#endif
-				// use graceful pause for auto-managed torrents
-				t->set_allow_peers(false, true);
-			}
+		for (std::vector<torrent*>::iterator j = rest.begin()
+			, end(rest.end()); j != end; ++j)
+		{
+			auto_manage_torrent(*j, dht_limit, tracker_limit, lsd_limit
+				, hard_limit, type_limit, decisions);
 		}
 	}
 
@@ -4190,12 +3571,6 @@ retry:
 
 		m_need_auto_manage = false;
 
-		// these vectors are filled with auto managed torrents
-		std::vector<torrent*> downloaders;
-		downloaders.reserve(m_torrents.size());
-		std::vector<torrent*> seeds;
-		seeds.reserve(m_torrents.size());
-
 		// these counters are set to the number of torrents
 		// of each kind we're allowed to have active
 		int num_downloaders = settings().active_downloads;
@@ -4212,75 +3587,167 @@ retry:
 		if (hard_limit == -1)
 			hard_limit = (std::numeric_limits<int>::max)();
 
-		for (torrent_map::iterator i = m_torrents.begin()
-			, end(m_torrents.end()); i != end; ++i)
+		// checking torrents are not subject to auto-management
+		std::vector<torrent*> checking(m_auto_manage_queues[checking_queue].begin()
+			, m_auto_manage_queues[checking_queue].end());
+		for (std::vector<torrent*>::iterator i = checking.begin()
+			, end(checking.end()); i != end; ++i)
 		{
-			torrent* t = i->second.get();
-			TORRENT_ASSERT(t);
+			if ((*i)->is_paused()) (*i)->resume();
+		}
+		m_auto_manage_evaluations += checking.size();
 
-			// checking torrents are not subject to auto-management
-			if (t->state() == torrent_status::checking_files
+		// the seed rank of running torrents changes over time. Refresh
+		// their position in the seed queue. The engaged list is not
+		// modified by this, only the order of the seed queue
+		for (int i = 0; i < int(m_engaged_torrents.size()); ++i)
+		{
+			torrent* t = m_engaged_torrents[i];
+			if (t->auto_manage_queue() == seed_queue)
+				update_auto_manage_state(t);
+		}
+
+		// torrents that are running without being managed by us
+		// (because they're not auto managed or have an error) take
+		// up slots too. They are all engaged
+		for (std::vector<torrent*>::const_iterator i = m_engaged_torrents.begin()
+			, end(m_engaged_torrents.end()); i != end; ++i)
+		{
+			torrent* t = *i;
+			if (t->auto_manage_queue() != -1) continue;
+			if (t->state() == torrent_status::checking_files
 				|| t->state() == torrent_status::queued_for_checking)
-			{
-				if (t->is_auto_managed() && t->is_paused()) t->resume();
 				continue;
-			}
-			if (t->is_auto_managed() && !t->has_error())
+			if (t->is_paused()) continue;
+
+			TORRENT_ASSERT(t->m_resume_data_loaded || !t->valid_metadata());
+			--hard_limit;
+			if (is_active(t, settings()))
 			{
-				TORRENT_ASSERT(t->m_resume_data_loaded || !t->valid_metadata());
-				// this torrent is auto managed, add it to
-				// the list (depending on if it's a seed or not)
+				// this is not an auto managed torrent,
+				// if it's running and active, decrease the
+				// counters.
 				if (t->is_finished())
-					seeds.push_back(t);
+					--num_seeds;
 				else
-					downloaders.push_back(t);
+					--num_downloaders;
+			}
+		}
+
+		std::vector<auto_manage_decision> decisions;
+		if (settings().auto_manage_prefer_seeds)
+		{
+			auto_manage_torrents(seed_queue, dht_limit, tracker_limit, lsd_limit
+				, hard_limit, num_seeds, decisions);
+			auto_manage_torrents(download_queue, dht_limit, tracker_limit, lsd_limit
+				, hard_limit, num_downloaders, decisions);
+		}
+		else
+		{
+			auto_manage_torrents(download_queue, dht_limit, tracker_limit, lsd_limit
+				, hard_limit, num_downloaders, decisions);
+			auto_manage_torrents(seed_queue, dht_limit, tracker_limit, lsd_limit
+				, hard_limit, num_seeds, decisions);
+		}
+		m_auto_manage_evaluations += decisions.size();
+
+		for (std::vector<auto_manage_decision>::iterator i = decisions.begin()
+			, end(decisions.end()); i != end; ++i)
+		{
+			torrent* t = i->t;
+			t->set_announce_to_dht(i->announce_to_dht);
+			t->set_announce_to_trackers(i->announce_to_trackers);
+			t->set_announce_to_lsd(i->announce_to_lsd);
+
+			if (i->start == 1)
+			{
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+				t->log_to_all_peers("AUTO MANAGER STARTING TORRENT");
+#endif
+				t->set_allow_peers(true);
 			}
-			else if (!t->is_paused())
+			else if (i->start == 0)
 			{
-				TORRENT_ASSERT(t->m_resume_data_loaded || !t->valid_metadata());
-				--hard_limit;
-			  	if (is_active(t, settings()))
-				{
-					// this is not an auto managed torrent,
-					// if it's running and active, decrease the
-					// counters.
-					if (t->is_finished())
-						--num_seeds;
-					else
-						--num_downloaders;
-				}
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+				t->log_to_all_peers("AUTO MANAGER PAUSING TORRENT");
+#endif
+				// use graceful pause for auto-managed torrents
+				t->set_allow_peers(false, true);
 			}
+			update_auto_manage_state(t);
 		}
+	}
 
-		bool handled_by_extension = false;
+	bool session_impl::auto_manage_order::operator()(
+		torrent const* lhs, torrent const* rhs) const
+	{
+		if (lhs->auto_manage_key() != rhs->auto_manage_key())
+			return lhs->auto_manage_key() < rhs->auto_manage_key();
+		return lhs < rhs;
+	}
 
-#ifndef TORRENT_DISABLE_EXTENSIONS
-		// TODO: allow extensions to sort torrents for queuing
-#endif
+	void session_impl::update_auto_manage_state(torrent* t)
+	{
+		TORRENT_ASSERT(is_network_thread());
+
+		// torrents that haven't been added to the session yet,
+		// or that have been aborted, are not in any queue
+		bool in_session = !t->is_aborted() && t->in_tick_schedule();
 
-		if (!handled_by_extension)
+		int queue = -1;
+		int key = 0;
+		if (in_session && t->is_auto_managed())
 		{
-			std::sort(downloaders.begin(), downloaders.end()
-				, boost::bind(&torrent::sequence_number, _1) < boost::bind(&torrent::sequence_number, _2));
+			if (t->state() == torrent_status::checking_files
+				|| t->state() == torrent_status::queued_for_checking)
+			{
+				queue = checking_queue;
+				key = t->sequence_number();
+			}
+			else if (!t->has_error())
+			{
+				if (t->is_finished())
+				{
+					queue = seed_queue;
+					key = -t->seed_rank(m_settings);
+				}
+				else
+				{
+					queue = download_queue;
+					key = t->sequence_number();
+				}
+			}
+		}
 
-			std::sort(seeds.begin(), seeds.end()
-				, boost::bind(&torrent::seed_rank, _1, boost::ref(m_settings))
-				> boost::bind(&torrent::seed_rank, _2, boost::ref(m_settings)));
+		if (queue != t->auto_manage_queue()
+			|| (queue != -1 && key != t->auto_manage_key()))
+		{
+			if (t->auto_manage_queue() != -1)
+			{
+				int erased = m_auto_manage_queues[t->auto_manage_queue()].erase(t);
+				TORRENT_ASSERT(erased == 1);
+				(void)erased;
+			}
+			t->set_auto_manage_position(queue, key);
+			if (queue != -1)
+				m_auto_manage_queues[queue].insert(t);
 		}
 
-		if (settings().auto_manage_prefer_seeds)
+		bool engaged = in_session && t->is_engaged();
+		int index = t->engaged_index();
+		if (engaged && index == -1)
 		{
-			auto_manage_torrents(seeds, dht_limit, tracker_limit, lsd_limit
-				, hard_limit, num_seeds);
-			auto_manage_torrents(downloaders, dht_limit, tracker_limit, lsd_limit
-				, hard_limit, num_downloaders);
+			t->set_engaged_index(m_engaged_torrents.size());
+			m_engaged_torrents.push_back(t);
 		}
-		else
+		else if (!engaged && index != -1)
 		{
-			auto_manage_torrents(downloaders, dht_limit, tracker_limit, lsd_limit
-				, hard_limit, num_downloaders);
-			auto_manage_torrents(seeds, dht_limit, tracker_limit, lsd_limit
-				, hard_limit, num_seeds);
+			TORRENT_ASSERT(m_engaged_torrents[index] == t);
+			torrent* last = m_engaged_torrents.back();
+			m_engaged_torrents[index] = last;
+			last->set_engaged_index(index);
+			m_engaged_torrents.pop_back();
+			t->set_engaged_index(-1);
 		}
 	}
 
@@ -4289,6 +3756,8 @@ retry:
 		TORRENT_ASSERT(is_network_thread());
 		if (m_allowed_upload_slots == 0) return;
 
+		inc_stats_counter(counters::num_optimistic_unchoke_rounds);
+
 		std::vector<policy::peer*> opt_unchoke;
 
 		for (connection_map::iterator i = m_connections.begin()
@@ -4464,9 +3933,7 @@ retry:
 								--max_connections;
 								--free_slots;
 								steps_since_last_connect = 0;
-#ifdef TORRENT_STATS
-								++m_connection_attempts;
-#endif
+								inc_stats_counter(counters::connection_attempts);
 							}
 						}
 						TORRENT_CATCH(std::bad_alloc&)
@@ -4510,6 +3977,8 @@ retry:
 		TORRENT_ASSERT(is_network_thread());
 		INVARIANT_CHECK;
 
+		inc_stats_counter(counters::num_unchoke_rounds);
+
 		ptime now = time_now();
 		time_duration unchoke_interval = now - m_last_choke;
 		m_last_choke = now;
@@ -4925,29 +4394,67 @@ retry:
 		}
 	}
 
-	void session_impl::post_torrent_updates()
+	void session_impl::post_torrent_updates(boost::uint32_t flags)
 	{
 		INVARIANT_CHECK;
 
 		TORRENT_ASSERT(is_network_thread());
 
+		std::vector<boost::weak_ptr<torrent> >& updates
+			= m_state_updates[state_update_queue];
 		std::auto_ptr<state_update_alert> alert(new state_update_alert());
-		alert->status.reserve(m_state_updates.size());
+		alert->status.reserve(updates.size());
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		m_posting_torrent_updates = true;
 #endif
 
-		for (std::vector<boost::weak_ptr<torrent> >::iterator i = m_state_updates.begin()
-			, end(m_state_updates.end()); i != end; ++i)
+		for (std::vector<boost::weak_ptr<torrent> >::iterator i = updates.begin()
+			, end(updates.end()); i != end; ++i)
 		{
 			boost::shared_ptr<torrent> t = i->lock();
 			if (!t) continue;
 			alert->status.push_back(torrent_status());
-			t->status(&alert->status.back(), 0xffffffff);
-			t->clear_in_state_update();
+			t->status(&alert->status.back(), flags);
+			t->clear_in_state_update(state_update_queue);
+		}
+		updates.clear();
+
+#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
+		m_posting_torrent_updates = false;
+#endif
+
+		m_alerts.post_alert_ptr(alert.release());
+	}
+
+	void session_impl::post_torrent_deltas(boost::uint64_t fields)
+	{
+		INVARIANT_CHECK;
+
+		TORRENT_ASSERT(is_network_thread());
+
+		std::vector<boost::weak_ptr<torrent> >& updates
+			= m_state_updates[state_delta_queue];
+		std::auto_ptr<state_delta_alert> alert(new state_delta_alert());
+		alert->deltas.reserve(updates.size());
+
+#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
+		m_posting_torrent_updates = true;
+#endif
+
+		for (std::vector<boost::weak_ptr<torrent> >::iterator i = updates.begin()
+			, end(updates.end()); i != end; ++i)
+		{
+			boost::shared_ptr<torrent> t = i->lock();
+			if (!t) continue;
+			alert->deltas.push_back(torrent_delta());
+			// torrents where none of the requested fields changed
+			// are left out
+			if (!t->status_delta(&alert->deltas.back(), fields))
+				alert->deltas.pop_back();
+			t->clear_in_state_update(state_delta_queue);
 		}
-		m_state_updates.clear();
+		updates.clear();
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		m_posting_torrent_updates = false;
@@ -4956,6 +4463,313 @@ retry:
 		m_alerts.post_alert_ptr(alert.release());
 	}
 
+	void session_impl::post_session_stats()
+	{
+		TORRENT_ASSERT(is_network_thread());
+
+		update_stats_gauges();
+		m_alerts.post_alert(session_stats_alert(m_stats_counters));
+	}
+
+	void session_impl::update_stats_gauges()
+	{
+		TORRENT_ASSERT(is_network_thread());
+
+		int connect_candidates = 0;
+
+		int checking_torrents = 0;
+		int stopped_torrents = 0;
+		int upload_only_torrents = 0;
+		int downloading_torrents = 0;
+		int seeding_torrents = 0;
+		int queued_seed_torrents = 0;
+		int queued_download_torrents = 0;
+		int error_torrents = 0;
+		int checking_resume_torrents = 0;
+
+		// number of torrents that want more peers
+		int num_want_more_peers = 0;
+
+		int num_peers = 0;
+		int peer_allocations = 0;
+		size_type peer_storage = 0;
+		int outstanding_requests = 0;
+		int outstanding_end_game_requests = 0;
+		int outstanding_write_blocks = 0;
+
+		std::vector<partial_piece_info> dq;
+		for (torrent_map::iterator i = m_torrents.begin()
+			, end(m_torrents.end()); i != end; ++i)
+		{
+			torrent* t = i->second.get();
+			int connection_slots = (std::max)(t->max_connections() - t->num_peers(), 0);
+			int candidates = t->get_policy().num_connect_candidates();
+			connect_candidates += (std::min)(candidates, connection_slots);
+			num_peers += t->get_policy().num_peers();
+			peer_allocations += t->get_policy().num_allocations();
+			peer_storage += t->get_policy().memory_usage();
+
+			if (t->want_more_peers()) ++num_want_more_peers;
+			if (t->state() == torrent_status::checking_resume_data)
+				++checking_resume_torrents;
+
+			if (t->has_error())
+				++error_torrents;
+			else
+			{
+				if (t->is_paused())
+				{
+					if (!t->is_auto_managed())
+						++stopped_torrents;
+					else
+					{
+						if (t->is_seed())
+							++queued_seed_torrents;
+						else
+							++queued_download_torrents;
+					}
+				}
+				else
+				{
+					if (t->state() == torrent_status::checking_files
+						|| t->state() == torrent_status::queued_for_checking)
+						++checking_torrents;
+					else if (t->is_seed())
+						++seeding_torrents;
+					else if (t->is_upload_only())
+						++upload_only_torrents;
+					else
+						++downloading_torrents;
+				}
+			}
+
+			dq.clear();
+			t->get_download_queue(&dq);
+			for (std::vector<partial_piece_info>::iterator j = dq.begin()
+				, end(dq.end()); j != end; ++j)
+			{
+				for (int k = 0; k < j->blocks_in_piece; ++k)
+				{
+					block_info& bi = j->blocks[k];
+					if (bi.state == block_info::requested)
+					{
+						++outstanding_requests;
+						if (bi.num_peers > 1) ++outstanding_end_game_requests;
+					}
+					else if (bi.state == block_info::writing)
+						++outstanding_write_blocks;
+				}
+			}
+		}
+
+		m_stats_counters.set_value(counters::num_checking_torrents, checking_torrents);
+		m_stats_counters.set_value(counters::num_stopped_torrents, stopped_torrents);
+		m_stats_counters.set_value(counters::num_upload_only_torrents, upload_only_torrents);
+		m_stats_counters.set_value(counters::num_downloading_torrents, downloading_torrents);
+		m_stats_counters.set_value(counters::num_seeding_torrents, seeding_torrents);
+		m_stats_counters.set_value(counters::num_queued_seeding_torrents, queued_seed_torrents);
+		m_stats_counters.set_value(counters::num_queued_download_torrents, queued_download_torrents);
+		m_stats_counters.set_value(counters::num_error_torrents, error_torrents);
+		m_stats_counters.set_value(counters::num_torrents_want_peers, num_want_more_peers);
+		// every ticking torrent is also in m_torrents, except while one
+		// is being removed or moved to a new info-hash
+		int const num_ticking = int(m_ticking_torrents.size());
+		int const num_dormant = int(m_torrents.size()) - num_ticking;
+		TORRENT_ASSERT(num_dormant >= 0);
+		m_stats_counters.set_value(counters::num_ticking_torrents, num_ticking);
+		m_stats_counters.set_value(counters::num_dormant_torrents, num_dormant);
+		m_stats_counters.set_value(counters::num_startup_queued_torrents
+			, m_torrent_loader ? m_torrent_loader->num_queued() : 0);
+		m_stats_counters.set_value(counters::num_checking_resume_torrents
+			, checking_resume_torrents);
+
+		m_stats_counters.set_value(counters::num_connect_candidates, connect_candidates);
+		m_stats_counters.set_value(counters::num_list_peers, num_peers);
+		m_stats_counters.set_value(counters::num_peer_allocations, peer_allocations);
+		m_stats_counters.set_value(counters::peer_list_bytes, peer_storage);
+		m_stats_counters.set_value(counters::num_outstanding_requests, outstanding_requests);
+		m_stats_counters.set_value(counters::num_outstanding_end_game_requests
+			, outstanding_end_game_requests);
+		m_stats_counters.set_value(counters::num_outstanding_write_blocks, outstanding_write_blocks);
+
+		int tcp_up_rate = 0;
+		int tcp_down_rate = 0;
+		int utp_up_rate = 0;
+		int utp_down_rate = 0;
+		int num_utp_peers = 0;
+		int num_tcp_peers = 0;
+		int num_complete_connections = 0;
+		int num_half_open = 0;
+		int peers_up_interested = 0;
+		int peers_down_interesting = 0;
+		int peers_up_requests = 0;
+		int peers_down_requests = 0;
+		int peers_up_send_buffer = 0;
+		int peers_down_unchoked = 0;
+		int peers_up_unchoked = 0;
+		int num_end_game_peers = 0;
+		int reading_bytes = 0;
+		int pending_incoming_reqs = 0;
+
+		for (connection_map::iterator i = m_connections.begin()
+			, end(m_connections.end()); i != end; ++i)
+		{
+			peer_connection* p = i->get();
+			if (p->is_connecting())
+			{
+				++num_half_open;
+				continue;
+			}
+
+			++num_complete_connections;
+			if (!p->is_choked()) ++peers_up_unchoked;
+			if (!p->has_peer_choked()) ++peers_down_unchoked;
+			if (!p->download_queue().empty()) ++peers_down_requests;
+			if (p->is_peer_interested()) ++peers_up_interested;
+			if (p->is_interesting()) ++peers_down_interesting;
+			if (p->send_buffer_size() > 100 || !p->upload_queue().empty() || p->num_reading_bytes() > 0)
+				++peers_up_requests;
+			if (p->endgame()) ++num_end_game_peers;
+			reading_bytes += p->num_reading_bytes();
+
+			pending_incoming_reqs += int(p->upload_queue().size());
+
+			int dl_rate = p->statistics().download_payload_rate();
+			int ul_rate = p->statistics().upload_payload_rate();
+
+			boost::uint64_t upload_rate = int(p->statistics().upload_rate());
+			int buffer_size_watermark = upload_rate
+				* m_settings.send_buffer_watermark_factor / 100;
+			if (buffer_size_watermark < m_settings.send_buffer_low_watermark)
+				buffer_size_watermark = m_settings.send_buffer_low_watermark;
+			else if (buffer_size_watermark > m_settings.send_buffer_watermark)
+				buffer_size_watermark = m_settings.send_buffer_watermark;
+			if (p->send_buffer_size() + p->num_reading_bytes() >= buffer_size_watermark)
+				++peers_up_send_buffer;
+
+			utp_stream* utp_socket = p->get_socket()->get<utp_stream>();
+#ifdef TORRENT_USE_OPENSSL
+			if (!utp_socket)
+			{
+				ssl_stream<utp_stream>* ssl_str = p->get_socket()->get<ssl_stream<utp_stream> >();
+				if (ssl_str) utp_socket = &ssl_str->next_layer();
+			}
+#endif
+			if (utp_socket)
+			{
+				utp_up_rate += ul_rate;
+				utp_down_rate += dl_rate;
+				++num_utp_peers;
+			}
+			else
+			{
+				tcp_up_rate += ul_rate;
+				tcp_down_rate += dl_rate;
+				++num_tcp_peers;
+			}
+		}
+
+		m_stats_counters.set_value(counters::num_peer_connections, m_connections.size());
+		m_stats_counters.set_value(counters::num_peers_connected, num_complete_connections);
+		m_stats_counters.set_value(counters::num_peers_half_open, num_half_open);
+		m_stats_counters.set_value(counters::num_tcp_peers, num_tcp_peers);
+		m_stats_counters.set_value(counters::num_utp_peers, num_utp_peers);
+		m_stats_counters.set_value(counters::num_peers_up_interested, peers_up_interested);
+		m_stats_counters.set_value(counters::num_peers_down_interesting, peers_down_interesting);
+		m_stats_counters.set_value(counters::num_peers_up_unchoked, peers_up_unchoked);
+		m_stats_counters.set_value(counters::num_peers_down_unchoked, peers_down_unchoked);
+		m_stats_counters.set_value(counters::num_peers_up_requests, peers_up_requests);
+		m_stats_counters.set_value(counters::num_peers_down_requests, peers_down_requests);
+		m_stats_counters.set_value(counters::num_peers_up_send_buffer, peers_up_send_buffer);
+		m_stats_counters.set_value(counters::num_peers_end_game, num_end_game_peers);
+		m_stats_counters.set_value(counters::num_unchoke_slots, m_allowed_upload_slots);
+		m_stats_counters.set_value(counters::num_pending_incoming_requests, pending_incoming_reqs);
+		m_stats_counters.set_value(counters::num_pending_reading_bytes, reading_bytes);
+
+		m_stats_counters.set_value(counters::upload_rate, m_stat.upload_rate());
+		m_stats_counters.set_value(counters::download_rate, m_stat.download_rate());
+		m_stats_counters.set_value(counters::tcp_upload_rate, tcp_up_rate);
+		m_stats_counters.set_value(counters::tcp_download_rate, tcp_down_rate);
+		m_stats_counters.set_value(counters::utp_upload_rate, utp_up_rate);
+		m_stats_counters.set_value(counters::utp_download_rate, utp_down_rate);
+		m_stats_counters.set_value(counters::limiter_up_queue, m_upload_rate.queue_size());
+		m_stats_counters.set_value(counters::limiter_down_queue, m_download_rate.queue_size());
+		m_stats_counters.set_value(counters::limiter_disk_up_queue
+			, m_disk_queues[peer_connection::upload_channel]);
+		m_stats_counters.set_value(counters::limiter_disk_down_queue
+			, m_disk_queues[peer_connection::download_channel]);
+
+		m_stats_counters.set_value(counters::sent_bytes, m_stat.total_upload());
+		m_stats_counters.set_value(counters::sent_payload_bytes, m_stat.total_payload_upload());
+		m_stats_counters.set_value(counters::recv_bytes, m_stat.total_download());
+		m_stats_counters.set_value(counters::recv_payload_bytes, m_stat.total_payload_download());
+		m_stats_counters.set_value(counters::recv_failed_bytes, m_total_failed_bytes);
+		m_stats_counters.set_value(counters::recv_redundant_bytes, m_total_redundant_bytes);
+		for (int i = 0; i < torrent::waste_reason_max; ++i)
+			m_stats_counters.set_value(counters::waste_piece_timed_out + i, m_redundant_bytes[i]);
+		m_stats_counters.set_value(counters::auto_manage_evaluations, m_auto_manage_evaluations);
+		m_stats_counters.set_value(counters::dns_cache_hits, m_resolver.num_hits());
+		m_stats_counters.set_value(counters::dns_cache_misses, m_resolver.num_misses());
+
+		cache_status cs = m_disk_thread.status();
+		m_stats_counters.set_value(counters::num_blocks_read, cs.blocks_read);
+		m_stats_counters.set_value(counters::num_blocks_written, cs.blocks_written);
+		m_stats_counters.set_value(counters::num_blocks_cache_hits, cs.blocks_read_hit);
+		m_stats_counters.set_value(counters::num_read_ops, cs.reads);
+		m_stats_counters.set_value(counters::num_write_ops, cs.writes);
+		m_stats_counters.set_value(counters::num_read_back, cs.total_read_back);
+		m_stats_counters.set_value(counters::disk_read_time, cs.cumulative_read_time);
+		m_stats_counters.set_value(counters::disk_write_time, cs.cumulative_write_time);
+		m_stats_counters.set_value(counters::disk_hash_time, cs.cumulative_hash_time);
+		m_stats_counters.set_value(counters::disk_sort_time, cs.cumulative_sort_time);
+		m_stats_counters.set_value(counters::disk_job_time, cs.cumulative_job_time);
+
+		m_stats_counters.set_value(counters::disk_blocks_in_use, cs.total_used_buffers);
+		m_stats_counters.set_value(counters::disk_read_cache_blocks, cs.read_cache_size);
+		m_stats_counters.set_value(counters::disk_cache_blocks, cs.cache_size);
+		m_stats_counters.set_value(counters::disk_queued_write_bytes, m_disk_thread.queue_buffer_size());
+		m_stats_counters.set_value(counters::disk_job_queue_length, cs.job_queue_length);
+		m_stats_counters.set_value(counters::disk_read_queue_size, cs.read_queue_size);
+		m_stats_counters.set_value(counters::disk_average_read_time, cs.average_read_time);
+		m_stats_counters.set_value(counters::disk_average_write_time, cs.average_write_time);
+		m_stats_counters.set_value(counters::disk_average_hash_time, cs.average_hash_time);
+		m_stats_counters.set_value(counters::disk_average_job_time, cs.average_job_time);
+		m_stats_counters.set_value(counters::disk_average_sort_time, cs.average_sort_time);
+		m_stats_counters.set_value(counters::disk_average_queue_time, cs.average_queue_time);
+
+		utp_status ut;
+		m_utp_socket_manager.get_status(ut);
+		m_stats_counters.set_value(counters::num_utp_idle, ut.num_idle);
+		m_stats_counters.set_value(counters::num_utp_syn_sent, ut.num_syn_sent);
+		m_stats_counters.set_value(counters::num_utp_connected, ut.num_connected);
+		m_stats_counters.set_value(counters::num_utp_fin_sent, ut.num_fin_sent);
+		m_stats_counters.set_value(counters::num_utp_close_wait, ut.num_close_wait);
+
+		m_stats_counters.set_value(counters::dht_bytes_in
+			, m_stat.total_transfer(stat::download_dht_protocol));
+		m_stats_counters.set_value(counters::dht_bytes_out
+			, m_stat.total_transfer(stat::upload_dht_protocol));
+
+#ifndef TORRENT_DISABLE_DHT
+		if (m_dht)
+		{
+			session_status sst;
+			m_dht->dht_status(sst);
+			m_stats_counters.set_value(counters::dht_nodes, sst.dht_nodes);
+			m_stats_counters.set_value(counters::dht_node_cache, sst.dht_node_cache);
+			m_stats_counters.set_value(counters::dht_torrents, sst.dht_torrents);
+			m_stats_counters.set_value(counters::dht_allocations, sst.dht_total_allocations);
+		}
+		else
+#endif
+		{
+			m_stats_counters.set_value(counters::dht_nodes, 0);
+			m_stats_counters.set_value(counters::dht_node_cache, 0);
+			m_stats_counters.set_value(counters::dht_torrents, 0);
+			m_stats_counters.set_value(counters::dht_allocations, 0);
+		}
+	}
+
 	std::vector<torrent_handle> session_impl::get_torrents() const
 	{
 		std::vector<torrent_handle> ret;
@@ -4983,6 +4797,31 @@ retry:
 		delete params;
 	}
 
+	void session_impl::async_add_torrents(std::vector<boost::shared_ptr<loaded_torrent> > const& torrents)
+	{
+		TORRENT_ASSERT(is_network_thread());
+
+		if (!m_torrent_loader)
+		{
+			m_torrent_loader.reset(new torrent_loader(m_io_service, m_files
+				, boost::bind(&session_impl::on_torrent_loaded, this, _1)));
+		}
+		m_torrent_loader->queue(torrents, (std::max)(m_settings.startup_threads, 1));
+	}
+
+	void session_impl::on_torrent_loaded(boost::shared_ptr<loaded_torrent> const& t)
+	{
+		TORRENT_ASSERT(is_network_thread());
+
+		error_code ec = t->error;
+		torrent_handle h;
+		if (!ec) h = add_torrent_impl(t->params, ec, &t->resume);
+		m_alerts.post_alert(add_torrent_alert(h, t->params, ec));
+
+		inc_stats_counter(ec ? counters::startup_torrents_failed
+			: counters::startup_torrents_added);
+	}
+
 	torrent_handle session_impl::add_torrent(add_torrent_params const& p
 		, error_code& ec)
 	{
@@ -4992,7 +4831,7 @@ retry:
 	}
 
 	torrent_handle session_impl::add_torrent_impl(add_torrent_params const& p
-		, error_code& ec)
+		, error_code& ec, bdecode_node* resume)
 	{
 		TORRENT_ASSERT(!p.save_path.empty());
 
@@ -5150,7 +4989,7 @@ retry:
 
 		torrent_ptr.reset(new torrent(*this, m_listen_interface
 			, 16 * 1024, queue_pos, params, *ih));
-		torrent_ptr->start();
+		torrent_ptr->start(resume);
 
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		for (extension_list_t::iterator i = m_extensions.begin()
@@ -5180,6 +5019,8 @@ retry:
 #endif
 
 		m_torrents.insert(std::make_pair(*ih, torrent_ptr));
+		start_ticking(torrent_ptr.get());
+		update_auto_manage_state(torrent_ptr.get());
 		if (!params.uuid.empty() || !params.url.empty())
 			m_uuids.insert(std::make_pair(params.uuid.empty()
 				? params.url : params.uuid, torrent_ptr));
@@ -5198,6 +5039,48 @@ retry:
 		return torrent_handle(torrent_ptr);
 	}
 
+	void session_impl::start_ticking(torrent* t)
+	{
+		TORRENT_ASSERT(t->ticking_index() == -1);
+		t->set_ticking_index(m_ticking_torrents.size());
+		m_ticking_torrents.push_back(t);
+	}
+
+	void session_impl::stop_ticking(torrent* t)
+	{
+		int index = t->ticking_index();
+		if (index < 0) return;
+		TORRENT_ASSERT(index < int(m_ticking_torrents.size()));
+		TORRENT_ASSERT(m_ticking_torrents[index] == t);
+		torrent* last = m_ticking_torrents.back();
+		m_ticking_torrents[index] = last;
+		last->set_ticking_index(index);
+		m_ticking_torrents.pop_back();
+		t->set_ticking_index(-1);
+	}
+
+	void session_impl::schedule_torrent_wakeup(timer_entry* e, int delay)
+	{
+		TORRENT_ASSERT(delay >= 0);
+		m_torrent_timers.schedule(e, timer_tick(time_now()) + delay);
+	}
+
+	void session_impl::cancel_torrent_wakeup(timer_entry* e)
+	{
+		m_torrent_timers.cancel(e);
+	}
+
+	void session_impl::schedule_torrent_unload(timer_entry* e, int delay)
+	{
+		TORRENT_ASSERT(delay >= 0);
+		m_unload_timers.schedule(e, timer_tick(time_now()) + delay);
+	}
+
+	void session_impl::cancel_torrent_unload(timer_entry* e)
+	{
+		m_unload_timers.cancel(e);
+	}
+
 	void session_impl::queue_check_torrent(boost::shared_ptr<torrent> const& t)
 	{
 		if (m_abort) return;
@@ -5431,9 +5314,7 @@ retry:
 
 	void session_impl::on_lsd_peer(tcp::endpoint peer, sha1_hash const& ih)
 	{
-#ifdef TORRENT_STATS
-		++m_num_messages[on_lsd_peer_counter];
-#endif
+		inc_stats_counter(counters::on_lsd_peer_counter);
 		TORRENT_ASSERT(is_network_thread());
 
 		INVARIANT_CHECK;
@@ -5604,19 +5485,40 @@ retry:
 			s.dht_torrents = 0;
 			s.dht_global_nodes = 0;
 			s.dht_total_allocations = 0;
+			std::fill(s.dht_rtt_histogram, s.dht_rtt_histogram
+				+ session_status::num_dht_rtt_buckets, 0);
+			s.dht_outstanding_transactions = 0;
+			s.dht_transaction_timeouts = 0;
 		}
 #endif
 
 		m_utp_socket_manager.get_status(s.utp_stats);
 
+		m_tracker_manager.get_host_status(&s.tracker_hosts);
+
 		int peerlist_size = 0;
+		size_type peerlist_memory = 0;
 		for (torrent_map::const_iterator i = m_torrents.begin()
 			, end(m_torrents.end()); i != end; ++i)
 		{
 			peerlist_size += i->second->get_policy().num_peers();
+			peerlist_memory += i->second->get_policy().memory_usage();
 		}
 
 		s.peerlist_size = peerlist_size;
+		s.peerlist_memory = peerlist_memory;
+		s.peerlist_bytes_per_peer = peerlist_size == 0 ? 0
+			: int(peerlist_memory / peerlist_size);
+
+		s.num_ticking_torrents = int(m_ticking_torrents.size());
+		s.num_dormant_torrents = int(m_torrents.size()) - s.num_ticking_torrents;
+		TORRENT_ASSERT(s.num_dormant_torrents >= 0);
+		std::copy(m_tick_histogram, m_tick_histogram
+			+ session_status::num_tick_histogram_buckets, s.tick_histogram);
+		std::copy(m_torrent_tick_histogram, m_torrent_tick_histogram
+			+ session_status::num_tick_histogram_buckets, s.torrent_tick_histogram);
+
+		s.auto_manage_evaluations = m_auto_manage_evaluations;
 
 		return s;
 	}
@@ -5670,6 +5572,20 @@ retry:
 		if (m_dht) m_dht->add_node(node);
 	}
 
+	void session_impl::dht_scrape(sha1_hash const& info_hash)
+	{
+		if (!m_dht) return;
+		m_dht->scrape(info_hash, boost::bind(&session_impl::on_dht_scrape
+			, this, info_hash, _1, _2));
+	}
+
+	void session_impl::on_dht_scrape(sha1_hash const& info_hash
+		, int num_seeds, int num_peers)
+	{
+		if (m_alerts.should_post<dht_scrape_alert>())
+			m_alerts.post_alert(dht_scrape_alert(info_hash, num_seeds, num_peers));
+	}
+
 	void session_impl::add_dht_router(std::pair<std::string, int> const& node)
 	{
 #if defined TORRENT_ASIO_DEBUGGING
@@ -6006,6 +5922,11 @@ retry:
 		m_alerts.get_all(alerts);
 	}
 
+	void session_impl::pop_alerts(std::vector<alert*>* alerts)
+	{
+		m_alerts.get_batch(*alerts);
+	}
+
 	alert const* session_impl::wait_for_alert(time_duration max_wait)
 	{
 		return m_alerts.wait_for_alert(max_wait);
@@ -6014,6 +5935,15 @@ retry:
 	void session_impl::set_alert_mask(boost::uint32_t m)
 	{
 		m_alerts.set_alert_mask(m);
+
+		// dormant torrents don't post stats alerts. Wake them up
+		// so they do
+		if (m & alert::stats_notification)
+		{
+			for (torrent_map::iterator i = m_torrents.begin()
+				, end(m_torrents.end()); i != end; ++i)
+				i->second->wake_up();
+		}
 	}
 
 #ifndef TORRENT_NO_DEPRECATE
@@ -6326,6 +6256,12 @@ retry:
 		TORRENT_ASSERT(m_queued_for_checking.empty() || num_checking == 1 || (m_paused && num_checking == 0));
 //		TORRENT_ASSERT(m_queued_for_checking.size() == num_queued_for_checking);
 
+		for (int i = 0; i < int(m_ticking_torrents.size()); ++i)
+		{
+			TORRENT_ASSERT(m_ticking_torrents[i]->ticking_index() == i);
+			TORRENT_ASSERT(!m_ticking_torrents[i]->is_dormant());
+		}
+
 		std::set<int> unique;
 		int num_active_downloading = 0;
 		int num_active_finished = 0;
@@ -6337,6 +6273,11 @@ retry:
 			if (t->is_active_download()) ++num_active_downloading;
 			else if (t->is_active_finished()) ++num_active_finished;
 
+			if (t->auto_manage_queue() != -1)
+				TORRENT_ASSERT(m_auto_manage_queues[t->auto_manage_queue()].count(t.get()) == 1);
+			if (t->engaged_index() != -1)
+				TORRENT_ASSERT(m_engaged_torrents[t->engaged_index()] == t.get());
+
 			int pos = t->queue_position();
 			if (pos < 0)
 			{
@@ -6349,6 +6290,11 @@ retry:
 		}
 		TORRENT_ASSERT(int(unique.size()) == total_downloaders);
 		TORRENT_ASSERT(num_active_downloading == m_num_active_downloading);
+		int queued_torrents = 0;
+		for (int i = 0; i < num_auto_manage_queues; ++i)
+			queued_torrents += m_auto_manage_queues[i].size();
+		TORRENT_ASSERT(queued_torrents <= int(m_torrents.size()));
+		TORRENT_ASSERT(m_engaged_torrents.size() <= m_torrents.size());
 		TORRENT_ASSERT(num_active_finished == m_num_active_finished);
 
 		std::set<peer_connection*> unique_peers;
@@ -0,0 +1,297 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/session_stats.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include <cstring> // for strcmp
+
+namespace libtorrent
+{
+	namespace
+	{
+		struct stats_metric_impl
+		{
+			char const* name;
+			int value_index;
+			int type;
+		};
+
+#define METRIC(category, name) { #category "." #name, counters:: name, stats_metric::type_counter },
+#define GAUGE(category, name) { #category "." #name, counters:: name, stats_metric::type_gauge },
+
+		// the names in this table are part of the public interface. Once
+		// a metric has been added, its name must not change. New metrics
+		// can be added anywhere
+		stats_metric_impl const metrics[] =
+		{
+			METRIC(peer, disconnected_peers)
+			METRIC(peer, error_peers)
+			METRIC(peer, eof_peers)
+			METRIC(peer, connreset_peers)
+			METRIC(peer, connrefused_peers)
+			METRIC(peer, connaborted_peers)
+			METRIC(peer, perm_peers)
+			METRIC(peer, buffer_peers)
+			METRIC(peer, unreachable_peers)
+			METRIC(peer, broken_pipe_peers)
+			METRIC(peer, addrinuse_peers)
+			METRIC(peer, no_access_peers)
+			METRIC(peer, invalid_arg_peers)
+			METRIC(peer, aborted_peers)
+			METRIC(peer, uninteresting_peers)
+			METRIC(peer, transport_timeout_peers)
+			METRIC(peer, timeout_peers)
+			METRIC(peer, no_memory_peers)
+			METRIC(peer, too_many_peers)
+			METRIC(peer, connect_timeouts)
+			METRIC(peer, error_incoming_peers)
+			METRIC(peer, error_outgoing_peers)
+			METRIC(peer, error_tcp_peers)
+			METRIC(peer, error_utp_peers)
+			METRIC(peer, error_encrypted_peers)
+			METRIC(peer, error_rc4_peers)
+			METRIC(peer, connection_attempts)
+			METRIC(peer, banned_peers)
+			METRIC(peer, banned_for_hash_failure)
+			METRIC(peer, smart_ban_failed_pieces)
+			METRIC(peer, smart_ban_passed_pieces)
+			METRIC(peer, smart_ban_blocks_recorded)
+			METRIC(peer, smart_ban_peers_banned)
+			METRIC(peer, piece_requests)
+			METRIC(peer, max_piece_requests)
+			METRIC(peer, invalid_piece_requests)
+			METRIC(peer, choked_piece_requests)
+			METRIC(peer, cancelled_piece_requests)
+			METRIC(peer, piece_rejects)
+
+			METRIC(picker, piece_picker_blocks)
+			METRIC(picker, end_game_piece_picker_blocks)
+			METRIC(picker, reject_piece_picks)
+			METRIC(picker, unchoke_piece_picks)
+			METRIC(picker, incoming_redundant_piece_picks)
+			METRIC(picker, incoming_piece_picks)
+			METRIC(picker, end_game_piece_picks)
+			METRIC(picker, snubbed_piece_picks)
+
+			METRIC(choker, num_unchoke_rounds)
+			METRIC(choker, num_optimistic_unchoke_rounds)
+
+			METRIC(net, on_read_counter)
+			METRIC(net, on_write_counter)
+			METRIC(net, on_tick_counter)
+			METRIC(net, on_lsd_counter)
+			METRIC(net, on_lsd_peer_counter)
+			METRIC(net, on_udp_counter)
+			METRIC(net, on_accept_counter)
+			METRIC(net, on_disk_queue_counter)
+			METRIC(net, on_disk_read_counter)
+			METRIC(net, on_disk_write_counter)
+			METRIC(net, sent_bytes)
+			METRIC(net, sent_payload_bytes)
+			METRIC(net, recv_bytes)
+			METRIC(net, recv_payload_bytes)
+			METRIC(net, recv_failed_bytes)
+			METRIC(net, recv_redundant_bytes)
+			METRIC(net, waste_piece_timed_out)
+			METRIC(net, waste_piece_cancelled)
+			METRIC(net, waste_piece_unknown)
+			METRIC(net, waste_piece_seed)
+			METRIC(net, waste_piece_end_game)
+			METRIC(net, waste_piece_closing)
+
+			METRIC(ses, auto_manage_evaluations)
+			METRIC(ses, startup_torrents_added)
+			METRIC(ses, startup_torrents_failed)
+
+			METRIC(net, tracker_pool_hits)
+			METRIC(net, tracker_pool_misses)
+			METRIC(net, dns_cache_hits)
+			METRIC(net, dns_cache_misses)
+
+			METRIC(disk, num_blocks_read)
+			METRIC(disk, num_blocks_written)
+			METRIC(disk, num_blocks_cache_hits)
+			METRIC(disk, num_read_ops)
+			METRIC(disk, num_write_ops)
+			METRIC(disk, num_read_back)
+			METRIC(disk, disk_read_time)
+			METRIC(disk, disk_write_time)
+			METRIC(disk, disk_hash_time)
+			METRIC(disk, disk_sort_time)
+			METRIC(disk, disk_job_time)
+
+			METRIC(dht, dht_bytes_in)
+			METRIC(dht, dht_bytes_out)
+
+			{ "sock_bufs.socket_send_size3", counters::socket_send_size3 + 0, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size4", counters::socket_send_size3 + 1, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size5", counters::socket_send_size3 + 2, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size6", counters::socket_send_size3 + 3, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size7", counters::socket_send_size3 + 4, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size8", counters::socket_send_size3 + 5, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size9", counters::socket_send_size3 + 6, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size10", counters::socket_send_size3 + 7, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size11", counters::socket_send_size3 + 8, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size12", counters::socket_send_size3 + 9, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size13", counters::socket_send_size3 + 10, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size14", counters::socket_send_size3 + 11, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size15", counters::socket_send_size3 + 12, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size16", counters::socket_send_size3 + 13, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size17", counters::socket_send_size3 + 14, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size18", counters::socket_send_size3 + 15, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size19", counters::socket_send_size3 + 16, stats_metric::type_counter },
+			{ "sock_bufs.socket_send_size20", counters::socket_send_size3 + 17, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size3", counters::socket_recv_size3 + 0, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size4", counters::socket_recv_size3 + 1, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size5", counters::socket_recv_size3 + 2, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size6", counters::socket_recv_size3 + 3, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size7", counters::socket_recv_size3 + 4, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size8", counters::socket_recv_size3 + 5, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size9", counters::socket_recv_size3 + 6, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size10", counters::socket_recv_size3 + 7, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size11", counters::socket_recv_size3 + 8, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size12", counters::socket_recv_size3 + 9, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size13", counters::socket_recv_size3 + 10, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size14", counters::socket_recv_size3 + 11, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size15", counters::socket_recv_size3 + 12, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size16", counters::socket_recv_size3 + 13, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size17", counters::socket_recv_size3 + 14, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size18", counters::socket_recv_size3 + 15, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size19", counters::socket_recv_size3 + 16, stats_metric::type_counter },
+			{ "sock_bufs.socket_recv_size20", counters::socket_recv_size3 + 17, stats_metric::type_counter },
+
+			GAUGE(ses, num_checking_torrents)
+			GAUGE(ses, num_stopped_torrents)
+			GAUGE(ses, num_upload_only_torrents)
+			GAUGE(ses, num_downloading_torrents)
+			GAUGE(ses, num_seeding_torrents)
+			GAUGE(ses, num_queued_seeding_torrents)
+			GAUGE(ses, num_queued_download_torrents)
+			GAUGE(ses, num_error_torrents)
+			GAUGE(ses, num_torrents_want_peers)
+			GAUGE(ses, num_ticking_torrents)
+			GAUGE(ses, num_dormant_torrents)
+			GAUGE(ses, num_startup_queued_torrents)
+			GAUGE(ses, num_checking_resume_torrents)
+
+			GAUGE(peer, num_peer_connections)
+			GAUGE(peer, num_peers_connected)
+			GAUGE(peer, num_peers_half_open)
+			GAUGE(peer, num_tcp_peers)
+			GAUGE(peer, num_utp_peers)
+			GAUGE(peer, num_peers_up_interested)
+			GAUGE(peer, num_peers_down_interesting)
+			GAUGE(peer, num_peers_up_unchoked)
+			GAUGE(peer, num_peers_down_unchoked)
+			GAUGE(peer, num_peers_up_requests)
+			GAUGE(peer, num_peers_down_requests)
+			GAUGE(peer, num_peers_up_send_buffer)
+			GAUGE(peer, num_peers_end_game)
+
+			GAUGE(choker, num_unchoke_slots)
+
+			GAUGE(peer, num_connect_candidates)
+			GAUGE(peer, num_list_peers)
+			GAUGE(peer, num_peer_allocations)
+			GAUGE(peer, peer_list_bytes)
+			GAUGE(peer, num_outstanding_requests)
+			GAUGE(peer, num_outstanding_end_game_requests)
+			GAUGE(peer, num_outstanding_write_blocks)
+			GAUGE(peer, num_pending_incoming_requests)
+			GAUGE(peer, num_pending_reading_bytes)
+
+			GAUGE(net, upload_rate)
+			GAUGE(net, download_rate)
+			GAUGE(net, tcp_upload_rate)
+			GAUGE(net, tcp_download_rate)
+			GAUGE(net, utp_upload_rate)
+			GAUGE(net, utp_download_rate)
+			GAUGE(net, limiter_up_queue)
+			GAUGE(net, limiter_down_queue)
+			GAUGE(net, limiter_disk_up_queue)
+			GAUGE(net, limiter_disk_down_queue)
+
+			GAUGE(disk, disk_blocks_in_use)
+			GAUGE(disk, disk_read_cache_blocks)
+			GAUGE(disk, disk_cache_blocks)
+			GAUGE(disk, disk_queued_write_bytes)
+			GAUGE(disk, disk_job_queue_length)
+			GAUGE(disk, disk_read_queue_size)
+			GAUGE(disk, disk_average_read_time)
+			GAUGE(disk, disk_average_write_time)
+			GAUGE(disk, disk_average_hash_time)
+			GAUGE(disk, disk_average_job_time)
+			GAUGE(disk, disk_average_sort_time)
+			GAUGE(disk, disk_average_queue_time)
+
+			GAUGE(utp, num_utp_idle)
+			GAUGE(utp, num_utp_syn_sent)
+			GAUGE(utp, num_utp_connected)
+			GAUGE(utp, num_utp_fin_sent)
+			GAUGE(utp, num_utp_close_wait)
+
+			GAUGE(dht, dht_nodes)
+			GAUGE(dht, dht_node_cache)
+			GAUGE(dht, dht_torrents)
+			GAUGE(dht, dht_allocations)
+		};
+
+#undef METRIC
+#undef GAUGE
+
+		int const num_metrics = sizeof(metrics) / sizeof(metrics[0]);
+	}
+
+	std::vector<stats_metric> session_stats_metrics()
+	{
+		std::vector<stats_metric> stats;
+		stats.resize(num_metrics);
+		for (int i = 0; i < num_metrics; ++i)
+		{
+			stats[i].name = metrics[i].name;
+			stats[i].value_index = metrics[i].value_index;
+			stats[i].type = metrics[i].type;
+		}
+		return stats;
+	}
+
+	int find_metric_idx(char const* name)
+	{
+		for (int i = 0; i < num_metrics; ++i)
+		{
+			if (std::strcmp(metrics[i].name, name) == 0)
+				return metrics[i].value_index;
+		}
+		return -1;
+	}
+}
+
@@ -49,6 +49,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <map>
 #include <utility>
 #include <numeric>
+#include <algorithm>
 #include <cstdio>
 
 #include "libtorrent/hasher.hpp"
@@ -69,7 +70,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/escape_string.hpp" // to_hex
 
 void log_hash_block(FILE** f, libtorrent::torrent const& t, int piece, int block
-	, libtorrent::address a, char const* bytes, int len, bool corrupt)
+	, libtorrent::address a, libtorrent::sha1_hash const& digest, bool corrupt)
 {
 	using namespace libtorrent;
 
@@ -84,7 +85,8 @@ void log_hash_block(FILE** f, libtorrent::torrent const& t, int piece, int block
 	}
 
 	file_storage const& fs = t.torrent_file().files();
-	std::vector<file_slice> files = fs.map_block(piece, block * 0x4000, len);
+	std::vector<file_slice> files = fs.map_block(piece, block * 0x4000
+		, (std::min)(0x4000, fs.piece_size(piece) - block * 0x4000));
 	
 	std::string fn = fs.file_path(fs.internal_at(files[0].file_index));
 
@@ -97,14 +99,9 @@ void log_hash_block(FILE** f, libtorrent::torrent const& t, int piece, int block
 		if (offset >= sizeof(filename)) break;
 	}
 
-	fprintf(*f, "%s\t%04d\t%04d\t%s\t%s\t%s\n", to_hex(t.info_hash().to_string()).c_str(), piece
-		, block, corrupt ? " bad" : "good", print_address(a).c_str(), filename);
-
-	snprintf(filename, sizeof(filename), "hash_failures/%s_%d_%d_%s.block"
-		, to_hex(t.info_hash().to_string()).c_str(), piece, block, corrupt ? "bad" : "good");
-	FILE* data = fopen(filename, "w+");
-	fwrite(bytes, 1, len, data);
-	fclose(data);
+	fprintf(*f, "%s\t%04d\t%04d\t%s\t%s\t%s\t%s\n", to_hex(t.info_hash().to_string()).c_str(), piece
+		, block, corrupt ? " bad" : "good", print_address(a).c_str()
+		, to_hex(digest.to_string()).c_str(), filename);
 }
 
 #endif
@@ -139,46 +136,26 @@ namespace
 			(*m_torrent.session().m_logger) << time_now_string() << " PIECE PASS [ p: " << p
 				<< " | block_hash_size: " << m_block_hashes.size() << " ]\n";
 #endif
-			// has this piece failed earlier? If it has, go through the
-			// CRCs from the time it failed and ban the peers that
-			// sent bad blocks
-			std::map<piece_block, block_entry>::iterator i = m_block_hashes.lower_bound(piece_block(p, 0));
-			if (i == m_block_hashes.end() || int(i->first.piece_index) != p) return;
-
-			int size = m_torrent.torrent_file().piece_size(p);
-			peer_request r = {p, 0, (std::min)(16*1024, size)};
-			piece_block pb(p, 0);
-			while (size > 0)
-			{
-				if (i->first.block_index == pb.block_index)
-				{
-					m_torrent.filesystem().async_read(r, boost::bind(&smart_ban_plugin::on_read_ok_block
-						, shared_from_this(), *i, _1, _2));
-					m_block_hashes.erase(i++);
-				}
-				else
-				{
-					TORRENT_ASSERT(i->first.block_index > pb.block_index);
-				}
-
-				if (i == m_block_hashes.end() || int(i->first.piece_index) != p)
-					break;
-
-				r.start += 16*1024;
-				size -= 16*1024;
-				r.length = (std::min)(16*1024, size);
-				++pb.block_index;
-			}
-
-#ifndef NDEBUG
-			// make sure we actually removed all the entries for piece 'p'
-			i = m_block_hashes.lower_bound(piece_block(p, 0));
-			TORRENT_ASSERT(i == m_block_hashes.end() || int(i->first.piece_index) != p);
-#endif
+			// has this piece failed earlier? If it has, hash its blocks
+			// again and ban the peers that sent blocks that differ from
+			// the ones that passed
+			std::vector<block_entry>::iterator first = std::lower_bound(m_block_hashes.begin()
+				, m_block_hashes.end(), piece_block(p, 0), &compare_block);
+			std::vector<block_entry>::iterator last = first;
+			while (last != m_block_hashes.end() && int(last->block.piece_index) == p) ++last;
+			if (first == last) return;
+
+			std::vector<block_entry> entries(first, last);
+			m_block_hashes.erase(first, last);
+
+			m_torrent.session().inc_stats_counter(counters::smart_ban_passed_pieces);
+			m_torrent.filesystem().async_hash_blocks(p, m_salt
+				, boost::bind(&smart_ban_plugin::on_hash_passed_piece
+				, shared_from_this(), entries, _1, _2));
 
 			if (m_torrent.is_seed())
 			{
-				std::map<piece_block, block_entry>().swap(m_block_hashes);
+				std::vector<block_entry>().swap(m_block_hashes);
 				return;
 			}
 		}
@@ -186,78 +163,90 @@ namespace
 		void on_piece_failed(int p)
 		{
 			// The piece failed the hash check. Record
-			// the CRC and origin peer of every block
+			// the hash and origin peer of every block
 
 			// if the torrent is aborted, no point in starting
-			// a bunch of read operations on it
+			// a disk job for it
 			if (m_torrent.is_aborted()) return;
 
 			std::vector<void*> downloaders;
 			m_torrent.picker().get_downloaders(downloaders, p);
 
-			int size = m_torrent.torrent_file().piece_size(p);
-			peer_request r = {p, 0, (std::min)(16*1024, size)};
-			piece_block pb(p, 0);
-			for (std::vector<void*>::iterator i = downloaders.begin()
-				, end(downloaders.end()); i != end; ++i)
+			// the peers may be gone by the time the blocks have been
+			// hashed, so we remember their addresses rather than the
+			// peer entries. Blocks we don't know the origin of have
+			// an unspecified address
+			std::vector<address> senders(downloaders.size());
+			bool any_sender = false;
+			for (int i = 0; i < int(downloaders.size()); ++i)
 			{
-				if (*i != 0)
-				{
-					m_torrent.filesystem().async_read(r, boost::bind(&smart_ban_plugin::on_read_failed_block
-						, shared_from_this(), pb, ((policy::peer*)*i)->address(), _1, _2));
-				}
-
-				r.start += 16*1024;
-				size -= 16*1024;
-				r.length = (std::min)(16*1024, size);
-				++pb.block_index;
+				if (downloaders[i] == 0) continue;
+				senders[i] = ((policy::peer*)downloaders[i])->address();
+				any_sender = true;
 			}
-			TORRENT_ASSERT(size <= 0);
+			if (!any_sender) return;
+
+			// all blocks of the piece are read back and hashed in a
+			// single job on the disk thread
+			m_torrent.session().inc_stats_counter(counters::smart_ban_failed_pieces);
+			m_torrent.filesystem().async_hash_blocks(p, m_salt
+				, boost::bind(&smart_ban_plugin::on_hash_failed_piece
+				, shared_from_this(), p, senders, _1, _2));
 		}
 
 	private:
 
-		// this entry ties a specific block CRC to
+		// this entry ties a specific block hash to
 		// a peer.
 		struct block_entry
 		{
 			policy::peer* peer;
 			sha1_hash digest;
+			piece_block block;
 		};
 
-		void on_read_failed_block(piece_block b, address a, int ret, disk_io_job const& j)
+		static bool compare_block(block_entry const& e, piece_block const& b)
+		{ return e.block < b; }
+
+		void on_hash_failed_piece(int piece, std::vector<address> const& senders
+			, int ret, disk_io_job const& j)
 		{
 			TORRENT_ASSERT(m_torrent.session().is_network_thread());
-			
-			disk_buffer_holder buffer(m_torrent.session(), j.buffer);
 
 			// ignore read errors
-			if (ret != j.buffer_size) return;
+			if (ret < 0 || !j.block_hashes) return;
+
+			std::vector<sha1_hash> const& hashes = *j.block_hashes;
+			int num_blocks = (std::min)(hashes.size(), senders.size());
+			for (int i = 0; i < num_blocks; ++i)
+			{
+				if (senders[i] == address()) continue;
 
-			hasher h;
-			h.update(j.buffer, j.buffer_size);
-			h.update((char const*)&m_salt, sizeof(m_salt));
+				policy::peer* p = m_torrent.get_policy().find_peer(senders[i]);
 
-			std::pair<policy::iterator, policy::iterator> range
-				= m_torrent.get_policy().find_peers(a);
+				// there is no peer with this address anymore
+				if (p == 0) continue;
 
-			// there is no peer with this address anymore
-			if (range.first == range.second) return;
+				record_block(piece_block(piece, i), p, hashes[i]);
+			}
+		}
 
-			policy::peer* p = (*range.first);
-			block_entry e = {p, h.final()};
+		void record_block(piece_block b, policy::peer* p, sha1_hash const& digest)
+		{
+			block_entry e = {p, digest, b};
 
 #ifdef TORRENT_LOG_HASH_FAILURES
 			log_hash_block(&m_log_file, m_torrent, b.piece_index
-				, b.block_index, p->address(), j.buffer, j.buffer_size, true);
+				, b.block_index, p->address(), digest, true);
 #endif
 
-			std::map<piece_block, block_entry>::iterator i = m_block_hashes.lower_bound(b);
+			std::vector<block_entry>::iterator i = std::lower_bound(m_block_hashes.begin()
+				, m_block_hashes.end(), b, &compare_block);
 
-			if (i != m_block_hashes.end() && i->first == b && i->second.peer == p)
+			if (i != m_block_hashes.end() && i->block == b && i->peer == p)
 			{
 				// this peer has sent us this block before
-				if (i->second.digest != e.digest)
+				if (i->digest != e.digest)
 				{
 					// this time the digest of the block is different
 					// from the first time it sent it
@@ -280,20 +269,19 @@ namespace
 					(*m_torrent.session().m_logger) << time_now_string() << " BANNING PEER [ p: " << b.piece_index
 						<< " | b: " << b.block_index
 						<< " | c: " << client
-						<< " | hash1: " << i->second.digest
+						<< " | hash1: " << i->digest
 						<< " | hash2: " << e.digest
 						<< " | ip: " << p->ip() << " ]\n";
 #endif
-					m_torrent.get_policy().ban_peer(p);
-					if (p->connection) p->connection->disconnect(
-						errors::peer_banned);
+					ban_peer(p);
 				}
-				// we already have this exact entry in the map
+				// we already have this exact entry in the table
 				// we don't have to insert it
 				return;
 			}
 			
-			m_block_hashes.insert(i, std::pair<const piece_block, block_entry>(b, e));
+			m_block_hashes.insert(i, e);
+			m_torrent.session().inc_stats_counter(counters::smart_ban_blocks_recorded);
 
 #ifdef TORRENT_LOGGING
 			char const* client = "-";
@@ -311,47 +299,55 @@ namespace
 #endif
 		}
 		
-		void on_read_ok_block(std::pair<piece_block, block_entry> b, int ret, disk_io_job const& j)
+		void on_hash_passed_piece(std::vector<block_entry> const& entries
+			, int ret, disk_io_job const& j)
 		{
 			TORRENT_ASSERT(m_torrent.session().is_network_thread());
 
-			disk_buffer_holder buffer(m_torrent.session(), j.buffer);
-
 			// ignore read errors
-			if (ret != j.buffer_size) return;
+			if (ret < 0 || !j.block_hashes) return;
 
-			hasher h;
-			h.update(j.buffer, j.buffer_size);
-			h.update((char const*)&m_salt, sizeof(m_salt));
-			sha1_hash ok_digest = h.final();
+			std::vector<sha1_hash> const& hashes = *j.block_hashes;
+			for (std::vector<block_entry>::const_iterator i = entries.begin()
+				, end(entries.end()); i != end; ++i)
+			{
+				if (int(i->block.block_index) >= int(hashes.size())) continue;
+				sha1_hash const& ok_digest = hashes[i->block.block_index];
 
-			policy::peer* p = b.second.peer;
+				policy::peer* p = i->peer;
 
-			if (b.second.digest == ok_digest) return;
-			if (p == 0) return;
+				if (i->digest == ok_digest) continue;
+				if (p == 0) continue;
 
 #ifdef TORRENT_LOG_HASH_FAILURES
-			log_hash_block(&m_log_file, m_torrent, b.first.piece_index
-				, b.first.block_index, p->address(), j.buffer, j.buffer_size, false);
+				log_hash_block(&m_log_file, m_torrent, i->block.piece_index
+					, i->block.block_index, p->address(), ok_digest, false);
 #endif
 
-			if (!m_torrent.get_policy().has_peer(p)) return;
+				if (!m_torrent.get_policy().has_peer(p)) continue;
 
 #ifdef TORRENT_LOGGING
-			char const* client = "-";
-			peer_info info;
-			if (p->connection)
-			{
-				p->connection->get_peer_info(info);
-				client = info.client.c_str();
-			}
-			(*m_torrent.session().m_logger) << time_now_string() << " BANNING PEER [ p: " << b.first.piece_index
-				<< " | b: " << b.first.block_index
-				<< " | c: " << client
-				<< " | ok_digest: " << ok_digest
-				<< " | bad_digest: " << b.second.digest
-				<< " | ip: " << p->ip() << " ]\n";
+				char const* client = "-";
+				peer_info info;
+				if (p->connection)
+				{
+					p->connection->get_peer_info(info);
+					client = info.client.c_str();
+				}
+				(*m_torrent.session().m_logger) << time_now_string() << " BANNING PEER [ p: " << i->block.piece_index
+					<< " | b: " << i->block.block_index
+					<< " | c: " << client
+					<< " | ok_digest: " << ok_digest
+					<< " | bad_digest: " << i->digest
+					<< " | ip: " << p->ip() << " ]\n";
 #endif
+				ban_peer(p);
+			}
+		}
+
+		void ban_peer(policy::peer* p)
+		{
+			m_torrent.session().inc_stats_counter(counters::smart_ban_peers_banned);
 			m_torrent.get_policy().ban_peer(p);
 			if (p->connection) p->connection->disconnect(
 				errors::peer_banned);
@@ -359,15 +355,16 @@ namespace
 		
 		torrent& m_torrent;
 
-		// This table maps a piece_block (piece and block index
-		// pair) to a peer and the block CRC. The CRC is calculated
-		// from the data in the block + the salt
-		std::map<piece_block, block_entry> m_block_hashes;
+		// This table ties blocks (piece and block index) to the
+		// peer that sent them and the hash of the block. It's
+		// sorted by block and only holds blocks of pieces that
+		// failed the hash check. The hash is calculated from the
+		// data in the block + the salt
+		std::vector<block_entry> m_block_hashes;
 
-		// This salt is a random value used to calculate the block CRCs
-		// Since the CRC function that is used is not a one way function
-		// the salt is required to avoid attacks where bad data is sent
-		// that is forged to match the CRC of the good data.
+		// This salt is a random value used to calculate the block hashes.
+		// It prevents a peer from forging data that matches the hash
+		// of the good data.
 		int m_salt;
 
 #ifdef TORRENT_LOG_HASH_FAILURES
@@ -140,7 +140,8 @@ namespace libtorrent
 		, std::string p
 		, std::vector<std::pair<size_type, std::time_t> > const& sizes
 		, int flags
-		, error_code& error)
+		, error_code& error
+		, file_pool* pool)
 	{
 		if ((int)sizes.size() != fs.num_files())
 		{
@@ -160,7 +161,9 @@ namespace libtorrent
 
 			file_status s;
 			error_code ec;
-			stat_file(combine_path(p, fs.file_path(*i)), &s, ec);
+			std::string path = combine_path(p, fs.file_path(*i));
+			if (pool == 0 || !pool->take_file_status(path, &s, ec))
+				stat_file(path, &s, ec);
 
 			if (!ec)
 			{
@@ -202,6 +205,24 @@ namespace libtorrent
 	// for backwards compatibility, let the default readv and
 	// writev implementations be implemented in terms of the
 	// old read and write
+#ifndef TORRENT_NO_DEPRECATE
+	bool storage_interface::verify_resume_data(bdecode_node const& rd, error_code& error)
+	{
+		std::pair<char const*, int> buf = rd.data_section();
+		lazy_entry e;
+		if (lazy_bdecode(buf.first, buf.first + buf.second, e, error) != 0)
+			return false;
+		return verify_resume_data(e, error);
+	}
+
+	bool storage_interface::verify_resume_data(lazy_entry const&, error_code&)
+	{
+		// a storage that implements neither overload doesn't keep
+		// anything in the resume data, so there's nothing to verify
+		return true;
+	}
+#endif
+
 	int storage_interface::readv(file::iovec_t const* bufs
 		, int slot, int offset, int num_bufs)
 	{
@@ -617,50 +638,50 @@ namespace libtorrent
 		return int((data_start + m_files.piece_length() - 1) / m_files.piece_length());
 	}
 
-	bool default_storage::verify_resume_data(lazy_entry const& rd, error_code& error)
+	bool default_storage::verify_resume_data(bdecode_node const& rd, error_code& error)
 	{
 		// TODO: make this more generic to not just work if files have been
 		// renamed, but also if they have been merged into a single file for instance
 		// maybe use the same format as .torrent files and reuse some code from torrent_info
-		lazy_entry const* mapped_files = rd.dict_find_list("mapped_files");
-		if (mapped_files && mapped_files->list_size() == m_files.num_files())
+		bdecode_node mapped_files = rd.dict_find_list("mapped_files");
+		if (mapped_files && mapped_files.list_size() == m_files.num_files())
 		{
 			m_mapped_files.reset(new file_storage(m_files));
 			for (int i = 0; i < m_files.num_files(); ++i)
 			{
-				std::string new_filename = mapped_files->list_string_value_at(i);
+				std::string new_filename = mapped_files.list_string_value_at(i);
 				if (new_filename.empty()) continue;
 				m_mapped_files->rename_file(i, new_filename);
 			}
 		}
 		
-		lazy_entry const* file_priority = rd.dict_find_list("file_priority");
-		if (file_priority && file_priority->list_size()
+		bdecode_node file_priority = rd.dict_find_list("file_priority");
+		if (file_priority && file_priority.list_size()
 			== files().num_files())
 		{
-			m_file_priority.resize(file_priority->list_size());
-			for (int i = 0; i < file_priority->list_size(); ++i)
-				m_file_priority[i] = boost::uint8_t(file_priority->list_int_value_at(i, 1));
+			m_file_priority.resize(file_priority.list_size());
+			for (int i = 0; i < file_priority.list_size(); ++i)
+				m_file_priority[i] = boost::uint8_t(file_priority.list_int_value_at(i, 1));
 		}
 
 		std::vector<std::pair<size_type, std::time_t> > file_sizes;
-		lazy_entry const* file_sizes_ent = rd.dict_find_list("file sizes");
-		if (file_sizes_ent == 0)
+		bdecode_node file_sizes_ent = rd.dict_find_list("file sizes");
+		if (!file_sizes_ent)
 		{
 			error = errors::missing_file_sizes;
 			return false;
 		}
 		
-		for (int i = 0; i < file_sizes_ent->list_size(); ++i)
+		for (int i = 0; i < file_sizes_ent.list_size(); ++i)
 		{
-			lazy_entry const* e = file_sizes_ent->list_at(i);
-			if (e->type() != lazy_entry::list_t
-				|| e->list_size() != 2
-				|| e->list_at(0)->type() != lazy_entry::int_t
-				|| e->list_at(1)->type() != lazy_entry::int_t)
+			bdecode_node e = file_sizes_ent.list_at(i);
+			if (e.type() != bdecode_node::list_t
+				|| e.list_size() != 2
+				|| e.list_at(0).type() != bdecode_node::int_t
+				|| e.list_at(1).type() != bdecode_node::int_t)
 				continue;
 			file_sizes.push_back(std::pair<size_type, std::time_t>(
-				e->list_int_value_at(0), std::time_t(e->list_int_value_at(1))));
+				e.list_int_value_at(0), std::time_t(e.list_int_value_at(1))));
 		}
 
 		if (file_sizes.empty())
@@ -671,27 +692,27 @@ namespace libtorrent
 		
 		bool seed = false;
 		
-		lazy_entry const* slots = rd.dict_find_list("slots");
+		bdecode_node slots = rd.dict_find_list("slots");
 		if (slots)
 		{
-			if (int(slots->list_size()) == m_files.num_pieces())
+			if (int(slots.list_size()) == m_files.num_pieces())
 			{
 				seed = true;
-				for (int i = 0; i < slots->list_size(); ++i)
+				for (int i = 0; i < slots.list_size(); ++i)
 				{
-					if (slots->list_int_value_at(i, -1) >= 0) continue;
+					if (slots.list_int_value_at(i, -1) >= 0) continue;
 					seed = false;
 					break;
 				}
 			}
 		}
-		else if (lazy_entry const* pieces = rd.dict_find_string("pieces"))
+		else if (bdecode_node pieces = rd.dict_find_string("pieces"))
 		{
-			if (int(pieces->string_length()) == m_files.num_pieces())
+			if (int(pieces.string_length()) == m_files.num_pieces())
 			{
 				seed = true;
-				char const* p = pieces->string_ptr();
-				for (int i = 0; i < pieces->string_length(); ++i)
+				char const* p = pieces.string_ptr();
+				for (int i = 0; i < pieces.string_length(); ++i)
 				{
 					if ((p[i] & 1) == 1) continue;
 					seed = false;
@@ -734,7 +755,7 @@ namespace libtorrent
 		int flags = (full_allocation_mode ? 0 : compact_mode)
 			| (settings().ignore_resume_timestamps ? ignore_timestamps : 0);
 
-		return match_filesizes(files(), m_save_path, file_sizes, flags, error);
+		return match_filesizes(files(), m_save_path, file_sizes, flags, error, &m_pool);
 
 	}
 
@@ -1525,7 +1546,7 @@ ret:
 		m_io_thread.add_job(j, handler);
 	}
 
-	void piece_manager::async_check_fastresume(lazy_entry const* resume_data
+	void piece_manager::async_check_fastresume(bdecode_node const* resume_data
 		, boost::function<void(int, disk_io_job const&)> const& handler)
 	{
 		TORRENT_ASSERT(resume_data != 0);
@@ -1655,6 +1676,18 @@ ret:
 		m_io_thread.add_job(j, handler);
 	}
 
+	void piece_manager::async_hash_blocks(int piece, int salt
+		, boost::function<void(int, disk_io_job const&)> const& handler)
+	{
+		disk_io_job j;
+		j.storage = this;
+		j.action = disk_io_job::hash_blocks;
+		j.piece = piece;
+		j.offset = salt;
+
+		m_io_thread.add_job(j, handler);
+	}
+
 	std::string piece_manager::save_path() const
 	{
 		mutex::scoped_lock l(m_mutex);
@@ -2043,7 +2076,7 @@ ret:
 	// isn't return false and the full check
 	// will be run
 	int piece_manager::check_fastresume(
-		lazy_entry const& rd, error_code& error)
+		bdecode_node const& rd, error_code& error)
 	{
 		mutex::scoped_lock lock(m_mutex);
 
@@ -2054,9 +2087,9 @@ ret:
 		m_current_slot = 0;
 
 		// if we don't have any resume data, return
-		if (rd.type() == lazy_entry::none_t) return check_no_fastresume(error);
+		if (rd.type() == bdecode_node::none_t) return check_no_fastresume(error);
 
-		if (rd.type() != lazy_entry::dict_t)
+		if (rd.type() != bdecode_node::dict_t)
 		{
 			error = errors::not_a_dictionary;
 			return check_no_fastresume(error);
@@ -2087,14 +2120,14 @@ ret:
 		if (storage_mode == internal_storage_mode_compact_deprecated || rd.dict_find("pieces") == 0)
 		{
 			// read slots map
-			lazy_entry const* slots = rd.dict_find_list("slots");
-			if (slots == 0)
+			bdecode_node slots = rd.dict_find_list("slots");
+			if (!slots)
 			{
 				error = errors::missing_slots;
 				return check_no_fastresume(error);
 			}
 
-			if ((int)slots->list_size() > m_files.num_pieces())
+			if ((int)slots.list_size() > m_files.num_pieces())
 			{
 				error = errors::too_many_slots;
 				return check_no_fastresume(error);
@@ -2105,16 +2138,16 @@ ret:
 				int num_pieces = int(m_files.num_pieces());
 				m_slot_to_piece.resize(num_pieces, unallocated);
 				m_piece_to_slot.resize(num_pieces, has_no_slot);
-				for (int i = 0; i < slots->list_size(); ++i)
+				for (int i = 0; i < slots.list_size(); ++i)
 				{
-					lazy_entry const* e = slots->list_at(i);
-					if (e->type() != lazy_entry::int_t)
+					bdecode_node e = slots.list_at(i);
+					if (e.type() != bdecode_node::int_t)
 					{
 						error = errors::invalid_slot_list;
 						return check_no_fastresume(error);
 					}
 
-					int index = int(e->int_value());
+					int index = int(e.int_value());
 					if (index >= num_pieces || index < -2)
 					{
 						error = errors::invalid_piece_index;
@@ -2141,16 +2174,16 @@ ret:
 			}
 			else
 			{
-				for (int i = 0; i < slots->list_size(); ++i)
+				for (int i = 0; i < slots.list_size(); ++i)
 				{
-					lazy_entry const* e = slots->list_at(i);
-					if (e->type() != lazy_entry::int_t)
+					bdecode_node e = slots.list_at(i);
+					if (e.type() != bdecode_node::int_t)
 					{
 						error = errors::invalid_slot_list;
 						return check_no_fastresume(error);
 					}
 
-					int index = int(e->int_value());
+					int index = int(e.int_value());
 					if (index != i && index >= 0)
 					{
 						error = errors::invalid_piece_index;
@@ -2190,14 +2223,14 @@ ret:
 		else if (m_storage_mode == internal_storage_mode_compact_deprecated)
 		{
 			// read piece map
-			lazy_entry const* pieces = rd.dict_find("pieces");
-			if (pieces == 0 || pieces->type() != lazy_entry::string_t)
+			bdecode_node pieces = rd.dict_find("pieces");
+			if (!pieces || pieces.type() != bdecode_node::string_t)
 			{
 				error = errors::missing_pieces;
 				return check_no_fastresume(error);
 			}
 
-			if ((int)pieces->string_length() != m_files.num_pieces())
+			if ((int)pieces.string_length() != m_files.num_pieces())
 			{
 				error = errors::too_many_slots;
 				return check_no_fastresume(error);
@@ -2206,7 +2239,7 @@ ret:
 			int num_pieces = int(m_files.num_pieces());
 			m_slot_to_piece.resize(num_pieces, unallocated);
 			m_piece_to_slot.resize(num_pieces, has_no_slot);
-			char const* have_pieces = pieces->string_ptr();
+			char const* have_pieces = pieces.string_ptr();
 			for (int i = 0; i < num_pieces; ++i)
 			{
 				if (have_pieces[i] & 1)
@@ -51,7 +51,7 @@ namespace libtorrent
 		// than a system call and can be
 		// used where more accurate time
 		// is not necessary
-		ptime g_current_time;
+		TORRENT_EXTRA_EXPORT ptime g_current_time;
 	}
 
 	TORRENT_EXPORT ptime const& time_now() { return aux::g_current_time; }
@@ -0,0 +1,202 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/timer_wheel.hpp"
+
+namespace libtorrent
+{
+	timer_wheel::timer_wheel(boost::uint32_t now)
+		: m_now(now)
+		, m_size(0)
+	{
+		for (int l = 0; l < num_levels; ++l)
+		{
+			for (int i = 0; i < num_slots; ++i)
+			{
+				timer_entry& head = m_slots[l][i];
+				head.next = &head;
+				head.prev = &head;
+			}
+		}
+	}
+
+	timer_wheel::~timer_wheel()
+	{
+		// unlink any entries that are still scheduled, so that
+		// their owners don't think they are
+		for (int l = 0; l < num_levels; ++l)
+		{
+			for (int i = 0; i < num_slots; ++i)
+			{
+				timer_entry* head = &m_slots[l][i];
+				for (timer_entry* e = head->next; e != head;)
+				{
+					timer_entry* n = e->next;
+					e->next = 0;
+					e->prev = 0;
+					e = n;
+				}
+			}
+		}
+	}
+
+	void timer_wheel::schedule(timer_entry* e, boost::uint32_t expires)
+	{
+		if (e->scheduled()) cancel(e);
+
+		// timers in the past expire on the next tick we process
+		if (boost::int32_t(expires - m_now) < 0) expires = m_now;
+		e->expires = expires;
+		link(e);
+		++m_size;
+	}
+
+	void timer_wheel::cancel(timer_entry* e)
+	{
+		if (!e->scheduled()) return;
+		TORRENT_ASSERT(m_size > 0);
+		e->prev->next = e->next;
+		e->next->prev = e->prev;
+		e->next = 0;
+		e->prev = 0;
+		--m_size;
+	}
+
+	void timer_wheel::link(timer_entry* e)
+	{
+		boost::uint32_t delta = e->expires - m_now;
+		TORRENT_ASSERT(boost::int32_t(delta) >= 0);
+
+		// pick the lowest level whose range covers delta. The slot
+		// is picked by the expiry tick (not by delta) so that a slot
+		// at level n holds the timers due when the level below it wraps
+		// around to that slot
+		int level = 0;
+		while (level < num_levels - 1
+			&& delta >= (boost::uint32_t(1) << ((level + 1) * slot_bits)))
+			++level;
+
+		boost::uint32_t expires = e->expires;
+		if (level == num_levels - 1)
+		{
+			// clamp timers beyond the horizon of the wheel
+			boost::uint32_t const horizon = (boost::uint32_t(1) << (num_levels * slot_bits)) - 1;
+			if (delta > horizon) expires = m_now + horizon;
+		}
+
+		timer_entry* head = &m_slots[level][(expires >> (level * slot_bits)) & slot_mask];
+		e->next = head;
+		e->prev = head->prev;
+		head->prev->next = e;
+		head->prev = e;
+	}
+
+	void timer_wheel::cascade(int level)
+	{
+		timer_entry* head = &m_slots[level][(m_now >> (level * slot_bits)) & slot_mask];
+		if (head->next == head) return;
+		timer_entry* e = head->next;
+
+		// detach the whole list before relinking, since an entry may
+		// (in the case of clamped timers) end up in the same slot again
+		head->prev->next = 0;
+		head->next = head;
+		head->prev = head;
+
+		while (e)
+		{
+			timer_entry* n = e->next;
+			link(e);
+			e = n;
+		}
+	}
+
+	boost::uint32_t timer_wheel::next_expiry() const
+	{
+		TORRENT_ASSERT(m_size > 0);
+		boost::uint32_t ret = 0;
+		bool found = false;
+		for (int l = 0; l < num_levels; ++l)
+		{
+			// level 0 holds the timers due in the next num_slots ticks,
+			// starting at the current slot. The current slot of the
+			// levels above has already been cascaded, so anything in it
+			// is a whole rotation ahead, and comes last
+			int const start = (m_now >> (l * slot_bits)) & slot_mask;
+			int const first = l == 0 ? 0 : 1;
+			for (int i = first; i < first + num_slots; ++i)
+			{
+				timer_entry const* head = &m_slots[l][(start + i) & slot_mask];
+				if (head->next == head) continue;
+
+				// a slot above level 0 covers a range of ticks
+				for (timer_entry const* e = head->next; e != head; e = e->next)
+				{
+					boost::uint32_t expires = e->expires;
+					if (boost::int32_t(expires - m_now) < 0) expires = m_now;
+					if (!found || boost::int32_t(expires - ret) < 0) ret = expires;
+					found = true;
+				}
+				break;
+			}
+		}
+		TORRENT_ASSERT(found);
+		return ret;
+	}
+
+	void timer_wheel::advance(boost::uint32_t now, std::vector<timer_entry*>& expired)
+	{
+		while (boost::int32_t(now - m_now) >= 0)
+		{
+			int index = m_now & slot_mask;
+
+			// when a level wraps around, the next slot of the level
+			// above it is spread out over this level
+			for (int l = 1; l < num_levels && index == 0; ++l)
+			{
+				cascade(l);
+				index = (m_now >> (l * slot_bits)) & slot_mask;
+			}
+
+			timer_entry* head = &m_slots[0][m_now & slot_mask];
+			while (head->next != head)
+			{
+				timer_entry* e = head->next;
+				TORRENT_ASSERT(e->expires == m_now);
+				cancel(e);
+				expired.push_back(e);
+			}
+			++m_now;
+		}
+	}
+}
+
@@ -55,6 +55,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/tracker_manager.hpp"
 #include "libtorrent/parse_url.hpp"
 #include "libtorrent/bencode.hpp"
+#include "libtorrent/bencode_writer.hpp"
+#include "libtorrent/file.hpp"
 #include "libtorrent/hasher.hpp"
 #include "libtorrent/entry.hpp"
 #include "libtorrent/peer.hpp"
@@ -355,6 +357,7 @@ namespace libtorrent
 		, m_url(p.url)
 		, m_uuid(p.uuid)
 		, m_source_feed_url(p.source_feed_url)
+		, m_delta_fields(0)
 		, m_storage_constructor(p.storage)
 		, m_added_time(time(0))
 		, m_completed_time(0)
@@ -414,6 +417,10 @@ namespace libtorrent
 		, m_last_scrape(0)
 		, m_last_download(0)
 		, m_last_upload(0)
+		, m_ticking_index(-1)
+		, m_auto_manage_key(0)
+		, m_engaged_index(-1)
+		, m_auto_manage_queue(-1)
 		, m_downloaders(0xffffff)
 		, m_interface_index(0)
 		, m_graceful_pause_mode(false)
@@ -423,8 +430,16 @@ namespace libtorrent
 		, m_apply_ip_filter(p.flags & add_torrent_params::flag_apply_ip_filter)
 		, m_merge_resume_trackers(p.flags & add_torrent_params::flag_merge_resume_trackers)
 		, m_state_subscription(p.flags & add_torrent_params::flag_update_subscribe)
-		, m_in_state_updates(false)
-	{
+		, m_in_state_updates(0)
+		, m_dormant(false)
+		, m_dormant_paused(false)
+		, m_dormant_seed(false)
+		, m_dormant_finished(false)
+		, m_dormant_upload_mode(false)
+		, m_torrent_file_pins(0)
+	{
+		m_wake_timer.userdata = this;
+		m_unload_timer.userdata = this;
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		m_resume_data_loaded = false;
 		m_finished_alert_posted = false;
@@ -789,7 +804,7 @@ namespace libtorrent
 
 #endif
 
-	void torrent::start()
+	void torrent::start(bdecode_node* resume)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
@@ -802,15 +817,22 @@ namespace libtorrent
 			m_picker.reset(new piece_picker());
 			std::fill(m_file_progress.begin(), m_file_progress.end(), 0);
 
-			if (!m_resume_data.empty())
+			if (!m_resume_data.empty() && resume && *resume)
+			{
+				// the resume data was decoded by the torrent_loader.
+				// m_resume_data took over its buffer in the constructor
+				TORRENT_ASSERT(resume->data_section().first == &m_resume_data[0]);
+				m_resume_entry.swap(*resume);
+			}
+			else if (!m_resume_data.empty())
 			{
 				int pos;
 				error_code ec;
-				if (lazy_bdecode(&m_resume_data[0], &m_resume_data[0]
+				if (bdecode(&m_resume_data[0], &m_resume_data[0]
 					+ m_resume_data.size(), m_resume_entry, ec, &pos) != 0)
 				{
 					std::vector<char>().swap(m_resume_data);
-					lazy_entry().swap(m_resume_entry);
+					bdecode_node().swap(m_resume_entry);
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
 					debug_log("resume data rejected: %s pos: %d", ec.message().c_str(), pos);
 #endif
@@ -937,6 +959,13 @@ namespace libtorrent
 	void torrent::read_piece(int piece)
 	{
 		TORRENT_ASSERT(piece >= 0 && piece < m_torrent_file->num_pieces());
+		if (!need_loaded())
+		{
+			m_ses.m_alerts.post_alert(read_piece_alert(
+				get_handle(), piece, boost::shared_array<char>(), 0));
+			return;
+		}
+
 		int piece_size = m_torrent_file->piece_size(piece);
 		int blocks_in_piece = (piece_size + block_size() - 1) / block_size();
 
@@ -1033,11 +1062,7 @@ namespace libtorrent
 		else
 		{
 			// reset last_connected, to force fast reconnect after leaving upload mode
-			for (policy::iterator i = m_policy.begin_peer()
-				, end(m_policy.end_peer()); i != end; ++i)
-			{
-				(*i)->last_connected = 0;
-			}
+			m_policy.clear_last_connected();
 
 			// send_block_requests on all peers
 			for (std::set<peer_connection*>::iterator i = m_connections.begin()
@@ -1155,6 +1180,7 @@ namespace libtorrent
 
 		// avoid crash trying to access the picker when there is none
 		if (!has_picker()) return;
+		if (!need_loaded()) return;
 
 		if (picker().have_piece(piece)
 			&& (flags & torrent::overwrite_existing) == 0)
@@ -1574,7 +1600,7 @@ namespace libtorrent
 		{
 			m_ses.m_io_service.post(boost::bind(&torrent::files_checked, shared_from_this()));
 			std::vector<char>().swap(m_resume_data);
-			lazy_entry().swap(m_resume_entry);
+			bdecode_node().swap(m_resume_entry);
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 			m_resume_data_loaded = true;
 #endif
@@ -1583,7 +1609,7 @@ namespace libtorrent
 
 		set_state(torrent_status::checking_resume_data);
 
-		if (m_resume_entry.type() == lazy_entry::dict_t)
+		if (m_resume_entry.type() == bdecode_node::dict_t)
 		{
 			int ev = 0;
 			if (m_resume_entry.dict_find_string_value("file-format") != "libtorrent resume file")
@@ -1609,7 +1635,7 @@ namespace libtorrent
 					, error_code(ev, get_libtorrent_category()).message().c_str());
 #endif
 				std::vector<char>().swap(m_resume_data);
-				lazy_entry().swap(m_resume_entry);
+				bdecode_node().swap(m_resume_entry);
 			}
 			else
 			{
@@ -1718,74 +1744,26 @@ namespace libtorrent
 			handle_disk_error(j);
 			set_state(torrent_status::queued_for_checking);
 			std::vector<char>().swap(m_resume_data);
-			lazy_entry().swap(m_resume_entry);
+			bdecode_node().swap(m_resume_entry);
 			return;
 		}
 
 		state_updated();
 
-		if (m_resume_entry.type() == lazy_entry::dict_t)
+		if (m_resume_entry.type() == bdecode_node::dict_t)
 		{
-			using namespace libtorrent::detail; // for read_*_endpoint()
+			add_compact_peers(m_resume_entry);
 			peer_id id(0);
 
-			if (lazy_entry const* peers_entry = m_resume_entry.dict_find_string("peers"))
-			{
-				int num_peers = peers_entry->string_length() / (sizeof(address_v4::bytes_type) + 2);
-				char const* ptr = peers_entry->string_ptr();
-				for (int i = 0; i < num_peers; ++i)
-				{
-					m_policy.add_peer(read_v4_endpoint<tcp::endpoint>(ptr)
-						, id, peer_info::resume_data, 0);
-				}
-			}
-
-			if (lazy_entry const* banned_peers_entry = m_resume_entry.dict_find_string("banned_peers"))
-			{
-				int num_peers = banned_peers_entry->string_length() / (sizeof(address_v4::bytes_type) + 2);
-				char const* ptr = banned_peers_entry->string_ptr();
-				for (int i = 0; i < num_peers; ++i)
-				{
-					policy::peer* p = m_policy.add_peer(read_v4_endpoint<tcp::endpoint>(ptr)
-						, id, peer_info::resume_data, 0);
-					if (p) m_policy.ban_peer(p);
-				}
-			}
-
-#if TORRENT_USE_IPV6
-			if (lazy_entry const* peers6_entry = m_resume_entry.dict_find_string("peers6"))
-			{
-				int num_peers = peers6_entry->string_length() / (sizeof(address_v6::bytes_type) + 2);
-				char const* ptr = peers6_entry->string_ptr();
-				for (int i = 0; i < num_peers; ++i)
-				{
-					m_policy.add_peer(read_v6_endpoint<tcp::endpoint>(ptr)
-						, id, peer_info::resume_data, 0);
-				}
-			}
-
-			if (lazy_entry const* banned_peers6_entry = m_resume_entry.dict_find_string("banned_peers6"))
-			{
-				int num_peers = banned_peers6_entry->string_length() / (sizeof(address_v6::bytes_type) + 2);
-				char const* ptr = banned_peers6_entry->string_ptr();
-				for (int i = 0; i < num_peers; ++i)
-				{
-					policy::peer* p = m_policy.add_peer(read_v6_endpoint<tcp::endpoint>(ptr)
-						, id, peer_info::resume_data, 0);
-					if (p) m_policy.ban_peer(p);
-				}
-			}
-#endif
-
 			// parse out "peers" from the resume data and add them to the peer list
-			if (lazy_entry const* peers_entry = m_resume_entry.dict_find_list("peers"))
+			if (bdecode_node peers_entry = m_resume_entry.dict_find_list("peers"))
 			{
-				for (int i = 0; i < peers_entry->list_size(); ++i)
+				for (int i = 0; i < peers_entry.list_size(); ++i)
 				{
-					lazy_entry const* e = peers_entry->list_at(i);
-					if (e->type() != lazy_entry::dict_t) continue;
-					std::string ip = e->dict_find_string_value("ip");
-					int port = e->dict_find_int_value("port");
+					bdecode_node e = peers_entry.list_at(i);
+					if (e.type() != bdecode_node::dict_t) continue;
+					std::string ip = e.dict_find_string_value("ip");
+					int port = e.dict_find_int_value("port");
 					if (ip.empty() || port == 0) continue;
 					error_code ec;
 					tcp::endpoint a(address::from_string(ip, ec), (unsigned short)port);
@@ -1795,14 +1773,14 @@ namespace libtorrent
 			}
 
 			// parse out "banned_peers" and add them as banned
-			if (lazy_entry const* banned_peers_entry = m_resume_entry.dict_find_list("banned_peers"))
+			if (bdecode_node banned_peers_entry = m_resume_entry.dict_find_list("banned_peers"))
 			{	
-				for (int i = 0; i < banned_peers_entry->list_size(); ++i)
+				for (int i = 0; i < banned_peers_entry.list_size(); ++i)
 				{
-					lazy_entry const* e = banned_peers_entry->list_at(i);
-					if (e->type() != lazy_entry::dict_t) continue;
-					std::string ip = e->dict_find_string_value("ip");
-					int port = e->dict_find_int_value("port");
+					bdecode_node e = banned_peers_entry.list_at(i);
+					if (e.type() != bdecode_node::dict_t) continue;
+					std::string ip = e.dict_find_string_value("ip");
+					int port = e.dict_find_int_value("port");
 					if (ip.empty() || port == 0) continue;
 					error_code ec;
 					tcp::endpoint a(address::from_string(ip, ec), (unsigned short)port);
@@ -1841,15 +1819,15 @@ namespace libtorrent
 			// there are either no files for this torrent
 			// or the resume_data was accepted
 
-			if (!j.error && m_resume_entry.type() == lazy_entry::dict_t)
+			if (!j.error && m_resume_entry.type() == bdecode_node::dict_t)
 			{
 				// parse have bitmask
-				lazy_entry const* pieces = m_resume_entry.dict_find("pieces");
-				if (pieces && pieces->type() == lazy_entry::string_t
-					&& int(pieces->string_length()) == m_torrent_file->num_pieces())
+				bdecode_node pieces = m_resume_entry.dict_find("pieces");
+				if (pieces && pieces.type() == bdecode_node::string_t
+					&& int(pieces.string_length()) == m_torrent_file->num_pieces())
 				{
-					char const* pieces_str = pieces->string_ptr();
-					for (int i = 0, end(pieces->string_length()); i < end; ++i)
+					char const* pieces_str = pieces.string_ptr();
+					for (int i = 0, end(pieces.string_length()); i < end; ++i)
 					{
 						if (pieces_str[i] & 1) we_have(i);
 						if (m_seed_mode && (pieces_str[i] & 2)) m_verified.set_bit(i);
@@ -1857,12 +1835,12 @@ namespace libtorrent
 				}
 				else
 				{
-					lazy_entry const* slots = m_resume_entry.dict_find("slots");
-					if (slots && slots->type() == lazy_entry::list_t)
+					bdecode_node slots = m_resume_entry.dict_find("slots");
+					if (slots && slots.type() == bdecode_node::list_t)
 					{
-						for (int i = 0; i < slots->list_size(); ++i)
+						for (int i = 0; i < slots.list_size(); ++i)
 						{
-							int piece = slots->list_int_value_at(i, -1);
+							int piece = slots.list_int_value_at(i, -1);
 							if (piece >= 0) we_have(piece);
 						}
 					}
@@ -1872,19 +1850,19 @@ namespace libtorrent
 				int num_blocks_per_piece =
 					static_cast<int>(torrent_file().piece_length()) / block_size();
 
-				if (lazy_entry const* unfinished_ent = m_resume_entry.dict_find_list("unfinished"))
+				if (bdecode_node unfinished_ent = m_resume_entry.dict_find_list("unfinished"))
 				{
-					for (int i = 0; i < unfinished_ent->list_size(); ++i)
+					for (int i = 0; i < unfinished_ent.list_size(); ++i)
 					{
-						lazy_entry const* e = unfinished_ent->list_at(i);
-						if (e->type() != lazy_entry::dict_t) continue;
-						int piece = e->dict_find_int_value("piece", -1);
+						bdecode_node e = unfinished_ent.list_at(i);
+						if (e.type() != bdecode_node::dict_t) continue;
+						int piece = e.dict_find_int_value("piece", -1);
 						if (piece < 0 || piece > torrent_file().num_pieces()) continue;
 
 						if (m_picker->have_piece(piece))
 							m_picker->we_dont_have(piece);
 
-						std::string bitmask = e->dict_find_string_value("bitmask");
+						std::string bitmask = e.dict_find_string_value("bitmask");
 						if (bitmask.empty()) continue;
 
 						const int num_bitmask_bytes = (std::max)(num_blocks_per_piece / 8, 1);
@@ -1921,7 +1899,7 @@ namespace libtorrent
 		}
 
 		std::vector<char>().swap(m_resume_data);
-		lazy_entry().swap(m_resume_entry);
+		bdecode_node().swap(m_resume_entry);
 	}
 
 	void torrent::queue_torrent_check()
@@ -1943,6 +1921,7 @@ namespace libtorrent
 	void torrent::force_recheck()
 	{
 		if (!valid_metadata()) return;
+		if (!need_loaded()) return;
 
 		// if the torrent is already queued to check its files
 		// don't do anything
@@ -1977,7 +1956,7 @@ namespace libtorrent
 			set_queue_position((std::numeric_limits<int>::max)());
 
 		std::vector<char>().swap(m_resume_data);
-		lazy_entry().swap(m_resume_entry);
+		bdecode_node().swap(m_resume_entry);
 		m_storage->async_check_fastresume(&m_resume_entry
 			, boost::bind(&torrent::on_force_recheck
 			, shared_from_this(), _1, _2));
@@ -2405,6 +2384,7 @@ namespace libtorrent
 	void torrent::scrape_tracker()
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
+		flush_dormant_time();
 		m_last_scrape = 0;
 
 		if (m_trackers.empty()) return;
@@ -2449,6 +2429,9 @@ namespace libtorrent
 		if (incomplete >= 0) m_incomplete = incomplete;
 		if (downloaders >= 0) m_downloaders = downloaders;
 
+		// the scrape data affects our seed rank
+		m_ses.update_auto_manage_state(this);
+
 		if (m_ses.m_alerts.should_post<scrape_reply_alert>())
 		{
 			m_ses.m_alerts.post_alert(scrape_reply_alert(
@@ -2510,7 +2493,11 @@ namespace libtorrent
 		if (complete >= 0) m_complete = complete;
 		if (incomplete >= 0) m_incomplete = incomplete;
 		if (complete >= 0 && incomplete >= 0)
+		{
+			flush_dormant_time();
 			m_last_scrape = 0;
+		}
+		m_ses.update_auto_manage_state(this);
 
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
 		debug_log("TRACKER RESPONSE\n"
@@ -2649,6 +2636,8 @@ namespace libtorrent
 			, m_ses.m_half_open.free_slots())
 			, m_ses.m_boost_connections - m_ses.m_settings.connection_speed);
 
+		if (conns > 0 && !need_loaded()) return;
+
 		while (want_more_peers() && conns > 0)
 		{
 			if (!m_policy.connect_one_peer(m_ses.session_time())) break;
@@ -3401,9 +3390,7 @@ namespace libtorrent
 
 				// mark the peer as banned
 				m_policy.ban_peer(p);
-#ifdef TORRENT_STATS
-				++m_ses.m_banned_for_hash_failure;
-#endif
+				m_ses.inc_stats_counter(counters::banned_for_hash_failure);
 
 				if (p->connection)
 				{
@@ -3482,6 +3469,16 @@ namespace libtorrent
 		if (m_abort) return;
 
 		m_abort = true;
+		stop_ticking();
+		m_ses.update_auto_manage_state(this);
+
+		// nobody will load the evicted metadata anymore
+		if (!m_torrent_file->is_loaded())
+		{
+			error_code ec;
+			remove(metadata_cache_file(), ec);
+		}
+
 		// if the torrent is paused, it doesn't need
 		// to announce with even=stopped again.
 		if (!is_paused())
@@ -3625,6 +3622,7 @@ namespace libtorrent
 		{
 			m_need_save_resume_data = false;
 			m_last_saved_resume = time(0);
+			flush_dormant_time();
 			write_resume_data(*j.resume_data);
 			alerts().post_alert(save_resume_data_alert(j.resume_data
 				, get_handle()));
@@ -3666,6 +3664,7 @@ namespace libtorrent
 
 	void torrent::set_piece_deadline(int piece, int t, int flags)
 	{
+		wake_up();
 		ptime deadline = time_now() + milliseconds(t);
 
 		if (is_seed() || m_picker->have_piece(piece))
@@ -3904,6 +3903,7 @@ namespace libtorrent
 
 		// this call is only valid on torrents with metadata
 		if (!valid_metadata() || is_seed()) return;
+		if (!need_loaded()) return;
 
 		// the bitmask need to have exactly one bit for every file
 		// in the torrent
@@ -3932,6 +3932,7 @@ namespace libtorrent
 
 		// this call is only valid on torrents with metadata
 		if (!valid_metadata() || is_seed()) return;
+		if (!need_loaded()) return;
 
 		TORRENT_ASSERT(index < m_torrent_file->num_files());
 		TORRENT_ASSERT(index >= 0);
@@ -3946,16 +3947,22 @@ namespace libtorrent
 		// this call is only valid on torrents with metadata
 		if (!valid_metadata()) return 1;
 
-		TORRENT_ASSERT(index < m_torrent_file->num_files());
 		TORRENT_ASSERT(index >= 0);
-		if (index < 0 || index >= m_torrent_file->num_files()) return 0;
-		return m_file_priority[index];
+		if (index < 0) return 0;
+
+		// the file priorities stay in memory when the metadata is
+		// unloaded, and cover every file once the torrent is initialized
+		if (index < int(m_file_priority.size())) return m_file_priority[index];
+
+		TORRENT_ASSERT(!is_loaded() || index < m_torrent_file->num_files());
+		if (is_loaded() && index < m_torrent_file->num_files()) return 1;
+		return 0;
 	}
 
 	void torrent::file_priorities(std::vector<int>* files) const
 	{
 		INVARIANT_CHECK;
-		if (!valid_metadata())
+		if (!valid_metadata() || !is_loaded())
 		{
 			files->resize(m_file_priority.size());
 			std::copy(m_file_priority.begin(), m_file_priority.end(), files->begin());
@@ -4112,6 +4119,7 @@ namespace libtorrent
 
 		// this call is only valid on torrents with metadata
 		if (!valid_metadata() || is_seed()) return;
+		if (!need_loaded()) return;
 
 		// the bitmask need to have exactly one bit for every file
 		// in the torrent
@@ -4372,20 +4380,33 @@ namespace libtorrent
 		m_connections.erase(i);
 	}
 
+	void torrent::clear_web_seed_peer(policy::peer& p)
+	{
+		peer_connection* peer = p.connection;
+		if (peer) {
+			TORRENT_ASSERT(peer->m_in_use == 1337);
+			peer->set_peer_info(0);
+			p.connection = 0;
+		}
+		if (has_picker()) picker().clear_peer(&p);
+	}
+
 	void torrent::remove_web_seed(std::list<web_seed_entry>::iterator web)
 	{
+		// the connections must not refer to the peer slots once
+		// the entry is gone. If it's being resolved (for another
+		// connection) the entry itself is removed by the resolver
+		// callback
+		clear_web_seed_peer(web->peer_info);
+		for (std::list<policy::peer>::iterator i = web->extra_peers.begin()
+			, end(web->extra_peers.end()); i != end; ++i)
+			clear_web_seed_peer(*i);
+
 		if (web->resolving)
 		{
 			web->removed = true;
 			return;
 		}
-		peer_connection * peer = web->peer_info.connection;
-		if (peer) {
-			TORRENT_ASSERT(peer->m_in_use == 1337);
-			peer->set_peer_info(0);
-		}
-		if (has_picker()) picker().clear_peer(&web->peer_info);
-					
 
 		m_web_seeds.erase(web);
 	}
@@ -4402,6 +4423,8 @@ namespace libtorrent
 			|| m_ses.num_connections() >= m_ses.settings().connections_limit)
 			return;
 
+		if (!need_loaded()) return;
+
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
 		debug_log("resolving web seed: %s", web->url.c_str());
 #endif
@@ -4430,7 +4453,7 @@ namespace libtorrent
 			return;
 		}
 
-		if (web->peer_info.banned)
+		if (web->banned())
 		{
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
 			debug_log("banned web seed: %s", web->url.c_str());
@@ -4510,9 +4533,9 @@ namespace libtorrent
 		{
 			// use proxy
 			web->resolving = true;
-			tcp::resolver::query q(ps.hostname, to_string(ps.port).elems);
-			m_ses.m_host_resolver.async_resolve(q,
-				boost::bind(&torrent::on_proxy_name_lookup, shared_from_this(), _1, _2, web));
+			m_ses.m_resolver.async_resolve(ps.hostname,
+				boost::bind(&torrent::on_proxy_name_lookup, shared_from_this(), _1, _2
+					, int(ps.port), web));
 		}
 		else if (ps.proxy_hostnames
 			&& (ps.type == proxy_settings::socks5
@@ -4523,14 +4546,14 @@ namespace libtorrent
 		else
 		{
 			web->resolving = true;
-			tcp::resolver::query q(hostname, to_string(port).elems);
-			m_ses.m_host_resolver.async_resolve(q,
-				boost::bind(&torrent::on_name_lookup, shared_from_this(), _1, _2, web
-					, tcp::endpoint()));
+			m_ses.m_resolver.async_resolve(hostname,
+				boost::bind(&torrent::on_name_lookup, shared_from_this(), _1, _2
+					, port, web, tcp::endpoint()));
 		}
 	}
 
-	void torrent::on_proxy_name_lookup(error_code const& e, tcp::resolver::iterator host
+	void torrent::on_proxy_name_lookup(error_code const& e
+		, std::vector<address> const& host, int proxy_port
 		, std::list<web_seed_entry>::iterator web)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
@@ -4558,7 +4581,7 @@ namespace libtorrent
 
 		if (m_abort) return;
 
-		if (e || host == tcp::resolver::iterator())
+		if (e || host.empty())
 		{
 			if (m_ses.m_alerts.should_post<url_seed_alert>())
 			{
@@ -4575,7 +4598,7 @@ namespace libtorrent
 		if (m_ses.is_aborted()) return;
 
 #ifndef TORRENT_DISABLE_GEO_IP
-		int as = m_ses.as_for_ip(host->endpoint().address());
+		int as = m_ses.as_for_ip(host.front());
 #ifdef TORRENT_DEBUG
 		web->peer_info.inet_as_num = as;
 #endif
@@ -4586,7 +4609,7 @@ namespace libtorrent
 			|| m_ses.num_connections() >= m_ses.settings().connections_limit)
 			return;
 
-		tcp::endpoint a(host->endpoint());
+		tcp::endpoint a(host.front(), proxy_port);
 
 		using boost::tuples::ignore;
 		std::string hostname;
@@ -4615,12 +4638,13 @@ namespace libtorrent
 		}
 
 		web->resolving = true;
-		tcp::resolver::query q(hostname, to_string(port).elems);
-		m_ses.m_host_resolver.async_resolve(q,
-			boost::bind(&torrent::on_name_lookup, shared_from_this(), _1, _2, web, a));
+		m_ses.m_resolver.async_resolve(hostname,
+			boost::bind(&torrent::on_name_lookup, shared_from_this(), _1, _2
+				, port, web, a));
 	}
 
-	void torrent::on_name_lookup(error_code const& e, tcp::resolver::iterator host
+	void torrent::on_name_lookup(error_code const& e
+		, std::vector<address> const& host, int port
 		, std::list<web_seed_entry>::iterator web, tcp::endpoint proxy)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
@@ -4643,7 +4667,7 @@ namespace libtorrent
 
 		if (m_abort) return;
 
-		if (e || host == tcp::resolver::iterator())
+		if (e || host.empty())
 		{
 			if (m_ses.m_alerts.should_post<url_seed_alert>())
 				m_ses.m_alerts.post_alert(url_seed_alert(get_handle(), web->url, e));
@@ -4661,7 +4685,7 @@ namespace libtorrent
 			|| m_ses.num_connections() >= m_ses.settings().connections_limit)
 			return;
 
-		tcp::endpoint a(host->endpoint());
+		tcp::endpoint a(host.front(), port);
 		connect_web_seed(web, a);
 	}
 
@@ -4677,13 +4701,18 @@ namespace libtorrent
 		}
 		
 		TORRENT_ASSERT(web->resolving == false);
-		TORRENT_ASSERT(web->peer_info.connection == 0);
 
 		web->endpoint = a;
 
 		if (is_paused()) return;
 		if (m_ses.is_aborted()) return;
 
+		// this is the peer slot the new connection will use. It's
+		// 0 if we already have as many connections as we're allowed
+		policy::peer* peer_info = web->free_slot(web_seed_connection_limit());
+		if (peer_info == 0) return;
+		TORRENT_ASSERT(peer_info->connection == 0);
+
 		boost::shared_ptr<socket_type> s(new (std::nothrow) socket_type(m_ses.m_io_service));
 		if (!s) return;
 	
@@ -4748,13 +4777,13 @@ namespace libtorrent
 		if (web->type == web_seed_entry::url_seed)
 		{
 			c = new (std::nothrow) web_peer_connection(
-				m_ses, shared_from_this(), s, a, web->url, &web->peer_info, // TODO: pass in web
+				m_ses, shared_from_this(), s, a, web->url, peer_info, // TODO: pass in web
 				web->auth, web->extra_headers);
 		}
 		else if (web->type == web_seed_entry::http_seed)
 		{
 			c = new (std::nothrow) http_seed_connection(
-				m_ses, shared_from_this(), s, a, web->url, &web->peer_info, // TODO: pass in web
+				m_ses, shared_from_this(), s, a, web->url, peer_info, // TODO: pass in web
 				web->auth, web->extra_headers);
 		}
 		if (!c) return;
@@ -4778,17 +4807,18 @@ namespace libtorrent
 			// add the newly connected peer to this torrent's peer list
 			m_connections.insert(boost::get_pointer(c));
 			m_ses.m_connections.insert(c);
+			wake_up();
 
-			TORRENT_ASSERT(!web->peer_info.connection);
-			web->peer_info.connection = c.get();
+			TORRENT_ASSERT(!peer_info->connection);
+			peer_info->connection = c.get();
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
-			web->peer_info.in_use = true;
+			peer_info->in_use = true;
 #endif
 
-			c->add_stat(size_type(web->peer_info.prev_amount_download) << 10
-				, size_type(web->peer_info.prev_amount_upload) << 10);
-			web->peer_info.prev_amount_download = 0;
-			web->peer_info.prev_amount_upload = 0;
+			c->add_stat(size_type(peer_info->prev_amount_download) << 10
+				, size_type(peer_info->prev_amount_upload) << 10);
+			peer_info->prev_amount_download = 0;
+			peer_info->prev_amount_upload = 0;
 #if defined TORRENT_VERBOSE_LOGGING 
 			debug_log("web seed connection started: %s", web->url.c_str());
 #endif
@@ -4957,7 +4987,7 @@ namespace libtorrent
 	}
 #endif
 
-	void torrent::read_resume_data(lazy_entry const& rd)
+	void torrent::read_resume_data(bdecode_node const& rd)
 	{
 		m_total_uploaded = rd.dict_find_int_value("total_uploaded");
 		m_total_downloaded = rd.dict_find_int_value("total_downloaded");
@@ -4999,12 +5029,12 @@ namespace libtorrent
 		// The mapped_files needs to be read both in the network thread
 		// and in the disk thread, since they both have their own mapped files structures
 		// which are kept in sync
-		lazy_entry const* mapped_files = rd.dict_find_list("mapped_files");
-		if (mapped_files && mapped_files->list_size() == m_torrent_file->num_files())
+		bdecode_node mapped_files = rd.dict_find_list("mapped_files");
+		if (mapped_files && mapped_files.list_size() == m_torrent_file->num_files())
 		{
 			for (int i = 0; i < m_torrent_file->num_files(); ++i)
 			{
-				std::string new_filename = mapped_files->list_string_value_at(i);
+				std::string new_filename = mapped_files.list_string_value_at(i);
 				if (new_filename.empty()) continue;
 				m_torrent_file->rename_file(i, new_filename);
 			}
@@ -5015,21 +5045,21 @@ namespace libtorrent
 		if (m_completed_time != 0 && m_completed_time < m_added_time)
 			m_completed_time = m_added_time;
 
-		lazy_entry const* file_priority = rd.dict_find_list("file_priority");
-		if (file_priority && file_priority->list_size()
+		bdecode_node file_priority = rd.dict_find_list("file_priority");
+		if (file_priority && file_priority.list_size()
 			== m_torrent_file->num_files())
 		{
-			for (int i = 0; i < file_priority->list_size(); ++i)
-				m_file_priority[i] = file_priority->list_int_value_at(i, 1);
+			for (int i = 0; i < file_priority.list_size(); ++i)
+				m_file_priority[i] = file_priority.list_int_value_at(i, 1);
 			update_piece_priorities();
 		}
 
-		lazy_entry const* piece_priority = rd.dict_find_string("piece_priority");
-		if (piece_priority && piece_priority->string_length()
+		bdecode_node piece_priority = rd.dict_find_string("piece_priority");
+		if (piece_priority && piece_priority.string_length()
 			== m_torrent_file->num_pieces())
 		{
-			char const* p = piece_priority->string_ptr();
-			for (int i = 0; i < piece_priority->string_length(); ++i)
+			char const* p = piece_priority.string_ptr();
+			for (int i = 0; i < piece_priority.string_length(); ++i)
 				m_picker->set_piece_priority(i, p[i]);
 			m_policy.recalculate_connect_candidates();
 		}
@@ -5060,20 +5090,21 @@ namespace libtorrent
 			int track_ = rd.dict_find_int_value("announce_to_trackers", -1);
 			if (track_ != -1) m_announce_to_trackers = track_;
 		}
+		m_ses.update_auto_manage_state(this);
 
-		lazy_entry const* trackers = rd.dict_find_list("trackers");
+		bdecode_node trackers = rd.dict_find_list("trackers");
 		if (trackers)
 		{
 			if (!m_merge_resume_trackers) m_trackers.clear();
 			int tier = 0;
-			for (int i = 0; i < trackers->list_size(); ++i)
+			for (int i = 0; i < trackers.list_size(); ++i)
 			{
-				lazy_entry const* tier_list = trackers->list_at(i);
-				if (tier_list == 0 || tier_list->type() != lazy_entry::list_t)
+				bdecode_node tier_list = trackers.list_at(i);
+				if (!tier_list || tier_list.type() != bdecode_node::list_t)
 					continue;
-				for (int j = 0; j < tier_list->list_size(); ++j)
+				for (int j = 0; j < tier_list.list_size(); ++j)
 				{
-					announce_entry e(tier_list->list_string_value_at(j));
+					announce_entry e(tier_list.list_string_value_at(j));
 					if (std::find_if(m_trackers.begin(), m_trackers.end()
 						, boost::bind(&announce_entry::url, _1) == e.url) != m_trackers.end())
 						continue;
@@ -5090,24 +5121,24 @@ namespace libtorrent
 				prioritize_udp_trackers();
 		}
 
-		lazy_entry const* url_list = rd.dict_find_list("url-list");
+		bdecode_node url_list = rd.dict_find_list("url-list");
 		if (url_list)
 		{
-			for (int i = 0; i < url_list->list_size(); ++i)
+			for (int i = 0; i < url_list.list_size(); ++i)
 			{
-				std::string url = url_list->list_string_value_at(i);
+				std::string url = url_list.list_string_value_at(i);
 				if (url.empty()) continue;
 				if (m_torrent_file->num_files() > 1 && url[url.size()-1] != '/') url += '/';
 				add_web_seed(url, web_seed_entry::url_seed);
 			}
 		}
 
-		lazy_entry const* httpseeds = rd.dict_find_list("httpseeds");
+		bdecode_node httpseeds = rd.dict_find_list("httpseeds");
 		if (httpseeds)
 		{
-			for (int i = 0; i < httpseeds->list_size(); ++i)
+			for (int i = 0; i < httpseeds.list_size(); ++i)
 			{
-				std::string url = httpseeds->list_string_value_at(i);
+				std::string url = httpseeds.list_string_value_at(i);
 				if (url.empty()) continue;
 				add_web_seed(url, web_seed_entry::http_seed);
 			}
@@ -5115,16 +5146,16 @@ namespace libtorrent
 
 		if (m_torrent_file->is_merkle_torrent())
 		{
-			lazy_entry const* mt = rd.dict_find_string("merkle tree");
+			bdecode_node mt = rd.dict_find_string("merkle tree");
 			if (mt)
 			{
 				std::vector<sha1_hash> tree;
 				tree.resize(m_torrent_file->merkle_tree().size());
-				std::memcpy(&tree[0], mt->string_ptr()
-					, (std::min)(mt->string_length(), int(tree.size()) * 20));
-				if (mt->string_length() < int(tree.size()) * 20)
-					std::memset(&tree[0] + mt->string_length() / 20, 0
-						, tree.size() - mt->string_length() / 20);
+				std::memcpy(&tree[0], mt.string_ptr()
+					, (std::min)(mt.string_length(), int(tree.size()) * 20));
+				if (mt.string_length() < int(tree.size()) * 20)
+					std::memset(&tree[0] + mt.string_length() / 20, 0
+						, tree.size() - mt.string_length() / 20);
 				m_torrent_file->set_merkle_tree(tree);
 			}
 			else
@@ -5142,14 +5173,23 @@ namespace libtorrent
 	boost::intrusive_ptr<torrent_info> torrent::get_torrent_copy()
 	{
 		if (!m_torrent_file->is_valid()) return boost::intrusive_ptr<torrent_info>();
+		if (!need_loaded()) return boost::intrusive_ptr<torrent_info>();
 
 		// copy the torrent_info object
 		return boost::intrusive_ptr<torrent_info>(new torrent_info(*m_torrent_file));
 	}
 	
+	bool torrent::load_write_resume_data(entry& ret)
+	{
+		if (valid_metadata() && !need_loaded()) return false;
+		write_resume_data(ret);
+		return true;
+	}
+
 	void torrent::write_resume_data(entry& ret) const
 	{
 		using namespace libtorrent::detail; // for write_*_endpoint()
+		TORRENT_ASSERT(!valid_metadata() || is_loaded());
 		ret["file-format"] = "libtorrent resume file";
 		ret["file-version"] = 1;
 		ret["libtorrent-version"] = LIBTORRENT_VERSION;
@@ -5568,7 +5608,7 @@ namespace libtorrent
 		TORRENT_ASSERT(peerinfo);
 		TORRENT_ASSERT(peerinfo->connection == 0);
 
-		peerinfo->last_connected = m_ses.session_time();
+		m_policy.set_last_connected(peerinfo, m_ses.session_time());
 #ifdef TORRENT_DEBUG
 		if (!settings().allow_multiple_connections_per_ip)
 		{
@@ -5695,6 +5735,7 @@ namespace libtorrent
 		// add the newly connected peer to this torrent's peer list
 		m_connections.insert(boost::get_pointer(c));
 		m_ses.m_connections.insert(c);
+		wake_up();
 		m_policy.set_connection(peerinfo, c.get());
 		c->start();
 
@@ -5860,6 +5901,12 @@ namespace libtorrent
 			return false;
 		}
 
+		if (!need_loaded())
+		{
+			p->disconnect(m_error);
+			return false;
+		}
+
 		if ((m_state == torrent_status::queued_for_checking
 			|| m_state == torrent_status::checking_files
 			|| m_state == torrent_status::checking_resume_data)
@@ -5939,6 +5986,7 @@ namespace libtorrent
 		}
 		TORRENT_ASSERT(m_connections.find(p) == m_connections.end());
 		m_connections.insert(p);
+		wake_up();
 #ifdef TORRENT_DEBUG
 		error_code ec;
 		TORRENT_ASSERT(p->remote() == p->get_socket()->remote_endpoint(ec) || ec);
@@ -6229,6 +6277,9 @@ namespace libtorrent
 			return;
 		}
 
+		// we may have web seeds to connect to now
+		wake_up();
+
 		// we might be finished already, in which case we should
 		// not switch to downloading mode. If all files are
 		// filtered, we're finished when we start.
@@ -6326,6 +6377,8 @@ namespace libtorrent
 	{
 		INVARIANT_CHECK;
 
+		if (!need_loaded()) return false;
+
 		TORRENT_ASSERT(index >= 0);
 		TORRENT_ASSERT(index < m_torrent_file->num_files());
 
@@ -6341,7 +6394,7 @@ namespace libtorrent
 		TORRENT_ASSERT(m_ses.is_network_thread());
 		INVARIANT_CHECK;
 
-		if (m_owning_storage.get())
+		if (m_owning_storage.get() && need_loaded())
 		{
 #if TORRENT_USE_UNC_PATHS
 			std::string path = canonicalize_path(save_path);
@@ -6413,6 +6466,10 @@ namespace libtorrent
 		TORRENT_ASSERT(m_ses.is_network_thread());
 		if (is_paused()) TORRENT_ASSERT(num_peers() == 0 || m_graceful_pause_mode);
 
+		// a dormant torrent is not ticked
+		if (m_dormant) TORRENT_ASSERT(m_ticking_index == -1);
+		if (m_wake_timer.scheduled()) TORRENT_ASSERT(m_dormant);
+
 		if (!should_check_files())
 			TORRENT_ASSERT(m_state != torrent_status::checking_files);
 		else
@@ -6455,8 +6512,8 @@ namespace libtorrent
 			}
 		}
 
-		TORRENT_ASSERT(m_resume_entry.type() == lazy_entry::dict_t
-			|| m_resume_entry.type() == lazy_entry::none_t);
+		TORRENT_ASSERT(m_resume_entry.type() == bdecode_node::dict_t
+			|| m_resume_entry.type() == bdecode_node::none_t);
 
 		int num_uploads = 0;
 		std::map<piece_block, int> num_requests;
@@ -6508,22 +6565,6 @@ namespace libtorrent
 			TORRENT_ASSERT(m_abort || m_error || !m_picker || m_picker->num_pieces() == 0);
 		}
 
-#ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
-		// make sure we haven't modified the peer object
-		// in a way that breaks the sort order
-		if (m_policy.begin_peer() != m_policy.end_peer())
-		{
-			policy::const_iterator i = m_policy.begin_peer();
-			policy::const_iterator prev = i++;
-			policy::const_iterator end(m_policy.end_peer());
-			policy::peer_address_compare cmp;
-			for (; i != end; ++i, ++prev)
-			{
-				TORRENT_ASSERT(!cmp(*i, *prev));
-			}
-		}
-#endif
-
 		size_type total_done = quantized_bytes_done();
 		if (m_torrent_file->is_valid())
 		{
@@ -6568,11 +6609,14 @@ namespace libtorrent
 		}
 
 
-		for (std::vector<size_type>::const_iterator i = m_file_progress.begin()
-			, end(m_file_progress.end()); i != end; ++i)
+		if (m_torrent_file->is_loaded())
 		{
-			int index = i - m_file_progress.begin();
-			TORRENT_ASSERT(*i <= m_torrent_file->files().file_size(index));
+			for (std::vector<size_type>::const_iterator i = m_file_progress.begin()
+				, end(m_file_progress.end()); i != end; ++i)
+			{
+				int index = i - m_file_progress.begin();
+				TORRENT_ASSERT(*i <= m_torrent_file->files().file_size(index));
+			}
 		}
 	}
 #endif
@@ -6681,6 +6725,7 @@ namespace libtorrent
 			m_sequence_number = (std::min)(max_seq, p);
 		}
 
+		m_ses.update_auto_manage_state(this);
 		m_ses.m_auto_manage_time_scaler = 2;
 	}
 
@@ -6795,7 +6840,7 @@ namespace libtorrent
 		disconnect_all(errors::torrent_removed);
 		stop_announcing();
 
-		if (m_owning_storage.get())
+		if (m_owning_storage.get() && need_loaded())
 		{
 			TORRENT_ASSERT(m_storage);
 			m_storage->async_delete_files(
@@ -6914,8 +6959,10 @@ namespace libtorrent
 
 		ptime now = time_now();
 
-		int finished_time = m_finished_time;
-		int download_time = int(m_active_time) - finished_time;
+		// the time counters of dormant torrents lag behind
+		int dormant = dormant_seconds();
+		int finished_time = m_finished_time + (m_dormant_finished ? dormant : 0);
+		int download_time = int(m_active_time) + dormant - finished_time;
 
 		// if we haven't yet met the seed limits, set the seed_ratio_not_met
 		// flag. That will make this seed prioritized
@@ -6970,6 +7017,14 @@ namespace libtorrent
 			return;
 		}
 
+		// the resume data includes the peer list
+		if (!need_loaded())
+		{
+			alerts().post_alert(save_resume_data_failed_alert(get_handle()
+				, m_error));
+			return;
+		}
+
 		if (!m_owning_storage.get())
 		{
 			alerts().post_alert(save_resume_data_failed_alert(get_handle()
@@ -6988,6 +7043,7 @@ namespace libtorrent
 			|| m_state == torrent_status::checking_resume_data)
 		{
 			boost::shared_ptr<entry> rd(new entry);
+			flush_dormant_time();
 			write_resume_data(*rd);
 			alerts().post_alert(save_resume_data_alert(rd
 				, get_handle()));
@@ -7176,6 +7232,7 @@ namespace libtorrent
 		// don't add duplicates
 		if (std::find(m_web_seeds.begin(), m_web_seeds.end(), ent) != m_web_seeds.end()) return;
 		m_web_seeds.push_back(ent);
+		wake_up();
 	}
 
 	void torrent::add_web_seed(std::string const& url, web_seed_entry::type_t type
@@ -7185,6 +7242,7 @@ namespace libtorrent
 		// don't add duplicates
 		if (std::find(m_web_seeds.begin(), m_web_seeds.end(), ent) != m_web_seeds.end()) return;
 		m_web_seeds.push_back(ent);
+		wake_up();
 	}
 	
 	void torrent::set_allow_peers(bool b, bool graceful)
@@ -7218,6 +7276,7 @@ namespace libtorrent
 		{
 			do_resume();
 		}
+		m_ses.update_auto_manage_state(this);
 	}
 
 	void torrent::resume()
@@ -7239,6 +7298,7 @@ namespace libtorrent
 		m_need_save_resume_data = true;
 
 		do_resume();
+		m_ses.update_auto_manage_state(this);
 	}
 
 	void torrent::do_resume()
@@ -7263,6 +7323,10 @@ namespace libtorrent
 
 		m_started = time_now();
 		clear_error();
+
+		// the peer list is needed to connect to peers
+		if (!need_loaded()) return;
+
 		start_announcing();
 		if (!m_queued_for_checking && should_check_files())
 			queue_torrent_check();
@@ -7506,6 +7570,7 @@ namespace libtorrent
 			// if the rate is 0, there's no update because of network transfers
 			if (m_stat.low_pass_upload_rate() > 0 || m_stat.low_pass_download_rate() > 0)
 				state_updated();
+			maybe_go_dormant();
 			return;
 		}
 
@@ -7557,12 +7622,15 @@ namespace libtorrent
 			&& m_ses.num_connections() < m_ses.settings().connections_limit)
 		{
 			// keep trying web-seeds if there are any
-			// first find out which web seeds we are connected to
+			// first find out which web seeds we are connected to.
+			// one more connection is opened per tick to web seeds
+			// that allow more than one
+			const int limit = web_seed_connection_limit();
 			for (std::list<web_seed_entry>::iterator i = m_web_seeds.begin();
 				i != m_web_seeds.end();)
 			{
 				std::list<web_seed_entry>::iterator w = i++;
-				if (w->peer_info.connection) continue;
+				if (w->num_connections() >= limit) continue;
 				if (w->retry > time_now()) continue;
 				if (w->resolving) continue;
 
@@ -7609,6 +7677,399 @@ namespace libtorrent
 		// if the rate is 0, there's no update because of network transfers
 		if (m_stat.low_pass_upload_rate() > 0 || m_stat.low_pass_download_rate() > 0)
 			state_updated();
+
+		maybe_go_dormant();
+	}
+
+	void torrent::add_compact_peers(bdecode_node const& e)
+	{
+		using namespace libtorrent::detail; // for read_*_endpoint()
+		peer_id id(0);
+
+		if (bdecode_node peers_entry = e.dict_find_string("peers"))
+		{
+			int num_peers = peers_entry.string_length() / (sizeof(address_v4::bytes_type) + 2);
+			char const* ptr = peers_entry.string_ptr();
+			for (int i = 0; i < num_peers; ++i)
+			{
+				m_policy.add_peer(read_v4_endpoint<tcp::endpoint>(ptr)
+					, id, peer_info::resume_data, 0);
+			}
+		}
+
+		if (bdecode_node banned_peers_entry = e.dict_find_string("banned_peers"))
+		{
+			int num_peers = banned_peers_entry.string_length() / (sizeof(address_v4::bytes_type) + 2);
+			char const* ptr = banned_peers_entry.string_ptr();
+			for (int i = 0; i < num_peers; ++i)
+			{
+				policy::peer* p = m_policy.add_peer(read_v4_endpoint<tcp::endpoint>(ptr)
+					, id, peer_info::resume_data, 0);
+				if (p) m_policy.ban_peer(p);
+			}
+		}
+
+#if TORRENT_USE_IPV6
+		if (bdecode_node peers6_entry = e.dict_find_string("peers6"))
+		{
+			int num_peers = peers6_entry.string_length() / (sizeof(address_v6::bytes_type) + 2);
+			char const* ptr = peers6_entry.string_ptr();
+			for (int i = 0; i < num_peers; ++i)
+			{
+				m_policy.add_peer(read_v6_endpoint<tcp::endpoint>(ptr)
+					, id, peer_info::resume_data, 0);
+			}
+		}
+
+		if (bdecode_node banned_peers6_entry = e.dict_find_string("banned_peers6"))
+		{
+			int num_peers = banned_peers6_entry.string_length() / (sizeof(address_v6::bytes_type) + 2);
+			char const* ptr = banned_peers6_entry.string_ptr();
+			for (int i = 0; i < num_peers; ++i)
+			{
+				policy::peer* p = m_policy.add_peer(read_v6_endpoint<tcp::endpoint>(ptr)
+					, id, peer_info::resume_data, 0);
+				if (p) m_policy.ban_peer(p);
+			}
+		}
+#endif
+	}
+
+	std::string torrent::metadata_cache_file() const
+	{
+		return combine_path(settings().metadata_cache_path
+			, to_hex(m_torrent_file->info_hash().to_string()));
+	}
+
+	bool torrent::can_unload_metadata() const
+	{
+		if (m_abort || !m_dormant) return false;
+		if (settings().metadata_unload_timeout <= 0
+			|| settings().metadata_cache_path.empty()) return false;
+		if (!valid_metadata() || !m_torrent_file->is_loaded()) return false;
+		if (m_torrent_file_pins > 0) return false;
+
+		// renamed files and merkle trees are not part of the info
+		// section, so they can't be restored from it
+		if (&m_torrent_file->files() != &m_torrent_file->orig_files()) return false;
+		if (m_torrent_file->is_merkle_torrent()) return false;
+
+		if (!m_connections.empty()) return false;
+		if (!m_files_checked) return false;
+
+		// a torrent that still has peers to try isn't idle, it's
+		// waiting for a connection slot
+		if (!is_paused() && m_policy.num_connect_candidates() > 0) return false;
+		if (m_state == torrent_status::checking_files
+			|| m_state == torrent_status::queued_for_checking
+			|| m_state == torrent_status::checking_resume_data
+			|| m_state == torrent_status::allocating)
+			return false;
+		return true;
+	}
+
+	bool torrent::unload_metadata()
+	{
+		using namespace libtorrent::detail; // for write_*()
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		if (!can_unload_metadata()) return false;
+
+		// outstanding disk jobs and cached pieces hold references to
+		// the storage, and they need the file list. Try again later
+		if (m_owning_storage && m_owning_storage->refcount() > 1)
+		{
+			m_ses.schedule_torrent_unload(&m_unload_timer
+				, settings().metadata_unload_timeout);
+			return false;
+		}
+
+		// the peers are saved in the same format as in the resume data,
+		// except that all connectable peers that work are kept
+		std::string peers;
+		std::string banned_peers;
+		std::back_insert_iterator<std::string> peers_out(peers);
+		std::back_insert_iterator<std::string> banned_peers_out(banned_peers);
+#if TORRENT_USE_IPV6
+		std::string peers6;
+		std::string banned_peers6;
+		std::back_insert_iterator<std::string> peers6_out(peers6);
+		std::back_insert_iterator<std::string> banned_peers6_out(banned_peers6);
+#endif
+
+		// failcount is a 5 bit value
+		int max_failcount = (std::min)(settings().max_failcount, 31);
+
+		for (policy::const_iterator i = m_policy.begin_peer()
+			, end(m_policy.end_peer()); i != end; ++i)
+		{
+			policy::peer const* p = *i;
+#if TORRENT_USE_I2P
+			if (p->is_i2p_addr) continue;
+#endif
+			if (!p->banned && (!p->connectable
+				|| int(p->failcount) >= max_failcount)) continue;
+
+			address addr = p->address();
+#if TORRENT_USE_IPV6
+			if (addr.is_v6())
+			{
+				std::back_insert_iterator<std::string>& out
+					= p->banned ? banned_peers6_out : peers6_out;
+				write_address(addr, out);
+				write_uint16(p->port, out);
+			}
+			else
+#endif
+			{
+				std::back_insert_iterator<std::string>& out
+					= p->banned ? banned_peers_out : peers_out;
+				write_address(addr, out);
+				write_uint16(p->port, out);
+			}
+		}
+
+		std::vector<char> buf;
+		{
+			vector_sink sink(buf);
+			bencode_dict<vector_sink> cache(sink);
+			cache.string("banned_peers", banned_peers);
+#if TORRENT_USE_IPV6
+			cache.string("banned_peers6", banned_peers6);
+#endif
+			cache.raw("info", m_torrent_file->metadata().get()
+				, m_torrent_file->metadata_size());
+			cache.string("peers", peers);
+#if TORRENT_USE_IPV6
+			cache.string("peers6", peers6);
+#endif
+		}
+
+		error_code ec;
+		std::string path = metadata_cache_file();
+		create_directories(settings().metadata_cache_path, ec);
+		ec.clear();
+		file f;
+		if (f.open(path, file::write_only, ec))
+		{
+			file::iovec_t b = {&buf[0], buf.size()};
+			size_type written = f.writev(0, &b, 1, ec);
+			if (!ec && written != size_type(buf.size()))
+				ec = error_code(boost::system::errc::no_space_on_device, get_posix_category());
+			if (!ec) f.set_size(buf.size(), ec);
+		}
+		if (ec)
+		{
+			// we just stay loaded
+			if (alerts().should_post<file_error_alert>())
+				alerts().post_alert(file_error_alert(path, get_handle(), ec));
+			return false;
+		}
+
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+		debug_log("unloading metadata (%d bytes, %d peers)"
+			, int(buf.size()), m_policy.num_peers());
+#endif
+
+#ifndef TORRENT_DISABLE_EXTENSIONS
+		for (extension_list_t::iterator i = m_extensions.begin()
+			, end(m_extensions.end()); i != end; ++i)
+		{
+			TORRENT_TRY {
+				(*i)->on_unload();
+			} TORRENT_CATCH (std::exception&) {}
+		}
+#endif
+
+		m_policy.clear_peer_list();
+		m_torrent_file->unload();
+		state_updated();
+		return true;
+	}
+
+	bool torrent::pin_torrent_file()
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		TORRENT_ASSERT(m_torrent_file_pins < 0xffff);
+		if (m_torrent_file_pins < 0xffff) ++m_torrent_file_pins;
+		m_ses.cancel_torrent_unload(&m_unload_timer);
+		return need_loaded();
+	}
+
+	void torrent::unpin_torrent_file()
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		TORRENT_ASSERT(m_torrent_file_pins > 0);
+		if (m_torrent_file_pins == 0) return;
+		--m_torrent_file_pins;
+		if (can_unload_metadata())
+			m_ses.schedule_torrent_unload(&m_unload_timer
+				, settings().metadata_unload_timeout);
+	}
+
+	bool torrent::load_torrent_file()
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		if (!need_loaded()) return false;
+		// the reference handed out is good for at least another
+		// metadata_unload_timeout seconds
+		if (can_unload_metadata())
+			m_ses.schedule_torrent_unload(&m_unload_timer
+				, settings().metadata_unload_timeout);
+		return true;
+	}
+
+	bool torrent::need_loaded()
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		if (m_torrent_file->is_loaded()) return true;
+
+		m_ses.cancel_torrent_unload(&m_unload_timer);
+
+		error_code ec;
+		std::string path = metadata_cache_file();
+		std::vector<char> buf;
+		bdecode_node e;
+		if (load_file(path, buf, ec, (std::numeric_limits<int>::max)()) == 0
+			&& !buf.empty()
+			&& bdecode(&buf[0], &buf[0] + buf.size(), e, ec) == 0)
+		{
+			bdecode_node info = e.dict_find_dict("info");
+			if (!info)
+			{
+				ec = errors::torrent_missing_info;
+			}
+			else
+			{
+				std::pair<char const*, int> section = info.data_section();
+				m_torrent_file->load(section.first, section.second, ec);
+			}
+		}
+		else if (!ec)
+		{
+			ec = errors::torrent_file_parse_failed;
+		}
+
+		if (ec)
+		{
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
+			debug_log("*** FAILED TO LOAD METADATA: %s", ec.message().c_str());
+#endif
+			set_error(ec, path);
+			pause();
+			return false;
+		}
+
+		add_compact_peers(e);
+
+		// the cache file is rewritten every time the metadata
+		// is unloaded
+		remove(path, ec);
+
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+		debug_log("loaded metadata (%d bytes, %d peers)"
+			, int(buf.size()), m_policy.num_peers());
+#endif
+		state_updated();
+		return true;
+	}
+
+	void torrent::maybe_go_dormant()
+	{
+		TORRENT_ASSERT(!m_dormant);
+		if (m_abort) return;
+		if (!m_connections.empty()) return;
+		if (!m_time_critical_pieces.empty()) return;
+		// wait for the transfer rates to fade out to 0
+		if (!m_stat.is_idle()) return;
+		if (m_ses.m_alerts.should_post<stats_alert>()) return;
+
+		// the number of seconds until we need to be ticked
+		// again, or -1 if there's nothing to wait for
+		int wake_up_in = -1;
+
+		if (!is_paused())
+		{
+			if (m_upload_mode && m_auto_managed)
+			{
+				wake_up_in = (std::max)(settings().optimistic_disk_retry
+					- int(m_upload_mode_time), 1);
+			}
+
+			if (!is_finished() && !m_web_seeds.empty() && m_files_checked)
+			{
+				ptime now = time_now();
+				for (std::list<web_seed_entry>::iterator i = m_web_seeds.begin()
+					, end(m_web_seeds.end()); i != end; ++i)
+				{
+					// if there's a web seed we could connect to right
+					// now (but didn't, because of the connection limit)
+					// we need to keep trying
+					if (i->resolving || i->num_connections() > 0 || i->retry <= now)
+						return;
+					int retry = total_seconds(i->retry - now) + 1;
+					if (wake_up_in == -1 || retry < wake_up_in) wake_up_in = retry;
+				}
+			}
+		}
+
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+		debug_log("going dormant (wake-up in: %d)", wake_up_in);
+#endif
+
+		m_dormant = true;
+		m_dormant_since = time_now();
+		m_dormant_paused = is_paused();
+		m_dormant_seed = is_seed();
+		m_dormant_finished = is_finished();
+		m_dormant_upload_mode = m_upload_mode;
+		m_ses.stop_ticking(this);
+		if (wake_up_in >= 0)
+			m_ses.schedule_torrent_wakeup(&m_wake_timer, wake_up_in);
+		if (can_unload_metadata())
+			m_ses.schedule_torrent_unload(&m_unload_timer
+				, settings().metadata_unload_timeout);
+	}
+
+	void torrent::wake_up()
+	{
+		if (!m_dormant || m_abort) return;
+		TORRENT_ASSERT(m_ses.is_network_thread());
+
+		flush_dormant_time();
+		m_dormant = false;
+		m_ses.cancel_torrent_wakeup(&m_wake_timer);
+		m_ses.cancel_torrent_unload(&m_unload_timer);
+		m_ses.start_ticking(this);
+	}
+
+	void torrent::stop_ticking()
+	{
+		m_ses.stop_ticking(this);
+		m_ses.cancel_torrent_wakeup(&m_wake_timer);
+		m_ses.cancel_torrent_unload(&m_unload_timer);
+		m_dormant = false;
+	}
+
+	int torrent::dormant_seconds() const
+	{
+		if (!m_dormant || m_dormant_paused) return 0;
+		return total_seconds(time_now() - m_dormant_since);
+	}
+
+	void torrent::flush_dormant_time()
+	{
+		int elapsed = dormant_seconds();
+		if (elapsed <= 0) return;
+		m_dormant_since += seconds(elapsed);
+
+		// this mirrors how second_tick() increments the counters
+		if (m_dormant_seed) m_seeding_time += elapsed;
+		if (m_dormant_finished) m_finished_time += elapsed;
+		if (m_dormant_upload_mode) m_upload_mode_time += elapsed;
+		m_last_scrape += elapsed;
+		m_active_time += elapsed;
+		m_last_download += elapsed;
+		m_last_upload += elapsed;
 	}
 
 	void torrent::recalc_share_mode()
@@ -8030,37 +8491,43 @@ namespace libtorrent
 	void torrent::disconnect_web_seed(peer_connection* p)
 	{
 		std::list<web_seed_entry>::iterator i = std::find_if(m_web_seeds.begin(), m_web_seeds.end()
-			, (boost::bind(&policy::peer::connection, boost::bind(&web_seed_entry::peer_info, _1)) == p));
+			, boost::bind(&web_seed_entry::has_connection, _1, p));
 		// this happens if the web server responded with a redirect
 		// or with something incorrect, so that we removed the web seed
 		// immediately, before we disconnected
 		if (i == m_web_seeds.end()) return;
 
-		TORRENT_ASSERT(i->resolving == false);
-
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_ERROR_LOGGING
 		debug_log("disconnect web seed: \"%s\"", i->url.c_str());
 #endif
-		TORRENT_ASSERT(i->peer_info.connection);
-		i->peer_info.connection = 0;
+		if (i->peer_info.connection == p)
+		{
+			i->peer_info.connection = 0;
+			return;
+		}
+		for (std::list<policy::peer>::iterator j = i->extra_peers.begin()
+			, end(i->extra_peers.end()); j != end; ++j)
+		{
+			if (j->connection != p) continue;
+			j->connection = 0;
+			return;
+		}
 	}
 
 	void torrent::remove_web_seed(peer_connection* p)
 	{
 		std::list<web_seed_entry>::iterator i = std::find_if(m_web_seeds.begin(), m_web_seeds.end()
-			, (boost::bind(&policy::peer::connection, boost::bind(&web_seed_entry::peer_info, _1)) == p));
+			, boost::bind(&web_seed_entry::has_connection, _1, p));
 		TORRENT_ASSERT(i != m_web_seeds.end());
 		if (i == m_web_seeds.end()) return;
-		p->set_peer_info(0);
-		if (has_picker()) picker().clear_peer(&i->peer_info);
-		m_web_seeds.erase(i);
+		remove_web_seed(i);
 	}
 
 	void torrent::retry_web_seed(peer_connection* p, int retry)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
 		std::list<web_seed_entry>::iterator i = std::find_if(m_web_seeds.begin(), m_web_seeds.end()
-			, (boost::bind(&policy::peer::connection, boost::bind(&web_seed_entry::peer_info, _1)) == p));
+			, boost::bind(&web_seed_entry::has_connection, _1, p));
 
 		TORRENT_ASSERT(i != m_web_seeds.end());
 		if (i == m_web_seeds.end()) return;
@@ -8072,6 +8539,7 @@ namespace libtorrent
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
 		TORRENT_ASSERT(want_more_peers());
+		if (!need_loaded()) return false;
 		bool ret = m_policy.connect_one_peer(m_ses.session_time());
 		return ret;
 	}
@@ -8145,10 +8613,17 @@ namespace libtorrent
 	}
 
 #if !TORRENT_NO_FPU
+	void torrent::load_file_progress(std::vector<float>& fp)
+	{
+		fp.clear();
+		if (!valid_metadata() || !need_loaded()) return;
+		file_progress(fp);
+	}
+
 	void torrent::file_progress(std::vector<float>& fp) const
 	{
 		fp.clear();
-		if (!valid_metadata()) return;
+		if (!valid_metadata() || !is_loaded()) return;
 	
 		fp.resize(m_torrent_file->num_files(), 1.f);
 		if (is_seed()) return;
@@ -8164,9 +8639,19 @@ namespace libtorrent
 	}
 #endif
 
+	void torrent::load_file_progress(std::vector<size_type>& fp, int flags)
+	{
+		if (!valid_metadata() || !need_loaded())
+		{
+			fp.clear();
+			return;
+		}
+		file_progress(fp, flags);
+	}
+
 	void torrent::file_progress(std::vector<size_type>& fp, int flags) const
 	{
-		if (!valid_metadata())
+		if (!valid_metadata() || !is_loaded())
 		{
 			fp.clear();
 			return;
@@ -8396,6 +8881,11 @@ namespace libtorrent
 		// this should probably be moved to torrent::start()
 		TORRENT_ASSERT(shared_from_this());
 
+		// any change of state may need attention from second_tick()
+		// and may move this torrent in the auto-manage queues
+		wake_up();
+		m_ses.update_auto_manage_state(this);
+
 		// we can't call state_updated() while the session
 		// is building the status update alert
 		TORRENT_ASSERT(!m_ses.m_posting_torrent_updates);
@@ -8404,20 +8894,29 @@ namespace libtorrent
 		// it has already been updated this round, no need to
 		// add it to the list twice
 		if (!m_state_subscription) return;
-		if (m_in_state_updates)
+		for (int q = 0; q < aux::session_impl::num_state_queues; ++q)
 		{
-			TORRENT_ASSERT(m_ses.in_state_updates(shared_from_this()));
-			return;
-		}
+			if (m_in_state_updates & (1 << q))
+			{
+				TORRENT_ASSERT(m_ses.in_state_updates(shared_from_this(), q));
+				continue;
+			}
 
-		m_ses.add_to_update_queue(shared_from_this());
-		m_in_state_updates = true;
+			m_ses.add_to_update_queue(shared_from_this(), q);
+			m_in_state_updates |= 1 << q;
+		}
 	}
 
 	void torrent::status(torrent_status* st, boost::uint32_t flags)
 	{
 		INVARIANT_CHECK;
 
+		flush_dormant_time();
+
+		// the accurate counters need the file list to account for pad files
+		if ((flags & torrent_handle::query_accurate_download_counters) && m_padding > 0)
+			need_loaded();
+
 		ptime now = time_now();
 
 		st->handle = get_handle();
@@ -8535,6 +9034,12 @@ namespace libtorrent
 
 		st->queue_position = queue_position();
 		st->need_save_resume = need_save_resume_data();
+		st->is_loaded = m_torrent_file->is_loaded();
+		if (flags & torrent_handle::query_memory_usage)
+		{
+			st->metadata_memory = int(m_torrent_file->memory_usage());
+			st->peer_list_memory = int(m_policy.memory_usage());
+		}
 		st->ip_filter_applies = m_apply_ip_filter;
 
 		st->state = (torrent_status::state_t)m_state;
@@ -8573,7 +9078,7 @@ namespace libtorrent
 #endif
 		}
 
-		if (has_picker())
+		if ((flags & torrent_handle::query_pieces) && has_picker())
 		{
 			st->sparse_regions = m_picker->sparse_regions();
 			int num_pieces = m_picker->num_pieces();
@@ -8581,7 +9086,7 @@ namespace libtorrent
 			for (int i = 0; i < num_pieces; ++i)
 				if (m_picker->have_piece(i)) st->pieces.set_bit(i);
 		}
-		else if (is_seed())
+		else if ((flags & torrent_handle::query_pieces) && is_seed())
 		{
 			int num_pieces = m_torrent_file->num_pieces();
 			st->pieces.resize(num_pieces, true);
@@ -8609,6 +9114,123 @@ namespace libtorrent
 		st->last_seen_complete = m_swarm_last_seen_complete;
 	}
 
+	bool torrent::status_delta(torrent_delta* d, boost::uint64_t fields)
+	{
+		INVARIANT_CHECK;
+
+		typedef torrent_delta td;
+
+		flush_dormant_time();
+
+		fields &= td::field_bit(td::num_fields) - 1;
+
+		// these are the only fields that are expensive to compute.
+		// Don't compute them unless they were asked for
+		torrent_status st;
+		boost::uint64_t const bytes_done_fields = td::field_bit(td::progress_ppm)
+			| td::field_bit(td::total_done) | td::field_bit(td::total_wanted_done)
+			| td::field_bit(td::total_wanted);
+		if (fields & bytes_done_fields) bytes_done(st, false);
+
+		int full_copies = -1;
+		int fraction = -1;
+		if ((fields & (td::field_bit(td::distributed_full_copies)
+			| td::field_bit(td::distributed_fraction))) && m_picker.get())
+			boost::tie(full_copies, fraction) = m_picker->distributed_copies();
+
+		if (!m_last_delta)
+		{
+			m_last_delta.reset(new boost::int64_t[td::num_fields]);
+			m_delta_fields = 0;
+		}
+
+		d->handle = get_handle();
+		d->changed = 0;
+		d->values.clear();
+
+		for (int f = 0; f < td::num_fields; ++f)
+		{
+			boost::uint64_t bit = td::field_bit(f);
+			if ((fields & bit) == 0) continue;
+
+			boost::int64_t v = 0;
+			switch (f)
+			{
+				case td::state:
+					v = valid_metadata() ? int(m_state)
+						: int(torrent_status::downloading_metadata);
+					break;
+				case td::paused: v = is_torrent_paused(); break;
+				case td::auto_managed: v = m_auto_managed; break;
+				case td::is_seeding: v = is_seed(); break;
+				case td::is_finished: v = is_finished(); break;
+				case td::has_metadata: v = valid_metadata(); break;
+				case td::need_save_resume: v = need_save_resume_data(); break;
+				case td::queue_position: v = queue_position(); break;
+				case td::progress_ppm:
+					// this mirrors the progress calculation in status()
+					if (!valid_metadata() || m_state == torrent_status::checking_files)
+						v = m_progress_ppm;
+					else if (st.total_wanted == 0)
+						v = 1000000;
+					else
+						v = st.total_wanted_done * 1000000 / st.total_wanted;
+					break;
+				case td::download_rate: v = m_stat.download_rate(); break;
+				case td::upload_rate: v = m_stat.upload_rate(); break;
+				case td::download_payload_rate: v = m_stat.download_payload_rate(); break;
+				case td::upload_payload_rate: v = m_stat.upload_payload_rate(); break;
+				case td::total_download:
+					v = m_stat.total_payload_download() + m_stat.total_protocol_download();
+					break;
+				case td::total_upload:
+					v = m_stat.total_payload_upload() + m_stat.total_protocol_upload();
+					break;
+				case td::total_payload_download: v = m_stat.total_payload_download(); break;
+				case td::total_payload_upload: v = m_stat.total_payload_upload(); break;
+				case td::total_done: v = st.total_done; break;
+				case td::total_wanted_done: v = st.total_wanted_done; break;
+				case td::total_wanted: v = st.total_wanted; break;
+				case td::all_time_download: v = m_total_downloaded; break;
+				case td::all_time_upload: v = m_total_uploaded; break;
+				case td::total_failed_bytes: v = m_total_failed_bytes; break;
+				case td::total_redundant_bytes: v = m_total_redundant_bytes; break;
+				case td::num_peers: v = int(m_connections.size()) - m_num_connecting; break;
+				case td::num_seeds: v = valid_metadata() ? num_seeds() : 0; break;
+				case td::num_complete: v = (m_complete == 0xffffff) ? -1 : int(m_complete); break;
+				case td::num_incomplete: v = (m_incomplete == 0xffffff) ? -1 : int(m_incomplete); break;
+				case td::list_peers: v = m_policy.num_peers(); break;
+				case td::list_seeds: v = m_policy.num_seeds(); break;
+				case td::connect_candidates: v = m_policy.num_connect_candidates(); break;
+				case td::num_uploads: v = m_num_uploads; break;
+				case td::num_connections: v = int(m_connections.size()); break;
+				case td::num_pieces: v = valid_metadata() ? num_have() : 0; break;
+				case td::distributed_full_copies: v = full_copies; break;
+				case td::distributed_fraction: v = fraction; break;
+				case td::seed_rank: v = seed_rank(settings()); break;
+				case td::active_time: v = m_active_time; break;
+				case td::finished_time: v = m_finished_time; break;
+				case td::seeding_time: v = m_seeding_time; break;
+				case td::time_since_upload: v = m_last_upload; break;
+				case td::time_since_download: v = m_last_download; break;
+				case td::last_scrape: v = m_last_scrape; break;
+				case td::last_seen_complete: v = m_swarm_last_seen_complete; break;
+			}
+
+			if ((m_delta_fields & bit) && m_last_delta[f] == v) continue;
+
+			m_last_delta[f] = v;
+			d->changed |= bit;
+			d->values.push_back(v);
+		}
+
+		// fields that weren't asked for this time keep the value the
+		// client saw last, so they are still valid to compare against
+		m_delta_fields |= fields;
+
+		return d->changed != 0;
+	}
+
 	void torrent::add_redundant_bytes(int b, torrent::wasted_reason_t reason)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
@@ -8655,6 +9277,19 @@ namespace libtorrent
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
 		debug_log("*** tracker error: (%d) %s %s", ec.value(), ec.message().c_str(), msg.c_str());
 #endif
+		// the request was dropped by the tracker_manager before it was
+		// sent, because a stopped event to the same tracker overtook it.
+		// That's not a failure of the tracker
+		if (ec == asio::error::operation_aborted)
+		{
+			if (r.kind == tracker_request::announce_request)
+			{
+				announce_entry* ae = find_tracker(r);
+				if (ae) ae->updating = false;
+			}
+			return;
+		}
+
 		if (r.kind == tracker_request::announce_request)
 		{
 			announce_entry* ae = find_tracker(r);
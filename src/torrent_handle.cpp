@@ -142,10 +142,29 @@ namespace libtorrent
 		, ip_filter_applies(true)
 		, info_hash(0)
 		, listen_port(0)
+		, is_loaded(true)
+		, metadata_memory(0)
+		, peer_list_memory(0)
 	{}
 
 	torrent_status::~torrent_status() {}
 
+	boost::int64_t torrent_delta::value(int field) const
+	{
+		TORRENT_ASSERT(has(field));
+		// the values are stored in field order, so the index of
+		// this field is the number of fields before it in the mask
+		boost::uint64_t before = changed & (field_bit(field) - 1);
+		int idx = 0;
+		while (before)
+		{
+			before &= before - 1;
+			++idx;
+		}
+		TORRENT_ASSERT(idx < int(values.size()));
+		return values[idx];
+	}
+
 	template <class R>
 	void fun_ret(R* ret, bool* done, condition* e, mutex* m, boost::function<R(void)> f)
 	{
@@ -512,7 +531,7 @@ namespace libtorrent
 	void torrent_handle::file_progress(std::vector<size_type>& progress, int flags) const
 	{
 		INVARIANT_CHECK;
-		TORRENT_SYNC_CALL2(file_progress, boost::ref(progress), flags);
+		TORRENT_SYNC_CALL2(load_file_progress, boost::ref(progress), flags);
 	}
 
 	torrent_status torrent_handle::status(boost::uint32_t flags) const
@@ -609,7 +628,7 @@ namespace libtorrent
 	void torrent_handle::file_progress(std::vector<float>& progress) const
 	{
 		INVARIANT_CHECK;
-		TORRENT_SYNC_CALL1(file_progress, boost::ref(progress));
+		TORRENT_SYNC_CALL1(load_file_progress, boost::ref(progress));
 	}
 #endif
 
@@ -836,10 +855,25 @@ namespace libtorrent
 		return r;
 	}
 
+	void torrent_handle::pin_metadata() const
+	{
+		INVARIANT_CHECK;
+		TORRENT_SYNC_CALL(pin_torrent_file);
+	}
+
+	void torrent_handle::unpin_metadata() const
+	{
+		INVARIANT_CHECK;
+		TORRENT_ASYNC_CALL(unpin_torrent_file);
+	}
+
 #ifndef TORRENT_NO_DEPRECATE
 	// this function should either be removed, or return
 	// reference counted handle to the torrent_info which
-	// forces the torrent to stay loaded while the client holds it
+	// forces the torrent to stay loaded while the client holds it.
+	// Until then, the metadata is loaded, and won't be unloaded for
+	// another metadata_unload_timeout seconds. Clients that hold on
+	// to the reference longer than that have to use pin_metadata()
 	torrent_info const& torrent_handle::get_torrent_info() const
 	{
 		INVARIANT_CHECK;
@@ -853,6 +887,15 @@ namespace libtorrent
 #else
 			throw_invalid_handle();
 #endif
+		{
+			bool done = false;
+			bool r;
+			session_impl& ses = t->session();
+			mutex::scoped_lock l(ses.mut);
+			ses.m_io_service.post(boost::bind(&fun_ret<bool>, &r, &done, &ses.cond, &ses.mut
+				, boost::function<bool(void)>(boost::bind(&torrent::load_torrent_file, t))));
+			do { ses.cond.wait(l); } while(!done);
+		}
 		if (!t->valid_metadata())
 #ifdef BOOST_NO_EXCEPTIONS
 			return empty;
@@ -867,7 +910,11 @@ namespace libtorrent
 		INVARIANT_CHECK;
 
 		entry ret(entry::dictionary_t);
-		TORRENT_SYNC_CALL1(write_resume_data, boost::ref(ret));
+		TORRENT_SYNC_CALL_RET1(bool, ret, load_write_resume_data, boost::ref(ret));
+		// if the metadata couldn't be loaded, the torrent is in an
+		// error state and the resume data would be missing the file
+		// sizes and the peers
+		if (!r) return ret;
 		t = m_torrent.lock();
 		if (t)
 		{
@@ -514,6 +514,46 @@ namespace libtorrent
 		peer_info.web_seed = true;
 	}
 
+	int web_seed_entry::num_connections() const
+	{
+		int ret = peer_info.connection ? 1 : 0;
+		for (std::list<policy::peer>::const_iterator i = extra_peers.begin()
+			, end(extra_peers.end()); i != end; ++i)
+			if (i->connection) ++ret;
+		return ret;
+	}
+
+	bool web_seed_entry::banned() const
+	{
+		if (peer_info.banned) return true;
+		for (std::list<policy::peer>::const_iterator i = extra_peers.begin()
+			, end(extra_peers.end()); i != end; ++i)
+			if (i->banned) return true;
+		return false;
+	}
+
+	bool web_seed_entry::has_connection(peer_connection const* c) const
+	{
+		TORRENT_ASSERT(c);
+		if (peer_info.connection == c) return true;
+		for (std::list<policy::peer>::const_iterator i = extra_peers.begin()
+			, end(extra_peers.end()); i != end; ++i)
+			if (i->connection == c) return true;
+		return false;
+	}
+
+	policy::peer* web_seed_entry::free_slot(int limit)
+	{
+		if (num_connections() >= limit) return 0;
+		if (peer_info.connection == 0) return &peer_info;
+		for (std::list<policy::peer>::iterator i = extra_peers.begin()
+			, end(extra_peers.end()); i != end; ++i)
+			if (i->connection == 0) return &*i;
+		extra_peers.push_back(policy::peer(0, true, 0));
+		extra_peers.back().web_seed = true;
+		return &extra_peers.back();
+	}
+
 	torrent_info::torrent_info(torrent_info const& t, int flags)
 		: m_merkle_first_leaf(t.m_merkle_first_leaf)
 		, m_files(t.m_files)
@@ -570,8 +610,8 @@ namespace libtorrent
 		if (m_files.total_size() != f.total_size()) return;
 		copy_on_write();
 		m_files = f;
-		m_files.set_num_pieces(m_orig_files->num_pieces());
 		m_files.set_piece_length(m_orig_files->piece_length());
+		m_files.set_num_pieces(m_orig_files->num_pieces());
 	}
 
 #ifndef TORRENT_NO_DEPRECATE
@@ -837,6 +877,56 @@ namespace libtorrent
 
 #undef SWAP
 
+	void torrent_info::unload()
+	{
+		INVARIANT_CHECK;
+
+		TORRENT_ASSERT(!m_orig_files);
+		TORRENT_ASSERT(!is_merkle_torrent());
+
+		// the file names and hashes point into the info section,
+		// so the files have to go first. m_info_section_size is
+		// left as is, so that metadata_size() still reports the
+		// size of the metadata
+		m_files.unload();
+		m_info_dict.clear();
+		m_info_section.reset();
+		m_piece_hashes = 0;
+	}
+
+	bool torrent_info::load(char const* buffer, int size, error_code& ec)
+	{
+		TORRENT_ASSERT(!is_loaded());
+
+		lazy_entry e;
+		if (lazy_bdecode(buffer, buffer + size, e, ec) != 0) return false;
+
+		torrent_info tmp(m_info_hash);
+		if (!tmp.parse_info_section(e, ec, 0)) return false;
+		if (tmp.m_info_hash != m_info_hash)
+		{
+			ec = errors::mismatching_info_hash;
+			return false;
+		}
+
+		// m_files is swapped rather than replaced, since the storage
+		// holds a reference to it
+		m_files.swap(tmp.m_files);
+		m_info_section.swap(tmp.m_info_section);
+		m_info_section_size = tmp.m_info_section_size;
+		m_piece_hashes = tmp.m_piece_hashes;
+		return true;
+	}
+
+	size_type torrent_info::memory_usage() const
+	{
+		size_type ret = m_files.memory_usage();
+		if (m_orig_files) ret += m_orig_files->memory_usage();
+		if (m_info_section) ret += m_info_section_size;
+		ret += m_merkle_tree.capacity() * sizeof(sha1_hash);
+		return ret;
+	}
+
 	bool torrent_info::parse_info_section(lazy_entry const& info, error_code& ec, int flags)
 	{
 		if (info.type() != lazy_entry::dict_t)
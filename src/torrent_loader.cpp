@@ -0,0 +1,221 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include "libtorrent/pch.hpp"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#include "libtorrent/torrent_loader.hpp"
+#include "libtorrent/add_torrent_params.hpp"
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/magnet_uri.hpp"
+#include "libtorrent/lazy_entry.hpp"
+#include "libtorrent/file_pool.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/string_util.hpp"
+#include "libtorrent/io_service.hpp"
+
+namespace libtorrent
+{
+	loaded_torrent::loaded_torrent(add_torrent_params const& p)
+		: params(p)
+	{
+		if (p.resume_data) params.resume_data = new std::vector<char>(*p.resume_data);
+	}
+
+	loaded_torrent::~loaded_torrent()
+	{
+		delete params.resume_data;
+	}
+
+	torrent_loader::torrent_loader(io_service& ios, file_pool& fp
+		, handler_t const& h)
+		: m_ios(ios)
+		, m_pool(fp)
+		, m_handler(h)
+		, m_abort(false)
+	{}
+
+	torrent_loader::~torrent_loader()
+	{
+		abort();
+	}
+
+	void torrent_loader::queue(std::vector<boost::shared_ptr<loaded_torrent> > const& torrents
+		, int num_threads)
+	{
+		mutex::scoped_lock l(m_mutex);
+		if (m_abort) return;
+
+		m_queue.insert(m_queue.end(), torrents.begin(), torrents.end());
+		m_cond.signal_all(l);
+
+		while (int(m_threads.size()) < num_threads)
+		{
+			m_threads.push_back(boost::shared_ptr<thread>(
+				new thread(boost::bind(&torrent_loader::thread_fun, this))));
+		}
+	}
+
+	void torrent_loader::abort()
+	{
+		mutex::scoped_lock l(m_mutex);
+		m_abort = true;
+		m_cond.signal_all(l);
+		m_queue.clear();
+		l.unlock();
+
+		for (std::vector<boost::shared_ptr<thread> >::iterator i = m_threads.begin()
+			, end(m_threads.end()); i != end; ++i)
+			(*i)->join();
+		m_threads.clear();
+	}
+
+	int torrent_loader::num_queued() const
+	{
+		mutex::scoped_lock l(m_mutex);
+		return m_queue.size();
+	}
+
+	void torrent_loader::thread_fun()
+	{
+		for (;;)
+		{
+			mutex::scoped_lock l(m_mutex);
+			while (m_queue.empty() && !m_abort) m_cond.wait(l);
+			if (m_abort) return;
+			boost::shared_ptr<loaded_torrent> t = m_queue.front();
+			m_queue.pop_front();
+			l.unlock();
+
+			load(*t);
+			// if the io_service is stopped before this runs, the torrent
+			// is freed along with the handler
+			m_ios.post(boost::bind(m_handler, t));
+		}
+	}
+
+	void torrent_loader::load(loaded_torrent& t)
+	{
+		add_torrent_params& p = t.params;
+
+		// this mirrors the first part of session_impl::add_torrent_impl().
+		// Anything that's left undone here is done there instead
+#ifndef TORRENT_NO_DEPRECATE
+		p.update_flags();
+#endif
+
+		if (string_begins_no_case("magnet:", p.url.c_str()))
+		{
+			parse_magnet_uri(p.url, p, t.error);
+			if (t.error) return;
+			p.url.clear();
+		}
+
+		if (p.resume_data == 0 || p.resume_data->empty()) return;
+
+		// this is the decoding torrent::start() would otherwise do on the
+		// network thread. If the resume data is invalid, leave it for the
+		// torrent to reject, to have it post the fastresume_rejected_alert
+		bdecode_node& rd = t.resume;
+		error_code rd_ec;
+		int pos;
+		if (bdecode(&(*p.resume_data)[0], &(*p.resume_data)[0]
+			+ p.resume_data->size(), rd, rd_ec, &pos) != 0)
+		{
+			rd.clear();
+			return;
+		}
+		if (rd.type() != bdecode_node::dict_t) return;
+
+		// the metadata of magnet links is saved in the resume data.
+		// torrent_info only parses lazy_entry, so the info section is
+		// decoded again on its own
+		bdecode_node info;
+		if ((!p.ti || !p.ti->is_valid())
+			&& (info = rd.dict_find_dict("info")))
+		{
+			std::pair<char const*, int> buf = info.data_section();
+			sha1_hash resume_ih = hasher(buf.first, buf.second).final();
+
+			lazy_entry info_section;
+			error_code parse_ec;
+			if ((resume_ih == p.info_hash
+				|| !p.url.empty()
+				|| p.info_hash.is_all_zeros())
+				&& lazy_bdecode(buf.first, buf.first + buf.second
+					, info_section, parse_ec, &pos) == 0)
+			{
+				boost::intrusive_ptr<torrent_info> ti(new torrent_info(resume_ih));
+				if (ti->parse_info_section(info_section, parse_ec, 0))
+				{
+					p.ti = ti;
+					p.info_hash = resume_ih;
+				}
+			}
+		}
+
+		// the files are only checked against the resume data if it
+		// has file sizes, and not at all in seed mode
+		if (!p.ti || !p.ti->is_valid()
+			|| (p.flags & add_torrent_params::flag_seed_mode)
+			|| rd.dict_find_list("file sizes") == 0)
+			return;
+
+		// stat the files the same way match_filesizes() will, and leave
+		// the results in the stat cache for it. The paths are sorted to
+		// stat all files in a directory together
+		file_storage const& fs = p.ti->files();
+		std::string save_path = complete(p.save_path);
+		std::vector<std::string> paths;
+		paths.reserve(fs.num_files());
+		for (file_storage::iterator i = fs.begin(), end(fs.end()); i != end; ++i)
+		{
+			if (i->pad_file) continue;
+			paths.push_back(combine_path(save_path, fs.file_path(*i)));
+		}
+		std::sort(paths.begin(), paths.end());
+
+		for (std::vector<std::string>::iterator i = paths.begin()
+			, end(paths.end()); i != end; ++i)
+		{
+			file_status s;
+			error_code stat_ec;
+			stat_file(*i, &s, stat_ec);
+			m_pool.cache_file_status(*i, s, stat_ec);
+		}
+	}
+}
+
@@ -39,8 +39,11 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/tracker_manager.hpp"
 #include "libtorrent/http_tracker_connection.hpp"
+#include "libtorrent/http_connection.hpp"
 #include "libtorrent/udp_tracker_connection.hpp"
 #include "libtorrent/aux_/session_impl.hpp"
+#include "libtorrent/parse_url.hpp"
+#include "libtorrent/escape_string.hpp"
 
 using boost::tuples::make_tuple;
 using boost::tuples::tuple;
@@ -154,6 +157,7 @@ namespace libtorrent
 		, m_requester(r)
 		, m_man(man)
 		, m_req(req)
+		, m_failed(false)
 	{}
 
 	boost::shared_ptr<request_callback> tracker_connection::requester() const
@@ -164,6 +168,8 @@ namespace libtorrent
 	void tracker_connection::fail(error_code const& ec, int code
 		, char const* msg, int interval, int min_interval)
 	{
+		m_failed = true;
+		m_error = ec;
 		boost::shared_ptr<request_callback> cb = requester();
 		if (cb) cb->tracker_request_error(m_req, code, ec, msg
 			, interval == 0 ? min_interval : interval);
@@ -186,6 +192,31 @@ namespace libtorrent
 		m_man.remove_request(this);
 	}
 
+	namespace
+	{
+		// requests are grouped by protocol, hostname and port
+		std::string tracker_host_key(std::string const& url)
+		{
+			std::string protocol;
+			std::string hostname;
+			int port;
+			error_code ec;
+			using boost::tuples::ignore;
+			boost::tie(protocol, ignore, hostname, port, ignore)
+				= parse_url_components(url, ec);
+			if (ec) return url;
+			return protocol + "://" + hostname + ":" + to_string(port).elems;
+		}
+	}
+
+	tracker_manager::tracker_manager(aux::session_impl& ses, proxy_settings const& ps)
+		: m_ses(ses)
+		, m_proxy(ps)
+		, m_queue_timer(ses.m_io_service)
+		, m_queue_timer_active(false)
+		, m_abort(false)
+	{}
+
 	tracker_manager::~tracker_manager()
 	{
 		TORRENT_ASSERT(m_abort);
@@ -213,6 +244,29 @@ namespace libtorrent
 		if (i == m_connections.end()) return;
 
 		m_connections.erase(i);
+
+		host_map_t::iterator h = m_hosts.find(tracker_host_key(c->tracker_req().url));
+		if (h == m_hosts.end()) return;
+		TORRENT_ASSERT(h->second.in_flight > 0);
+		--h->second.in_flight;
+
+		// requests cancelled by the session shutting down don't count
+		if (m_abort) return;
+
+		++h->second.num_requests;
+		if (c->failed())
+		{
+			++h->second.num_failures;
+			// UDP trackers time out with errors::timed_out, HTTP
+			// trackers with asio::error::timed_out
+			if (c->error() == error_code(errors::timed_out)
+				|| c->error() == error_code(asio::error::timed_out))
+				++h->second.num_timeouts;
+		}
+		else
+		{
+			h->second.rtt.add_sample(total_milliseconds(time_now_hires() - c->start_time()));
+		}
 	}
 
 	void tracker_manager::queue_request(
@@ -233,6 +287,54 @@ namespace libtorrent
 		if (m_abort && req.event != tracker_request::stopped)
 			return;
 
+		queued_request r;
+		r.ios = &ios;
+		r.cc = &cc;
+		r.req = req;
+		r.auth = auth;
+		r.cb = c;
+
+		tracker_host& h = m_hosts[tracker_host_key(req.url)];
+
+		// stopped events are sent right away, they may be sent
+		// while the session is shutting down. Requests from the same
+		// torrent that are still waiting for the rate limit would be
+		// sent after the stopped event, so they're dropped
+		if (req.event == tracker_request::stopped)
+		{
+			boost::shared_ptr<request_callback> cb = c.lock();
+			if (cb) drop_queued_requests(h, cb);
+		}
+		else
+		{
+			// UDP scrapes are held back for up to a second, to be sent
+			// together with other scrapes to the same tracker
+			if (req.kind == tracker_request::scrape_request
+				&& req.url.substr(0, req.url.find(':')) == "udp")
+			{
+				h.scrapes.push_back(r);
+				arm_queue_timer();
+				return;
+			}
+
+			// requests that arrive while others are waiting are queued
+			// behind them, to preserve the order
+			if (!h.queue.empty() || !may_start(h))
+			{
+				h.queue.push_back(r);
+				arm_queue_timer();
+				return;
+			}
+		}
+
+		boost::intrusive_ptr<tracker_connection> con = add_connection(r, h);
+		if (con) con->start();
+	}
+
+	boost::intrusive_ptr<tracker_connection> tracker_manager::add_connection(
+		queued_request const& r, tracker_host& h)
+	{
+		tracker_request const& req = r.req;
 		std::string protocol = req.url.substr(0, req.url.find(':'));
 
 		boost::intrusive_ptr<tracker_connection> con;
@@ -243,35 +345,231 @@ namespace libtorrent
 		if (protocol == "http")
 #endif
 		{
-			con = new http_tracker_connection(
-				ios, cc, *this, req, c
-				, m_ses, m_proxy, auth
+			boost::intrusive_ptr<http_tracker_connection> hc = new http_tracker_connection(
+				*r.ios, *r.cc, *this, req, r.cb
+				, m_ses, m_proxy, r.auth
 #if TORRENT_USE_I2P
 				, &m_ses.m_i2p_conn
 #endif
 				);
+
+			// send the request on a kept-alive connection to this
+			// tracker, if there is one
+			if (hc->keep_alive())
+			{
+				hc->m_tracker_connection = take_idle_connection(h);
+				m_ses.inc_stats_counter(hc->m_tracker_connection
+					? counters::tracker_pool_hits : counters::tracker_pool_misses);
+			}
+			con = hc;
 		}
 		else if (protocol == "udp")
 		{
 			con = new udp_tracker_connection(
-				ios, cc, *this, req , c, m_ses
+				*r.ios, *r.cc, *this, req , r.cb, m_ses
 				, m_proxy);
 		}
 		else
 		{
 			// we need to post the error to avoid deadlock
-			if (boost::shared_ptr<request_callback> r = c.lock())
-				ios.post(boost::bind(&request_callback::tracker_request_error, r, req
+			if (boost::shared_ptr<request_callback> cb = r.cb.lock())
+				r.ios->post(boost::bind(&request_callback::tracker_request_error, cb, req
 					, -1, error_code(errors::unsupported_url_protocol)
 					, "", 0));
-			return;
+			return con;
 		}
 
 		m_connections.push_back(con);
+		++h.in_flight;
 
 		boost::shared_ptr<request_callback> cb = con->requester();
 		if (cb) cb->m_manager = this;
-		con->start();
+		return con;
+	}
+
+	void tracker_manager::drop_queued_requests(tracker_host& h
+		, boost::shared_ptr<request_callback> const& cb)
+	{
+		// the requester is told, so that it doesn't keep waiting for
+		// a response. The error is posted to avoid a deadlock
+		for (std::deque<queued_request>::iterator i = h.queue.begin();
+			i != h.queue.end();)
+		{
+			if (i->cb.lock() != cb) { ++i; continue; }
+			i->ios->post(boost::bind(&request_callback::tracker_request_error, cb
+				, i->req, -1, error_code(asio::error::operation_aborted), "", 0));
+			i = h.queue.erase(i);
+		}
+		for (std::vector<queued_request>::iterator i = h.scrapes.begin();
+			i != h.scrapes.end();)
+		{
+			if (i->cb.lock() != cb) { ++i; continue; }
+			i->ios->post(boost::bind(&request_callback::tracker_request_error, cb
+				, i->req, -1, error_code(asio::error::operation_aborted), "", 0));
+			i = h.scrapes.erase(i);
+		}
+	}
+
+	bool tracker_manager::may_start(tracker_host& h)
+	{
+		int limit = m_ses.settings().tracker_host_requests_per_second;
+		if (limit <= 0) return true;
+
+		ptime now = time_now();
+		if (now - h.window_start >= seconds(1))
+		{
+			h.window_start = now;
+			h.requests_left = limit;
+		}
+		if (h.requests_left <= 0) return false;
+		--h.requests_left;
+		return true;
+	}
+
+	boost::shared_ptr<http_connection> tracker_manager::take_idle_connection(
+		tracker_host& h)
+	{
+		ptime now = time_now();
+		time_duration timeout = seconds(m_ses.settings().tracker_keep_alive_timeout);
+		while (!h.idle.empty())
+		{
+			boost::shared_ptr<http_connection> c = h.idle.back().first;
+			ptime idle_since = h.idle.back().second;
+			h.idle.pop_back();
+			if (c->is_idle() && now - idle_since < timeout) return c;
+			c->close();
+		}
+		return boost::shared_ptr<http_connection>();
+	}
+
+	bool tracker_manager::expire_idle_connections(tracker_host& h)
+	{
+		ptime now = time_now();
+		time_duration timeout = seconds(m_ses.settings().tracker_keep_alive_timeout);
+
+		// the connections are ordered by the time they were returned
+		// to the pool, oldest first
+		int num_expired = 0;
+		while (num_expired < int(h.idle.size())
+			&& now - h.idle[num_expired].second >= timeout)
+		{
+			h.idle[num_expired].first->close();
+			++num_expired;
+		}
+		h.idle.erase(h.idle.begin(), h.idle.begin() + num_expired);
+		return !h.idle.empty();
+	}
+
+	void tracker_manager::return_idle_connection(std::string const& url
+		, boost::shared_ptr<http_connection> const& c)
+	{
+		mutex_t::scoped_lock l(m_mutex);
+
+		// the handlers still refer to the request that just completed
+		c->set_handler(http_handler());
+
+		host_map_t::iterator i = m_hosts.find(tracker_host_key(url));
+		if (i == m_hosts.end() || m_ses.settings().tracker_keep_alive_timeout <= 0)
+		{
+			c->close();
+			return;
+		}
+
+		// don't keep more connections than we've needed at once
+		// recently, up to a limit
+		std::vector<std::pair<boost::shared_ptr<http_connection>, ptime> >& idle
+			= i->second.idle;
+		if (int(idle.size()) >= max_idle_connections)
+		{
+			idle.front().first->close();
+			idle.erase(idle.begin());
+		}
+		idle.push_back(std::make_pair(c, time_now()));
+
+		// while shutting down, the idle connections are kept for the
+		// stopped events
+		if (!m_abort) arm_queue_timer();
+	}
+
+	void tracker_manager::send_scrapes(tracker_host& h)
+	{
+		while (!h.scrapes.empty() && may_start(h))
+		{
+			int num = (std::min)(int(h.scrapes.size())
+				, int(udp_tracker_connection::max_scrapes_per_packet));
+
+			// the first scrape is the request of the connection, the
+			// others are added to the same packet
+			boost::intrusive_ptr<tracker_connection> con
+				= add_connection(h.scrapes[0], h);
+			udp_tracker_connection* udp = static_cast<udp_tracker_connection*>(con.get());
+			for (int i = 1; i < num; ++i)
+			{
+				udp->add_scrape(h.scrapes[i].req, h.scrapes[i].cb);
+				boost::shared_ptr<request_callback> cb = h.scrapes[i].cb.lock();
+				if (cb) cb->m_manager = this;
+			}
+			h.scrapes.erase(h.scrapes.begin(), h.scrapes.begin() + num);
+			con->start();
+		}
+	}
+
+	void tracker_manager::arm_queue_timer()
+	{
+		if (m_queue_timer_active) return;
+		m_queue_timer_active = true;
+		error_code ec;
+		m_queue_timer.expires_from_now(seconds(1), ec);
+		m_queue_timer.async_wait(boost::bind(&tracker_manager::on_queue_timer, this, _1));
+	}
+
+	void tracker_manager::on_queue_timer(error_code const& e)
+	{
+		if (e == asio::error::operation_aborted) return;
+
+		mutex_t::scoped_lock l(m_mutex);
+		m_queue_timer_active = false;
+		if (m_abort) return;
+
+		bool pending = false;
+		for (host_map_t::iterator i = m_hosts.begin(), end(m_hosts.end());
+			i != end; ++i)
+		{
+			tracker_host& h = i->second;
+			while (!h.queue.empty() && may_start(h))
+			{
+				queued_request r = h.queue.front();
+				h.queue.pop_front();
+				boost::intrusive_ptr<tracker_connection> con = add_connection(r, h);
+				if (con) con->start();
+			}
+			send_scrapes(h);
+			if (!h.queue.empty() || !h.scrapes.empty()) pending = true;
+			if (expire_idle_connections(h)) pending = true;
+		}
+
+		if (pending) arm_queue_timer();
+	}
+
+	void tracker_manager::get_host_status(std::vector<tracker_host_status>* ret) const
+	{
+		mutex_t::scoped_lock l(m_mutex);
+		ret->reserve(ret->size() + m_hosts.size());
+		for (host_map_t::const_iterator i = m_hosts.begin(), end(m_hosts.end());
+			i != end; ++i)
+		{
+			tracker_host const& h = i->second;
+			tracker_host_status st;
+			st.host = i->first;
+			st.num_requests = h.num_requests;
+			st.num_failures = h.num_failures;
+			st.num_timeouts = h.num_timeouts;
+			st.rtt = h.rtt.mean();
+			st.in_flight = h.in_flight;
+			st.queued = h.queue.size();
+			st.queued_scrapes = h.scrapes.size();
+			ret->push_back(st);
+		}
 	}
 
 	bool tracker_manager::incoming_packet(error_code const& e
@@ -313,6 +611,25 @@ namespace libtorrent
 		m_abort = true;
 		tracker_connections_t close_connections;
 
+		// requests that haven't been sent yet are dropped
+		for (host_map_t::iterator i = m_hosts.begin(), end(m_hosts.end());
+			i != end; ++i)
+		{
+			i->second.queue.clear();
+			i->second.scrapes.clear();
+
+			// idle connections are kept for the stopped events, unless
+			// those are aborted too
+			if (!all) continue;
+			for (std::vector<std::pair<boost::shared_ptr<http_connection>, ptime> >::iterator
+				j = i->second.idle.begin(), end2(i->second.idle.end()); j != end2; ++j)
+				j->first->close();
+			i->second.idle.clear();
+		}
+		error_code ec;
+		m_queue_timer.cancel(ec);
+		m_queue_timer_active = false;
+
 		for (tracker_connections_t::iterator i = m_connections.begin()
 			, end(m_connections.end()); i != end; ++i)
 		{
@@ -144,6 +144,14 @@ namespace libtorrent
 		// if that was the last one, fail the whole announce
 		if (m_endpoints.empty())
 		{
+			for (std::vector<scrape_entry>::iterator j = m_scrapes.begin()
+				, end(m_scrapes.end()); j != end; ++j)
+			{
+				boost::shared_ptr<request_callback> cb = j->cb.lock();
+				if (cb) cb->tracker_request_error(j->req, code, ec, msg
+					, interval == 0 ? min_interval : interval);
+			}
+			m_scrapes.clear();
 			tracker_connection::fail(ec, code, msg, interval, min_interval);
 			return;
 		}
@@ -468,6 +476,17 @@ namespace libtorrent
 		}
 	}
 
+	void udp_tracker_connection::add_scrape(tracker_request const& req
+		, boost::weak_ptr<request_callback> c)
+	{
+		TORRENT_ASSERT(tracker_req().kind == tracker_request::scrape_request);
+		TORRENT_ASSERT(int(m_scrapes.size()) + 1 < max_scrapes_per_packet);
+		scrape_entry e;
+		e.req = req;
+		e.cb = c;
+		m_scrapes.push_back(e);
+	}
+
 	void udp_tracker_connection::send_udp_scrape()
 	{
 		if (m_transaction_id == 0)
@@ -481,7 +500,7 @@ namespace libtorrent
 		TORRENT_ASSERT(i != m_connection_cache.end());
 		if (i == m_connection_cache.end()) return;
 
-		char buf[8 + 4 + 4 + 20];
+		char buf[8 + 4 + 4 + 20 * max_scrapes_per_packet];
 		char* out = buf;
 
 		detail::write_int64(i->second.connection_id, out); // connection_id
@@ -490,19 +509,26 @@ namespace libtorrent
 		// info_hash
 		std::copy(tracker_req().info_hash.begin(), tracker_req().info_hash.end(), out);
 		out += 20;
-		TORRENT_ASSERT(out - buf == sizeof(buf));
+		for (std::vector<scrape_entry>::const_iterator j = m_scrapes.begin()
+			, end(m_scrapes.end()); j != end; ++j)
+		{
+			std::copy(j->req.info_hash.begin(), j->req.info_hash.end(), out);
+			out += 20;
+		}
+		int len = out - buf;
+		TORRENT_ASSERT(len <= int(sizeof(buf)));
 
 		error_code ec;
 		if (!m_hostname.empty())
 		{
-			m_ses.m_udp_socket.send_hostname(m_hostname.c_str(), m_target.port(), buf, sizeof(buf), ec);
+			m_ses.m_udp_socket.send_hostname(m_hostname.c_str(), m_target.port(), buf, len, ec);
 		}
 		else
 		{
-			m_ses.m_udp_socket.send(m_target, buf, sizeof(buf), ec);
+			m_ses.m_udp_socket.send(m_target, buf, len, ec);
 		}
 		m_state = action_scrape;
-		sent_bytes(sizeof(buf) + 28); // assuming UDP/IP header
+		sent_bytes(len + 28); // assuming UDP/IP header
 		++m_attempts;
 		if (ec)
 		{
@@ -610,6 +636,29 @@ namespace libtorrent
 		int downloaded = detail::read_int32(buf);
 		int incomplete = detail::read_int32(buf);
 
+		// the responses for the additional info-hashes follow in the
+		// same order they were sent. A tracker that doesn't support
+		// scraping more than one torrent at a time may leave them out
+		size -= 20;
+		for (std::vector<scrape_entry>::iterator j = m_scrapes.begin()
+			, end(m_scrapes.end()); j != end; ++j)
+		{
+			boost::shared_ptr<request_callback> c = j->cb.lock();
+			if (size < 12)
+			{
+				if (c) c->tracker_request_error(j->req, -1
+					, error_code(errors::invalid_tracker_response_length), "", 0);
+				continue;
+			}
+			int c_complete = detail::read_int32(buf);
+			int c_downloaded = detail::read_int32(buf);
+			int c_incomplete = detail::read_int32(buf);
+			size -= 12;
+			if (c) c->tracker_scrape_response(j->req
+				, c_complete, c_incomplete, c_downloaded, -1);
+		}
+		m_scrapes.clear();
+
 		boost::shared_ptr<request_callback> cb = requester();
 		if (!cb)
 		{
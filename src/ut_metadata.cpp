@@ -53,6 +53,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/bt_peer_connection.hpp"
 #include "libtorrent/hasher.hpp"
 #include "libtorrent/bencode.hpp"
+#include "libtorrent/bencode_writer.hpp"
+#include "libtorrent/bdecode.hpp"
 #include "libtorrent/torrent.hpp"
 #include "libtorrent/extensions.hpp"
 #include "libtorrent/extensions/ut_metadata.hpp"
@@ -107,6 +109,15 @@ namespace libtorrent { namespace
 				metadata();
 		}
 
+		virtual void on_unload()
+		{
+			// our copy shares the buffer with the torrent_info. Let
+			// go of it so that it's actually freed. metadata() picks
+			// it up again once the torrent is loaded
+			TORRENT_ASSERT(m_torrent.valid_metadata());
+			m_metadata.reset();
+		}
+
 		virtual boost::shared_ptr<peer_plugin> new_connection(
 			peer_connection* pc);
 		
@@ -244,10 +255,6 @@ namespace libtorrent { namespace
 			// abort if the peer doesn't support the metadata extension
 			if (m_message_index == 0) return;
 
-			entry e;
-			e["msg_type"] = type;
-			e["piece"] = piece;
-
 			char const* metadata = 0;
 			int metadata_piece_size = 0;
 
@@ -265,7 +272,6 @@ namespace libtorrent { namespace
 				}
 
 				TORRENT_ASSERT(m_pc.associated_torrent().lock()->valid_metadata());
-				e["total_size"] = m_tp.metadata().left();
 				int offset = piece * 16 * 1024;
 				metadata = m_tp.metadata().begin + offset;
 				metadata_piece_size = (std::min)(
@@ -275,18 +281,16 @@ namespace libtorrent { namespace
 				TORRENT_ASSERT(offset + metadata_piece_size <= int(m_tp.metadata().left()));
 			}
 
-			char msg[200];
-			char* header = msg;
-			char* p = &msg[6];
-			int len = bencode(p, e);
-			int total_size = 2 + len + metadata_piece_size;
-			namespace io = detail;
-			io::write_uint32(total_size, header);
-			io::write_uint8(bt_peer_connection::msg_extended, header);
-			io::write_uint8(m_message_index, header);
-
-			m_pc.send_buffer(msg, len + 6);
-			if (metadata_piece_size) m_pc.append_const_send_buffer(
+			bt_peer_connection::extended_message msg(m_pc, m_message_index);
+			{
+				bencode_dict<bt_peer_connection::extended_message> e(msg);
+				e.integer("msg_type", type);
+				e.integer("piece", piece);
+				if (type == 1) e.integer("total_size", m_tp.metadata().left());
+			}
+			// the metadata itself is not copied, it's appended
+			// to the message as a separate buffer
+			if (metadata_piece_size) msg.append_const_buffer(
 				metadata, metadata_piece_size);
 		}
 
@@ -307,9 +311,13 @@ namespace libtorrent { namespace
 
 			if (!m_pc.packet_finished()) return true;
 
-			int len;
-			entry msg = bdecode(body.begin, body.end, len);
-			if (msg.type() == entry::undefined_t)
+			// the dictionary is followed by the raw metadata piece. bdecode()
+			// stops at the end of the dictionary, and its data section tells
+			// us where the piece starts
+			bdecode_node msg;
+			error_code ec;
+			int ret = bdecode(body.begin, body.end, msg, ec);
+			if (ret != 0 || msg.type() != bdecode_node::dict_t)
 			{
 #ifdef TORRENT_VERBOSE_LOGGING
 				m_pc.peer_log("<== UT_METADATA [ not a dictionary ]");
@@ -318,10 +326,9 @@ namespace libtorrent { namespace
 				return true;
 			}
 
-			entry const* type_ent = msg.find_key("msg_type");
-			entry const* piece_ent = msg.find_key("piece");
-			if (type_ent == 0 || type_ent->type() != entry::int_t
-				|| piece_ent == 0 || piece_ent->type() != entry::int_t)
+			bdecode_node type_ent = msg.dict_find_int("msg_type");
+			bdecode_node piece_ent = msg.dict_find_int("piece");
+			if (!type_ent || !piece_ent)
 			{
 #ifdef TORRENT_VERBOSE_LOGGING
 				m_pc.peer_log("<== UT_METADATA [ missing or invalid keys ]");
@@ -329,8 +336,8 @@ namespace libtorrent { namespace
 				m_pc.disconnect(errors::invalid_metadata_message, 2);
 				return true;
 			}
-			int type = type_ent->integer();
-			int piece = piece_ent->integer();
+			int type = type_ent.int_value();
+			int piece = piece_ent.int_value();
 
 #ifdef TORRENT_VERBOSE_LOGGING
 			m_pc.peer_log("<== UT_METADATA [ type: %d | piece: %d ]", type, piece);
@@ -368,9 +375,9 @@ namespace libtorrent { namespace
 					}
 
 					m_sent_requests.erase(i);
-					entry const* total_size = msg.find_key("total_size");
+					int len = msg.data_section().second;
 					m_tp.received_metadata(*this, body.begin + len, body.left() - len, piece
-						, (total_size && total_size->type() == entry::int_t) ? total_size->integer() : 0);
+						, msg.dict_find_int_value("total_size", 0));
 					maybe_send_request();
 				}
 				break;
@@ -47,6 +47,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/peer_connection.hpp"
 #include "libtorrent/bt_peer_connection.hpp"
 #include "libtorrent/bencode.hpp"
+#include "libtorrent/bencode_writer.hpp"
 #include "libtorrent/torrent.hpp"
 #include "libtorrent/extensions.hpp"
 #include "libtorrent/broadcast_socket.hpp"
@@ -56,6 +57,8 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/extensions/ut_pex.hpp"
 
+#include "libtorrent/bdecode.hpp"
+
 #ifdef TORRENT_VERBOSE_LOGGING
 #include "libtorrent/lazy_entry.hpp"
 #endif
@@ -110,17 +113,16 @@ namespace libtorrent { namespace
 
 			m_1_minute = 0;
 
-			entry pex;
-			std::string& pla = pex["added"].string();
-			std::string& pld = pex["dropped"].string();
-			std::string& plf = pex["added.f"].string();
+			std::string pla;
+			std::string pld;
+			std::string plf;
 			std::back_insert_iterator<std::string> pla_out(pla);
 			std::back_insert_iterator<std::string> pld_out(pld);
 			std::back_insert_iterator<std::string> plf_out(plf);
 #if TORRENT_USE_IPV6
-			std::string& pla6 = pex["added6"].string();
-			std::string& pld6 = pex["dropped6"].string();
-			std::string& plf6 = pex["added6.f"].string();
+			std::string pla6;
+			std::string pld6;
+			std::string plf6;
 			std::back_insert_iterator<std::string> pla6_out(pla6);
 			std::back_insert_iterator<std::string> pld6_out(pld6);
 			std::back_insert_iterator<std::string> plf6_out(plf6);
@@ -213,7 +215,18 @@ namespace libtorrent { namespace
 			}
 
 			m_ut_pex_msg.clear();
-			bencode(std::back_inserter(m_ut_pex_msg), pex);
+			vector_sink out(m_ut_pex_msg);
+			bencode_dict<vector_sink> pex(out);
+			pex.string("added", pla);
+			pex.string("added.f", plf);
+#if TORRENT_USE_IPV6
+			pex.string("added6", pla6);
+			pex.string("added6.f", plf6);
+#endif
+			pex.string("dropped", pld);
+#if TORRENT_USE_IPV6
+			pex.string("dropped6", pld6);
+#endif
 		}
 
 	private:
@@ -228,7 +241,7 @@ namespace libtorrent { namespace
 
 	struct ut_pex_peer_plugin : peer_plugin
 	{	
-		ut_pex_peer_plugin(torrent& t, peer_connection& pc, ut_pex_plugin& tp)
+		ut_pex_peer_plugin(torrent& t, bt_peer_connection& pc, ut_pex_plugin& tp)
 			: m_torrent(t)
 			, m_pc(pc)
 			, m_tp(tp)
@@ -291,26 +304,26 @@ namespace libtorrent { namespace
 				m_last_pex[i] = m_last_pex[i+1];
 			m_last_pex[num_pex_timers-1] = now;
 
-			lazy_entry pex_msg;
+			bdecode_node pex_msg;
 			error_code ec;
-			int ret = lazy_bdecode(body.begin, body.end, pex_msg, ec);
-			if (ret != 0 || pex_msg.type() != lazy_entry::dict_t)
+			int ret = bdecode(body.begin, body.end, pex_msg, ec);
+			if (ret != 0 || pex_msg.type() != bdecode_node::dict_t)
 			{
 				m_pc.disconnect(errors::invalid_pex_message, 2);
 				return true;
 			}
 
-			lazy_entry const* p = pex_msg.dict_find_string("dropped");
+			bdecode_node p = pex_msg.dict_find_string("dropped");
 
 #ifdef TORRENT_VERBOSE_LOGGING
 			int num_dropped = 0;
 			int num_added = 0;
-			if (p) num_dropped += p->string_length()/6;
+			if (p) num_dropped += p.string_length()/6;
 #endif
 			if (p)
 			{
-				int num_peers = p->string_length() / 6;
-				char const* in = p->string_ptr();
+				int num_peers = p.string_length() / 6;
+				char const* in = p.string_ptr();
 
 				for (int i = 0; i < num_peers; ++i)
 				{
@@ -322,18 +335,18 @@ namespace libtorrent { namespace
 			}
 
 			p = pex_msg.dict_find_string("added");
-			lazy_entry const* pf = pex_msg.dict_find_string("added.f");
+			bdecode_node pf = pex_msg.dict_find_string("added.f");
 
 #ifdef TORRENT_VERBOSE_LOGGING
-			if (p) num_added += p->string_length() / 6;
+			if (p) num_added += p.string_length() / 6;
 #endif
-			if (p != 0
-				&& pf != 0
-				&& pf->string_length() == p->string_length() / 6)
+			if (p
+				&& pf
+				&& pf.string_length() == p.string_length() / 6)
 			{
-				int num_peers = pf->string_length();
-				char const* in = p->string_ptr();
-				char const* fin = pf->string_ptr();
+				int num_peers = pf.string_length();
+				char const* in = p.string_ptr();
+				char const* fin = pf.string_ptr();
 
 				peer_id pid(0);
 				policy& p = m_torrent.get_policy();
@@ -358,14 +371,14 @@ namespace libtorrent { namespace
 
 #if TORRENT_USE_IPV6
 
-			lazy_entry const* p6 = pex_msg.dict_find("dropped6");
+			bdecode_node p6 = pex_msg.dict_find("dropped6");
 #ifdef TORRENT_VERBOSE_LOGGING
-			if (p6) num_dropped += p6->string_length() / 18;
+			if (p6) num_dropped += p6.string_length() / 18;
 #endif
-			if (p6 != 0 && p6->type() == lazy_entry::string_t)
+			if (p6 && p6.type() == bdecode_node::string_t)
 			{
-				int num_peers = p6->string_length() / 18;
-				char const* in = p6->string_ptr();
+				int num_peers = p6.string_length() / 18;
+				char const* in = p6.string_ptr();
 
 				for (int i = 0; i < num_peers; ++i)
 				{
@@ -378,18 +391,18 @@ namespace libtorrent { namespace
 
 			p6 = pex_msg.dict_find("added6");
 #ifdef TORRENT_VERBOSE_LOGGING
-			if (p6) num_added += p6->string_length() / 18;
+			if (p6) num_added += p6.string_length() / 18;
 #endif
-			lazy_entry const* p6f = pex_msg.dict_find("added6.f");
-			if (p6 != 0
-				&& p6f != 0
-				&& p6->type() == lazy_entry::string_t
-				&& p6f->type() == lazy_entry::string_t
-				&& p6f->string_length() == p6->string_length() / 18)
+			bdecode_node p6f = pex_msg.dict_find("added6.f");
+			if (p6
+				&& p6f
+				&& p6.type() == bdecode_node::string_t
+				&& p6f.type() == bdecode_node::string_t
+				&& p6f.string_length() == p6.string_length() / 18)
 			{
-				int num_peers = p6f->string_length();
-				char const* in = p6->string_ptr();
-				char const* fin = p6f->string_ptr();
+				int num_peers = p6f.string_length();
+				char const* in = p6.string_ptr();
+				char const* fin = p6f.string_ptr();
 
 				peer_id pid(0);
 				policy& p = m_torrent.get_policy();
@@ -443,31 +456,28 @@ namespace libtorrent { namespace
 
 			std::vector<char> const& pex_msg = m_tp.get_ut_pex_msg();
 
-			char msg[6];
-			char* ptr = msg;
-
-			detail::write_uint32(1 + 1 + pex_msg.size(), ptr);
-			detail::write_uint8(bt_peer_connection::msg_extended, ptr);
-			detail::write_uint8(m_message_index, ptr);
-			m_pc.send_buffer(msg, sizeof(msg));
-			m_pc.send_buffer(&pex_msg[0], pex_msg.size());
+			// the diff is the same for all peers, it's bencoded once
+			// by the torrent plugin
+			bt_peer_connection::extended_message msg(m_pc, m_message_index);
+			msg.write(&pex_msg[0], pex_msg.size());
+			msg.finish();
 
 #ifdef TORRENT_VERBOSE_LOGGING
-			lazy_entry m;
+			bdecode_node m;
 			error_code ec;
-			int ret = lazy_bdecode(&pex_msg[0], &pex_msg[0] + pex_msg.size(), m, ec);
+			int ret = bdecode(&pex_msg[0], &pex_msg[0] + pex_msg.size(), m, ec);
 			TORRENT_ASSERT(ret == 0);
 			TORRENT_ASSERT(!ec);
 			int num_dropped = 0;
 			int num_added = 0;
-			lazy_entry const* e = m.dict_find_string("added");
-			if (e) num_added += e->string_length() / 6;
+			bdecode_node e = m.dict_find_string("added");
+			if (e) num_added += e.string_length() / 6;
 			e = m.dict_find_string("dropped");
-			if (e) num_dropped += e->string_length() / 6;
+			if (e) num_dropped += e.string_length() / 6;
 			e = m.dict_find_string("added6");
-			if (e) num_added += e->string_length() / 18;
+			if (e) num_added += e.string_length() / 18;
 			e = m.dict_find_string("dropped6");
-			if (e) num_dropped += e->string_length() / 18;
+			if (e) num_dropped += e.string_length() / 18;
 			m_pc.peer_log("==> PEX_DIFF [ dropped: %d added: %d msg_size: %d ]"
 				, num_dropped, num_added, int(pex_msg.size()));
 #endif
@@ -475,20 +485,18 @@ namespace libtorrent { namespace
 
 		void send_ut_peer_list()
 		{
-			entry pex;
-			// leave the dropped string empty
-			pex["dropped"].string();
-			std::string& pla = pex["added"].string();
-			std::string& plf = pex["added.f"].string();
-			std::back_insert_iterator<std::string> pla_out(pla);
-			std::back_insert_iterator<std::string> plf_out(plf);
+			// the peer lists are collected on the stack, and then bencoded
+			// straight into the send buffer
+			char pla[max_peer_entries * 6];
+			char plf[max_peer_entries];
+			char* pla_out = pla;
+			char* plf_out = plf;
 
 #if TORRENT_USE_IPV6
-			pex["dropped6"].string();
-			std::string& pla6 = pex["added6"].string();
-			std::string& plf6 = pex["added6.f"].string();
-			std::back_insert_iterator<std::string> pla6_out(pla6);
-			std::back_insert_iterator<std::string> plf6_out(plf6);
+			char pla6[max_peer_entries * 18];
+			char plf6[max_peer_entries];
+			char* pla6_out = pla6;
+			char* plf6_out = plf6;
 #endif
 
 			int num_added = 0;
@@ -545,25 +553,31 @@ namespace libtorrent { namespace
 #endif
 				++num_added;
 			}
-			std::vector<char> pex_msg;
-			bencode(std::back_inserter(pex_msg), pex);
-
-			char msg[6];
-			char* ptr = msg;
 
-			detail::write_uint32(1 + 1 + pex_msg.size(), ptr);
-			detail::write_uint8(bt_peer_connection::msg_extended, ptr);
-			detail::write_uint8(m_message_index, ptr);
-			m_pc.send_buffer(msg, sizeof(msg));
-			m_pc.send_buffer(&pex_msg[0], pex_msg.size());
+			bt_peer_connection::extended_message msg(m_pc, m_message_index);
+			{
+				bencode_dict<bt_peer_connection::extended_message> pex(msg);
+				pex.string("added", pla, pla_out - pla);
+				pex.string("added.f", plf, plf_out - plf);
+#if TORRENT_USE_IPV6
+				pex.string("added6", pla6, pla6_out - pla6);
+				pex.string("added6.f", plf6, plf6_out - plf6);
+#endif
+				// leave the dropped strings empty
+				pex.string("dropped", "", 0);
+#if TORRENT_USE_IPV6
+				pex.string("dropped6", "", 0);
+#endif
+			}
 
 #ifdef TORRENT_VERBOSE_LOGGING
-			m_pc.peer_log("==> PEX_FULL [ added: %d msg_size: %d ]", num_added, int(pex_msg.size()));
+			m_pc.peer_log("==> PEX_FULL [ added: %d msg_size: %d ]", num_added, msg.size());
 #endif
+			msg.finish();
 		}
 
 		torrent& m_torrent;
-		peer_connection& m_pc;
+		bt_peer_connection& m_pc;
 		ut_pex_plugin& m_tp;
 		// stores all peers this this peer is connected to. These lists
 		// are updated with each pex message and are limited in size
@@ -604,7 +618,7 @@ namespace libtorrent { namespace
 			return boost::shared_ptr<peer_plugin>();
 
 		return boost::shared_ptr<peer_plugin>(new ut_pex_peer_plugin(m_torrent
-			, *pc, *this));
+			, *static_cast<bt_peer_connection*>(pc), *this));
 	}
 } }
 
@@ -71,6 +71,8 @@ namespace libtorrent
 		, web_seed_entry::headers_t const& extra_headers)
 		: web_connection_base(ses, t, s, remote, url, peerinfo, auth, extra_headers)
 		, m_url(url)
+		, m_piece(ses, 0)
+		, m_piece_size(0)
 		, m_received_body(0)
 		, m_range_pos(0)
 		, m_block_pos(0)
@@ -85,16 +87,31 @@ namespace libtorrent
 		shared_ptr<torrent> tor = t.lock();
 		TORRENT_ASSERT(tor);
 
-		// we always prefer downloading 1 MiB chunks
-		// from web seeds, or whole pieces if pieces
-		// are larger than a MiB
-		prefer_whole_pieces((std::max)((1024 * 1024) / tor->torrent_file().piece_length(), 1));
+		const int block_size = tor->block_size();
+		const int max_request = (std::max)(ses.settings().urlseed_max_request_bytes
+			, block_size);
+
+		// we always prefer downloading urlseed_max_request_bytes
+		// chunks from web seeds, or whole pieces if pieces are
+		// larger than that
+		prefer_whole_pieces((std::max)(max_request / tor->torrent_file().piece_length(), 1));
 		
 		// we want large blocks as well, so
 		// we can request more bytes at once
 		// this setting will merge adjacent requests
-		// into single larger ones
+		// into single larger ones, up to max_request bytes
 		request_large_blocks(true);
+		max_large_request(max_request);
+
+		// keep up to urlseed_pipeline_size range requests
+		// outstanding, and at least one full request even
+		// before we know the download rate. The desired queue
+		// size is 16 bits, so neither may exceed 65535 blocks
+		const int blocks_per_request = (std::min)(max_request / block_size, 0xffff);
+		m_max_out_request_queue = int((std::min)(size_type(0xffff)
+			, size_type((std::max)(ses.settings().urlseed_pipeline_size, 1))
+			* blocks_per_request));
+		min_desired_queue_size(blocks_per_request);
 
 #ifdef TORRENT_VERBOSE_LOGGING
 		peer_log("*** web_peer_connection %s", url.c_str());
@@ -289,8 +306,8 @@ namespace libtorrent
 	{
 		peer_request const& front_request = m_requests.front();
 
-		if (int(m_piece.size()) < front_request.length) return false;
-		TORRENT_ASSERT(int(m_piece.size() == front_request.length));
+		if (m_piece_size < front_request.length) return false;
+		TORRENT_ASSERT(m_piece_size == front_request.length);
 
 		// each call to incoming_piece() may result in us becoming
 		// a seed. If we become a seed, all seeds we're connected to
@@ -301,7 +318,9 @@ namespace libtorrent
 		TORRENT_ASSERT(t);
 		buffer::const_interval recv_buffer = receive_buffer();
 
-		incoming_piece(front_request, &m_piece[0]);
+		incoming_piece(front_request, m_piece);
+		m_piece.reset();
+		m_piece_size = 0;
 		m_requests.pop_front();
 		if (associated_torrent().expired()) return false;
 		TORRENT_ASSERT(m_block_pos >= front_request.length);
@@ -310,8 +329,25 @@ namespace libtorrent
 		m_body_start = 0;
 		recv_buffer = receive_buffer();
 //		TORRENT_ASSERT(m_received_body <= range_end - range_start);
-		m_piece.clear();
-		TORRENT_ASSERT(m_piece.empty());
+		return true;
+	}
+
+	bool web_peer_connection::append_piece(char const* buf, int size)
+	{
+		TORRENT_ASSERT(size >= 0);
+		if (!m_piece)
+		{
+			TORRENT_ASSERT(m_piece_size == 0);
+			m_piece.reset(m_ses.allocate_disk_buffer("receive buffer"));
+			if (!m_piece)
+			{
+				disconnect(errors::no_memory);
+				return false;
+			}
+		}
+		if (buf) std::memcpy(m_piece.get() + m_piece_size, buf, size);
+		else std::memset(m_piece.get() + m_piece_size, 0, size);
+		m_piece_size += size;
 		return true;
 	}
 
@@ -732,7 +768,7 @@ namespace libtorrent
 			// 3. the start of a block
 			// in that order, these parts are parsed.
 
-			bool range_overlaps_request = re > fs + int(m_piece.size());
+			bool range_overlaps_request = re > fs + m_piece_size;
 
 			if (!range_overlaps_request)
 			{
@@ -740,7 +776,7 @@ namespace libtorrent
 					, front_request.length - m_block_pos));
 				m_statistics.received_bytes(0, bytes_transferred);
 				// this means the end of the incoming request ends _before_ the
-				// first expected byte (fs + m_piece.size())
+				// first expected byte (fs + m_piece_size)
 				disconnect(errors::invalid_range, 2);
 				return;
 			}
@@ -757,16 +793,18 @@ namespace libtorrent
 				// (if it completed) call incoming_piece() with
 				// m_piece as buffer.
 				
-				int piece_size = int(m_piece.size());
-				int copy_size = (std::min)((std::min)(front_request.length - piece_size
+				int copy_size = (std::min)((std::min)(front_request.length - m_piece_size
 					, recv_buffer.left()), int(range_end - range_start - m_received_body));
 				if (copy_size > m_chunk_pos && m_chunk_pos > 0) copy_size = m_chunk_pos;
 				if (copy_size > 0)
 				{
-					TORRENT_ASSERT(m_piece.size() == m_received_in_piece);
-					m_piece.resize(piece_size + copy_size);
-					std::memcpy(&m_piece[0] + piece_size, recv_buffer.begin, copy_size);
-					TORRENT_ASSERT(int(m_piece.size()) <= front_request.length);
+					TORRENT_ASSERT(m_piece_size == m_received_in_piece);
+					if (!append_piece(recv_buffer.begin, copy_size))
+					{
+						m_statistics.received_bytes(0, bytes_transferred);
+						return;
+					}
+					TORRENT_ASSERT(m_piece_size <= front_request.length);
 					recv_buffer.begin += copy_size;
 					m_received_body += copy_size;
 					m_body_start += copy_size;
@@ -776,9 +814,9 @@ namespace libtorrent
 						m_chunk_pos -= copy_size;
 					}
 					TORRENT_ASSERT(m_received_body <= range_end - range_start);
-					TORRENT_ASSERT(int(m_piece.size()) <= front_request.length);
+					TORRENT_ASSERT(m_piece_size <= front_request.length);
 					incoming_piece_fragment(copy_size);
-					TORRENT_ASSERT(m_piece.size() == m_received_in_piece);
+					TORRENT_ASSERT(m_piece_size == m_received_in_piece);
 				}
 
 				if (maybe_harvest_block())
@@ -818,20 +856,22 @@ namespace libtorrent
 				if (in_range.start + in_range.length < m_requests.front().start + m_requests.front().length
 					&& (m_received_body + recv_buffer.left() >= range_end - range_start))
 				{
-					int piece_size = int(m_piece.size());
-					int copy_size = (std::min)((std::min)(m_requests.front().length - piece_size
+					int copy_size = (std::min)((std::min)(m_requests.front().length - m_piece_size
 						, recv_buffer.left()), int(range_end - range_start - m_received_body));
 					TORRENT_ASSERT(copy_size >= 0);
 					if (copy_size > 0)
 					{
-						TORRENT_ASSERT(m_piece.size() == m_received_in_piece);
-						m_piece.resize(piece_size + copy_size);
-						std::memcpy(&m_piece[0] + piece_size, recv_buffer.begin, copy_size);
+						TORRENT_ASSERT(m_piece_size == m_received_in_piece);
+						if (!append_piece(recv_buffer.begin, copy_size))
+						{
+							m_statistics.received_bytes(0, bytes_transferred);
+							return;
+						}
 						recv_buffer.begin += copy_size;
 						m_received_body += copy_size;
 						m_body_start += copy_size;
 						incoming_piece_fragment(copy_size);
-						TORRENT_ASSERT(m_piece.size() == m_received_in_piece);
+						TORRENT_ASSERT(m_piece_size == m_received_in_piece);
 					}
 					TORRENT_ASSERT(m_received_body == range_end - range_start);
 				}
@@ -879,7 +919,7 @@ namespace libtorrent
 					int pad_size = (std::min)(file_size, size_type(front_request.length - m_block_pos));
 
 					// insert zeroes to represent the pad file
-					m_piece.resize(m_piece.size() + pad_size, 0);
+					if (!append_piece(0, pad_size)) return;
 					m_block_pos += pad_size;
 					incoming_piece_fragment(pad_size);
 
@@ -32,6 +32,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <fstream>
 #include <deque>
+#include <cstring> // for memcpy
 
 #include "libtorrent/session.hpp"
 #include "libtorrent/hasher.hpp"
@@ -457,6 +458,17 @@ int start_tracker()
 
 int g_udp_tracker_requests = 0;
 int g_http_tracker_requests = 0;
+int g_udp_tracker_scrapes = 0;
+int g_udp_tracker_scrape_responses = -1;
+
+libtorrent::mutex udp_tracker_events_lock;
+std::vector<std::pair<sha1_hash, int> > udp_tracker_events;
+
+std::vector<std::pair<sha1_hash, int> > udp_tracker_announces()
+{
+	libtorrent::mutex::scoped_lock l(udp_tracker_events_lock);
+	return udp_tracker_events;
+}
 
 void on_udp_receive(error_code const& ec, size_t bytes_transferred, udp::endpoint const* from, char* buffer, udp::socket* sock)
 {
@@ -493,6 +505,15 @@ void on_udp_receive(error_code const& ec, size_t bytes_transferred, udp::endpoin
 
 		case 1: // announce
 
+			if (bytes_transferred >= 84)
+			{
+				sha1_hash ih;
+				std::memcpy(&ih[0], buffer + 16, 20);
+				char* ev = buffer + 80;
+				libtorrent::mutex::scoped_lock l(udp_tracker_events_lock);
+				udp_tracker_events.push_back(std::make_pair(ih, int(detail::read_uint32(ev))));
+			}
+
 			ptr = buffer;
 			detail::write_uint32(1, ptr); // action = announce
 			detail::write_uint32(transaction_id, ptr); // transaction_id
@@ -503,7 +524,31 @@ void on_udp_receive(error_code const& ec, size_t bytes_transferred, udp::endpoin
 			// 0 peers
 			sock->send_to(asio::buffer(buffer, 20), *from, 0, e);
 			break;
-		default: // ignore scrapes
+
+		case 2: // scrape
+		{
+			// every info-hash is answered with the first byte of the
+			// hash as the number of seeds, and its position in the
+			// request as the number of downloads
+			int num_hashes = (bytes_transferred - 16) / 20;
+			if (g_udp_tracker_scrape_responses >= 0)
+				num_hashes = (std::min)(num_hashes, g_udp_tracker_scrape_responses);
+			char response[8 + 12 * 74];
+			num_hashes = (std::min)(num_hashes, 74);
+			ptr = response;
+			detail::write_uint32(2, ptr); // action = scrape
+			detail::write_uint32(transaction_id, ptr); // transaction_id
+			for (int i = 0; i < num_hashes; ++i)
+			{
+				detail::write_uint32(boost::uint8_t(buffer[16 + i * 20]), ptr); // complete
+				detail::write_uint32(i, ptr); // downloaded
+				detail::write_uint32(1, ptr); // incomplete
+			}
+			++g_udp_tracker_scrapes;
+			sock->send_to(asio::buffer(response, ptr - response), *from, 0, e);
+			break;
+		}
+		default:
 			break;
 	}
 }
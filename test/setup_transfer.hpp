@@ -55,6 +55,16 @@ void test_sleep(int millisec);
 extern int g_udp_tracker_requests;
 extern int g_http_tracker_requests;
 
+// the number of scrape packets the UDP tracker has received
+extern int g_udp_tracker_scrapes;
+// if >= 0, the UDP tracker only answers this many of the
+// info-hashes in a scrape, as if it didn't support more
+extern int g_udp_tracker_scrape_responses;
+
+// the info-hash and event of every announce the UDP tracker
+// has received, in order
+std::vector<std::pair<libtorrent::sha1_hash, int> > udp_tracker_announces();
+
 boost::intrusive_ptr<libtorrent::torrent_info> create_torrent(std::ostream* file = 0
 	, int piece_size = 16 * 1024, int num_pieces = 13, bool add_tracker = true, bool encrypted = false);
 
@@ -31,30 +31,340 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "libtorrent/lazy_entry.hpp"
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/entry.hpp"
 #include <boost/lexical_cast.hpp>
 #include <iostream>
+#include <cstdlib>
 
 #include "test.hpp"
 #include "libtorrent/time.hpp"
 
 using namespace libtorrent;
 
-int test_main()
+// compares lazy_bdecode() and bdecode() on messages of the kinds
+// that are decoded on hot paths: DHT traffic, extension messages,
+// resume data and .torrent files
+
+std::string rand_string(int len)
+{
+	std::string ret(len, '\0');
+	for (int i = 0; i < len; ++i) ret[i] = char(rand());
+	return ret;
+}
+
+std::string encode(entry const& e)
+{
+	std::string ret;
+	bencode(std::back_inserter(ret), e);
+	return ret;
+}
+
+std::string dht_query()
+{
+	entry e;
+	e["q"] = "get_peers";
+	e["t"] = rand_string(2);
+	e["y"] = "q";
+	e["v"] = "LT\x00\x10";
+	entry& a = e["a"];
+	a["id"] = rand_string(20);
+	a["info_hash"] = rand_string(20);
+	return encode(e);
+}
+
+std::string dht_response()
+{
+	entry e;
+	e["t"] = rand_string(2);
+	e["y"] = "r";
+	entry& r = e["r"];
+	r["id"] = rand_string(20);
+	r["token"] = rand_string(8);
+	r["nodes"] = rand_string(8 * 26);
+	entry::list_type& values = r["values"].list();
+	for (int i = 0; i < 50; ++i)
+		values.push_back(rand_string(6));
+	return encode(e);
+}
+
+std::string ut_pex()
+{
+	entry e;
+	e["added"] = rand_string(50 * 6);
+	e["added.f"] = rand_string(50);
+	e["dropped"] = rand_string(10 * 6);
+	e["added6"] = rand_string(5 * 18);
+	e["added6.f"] = rand_string(5);
+	e["dropped6"] = std::string();
+	return encode(e);
+}
+
+std::string ut_metadata()
+{
+	entry e;
+	e["msg_type"] = 1;
+	e["piece"] = rand() % 100;
+	e["total_size"] = 1600000;
+	// the piece itself follows the dictionary
+	return encode(e) + rand_string(16 * 1024);
+}
+
+std::string resume_file()
+{
+	const int num_files = 100;
+	const int num_pieces = 2000;
+	entry e;
+	e["file-format"] = "libtorrent resume file";
+	e["file-version"] = 1;
+	e["info-hash"] = rand_string(20);
+	e["blocks per piece"] = 16;
+	e["total_uploaded"] = 1234567;
+	e["total_downloaded"] = 7654321;
+	e["active_time"] = 3600;
+	e["seeding_time"] = 0;
+	e["num_seeds"] = 12;
+	e["num_downloaders"] = 40;
+	e["sequential_download"] = 0;
+	e["paused"] = 0;
+	e["auto_managed"] = 1;
+	e["allocation"] = "sparse";
+	e["pieces"] = rand_string(num_pieces);
+	e["piece_priority"] = std::string(num_pieces, '\x01');
+	e["peers"] = rand_string(200 * 6);
+	e["banned_peers"] = rand_string(3 * 6);
+	entry::list_type& sizes = e["file sizes"].list();
+	entry::list_type& prio = e["file_priority"].list();
+	for (int i = 0; i < num_files; ++i)
+	{
+		entry::list_type s;
+		s.push_back(entry(rand() * 1024));
+		s.push_back(entry(1300000000 + rand()));
+		sizes.push_back(s);
+		prio.push_back(entry(1));
+	}
+	entry::list_type& unfinished = e["unfinished"].list();
+	for (int i = 0; i < 20; ++i)
+	{
+		entry p;
+		p["piece"] = rand() % num_pieces;
+		p["bitmask"] = rand_string(2);
+		p["adler32"] = rand();
+		unfinished.push_back(p);
+	}
+	entry::list_type& trackers = e["trackers"].list();
+	for (int i = 0; i < 3; ++i)
+	{
+		entry::list_type tier;
+		tier.push_back(entry("http://tracker" + boost::lexical_cast<std::string>(i)
+			+ ".example.com:6969/announce"));
+		trackers.push_back(tier);
+	}
+	return encode(e);
+}
+
+std::string torrent_file()
+{
+	const int num_files = 500;
+	const int num_pieces = 2000;
+	entry e;
+	e["announce"] = "http://tracker.example.com:6969/announce";
+	e["creation date"] = 1300000000;
+	e["comment"] = "benchmark torrent";
+	entry& info = e["info"];
+	info["name"] = "benchmark";
+	info["piece length"] = 256 * 1024;
+	info["pieces"] = rand_string(num_pieces * 20);
+	entry::list_type& files = info["files"].list();
+	for (int i = 0; i < num_files; ++i)
+	{
+		entry f;
+		f["length"] = rand() * 16;
+		entry::list_type& path = f["path"].list();
+		path.push_back(entry("directory_" + boost::lexical_cast<std::string>(i % 10)));
+		path.push_back(entry("file_" + boost::lexical_cast<std::string>(i) + ".dat"));
+		files.push_back(f);
+	}
+	return encode(e);
+}
+
+// visits every item, the way a consumer reading every field would.
+// Returns a checksum to compare the two decoders with
+boost::int64_t walk(lazy_entry const& e)
 {
-	using namespace libtorrent;
+	switch (e.type())
+	{
+		case lazy_entry::int_t: return e.int_value();
+		case lazy_entry::string_t: return e.string_length();
+		case lazy_entry::list_t:
+		{
+			boost::int64_t ret = 1;
+			for (int i = 0; i < e.list_size(); ++i)
+				ret += walk(*e.list_at(i));
+			return ret;
+		}
+		case lazy_entry::dict_t:
+		{
+			boost::int64_t ret = 2;
+			for (int i = 0; i < e.dict_size(); ++i)
+			{
+				std::pair<std::string, lazy_entry const*> item = e.dict_at(i);
+				ret += item.first.size() + walk(*item.second);
+			}
+			return ret;
+		}
+		default: return 0;
+	}
+}
 
-	ptime start(time_now());
+boost::int64_t walk(bdecode_node const& e)
+{
+	switch (e.type())
+	{
+		case bdecode_node::int_t: return e.int_value();
+		case bdecode_node::string_t: return e.string_length();
+		case bdecode_node::list_t:
+		{
+			boost::int64_t ret = 1;
+			for (int i = 0; i < e.list_size(); ++i)
+				ret += walk(e.list_at(i));
+			return ret;
+		}
+		case bdecode_node::dict_t:
+		{
+			boost::int64_t ret = 2;
+			for (int i = 0; i < e.dict_size(); ++i)
+			{
+				std::pair<std::string, bdecode_node> item = e.dict_at(i);
+				ret += item.first.size() + walk(item.second);
+			}
+			return ret;
+		}
+		default: return 0;
+	}
+}
 
-	for (int i = 0; i < 100000; ++i)
+void benchmark(char const* name, std::vector<std::string> const& corpus)
+{
+	size_type corpus_bytes = 0;
+	for (int i = 0; i < int(corpus.size()); ++i)
+		corpus_bytes += corpus[i].size();
+
+	// decode about 50 MB of each kind of message
+	const int rounds = (std::max)(1, int(50 * 1024 * 1024 / corpus_bytes));
+	const int num_messages = rounds * int(corpus.size());
+	const double megabytes = double(corpus_bytes) * rounds / (1024 * 1024);
+
+	// both decoders reuse the same object, like the DHT does
+	lazy_entry le;
+	bdecode_node be;
+	error_code ec;
+
+	boost::int64_t lazy_sum = 0;
+	ptime start = time_now_hires();
+	for (int r = 0; r < rounds; ++r)
+	{
+		for (std::vector<std::string>::const_iterator i = corpus.begin()
+			, end(corpus.end()); i != end; ++i)
+		{
+			char const* buf = i->c_str();
+			int ret = lazy_bdecode(buf, buf + i->size(), le, ec);
+			TEST_CHECK(ret == 0);
+			if (r == 0) lazy_sum += walk(le);
+		}
+	}
+	ptime stop = time_now_hires();
+	double lazy_seconds = total_microseconds(stop - start) / 1000000.;
+
+	boost::int64_t sum = 0;
+	start = time_now_hires();
+	for (int r = 0; r < rounds; ++r)
 	{
-		char b[] = "d1:ai12453e1:b3:aaa1:c3:bbbe";
-		lazy_entry e;
-		error_code ec;
-		lazy_bdecode(b, b + sizeof(b)-1, e, ec);
+		for (std::vector<std::string>::const_iterator i = corpus.begin()
+			, end(corpus.end()); i != end; ++i)
+		{
+			char const* buf = i->c_str();
+			int ret = bdecode(buf, buf + i->size(), be, ec);
+			TEST_CHECK(ret == 0);
+			if (r == 0) sum += walk(be);
+		}
 	}
-	ptime stop(time_now());
+	stop = time_now_hires();
+	double seconds = total_microseconds(stop - start) / 1000000.;
+
+	// both decoders must agree on the content
+	TEST_EQUAL(lazy_sum, sum);
+
+	// then decode and visit every item, to include the cost of
+	// the accessors
+	start = time_now_hires();
+	for (int r = 0; r < rounds; ++r)
+	{
+		for (std::vector<std::string>::const_iterator i = corpus.begin()
+			, end(corpus.end()); i != end; ++i)
+		{
+			char const* buf = i->c_str();
+			lazy_bdecode(buf, buf + i->size(), le, ec);
+			lazy_sum += walk(le);
+		}
+	}
+	stop = time_now_hires();
+	double lazy_walk_seconds = total_microseconds(stop - start) / 1000000.;
+
+	start = time_now_hires();
+	for (int r = 0; r < rounds; ++r)
+	{
+		for (std::vector<std::string>::const_iterator i = corpus.begin()
+			, end(corpus.end()); i != end; ++i)
+		{
+			char const* buf = i->c_str();
+			bdecode(buf, buf + i->size(), be, ec);
+			sum += walk(be);
+		}
+	}
+	stop = time_now_hires();
+	double walk_seconds = total_microseconds(stop - start) / 1000000.;
+	TEST_EQUAL(lazy_sum, sum);
+
+	fprintf(stderr, "%-16s %8d bytes/msg | decode: lazy_bdecode %10.0f msg/s %7.1f MB/s"
+		" bdecode %10.0f msg/s %7.1f MB/s (%.2fx) | decode+walk: lazy_bdecode %10.0f msg/s"
+		" bdecode %10.0f msg/s (%.2fx)\n"
+		, name, int(corpus_bytes / corpus.size())
+		, num_messages / lazy_seconds, megabytes / lazy_seconds
+		, num_messages / seconds, megabytes / seconds, lazy_seconds / seconds
+		, num_messages / lazy_walk_seconds, num_messages / walk_seconds
+		, lazy_walk_seconds / walk_seconds);
+}
+
+int test_main()
+{
+	std::vector<std::string> corpus;
+
+	for (int i = 0; i < 1000; ++i) corpus.push_back(dht_query());
+	benchmark("DHT query", corpus);
+	corpus.clear();
+
+	for (int i = 0; i < 1000; ++i) corpus.push_back(dht_response());
+	benchmark("DHT response", corpus);
+	corpus.clear();
+
+	for (int i = 0; i < 1000; ++i) corpus.push_back(ut_pex());
+	benchmark("ut_pex", corpus);
+	corpus.clear();
+
+	for (int i = 0; i < 100; ++i) corpus.push_back(ut_metadata());
+	benchmark("ut_metadata", corpus);
+	corpus.clear();
+
+	for (int i = 0; i < 20; ++i) corpus.push_back(resume_file());
+	benchmark("resume file", corpus);
+	corpus.clear();
+
+	for (int i = 0; i < 5; ++i) corpus.push_back(torrent_file());
+	benchmark(".torrent file", corpus);
+	corpus.clear();
 
-	std::cout << "done in " << total_milliseconds(stop - start) / 100. << " seconds per million message" << std::endl;
 	return 0;
 }
 
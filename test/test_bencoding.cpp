@@ -32,9 +32,12 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/bencode.hpp"
 #include "libtorrent/lazy_entry.hpp"
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/bencode_writer.hpp"
 #include <boost/lexical_cast.hpp>
 #include <iostream>
 #include <cstring>
+#include <climits> // for INT_MAX
 
 #include "test.hpp"
 
@@ -104,6 +107,38 @@ int test_main()
 		TEST_CHECK(decode(encode(e)) == e);
 	}
 
+	// ** streaming encoder **
+	{
+		std::vector<char> buf;
+		vector_sink s(buf);
+		{
+			bencode_dict<vector_sink> d(s);
+			d.string("cow", "moo");
+			d.integer("i", -3);
+			{
+				bencode_list<vector_sink> l(d, "list");
+				l.string("spam");
+				l.integer(0);
+				bencode_dict<vector_sink> item(l);
+				item.string("empty", "", 0);
+			}
+			d.string("spam", std::string("eggs"));
+		}
+		TEST_EQUAL(std::string(&buf[0], buf.size())
+			, "d3:cow3:moo1:ii-3e4:listl4:spami0ed5:empty0:ee4:spam4:eggse");
+
+		entry e(entry::dictionary_t);
+		e["cow"] = "moo";
+		e["i"] = -3;
+		e["spam"] = "eggs";
+		entry::list_type& l = e["list"].list();
+		l.push_back(entry("spam"));
+		l.push_back(entry(0));
+		l.push_back(entry(entry::dictionary_t));
+		l.back()["empty"] = "";
+		TEST_EQUAL(encode(e), std::string(&buf[0], buf.size()));
+	}
+
 	{
 		char b[] = "i12453e";
 		lazy_entry e;
@@ -201,6 +236,221 @@ int test_main()
 		int ret = lazy_bdecode(buf, buf + sizeof(buf), e, ec);
 		TEST_CHECK(ret == -1);	
 	}
+
+	// bdecode_node
+
+	{
+		char b[] = "i12453e";
+		bdecode_node e;
+		error_code ec;
+		int ret = bdecode(b, b + sizeof(b)-1, e, ec);
+		TEST_CHECK(ret == 0);
+		printf("%s\n", print_entry(e).c_str());
+		std::pair<const char*, int> section = e.data_section();
+		TEST_CHECK(std::memcmp(b, section.first, section.second) == 0);
+		TEST_CHECK(section.second == sizeof(b) - 1);
+		TEST_CHECK(e.type() == bdecode_node::int_t);
+		TEST_CHECK(e.int_value() == 12453);
+	}
+
+	{
+		char b[] = "i-9223372036854775807e";
+		bdecode_node e;
+		error_code ec;
+		int ret = bdecode(b, b + sizeof(b)-1, e, ec);
+		TEST_CHECK(ret == 0);
+		TEST_CHECK(e.int_value() == -9223372036854775807LL);
+	}
+
+	{
+		char b[] = "26:abcdefghijklmnopqrstuvwxyz";
+		bdecode_node e;
+		error_code ec;
+		int ret = bdecode(b, b + sizeof(b)-1, e, ec);
+		TEST_CHECK(ret == 0);
+		printf("%s\n", print_entry(e).c_str());
+		std::pair<const char*, int> section = e.data_section();
+		TEST_CHECK(std::memcmp(b, section.first, section.second) == 0);
+		TEST_CHECK(section.second == sizeof(b) - 1);
+		TEST_CHECK(e.type() == bdecode_node::string_t);
+		TEST_CHECK(e.string_value() == std::string("abcdefghijklmnopqrstuvwxyz"));
+		TEST_CHECK(e.string_length() == 26);
+	}
+
+	{
+		char b[] = "li12453e3:aaae";
+		bdecode_node e;
+		error_code ec;
+		int ret = bdecode(b, b + sizeof(b)-1, e, ec);
+		TEST_CHECK(ret == 0);
+		printf("%s\n", print_entry(e).c_str());
+		std::pair<const char*, int> section = e.data_section();
+		TEST_CHECK(std::memcmp(b, section.first, section.second) == 0);
+		TEST_CHECK(section.second == sizeof(b) - 1);
+		TEST_CHECK(e.type() == bdecode_node::list_t);
+		TEST_CHECK(e.list_size() == 2);
+		TEST_CHECK(e.list_at(0).type() == bdecode_node::int_t);
+		TEST_CHECK(e.list_at(1).type() == bdecode_node::string_t);
+		TEST_CHECK(e.list_at(0).int_value() == 12453);
+		TEST_CHECK(e.list_at(1).string_value() == std::string("aaa"));
+		TEST_CHECK(e.list_at(1).string_length() == 3);
+		TEST_CHECK(e.list_int_value_at(0) == 12453);
+		TEST_CHECK(e.list_int_value_at(1, -1) == -1);
+		TEST_CHECK(e.list_string_value_at(1) == "aaa");
+		section = e.list_at(1).data_section();
+		TEST_CHECK(std::memcmp("3:aaa", section.first, section.second) == 0);
+		TEST_CHECK(section.second == 5);
+	}
+
+	{
+		char b[] = "d1:ai12453e1:b3:aaa1:c3:bbb1:X10:0123456789e";
+		bdecode_node e;
+		error_code ec;
+		int ret = bdecode(b, b + sizeof(b)-1, e, ec);
+		TEST_CHECK(ret == 0);
+		printf("%s\n", print_entry(e).c_str());
+		std::pair<const char*, int> section = e.data_section();
+		TEST_CHECK(std::memcmp(b, section.first, section.second) == 0);
+		TEST_CHECK(section.second == sizeof(b) - 1);
+		TEST_CHECK(e.type() == bdecode_node::dict_t);
+		TEST_CHECK(e.dict_size() == 4);
+		TEST_CHECK(e.dict_find("a").type() == bdecode_node::int_t);
+		TEST_CHECK(e.dict_find("a").int_value() == 12453);
+		TEST_CHECK(e.dict_find("b").type() == bdecode_node::string_t);
+		TEST_CHECK(e.dict_find("b").string_value() == std::string("aaa"));
+		TEST_CHECK(e.dict_find("b").string_length() == 3);
+		TEST_CHECK(e.dict_find("c").type() == bdecode_node::string_t);
+		TEST_CHECK(e.dict_find("c").string_value() == std::string("bbb"));
+		TEST_CHECK(e.dict_find("c").string_length() == 3);
+		TEST_CHECK(e.dict_find_string_value("X") == "0123456789");
+		TEST_CHECK(!e.dict_find("d"));
+		TEST_CHECK(!e.dict_find_string("a"));
+		TEST_CHECK(e.dict_find_int_value("b", -1) == -1);
+		TEST_CHECK(e.dict_at(3).first == "X");
+		TEST_CHECK(e.dict_at(1).second.string_value() == "aaa");
+		TEST_CHECK(e.dict_at(0).first == "a");
+	}
+
+	// nested containers. The items following a container have to
+	// be found by skipping over it
+	{
+		char b[] = "d1:ald1:xi1eeli2ei3ee0:e1:b4:spam1:ci-1ee";
+		bdecode_node e;
+		error_code ec;
+		int ret = bdecode(b, b + sizeof(b)-1, e, ec);
+		TEST_CHECK(ret == 0);
+		printf("%s\n", print_entry(e).c_str());
+		TEST_CHECK(e.dict_size() == 3);
+		bdecode_node a = e.dict_find_list("a");
+		TEST_CHECK(a.list_size() == 3);
+		TEST_CHECK(a.list_at(0).dict_find_int_value("x") == 1);
+		TEST_CHECK(a.list_at(1).list_size() == 2);
+		TEST_CHECK(a.list_at(1).list_int_value_at(1) == 3);
+		TEST_CHECK(a.list_at(2).string_length() == 0);
+		TEST_CHECK(e.dict_find_string_value("b") == "spam");
+		TEST_CHECK(e.dict_find_int_value("c") == -1);
+		std::pair<const char*, int> section = a.list_at(1).data_section();
+		TEST_CHECK(std::string(section.first, section.second) == "li2ei3ee");
+
+		// a copy of the root owns its own tokens
+		bdecode_node copy = e;
+		e.clear();
+		TEST_CHECK(!e);
+		TEST_CHECK(copy.dict_find_string_value("b") == "spam");
+	}
+
+	// the dictionary may be followed by other data, like in ut_metadata
+	// messages. It's not part of the decoded item
+	{
+		char b[] = "d8:msg_typei1e5:piecei0eeMETADATA";
+		bdecode_node e;
+		error_code ec;
+		int ret = bdecode(b, b + sizeof(b)-1, e, ec);
+		TEST_CHECK(ret == 0);
+		TEST_CHECK(e.data_section().second == sizeof(b) - 1 - 8);
+		TEST_CHECK(e.dict_find_int_value("msg_type") == 1);
+	}
+
+	// the same node can be reused to decode many messages
+	{
+		bdecode_node e;
+		error_code ec;
+		char b1[] = "d1:ai1ee";
+		char b2[] = "l1:x1:ye";
+		TEST_CHECK(bdecode(b1, b1 + sizeof(b1)-1, e, ec) == 0);
+		TEST_CHECK(e.dict_find_int_value("a") == 1);
+		TEST_CHECK(bdecode(b2, b2 + sizeof(b2)-1, e, ec) == 0);
+		TEST_CHECK(e.type() == bdecode_node::list_t);
+		TEST_CHECK(e.list_string_value_at(1) == "y");
+	}
+
+	// invalid encodings
+	{
+		char const* invalid[] = { "i1", "ie", "i-e", "ixe", "3:ab", "d1:ai1e"
+			, "d1:ae", "di1e1:ae", "e", "l", "5a:x", "123456789:x" };
+		for (int i = 0; i < int(sizeof(invalid)/sizeof(invalid[0])); ++i)
+		{
+			bdecode_node e;
+			error_code ec;
+			int pos = -1;
+			int ret = bdecode(invalid[i], invalid[i] + strlen(invalid[i]), e, ec, &pos);
+			fprintf(stderr, "%s: %s pos: %d\n", invalid[i], ec.message().c_str(), pos);
+			TEST_CHECK(ret == -1);
+			TEST_CHECK(ec);
+			TEST_CHECK(pos >= 0 && pos <= int(strlen(invalid[i])));
+			TEST_CHECK(e.type() == bdecode_node::none_t);
+		}
+	}
+
+	// depth and token limits
+	{
+		char b[] = "lllleeee";
+		bdecode_node e;
+		error_code ec;
+		int ret = bdecode(b, b + sizeof(b)-1, e, ec, 0, 3);
+		TEST_CHECK(ret == -1);
+		TEST_CHECK(ec == error_code(errors::depth_exceeded));
+		ret = bdecode(b, b + sizeof(b)-1, e, ec, 0, 4);
+		TEST_CHECK(ret == 0);
+
+		char b2[] = "li1ei2ei3ee";
+		ret = bdecode(b2, b2 + sizeof(b2)-1, e, ec, 0, 100, 3);
+		TEST_CHECK(ret == -1);
+		TEST_CHECK(ec == error_code(errors::limit_exceeded));
+
+		// a huge depth limit must not put a huge parse stack on the
+		// machine stack
+		std::string deep(1000, 'l');
+		deep.append(1000, 'e');
+		ret = bdecode(&deep[0], &deep[0] + deep.size(), e, ec, 0, INT_MAX);
+		TEST_CHECK(ret == 0);
+		ret = bdecode(&deep[0], &deep[0] + deep.size(), e, ec, 0, 999);
+		TEST_CHECK(ret == -1);
+		TEST_CHECK(ec == error_code(errors::depth_exceeded));
+	}
+
+	// the same invalid encoding as above
+	{
+		char buf[] =
+			{ 0x64	, 0x31	, 0x3a	, 0x61	, 0x64	, 0x32	, 0x3a	, 0x69
+			, 0x64	, 0x32	, 0x30	, 0x3a	, 0x2a	, 0x21	, 0x19	, 0x89
+			, 0x9f	, 0xcd	, 0x5f	, 0xc9	, 0xbc	, 0x80	, 0xc1	, 0x76
+			, 0xfe	, 0xe0	, 0xc6	, 0x84	, 0x2d	, 0xf6	, 0xfc	, 0xb8
+			, 0x39	, 0x3a	, 0x69	, 0x6e	, 0x66	, 0x6f	, 0x5f	, 0x68
+			, 0x61	, 0xae	, 0x68	, 0x32	, 0x30	, 0x3a	, 0x14	, 0x78
+			, 0xd5	, 0xb0	, 0xdc	, 0xf6	, 0x82	, 0x42	, 0x32	, 0xa0
+			, 0xd6	, 0x88	, 0xeb	, 0x48	, 0x57	, 0x01	, 0x89	, 0x40
+			, 0x4e	, 0xbc	, 0x65	, 0x31	, 0x3a	, 0x71	, 0x39	, 0x3a
+			, 0x67	, 0x65	, 0x74	, 0x5f	, 0x70	, 0x65	, 0x65	, 0x72
+			, 0x78	, 0xff	, 0x3a	, 0x74	, 0x38	, 0x3a	, 0xaa	, 0xd4
+			, 0xa1	, 0x88	, 0x7a	, 0x8d	, 0xc3	, 0xd6	, 0x31	, 0x3a
+			, 0x79	, 0x31	, 0xae	, 0x71	, 0x65	, 0};
+
+		bdecode_node e;
+		error_code ec;
+		int ret = bdecode(buf, buf + sizeof(buf), e, ec);
+		TEST_CHECK(ret == -1);
+	}
 	return 0;
 }
 
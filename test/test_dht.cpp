@@ -39,13 +39,24 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/rsa.hpp" // for generate_rsa_keys and sign_rsa
 #include "libtorrent/broadcast_socket.hpp" // for supports_ipv6
 #include "libtorrent/alert_dispatcher.hpp"
+#include "libtorrent/hasher.hpp"
 #include <iostream>
+#include <set>
+#include <numeric>
+#include <algorithm>
 
 #include "test.hpp"
 
 using namespace libtorrent;
 using namespace libtorrent::dht;
 
+namespace libtorrent { namespace aux
+{
+	// the cached clock returned by time_now(). The tests move it
+	// forward to expire DHT transactions
+	extern TORRENT_EXTRA_EXPORT ptime g_current_time;
+} }
+
 std::list<std::pair<udp::endpoint, entry> > g_responses;
 
 struct mock_socket : udp_socket_interface
@@ -55,6 +66,12 @@ struct mock_socket : udp_socket_interface
 		g_responses.push_back(std::make_pair(ep, msg));
 		return true;
 	}
+
+	bool send_packet(char const* buf, int size, udp::endpoint const& ep, int flags)
+	{
+		g_responses.push_back(std::make_pair(ep, bdecode(buf, buf + size)));
+		return true;
+	}
 };
 
 address rand_v4()
@@ -79,7 +96,7 @@ boost::array<char, 64> generate_key()
 static const std::string no;
 
 void send_dht_msg(node_impl& node, char const* msg, udp::endpoint const& ep
-	, lazy_entry* reply, char const* t = "10", char const* info_hash = 0
+	, bdecode_node* reply, char const* t = "10", char const* info_hash = 0
 	, char const* name = 0, std::string const token = std::string(), int port = 0
 	, char const* target = 0, entry const* value = 0
 	, bool scrape = false, bool seed = false
@@ -87,7 +104,7 @@ void send_dht_msg(node_impl& node, char const* msg, udp::endpoint const& ep
 	, int seq = -1)
 {
 	// we're about to clear out the backing buffer
-	// for this lazy_entry, so we better clear it now
+	// for this bdecode_node, so we better clear it now
 	reply->clear();
 	entry e;
 	e["q"] = msg;
@@ -110,10 +127,10 @@ void send_dht_msg(node_impl& node, char const* msg, udp::endpoint const& ep
 	int size = bencode(msg_buf, e);
 //	std::cerr << "sending: " <<  e << "\n";
 
-	lazy_entry decoded;
+	bdecode_node decoded;
 	error_code ec;
-	lazy_bdecode(msg_buf, msg_buf + size, decoded, ec);
-	if (ec) fprintf(stderr, "lazy_bdecode failed: %s\n", ec.message().c_str());
+	bdecode(msg_buf, msg_buf + size, decoded, ec);
+	if (ec) fprintf(stderr, "bdecode failed: %s\n", ec.message().c_str());
 
 	dht::msg m(decoded, ep);
 	node.incoming(m);
@@ -133,7 +150,7 @@ void send_dht_msg(node_impl& node, char const* msg, udp::endpoint const& ep
 	static char inbuf[1500];
 	int len = bencode(inbuf, i->second);
 	g_responses.erase(i);
-	int ret = lazy_bdecode(inbuf, inbuf + len, *reply, ec);
+	int ret = bdecode(inbuf, inbuf + len, *reply, ec);
 	TEST_CHECK(ret == 0);
 }
 
@@ -167,28 +184,28 @@ void announce_immutable_items(node_impl& node, udp::endpoint const* eps
 		for (int j = 0; j < num_items; ++j)
 		{
 			if ((i % items[j].num_peers) == 0) continue;
-			lazy_entry response;
+			bdecode_node response;
 			send_dht_msg(node, "get", eps[i], &response, "10", 0
 				, 0, no, 0, (char const*)&items[j].target[0]);
 			
 			key_desc_t desc[] =
 			{
-				{ "r", lazy_entry::dict_t, 0, key_desc_t::parse_children },
-					{ "id", lazy_entry::string_t, 20, 0},
-					{ "token", lazy_entry::string_t, 0, 0},
-					{ "ip", lazy_entry::string_t, 0, key_desc_t::optional | key_desc_t::last_child},
-				{ "y", lazy_entry::string_t, 1, 0},
+				{ "r", bdecode_node::dict_t, 0, key_desc_t::parse_children },
+					{ "id", bdecode_node::string_t, 20, 0},
+					{ "token", bdecode_node::string_t, 0, 0},
+					{ "ip", bdecode_node::string_t, 0, key_desc_t::optional | key_desc_t::last_child},
+				{ "y", bdecode_node::string_t, 1, 0},
 			};
 
-			lazy_entry const* parsed[5];
+			bdecode_node parsed[5];
 			char error_string[200];
 
 //			fprintf(stderr, "msg: %s\n", print_entry(response).c_str());
-			int ret = verify_message(&response, desc, parsed, 5, error_string, sizeof(error_string));
+			int ret = verify_message(response, desc, parsed, 5, error_string, sizeof(error_string));
 			if (ret)
 			{
-				TEST_EQUAL(parsed[4]->string_value(), "r");
-				token = parsed[2]->string_value();
+				TEST_EQUAL(parsed[4].string_value(), "r");
+				token = parsed[2].string_value();
 			}
 			else
 			{
@@ -199,7 +216,7 @@ void announce_immutable_items(node_impl& node, udp::endpoint const* eps
 			if (parsed[3])
 			{
 				address_v4::bytes_type b;
-				memcpy(&b[0], parsed[3]->string_ptr(), b.size());
+				memcpy(&b[0], parsed[3].string_ptr(), b.size());
 				address_v4 addr(b);
 				TEST_EQUAL(addr, eps[i].address());
 			}
@@ -209,14 +226,14 @@ void announce_immutable_items(node_impl& node, udp::endpoint const* eps
 
 			key_desc_t desc2[] =
 			{
-				{ "y", lazy_entry::string_t, 1, 0 }
+				{ "y", bdecode_node::string_t, 1, 0 }
 			};
 
 //			fprintf(stderr, "msg: %s\n", print_entry(response).c_str());
-			ret = verify_message(&response, desc2, parsed, 1, error_string, sizeof(error_string));
+			ret = verify_message(response, desc2, parsed, 1, error_string, sizeof(error_string));
 			if (ret)
 			{
-				TEST_EQUAL(parsed[0]->string_value(), "r");
+				TEST_EQUAL(parsed[0].string_value(), "r");
 			}
 			else
 			{
@@ -229,22 +246,22 @@ void announce_immutable_items(node_impl& node, udp::endpoint const* eps
 	std::set<int> items_num;
 	for (int j = 0; j < num_items; ++j)
 	{
-		lazy_entry response;
+		bdecode_node response;
 		send_dht_msg(node, "get", eps[j], &response, "10", 0
 			, 0, no, 0, (char const*)&items[j].target[0]);
 		
 		key_desc_t desc[] =
 		{
-			{ "r", lazy_entry::dict_t, 0, key_desc_t::parse_children },
-				{ "v", lazy_entry::dict_t, 0, 0},
-				{ "id", lazy_entry::string_t, 20, key_desc_t::last_child},
-			{ "y", lazy_entry::string_t, 1, 0},
+			{ "r", bdecode_node::dict_t, 0, key_desc_t::parse_children },
+				{ "v", bdecode_node::dict_t, 0, 0},
+				{ "id", bdecode_node::string_t, 20, key_desc_t::last_child},
+			{ "y", bdecode_node::string_t, 1, 0},
 		};
 
-		lazy_entry const* parsed[4];
+		bdecode_node parsed[4];
 		char error_string[200];
 
-		int ret = verify_message(&response, desc, parsed, 4, error_string, sizeof(error_string));
+		int ret = verify_message(response, desc, parsed, 4, error_string, sizeof(error_string));
 		if (ret)
 		{
 			items_num.insert(items_num.begin(), j);
@@ -270,6 +287,75 @@ struct print_alert : alert_dispatcher
 	}
 };
 
+void send_dht_reply(node_impl& node, udp::endpoint const& ep
+	, std::string const& t, entry const* r = 0)
+{
+	entry e;
+	e["y"] = "r";
+	e["t"] = t;
+	if (r) e["r"] = *r;
+	e["r"]["id"] = generate_next().to_string();
+	char msg_buf[1500];
+	int size = bencode(msg_buf, e);
+
+	bdecode_node decoded;
+	error_code ec;
+	bdecode(msg_buf, msg_buf + size, decoded, ec);
+	if (ec) fprintf(stderr, "bdecode failed: %s\n", ec.message().c_str());
+
+	dht::msg m(decoded, ep);
+	node.incoming(m);
+}
+
+int g_scrape_seeds = -1;
+int g_scrape_peers = -1;
+
+void on_scrape(int seeds, int peers)
+{
+	g_scrape_seeds = seeds;
+	g_scrape_peers = peers;
+}
+
+bloom_filter<256> address_filter(int first, int last)
+{
+	bloom_filter<256> ret;
+	for (int i = first; i < last; ++i)
+	{
+		char adr[50];
+		snprintf(adr, 50, "192.0.2.%d", i);
+		sha1_hash iphash;
+		hash_address(address::from_string(adr), iphash);
+		ret.set(iphash);
+	}
+	return ret;
+}
+
+void add_node_id(void* userdata, dht::node_entry const& e)
+{
+	static_cast<std::vector<node_id>*>(userdata)->push_back(e.id);
+}
+
+struct closer_to
+{
+	closer_to(node_id const& t): target(t) {}
+	bool operator()(node_id const& lhs, node_id const& rhs) const
+	{ return compare_ref(lhs, rhs, target); }
+	node_id target;
+};
+
+// returns an ID that shares the first prefix bits with id,
+// differs in the next one, and is random after that
+node_id id_with_prefix(node_id const& id, int prefix)
+{
+	node_id ret = generate_next();
+	int const byte = prefix / 8;
+	int const bit = 0x80 >> (prefix % 8);
+	int const mask = 0xff00 >> (prefix % 8);
+	for (int i = 0; i < byte; ++i) ret[i] = id[i];
+	ret[byte] = (id[byte] & mask) | (~id[byte] & bit) | (ret[byte] & (bit - 1));
+	return ret;
+}
+
 int test_main()
 {
 	dht_settings sett;
@@ -281,8 +367,8 @@ int test_main()
 	dht::node_impl node(&ad, &s, sett, node_id(0), ext, 0);
 
 	// DHT should be running on port 48199 now
-	lazy_entry response;
-	lazy_entry const* parsed[5];
+	bdecode_node response;
+	bdecode_node parsed[5];
 	char error_string[200];
 	bool ret;
 
@@ -291,19 +377,19 @@ int test_main()
 	send_dht_msg(node, "ping", source, &response, "10");
 
 	dht::key_desc_t pong_desc[] = {
-		{"y", lazy_entry::string_t, 1, 0},
-		{"t", lazy_entry::string_t, 2, 0},
-		{"r", lazy_entry::dict_t, 0, key_desc_t::parse_children},
-			{"id", lazy_entry::string_t, 20, key_desc_t::last_child},
+		{"y", bdecode_node::string_t, 1, 0},
+		{"t", bdecode_node::string_t, 2, 0},
+		{"r", bdecode_node::dict_t, 0, key_desc_t::parse_children},
+			{"id", bdecode_node::string_t, 20, key_desc_t::last_child},
 	};
 
 	fprintf(stderr, "msg: %s\n", print_entry(response).c_str());
-	ret = dht::verify_message(&response, pong_desc, parsed, 4, error_string, sizeof(error_string));
+	ret = dht::verify_message(response, pong_desc, parsed, 4, error_string, sizeof(error_string));
 	TEST_CHECK(ret);
 	if (ret)
 	{
-		TEST_CHECK(parsed[0]->string_value() == "r");
-		TEST_CHECK(parsed[1]->string_value() == "10");
+		TEST_CHECK(parsed[0].string_value() == "r");
+		TEST_CHECK(parsed[1].string_value() == "10");
 	}
 	else
 	{
@@ -315,22 +401,22 @@ int test_main()
 	send_dht_msg(node, "find_node", source, &response, "10");
 
 	dht::key_desc_t err_desc[] = {
-		{"y", lazy_entry::string_t, 1, 0},
-		{"e", lazy_entry::list_t, 2, 0},
-		{"r", lazy_entry::dict_t, 0, key_desc_t::parse_children},
-			{"id", lazy_entry::string_t, 20, key_desc_t::last_child},
+		{"y", bdecode_node::string_t, 1, 0},
+		{"e", bdecode_node::list_t, 2, 0},
+		{"r", bdecode_node::dict_t, 0, key_desc_t::parse_children},
+			{"id", bdecode_node::string_t, 20, key_desc_t::last_child},
 	};
 
 	fprintf(stderr, "msg: %s\n", print_entry(response).c_str());
-	ret = dht::verify_message(&response, err_desc, parsed, 4, error_string, sizeof(error_string));
+	ret = dht::verify_message(response, err_desc, parsed, 4, error_string, sizeof(error_string));
 	TEST_CHECK(ret);
 	if (ret)
 	{
-		TEST_CHECK(parsed[0]->string_value() == "e");
-		if (parsed[1]->list_at(0)->type() == lazy_entry::int_t
-			&& parsed[1]->list_at(1)->type() == lazy_entry::string_t)
+		TEST_CHECK(parsed[0].string_value() == "e");
+		if (parsed[1].list_at(0).type() == bdecode_node::int_t
+			&& parsed[1].list_at(1).type() == bdecode_node::string_t)
 		{
-			TEST_CHECK(parsed[1]->list_at(1)->string_value() == "missing 'target' key");
+			TEST_CHECK(parsed[1].list_at(1).string_value() == "missing 'target' key");
 		}
 		else
 		{
@@ -347,20 +433,20 @@ int test_main()
 	send_dht_msg(node, "get_peers", source, &response, "10", "01010101010101010101");
 
 	dht::key_desc_t peer1_desc[] = {
-		{"y", lazy_entry::string_t, 1, 0},
-		{"r", lazy_entry::dict_t, 0, key_desc_t::parse_children},
-			{"token", lazy_entry::string_t, 0, 0},
-			{"id", lazy_entry::string_t, 20, key_desc_t::last_child},
+		{"y", bdecode_node::string_t, 1, 0},
+		{"r", bdecode_node::dict_t, 0, key_desc_t::parse_children},
+			{"token", bdecode_node::string_t, 0, 0},
+			{"id", bdecode_node::string_t, 20, key_desc_t::last_child},
 	};
 
 	std::string token;
 	fprintf(stderr, "msg: %s\n", print_entry(response).c_str());
-	ret = dht::verify_message(&response, peer1_desc, parsed, 4, error_string, sizeof(error_string));
+	ret = dht::verify_message(response, peer1_desc, parsed, 4, error_string, sizeof(error_string));
 	TEST_CHECK(ret);
 	if (ret)
 	{
-		TEST_CHECK(parsed[0]->string_value() == "r");
-		token = parsed[2]->string_value();
+		TEST_CHECK(parsed[0].string_value() == "r");
+		token = parsed[2].string_value();
 	}
 	else
 	{
@@ -372,17 +458,17 @@ int test_main()
 	send_dht_msg(node, "announce_peer", source, &response, "10", "01010101010101010101", "test", token, 8080);
 
 	dht::key_desc_t ann_desc[] = {
-		{"y", lazy_entry::string_t, 1, 0},
-		{"r", lazy_entry::dict_t, 0, key_desc_t::parse_children},
-			{"id", lazy_entry::string_t, 20, key_desc_t::last_child},
+		{"y", bdecode_node::string_t, 1, 0},
+		{"r", bdecode_node::dict_t, 0, key_desc_t::parse_children},
+			{"id", bdecode_node::string_t, 20, key_desc_t::last_child},
 	};
 
 	fprintf(stderr, "msg: %s\n", print_entry(response).c_str());
-	ret = dht::verify_message(&response, ann_desc, parsed, 3, error_string, sizeof(error_string));
+	ret = dht::verify_message(response, ann_desc, parsed, 3, error_string, sizeof(error_string));
 	TEST_CHECK(ret);
 	if (ret)
 	{
-		TEST_CHECK(parsed[0]->string_value() == "r");
+		TEST_CHECK(parsed[0].string_value() == "r");
 	}
 	else
 	{
@@ -395,12 +481,12 @@ int test_main()
 	{
 		source = udp::endpoint(rand_v4(), 6000);
 		send_dht_msg(node, "get_peers", source, &response, "10", "01010101010101010101");
-		ret = dht::verify_message(&response, peer1_desc, parsed, 4, error_string, sizeof(error_string));
+		ret = dht::verify_message(response, peer1_desc, parsed, 4, error_string, sizeof(error_string));
 
 		if (ret)
 		{
-			TEST_CHECK(parsed[0]->string_value() == "r");
-			token = parsed[2]->string_value();
+			TEST_CHECK(parsed[0].string_value() == "r");
+			token = parsed[2].string_value();
 		}
 		else
 		{
@@ -418,25 +504,25 @@ int test_main()
 		, 0, no, 0, 0, 0, true);
 
 	dht::key_desc_t peer2_desc[] = {
-		{"y", lazy_entry::string_t, 1, 0},
-		{"r", lazy_entry::dict_t, 0, key_desc_t::parse_children},
-			{"BFpe", lazy_entry::string_t, 256, 0},
-			{"BFse", lazy_entry::string_t, 256, 0},
-			{"id", lazy_entry::string_t, 20, key_desc_t::last_child},
+		{"y", bdecode_node::string_t, 1, 0},
+		{"r", bdecode_node::dict_t, 0, key_desc_t::parse_children},
+			{"BFpe", bdecode_node::string_t, 256, 0},
+			{"BFsd", bdecode_node::string_t, 256, 0},
+			{"id", bdecode_node::string_t, 20, key_desc_t::last_child},
 	};
 
 	fprintf(stderr, "msg: %s\n", print_entry(response).c_str());
-	ret = dht::verify_message(&response, peer2_desc, parsed, 5, error_string, sizeof(error_string));
+	ret = dht::verify_message(response, peer2_desc, parsed, 5, error_string, sizeof(error_string));
 	TEST_CHECK(ret);
 	if (ret)
 	{
-		TEST_CHECK(parsed[0]->string_value() == "r");
-		TEST_EQUAL(parsed[1]->dict_find_string_value("n"), "test");
+		TEST_CHECK(parsed[0].string_value() == "r");
+		TEST_EQUAL(parsed[1].dict_find_string_value("n"), "test");
 
 		bloom_filter<256> downloaders;
 		bloom_filter<256> seeds;
-		downloaders.from_string(parsed[2]->string_ptr());
-		seeds.from_string(parsed[3]->string_ptr());
+		downloaders.from_string(parsed[2].string_ptr());
+		seeds.from_string(parsed[3].string_ptr());
 
 		fprintf(stderr, "seeds: %f\n", seeds.size());
 		fprintf(stderr, "downloaders: %f\n", downloaders.size());
@@ -449,6 +535,48 @@ int test_main()
 		fprintf(stderr, "   invalid get_peers response: %s\n", error_string);
 	}
 
+	// the filters are cached now. Make sure they're kept up to date
+	// as peers announce. Turn 10 of the downloaders into seeds
+	for (int i = 0; i < 10; ++i)
+	{
+		source = udp::endpoint(address_v4(0x0a000000 + i), 6000);
+		send_dht_msg(node, "get_peers", source, &response, "10", "01010101010101010101");
+		ret = dht::verify_message(response, peer1_desc, parsed, 4, error_string, sizeof(error_string));
+		TEST_CHECK(ret);
+		if (ret) token = parsed[2].string_value();
+		response.clear();
+		send_dht_msg(node, "announce_peer", source, &response, "10", "01010101010101010101"
+			, "test", token, 8080, 0, 0, false, i < 5);
+		response.clear();
+		send_dht_msg(node, "announce_peer", source, &response, "10", "01010101010101010101"
+			, "test", token, 8080, 0, 0, false, true);
+		response.clear();
+	}
+
+	send_dht_msg(node, "get_peers", source, &response, "10", "01010101010101010101"
+		, 0, no, 0, 0, 0, true);
+	ret = dht::verify_message(response, peer2_desc, parsed, 5, error_string, sizeof(error_string));
+	TEST_CHECK(ret);
+	if (ret)
+	{
+		bloom_filter<256> downloaders;
+		bloom_filter<256> seeds;
+		downloaders.from_string(parsed[2].string_ptr());
+		seeds.from_string(parsed[3].string_ptr());
+
+		fprintf(stderr, "seeds: %f\n", seeds.size());
+		fprintf(stderr, "downloaders: %f\n", downloaders.size());
+
+		// the peers that announced as downloaders first, and then
+		// as seeds, may not be left in the downloader filter
+		TEST_CHECK(fabs(seeds.size() - 60.f) <= 3.f);
+		TEST_CHECK(fabs(downloaders.size() - 50.f) <= 3.f);
+	}
+	else
+	{
+		fprintf(stderr, "   invalid get_peers response: %s\n", error_string);
+	}
+
 	bloom_filter<256> test;
 	for (int i = 0; i < 256; ++i)
 	{
@@ -535,18 +663,18 @@ int test_main()
 			
 	key_desc_t desc[] =
 	{
-		{ "r", lazy_entry::dict_t, 0, key_desc_t::parse_children },
-			{ "id", lazy_entry::string_t, 20, 0},
-			{ "token", lazy_entry::string_t, 0, 0},
-			{ "ip", lazy_entry::string_t, 0, key_desc_t::optional | key_desc_t::last_child},
-		{ "y", lazy_entry::string_t, 1, 0},
+		{ "r", bdecode_node::dict_t, 0, key_desc_t::parse_children },
+			{ "id", bdecode_node::string_t, 20, 0},
+			{ "token", bdecode_node::string_t, 0, 0},
+			{ "ip", bdecode_node::string_t, 0, key_desc_t::optional | key_desc_t::last_child},
+		{ "y", bdecode_node::string_t, 1, 0},
 	};
 
-	ret = verify_message(&response, desc, parsed, 5, error_string, sizeof(error_string));
+	ret = verify_message(response, desc, parsed, 5, error_string, sizeof(error_string));
 	if (ret)
 	{
-		TEST_EQUAL(parsed[4]->string_value(), "r");
-		token = parsed[2]->string_value();
+		TEST_EQUAL(parsed[4].string_value(), "r");
+		token = parsed[2].string_value();
 	}
 	else
 	{
@@ -573,15 +701,15 @@ int test_main()
 
 	key_desc_t desc2[] =
 	{
-		{ "y", lazy_entry::string_t, 1, 0 }
+		{ "y", bdecode_node::string_t, 1, 0 }
 	};
 
-	ret = verify_message(&response, desc2, parsed, 1, error_string, sizeof(error_string));
+	ret = verify_message(response, desc2, parsed, 1, error_string, sizeof(error_string));
 	if (ret)
 	{
 		fprintf(stderr, "put response: %s\n"
 			, print_entry(response).c_str());
-		TEST_EQUAL(parsed[0]->string_value(), "r");
+		TEST_EQUAL(parsed[0].string_value(), "r");
 	}
 	else
 	{
@@ -591,6 +719,262 @@ int test_main()
 	}
 #endif // TORRENT_USE_OPENSSL
 
+	// ====== peer storage ======
+	{
+		dht_settings ps_sett;
+		ps_sett.max_torrents = 100;
+		ps_sett.max_peers = 10;
+		ps_sett.max_peer_storage_size = 8000;
+		peer_storage storage(ps_sett);
+
+		// announce more torrents than fit in the memory limit
+		for (int i = 0; i < 200; ++i)
+		{
+			sha1_hash ih = hasher((char const*)&i, sizeof(i)).final();
+			storage.announce(ih, tcp::endpoint(rand_v4(), 6881), false, "test", 4);
+		}
+		TEST_CHECK(storage.num_torrents() > 0);
+		TEST_CHECK(storage.num_torrents() <= 100);
+		TEST_CHECK(storage.memory_usage() <= 8000);
+
+		// a torrent never has more than max_peers peers,
+		// and announcing twice doesn't add the peer twice
+		sha1_hash ih("01010101010101010101");
+		for (int i = 0; i < 20; ++i)
+			storage.announce(ih, tcp::endpoint(rand_v4(), 6881), i & 1, 0, 0);
+		dht::torrent_entry const* t = storage.find(ih);
+		TEST_CHECK(t != 0);
+		if (t)
+		{
+			TEST_EQUAL(t->num_peers, 10);
+			tcp::endpoint ep = t->peers[0].endpoint();
+			storage.announce(ih, ep, false, 0, 0);
+			TEST_EQUAL(t->num_peers, 10);
+
+			dht::peer_entry const* sample[10];
+			int num = storage.random_peers(*t, 5, false, sample);
+			TEST_EQUAL(num, 5);
+			std::set<dht::peer_entry const*> unique(sample, sample + num);
+			TEST_EQUAL(int(unique.size()), 5);
+			num = storage.random_peers(*t, 10, true, sample);
+			for (int i = 0; i < num; ++i) TEST_CHECK(!sample[i]->seed());
+		}
+
+		// prefix lookups find torrents sharing the first bytes
+		sha1_hash other = ih;
+		other[19] ^= 0xff;
+		TEST_CHECK(storage.find(other) == 0);
+		TEST_CHECK(storage.find(other, 8) == t);
+	}
+
+	// torrents whose info-hashes only differ in the last bytes
+	// are all stored, and prefix lookups pick the right ones
+	{
+		dht_settings ps_sett;
+		ps_sett.max_torrents = 100;
+		peer_storage storage(ps_sett);
+
+		sha1_hash ih("01010101010101010101");
+		for (int i = 0; i < 50; ++i)
+		{
+			ih[19] = i;
+			storage.announce(ih, tcp::endpoint(rand_v4(), 6881), false, 0, 0);
+		}
+		TEST_EQUAL(storage.num_torrents(), 50);
+		for (int i = 0; i < 50; ++i)
+		{
+			ih[19] = i;
+			dht::torrent_entry const* t = storage.find(ih);
+			TEST_CHECK(t != 0 && t->info_hash == ih);
+		}
+
+		ih[17] ^= 0xff;
+		TEST_CHECK(storage.find(ih, 18) == 0);
+		ih[17] ^= 0xff;
+		ih[19] = 0xff;
+		dht::torrent_entry const* t = storage.find(ih, 19);
+		TEST_CHECK(t != 0 && std::memcmp(&t->info_hash[0], &ih[0], 19) == 0);
+	}
+
+	// a new torrent is rejected if there's nothing to
+	// evict to make room for it
+	{
+		dht_settings ps_sett;
+		ps_sett.max_torrents = 100;
+		ps_sett.max_peer_storage_size = 0;
+		peer_storage storage(ps_sett);
+		size_type memory = storage.memory_usage();
+
+		sha1_hash ih("01010101010101010101");
+		storage.announce(ih, tcp::endpoint(rand_v4(), 6881), false, "test", 4);
+		TEST_EQUAL(storage.num_torrents(), 0);
+		TEST_CHECK(storage.find(ih) == 0);
+		TEST_EQUAL(storage.memory_usage(), memory);
+	}
+
+	// ====== routing table ======
+	{
+		dht_settings rt_sett;
+		rt_sett.restrict_routing_ips = false;
+		node_id id = generate_next();
+		dht::routing_table table(id, 8, rt_sett);
+
+		// nodes at every distance from us down to 2^140. Only the last
+		// bucket is split, so this fills and splits it over and over
+		for (int prefix = 0; prefix < 20; ++prefix)
+		{
+			for (int i = 0; i < 20; ++i)
+			{
+				node_id nid = id_with_prefix(id, prefix);
+				TEST_EQUAL(distance_exp(id, nid), 159 - prefix);
+				table.node_seen(nid, udp::endpoint(rand_v4(), 6881), 10);
+			}
+		}
+		TEST_CHECK(table.num_active_buckets() >= 10);
+
+		std::vector<node_id> all;
+		table.for_each_node(&add_node_id, 0, &all);
+		TEST_CHECK(all.size() > 100);
+
+		// find_node() returns the nodes closest to the target, closest
+		// first. Try our own ID, which has its closest nodes in the
+		// last bucket, one of the nodes and a random ID
+		node_id targets[] = { id, all[all.size() / 2], generate_next() };
+		for (int k = 0; k < int(sizeof(targets) / sizeof(targets[0])); ++k)
+		{
+			std::vector<dht::node_entry> nodes;
+			table.find_node(targets[k], nodes, 0, 8);
+			TEST_EQUAL(nodes.size(), 8);
+
+			std::vector<node_id> closest(all);
+			std::sort(closest.begin(), closest.end(), closer_to(targets[k]));
+			for (int i = 0; i < int(nodes.size()); ++i)
+				TEST_CHECK(nodes[i].id == closest[i]);
+		}
+	}
+
+	// ====== rpc transactions ======
+	{
+		g_responses.clear();
+		dht::node_impl node2(&ad, &s, sett, node_id(0), ext, 0);
+
+		// enough outstanding pings to grow the transaction table
+		for (int i = 0; i < 200; ++i)
+			node2.add_node(udp::endpoint(rand_v4(), 6881));
+		TEST_EQUAL(node2.m_rpc.num_transactions(), 200);
+		TEST_EQUAL(int(g_responses.size()), 200);
+
+		std::vector<std::pair<udp::endpoint, entry> > pings(
+			g_responses.begin(), g_responses.end());
+		g_responses.clear();
+
+		for (int i = 0; i < 100; ++i)
+			send_dht_reply(node2, pings[i].first, pings[i].second["t"].string());
+
+		// a reply with the right transaction ID but from another
+		// address doesn't match the request
+		send_dht_reply(node2, udp::endpoint(rand_v4(), 6881)
+			, pings[100].second["t"].string());
+		// and neither does one that has already been answered
+		send_dht_reply(node2, pings[0].first, pings[0].second["t"].string());
+
+		session_status st;
+		node2.status(st);
+		int replies = std::accumulate(st.dht_rtt_histogram
+			, st.dht_rtt_histogram + session_status::num_dht_rtt_buckets, 0);
+		TEST_EQUAL(replies, 100);
+		TEST_EQUAL(st.dht_outstanding_transactions, 100);
+		TEST_EQUAL(st.dht_transaction_timeouts, 0);
+	}
+
+	// ====== rpc transaction timeouts ======
+	{
+		g_responses.clear();
+		ptime const start = aux::g_current_time;
+		aux::g_current_time = time_now_hires();
+		dht::node_impl node4(&ad, &s, sett, node_id(0), ext, 0);
+
+		for (int i = 0; i < 10; ++i)
+			node4.add_node(udp::endpoint(rand_v4(), 6881));
+		TEST_EQUAL(node4.m_rpc.num_transactions(), 10);
+
+		std::vector<std::pair<udp::endpoint, entry> > pings(
+			g_responses.begin(), g_responses.end());
+		g_responses.clear();
+		for (int i = 0; i < 3; ++i)
+			send_dht_reply(node4, pings[i].first, pings[i].second["t"].string());
+
+		// the replies may have triggered new requests
+		int const outstanding = node4.m_rpc.num_transactions();
+		TEST_CHECK(outstanding >= 7);
+
+		// nothing has timed out yet
+		node4.connection_timeout();
+		TEST_EQUAL(node4.m_rpc.num_transactions(), outstanding);
+
+		// move the cached clock past the short timeout. The transactions
+		// are kept, and rescheduled for the full timeout
+		aux::g_current_time = time_now_hires() + seconds(5);
+		node4.connection_timeout();
+		TEST_EQUAL(node4.m_rpc.num_transactions(), outstanding);
+
+		// and past the full timeout, which removes them
+		aux::g_current_time = time_now_hires() + seconds(15);
+		node4.connection_timeout();
+
+		session_status st;
+		node4.status(st);
+		TEST_EQUAL(node4.m_rpc.num_transactions(), 0);
+		TEST_EQUAL(st.dht_outstanding_transactions, 0);
+		TEST_EQUAL(st.dht_transaction_timeouts, outstanding);
+		aux::g_current_time = start;
+	}
+
+	// ====== scrape traversal ======
+	{
+		g_responses.clear();
+		dht::node_impl node3(&ad, &s, sett, node_id(0), ext, 0);
+
+		for (int i = 0; i < 8; ++i)
+			node3.add_node(udp::endpoint(rand_v4(), 6881));
+		std::vector<std::pair<udp::endpoint, entry> > pings(
+			g_responses.begin(), g_responses.end());
+		g_responses.clear();
+		for (int i = 0; i < int(pings.size()); ++i)
+			send_dht_reply(node3, pings[i].first, pings[i].second["t"].string());
+
+		node3.scrape(sha1_hash("01010101010101010101"), &on_scrape);
+
+		// half of the nodes know about seeds 0-29, the other half about
+		// seeds 20-49. They all know the same 10 downloaders. The other
+		// half uses the key older versions of libtorrent used for seeds
+		bloom_filter<256> seeds1 = address_filter(0, 30);
+		bloom_filter<256> seeds2 = address_filter(20, 50);
+		bloom_filter<256> downloaders = address_filter(100, 110);
+
+		int num_scrapes = 0;
+		while (!g_responses.empty())
+		{
+			std::pair<udp::endpoint, entry> req = g_responses.front();
+			g_responses.pop_front();
+			TEST_EQUAL(req.second["q"].string(), "get_peers");
+			TEST_EQUAL(req.second["a"]["scrape"].integer(), 1);
+
+			entry r;
+			r["BFpe"] = downloaders.to_string();
+			if (num_scrapes & 1) r["BFsd"] = seeds1.to_string();
+			else r["BFse"] = seeds2.to_string();
+			send_dht_reply(node3, req.first, req.second["t"].string(), &r);
+			++num_scrapes;
+		}
+
+		fprintf(stderr, "scraped %d nodes. seeds: %d downloaders: %d\n"
+			, num_scrapes, g_scrape_seeds, g_scrape_peers);
+		TEST_CHECK(num_scrapes >= 2);
+		TEST_CHECK(abs(g_scrape_seeds - 50) <= 3);
+		TEST_CHECK(abs(g_scrape_peers - 10) <= 2);
+	}
+
 	return 0;
 }
 
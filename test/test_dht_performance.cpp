@@ -0,0 +1,230 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/session.hpp"
+#include "libtorrent/kademlia/node.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/time.hpp"
+#include <iostream>
+#include <cstring> // for memcpy
+
+#include "test.hpp"
+
+using namespace libtorrent;
+using namespace libtorrent::dht;
+
+#ifndef TORRENT_DISABLE_DHT
+
+// a socket that just counts the responses sent through it
+struct counting_socket : udp_socket_interface
+{
+	counting_socket(): packets(0), bytes(0) {}
+
+	bool send_packet(entry& msg, udp::endpoint const& ep, int flags)
+	{
+		m_buf.clear();
+		bencode(std::back_inserter(m_buf), msg);
+		return send_packet(&m_buf[0], int(m_buf.size()), ep, flags);
+	}
+
+	bool send_packet(char const* buf, int size, udp::endpoint const& ep, int flags)
+	{
+		++packets;
+		bytes += size;
+		return true;
+	}
+
+	int packets;
+	size_type bytes;
+	std::vector<char> m_buf;
+};
+
+address rand_v4()
+{
+	return address_v4((rand() << 16 | rand()) & 0xffffffff);
+}
+
+sha1_hash rand_hash()
+{
+	sha1_hash ret;
+	for (int i = 0; i < 20; ++i) ret[i] = rand();
+	return ret;
+}
+
+// a query, bencoded the way it arrives from the network
+struct query_t
+{
+	std::vector<char> buf;
+	udp::endpoint ep;
+};
+
+query_t make_query(char const* q, char const* target_key, sha1_hash const& target
+	, udp::endpoint const& ep, std::string const& token = std::string())
+{
+	entry e;
+	e["q"] = q;
+	e["t"] = "aa";
+	e["y"] = "q";
+	entry& a = e["a"];
+	a["id"] = rand_hash().to_string();
+	if (target_key) a[target_key] = target.to_string();
+	if (!token.empty())
+	{
+		a["token"] = token;
+		a["port"] = 6881;
+	}
+	query_t ret;
+	bencode(std::back_inserter(ret.buf), e);
+	ret.ep = ep;
+	return ret;
+}
+
+// decodes and handles every query, the way dht_tracker does for
+// packets arriving on the socket
+void run_queries(node_impl& node, std::vector<query_t> const& queries)
+{
+	// the node is reused for every message, just like dht_tracker's,
+	// so its token array is only allocated once. Every query is copied
+	// into a receive buffer first, just like it would be by the socket
+	bdecode_node e;
+	error_code ec;
+	char buf[1500];
+	for (std::vector<query_t>::const_iterator i = queries.begin()
+		, end(queries.end()); i != end; ++i)
+	{
+		int size = (std::min)(int(i->buf.size()), int(sizeof(buf)));
+		std::memcpy(buf, &i->buf[0], size);
+		bdecode(buf, buf + size, e, ec, 0, 10, 500);
+		dht::msg m(e, i->ep);
+		node.incoming(m);
+	}
+}
+
+void benchmark(node_impl& node, counting_socket& s, char const* name
+	, std::vector<query_t> const& queries)
+{
+	// warm up the response buffers
+	run_queries(node, queries);
+
+	s.packets = 0;
+	s.bytes = 0;
+	const int rounds = 10;
+	ptime start = time_now_hires();
+	for (int i = 0; i < rounds; ++i) run_queries(node, queries);
+	ptime stop = time_now_hires();
+
+	int num_queries = rounds * int(queries.size());
+	TEST_EQUAL(s.packets, num_queries);
+
+	double seconds = total_microseconds(stop - start) / 1000000.;
+	std::cout << name << ": " << (num_queries / seconds) << " queries per second, "
+		<< (s.bytes / num_queries) << " bytes per response" << std::endl;
+}
+
+int test_main()
+{
+	dht_settings sett;
+	address ext = address::from_string("236.0.0.1");
+	counting_socket s;
+	dht::node_impl node(0, &s, sett, node_id(0), ext, 0);
+
+	// fill the routing table, so find_node and get_peers
+	// responses are full
+	for (int i = 0; i < 1000; ++i)
+		node.m_table.node_seen(rand_hash(), udp::endpoint(rand_v4(), 6881), 50);
+
+	// and announce some peers to some torrents
+	std::vector<sha1_hash> torrents;
+	std::vector<query_t> queries;
+	for (int i = 0; i < 100; ++i)
+	{
+		sha1_hash ih = rand_hash();
+		torrents.push_back(ih);
+		for (int j = 0; j < 50; ++j)
+		{
+			udp::endpoint ep(rand_v4(), 6881);
+			queries.push_back(make_query("announce_peer", "info_hash", ih, ep
+				, node.generate_token(ep, (char const*)&ih[0])));
+		}
+	}
+	run_queries(node, queries);
+	TEST_EQUAL(node.num_torrents(), 100);
+
+	const int num_queries = 1000;
+
+	queries.clear();
+	for (int i = 0; i < num_queries; ++i)
+		queries.push_back(make_query("ping", 0, sha1_hash(), udp::endpoint(rand_v4(), 6881)));
+	benchmark(node, s, "ping", queries);
+
+	queries.clear();
+	for (int i = 0; i < num_queries; ++i)
+		queries.push_back(make_query("find_node", "target", rand_hash()
+			, udp::endpoint(rand_v4(), 6881)));
+	benchmark(node, s, "find_node", queries);
+
+	// this is what dht_flood.py sends, get_peers for random info-hashes
+	queries.clear();
+	for (int i = 0; i < num_queries; ++i)
+		queries.push_back(make_query("get_peers", "info_hash", rand_hash()
+			, udp::endpoint(rand_v4(), 6881)));
+	benchmark(node, s, "get_peers (no peers)", queries);
+
+	queries.clear();
+	for (int i = 0; i < num_queries; ++i)
+		queries.push_back(make_query("get_peers", "info_hash", torrents[i % torrents.size()]
+			, udp::endpoint(rand_v4(), 6881)));
+	benchmark(node, s, "get_peers (with peers)", queries);
+
+	queries.clear();
+	for (int i = 0; i < num_queries; ++i)
+	{
+		udp::endpoint ep(rand_v4(), 6881);
+		sha1_hash const& ih = torrents[i % torrents.size()];
+		queries.push_back(make_query("announce_peer", "info_hash", ih, ep
+			, node.generate_token(ep, (char const*)&ih[0])));
+	}
+	benchmark(node, s, "announce_peer", queries);
+
+	return 0;
+}
+
+#else
+
+int test_main()
+{
+	return 0;
+}
+
+#endif
+
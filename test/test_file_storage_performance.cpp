@@ -0,0 +1,120 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/file_storage.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/time.hpp"
+#include <iostream>
+#include <cstdio> // for snprintf
+
+#include "test.hpp"
+
+using namespace libtorrent;
+
+const int block_size = 0x4000;
+
+// maps every block of the torrent and checks that the first slice is
+// in the same file a linear sweep over the files finds
+void map_all_blocks(file_storage const& fs, char const* name)
+{
+	const int num_blocks = int((fs.total_size() + block_size - 1) / block_size);
+	int file = 0;
+	int errors = 0;
+	size_type bytes = 0;
+	ptime start = time_now_hires();
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		size_type offset = size_type(i) * block_size;
+		int piece = int(offset / fs.piece_length());
+		int size = int((std::min)(size_type(block_size), fs.total_size() - offset));
+		std::vector<file_slice> slices = fs.map_block(piece
+			, offset - size_type(piece) * fs.piece_length(), size);
+
+		while (fs.file_offset(file) + fs.file_size(file) <= offset) ++file;
+		if (slices.empty() || slices[0].file_index != file) ++errors;
+		for (std::vector<file_slice>::iterator j = slices.begin()
+			, end(slices.end()); j != end; ++j)
+			bytes += j->size;
+	}
+	ptime stop = time_now_hires();
+
+	TEST_EQUAL(errors, 0);
+	TEST_EQUAL(bytes, fs.total_size());
+
+	double seconds = total_microseconds(stop - start) / 1000000.;
+	std::cout << name << ": " << (num_blocks / seconds) << " blocks mapped per second ("
+		<< num_blocks << " blocks)" << std::endl;
+}
+
+int test_main()
+{
+	// 100 top level directories with 50 sub directories each,
+	// and 100 files in each of those
+	const int num_files = 500000;
+	char path[200];
+
+	file_storage fs;
+	fs.reserve(num_files);
+	ptime start = time_now_hires();
+	for (int i = 0; i < num_files; ++i)
+	{
+		snprintf(path, sizeof(path), "test/dir-%d/sub-directory-%d/file-%d"
+			, i / 5000, (i / 100) % 50, i);
+		// every 13th file is empty
+		size_type size = (i % 13) == 0 ? 0 : (i * 7919) % 100000 + 1;
+		fs.add_file(path, size);
+	}
+	ptime stop = time_now_hires();
+	std::cout << "add_file: " << (num_files / (total_microseconds(stop - start) / 1000000.))
+		<< " files per second" << std::endl;
+
+	const int piece_length = 0x400000;
+	fs.set_piece_length(piece_length);
+	fs.set_num_pieces(int((fs.total_size() + piece_length - 1) / piece_length));
+	std::cout << "files: " << fs.num_files() << " pieces: " << fs.num_pieces()
+		<< " size: " << fs.total_size() << " memory: " << fs.memory_usage()
+		<< std::endl;
+
+	TEST_EQUAL(fs.file_path(63456), combine_path(combine_path(combine_path(
+		"test", "dir-12"), "sub-directory-34"), "file-63456"));
+	TEST_EQUAL(fs.file_name(num_files - 1), "file-499999");
+
+	map_all_blocks(fs, "map_block (indexed)");
+
+	// setting the piece length drops the piece index, mapping
+	// blocks then searches all files
+	fs.set_piece_length(piece_length);
+	map_all_blocks(fs, "map_block (unindexed)");
+
+	return 0;
+}
+
@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/socket_io.hpp" // print_endpoint
 #include "libtorrent/connection_queue.hpp"
 #include "libtorrent/http_connection.hpp"
+#include "libtorrent/resolver.hpp"
 #include "setup_transfer.hpp"
 
 #include <fstream>
@@ -134,6 +135,59 @@ void run_test(std::string const& url, int size, int status, int connected
 	TEST_CHECK(http_status == status || status == -1);
 }
 
+void run_keep_alive_test(int port)
+{
+	reset_globals();
+
+	char url[256];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/test_file", port);
+	std::cerr << " ===== TESTING KEEP-ALIVE: " << url << " =====" << std::endl;
+
+	resolver res(ios);
+	boost::shared_ptr<http_connection> h(new http_connection(ios, cq
+		, &::http_handler, true, 1024*1024, &::http_connect_handler));
+	h->set_resolver(&res);
+	h->keep_alive(true);
+
+	for (int i = 0; i < 3; ++i)
+	{
+		h->get(url, seconds(1));
+		ios.reset();
+		error_code e;
+		ios.run(e);
+
+		TEST_EQUAL(handler_called, i + 1);
+		TEST_EQUAL(http_status, 200);
+		TEST_EQUAL(data_size, 3216);
+		// the web server keeps the connection open
+		TEST_CHECK(h->is_idle());
+	}
+
+	// all requests were sent over the first connection, so the
+	// hostname was only looked up once
+	TEST_EQUAL(connect_handler_called, 1);
+	TEST_EQUAL(res.num_misses(), 1);
+	TEST_EQUAL(res.num_hits(), 0);
+	h->close();
+
+	// a new connection to the same host gets the address
+	// from the cache
+	boost::shared_ptr<http_connection> h2(new http_connection(ios, cq
+		, &::http_handler, true, 1024*1024, &::http_connect_handler));
+	h2->set_resolver(&res);
+	h2->get(url, seconds(1));
+	ios.reset();
+	error_code e;
+	ios.run(e);
+
+	TEST_EQUAL(handler_called, 4);
+	TEST_EQUAL(connect_handler_called, 2);
+	TEST_EQUAL(data_size, 3216);
+	TEST_CHECK(!h2->is_idle());
+	TEST_EQUAL(res.num_misses(), 1);
+	TEST_EQUAL(res.num_hits(), 1);
+}
+
 void run_suite(std::string const& protocol, proxy_settings ps, int port)
 {
 	if (ps.type != proxy_settings::none)
@@ -206,6 +260,7 @@ int test_main()
 		ps.type = (proxy_settings::proxy_type)i;
 		run_suite("http", ps, port);
 	}
+	run_keep_alive_test(port);
 	stop_web_server();
 
 #ifdef TORRENT_USE_OPENSSL
@@ -0,0 +1,247 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/http_parser.hpp"
+#include "libtorrent/buffer.hpp"
+#include "libtorrent/size_type.hpp"
+#include "libtorrent/time.hpp"
+#include <boost/tuple/tuple.hpp>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include "test.hpp"
+
+using namespace libtorrent;
+
+// measures the throughput of http_parser on the kinds of responses
+// it sees on hot paths: large web seed responses, with and without
+// chunked encoding, and small tracker responses
+
+const int body_size = 8 * 1024 * 1024;
+
+// the size of each read from the socket. The parser is fed the
+// receive buffer, growing by this much for every call
+const int read_size = 16 * 1024;
+
+std::string response_header(int chunk_size)
+{
+	std::string ret = "HTTP/1.1 206 Partial Content\r\n"
+		"Date: Sat, 01 Sep 2012 12:00:00 GMT\r\n"
+		"Server: Apache/2.2.22 (Unix)\r\n"
+		"Last-Modified: Sat, 01 Sep 2012 10:00:00 GMT\r\n"
+		"ETag: \"1a2b3c-800000-4c8a9b7e8c4c0\"\r\n"
+		"Accept-Ranges: bytes\r\n"
+		"Content-Type: application/octet-stream\r\n"
+		"Connection: keep-alive\r\n";
+	char buf[200];
+	snprintf(buf, sizeof(buf), "Content-Range: bytes 0-%d/%d\r\n", body_size - 1, body_size);
+	ret += buf;
+	if (chunk_size > 0)
+	{
+		ret += "Transfer-Encoding: chunked\r\n";
+	}
+	else
+	{
+		snprintf(buf, sizeof(buf), "Content-Length: %d\r\n", body_size);
+		ret += buf;
+	}
+	ret += "\r\n";
+	return ret;
+}
+
+// builds a response with a body of body_size bytes, split into
+// chunks of chunk_size bytes. 0 means no chunked encoding
+std::string response(std::string const& body, int chunk_size)
+{
+	std::string ret = response_header(chunk_size);
+	if (chunk_size == 0) return ret + body;
+
+	char buf[30];
+	for (int i = 0; i < int(body.size()); i += chunk_size)
+	{
+		int len = (std::min)(chunk_size, int(body.size()) - i);
+		snprintf(buf, sizeof(buf), "%x\r\n", len);
+		ret += buf;
+		ret.append(body, i, len);
+		ret += "\r\n";
+	}
+	ret += "0\r\n\r\n";
+	return ret;
+}
+
+// parses the response the way a bottled http_connection does (trackers,
+// .torrent and feed downloads): the parser decodes the chunk headers
+// and once the response is complete, they're removed from the buffer
+// in place. Returns the number of payload bytes
+int parse_bottled(std::vector<char>& buf)
+{
+	http_parser parser;
+	int payload = 0;
+	for (int received = 0; received < int(buf.size());)
+	{
+		received = (std::min)(received + read_size, int(buf.size()));
+		bool error = false;
+		int p, protocol;
+		boost::tie(p, protocol) = parser.incoming(
+			buffer::const_interval(&buf[0], &buf[0] + received), error);
+		TEST_CHECK(!error);
+		payload += p;
+	}
+	TEST_CHECK(parser.finished());
+	int body_start = parser.body_start();
+	int size = parser.collapse_chunk_headers(&buf[0] + body_start
+		, int(buf.size()) - body_start);
+	TEST_EQUAL(size, payload);
+	return size;
+}
+
+// parses the response the way web_peer_connection does: the parser
+// is only used for the header, and the chunk headers are parsed
+// one at a time as the body is received. Returns the number of
+// payload bytes
+int parse_web_seed(std::vector<char> const& buf)
+{
+	http_parser parser(http_parser::dont_parse_chunks);
+	char const* begin = &buf[0];
+	char const* end = begin + buf.size();
+	int received = 0;
+	while (!parser.header_finished())
+	{
+		received = (std::min)(received + read_size, int(buf.size()));
+		bool error = false;
+		parser.incoming(buffer::const_interval(begin, begin + received), error);
+		TEST_CHECK(!error);
+	}
+	if (!parser.chunked_encoding())
+		return int(end - begin) - parser.body_start();
+
+	int payload = 0;
+	char const* pos = begin + parser.body_start();
+	for (;;)
+	{
+		size_type chunk_size;
+		int header_size;
+		bool ret = parser.parse_chunk_header(buffer::const_interval(pos, end)
+			, &chunk_size, &header_size);
+		TEST_CHECK(ret);
+		if (!ret || chunk_size == 0) break;
+		pos += header_size + chunk_size;
+		payload += int(chunk_size);
+	}
+	return payload;
+}
+
+void benchmark(std::string const& body, int chunk_size)
+{
+	std::string const resp = response(body, chunk_size);
+	const int rounds = 10;
+
+	std::vector<char> buf;
+	double bottled_seconds = 0;
+	for (int r = 0; r < rounds; ++r)
+	{
+		buf.assign(resp.begin(), resp.end());
+		ptime start = time_now_hires();
+		int size = parse_bottled(buf);
+		bottled_seconds += total_microseconds(time_now_hires() - start) / 1000000.;
+		TEST_EQUAL(size, int(body.size()));
+		// the chunk headers must have been removed
+		int body_start = int(response_header(chunk_size).size());
+		if (r == 0) TEST_CHECK(std::memcmp(&buf[0] + body_start, body.c_str(), body.size()) == 0);
+	}
+
+	buf.assign(resp.begin(), resp.end());
+	double web_seed_seconds = 0;
+	for (int r = 0; r < rounds; ++r)
+	{
+		ptime start = time_now_hires();
+		int size = parse_web_seed(buf);
+		web_seed_seconds += total_microseconds(time_now_hires() - start) / 1000000.;
+		TEST_EQUAL(size, int(body.size()));
+	}
+
+	const double megabytes = double(body.size()) * rounds / (1024 * 1024);
+	char name[50];
+	if (chunk_size > 0) snprintf(name, sizeof(name), "chunked %d kiB", chunk_size / 1024);
+	else snprintf(name, sizeof(name), "content-length");
+	fprintf(stderr, "%-16s | bottled: %8.1f MB/s | web seed: %8.1f MB/s\n"
+		, name, megabytes / bottled_seconds, megabytes / web_seed_seconds);
+}
+
+void benchmark_tracker_response()
+{
+	std::string body = "d8:completei12e10:incompletei3e8:intervali1800e5:peers300:";
+	for (int i = 0; i < 300; ++i) body += char(rand());
+	body += "e";
+	char buf[100];
+	snprintf(buf, sizeof(buf), "Content-Length: %d\r\n\r\n", int(body.size()));
+	std::string const resp = "HTTP/1.1 200 OK\r\n"
+		"Date: Sat, 01 Sep 2012 12:00:00 GMT\r\n"
+		"Server: opentracker\r\n"
+		"Content-Type: text/plain\r\n"
+		"Pragma: no-cache\r\n"
+		"Cache-Control: no-cache\r\n"
+		"Connection: keep-alive\r\n"
+		+ std::string(buf) + body;
+
+	const int num_messages = 200000;
+	http_parser parser;
+	buffer::const_interval recv(resp.c_str(), resp.c_str() + resp.size());
+	ptime start = time_now_hires();
+	for (int i = 0; i < num_messages; ++i)
+	{
+		parser.reset();
+		bool error = false;
+		parser.incoming(recv, error);
+		TEST_CHECK(parser.finished());
+	}
+	double seconds = total_microseconds(time_now_hires() - start) / 1000000.;
+	TEST_EQUAL(parser.header("server"), "opentracker");
+	fprintf(stderr, "%-16s | %8.0f responses/s\n", "tracker response"
+		, num_messages / seconds);
+}
+
+int test_main()
+{
+	std::string body(body_size, '\0');
+	for (int i = 0; i < body_size; ++i) body[i] = char(rand());
+
+	benchmark(body, 0);
+	benchmark(body, 1024);
+	benchmark(body, 16 * 1024);
+	benchmark(body, 256 * 1024);
+
+	benchmark_tracker_response();
+	return 0;
+}
+
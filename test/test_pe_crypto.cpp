@@ -36,6 +36,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/hasher.hpp"
 #include "libtorrent/pe_crypto.hpp"
 #include "libtorrent/session.hpp"
+#include "libtorrent/time.hpp"
 
 #include "setup_transfer.hpp"
 #include "test.hpp"
@@ -152,6 +153,59 @@ void test_enc_handler(libtorrent::encryption_handler* a, libtorrent::encryption_
 	}
 }
 
+// encrypting a chain of buffers in one call must yield the same bytes
+// as encrypting them as one contiguous buffer
+void test_enc_buffers(libtorrent::encryption_handler* a, libtorrent::encryption_handler* b)
+{
+	using namespace libtorrent;
+
+	std::vector<char> buf(64 * 1024);
+	std::generate(buf.begin(), buf.end(), &std::rand);
+	std::vector<char> cmp_buf = buf;
+
+	std::vector<asio::mutable_buffer> iovec;
+	int pos = 0;
+	while (pos < int(buf.size()))
+	{
+		int len = (std::min)(int(buf.size()) - pos, rand() % 3000);
+		iovec.push_back(asio::mutable_buffer(&buf[pos], len));
+		pos += len;
+	}
+
+	a->encrypt_buffers(iovec);
+	b->encrypt(&cmp_buf[0], cmp_buf.size());
+	TEST_CHECK(buf == cmp_buf);
+}
+
+// reports the throughput of encrypting send buffers in chunks of
+// 16 kiB, the size of a block, 16 chunks at a time
+void benchmark_rc4()
+{
+	using namespace libtorrent;
+
+	sha1_hash key = hasher("benchmark_key", 13).final();
+	rc4_handler rc4;
+	rc4.set_outgoing_key(&key[0], 20);
+
+	const int chunk_size = 16 * 1024;
+	const int num_chunks = 16;
+	const int total_size = 256 * 1024 * 1024;
+
+	std::vector<char> buf(chunk_size * num_chunks);
+	std::generate(buf.begin(), buf.end(), &std::rand);
+	std::vector<asio::mutable_buffer> iovec;
+	for (int i = 0; i < num_chunks; ++i)
+		iovec.push_back(asio::mutable_buffer(&buf[i * chunk_size], chunk_size));
+
+	ptime start = time_now_hires();
+	for (int i = 0; i < total_size; i += int(buf.size()))
+		rc4.encrypt_buffers(iovec);
+	double seconds = total_microseconds(time_now_hires() - start) / 1000000.;
+
+	fprintf(stderr, "RC4 encrypt: %.1f MB/s\n"
+		, seconds > 0. ? total_size / seconds / 1000000. : 0.);
+}
+
 int test_main()
 {
 	using namespace libtorrent;
@@ -184,6 +238,14 @@ int test_main()
 	rc42.set_incoming_key(&test1_key[0], 20);
 	rc42.set_outgoing_key(&test2_key[0], 20);
 	test_enc_handler(&rc41, &rc42);
+
+	rc4_handler rc43;
+	rc43.set_outgoing_key(&test1_key[0], 20);
+	rc4_handler rc44;
+	rc44.set_outgoing_key(&test1_key[0], 20);
+	test_enc_buffers(&rc43, &rc44);
+
+	benchmark_rc4();
 	
 #ifdef TORRENT_USE_OPENSSL
 	fprintf(stderr, "testing AES-256 handler\n");
@@ -0,0 +1,224 @@
+/*
+
+Copyright (c) 2013, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/session.hpp"
+#include "libtorrent/torrent.hpp"
+#include "libtorrent/policy.hpp"
+#include "libtorrent/peer_info.hpp"
+#include "libtorrent/create_torrent.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/thread.hpp"
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <climits>
+
+#include "test.hpp"
+#include "setup_transfer.hpp"
+
+using namespace libtorrent;
+
+void call_and_signal(boost::function<void()> const& f, mutex& m
+	, condition& c, bool* done)
+{
+	f();
+	mutex::scoped_lock l(m);
+	*done = true;
+	c.signal_all(l);
+}
+
+// the policy may only be used from the network thread. This
+// runs f there and waits for it to return
+void run_on_network_thread(session& ses, boost::function<void()> const& f)
+{
+	mutex m;
+	condition c;
+	bool done = false;
+	ses.get_io_service().post(boost::bind(&call_and_signal, boost::cref(f)
+		, boost::ref(m), boost::ref(c), &done));
+	mutex::scoped_lock l(m);
+	while (!done) c.wait(l);
+}
+
+tcp::endpoint ep(int a, int b, int c, int d, int port = 6881)
+{
+	return tcp::endpoint(address_v4((a << 24) | (b << 16) | (c << 8) | d), port);
+}
+
+int const sources[] = { peer_info::pex, peer_info::tracker, peer_info::dht
+	, peer_info::lsd, peer_info::resume_data };
+int const num_sources = sizeof(sources) / sizeof(sources[0]);
+
+void test_candidate_order(torrent* t)
+{
+	policy& p = t->get_policy();
+
+	// with no failures and no connection attempts, candidates
+	// are ordered by the rank of their source
+	for (int i = 0; i < num_sources; ++i)
+		p.add_peer(ep(80, 0, 0, i + 1), peer_id(0), sources[i], 0);
+	TEST_EQUAL(p.num_peers(), num_sources);
+	TEST_EQUAL(p.num_connect_candidates(), num_sources);
+
+	int const expected[] = { peer_info::tracker, peer_info::lsd, peer_info::dht
+		, peer_info::pex, peer_info::resume_data };
+	for (int i = 0; i < num_sources; ++i)
+	{
+		policy::peer* c = p.find_connect_candidate(1000);
+		TEST_CHECK(c != 0);
+		if (c == 0) return;
+		TEST_EQUAL(c->source, expected[i]);
+		p.erase_peer(c);
+		TEST_EQUAL(p.num_connect_candidates(), num_sources - i - 1);
+	}
+	TEST_CHECK(p.find_connect_candidate(1000) == 0);
+
+	// erase peers from the middle of the heap, and make sure
+	// the rest still come out best first
+	for (int i = 0; i < 200; ++i)
+		p.add_peer(ep(81, 0, 0, i + 1), peer_id(0), sources[i % num_sources], 0);
+	TEST_EQUAL(p.num_connect_candidates(), 200);
+
+	for (int i = 0; i < 200; i += 3)
+	{
+		policy::peer* pe = p.find_peer(ep(81, 0, 0, i + 1));
+		TEST_CHECK(pe != 0);
+		if (pe) p.erase_peer(pe);
+	}
+	int left = p.num_connect_candidates();
+	TEST_EQUAL(left, 200 - 67);
+
+	int last_rank = INT_MAX;
+	while (policy::peer* c = p.find_connect_candidate(1000))
+	{
+		int rank = source_rank(c->source);
+		TEST_CHECK(rank <= last_rank);
+		last_rank = rank;
+		p.erase_peer(c);
+		--left;
+	}
+	TEST_EQUAL(left, 0);
+	TEST_EQUAL(p.num_peers(), 0);
+}
+
+// every peer in the list knows its own position, and can be
+// found through the endpoint index
+void check_peer_list(policy& p)
+{
+	int pos = 0;
+	for (policy::iterator i = p.begin_peer(), end(p.end_peer()); i != end; ++i, ++pos)
+	{
+		TEST_EQUAL(int((*i)->index), pos);
+		TEST_CHECK(p.find_peer((*i)->ip()) == *i);
+		TEST_CHECK(p.find_peer((*i)->address()) == *i);
+	}
+}
+
+void test_peer_index(torrent* t)
+{
+	policy& p = t->get_policy();
+	TEST_EQUAL(p.num_peers(), 0);
+
+	// enough peers to grow the index a few times
+	for (int i = 0; i < 500; ++i)
+		p.add_peer(ep(82, 0, i >> 8, i & 0xff, 1000 + i), peer_id(0), peer_info::tracker, 0);
+	TEST_EQUAL(p.num_peers(), 500);
+	check_peer_list(p);
+	TEST_CHECK(p.find_peer(ep(82, 0, 0, 1, 1001)) != 0);
+	// the port has to match too
+	TEST_CHECK(p.find_peer(ep(82, 0, 0, 1, 1000)) == 0);
+	TEST_CHECK(p.find_peer(ep(83, 0, 0, 1, 1001)) == 0);
+
+	// erasing a peer moves the last one into its place
+	policy::peer* last = *(p.end_peer() - 1);
+	p.erase_peer(*p.begin_peer());
+	TEST_EQUAL(p.num_peers(), 499);
+	TEST_CHECK(*p.begin_peer() == last);
+	TEST_EQUAL(int(last->index), 0);
+	TEST_CHECK(p.find_peer(ep(82, 0, 0, 0, 1000)) == 0);
+	check_peer_list(p);
+
+	// erasing the last peer doesn't move anything
+	last = *(p.end_peer() - 1);
+	policy::peer* before_last = *(p.end_peer() - 2);
+	p.erase_peer(last);
+	TEST_CHECK(*(p.end_peer() - 1) == before_last);
+	check_peer_list(p);
+
+	// erase all but a few, which shrinks the index. The ones
+	// left are still found
+	for (int i = 0; i < 500; ++i)
+	{
+		if (i % 50 == 7) continue;
+		policy::peer* pe = p.find_peer(ep(82, 0, i >> 8, i & 0xff, 1000 + i));
+		if (pe) p.erase_peer(pe);
+	}
+	TEST_EQUAL(p.num_peers(), 10);
+	check_peer_list(p);
+	for (int i = 7; i < 500; i += 50)
+		TEST_CHECK(p.find_peer(ep(82, 0, i >> 8, i & 0xff, 1000 + i)) != 0);
+
+	while (p.num_peers() > 0) p.erase_peer(*p.begin_peer());
+}
+
+int test_main()
+{
+	file_storage fs;
+	fs.add_file("test_policy_dir/tmp1", 0x4000);
+	libtorrent::create_torrent ct(fs, 0x4000);
+	ct.set_hash(0, sha1_hash(0));
+
+	std::vector<char> tmp;
+	std::back_insert_iterator<std::vector<char> > out(tmp);
+	bencode(out, ct.generate());
+	error_code ec;
+	boost::intrusive_ptr<torrent_info> info(new torrent_info(&tmp[0], tmp.size(), ec));
+	TEST_CHECK(!ec);
+
+	session ses(fingerprint("LT", 0, 1, 0, 0), std::make_pair(48170, 48180), "0.0.0.0", 0);
+
+	// a paused torrent doesn't connect to the peers we add
+	add_torrent_params p;
+	p.ti = info;
+	p.save_path = ".";
+	p.flags |= add_torrent_params::flag_paused;
+	p.flags &= ~add_torrent_params::flag_auto_managed;
+	torrent_handle h = ses.add_torrent(p, ec);
+	boost::shared_ptr<torrent> t = h.native_handle();
+	TEST_CHECK(t);
+	if (!t) return 1;
+
+	run_on_network_thread(ses, boost::bind(&test_candidate_order, t.get()));
+	run_on_network_thread(ses, boost::bind(&test_peer_index, t.get()));
+
+	return 0;
+}
+
@@ -49,6 +49,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/timestamp_history.hpp"
 #include "libtorrent/enum_net.hpp"
 #include "libtorrent/bloom_filter.hpp"
+#include "libtorrent/slab_allocator.hpp"
+#include "libtorrent/alert_types.hpp"
+#include "libtorrent/session_stats.hpp"
+#include "libtorrent/timer_wheel.hpp"
+#include "libtorrent/connection_queue.hpp"
 #include "libtorrent/aux_/session_impl.hpp"
 #include "libtorrent/rsa.hpp"
 #ifndef TORRENT_DISABLE_DHT
@@ -163,6 +168,15 @@ void nop(void* userdata, libtorrent::dht::node_entry const& n) {}
 
 #endif
 
+void cq_connect(std::vector<int>* connected, int id, int ticket)
+{
+	if (ticket == -1) return;
+	connected->push_back(id);
+	connected->push_back(ticket);
+}
+
+void cq_timeout(int* timeouts) { ++*timeouts; }
+
 char upnp_xml[] = 
 "<root>"
 "<specVersion>"
@@ -445,83 +459,84 @@ int test_main()
 
 	// test verify_message
 	const static key_desc_t msg_desc[] = {
-		{"A", lazy_entry::string_t, 4, 0},
-		{"B", lazy_entry::dict_t, 0, key_desc_t::optional | key_desc_t::parse_children},
-			{"B1", lazy_entry::string_t, 0, 0},
-			{"B2", lazy_entry::string_t, 0, key_desc_t::last_child},
-		{"C", lazy_entry::dict_t, 0, key_desc_t::optional | key_desc_t::parse_children},
-			{"C1", lazy_entry::string_t, 0, 0},
-			{"C2", lazy_entry::string_t, 0, key_desc_t::last_child},
+		{"A", bdecode_node::string_t, 4, 0},
+		{"B", bdecode_node::dict_t, 0, key_desc_t::optional | key_desc_t::parse_children},
+			{"B1", bdecode_node::string_t, 0, 0},
+			{"B2", bdecode_node::string_t, 0, key_desc_t::last_child},
+		{"C", bdecode_node::dict_t, 0, key_desc_t::optional | key_desc_t::parse_children},
+			{"C1", bdecode_node::string_t, 0, 0},
+			{"C2", bdecode_node::string_t, 0, key_desc_t::last_child},
 	};
 
-	lazy_entry const* msg_keys[7];
+	bdecode_node msg_keys[7];
 
-	lazy_entry ent;
+	bdecode_node decoded;
 
 	char const test_msg[] = "d1:A4:test1:Bd2:B15:test22:B25:test3ee";
-	lazy_bdecode(test_msg, test_msg + sizeof(test_msg)-1, ent, ec);
-	fprintf(stderr, "%s\n", print_entry(ent).c_str());
+	bdecode(test_msg, test_msg + sizeof(test_msg)-1, decoded, ec);
+	fprintf(stderr, "%s\n", print_entry(decoded).c_str());
 
 	char error_string[200];
-	ret = verify_message(&ent, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
+	ret = verify_message(decoded, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
 	TEST_CHECK(ret);
 	TEST_CHECK(msg_keys[0]);
-	if (msg_keys[0]) TEST_EQUAL(msg_keys[0]->string_value(), "test");
+	if (msg_keys[0]) TEST_EQUAL(msg_keys[0].string_value(), "test");
 	TEST_CHECK(msg_keys[1]);
 	TEST_CHECK(msg_keys[2]);
-	if (msg_keys[2]) TEST_EQUAL(msg_keys[2]->string_value(), "test2");
+	if (msg_keys[2]) TEST_EQUAL(msg_keys[2].string_value(), "test2");
 	TEST_CHECK(msg_keys[3]);
-	if (msg_keys[3]) TEST_EQUAL(msg_keys[3]->string_value(), "test3");
-	TEST_CHECK(msg_keys[4] == 0);
-	TEST_CHECK(msg_keys[5] == 0);
-	TEST_CHECK(msg_keys[6] == 0);
+	if (msg_keys[3]) TEST_EQUAL(msg_keys[3].string_value(), "test3");
+	TEST_CHECK(!msg_keys[4]);
+	TEST_CHECK(!msg_keys[5]);
+	TEST_CHECK(!msg_keys[6]);
 
 	char const test_msg2[] = "d1:A4:test1:Cd2:C15:test22:C25:test3ee";
-	lazy_bdecode(test_msg2, test_msg2 + sizeof(test_msg2)-1, ent, ec);
-	fprintf(stderr, "%s\n", print_entry(ent).c_str());
+	bdecode(test_msg2, test_msg2 + sizeof(test_msg2)-1, decoded, ec);
+	fprintf(stderr, "%s\n", print_entry(decoded).c_str());
 
-	ret = verify_message(&ent, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
+	ret = verify_message(decoded, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
 	TEST_CHECK(ret);
 	TEST_CHECK(msg_keys[0]);
-	if (msg_keys[0]) TEST_EQUAL(msg_keys[0]->string_value(), "test");
-	TEST_CHECK(msg_keys[1] == 0);
-	TEST_CHECK(msg_keys[2] == 0);
-	TEST_CHECK(msg_keys[3] == 0);
+	if (msg_keys[0]) TEST_EQUAL(msg_keys[0].string_value(), "test");
+	TEST_CHECK(!msg_keys[1]);
+	TEST_CHECK(!msg_keys[2]);
+	TEST_CHECK(!msg_keys[3]);
 	TEST_CHECK(msg_keys[4]);
 	TEST_CHECK(msg_keys[5]);
-	if (msg_keys[5]) TEST_EQUAL(msg_keys[5]->string_value(), "test2");
+	if (msg_keys[5]) TEST_EQUAL(msg_keys[5].string_value(), "test2");
 	TEST_CHECK(msg_keys[6]);
-	if (msg_keys[6]) TEST_EQUAL(msg_keys[6]->string_value(), "test3");
+	if (msg_keys[6]) TEST_EQUAL(msg_keys[6].string_value(), "test3");
 
 
 	char const test_msg3[] = "d1:Cd2:C15:test22:C25:test3ee";
-	lazy_bdecode(test_msg3, test_msg3 + sizeof(test_msg3)-1, ent, ec);
-	fprintf(stderr, "%s\n", print_entry(ent).c_str());
+	bdecode(test_msg3, test_msg3 + sizeof(test_msg3)-1, decoded, ec);
+	fprintf(stderr, "%s\n", print_entry(decoded).c_str());
 
-	ret = verify_message(&ent, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
+	ret = verify_message(decoded, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
 	TEST_CHECK(!ret);
 	fprintf(stderr, "%s\n", error_string);
 	TEST_EQUAL(error_string, std::string("missing 'A' key"));
 
 	char const test_msg4[] = "d1:A6:foobare";
-	lazy_bdecode(test_msg4, test_msg4 + sizeof(test_msg4)-1, ent, ec);
-	fprintf(stderr, "%s\n", print_entry(ent).c_str());
+	bdecode(test_msg4, test_msg4 + sizeof(test_msg4)-1, decoded, ec);
+	fprintf(stderr, "%s\n", print_entry(decoded).c_str());
 
-	ret = verify_message(&ent, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
+	ret = verify_message(decoded, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
 	TEST_CHECK(!ret);
 	fprintf(stderr, "%s\n", error_string);
 	TEST_EQUAL(error_string, std::string("invalid value for 'A'"));
 
 	char const test_msg5[] = "d1:A4:test1:Cd2:C15:test2ee";
-	lazy_bdecode(test_msg5, test_msg5 + sizeof(test_msg5)-1, ent, ec);
-	fprintf(stderr, "%s\n", print_entry(ent).c_str());
+	bdecode(test_msg5, test_msg5 + sizeof(test_msg5)-1, decoded, ec);
+	fprintf(stderr, "%s\n", print_entry(decoded).c_str());
 
-	ret = verify_message(&ent, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
+	ret = verify_message(decoded, msg_desc, msg_keys, 7, error_string, sizeof(error_string));
 	TEST_CHECK(!ret);
 	fprintf(stderr, "%s\n", error_string);
 	TEST_EQUAL(error_string, std::string("missing 'C2' key"));
 
 	// test empty strings [ { "":1 }, "" ]
+	lazy_entry ent;
 	char const test_msg6[] = "ld0:i1ee0:e";
 	lazy_bdecode(test_msg6, test_msg6 + sizeof(test_msg6)-1, ent, ec);
 	fprintf(stderr, "%s\n", print_entry(ent).c_str());
@@ -608,6 +623,252 @@ int test_main()
 	TEST_CHECK(!filter.find(k3));
 	TEST_CHECK(filter.find(k4));
 
+	// test slab_allocator
+	{
+		slab_allocator<boost::uint64_t, 64> slab;
+		std::vector<boost::uint64_t*> allocs;
+		for (int i = 0; i < 200; ++i)
+		{
+			boost::uint64_t* p = slab.malloc();
+			TEST_CHECK(p != 0);
+			TEST_CHECK(slab.is_from(p));
+			*p = i;
+			allocs.push_back(p);
+		}
+		TEST_EQUAL(slab.size(), 200);
+		// chunks of 32, 64, 64 and 64 slots
+		TEST_EQUAL(slab.num_chunks(), 4);
+		TEST_EQUAL(slab.capacity(), 224);
+		for (int i = 0; i < 200; ++i)
+			TEST_EQUAL(*allocs[i], boost::uint64_t(i));
+
+		boost::uint64_t local;
+		TEST_CHECK(!slab.is_from(&local));
+
+		// freed slots are reused before allocating more memory
+		for (int i = 0; i < 100; ++i) slab.free(allocs[i]);
+		TEST_EQUAL(slab.size(), 100);
+		for (int i = 0; i < 100; ++i) allocs[i] = slab.malloc();
+		TEST_EQUAL(slab.capacity(), 224);
+
+		for (int i = 0; i < 200; ++i) slab.free(allocs[i]);
+		TEST_EQUAL(slab.size(), 0);
+
+		slab.release_memory();
+		TEST_EQUAL(slab.num_chunks(), 0);
+		TEST_EQUAL(slab.capacity(), 0);
+		TEST_CHECK(!slab.is_from(allocs[0]));
+		allocs[0] = slab.malloc();
+		TEST_CHECK(allocs[0] != 0);
+		TEST_EQUAL(slab.capacity(), 32);
+		slab.free(allocs[0]);
+	}
+
+	// test alert_manager
+	{
+		io_service ios;
+		alert_manager mgr(ios, 10, alert::all_categories);
+		std::vector<alert*> batch;
+		mgr.get_batch(batch);
+		TEST_CHECK(batch.empty());
+
+		TEST_CHECK(mgr.should_post<dht_get_peers_alert>());
+		for (int i = 0; i < 3; ++i)
+			mgr.post_alert(dht_get_peers_alert(sha1_hash(0)));
+		mgr.post_alert_ptr(new listen_succeeded_alert(tcp::endpoint()));
+		TEST_CHECK(mgr.pending());
+
+		mgr.get_batch(batch);
+		TEST_EQUAL(batch.size(), 4);
+		TEST_CHECK(alert_cast<dht_get_peers_alert>(batch[0]));
+		TEST_CHECK(alert_cast<listen_succeeded_alert>(batch[3]));
+		TEST_CHECK(!mgr.pending());
+
+		// the batch stays valid while new alerts are posted
+		mgr.post_alert(listen_succeeded_alert(tcp::endpoint()));
+		mgr.post_alert(dht_get_peers_alert(sha1_hash(0)));
+		TEST_CHECK(alert_cast<dht_get_peers_alert>(batch[2]));
+
+		std::auto_ptr<alert> a = mgr.get();
+		TEST_CHECK(alert_cast<listen_succeeded_alert>(a.get()));
+		mgr.get_batch(batch);
+		TEST_EQUAL(batch.size(), 1);
+		TEST_CHECK(alert_cast<dht_get_peers_alert>(batch[0]));
+
+		// discardable alerts are dropped when the queue is full
+		for (int i = 0; i < 20; ++i)
+			mgr.post_alert(dht_get_peers_alert(sha1_hash(0)));
+		TEST_CHECK(!mgr.should_post<dht_get_peers_alert>());
+		mgr.post_alert(listen_succeeded_alert(tcp::endpoint()));
+
+		std::deque<alert*> alerts;
+		mgr.get_all(&alerts);
+		TEST_EQUAL(alerts.size(), 11);
+		TEST_CHECK(alert_cast<listen_succeeded_alert>(alerts.back()));
+		for (std::deque<alert*>::iterator i = alerts.begin()
+			, end(alerts.end()); i != end; ++i)
+			delete *i;
+		TEST_CHECK(mgr.should_post<dht_get_peers_alert>());
+	}
+
+	// test torrent_delta
+	{
+		typedef torrent_delta td;
+		torrent_delta d;
+		d.changed = td::field_bit(td::state) | td::field_bit(td::download_rate)
+			| td::field_bit(td::last_seen_complete);
+		d.values.push_back(3);
+		d.values.push_back(1024);
+		d.values.push_back(-1);
+		TEST_CHECK(d.has(td::state));
+		TEST_CHECK(d.has(td::download_rate));
+		TEST_CHECK(d.has(td::last_seen_complete));
+		TEST_CHECK(!d.has(td::upload_rate));
+		TEST_CHECK(!d.has(td::paused));
+		TEST_EQUAL(d.value(td::state), 3);
+		TEST_EQUAL(d.value(td::download_rate), 1024);
+		TEST_EQUAL(d.value(td::last_seen_complete), -1);
+		TEST_CHECK(td::num_fields <= 64);
+	}
+
+	// test session stats metrics
+	{
+		// every counter and gauge has exactly one, unique, name
+		std::vector<stats_metric> stats = session_stats_metrics();
+		TEST_EQUAL(stats.size(), counters::num_counters);
+		std::vector<int> seen(counters::num_counters, 0);
+		std::set<std::string> names;
+		for (std::vector<stats_metric>::iterator i = stats.begin()
+			, end(stats.end()); i != end; ++i)
+		{
+			TEST_CHECK(i->value_index >= 0 && i->value_index < counters::num_counters);
+			if (i->value_index < 0 || i->value_index >= counters::num_counters) continue;
+			++seen[i->value_index];
+			TEST_CHECK(names.insert(i->name).second);
+			TEST_CHECK((i->type == stats_metric::type_gauge)
+				== (i->value_index >= counters::num_stats_counters));
+			TEST_EQUAL(find_metric_idx(i->name), i->value_index);
+		}
+		TEST_CHECK(std::count(seen.begin(), seen.end(), 1) == counters::num_counters);
+
+		TEST_EQUAL(find_metric_idx("peer.disconnected_peers"), counters::disconnected_peers);
+		TEST_EQUAL(find_metric_idx("sock_bufs.socket_recv_size20"), counters::socket_recv_size20);
+		TEST_EQUAL(find_metric_idx("ses.num_seeding_torrents"), counters::num_seeding_torrents);
+		TEST_EQUAL(find_metric_idx("no.such_metric"), -1);
+
+		counters cnt;
+		TEST_EQUAL(cnt[counters::piece_requests], 0);
+		cnt.inc_stats_counter(counters::piece_requests);
+		TEST_EQUAL(cnt.inc_stats_counter(counters::piece_requests, 10), 11);
+		cnt.set_value(counters::num_peers_connected, 5);
+
+		session_stats_alert a(cnt);
+		TEST_EQUAL(a.values[counters::piece_requests], 11);
+		TEST_EQUAL(a.values[counters::num_peers_connected], 5);
+		TEST_EQUAL(a.values[counters::connect_timeouts], 0);
+		TEST_CHECK(!a.discardable());
+	}
+
+	// test timer_wheel
+	{
+		timer_wheel w(100);
+		std::vector<timer_entry*> expired;
+
+		// one timer on each level of the wheel, one in the past
+		// and one beyond the horizon
+		boost::uint32_t expiry[] = { 150, 100 + 64 * 64 + 7
+			, 100 + 64 * 64 * 64 + 3, 90, 100 + 300000, 100 + 20000000 };
+		int const num_timers = sizeof(expiry) / sizeof(expiry[0]);
+		timer_entry e[num_timers];
+		for (int i = 0; i < num_timers; ++i)
+		{
+			e[i].userdata = &expiry[i];
+			w.schedule(&e[i], expiry[i]);
+			TEST_CHECK(e[i].scheduled());
+		}
+		TEST_EQUAL(w.size(), num_timers);
+		TEST_EQUAL(w.next_expiry(), 100);
+
+		// the timer in the past expires on the first tick
+		w.advance(100, expired);
+		TEST_EQUAL(expired.size(), 1);
+		TEST_CHECK(expired[0] == &e[3]);
+		TEST_EQUAL(w.next_expiry(), 150);
+
+		w.cancel(&e[4]);
+		TEST_CHECK(!e[4].scheduled());
+		TEST_EQUAL(w.size(), num_timers - 2);
+
+		// every timer expires exactly at its tick
+		for (int i = 0; i < 3; ++i)
+		{
+			TEST_EQUAL(w.next_expiry(), expiry[i]);
+			expired.clear();
+			w.advance(expiry[i] - 1, expired);
+			TEST_CHECK(expired.empty());
+			TEST_EQUAL(w.next_expiry(), expiry[i]);
+			w.advance(expiry[i], expired);
+			TEST_EQUAL(expired.size(), 1);
+			TEST_CHECK(expired[0] == &e[i]);
+			TEST_CHECK(!e[i].scheduled());
+		}
+
+		// timers beyond the horizon are clamped to it
+		TEST_EQUAL(w.next_expiry(), 100 + 20000000);
+		expired.clear();
+		w.advance(100 + 20000000, expired);
+		TEST_EQUAL(expired.size(), 1);
+		TEST_CHECK(expired[0] == &e[5]);
+		TEST_EQUAL(w.size(), 0);
+
+		// rescheduling moves the timer
+		w.schedule(&e[0], w.current_tick() + 10);
+		w.schedule(&e[0], w.current_tick() + 20);
+		TEST_EQUAL(w.size(), 1);
+		TEST_EQUAL(w.next_expiry(), w.current_tick() + 20);
+		expired.clear();
+		w.advance(w.current_tick() + 15, expired);
+		TEST_CHECK(expired.empty());
+		w.advance(w.current_tick() + 10, expired);
+		TEST_EQUAL(expired.size(), 1);
+	}
+
+	// test connection_queue
+	{
+		io_service ios;
+		connection_queue cq(ios);
+		cq.limit(4);
+		std::vector<int> connected;
+		int timeouts = 0;
+		for (int i = 0; i < 10; ++i)
+		{
+			cq.enqueue(boost::bind(&cq_connect, &connected, i, _1)
+				, boost::bind(&cq_timeout, &timeouts), seconds(10), i == 9 ? 1 : 0);
+		}
+
+		// a single wakeup connects a whole batch, and
+		// priority entries are connected first
+		ios.poll();
+		TEST_EQUAL(connected.size(), 8);
+		TEST_EQUAL(connected[0], 9);
+		TEST_EQUAL(cq.num_connecting(), 4);
+		TEST_EQUAL(cq.size(), 10);
+
+		// completing a connection more than once has no effect
+		cq.done(connected[1]);
+		cq.done(connected[1]);
+		TEST_EQUAL(cq.num_connecting(), 3);
+		ios.reset();
+		ios.poll();
+		TEST_EQUAL(connected.size(), 10);
+		TEST_EQUAL(cq.size(), 9);
+
+		// closing the queue times out the connecting entries
+		cq.close();
+		TEST_EQUAL(timeouts, 4);
+		TEST_EQUAL(cq.size(), 0);
+	}
+
 	// test timestamp_history
 	{
 		timestamp_history h;
@@ -1529,6 +1790,33 @@ int test_main()
 	TEST_CHECK(ti3.name() == "test2/test3/test4");
 #endif
 
+	// test unloading and reloading the metadata
+	std::string section(ti.metadata().get(), ti.metadata_size());
+	TEST_CHECK(ti.is_loaded());
+	size_type loaded_memory = ti.memory_usage();
+	ti.unload();
+	TEST_CHECK(!ti.is_loaded());
+	TEST_CHECK(ti.memory_usage() < loaded_memory);
+	TEST_EQUAL(ti.num_files(), 0);
+	TEST_EQUAL(ti.num_pieces(), 1);
+	TEST_EQUAL(ti.total_size(), 3245);
+	TEST_CHECK(ti.name() == "test1");
+
+	// the info section of another torrent is rejected
+	std::string other(ti3.metadata().get(), ti3.metadata_size());
+	TEST_CHECK(!ti.load(other.c_str(), other.size(), ec));
+	TEST_CHECK(ec == error_code(errors::mismatching_info_hash, get_libtorrent_category()));
+	TEST_CHECK(!ti.is_loaded());
+
+	ec.clear();
+	TEST_CHECK(ti.load(section.c_str(), section.size(), ec));
+	TEST_CHECK(!ec);
+	TEST_CHECK(ti.is_loaded());
+	TEST_EQUAL(ti.num_files(), 1);
+	TEST_EQUAL(ti.file_at(0).size, 3245);
+	TEST_CHECK(ti.hash_for_piece(0) == sha1_hash("aaaaaaaaaaaaaaaaaaaa"));
+	TEST_EQUAL(ti.memory_usage(), loaded_memory);
+
 #ifndef TORRENT_DISABLE_DHT	
 	// test kademlia functions
 
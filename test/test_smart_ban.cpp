@@ -0,0 +1,206 @@
+/*
+
+Copyright (c) 2013, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include "libtorrent/session.hpp"
+#include "libtorrent/torrent.hpp"
+#include "libtorrent/policy.hpp"
+#include "libtorrent/piece_picker.hpp"
+#include "libtorrent/peer_info.hpp"
+#include "libtorrent/alert_types.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/extensions.hpp"
+#include "libtorrent/extensions/smart_ban.hpp"
+#include "libtorrent/thread.hpp"
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <fstream>
+
+#include "test.hpp"
+#include "setup_transfer.hpp"
+
+using namespace libtorrent;
+
+int const block_size = 0x4000;
+
+void call_and_signal(boost::function<void()> const& f, mutex& m
+	, condition& c, bool* done)
+{
+	f();
+	mutex::scoped_lock l(m);
+	*done = true;
+	c.signal_all(l);
+}
+
+// the plugin, the policy and the piece picker may only be used
+// from the network thread. This runs f there and waits for it
+void run_on_network_thread(session& ses, boost::function<void()> const& f)
+{
+	mutex m;
+	condition c;
+	bool done = false;
+	ses.get_io_service().post(boost::bind(&call_and_signal, boost::cref(f)
+		, boost::ref(m), boost::ref(c), &done));
+	mutex::scoped_lock l(m);
+	while (!done) c.wait(l);
+}
+
+// waits for the session counter idx to reach value. The smart ban
+// plugin hashes the blocks in a disk job, so its counters are the
+// only way to tell when it's done
+bool wait_for_counter(session& ses, int idx, boost::uint64_t value)
+{
+	for (int i = 0; i < 50; ++i)
+	{
+		ses.post_session_stats();
+		ses.wait_for_alert(milliseconds(100));
+		std::auto_ptr<alert> a = ses.pop_alert();
+		if (!a.get()) continue;
+		session_stats_alert const* s = alert_cast<session_stats_alert>(a.get());
+		if (s == 0) continue;
+		if (s->values[idx] >= value) return true;
+		test_sleep(100);
+	}
+	return false;
+}
+
+// writes the piece to the file. If corrupt is true, the second
+// block is garbage
+void write_piece(std::string const& path, bool corrupt)
+{
+	std::vector<char> piece(2 * block_size);
+	for (int i = 0; i < int(piece.size()); ++i)
+		piece[i] = (i % 26) + 'A';
+	if (corrupt) std::fill(piece.begin() + block_size, piece.end(), 'x');
+	std::ofstream f(path.c_str(), std::ios_base::binary | std::ios_base::trunc);
+	f.write(&piece[0], piece.size());
+}
+
+tcp::endpoint ep(int a, int b, int c, int d, int port = 6881)
+{
+	return tcp::endpoint(address_v4((a << 24) | (b << 16) | (c << 8) | d), port);
+}
+
+// the first block of piece 0 comes from one peer and the second
+// one, which is the corrupt one, from another
+void fail_piece(torrent* t, boost::shared_ptr<torrent_plugin> sb)
+{
+	policy& p = t->get_policy();
+	policy::peer* good = p.add_peer(ep(60, 0, 0, 1), peer_id(0), peer_info::tracker, 0);
+	policy::peer* bad = p.add_peer(ep(60, 0, 0, 2), peer_id(0), peer_info::tracker, 0);
+	TEST_CHECK(good != 0 && bad != 0);
+	if (good == 0 || bad == 0) return;
+
+	piece_picker& pp = t->picker();
+	policy::peer* senders[] = { good, bad };
+	for (int i = 0; i < 2; ++i)
+	{
+		piece_block b(0, i);
+		pp.mark_as_downloading(b, senders[i], piece_picker::medium);
+		pp.mark_as_writing(b, senders[i]);
+		pp.mark_as_finished(b, senders[i]);
+	}
+	sb->on_piece_failed(0);
+}
+
+void pass_piece(boost::shared_ptr<torrent_plugin> sb)
+{
+	sb->on_piece_pass(0);
+}
+
+void check_banned(torrent* t)
+{
+	policy& p = t->get_policy();
+	policy::peer* good = p.find_peer(ep(60, 0, 0, 1));
+	policy::peer* bad = p.find_peer(ep(60, 0, 0, 2));
+	TEST_CHECK(good != 0 && !good->banned);
+	TEST_CHECK(bad != 0 && bad->banned);
+}
+
+int test_main()
+{
+	error_code ec;
+	std::string save_path = "test_smart_ban";
+	create_directory(save_path, ec);
+	std::string path = combine_path(save_path, "temporary");
+
+	// a single piece of two blocks
+	boost::intrusive_ptr<torrent_info> info = ::create_torrent(0, 2 * block_size, 1, false);
+	write_piece(path, true);
+
+	session ses(fingerprint("LT", 0, 1, 0, 0), std::make_pair(48190, 48200), "0.0.0.0", 0);
+	ses.set_alert_mask(alert::stats_notification);
+
+	add_torrent_params p;
+	p.ti = info;
+	p.save_path = save_path;
+	p.flags &= ~(add_torrent_params::flag_paused | add_torrent_params::flag_auto_managed);
+	torrent_handle h = ses.add_torrent(p, ec);
+
+	torrent_status st;
+	for (int i = 0; i < 100; ++i)
+	{
+		st = h.status(0);
+		if (st.state != torrent_status::queued_for_checking
+			&& st.state != torrent_status::checking_files
+			&& st.state != torrent_status::checking_resume_data)
+			break;
+		test_sleep(100);
+	}
+	TEST_EQUAL(st.state, torrent_status::downloading);
+	TEST_EQUAL(st.num_pieces, 0);
+
+	// the torrent doesn't connect to the peers we add while it's paused
+	h.pause();
+	boost::shared_ptr<torrent> t = h.native_handle();
+	TEST_CHECK(t);
+	if (!t) return 1;
+
+	boost::shared_ptr<torrent_plugin> sb = create_smart_ban_plugin(t.get(), 0);
+
+	// the blocks of the failed piece are recorded with their senders
+	run_on_network_thread(ses, boost::bind(&fail_piece, t.get(), sb));
+	TEST_CHECK(wait_for_counter(ses, counters::smart_ban_blocks_recorded, 2));
+
+	// when the piece passes, the peer whose block differs from the
+	// good one is banned
+	write_piece(path, false);
+	run_on_network_thread(ses, boost::bind(&pass_piece, sb));
+	TEST_CHECK(wait_for_counter(ses, counters::smart_ban_peers_banned, 1));
+	run_on_network_thread(ses, boost::bind(&check_banned, t.get()));
+
+	ses.remove_torrent(h);
+	sb.reset();
+	t.reset();
+	remove_all(save_path, ec);
+	return 0;
+}
@@ -38,6 +38,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/aux_/session_impl.hpp"
 #include "libtorrent/create_torrent.hpp"
 #include "libtorrent/thread.hpp"
+#include "libtorrent/torrent_loader.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/escape_string.hpp" // for to_string
 
 #include <boost/utility.hpp>
 
@@ -70,6 +73,22 @@ void on_read_piece(int ret, disk_io_job const& j, char const* data, int size)
 	if (ret > 0) TEST_CHECK(std::equal(j.buffer, j.buffer + ret, data));
 }
 
+void on_hash_blocks(int ret, disk_io_job const& j, char const* data, int salt, bool* done)
+{
+	std::cerr << "on_hash_blocks piece: " << j.piece << std::endl;
+	*done = true;
+	TEST_EQUAL(ret, 0);
+	TEST_CHECK(j.block_hashes);
+	if (!j.block_hashes) return;
+	TEST_EQUAL(int(j.block_hashes->size()), piece_size / block_size);
+	for (int i = 0; i < int(j.block_hashes->size()); ++i)
+	{
+		hasher h(data + i * block_size, block_size);
+		h.update((char const*)&salt, sizeof(salt));
+		TEST_CHECK((*j.block_hashes)[i] == h.final());
+	}
+}
+
 void on_check_resume_data(int ret, disk_io_job const& j, bool* done)
 {
 	std::cerr << "on_check_resume_data ret: " << ret;
@@ -201,7 +220,7 @@ struct test_storage : storage_interface
 	virtual bool move_storage(std::string const&  save_path)
 	{ return false; }
 
-	virtual bool verify_resume_data(lazy_entry const& rd, error_code& error)
+	virtual bool verify_resume_data(bdecode_node const& rd, error_code& error)
 	{ return false; }
 
 	virtual bool write_resume_data(entry& rd) const
@@ -298,6 +317,200 @@ void add_job(disk_io_thread& dio, int piece, boost::intrusive_ptr<piece_manager>
 	dio.add_job(j, boost::bind(&callback, _1, _2));
 }
 
+void test_file_storage_index()
+{
+	file_storage fs;
+	fs.add_file("test/a/b/1", 0x2000);
+	fs.add_file("test/a/b/2", 0);
+	fs.add_file("test/a/c/3", 0x9000);
+	fs.add_file("test/4", 0x10);
+	fs.add_file("test/a/b/5", 0x7ff0);
+	fs.set_piece_length(0x4000);
+	fs.set_num_pieces(int((fs.total_size() + 0x3fff) / 0x4000));
+	TEST_EQUAL(fs.num_pieces(), 5);
+
+	std::string ab = combine_path(combine_path("test", "a"), "b");
+	TEST_EQUAL(fs.file_path(0), combine_path(ab, "1"));
+	TEST_EQUAL(fs.file_path(1), combine_path(ab, "2"));
+	TEST_EQUAL(fs.file_path(2), combine_path(combine_path(combine_path("test", "a"), "c"), "3"));
+	TEST_EQUAL(fs.file_path(3), combine_path("test", "4"));
+	TEST_EQUAL(fs.file_path(4), combine_path(ab, "5"));
+	TEST_EQUAL(fs.file_name(4), "5");
+
+	// the empty file is skipped
+	std::vector<file_slice> slices = fs.map_block(0, 0x2000, 0x4000);
+	TEST_EQUAL(slices.size(), 1);
+	TEST_EQUAL(slices[0].file_index, 2);
+	TEST_EQUAL(slices[0].offset, 0);
+	TEST_EQUAL(slices[0].size, 0x4000);
+
+	// a block spanning files
+	slices = fs.map_block(2, 0x3000, 0x1000);
+	TEST_EQUAL(slices.size(), 2);
+	TEST_EQUAL(slices[0].file_index, 3);
+	TEST_EQUAL(slices[0].offset, 0);
+	TEST_EQUAL(slices[0].size, 0x10);
+	TEST_EQUAL(slices[1].file_index, 4);
+	TEST_EQUAL(slices[1].offset, 0);
+	TEST_EQUAL(slices[1].size, 0xff0);
+
+	TEST_EQUAL(fs.file_at_offset(0xb010) - fs.begin(), 4);
+	TEST_EQUAL(fs.file_at_offset(0x12fff) - fs.begin(), 4);
+
+	peer_request r = fs.map_file(4, 0x10, 0x100);
+	TEST_EQUAL(r.piece, 2);
+	TEST_EQUAL(r.start, 0x3020);
+	TEST_EQUAL(r.length, 0x100);
+
+	fs.rename_file(3, "test/a/c/4");
+	TEST_EQUAL(fs.file_path(3), combine_path(combine_path(combine_path("test", "a"), "c"), "4"));
+	TEST_EQUAL(fs.file_name(3), "4");
+}
+
+void test_stat_cache()
+{
+	file_pool fp;
+	file_status s;
+	error_code ec;
+	TEST_CHECK(!fp.take_file_status("a", &s, ec));
+
+	s.file_size = 1337;
+	s.mtime = 42;
+	fp.cache_file_status("a", s, error_code());
+	s.file_size = 0;
+	fp.cache_file_status("b", s, error_code(boost::system::errc::no_such_file_or_directory
+		, get_posix_category()));
+	TEST_EQUAL(fp.stat_cache_size(), 2);
+
+	TEST_CHECK(fp.take_file_status("a", &s, ec));
+	TEST_CHECK(!ec);
+	TEST_EQUAL(s.file_size, 1337);
+	TEST_EQUAL(s.mtime, 42);
+
+	// entries are only used once
+	TEST_CHECK(!fp.take_file_status("a", &s, ec));
+
+	TEST_CHECK(fp.take_file_status("b", &s, ec));
+	TEST_CHECK(ec);
+	TEST_EQUAL(fp.stat_cache_size(), 0);
+
+	// the oldest entries are evicted once the cache is full
+	for (int i = 0; i < 10001; ++i)
+		fp.cache_file_status(to_string(i).elems, s, error_code());
+	TEST_EQUAL(fp.stat_cache_size(), 10000);
+	TEST_CHECK(!fp.take_file_status("0", &s, ec));
+	TEST_CHECK(fp.take_file_status("1", &s, ec));
+	TEST_CHECK(fp.take_file_status("10000", &s, ec));
+
+	// entries that are never looked up expire
+	fp.set_stat_cache_age(milliseconds(100));
+	fp.cache_file_status("c", s, error_code());
+	test_sleep(200);
+	TEST_CHECK(!fp.take_file_status("c", &s, ec));
+	TEST_EQUAL(fp.stat_cache_size(), 0);
+}
+
+void on_torrent_loaded(boost::shared_ptr<loaded_torrent> const& t, int* loaded)
+{
+	TEST_CHECK(!t->error);
+	TEST_CHECK(t->params.ti && t->params.ti->is_valid());
+	// the resume data is decoded on the loader thread
+	TEST_EQUAL(t->resume.type(), bdecode_node::dict_t);
+	TEST_EQUAL(t->resume.dict_find_string_value("file-format"), "libtorrent resume file");
+	++*loaded;
+}
+
+void test_torrent_loader(std::string const& test_path)
+{
+	std::cout << "\n\n=== test torrent_loader ===" << std::endl;
+	error_code ec;
+	std::string save_path = combine_path(test_path, "tmp_loader");
+	remove_all(save_path, ec);
+	create_directory(save_path, ec);
+	std::ofstream file(combine_path(save_path, "temporary").c_str());
+	boost::intrusive_ptr<torrent_info> t = ::create_torrent(&file);
+	file.close();
+
+	// the loader only stats the files if the resume data has file sizes
+	entry rd;
+	rd["file-format"] = "libtorrent resume file";
+	rd["file-version"] = 1;
+	rd["file sizes"] = entry::list_type();
+
+	io_service ios;
+	file_pool fp;
+	int loaded = 0;
+	std::vector<char> resume_data;
+	bencode(std::back_inserter(resume_data), rd);
+	add_torrent_params p;
+	p.save_path = save_path;
+	p.resume_data = &resume_data;
+	std::vector<boost::shared_ptr<loaded_torrent> > torrents;
+	for (int i = 0; i < 3; ++i)
+	{
+		p.ti = new torrent_info(*t);
+		torrents.push_back(boost::shared_ptr<loaded_torrent>(new loaded_torrent(p)));
+	}
+
+	torrent_loader tl(ios, fp, boost::bind(&on_torrent_loaded, _1, &loaded));
+	tl.queue(torrents, 2);
+	for (int i = 0; i < 100 && loaded < 3; ++i)
+	{
+		ios.reset();
+		if (ios.poll(ec) == 0) test_sleep(50);
+	}
+	TEST_EQUAL(loaded, 3);
+	TEST_EQUAL(tl.num_queued(), 0);
+
+	// all three torrents stat the same file, which leaves
+	// one entry in the stat cache
+	TEST_EQUAL(fp.stat_cache_size(), 1);
+	file_status s;
+	std::string path = combine_path(save_path, "temporary");
+	TEST_CHECK(fp.take_file_status(path, &s, ec));
+	TEST_CHECK(!ec);
+	TEST_EQUAL(s.file_size, t->total_size());
+	TEST_CHECK(!fp.take_file_status(path, &s, ec));
+
+	// an entry left behind by a torrent that's never checked
+	// expires, and isn't used by a later check
+	fp.set_stat_cache_age(milliseconds(100));
+	torrents.clear();
+	p.ti = new torrent_info(*t);
+	torrents.push_back(boost::shared_ptr<loaded_torrent>(new loaded_torrent(p)));
+	tl.queue(torrents, 2);
+	for (int i = 0; i < 100 && loaded < 4; ++i)
+	{
+		ios.reset();
+		if (ios.poll(ec) == 0) test_sleep(50);
+	}
+	TEST_EQUAL(loaded, 4);
+	test_sleep(200);
+	TEST_CHECK(!fp.take_file_status(path, &s, ec));
+
+	tl.abort();
+
+	// a torrent whose handler never gets to run is freed along
+	// with the io_service
+	boost::weak_ptr<loaded_torrent> dropped;
+	{
+		io_service ios2;
+		torrent_loader tl2(ios2, fp, boost::bind(&on_torrent_loaded, _1, &loaded));
+		torrents.clear();
+		p.ti = new torrent_info(*t);
+		torrents.push_back(boost::shared_ptr<loaded_torrent>(new loaded_torrent(p)));
+		dropped = torrents.back();
+		tl2.queue(torrents, 1);
+		torrents.clear();
+		for (int i = 0; i < 100 && tl2.num_queued() > 0; ++i) test_sleep(50);
+		tl2.abort();
+	}
+	TEST_CHECK(dropped.expired());
+	TEST_EQUAL(loaded, 4);
+
+	remove_all(save_path, ec);
+}
+
 void run_elevator_test()
 {
 	io_service ios;
@@ -527,7 +740,7 @@ void run_storage_tests(boost::intrusive_ptr<torrent_info> info
 
 	error_code ec;
 	bool done = false;
-	lazy_entry frd;
+	bdecode_node frd;
 	pm->async_check_fastresume(&frd, boost::bind(&on_check_resume_data, _1, _2, &done));
 	ios.reset();
 	run_until(ios, done);
@@ -589,6 +802,11 @@ void run_storage_tests(boost::intrusive_ptr<torrent_info> info
 	pm->async_read(r, boost::bind(&on_read_piece, _1, _2, piece1, block_size));
 	r.piece = 2;
 	pm->async_read(r, boost::bind(&on_read_piece, _1, _2, piece2, block_size));
+
+	done = false;
+	pm->async_hash_blocks(1, 1234, boost::bind(&on_hash_blocks, _1, _2, piece1, 1234, &done));
+	run_until(ios, done);
+
 	std::cerr << "async_release_files" << std::endl;
 	done = false;
 	pm->async_release_files(boost::bind(&signal_bool, &done, "async_release_files"));
@@ -736,7 +954,7 @@ void test_check_files(std::string const& test_path
 	libtorrent::mutex lock;
 
 	bool done = false;
-	lazy_entry frd;
+	bdecode_node frd;
 	pm->async_check_fastresume(&frd, boost::bind(&on_check_resume_data, _1, _2, &done));
 	ios.reset();
 	run_until(ios, done);
@@ -754,6 +972,59 @@ void test_check_files(std::string const& test_path
 	io.join();
 }
 
+bool cancel_at(int piece, int cancel_piece, int* last_piece)
+{
+	*last_piece = piece;
+	return piece != cancel_piece;
+}
+
+void test_set_piece_hashes(std::string const& test_path)
+{
+	error_code ec;
+	const int piece_size = 16 * 1024;
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+	create_directory(combine_path(test_path, "temp_storage"), ec);
+	if (ec) std::cerr << "create_directory: " << ec.message() << std::endl;
+
+	int const sizes[] = { piece_size * 3 + 100, 10, piece_size * 5 + 7 };
+	char const* names[] = { "temp_storage/test1.tmp", "temp_storage/test2.tmp"
+		, "temp_storage/test3.tmp" };
+	file_storage fs;
+	for (int i = 0; i < 3; ++i)
+	{
+		std::vector<char> data(sizes[i]);
+		std::generate(data.begin(), data.end(), &std::rand);
+		std::ofstream f(combine_path(test_path, names[i]).c_str()
+			, std::ios::trunc | std::ios::binary);
+		f.write(&data[0], data.size());
+		fs.add_file(names[i], sizes[i]);
+	}
+
+	// hashing the pieces on several threads must
+	// give the same result as hashing them in order
+	libtorrent::create_torrent t1(fs, piece_size, -1, create_torrent::calculate_file_hashes);
+	set_piece_hashes(t1, test_path, ec);
+	TEST_CHECK(!ec);
+
+	libtorrent::create_torrent t2(fs, piece_size, -1, create_torrent::calculate_file_hashes);
+	int last_piece = -1;
+	set_piece_hashes(t2, test_path, boost::bind(&cancel_at, _1, -1, &last_piece), 3, ec);
+	TEST_CHECK(!ec);
+	TEST_EQUAL(last_piece, t2.num_pieces() - 1);
+
+	entry e1 = t1.generate();
+	entry e2 = t2.generate();
+	TEST_CHECK(e1["info"] == e2["info"]);
+
+	// returning false from the progress callback cancels
+	libtorrent::create_torrent t3(fs, piece_size, -1, 0);
+	set_piece_hashes(t3, test_path, boost::bind(&cancel_at, _1, 2, &last_piece), 3, ec);
+	TEST_CHECK(ec == asio::error::operation_aborted);
+	TEST_EQUAL(last_piece, 2);
+
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+}
+
 void run_test(std::string const& test_path, bool unbuffered)
 {
 	std::cerr << "\n=== " << test_path << " ===\n" << std::endl;
@@ -1028,6 +1299,8 @@ int test_main()
 {
 
 	run_elevator_test();
+	test_file_storage_index();
+	test_stat_cache();
 
 	// initialize test pieces
 	for (char* p = piece0, *end(piece0 + piece_size); p < end; ++p)
@@ -1053,6 +1326,8 @@ int test_main()
 		}
 	}
 
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_set_piece_hashes, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_torrent_loader, _1));
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_fastresume, _1));
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_rename_file_in_fastresume, _1));
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&run_test, _1, true));
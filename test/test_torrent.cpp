@@ -37,6 +37,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/create_torrent.hpp"
 #include "libtorrent/alert_types.hpp"
 #include "libtorrent/thread.hpp"
+#include "libtorrent/file.hpp"
 #include <boost/tuple/tuple.hpp>
 #include <iostream>
 
@@ -128,8 +129,296 @@ void test_running_torrent(boost::intrusive_ptr<torrent_info> info, size_type fil
 	}
 }
 
+void test_unload_torrent()
+{
+	file_storage fs;
+	fs.add_file("test_unload_dir/tmp1", 0x4000);
+	fs.add_file("test_unload_dir/tmp2", 0x4000);
+	fs.add_file("test_unload_dir/tmp3", 0x4000);
+	libtorrent::create_torrent t(fs, 0x4000);
+	for (int i = 0; i < t.num_pieces(); ++i)
+		t.set_hash(i, sha1_hash(0));
+
+	std::vector<char> tmp;
+	std::back_insert_iterator<std::vector<char> > out(tmp);
+	bencode(out, t.generate());
+	error_code ec;
+	boost::intrusive_ptr<torrent_info> info(new torrent_info(&tmp[0], tmp.size(), ec));
+	TEST_CHECK(!ec);
+
+	session ses(fingerprint("LT", 0, 1, 0, 0), std::make_pair(48150, 48160), "0.0.0.0", 0);
+	ses.set_alert_mask(alert::storage_notification);
+	session_settings sett = ses.settings();
+	sett.metadata_unload_timeout = 1;
+	sett.metadata_cache_path = "test_unload_cache";
+	ses.set_settings(sett);
+
+	add_torrent_params p;
+	p.ti = info;
+	p.save_path = ".";
+	p.flags &= ~(add_torrent_params::flag_paused | add_torrent_params::flag_auto_managed);
+	torrent_handle h = ses.add_torrent(p, ec);
+
+	torrent_status st;
+	for (int i = 0; i < 100; ++i)
+	{
+		st = h.status(0);
+		if (st.state != torrent_status::queued_for_checking
+			&& st.state != torrent_status::checking_files
+			&& st.state != torrent_status::checking_resume_data)
+			break;
+		test_sleep(100);
+	}
+	TEST_EQUAL(st.state, torrent_status::downloading);
+
+	std::vector<int> prio(3, 1);
+	prio[0] = 0;
+	prio[2] = 7;
+	h.prioritize_files(prio);
+
+	// a paused torrent with no connections goes dormant, and is
+	// evicted metadata_unload_timeout seconds later
+	h.pause();
+	h.connect_peer(tcp::endpoint(address_v4::from_string("10.0.0.1"), 6881));
+	h.connect_peer(tcp::endpoint(address_v4::from_string("10.0.0.2"), 6882));
+	test_sleep(100);
+	TEST_EQUAL(h.status(0).list_peers, 2);
+
+	for (int i = 0; i < 300; ++i)
+	{
+		st = h.status(0);
+		if (!st.is_loaded) break;
+		test_sleep(100);
+	}
+	TEST_CHECK(!st.is_loaded);
+	TEST_EQUAL(st.list_peers, 0);
+
+	// the file priorities are kept in memory, and don't load the torrent
+	TEST_CHECK(h.file_priorities() == prio);
+	TEST_EQUAL(h.file_priority(2), 7);
+	TEST_CHECK(!h.status(0).is_loaded);
+
+	// file progress needs the file list, and loads the torrent back
+	std::vector<size_type> fp;
+	h.file_progress(fp);
+	TEST_EQUAL(fp.size(), 3);
+	st = h.status(0);
+	TEST_CHECK(st.is_loaded);
+	TEST_EQUAL(st.list_peers, 2);
+	TEST_CHECK(h.file_priorities() == prio);
+
+	// the synchronous resume data includes the peers and file sizes
+	// even if the torrent was evicted before it was written
+	for (int i = 0; i < 300; ++i)
+	{
+		if (!h.status(0).is_loaded) break;
+		test_sleep(100);
+	}
+	TEST_CHECK(!h.status(0).is_loaded);
+#ifndef TORRENT_NO_DEPRECATE
+	entry rd = h.write_resume_data();
+	TEST_CHECK(rd.find_key("peers") && rd["peers"].string().size() == 12);
+	TEST_CHECK(rd.find_key("file sizes") && rd["file sizes"].list().size() == 3);
+
+	// get_torrent_info() loads the torrent, but doesn't keep
+	// it from being evicted again
+	for (int i = 0; i < 300; ++i)
+	{
+		if (!h.status(0).is_loaded) break;
+		test_sleep(100);
+	}
+	TEST_CHECK(!h.status(0).is_loaded);
+	TEST_EQUAL(h.get_torrent_info().num_files(), 3);
+	TEST_CHECK(h.status(0).is_loaded);
+#endif
+
+	// a pinned torrent is loaded, and stays loaded until it's unpinned
+	h.pin_metadata();
+	TEST_CHECK(h.status(0).is_loaded);
+	test_sleep(3000);
+	TEST_CHECK(h.status(0).is_loaded);
+
+	h.unpin_metadata();
+	for (int i = 0; i < 300; ++i)
+	{
+		if (!h.status(0).is_loaded) break;
+		test_sleep(100);
+	}
+	TEST_CHECK(!h.status(0).is_loaded);
+
+	ses.remove_torrent(h);
+	remove_all("test_unload_cache", ec);
+}
+
+// waits for the next state_delta_alert and copies the delta for ``h``
+// into ``d``. Returns false if there was no delta for ``h``
+bool wait_for_delta(session& ses, torrent_handle const& h, torrent_delta& d)
+{
+	for (int i = 0; i < 50; ++i)
+	{
+		ses.wait_for_alert(milliseconds(100));
+		std::auto_ptr<alert> a = ses.pop_alert();
+		if (!a.get()) continue;
+		state_delta_alert const* sd = alert_cast<state_delta_alert>(a.get());
+		if (sd == 0) continue;
+		for (std::vector<torrent_delta>::const_iterator j = sd->deltas.begin()
+			, end(sd->deltas.end()); j != end; ++j)
+		{
+			if (j->handle != h) continue;
+			d = *j;
+			return true;
+		}
+		return false;
+	}
+	return false;
+}
+
+void test_torrent_deltas()
+{
+	file_storage fs;
+	fs.add_file("test_delta_dir/tmp1", 0x4000);
+	libtorrent::create_torrent t(fs, 0x4000);
+	t.set_hash(0, sha1_hash(0));
+
+	std::vector<char> tmp;
+	std::back_insert_iterator<std::vector<char> > out(tmp);
+	bencode(out, t.generate());
+	error_code ec;
+	boost::intrusive_ptr<torrent_info> info(new torrent_info(&tmp[0], tmp.size(), ec));
+	TEST_CHECK(!ec);
+
+	session ses(fingerprint("LT", 0, 1, 0, 0), std::make_pair(48160, 48170), "0.0.0.0", 0);
+	ses.set_alert_mask(alert::status_notification);
+
+	add_torrent_params p;
+	p.ti = info;
+	p.save_path = ".";
+	p.flags |= add_torrent_params::flag_paused;
+	p.flags &= ~add_torrent_params::flag_auto_managed;
+	torrent_handle h = ses.add_torrent(p, ec);
+
+	typedef torrent_delta td;
+	boost::uint64_t const fields = td::field_bit(td::paused)
+		| td::field_bit(td::auto_managed) | td::field_bit(td::queue_position);
+
+	// the first delta for a torrent contains all requested fields
+	torrent_delta d;
+	ses.post_torrent_deltas(fields);
+	TEST_CHECK(wait_for_delta(ses, h, d));
+	TEST_EQUAL(d.changed, fields);
+	TEST_EQUAL(d.value(td::paused), 1);
+	TEST_EQUAL(d.value(td::auto_managed), 0);
+
+	// posting deltas must not empty the queue of post_torrent_updates()
+	ses.post_torrent_updates(0);
+	bool found = false;
+	for (int i = 0; i < 50 && !found; ++i)
+	{
+		ses.wait_for_alert(milliseconds(100));
+		std::auto_ptr<alert> a = ses.pop_alert();
+		state_update_alert const* su = alert_cast<state_update_alert>(a.get());
+		if (su == 0) continue;
+		for (std::vector<torrent_status>::const_iterator j = su->status.begin()
+			, end(su->status.end()); j != end; ++j)
+			if (j->handle == h) found = true;
+		break;
+	}
+	TEST_CHECK(found);
+
+	// only the field that changed since the last delta is included
+	h.resume();
+	ses.post_torrent_deltas(fields);
+	TEST_CHECK(wait_for_delta(ses, h, d));
+	TEST_EQUAL(d.changed, td::field_bit(td::paused));
+	TEST_CHECK(d.has(td::paused));
+	TEST_CHECK(!d.has(td::auto_managed));
+	TEST_CHECK(!d.has(td::queue_position));
+	TEST_EQUAL(d.value(td::paused), 0);
+}
+
+// waits for exactly the torrents h[expected[0]] ... h[expected[num - 1]]
+// to be running. expected must be sorted
+bool wait_for_running(std::vector<torrent_handle> const& h
+	, int const* expected, int num)
+{
+	std::vector<int> running;
+	for (int i = 0; i < 100; ++i)
+	{
+		running.clear();
+		for (int k = 0; k < int(h.size()); ++k)
+			if (!h[k].status(0).paused) running.push_back(k);
+		if (running == std::vector<int>(expected, expected + num)) return true;
+		test_sleep(100);
+	}
+	for (int k = 0; k < int(running.size()); ++k)
+		fprintf(stderr, "running: %d\n", running[k]);
+	return false;
+}
+
+void test_auto_manage()
+{
+	session ses(fingerprint("LT", 0, 1, 0, 0), std::make_pair(48210, 48220), "0.0.0.0", 0);
+	session_settings sett = ses.settings();
+	sett.active_downloads = 2;
+	sett.active_seeds = 2;
+	sett.active_limit = 10;
+	sett.dont_count_slow_torrents = false;
+	sett.auto_manage_interval = 1;
+	ses.set_settings(sett);
+
+	std::vector<torrent_handle> h;
+	for (int i = 0; i < 6; ++i)
+	{
+		char name[100];
+		snprintf(name, sizeof(name), "test_auto_manage/tmp%d", i);
+		file_storage fs;
+		fs.add_file(name, 0x4000);
+		libtorrent::create_torrent t(fs, 0x4000);
+		t.set_hash(0, sha1_hash(0));
+
+		std::vector<char> tmp;
+		std::back_insert_iterator<std::vector<char> > out(tmp);
+		bencode(out, t.generate());
+		error_code ec;
+		add_torrent_params p;
+		p.ti = new torrent_info(&tmp[0], tmp.size(), ec);
+		p.save_path = ".";
+		// torrents are added paused and auto managed by default
+		h.push_back(ses.add_torrent(p, ec));
+		TEST_CHECK(!ec);
+	}
+
+	// the first two in the queue are started, the others stay paused
+	int const first[] = { 0, 1 };
+	TEST_CHECK(wait_for_running(h, first, 2));
+
+	// moving a torrent to the top of the queue starts it, and pauses
+	// the one it pushed past the limit
+	h[5].queue_position_top();
+	int const top[] = { 0, 5 };
+	TEST_CHECK(wait_for_running(h, top, 2));
+
+	// a torrent that's paused and taken out of auto management frees
+	// its slot for the next one in the queue
+	h[0].auto_managed(false);
+	h[0].pause();
+	int const manual[] = { 1, 5 };
+	TEST_CHECK(wait_for_running(h, manual, 2));
+
+	TEST_CHECK(ses.status().auto_manage_evaluations > 0);
+
+	for (int i = 0; i < int(h.size()); ++i)
+		ses.remove_torrent(h[i]);
+	error_code ec;
+	remove_all("test_auto_manage", ec);
+}
+
 int test_main()
 {
+	test_unload_torrent();
+	test_torrent_deltas();
+	test_auto_manage();
+
 	{
 		remove("test_torrent_dir2/tmp1");
 		remove("test_torrent_dir2/tmp2");
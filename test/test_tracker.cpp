@@ -35,11 +35,181 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/alert.hpp"
 #include "libtorrent/session.hpp"
 #include "libtorrent/error_code.hpp"
+#include "libtorrent/alert_types.hpp"
+#include "libtorrent/tracker_manager.hpp" // for tracker_request
 
 #include <fstream>
 
 using namespace libtorrent;
 
+// returns the events the UDP tracker has seen for ih, in order,
+// starting at the first event
+std::vector<int> announce_events(sha1_hash const& ih, int first)
+{
+	std::vector<std::pair<sha1_hash, int> > events = udp_tracker_announces();
+	std::vector<int> ret;
+	for (int i = first; i < int(events.size()); ++i)
+		if (events[i].first == ih) ret.push_back(events[i].second);
+	return ret;
+}
+
+// waits for num scrape reply or scrape failed alerts
+void wait_for_scrapes(session& ses, int num, int* replies, int* failures)
+{
+	*replies = 0;
+	*failures = 0;
+	for (int i = 0; i < 50 && *replies + *failures < num; ++i)
+	{
+		ses.wait_for_alert(milliseconds(100));
+		std::deque<alert*> alerts;
+		ses.pop_alerts(&alerts);
+		for (std::deque<alert*>::iterator j = alerts.begin()
+			, end(alerts.end()); j != end; ++j)
+		{
+			if (scrape_reply_alert* sr = alert_cast<scrape_reply_alert>(*j))
+			{
+				// the test tracker reports the first byte of the
+				// info-hash as the number of seeds
+				TEST_EQUAL(sr->complete, sr->handle.info_hash()[0]);
+				++*replies;
+			}
+			else if (alert_cast<scrape_failed_alert>(*j))
+			{
+				++*failures;
+			}
+			delete *j;
+		}
+	}
+}
+
+void test_udp_tracker_queue(int udp_port)
+{
+	session ses(fingerprint("LT", 0, 1, 0, 0), std::make_pair(48975, 49000), "0.0.0.0", 0
+		, alert::tracker_notification | alert::error_notification);
+
+	session_settings sett;
+	sett.announce_to_all_trackers = true;
+	sett.announce_to_all_tiers = true;
+	ses.set_settings(sett);
+
+	char tracker_url[200];
+	snprintf(tracker_url, sizeof(tracker_url), "udp://127.0.0.1:%d/announce", udp_port);
+
+	error_code ec;
+	create_directory("tmp3_tracker", ec);
+	torrent_handle h[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		boost::intrusive_ptr<torrent_info> t = ::create_torrent(0, 16 * 1024, 13 + i, false);
+		t->add_tracker(tracker_url, 0);
+		add_torrent_params addp;
+		addp.flags |= add_torrent_params::flag_paused;
+		addp.flags &= ~add_torrent_params::flag_auto_managed;
+		addp.ti = t;
+		addp.save_path = "tmp3_tracker";
+		h[i] = ses.add_torrent(addp);
+	}
+
+	// ========================================
+	// scrapes to the same UDP tracker are sent in one packet
+	// ========================================
+
+	int prev_scrapes = g_udp_tracker_scrapes;
+	for (int i = 0; i < 3; ++i) h[i].scrape_tracker();
+	int replies = 0;
+	int failures = 0;
+	wait_for_scrapes(ses, 3, &replies, &failures);
+	TEST_EQUAL(replies, 3);
+	TEST_EQUAL(failures, 0);
+	TEST_EQUAL(g_udp_tracker_scrapes, prev_scrapes + 1);
+
+	// a tracker that only answers the first info-hash fails
+	// the other scrapes in the packet
+	g_udp_tracker_scrape_responses = 1;
+	prev_scrapes = g_udp_tracker_scrapes;
+	for (int i = 0; i < 3; ++i) h[i].scrape_tracker();
+	wait_for_scrapes(ses, 3, &replies, &failures);
+	TEST_EQUAL(replies, 1);
+	TEST_EQUAL(failures, 2);
+	TEST_EQUAL(g_udp_tracker_scrapes, prev_scrapes + 1);
+	g_udp_tracker_scrape_responses = -1;
+
+	// ========================================
+	// with a rate limit, announces that are held back are sent
+	// in the order they were made
+	// ========================================
+
+	sett.tracker_host_requests_per_second = 1;
+	ses.set_settings(sett);
+
+	int first_event = udp_tracker_announces().size();
+	for (int i = 0; i < 3; ++i) h[i].resume();
+
+	for (int i = 0; i < 50; ++i)
+	{
+		test_sleep(100);
+		if (int(udp_tracker_announces().size()) >= first_event + 3) break;
+	}
+	std::vector<std::pair<sha1_hash, int> > events = udp_tracker_announces();
+	TEST_EQUAL(int(events.size()), first_event + 3);
+	for (int i = 0; i < 3 && first_event + i < int(events.size()); ++i)
+	{
+		TEST_CHECK(events[first_event + i].first == h[i].info_hash());
+		TEST_EQUAL(events[first_event + i].second, tracker_request::started);
+	}
+
+	for (int i = 0; i < 3; ++i) h[i].pause();
+	test_sleep(500);
+
+	// ========================================
+	// a stopped event drops the requests from the same torrent
+	// that are still held back by the rate limit, instead of
+	// sending them after it
+	// ========================================
+
+	boost::intrusive_ptr<torrent_info> t = ::create_torrent(0, 16 * 1024, 20, false);
+	t->add_tracker(tracker_url, 0);
+	// the same tracker host, so it's subject to the same rate limit
+	snprintf(tracker_url, sizeof(tracker_url), "udp://127.0.0.1:%d/announce2", udp_port);
+	t->add_tracker(tracker_url, 0);
+	add_torrent_params addp;
+	addp.flags &= ~add_torrent_params::flag_paused;
+	addp.flags &= ~add_torrent_params::flag_auto_managed;
+	addp.ti = t;
+	addp.save_path = "tmp3_tracker";
+	first_event = udp_tracker_announces().size();
+	torrent_handle h2 = ses.add_torrent(addp);
+
+	// wait for the first announce and its response. The second one
+	// is held back for at least a second after it
+	for (int i = 0; i < 30; ++i)
+	{
+		test_sleep(50);
+		if (!announce_events(t->info_hash(), first_event).empty()) break;
+	}
+	test_sleep(200);
+	h2.pause();
+	test_sleep(2500);
+
+	std::vector<int> ev = announce_events(t->info_hash(), first_event);
+	TEST_EQUAL(ev.size(), 2);
+	if (ev.size() == 2)
+	{
+		TEST_EQUAL(ev[0], tracker_request::started);
+		TEST_EQUAL(ev[1], tracker_request::stopped);
+	}
+
+	// the dropped announce doesn't count as a failure, and the
+	// tracker is announced to when the torrent is resumed
+	std::vector<announce_entry> trackers = h2.trackers();
+	TEST_EQUAL(trackers.size(), 2);
+	for (int i = 0; i < int(trackers.size()); ++i)
+	{
+		TEST_CHECK(!trackers[i].updating);
+		TEST_EQUAL(trackers[i].fails, 0);
+	}
+}
+
 int test_main()
 {
 	int http_port = start_web_server();
@@ -161,6 +331,8 @@ int test_main()
 	delete s;
 	fprintf(stderr, "done\n");
 
+	test_udp_tracker_queue(udp_port);
+
 	stop_tracker();
 	stop_web_server();
 
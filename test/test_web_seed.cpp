@@ -47,14 +47,23 @@ POSSIBILITY OF SUCH DAMAGE.
 using namespace libtorrent;
 
 // proxy: 0=none, 1=socks4, 2=socks5, 3=socks5_pw 4=http 5=http_pw
+// parallel: open several connections to the web seed, each with
+// several small pipelined range requests outstanding
 void test_transfer(boost::intrusive_ptr<torrent_info> torrent_file
-	, int proxy, int port, char const* protocol, bool url_seed, bool chunked_encoding, bool test_ban)
+	, int proxy, int port, char const* protocol, bool url_seed, bool chunked_encoding, bool test_ban
+	, bool parallel = false)
 {
 	using namespace libtorrent;
 
 	session ses(fingerprint("  ", 0,0,0,0), 0);
 	session_settings settings;
 	settings.max_queued_disk_bytes = 256 * 1024;
+	if (parallel)
+	{
+		settings.max_web_seed_connections = 3;
+		settings.urlseed_max_request_bytes = 2 * 16 * 1024;
+		settings.urlseed_pipeline_size = 4;
+	}
 	ses.set_settings(settings);
 	ses.set_alert_mask(~(alert::progress_notification | alert::stats_notification));
 	error_code ec;
@@ -360,6 +369,8 @@ int run_suite(char const* protocol, bool test_url_seed, bool chunked_encoding, b
 		test_transfer(torrent_file, 0, port, protocol, test_url_seed, chunked_encoding, test_ban);
 	}
 
+	test_transfer(torrent_file, 0, port, protocol, test_url_seed, chunked_encoding, test_ban, true);
+
 	stop_web_server();
 	remove_all("tmp1_web_seed", ec);
 	return 0;